@@ -706,6 +706,10 @@ class DTblDefBase
 			$this->_attrs['cgiUmask'],
 			$this->_attrs['ext_runOnStartUp'],
 			self::NewIntAttr('extMaxIdleTime', DMsg::ALbl('l_maxidletime'), true, -1),
+			self::NewBoolAttr('autoScale', DMsg::ALbl('l_autoscale')),
+			self::NewIntAttr('autoScaleMinConns', DMsg::ALbl('l_autoscalemin'), true, 1, 2000),
+			self::NewIntAttr('autoScaleWaitMs', DMsg::ALbl('l_autoscalewait'), true, 1, 60000),
+			self::NewIntAttr('autoScaleMinFreeMem', DMsg::ALbl('l_autoscalemem'), true, 0),
 			$this->_attrs['priority']->dup(null, null, 'extAppPriority'),
 			$this->_attrs['memSoftLimit'],
 			$this->_attrs['memHardLimit'],
@@ -284,6 +284,14 @@ class DTblDef extends DTblDefBase
 			self::NewTextAttr('sslSessionTicketKeyFile', DMsg::ALbl('l_sslSessionTicketKeyFile'), 'cust'),
 			self::NewParseTextAttr('sslOcspProxy', DMsg::ALbl('l_ocspproxy'), '/^((http|https):\/\/)?([A-z0-9._\-]+|\[[[:xdigit:]:]+\])(:\d+)$/', DMsg::ALbl('parse_ocspproxy')),
 			self::NewBoolAttr('sslStrictSni', DMsg::ALbl('l_sslStrictSni')),
+			self::NewBoolAttr('sslCertCompress', DMsg::ALbl('l_sslCertCompress')),
+			self::NewBoolAttr('sslLazyCertLoad', DMsg::ALbl('l_sslLazyCertLoad')),
+			self::NewIntAttr('sslCertCacheSize', DMsg::ALbl('l_sslCertCacheSize'), true, 1),
+			self::NewIntAttr('sslCertIdleTimeout', DMsg::ALbl('l_sslCertIdleTimeout'), true, 10),
+			self::NewBoolAttr('sslEarlyData', DMsg::ALbl('l_sslEarlyData')),
+			self::NewBoolAttr('sslAsyncPk', DMsg::ALbl('l_sslAsyncPk')),
+			self::NewIntAttr('sslAsyncPkWorkers', DMsg::ALbl('l_sslAsyncPkWorkers'), true, 1, 64),
+			self::NewIntAttr('sslAsyncPkBatchSize', DMsg::ALbl('l_sslAsyncPkBatchSize'), true, 1, 32),
 		];
 		$this->_tblDef[$id] = DTbl::NewRegular($id, DMsg::ALbl('l_tuningsslsettings'), $attrs, 'sslGlobal');
 	}
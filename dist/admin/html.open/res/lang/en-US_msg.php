@@ -167,6 +167,10 @@ $_gmsg['l_autofix503'] = 'Auto Fix 503 Error';
 $_gmsg['l_autoindex'] = 'Auto Index';
 $_gmsg['l_autoindexuri'] = 'Auto Index URI';
 $_gmsg['l_autoreloadapacheconf'] = 'Auto Reload On Changes';
+$_gmsg['l_autoscale'] = 'Auto Scale Connections';
+$_gmsg['l_autoscalemem'] = 'Auto Scale Min Free Memory (MB)';
+$_gmsg['l_autoscalemin'] = 'Auto Scale Min Connections';
+$_gmsg['l_autoscalewait'] = 'Auto Scale Target Wait (ms)';
 $_gmsg['l_autostart'] = 'Start By Server';
 $_gmsg['l_autoupdatedownload'] = 'Download Updates';
 $_gmsg['l_autoupdateinterval'] = 'Check For Update';
@@ -517,6 +521,14 @@ $_gmsg['l_sslSessionTicketKeyFile'] = 'SSL Session Ticket Key File';
 $_gmsg['l_sslSessionTicketLifetime'] = 'SSL Session Ticket Lifetime (secs)';
 $_gmsg['l_sslSessionTickets'] = 'Enable Session Tickets';
 $_gmsg['l_sslStrictSni'] = 'Strict SNI Certificate';
+$_gmsg['l_sslCertCompress'] = 'Certificate Compression';
+$_gmsg['l_sslLazyCertLoad'] = 'Load Certificates on Demand';
+$_gmsg['l_sslCertCacheSize'] = 'Max Loaded Certificates';
+$_gmsg['l_sslCertIdleTimeout'] = 'Certificate Idle Timeout (secs)';
+$_gmsg['l_sslEarlyData'] = 'Enable TLS 1.3 Early Data';
+$_gmsg['l_sslAsyncPk'] = 'Async Private Key Signing';
+$_gmsg['l_sslAsyncPkWorkers'] = 'Max Async Signing Threads';
+$_gmsg['l_sslAsyncPkBatchSize'] = 'Async Signing Batch Size';
 $_gmsg['l_sslStrongDhKey'] = 'SSL Strong DH Key';
 $_gmsg['l_sslprotocol'] = 'SSL Protocol';
 $_gmsg['l_startupfile'] = 'Startup File';
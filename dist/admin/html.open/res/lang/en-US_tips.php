@@ -138,6 +138,14 @@ $_tipsdb['autoIndexURI'] = new DAttrHelp("Auto Index URI", 'Specifies the URI th
 
 $_tipsdb['autoLoadHtaccess'] = new DAttrHelp("Auto Load from .htaccess", 'Autoload rewrite rules contained in a directory&#039;s .htaccess file when first accessing that directory if an HttpContext for that directory using the <b>rewritefile</b> directive does not already exist. Once initially loaded, a graceful restart must be performed for any further changes to that .htaccess file to take effect.<br/><br/>Virtual Host-level setting overrides Server-level setting. Default values:<br/><br/><b>Server-level:</b> No<br/><br/><b>VH-Level:</b> Inherit Server-level setting', '', 'Select from radio box', '');
 
+$_tipsdb['autoScale'] = new DAttrHelp("Auto Scale Connections", 'Specifies whether to size the connection pool of a local application from the load instead of keeping &quot;Max Connections&quot; processes. The pool starts at [Auto Scale Min Connections] and grows when requests wait in the queue longer than [Auto Scale Target Wait], up to &quot;Max Connections&quot;. Idle connections above the minimum are closed when the load drops.<br/><br/>Default value: No', '', 'Select from radio box', '');
+
+$_tipsdb['autoScaleMinConns'] = new DAttrHelp("Auto Scale Min Connections", 'Specifies the number of connections an auto scaled application starts with and never shrinks below.<br/><br/>Default value: 1', '', 'Integer number', '');
+
+$_tipsdb['autoScaleMinFreeMem'] = new DAttrHelp("Auto Scale Min Free Memory", 'Specifies the amount of free system memory, in MB, below which an auto scaled application will not grow its pool.<br/><br/>Default value: 256', '', 'Integer number', '');
+
+$_tipsdb['autoScaleWaitMs'] = new DAttrHelp("Auto Scale Target Wait", 'Specifies the queue wait time, in milliseconds, above which an auto scaled application adds connections.<br/><br/>Default value: 100', '', 'Integer number', '');
+
 $_tipsdb['autoStart'] = new DAttrHelp("Start By Server", 'Specifies whether you want the web server to start the application automatically. Only FastCGI and LSAPI applications running on the same machine can be started automatically. The IP in the &quot;Address&quot; must be a local IP. Starting through the LiteSpeed CGI Daemon instead of a main server process will help reduce system overhead.<br/><br/>Default value: Yes (Through CGI Daemon)', '', 'Select from drop down list', '');
 
 $_tipsdb['backlog'] = new DAttrHelp("Back Log", 'Specifies the backlog of the listening socket.  Required if &quot;Start By Server&quot; is enabled.', '', 'Integer number', '');
@@ -636,6 +644,12 @@ $_tipsdb['sndBufSize'] = new DAttrHelp("Send Buffer Size (bytes)", 'The sending
 
 $_tipsdb['softLimit'] = new DAttrHelp("Connection Soft Limit", 'Specifies the soft limit of concurrent connections allowed from one IP. This soft limit can be exceeded temporarily during &quot;Grace Period (sec)&quot; as long as the number is below the &quot;Connection Hard Limit&quot;, but Keep-Alive connections will be closed as soon as possible until the number of connections is lower than the limit. If number of connections is still over the limit after the &quot;Grace Period (sec)&quot;, that IP will be blocked for the &quot;Banned Period (sec)&quot;.<br/><br/>For example, if a page contains many small graphs, the browser may try to set up many connections at same time, especially for HTTP/1.0 clients. You would want to allow those connections for a short period.<br/><br/>HTTP/1.1 clients may also set up multiple connections to speed up downloading and SSL  requires separate connections from non-SSL connections. Make sure the limit is set properly,  as not to adversely affect normal service. The recommended limit is between 5 and 10.', ' A lower number will enable serving more distinct clients.<br/> Trusted IPs or sub-networks are not affected.<br/> Set to a high value when you are performing benchmark tests with a large number of concurrent client machines.', 'Integer number', '');
 
+$_tipsdb['sslAsyncPk'] = new DAttrHelp("Async Private Key Signing", 'Specifies whether TLS handshake signatures are computed by a pool of worker threads instead of the event loop. Signatures requested during one event loop pass are handed to the pool as one batch, and the pool grows with the number of pending signatures. Requires BoringSSL.<br/><br/>Default value: No', '', 'Select from radio box', '');
+
+$_tipsdb['sslAsyncPkBatchSize'] = new DAttrHelp("Async Signing Batch Size", 'Specifies the maximum number of signatures handed to a signing thread as one batch when [Async Private Key Signing] is enabled.<br/><br/>Default value: 8', '', 'Integer number between 1 and 32', '');
+
+$_tipsdb['sslAsyncPkWorkers'] = new DAttrHelp("Max Async Signing Threads", 'Specifies the maximum number of signing threads per server process when [Async Private Key Signing] is enabled. One thread is kept running, more are started while signatures are queued.<br/><br/>Default value: 4', '', 'Integer number between 1 and 64', '');
+
 $_tipsdb['sslCert'] = new DAttrHelp("SSL Private Key & Certificate", 'Every SSL listener requires a paired SSL private key and SSL certificate. Multiple SSL listeners can share the same key and certificate.<br/><br/>You can generate SSL private keys yourself using an SSL software package, such as OpenSSL. SSL certificates can also be purchased from an authorized certificate issuer like VeriSign or Thawte. You can also sign the certificate yourself. Self-signed certificates will not be trusted by web browsers and should not be used on public websites containing critical data. However, a self-signed certificate is good enough for internal use, e.g. for encrypting traffic to LiteSpeed Web Server&#039;s WebAdmin Console.', '', '', '');
 
 $_tipsdb['sslDefaultCiphers'] = new DAttrHelp("Default Cipher Suite", 'Default cipher suite for SSL certificates.<br/><br/>Default value: Server Internal Default (Based on current best practices)', '', 'Colon-separated string of cipher specifications.', '');
@@ -660,6 +674,16 @@ $_tipsdb['sslSessionTicketLifetime'] = new DAttrHelp("SSL Session Ticket Lifetim
 
 $_tipsdb['sslSessionTickets'] = new DAttrHelp("Enable Session Tickets", 'Enables session tickets using OpenSSL&#039;s default session ticket setting. Server-level setting must be set to &quot;Yes&quot; for Virtual Host setting to take effect.<br/><br/>Default values:<br/><b>Server-level:</b> Yes<br/><b>VH-Level:</b> Yes', '', 'Select from radio box', '');
 
+$_tipsdb['sslCertCacheSize'] = new DAttrHelp("Max Loaded Certificates", 'Specifies the maximum number of virtual host SSL contexts each worker keeps in memory when [Load Certificates on Demand] is enabled. The least recently used context is unloaded when the limit is reached.<br/><br/>Default value: 1000', '', 'Integer number', '');
+
+$_tipsdb['sslCertCompress'] = new DAttrHelp("Certificate Compression", 'Specifies whether to compress the server certificate chain in TLS 1.3 handshakes (RFC 8879) for clients that support it. The chain is compressed once with brotli, zlib and zstd when the certificate is loaded, so handshakes only copy the cached result. Requires BoringSSL.<br/><br/>Default value: No', '', 'Select from radio box', '');
+
+$_tipsdb['sslCertIdleTimeout'] = new DAttrHelp("Certificate Idle Timeout", 'Specifies how long, in seconds, an SSL context loaded on demand stays in memory without being used before it is unloaded.<br/><br/>Default value: 300', '', 'Integer number', '');
+
+$_tipsdb['sslEarlyData'] = new DAttrHelp("Enable TLS 1.3 Early Data", 'Specifies whether to accept TLS 1.3 early data (0-RTT) from resuming clients, saving one round trip for repeat visitors. Only GET, HEAD and OPTIONS requests without a body are served from early data, other requests get a &quot;425 Too Early&quot; response and are retried by the client after the handshake. Requests served from early data are forwarded to backends with &quot;Early-Data: 1&quot;. Replayed ClientHello messages are detected through shared memory and fall back to a full handshake. Requires BoringSSL.<br/><br/>Default value: No', '', 'Select from radio box', '');
+
+$_tipsdb['sslLazyCertLoad'] = new DAttrHelp("Load Certificates on Demand", 'Specifies whether to load virtual host SSL certificates on the first handshake for the virtual host instead of at startup. This reduces startup time and memory usage on servers with a large number of certificates. The parsed certificate chain is shared between workers through shared memory. Virtual hosts requiring client verification are always loaded at startup.<br/><br/>Default value: No', '', 'Select from radio box', '');
+
 $_tipsdb['sslStrictSni'] = new DAttrHelp("Strict SNI Certificate", 'Specifies whether to strictly require a dedicated virtual host certificate configuration. When enabled, SSL connections to virtual hosts without a dedicated certificate configuration will fail instead of using a default catch-all certificate.<br/><br/>Default value: No', '', 'Select from radio box', '');
 
 $_tipsdb['sslStrongDhKey'] = new DAttrHelp("SSL Strong DH Key", 'Specifies whether to use 2048 or 1024 bit DH keys for SSL handshakes. If set to &quot;Yes&quot;, 2048 bit DH keys will be used for 2048 bit SSL keys and certificates. 1024 bit DH keys will still be used in other situations. Default is &quot;Yes&quot;.<br/><br/>Earlier versions of Java do not support DH key size higher than 1024 bits. If Java client compatibility is required, this should be set to &quot;No&quot;.', '', 'radio', '');
@@ -1311,6 +1311,7 @@ enum LSI_COMPRESS_METHOD
     LSI_NO_COMPRESS = 0,
     LSI_GZIP_COMPRESS,
     LSI_BR_COMPRESS,
+    LSI_ZSTD_COMPRESS,
 };
 
 
@@ -2016,6 +2017,22 @@ struct lsi_module_s
 };
 
 
+/**
+ * @brief lsi_subreq_t m_flag bit, the request headers below are set.
+ */
+#define LSI_SUBREQ_SET_HEADERS  8
+
+/**
+ * @brief lsi_subreq_t m_flag bit, the env variable below is set.
+ */
+#define LSI_SUBREQ_SET_ENV      16
+
+/**
+ * @brief lsi_subreq_t m_flag bit, a background subrequest keeps the Cookie
+ * and Authorization headers of the current request.
+ */
+#define LSI_SUBREQ_KEEP_CREDENTIALS 64
+
 typedef struct lsi_subreq_s
 {
     int             m_flag;
@@ -2026,6 +2043,26 @@ typedef struct lsi_subreq_s
     int             m_qsLen;
     const char     *m_pReqBody;
     int32_t         m_reqBodyLen;
+
+    /**
+     * With LSI_SUBREQ_SET_HEADERS, only the Host, Accept-Encoding and
+     * User-Agent headers of the current request are passed on. The Cookie
+     * header is set to m_pCookie unless it is empty, the User-Agent header
+     * is replaced unless m_pUserAgent is NULL.
+     */
+    const char     *m_pCookie;
+    int             m_cookieLen;
+    const char     *m_pUserAgent;
+    int             m_userAgentLen;
+
+    /**
+     * With LSI_SUBREQ_SET_ENV, set the env variable in the subrequest, a
+     * module can tell its own subrequests by it.
+     */
+    const char     *m_pEnvName;
+    int             m_envNameLen;
+    const char     *m_pEnvValue;
+    int             m_envValueLen;
 } lsi_subreq_t;
 
 
@@ -3048,7 +3085,7 @@ struct lsi_api_s
      * @since 1.0
      *
      * @param[in] pSession - a pointer to the session.
-     * @return 0 no compress, 1 gzip, 2, br.
+     * @return 0 no compress, 1 gzip, 2, br, 3 zstd.
      */
     int (*get_resp_buffer_compress_method)(const lsi_session_t *pSession);
 
@@ -3061,7 +3098,7 @@ struct lsi_api_s
      * @param[in] pSession - a pointer to the session.
      * @param[in] compress_method - compress method;
      *               set 1 if gzip compressed, 2 if br compressed,
-     *               0 to clear the flag.
+     *               3 if zstd compressed, 0 to clear the flag.
      * @return 0 if success, -1 if failure.
      */
     int (*set_resp_buffer_compress_method)(const lsi_session_t *pSession, int method);
@@ -3981,6 +4018,48 @@ struct lsi_api_s
     void (*register_thread_cleanup)(const lsi_module_t *module,
                                     void (*routine)(void *), void * arg);
 
+    /**
+     * @brief exec_bg_subreq starts a detached subrequest in the background.
+     * @details The subrequest is a copy of the current request with the URI,
+     * query string and method of pSubReq, it runs through the normal
+     * request processing from the event queue and its response is
+     * discarded. It is not affected when the current session ends. The
+     * Cookie and Authorization headers of the current request are not
+     * passed on unless LSI_SUBREQ_KEEP_CREDENTIALS is set, the Cookie of
+     * pSubReq with LSI_SUBREQ_SET_HEADERS is. The SSL session of the
+     * connection is not used. A module can tell it apart
+     * with the IS_SUBREQ request variable.
+     * @ingroup session
+     *
+     * @param[in] session - current session.
+     * @param[in] pSubReq - the subrequest, the strings are copied.
+     * @return 0 on success, -1 on failure.
+     */
+    int (*exec_bg_subreq)(const lsi_session_t *session,
+                          lsi_subreq_t *pSubReq);
+
+    /**
+     * @brief hold_bg_session keeps a detached copy of the current request to
+     * start background subrequests from, when no request is at hand.
+     * @details The copy is never processed itself. It has the minimal
+     * header set of LSI_SUBREQ_SET_HEADERS, no credentials, and counts as a
+     * connection from localhost. Pass it to exec_bg_subreq as the session,
+     * free it with release_bg_session.
+     * @ingroup session
+     *
+     * @param[in] session - current session.
+     * @return the copy, NULL on failure.
+     */
+    const lsi_session_t *(*hold_bg_session)(const lsi_session_t *session);
+
+    /**
+     * @brief release_bg_session frees a copy made by hold_bg_session.
+     * @ingroup session
+     *
+     * @param[in] session - the copy.
+     */
+    void (*release_bg_session)(const lsi_session_t *session);
+
 };
 
 /**
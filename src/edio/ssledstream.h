@@ -26,6 +26,7 @@ public:
     int initSsl(SslContext *ctx, ls_str_t *sni, bool enable_h2,
                 SslClientSessCache *cache);
     int verifySni(ls_str_t *sni);
+    SslConnection *getSsl() const   {   return m_ssl;   }
     void takeover(EdStream * old, SslConnection *ssl);
 
     void continueRead() override;
@@ -16,6 +16,7 @@
 *    along with this program. If not, see http://www.gnu.org/licenses/.      *
 *****************************************************************************/
 #include "extconn.h"
+#include "extconnboard.h"
 #include "extrequest.h"
 #include "extworker.h"
 
@@ -34,6 +35,8 @@ ExtConn::ExtConn()
     , m_iToClose(0)
     , m_iInProcess(0)
     , m_iCPState(0)
+    , m_iCounted(0)
+    , m_iPrepared(0)
     , m_tmLastAccess(0)
     , m_iReqProcessed(0)
     , m_pWorker(NULL)
@@ -117,6 +120,13 @@ int ExtConn::close()
         m_iState = DISCONNECTED;
         m_iInProcess = 0;
     }
+    m_iPrepared = 0;
+    if (m_iCounted)
+    {
+        m_iCounted = 0;
+        if (m_pWorker->getConnBoard())
+            m_pWorker->getConnBoard()->closed();
+    }
     return 0;
 }
 
@@ -158,6 +168,11 @@ int ExtConn::connectEx(Multiplexer *pMplx)
         m_tmLastAccess = DateTime::s_curTime;
         ::fcntl(fd, F_SETFD, FD_CLOEXEC);
         init(fd, pMplx);
+        if (m_pWorker->getConnBoard())
+        {
+            m_pWorker->getConnBoard()->opened();
+            m_iCounted = 1;
+        }
         if (ret == 0)
         {
             m_iState = PROCESSING;
@@ -198,6 +213,16 @@ int ExtConn::onInitConnected()
         LS_DBG_L(this, "Connected to [%s] on local address [%s:%u]!",
                  m_pWorker->getURL(), achAddr, port);
     }
+    if (m_iPrepared)
+    {
+        m_iPrepared = 0;
+        if (!getReq())
+        {
+            suspendWrite();
+            m_pWorker->recycleConn(this);
+            return 1;
+        }
+    }
     return 0;
 }
 
@@ -350,6 +375,8 @@ void ExtConn::onSecTimer()
     {
         LS_DBG_L(this, "Idle connection timed out, close!");
         close();
+        if (m_pWorker->getConnBoard())
+            m_pWorker->getConnBoard()->trimmed();
         m_pWorker->getConnPool().removeConn(this);
     }
 
@@ -35,6 +35,8 @@ class ExtConn : public EdStream, public IConnection
     char            m_iToClose;
     char            m_iInProcess;
     char            m_iCPState;
+    char            m_iCounted;
+    char            m_iPrepared;
     time_t          m_tmLastAccess;
     int             m_iReqProcessed;
     ExtWorker      *m_pWorker;
@@ -83,6 +85,9 @@ public:
     void  setCPState(char s)        {   m_iCPState = s;         }
     char  getCPState() const        {   return m_iCPState;      }
 
+    //Opened ahead of the load, goes to the pool once connected.
+    void  setPrepared(char s)       {   m_iPrepared = s;        }
+
     void  access(time_t tm)         {   m_tmLastAccess = tm;    }
     time_t getLastAccess() const    {   return m_tmLastAccess;  }
 
@@ -0,0 +1,388 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2022  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+#include "extconnboard.h"
+
+#include <http/httpserverconfig.h>
+#include <log4cxx/logger.h>
+#include <lsr/ls_atomic.h>
+#include <lsr/ls_strtool.h>
+#include <shm/lsshm.h>
+#include <shm/lsshmhash.h>
+#include <shm/lsshmpool.h>
+#include <util/datetime.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define shmExtConnBoard     "ExtConnBoard"
+
+
+struct ExtConnProc_s
+{
+    int32_t     x_pid;
+    int32_t     x_iOpen;
+    int32_t     x_iIdle;
+    int32_t     x_iWaiting;
+    int32_t     x_tmBeat;
+};
+
+
+struct ExtConnScore_s
+{
+    int32_t     x_iTotal;
+    int32_t     x_iMaxConns;
+    uint64_t    x_iConnects;
+    uint64_t    x_iReuses;
+    uint64_t    x_iRefused;
+    uint64_t    x_iTrimmed;
+    uint64_t    x_iDonated;
+    ExtConnProc_t x_procs[EXTCONNBOARD_MAX_PROCS];
+};
+
+
+LsShmHash *ExtConnBoard::s_pBoard = NULL;
+DLinkQueue ExtConnBoard::s_boards;
+
+
+ExtConnBoard::ExtConnBoard()
+    : m_offset(0)
+    , m_iProc(-1)
+    , m_iMaxConns(0)
+{
+}
+
+
+ExtConnBoard::~ExtConnBoard()
+{
+    ExtConnProc_t *pProc = getProc();
+    ExtConnScore_t *pScore = getScore();
+    if (pProc && pProc->x_pid == getpid())
+    {
+        s_pBoard->lock();
+        reclaim(pScore, m_iProc, pProc->x_pid);
+        s_pBoard->unlock();
+    }
+    if (next())
+        s_boards.remove(this);
+}
+
+
+int ExtConnBoard::init(const char *pVHost, const char *pName, int iMaxConns)
+{
+    LsShm *pShm;
+    LsShmPool *pPool;
+    ExtConnScore_t *pScore;
+    ExtConnProc_t *pProc;
+    char achKey[512];
+    int len, valLen;
+
+    m_iProc = HttpServerConfig::getInstance().getProcNo() - 1;
+    if (m_iProc < 0)
+        m_iProc = 0;
+    if (m_iProc >= EXTCONNBOARD_MAX_PROCS)
+        return LS_FAIL;
+    if (!s_pBoard)
+    {
+        if ((pShm = LsShm::open(shmExtConnBoard, 0)) == NULL)
+            return LS_FAIL;
+        if ((pPool = pShm->getGlobalPool()) == NULL)
+            return LS_FAIL;
+        s_pBoard = pPool->getNamedHash(shmExtConnBoard, 500,
+                                       LsShmHash::hashXXH32, memcmp, 0);
+        if (!s_pBoard)
+            return LS_FAIL;
+        s_pBoard->disableAutoLock();
+    }
+
+    len = snprintf(achKey, sizeof(achKey), "%s\t%s", pVHost ? pVHost : "",
+                   pName);
+    if (len >= (int)sizeof(achKey))
+        len = sizeof(achKey) - 1;
+    m_sName.setStr(pName);
+    s_pBoard->lock();
+    m_offset = s_pBoard->find(achKey, len, &valLen);
+    if (m_offset != 0 && valLen < (int)sizeof(ExtConnScore_t))
+    {
+        s_pBoard->remove(achKey, len);
+        m_offset = 0;
+    }
+    if (m_offset == 0)
+    {
+        ExtConnScore_t score;
+        memset(&score, 0, sizeof(score));
+        m_offset = s_pBoard->insert(achKey, len, &score, sizeof(score));
+    }
+    if (m_offset != 0)
+    {
+        pScore = getScore();
+        pProc = &pScore->x_procs[m_iProc];
+        //The slot was left by the previous process with the same number.
+        if (pProc->x_pid != getpid())
+            reclaim(pScore, m_iProc, pProc->x_pid);
+        pProc->x_pid = getpid();
+        pProc->x_tmBeat = DateTime::s_curTime;
+        pScore->x_iMaxConns = iMaxConns;
+        //Left by a previous server instance or a crashed process
+        reconcile(pScore);
+    }
+    s_pBoard->unlock();
+    if (m_offset == 0)
+        return LS_FAIL;
+    m_iMaxConns = iMaxConns;
+    s_boards.append(this);
+    return LS_OK;
+}
+
+
+void ExtConnBoard::setMaxConns(int iMaxConns)
+{
+    ExtConnScore_t *pScore = getScore();
+    m_iMaxConns = iMaxConns;
+    if (pScore)
+        pScore->x_iMaxConns = iMaxConns;
+}
+
+
+ExtConnScore_t *ExtConnBoard::getScore() const
+{
+    if (m_offset == 0)
+        return NULL;
+    return (ExtConnScore_t *)s_pBoard->offset2ptr(m_offset);
+}
+
+
+ExtConnProc_t *ExtConnBoard::getProc() const
+{
+    ExtConnScore_t *pScore = getScore();
+    if (!pScore)
+        return NULL;
+    return &pScore->x_procs[m_iProc];
+}
+
+
+/**
+ * Give back the connections still charged to a slot, must be called with
+ * the board locked.
+ */
+void ExtConnBoard::reclaim(ExtConnScore_t *pScore, int idx, pid_t pid)
+{
+    ExtConnProc_t *pProc = &pScore->x_procs[idx];
+    if (pProc->x_pid != pid)
+        return;
+    if (pProc->x_iOpen > 0
+        && ls_atomic_sub(&pScore->x_iTotal, pProc->x_iOpen) < 0)
+        ls_atomic_setint(&pScore->x_iTotal, 0);
+    memset(pProc, 0, sizeof(*pProc));
+}
+
+
+/**
+ * Reclaim the slots of dead or stale processes and recount the total from
+ * the live slots, must be called with the board locked. A process adding a
+ * connection at the same moment may be off by one until the next pass.
+ */
+void ExtConnBoard::reconcile(ExtConnScore_t *pScore)
+{
+    ExtConnProc_t *pProc;
+    int32_t total = 0;
+    pid_t pid;
+    for (int i = 0; i < EXTCONNBOARD_MAX_PROCS; ++i)
+    {
+        pProc = &pScore->x_procs[i];
+        if ((pid = pProc->x_pid) == 0)
+            continue;
+        if (i != m_iProc
+            && ((kill(pid, 0) == -1 && errno == ESRCH)
+                || DateTime::s_curTime - pProc->x_tmBeat
+                   > EXTCONNBOARD_STALE_SECS))
+        {
+            LS_DBG_L("[%s] Reclaim %d connections of process %d.",
+                     m_sName.c_str(), pProc->x_iOpen, (int)pid);
+            reclaim(pScore, i, pid);
+            continue;
+        }
+        if (pProc->x_iOpen > 0)
+            total += pProc->x_iOpen;
+    }
+    if (ls_atomic_value(&pScore->x_iTotal) != total)
+    {
+        LS_DBG_L("[%s] Connection total %d corrected to %d.",
+                 m_sName.c_str(), ls_atomic_value(&pScore->x_iTotal), total);
+        ls_atomic_setint(&pScore->x_iTotal, total);
+    }
+}
+
+
+bool ExtConnBoard::canOpen()
+{
+    ExtConnScore_t *pScore = getScore();
+    if (!pScore || m_iMaxConns <= 0)
+        return true;
+    return ls_atomic_value(&pScore->x_iTotal) < m_iMaxConns;
+}
+
+
+int ExtConnBoard::getTotal()
+{
+    ExtConnScore_t *pScore = getScore();
+    return pScore ? ls_atomic_value(&pScore->x_iTotal) : 0;
+}
+
+
+int ExtConnBoard::getOthersWaiting()
+{
+    ExtConnScore_t *pScore = getScore();
+    int waiting = 0;
+    if (!pScore)
+        return 0;
+    for (int i = 0; i < EXTCONNBOARD_MAX_PROCS; ++i)
+    {
+        if (i != m_iProc && pScore->x_procs[i].x_pid != 0)
+            waiting += pScore->x_procs[i].x_iWaiting;
+    }
+    return waiting;
+}
+
+
+void ExtConnBoard::opened()
+{
+    ExtConnScore_t *pScore = getScore();
+    if (!pScore)
+        return;
+    ls_atomic_add(&pScore->x_iTotal, 1);
+    ls_atomic_add(&pScore->x_procs[m_iProc].x_iOpen, 1);
+    ls_atomic_add(&pScore->x_iConnects, 1);
+}
+
+
+void ExtConnBoard::closed()
+{
+    ExtConnScore_t *pScore = getScore();
+    if (!pScore)
+        return;
+    //A slot reclaimed while this process was not looking starts from zero.
+    if (ls_atomic_sub(&pScore->x_procs[m_iProc].x_iOpen, 1) < 0)
+    {
+        ls_atomic_add(&pScore->x_procs[m_iProc].x_iOpen, 1);
+        return;
+    }
+    if (ls_atomic_sub(&pScore->x_iTotal, 1) < 0)
+        ls_atomic_add(&pScore->x_iTotal, 1);
+}
+
+
+void ExtConnBoard::reused()
+{
+    ExtConnScore_t *pScore = getScore();
+    if (pScore)
+        ls_atomic_add(&pScore->x_iReuses, 1);
+}
+
+
+void ExtConnBoard::refused()
+{
+    ExtConnScore_t *pScore = getScore();
+    if (pScore)
+        ls_atomic_add(&pScore->x_iRefused, 1);
+}
+
+
+void ExtConnBoard::trimmed()
+{
+    ExtConnScore_t *pScore = getScore();
+    if (pScore)
+        ls_atomic_add(&pScore->x_iTrimmed, 1);
+}
+
+
+void ExtConnBoard::donated()
+{
+    ExtConnScore_t *pScore = getScore();
+    if (pScore)
+        ls_atomic_add(&pScore->x_iDonated, 1);
+}
+
+
+void ExtConnBoard::onTimer(int iIdle, int iWaiting)
+{
+    ExtConnScore_t *pScore = getScore();
+    ExtConnProc_t *pProc;
+    if (!pScore)
+        return;
+    pProc = &pScore->x_procs[m_iProc];
+    pProc->x_pid = getpid();
+    pProc->x_iIdle = iIdle;
+    pProc->x_iWaiting = iWaiting;
+    pProc->x_tmBeat = DateTime::s_curTime;
+
+    s_pBoard->lock();
+    reconcile(pScore);
+    s_pBoard->unlock();
+}
+
+
+int ExtConnBoard::generateRTReport(int fd)
+{
+    char achBuf[4096];
+    char *p = achBuf;
+    ExtConnBoard *pBoard;
+    ExtConnScore_t *pScore;
+    int idle, waiting;
+
+    //Every process writes its own report, the totals are global.
+    if (HttpServerConfig::getInstance().getProcNo() > 1)
+        return 0;
+    for (pBoard = (ExtConnBoard *)s_boards.begin();
+         pBoard != (ExtConnBoard *)s_boards.end();
+         pBoard = (ExtConnBoard *)pBoard->next())
+    {
+        if ((pScore = pBoard->getScore()) == NULL)
+            continue;
+        if (&achBuf[sizeof(achBuf)] - p < 256)
+        {
+            write(fd, achBuf, p - achBuf);
+            p = achBuf;
+        }
+        idle = waiting = 0;
+        for (int i = 0; i < EXTCONNBOARD_MAX_PROCS; ++i)
+        {
+            if (pScore->x_procs[i].x_pid == 0)
+                continue;
+            idle += pScore->x_procs[i].x_iIdle;
+            waiting += pScore->x_procs[i].x_iWaiting;
+        }
+        p += ls_snprintf(p, &achBuf[sizeof(achBuf)] - p,
+                         "EXTAPP_GLOBAL [%s]: GMAXCONN: %d, POOL_SIZE: %d, "
+                         "IDLE_CONN: %d, WAITQUE_DEPTH: %d, CONNECTS: %llu, "
+                         "REUSES: %llu, REFUSED: %llu, TRIMMED: %llu, "
+                         "DONATED: %llu\n",
+                         pBoard->m_sName.c_str(), pScore->x_iMaxConns,
+                         ls_atomic_value(&pScore->x_iTotal), idle, waiting,
+                         (unsigned long long)pScore->x_iConnects,
+                         (unsigned long long)pScore->x_iReuses,
+                         (unsigned long long)pScore->x_iRefused,
+                         (unsigned long long)pScore->x_iTrimmed,
+                         (unsigned long long)pScore->x_iDonated);
+    }
+    if (p > achBuf)
+        write(fd, achBuf, p - achBuf);
+    return 0;
+}
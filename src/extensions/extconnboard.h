@@ -0,0 +1,96 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2022  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+#ifndef EXTCONNBOARD_H
+#define EXTCONNBOARD_H
+
+#include <lsdef.h>
+#include <util/autostr.h>
+#include <util/dlinkqueue.h>
+
+#include <sys/types.h>
+
+//Server processes beyond this number run without global accounting.
+#define EXTCONNBOARD_MAX_PROCS      64
+
+//A slot not updated for this long is reclaimed even if its pid is alive,
+//the pid may have been reused.
+#define EXTCONNBOARD_STALE_SECS     30
+
+class LsShmHash;
+typedef uint32_t LsShmOffset_t;
+typedef struct ExtConnScore_s ExtConnScore_t;
+typedef struct ExtConnProc_s ExtConnProc_t;
+
+
+/**
+ * ExtConnBoard accounts the connections of one external application
+ * opened by all server processes in SHM, so "globalMaxConns" caps the
+ * total the backend sees instead of maxConns times the number of
+ * processes.
+ *
+ * Every process owns one slot indexed by its process number and updates it
+ * every second. The slot of a process that died, was restarted or stopped
+ * updating it is reclaimed, and the total is recounted from the live slots
+ * so counts leaked by a crash do not hold quota. The limit is soft,
+ * processes checking at the same moment may overshoot it by one each.
+ * A process waiting for quota gets it from the idle connections other
+ * processes give back.
+ */
+class ExtConnBoard : public DLinkedObj
+{
+public:
+    ExtConnBoard();
+    ~ExtConnBoard();
+
+    int  init(const char *pVHost, const char *pName, int iMaxConns);
+    void setMaxConns(int iMaxConns);
+    int  getMaxConns() const        {   return m_iMaxConns;     }
+
+    bool canOpen();
+    int  getTotal();
+    int  getOthersWaiting();
+
+    void opened();
+    void closed();
+    void reused();
+    void refused();
+    void trimmed();
+    void donated();
+
+    void onTimer(int iIdle, int iWaiting);
+
+    static int generateRTReport(int fd);
+
+private:
+    ExtConnScore_t *getScore() const;
+    ExtConnProc_t  *getProc() const;
+    void reclaim(ExtConnScore_t *pScore, int idx, pid_t pid);
+    void reconcile(ExtConnScore_t *pScore);
+
+    AutoStr             m_sName;
+    LsShmOffset_t       m_offset;
+    int                 m_iProc;
+    int                 m_iMaxConns;
+
+    static LsShmHash   *s_pBoard;
+    static DLinkQueue   s_boards;
+
+    LS_NO_COPY_ASSIGN(ExtConnBoard);
+};
+
+#endif
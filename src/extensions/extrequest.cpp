@@ -16,6 +16,41 @@
 *    along with this program. If not, see http://www.gnu.org/licenses/.      *
 *****************************************************************************/
 #include "extrequest.h"
+#include <stdlib.h>
+#include <string.h>
 
 
+ExtRequest::~ExtRequest()
+{
+    if (m_pWorkerTrack)
+        free(m_pWorkerTrack);
+}
 
+
+void ExtRequest::setLB(LoadBalancer *pLB)
+{
+    m_pLB = pLB;
+    m_iLbWorker = -1;
+    m_iLbStartUs = 0;
+    if (m_pWorkerTrack)
+        memset(m_pWorkerTrack, 0, m_iTrackWords * sizeof(uint32_t));
+}
+
+
+int ExtRequest::addWorkerTrack(int n)
+{
+    int words = (n >> 5) + 1;
+    if (words > m_iTrackWords)
+    {
+        uint32_t *pTrack = (uint32_t *)realloc(m_pWorkerTrack,
+                                               words * sizeof(uint32_t));
+        if (!pTrack)
+            return LS_FAIL;
+        memset(pTrack + m_iTrackWords, 0,
+               (words - m_iTrackWords) * sizeof(uint32_t));
+        m_pWorkerTrack = pTrack;
+        m_iTrackWords = words;
+    }
+    m_pWorkerTrack[n >> 5] |= (1U << (n & 31));
+    return LS_OK;
+}
@@ -32,21 +32,44 @@ class ExtRequest : public DLinkedObj
 {
     int             m_iAttempts;
     LoadBalancer   *m_pLB;
-    int             m_iWorkerTrack;
+    uint32_t       *m_pWorkerTrack;
+    int             m_iTrackWords;
+    int             m_iLbWorker;
+    int64_t         m_iLbStartUs;
+    int64_t         m_iQueuedUs;
 
 public:
-    ExtRequest(): m_iAttempts(0), m_pLB(NULL), m_iWorkerTrack(0) {};
-    virtual ~ExtRequest() {};
+    ExtRequest()
+        : m_iAttempts(0)
+        , m_pLB(NULL)
+        , m_pWorkerTrack(NULL)
+        , m_iTrackWords(0)
+        , m_iLbWorker(-1)
+        , m_iLbStartUs(0)
+        , m_iQueuedUs(0)
+    {}
+    virtual ~ExtRequest();
 
     void setAttempts(int att) {   m_iAttempts = att;  }
     int  getAttempts() const    {   return m_iAttempts; }
     int  incAttempts()          {   return ++m_iAttempts;   }
 
-    void setLB(LoadBalancer *pLB)    {   m_pLB = pLB;    m_iWorkerTrack = 0;   }
+    void setLB(LoadBalancer *pLB);
     LoadBalancer *getLB() const        {   return m_pLB;   }
 
-    int getWorkerTrack() const      {   return m_iWorkerTrack;  }
-    void addWorkerTrack(int n)    {   m_iWorkerTrack |= (1 << n);   }
+    int  isWorkerTracked(int n) const
+    {
+        return ((n >> 5) < m_iTrackWords)
+               && (m_pWorkerTrack[n >> 5] & (1U << (n & 31)));
+    }
+    int  addWorkerTrack(int n);
+
+    int  getLbWorker() const            {   return m_iLbWorker;     }
+    void setLbWorker(int n)             {   m_iLbWorker = n;        }
+    int64_t getLbStartUs() const        {   return m_iLbStartUs;    }
+    void setLbStartUs(int64_t us)       {   m_iLbStartUs = us;      }
+    int64_t getQueuedUs() const         {   return m_iQueuedUs;     }
+    void setQueuedUs(int64_t us)        {   m_iQueuedUs = us;       }
 
 
     virtual void resetConnector() = 0;
@@ -17,6 +17,7 @@
 *****************************************************************************/
 #include "extworker.h"
 #include "extconn.h"
+#include "extconnboard.h"
 #include "extrequest.h"
 #include "localworker.h"
 
@@ -36,6 +37,12 @@
 #include <unistd.h>
 
 
+static int64_t curTimeUs()
+{
+    return (int64_t)DateTime::s_curTime * 1000000 + DateTime::s_curTimeUs;
+}
+
+
 ExtWorker::ExtWorker(int type)
     : HttpHandler(type)
     , m_pConfig(NULL)
@@ -48,12 +55,18 @@ ExtWorker::ExtWorker(int type)
     , m_lLastRestart(0)
     , m_lIdleTime(0)
     , m_iLingerConns(0)
+    , m_pConnBoard(NULL)
+    , m_iPoolTarget(0)
+    , m_iWaitReqs(0)
+    , m_iWaitUs(0)
 {
 }
 
 
 ExtWorker::~ExtWorker()
 {
+    if (m_pConnBoard)
+        delete m_pConnBoard;
     if (m_pConfig)
         delete m_pConfig;
 }
@@ -127,16 +140,29 @@ ExtConn *ExtWorker::getConn()
 //                m_pConfig->getURL(), getConnPool().getFreeConns());
 
     m_lIdleTime = 0;
+    if (!m_pConnBoard && m_pConfig->getGlobalMaxConns() > 0)
+        initConnBoard();
     ExtConn *pConn = (ExtConn *) getConnPool().getFreeConn();
     if (pConn)
     {
         LS_DBG_L("[%s] connection available!",
                  m_pConfig->getURL());
+        if (m_pConnBoard)
+            m_pConnBoard->reused();
     }
     else
     {
-        if (getConnPool().canAddMore())
+        if (getConnPool().canAddMore() && ((m_iPoolTarget <= 0)
+            || (getConnPool().getTotalConns() < m_iPoolTarget)))
         {
+            if (m_pConnBoard && !m_pConnBoard->canOpen())
+            {
+                LS_DBG_L("[%s] global max connections %d reached, wait for "
+                         "a connection to be released!", m_pConfig->getURL(),
+                         m_pConnBoard->getMaxConns());
+                m_pConnBoard->refused();
+                return NULL;
+            }
             pConn = (ExtConn *)getConnPool().getBadConn();
             if (pConn)
                 getConnPool().regConn(pConn);
@@ -157,6 +183,143 @@ ExtConn *ExtWorker::getConn()
 }
 
 
+/**
+ * Open up to n idle connections ahead of the load, for a local application
+ * connecting is what starts a new process.
+ */
+int ExtWorker::prepareConns(int n)
+{
+    ExtConn *pConn;
+    int i;
+    for (i = 0; i < n; ++i)
+    {
+        if (!getConnPool().canAddMore()
+            || (m_pConnBoard && !m_pConnBoard->canOpen()))
+            break;
+        pConn = (ExtConn *)getConnPool().getBadConn();
+        if (pConn)
+            getConnPool().regConn(pConn);
+        else
+        {
+            pConn = newConn();
+            if (!pConn)
+                break;
+            getConnPool().regConn(pConn);
+            pConn->setWorker(this);
+        }
+        if (pConn->reconnect() == -1)
+        {
+            pConn->close();
+            getConnPool().removeConn(pConn);
+            break;
+        }
+        //Not handed out before it is connected.
+        if (pConn->getState() == ExtConn::CONNECTING)
+            pConn->setPrepared(1);
+        else
+            getConnPool().reuse(pConn);
+    }
+    if (i > 0)
+        LS_DBG_L("[%s] Open %d connections ahead of load.",
+                 m_pConfig->getURL(), i);
+    return i;
+}
+
+
+int ExtWorker::trimIdleConns(int n)
+{
+    ExtConn *pConn;
+    int i;
+    for (i = 0; i < n; ++i)
+    {
+        if ((pConn = (ExtConn *)getConnPool().getFreeConn()) == NULL)
+            break;
+        pConn->close();
+        getConnPool().removeConn(pConn);
+    }
+    return i;
+}
+
+
+void ExtWorker::addWait(ExtRequest *pReq)
+{
+    if (pReq->getQueuedUs() == 0)
+        return;
+    m_iWaitUs += curTimeUs() - pReq->getQueuedUs();
+    ++m_iWaitReqs;
+    pReq->setQueuedUs(0);
+}
+
+
+int ExtWorker::getOldestWaitMs() const
+{
+    if (m_reqQueue.empty())
+        return 0;
+    const ExtRequest *pReq = (const ExtRequest *)m_reqQueue.begin();
+    return (int)((curTimeUs() - pReq->getQueuedUs()) / 1000);
+}
+
+
+int ExtWorker::takeAvgWaitMs()
+{
+    int ms = 0;
+    if (m_iWaitReqs > 0)
+        ms = (int)(m_iWaitUs / m_iWaitReqs / 1000);
+    m_iWaitUs = 0;
+    m_iWaitReqs = 0;
+    return ms;
+}
+
+
+void ExtWorker::initConnBoard()
+{
+    const HttpVHost *pVHost = m_pConfig->getVHost();
+    m_pConnBoard = new ExtConnBoard();
+    if (m_pConnBoard->init(pVHost ? pVHost->getName() : NULL, getName(),
+                           m_pConfig->getGlobalMaxConns()) != LS_OK)
+    {
+        LS_WARN("[%s] Failed to init SHM connection board, globalMaxConns "
+                "is ignored.", m_pConfig->getURL());
+        delete m_pConnBoard;
+        m_pConnBoard = NULL;
+        m_pConfig->setGlobalMaxConns(0);
+    }
+}
+
+
+void ExtWorker::balanceConnBoard()
+{
+    ExtConn *pConn;
+    if (m_pConfig->getGlobalMaxConns() != m_pConnBoard->getMaxConns())
+    {
+        if (m_pConfig->getGlobalMaxConns() <= 0)
+        {
+            delete m_pConnBoard;
+            m_pConnBoard = NULL;
+            return;
+        }
+        m_pConnBoard->setMaxConns(m_pConfig->getGlobalMaxConns());
+    }
+    m_pConnBoard->onTimer(m_connPool.getFreeConns(), m_reqQueue.size());
+    if (!m_reqQueue.empty())
+    {
+        //Quota may have been released by another process.
+        if (m_pConnBoard->canOpen())
+            processPending();
+    }
+    else if ((m_connPool.getFreeConns() > 0) && !m_pConnBoard->canOpen()
+             && (m_pConnBoard->getOthersWaiting() > 0))
+    {
+        pConn = (ExtConn *)m_connPool.getFreeConn();
+        LS_DBG_L("[%s] Close an idle connection for other processes waiting "
+                 "for global quota.", m_pConfig->getURL());
+        pConn->close();
+        m_connPool.removeConn(pConn);
+        m_pConnBoard->donated();
+    }
+}
+
+
 void ExtWorker::recycleConn(ExtConn *pConn)
 {
     if (pConn->isToClose())
@@ -178,6 +341,7 @@ void ExtWorker::recycleConn(ExtConn *pConn)
             LS_DBG_L(pReq, "Client side socket is closed, close connection!");
             continue;
         }
+        addWait(pReq);
         LS_DBG_L(pReq->getLogger(),
                  "[%s] assign pending request [%s] to recycled connection!",
                  m_pConfig->getURL(), pReq->getLogId());
@@ -255,6 +419,7 @@ int  ExtWorker::processRequest(ExtRequest *pReq, int retry)
              "to pending queue!",
              m_pConfig->getURL(), pReq->getLogId());
     pReq->suspend();
+    pReq->setQueuedUs(curTimeUs());
     if (retry)
         m_reqQueue.push_front(pReq);
     else
@@ -302,6 +467,7 @@ void ExtWorker::processPending()
             LS_DBG_L(pReq, "Client side socket is closed, close connection!");
             continue;
         }
+        addWait(pReq);
         int ret = pConn->assignReq(pReq);
         if (ret)
         {
@@ -456,6 +622,13 @@ void ExtWorker::onTimer()
 }
 
 
+void ExtWorker::onSecTimer()
+{
+    if (m_pConnBoard)
+        balanceConnBoard();
+}
+
+
 int ExtWorker::generateRTReport(int fd, const char *pTypeName)
 {
     char *p;
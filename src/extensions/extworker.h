@@ -37,6 +37,7 @@ class RLimits;
 
 class AutoBuf;
 class ExtConn;
+class ExtConnBoard;
 class ExtRequest;
 class GSockAddr;
 class Multiplexer;
@@ -57,10 +58,17 @@ class ExtWorker : public HttpHandler
     long                m_lIdleTime;
     int                 m_iLingerConns;
     ReqStats            m_reqStats;
+    ExtConnBoard       *m_pConnBoard;
+    int                 m_iPoolTarget;
+    int                 m_iWaitReqs;
+    int64_t             m_iWaitUs;
 
 
     void processPending();
     void failOutstandingReqs();
+    void initConnBoard();
+    void balanceConnBoard();
+    void addWait(ExtRequest *pReq);
 
 protected:
     void setConfigPointer(ExtWorkerConfig *pConfig)
@@ -78,6 +86,7 @@ public:
     explicit ExtWorker(int type);
     virtual ~ExtWorker();
     ConnPool &getConnPool()     {   return m_connPool;  }
+    ExtConnBoard *getConnBoard() const  {   return m_pConnBoard;    }
 
     ExtWorkerConfig *getConfigPointer() const
     {   return m_pConfig;       }
@@ -113,12 +122,16 @@ public:
     }
     int clearCurConnPool();
     ExtConn *getConn();
+    int  prepareConns(int n);
+    int  trimIdleConns(int n);
     void recycleConn(ExtConn *conn);
     void removeConn(IConnection *pConn)
     {   m_connPool.removeConn(pConn);     }
     int  removeReq(ExtRequest *pReq);
     int  processRequest(ExtRequest *pReq, int retry = 0);
     virtual void onTimer();
+    // Every second, independent of the real time report.
+    virtual void onSecTimer();
 
     void setState(int state)  {   m_iState = state;   }
     int getState() const        {   return m_iState;    }
@@ -127,6 +140,12 @@ public:
     bool isReady() const    {   return m_iState > ST_BAD;       }
 
     int  getQueuedReqs() const  {   return m_reqQueue.size();   }
+    int  getOldestWaitMs() const;
+    int  takeAvgWaitMs();
+
+    //Pool size wanted by an autoscaler, 0 for no limit below maxConns.
+    void setPoolTarget(int n)   {   m_iPoolTarget = n;          }
+    int  getPoolTarget() const  {   return m_iPoolTarget;       }
     int  getUtilRatio() const
     {   return m_connPool.getUsedConns() * 1000 / (m_connPool.getMaxConns() + 1); }
 
@@ -147,7 +166,7 @@ public:
     int processConnError(ExtConn *pConn, ExtRequest *pReq, int errCode);
 
     static int startServerSock(ExtWorkerConfig *pConfig, int backlog);
-    int generateRTReport(int fd, const char *pTypeName);
+    virtual int generateRTReport(int fd, const char *pTypeName);
     int generateRTJsonReport(AutoBuf *buf, const char *pTypeName, int *did);
     int resetStats(const char *pTypeName);
 
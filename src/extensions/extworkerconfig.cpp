@@ -35,6 +35,7 @@ ExtWorkerConfig::ExtWorkerConfig(const char *pName)
     , m_sName(pName)
     , m_pVHost(NULL)
     , m_iMaxConns(1)
+    , m_iGlobalMaxConns(0)
     , m_iTimeout(10)
     , m_iRetryTimeout(3)
     , m_iBuffering(0)
@@ -58,6 +59,7 @@ ExtWorkerConfig::ExtWorkerConfig(const char *pName)
 ExtWorkerConfig::ExtWorkerConfig()
     : m_pVHost(NULL)
     , m_iMaxConns(1)
+    , m_iGlobalMaxConns(0)
     , m_iTimeout(10)
     , m_iRetryTimeout(3)
     , m_iBuffering(0)
@@ -99,6 +101,7 @@ ExtWorkerConfig::ExtWorkerConfig(const ExtWorkerConfig &rhs)
     m_sName = rhs.m_sName;
     m_pVHost = rhs.m_pVHost;
     m_iMaxConns = rhs.m_iMaxConns;
+    m_iGlobalMaxConns = rhs.m_iGlobalMaxConns;
     m_iBuffering = rhs.m_iBuffering;
     m_iRefAddr = rhs.m_iRefAddr;
     m_iDaemonSuEXEC = rhs.m_iDaemonSuEXEC;
@@ -200,6 +203,8 @@ void ExtWorkerConfig::config(const XmlNode *pNode)
 {
     int iMaxConns = ConfigCtx::getCurConfigCtx()->getLongValue(pNode,
                     "maxConns", 1, 10000, 5);
+    int iGlobalMaxConns = ConfigCtx::getCurConfigCtx()->getLongValue(pNode,
+                          "globalMaxConns", 0, 100000, 0);
     int iRetryTimeout = ConfigCtx::getCurConfigCtx()->getLongValue(pNode,
                         "retryTimeout", 0, LONG_MAX, 10);
     int iInitTimeout = ConfigCtx::getCurConfigCtx()->getLongValue(pNode,
@@ -224,6 +229,7 @@ void ExtWorkerConfig::config(const XmlNode *pNode)
     setPersistConn(iKeepAlive);
     setKeepAliveTimeout(iKeepAliveTimeout);
     setMaxConns(iMaxConns);
+    setGlobalMaxConns(iGlobalMaxConns);
     setTimeout(iInitTimeout);
     setRetryTimeout(iRetryTimeout);
     setBuffering(iBuffer);
@@ -46,6 +46,7 @@ class ExtWorkerConfig
     AutoStr     m_sName;
     const HttpVHost *m_pVHost;
     int         m_iMaxConns;
+    int         m_iGlobalMaxConns;
     int         m_iTimeout;
     int         m_iRetryTimeout;
     int         m_iBuffering;
@@ -81,6 +82,9 @@ public:
     void setMaxConns(int max)           {   m_iMaxConns = max;  }
     int getMaxConns() const             {   return m_iMaxConns; }
 
+    void setGlobalMaxConns(int max)     {   m_iGlobalMaxConns = max;    }
+    int getGlobalMaxConns() const       {   return m_iGlobalMaxConns;   }
+
     void setName(const char *pName);
     const char *getName() const         {   return m_sName.c_str();  }
 
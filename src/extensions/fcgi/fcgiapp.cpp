@@ -18,10 +18,16 @@
 #include "fcgiapp.h"
 #include "fcgiappconfig.h"
 #include "fcgiconnection.h"
+#include "fcgimplxconn.h"
+#include "fcgirequest.h"
+#include <edio/multiplexerfactory.h>
 #include <http/handlertype.h>
+#include <log4cxx/logger.h>
 #include <lsr/ls_time.h>
 
+#include <errno.h>
 #include <signal.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -39,6 +45,9 @@ FcgiApp::FcgiApp(const char *pName)
 FcgiApp::~FcgiApp()
 {
     //stop();
+    m_mplxConns.release_objects();
+    m_mplxClosed.release_objects();
+    LocalWorker::onSecTimer();
 }
 
 int FcgiApp::startEx()
@@ -52,10 +61,72 @@ int FcgiApp::startEx()
 
 ExtConn *FcgiApp::newConn()
 {
+    if (getConfig().getMultiplex())
+        return new FcgiRequest();
     return new FcgiConnection();
 }
 
 
+FcgiMplxConn *FcgiApp::getMplxConn()
+{
+    FcgiMplxConn *pBest = NULL;
+    int usable = 0;
+    FcgiMplxConn *pConn = m_mplxConns.begin();
+    for (; pConn != m_mplxConns.end(); pConn = (FcgiMplxConn *)pConn->next())
+    {
+        //A draining connection does not count against the limit.
+        if (!pConn->isUsable())
+            continue;
+        ++usable;
+        if (!pBest || pConn->getLoad() < pBest->getLoad())
+            pBest = pConn;
+    }
+    if (pBest && pBest->canStartRequest())
+        return pBest;
+    //Wait for the answer to FCGI_GET_VALUES before opening more.
+    if (pBest && wantManagementInfo())
+        return pBest;
+
+    int maxConns = isMultiplexConns() ? getConfig().getMplxConns()
+                   : getConfig().getMaxConns();
+    if (usable < maxConns)
+    {
+        pConn = new FcgiMplxConn(this);
+        if (pConn->connectTo(MultiplexerFactory::getMultiplexer()) == LS_FAIL)
+        {
+            LS_NOTICE("[%s] Failed to connect to FastCGI application, "
+                      "error: %s.", getName(), strerror(errno));
+            delete pConn;
+            return NULL;
+        }
+        m_mplxConns.append(pConn);
+        return pConn;
+    }
+    if (!pBest)
+        errno = EAGAIN;
+    return pBest;
+}
+
+
+void FcgiApp::retireMplxConn(FcgiMplxConn *pConn)
+{
+    m_mplxConns.remove(pConn);
+    m_mplxClosed.append(pConn);
+}
+
+
+void FcgiApp::onSecTimer()
+{
+    FcgiMplxConn *pNext, *pConn = m_mplxConns.begin();
+    for (; pConn != m_mplxConns.end(); pConn = pNext)
+    {
+        pNext = (FcgiMplxConn *)pConn->next();
+        pConn->onSecTimer();
+    }
+    m_mplxClosed.release_objects();
+}
+
+
 int FcgiApp::setURL(const char *pURL)
 {
 //    return ExtWorker::setURL( pURL );
@@ -21,12 +21,17 @@
 
 #include <lsdef.h>
 #include <extensions/localworker.h>
+#include <util/dlinkqueue.h>
+
 class FcgiAppConfig;
+class FcgiMplxConn;
 
 class FcgiApp : public LocalWorker
 {
     int             m_iMaxConns;
     int             m_iMaxReqs;
+    TDLinkQueue<FcgiMplxConn>   m_mplxConns;
+    TDLinkQueue<FcgiMplxConn>   m_mplxClosed;
 
     ExtConn        *newConn();
 
@@ -44,6 +49,11 @@ public:
 
     void setFcgiMaxConns(int max)     {   m_iMaxConns = max;          }
     void setFcgiMaxReqs(int max)      {   m_iMaxReqs = max;           }
+    int  getFcgiMaxReqs() const       {   return m_iMaxReqs;          }
+
+    FcgiMplxConn *getMplxConn();
+    void retireMplxConn(FcgiMplxConn *pConn);
+    virtual void onSecTimer();
 
     virtual int setURL(const char *pURL);
 
@@ -17,7 +17,9 @@
 *****************************************************************************/
 #include "fcgiappconfig.h"
 
+#include <main/configctx.h>
 #include <util/rlimits.h>
+#include <util/xmlnode.h>
 
 #include <assert.h>
 #include <string.h>
@@ -25,15 +27,21 @@
 
 FcgiAppConfig::FcgiAppConfig(const char *pName)
     : LocalWorkerConfig(pName)
+    , m_iMultiplex(0)
+    , m_iMplxConns(FCGI_MPLX_DEFAULT_CONNS)
 {
 }
 
 FcgiAppConfig::FcgiAppConfig()
+    : m_iMultiplex(0)
+    , m_iMplxConns(FCGI_MPLX_DEFAULT_CONNS)
 {
 }
 
 FcgiAppConfig::FcgiAppConfig(const FcgiAppConfig &rhs)
     : LocalWorkerConfig(rhs)
+    , m_iMultiplex(rhs.m_iMultiplex)
+    , m_iMplxConns(rhs.m_iMplxConns)
 {
 }
 
@@ -42,3 +50,12 @@ FcgiAppConfig::~FcgiAppConfig()
 {
 }
 
+
+void FcgiAppConfig::configMultiplex(const XmlNode *pNode)
+{
+    m_iMultiplex = ConfigCtx::getCurConfigCtx()->getLongValue(pNode,
+                   "fcgiMultiplex", 0, 1, 0);
+    m_iMplxConns = ConfigCtx::getCurConfigCtx()->getLongValue(pNode,
+                   "fcgiMplxConns", 1, FCGI_MPLX_MAX_CONNS,
+                   FCGI_MPLX_DEFAULT_CONNS);
+}
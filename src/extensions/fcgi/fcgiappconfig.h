@@ -22,15 +22,27 @@
 
 #include <extensions/localworkerconfig.h>
 
+#define FCGI_MPLX_DEFAULT_CONNS     4
+#define FCGI_MPLX_MAX_CONNS         64
+
 class RLimits;
+class XmlNode;
 class FcgiAppConfig : public LocalWorkerConfig
 {
+    int     m_iMultiplex;
+    int     m_iMplxConns;
 public:
     explicit FcgiAppConfig(const char *pName);
     FcgiAppConfig();
     ~FcgiAppConfig();
     FcgiAppConfig(const FcgiAppConfig &rhs);
 
+    int getMultiplex() const        {   return m_iMultiplex;    }
+    void setMultiplex(int m)        {   m_iMultiplex = m;       }
+    int getMplxConns() const        {   return m_iMplxConns;    }
+    void setMplxConns(int n)        {   m_iMplxConns = n;       }
+
+    void configMultiplex(const XmlNode *pNode);
 };
 
 #endif
@@ -0,0 +1,783 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2022  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+#include "fcgimplxconn.h"
+#include "fcgiapp.h"
+#include "fcgiappconfig.h"
+#include "fcgiconnection.h"
+#include "fcginamevaluepair.h"
+#include "fcgirecord.h"
+#include "fcgirequest.h"
+
+#include <edio/multiplexer.h>
+#include <http/httpresourcemanager.h>
+#include <log4cxx/logger.h>
+#include <socket/coresocket.h>
+#include <util/datetime.h>
+#include <util/iovec.h>
+#include <util/ssnprintf.h>
+#include <util/stringtool.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FCGI_MPLX_CONNECT_TIMEOUT   10
+//Applications that do not know FCGI_GET_VALUES never answer it.
+#define FCGI_MPLX_NEGOTIATE_TIMEOUT 3
+
+#define FCGI_MAX_CONNS  "FCGI_MAX_CONNS"
+#define FCGI_MAX_REQS   "FCGI_MAX_REQS"
+#define FCGI_MPXS_CONNS "FCGI_MPXS_CONNS"
+
+static uint32_t s_uiConnSeq = 0;
+
+
+FcgiMplxConn::FcgiMplxConn(FcgiApp *pApp)
+    : m_pApp(pApp)
+    , m_bufOS(this)
+    , m_recSize(0)
+    , m_iRecStatus(REC_HEADER)
+    , m_iContentLen(0)
+    , m_iRecId(0)
+    , m_iSessState(FMC_CONNECTING)
+    , m_iInEvent(0)
+    , m_iPausedReqs(0)
+    , m_uiSeq(++s_uiConnSeq)
+    , m_tmStart(DateTime::s_curTime)
+    , m_tmIdleBegin(0)
+    , m_tmLastRead(DateTime::s_curTime)
+{
+    memset(&m_recCur, 0, sizeof(m_recCur));
+}
+
+
+FcgiMplxConn::~FcgiMplxConn()
+{
+    FcgiRequest *pReq, *pNext;
+    while ((pReq = m_waitQueue.pop_front()) != NULL)
+        pReq->detachSession();
+    while ((pReq = m_writeQueue.pop_front()) != NULL)
+        ;
+    for (pReq = m_reqs.first(); pReq; pReq = pNext)
+    {
+        pNext = m_reqs.next(pReq->getId());
+        m_reqs.unregist(pReq);
+        pReq->detachSession();
+    }
+    EdStream::close();
+}
+
+
+int FcgiMplxConn::connectTo(Multiplexer *pMplx)
+{
+    int fd;
+    int ret = CoreSocket::connect(m_pApp->getServerAddr(),
+                                  pMplx->getFLTag(), &fd, 1);
+    if (fd == -1)
+        return LS_FAIL;
+    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    EdStream::init(fd, pMplx, POLLIN | POLLOUT | POLLHUP | POLLERR);
+    m_tmStart = DateTime::s_curTime;
+    LS_DBG_L(this, "[FCGI] Connecting to %s, fd: %d, connect() return %d.",
+             m_pApp->getURL(), fd, ret);
+    return LS_OK;
+}
+
+
+int FcgiMplxConn::checkReady()
+{
+    int32_t err = 0;
+    if (getSockError(&err) == -1 || err != 0)
+    {
+        if (err)
+            errno = err;
+        return LS_FAIL;
+    }
+    LS_DBG_L(this, "[FCGI] Connected to %s.", m_pApp->getURL());
+    m_tmLastRead = DateTime::s_curTime;
+    if (m_pApp->wantManagementInfo())
+    {
+        if (queryAppAttr() == LS_FAIL)
+            return LS_FAIL;
+        m_iSessState = FMC_NEGOTIATING;
+        m_tmStart = DateTime::s_curTime;
+    }
+    else
+        setReady();
+    return 1;
+}
+
+
+int FcgiMplxConn::queryAppAttr()
+{
+    char achBuf[256];
+    FCGI_Header *pHeader = (FCGI_Header *)achBuf;
+    char *p = achBuf + sizeof(FCGI_Header);
+    int size = sizeof(achBuf) - sizeof(FCGI_Header);
+    int len = 0;
+    int ret;
+    len += (ret = FcgiNameValuePair::append(p, size, FCGI_MAX_CONNS, ""));
+    p += ret;
+    size -= ret;
+    len += (ret = FcgiNameValuePair::append(p, size, FCGI_MAX_REQS, ""));
+    p += ret;
+    size -= ret;
+    len += (ret = FcgiNameValuePair::append(p, size, FCGI_MPXS_CONNS, ""));
+    FcgiRecord::setRecordHeader(*pHeader, FCGI_GET_VALUES, 0, len);
+    LS_DBG_L(this, "[FCGI] Query application attributes.");
+    return sendRecord(achBuf, sizeof(FCGI_Header) + len);
+}
+
+
+void FcgiMplxConn::setReady()
+{
+    m_iSessState = FMC_READY;
+    m_tmIdleBegin = 0;
+}
+
+
+bool FcgiMplxConn::canStartRequest() const
+{
+    if (m_iSessState != FMC_READY)
+        return false;
+    int maxReqs = 1;
+    if (m_pApp->isMultiplexConns())
+    {
+        maxReqs = m_pApp->getFcgiMaxReqs();
+        if (maxReqs > FCGI_MPLX_MAX_REQS)
+            maxReqs = FCGI_MPLX_MAX_REQS;
+        else if (maxReqs < 1)
+            maxReqs = 1;
+    }
+    return m_reqs.size() < maxReqs;
+}
+
+
+void FcgiMplxConn::attach(FcgiRequest *pReq)
+{
+    if (!pReq->next())
+        m_waitQueue.append(pReq);
+    if (canStartRequest() && !m_iInEvent)
+        EdStream::continueWrite();
+}
+
+
+void FcgiMplxConn::detach(FcgiRequest *pReq)
+{
+    if (!pReq->getId())
+        m_waitQueue.remove(pReq);
+}
+
+
+int FcgiMplxConn::startRequest(FcgiRequest *pReq)
+{
+    int id = m_reqs.regist(pReq);
+    m_tmIdleBegin = 0;
+    LS_DBG_L(this, "[FCGI] Start request %d, active requests: %d.",
+             id, m_reqs.size());
+    return id;
+}
+
+
+void FcgiMplxConn::releaseRequest(FcgiRequest *pReq, int abort)
+{
+    m_writeQueue.remove(pReq);
+    if (m_reqs.get(pReq->getId()) != pReq)
+        return;
+    if (abort && m_iSessState != FMC_CLOSED)
+    {
+        //The id can not be reused before the application ends it.
+        if (!pReq->isAbortSent())
+            endOfStream(FCGI_ABORT_REQUEST, pReq->getId());
+        m_reqs.retire(pReq);
+        LS_DBG_L(this, "[FCGI] Abort request %d.", pReq->getId());
+    }
+    else
+        m_reqs.unregist(pReq);
+    if (!m_iInEvent && !m_waitQueue.empty() && canStartRequest())
+        EdStream::continueWrite();
+}
+
+
+void FcgiMplxConn::waitWrite(FcgiRequest *pReq)
+{
+    if (!pReq->next())
+        m_writeQueue.append(pReq);
+    EdStream::continueWrite();
+}
+
+
+void FcgiMplxConn::cancelWrite(FcgiRequest *pReq)
+{
+    m_writeQueue.remove(pReq);
+}
+
+
+int FcgiMplxConn::sendRecord(const char *pRec, int size)
+{
+    int ret = m_bufOS.cacheWrite(pRec, size);
+    if (!m_bufOS.isEmpty())
+        EdStream::continueWrite();
+    return ret;
+}
+
+
+int FcgiMplxConn::endOfStream(int streamType, int id)
+{
+    FCGI_Header rec;
+    FcgiRecord::setRecordHeader(rec, streamType, id, 0);
+    return sendRecord((char *)&rec, sizeof(rec));
+}
+
+
+/**
+  * Records of a request are never held back for another request, the
+  * data is always taken, written or cached.
+  *
+  * @return -1, if error; size otherwise.
+  */
+
+int FcgiMplxConn::writeStream(int streamType, int id,
+                              const char *pBuf, int size)
+{
+    FCGI_Header rec;
+    IOVec iov;
+    int packetSize;
+    int left = size;
+    while (left > 0)
+    {
+        packetSize = left;
+        if (packetSize > FCGI_MAX_PACKET_SIZE)
+            packetSize = FCGI_MAX_PACKET_SIZE;
+        FcgiRecord::setRecordHeader(rec, streamType, id, packetSize);
+        iov.clear();
+        iov.append((char *)&rec, sizeof(rec));
+        iov.append((char *)pBuf, packetSize);
+        if (rec.paddingLength > 0)
+            iov.append(FcgiConnection::s_padding, rec.paddingLength);
+        if (m_bufOS.cacheWritev(iov) == -1)
+            return LS_FAIL;
+        left -= packetSize;
+        pBuf += packetSize;
+    }
+    if (!m_bufOS.isEmpty())
+        EdStream::continueWrite();
+    return size;
+}
+
+
+void FcgiMplxConn::pauseRead()
+{
+    if (m_iPausedReqs++ == 0)
+    {
+        LS_DBG_L(this, "[FCGI] Too much pending output, suspend reading.");
+        EdStream::suspendRead();
+    }
+}
+
+
+void FcgiMplxConn::resumeRead()
+{
+    if (m_iPausedReqs > 0 && --m_iPausedReqs == 0
+        && m_iSessState != FMC_CLOSED)
+    {
+        LS_DBG_L(this, "[FCGI] Resume reading.");
+        EdStream::continueRead();
+    }
+}
+
+
+void FcgiMplxConn::startWaiting()
+{
+    FcgiRequest *pReq;
+    while (canStartRequest() && (pReq = m_waitQueue.pop_front()) != NULL)
+        pReq->onSessionWrite();
+}
+
+
+void FcgiMplxConn::drain()
+{
+    if (m_iSessState >= FMC_DRAINING)
+        return;
+    m_iSessState = FMC_DRAINING;
+    FcgiRequest *pReq;
+    while ((pReq = m_waitQueue.pop_front()) != NULL)
+        pReq->onSessionDrain();
+}
+
+
+int FcgiMplxConn::onRead()
+{
+    int ret;
+    if (m_iSessState == FMC_CLOSED)
+        return -1;
+    if (m_iSessState == FMC_CONNECTING)
+    {
+        if (checkReady() == LS_FAIL)
+        {
+            closeSession(EIO);
+            return -1;
+        }
+    }
+
+    m_iInEvent = 1;
+    ret = readRecords();
+    m_iInEvent = 0;
+    if (ret == LS_FAIL)
+    {
+        closeSession(errno ? errno : ECONNRESET);
+        return -1;
+    }
+    if (m_iSessState == FMC_CLOSED)
+        return -1;
+    flushResps();
+    if (m_iSessState == FMC_DRAINING && m_reqs.size() == 0)
+    {
+        closeSession(0);
+        return -1;
+    }
+    startWaiting();
+    return 0;
+}
+
+
+int FcgiMplxConn::onWrite()
+{
+    if (m_iSessState == FMC_CLOSED || getfd() == -1)
+        return -1;
+    if (m_iSessState == FMC_CONNECTING)
+    {
+        if (checkReady() == LS_FAIL)
+        {
+            closeSession(EIO);
+            return -1;
+        }
+    }
+    if (m_bufOS.flush() == -1)
+    {
+        closeSession(errno);
+        return -1;
+    }
+
+    m_iInEvent = 1;
+    //Only those queued so far, a request may queue itself again.
+    FcgiRequest *pReq;
+    int count = m_writeQueue.size();
+    while (count-- > 0 && !isOutputFull() && m_iSessState != FMC_CLOSED
+           && (pReq = m_writeQueue.pop_front()) != NULL)
+        pReq->onSessionWrite();
+    if (m_iSessState != FMC_CLOSED)
+        startWaiting();
+    m_iInEvent = 0;
+    if (m_iSessState == FMC_CLOSED)
+        return -1;
+
+    if (m_bufOS.flush() == -1)
+    {
+        closeSession(errno);
+        return -1;
+    }
+    if (m_bufOS.isEmpty() && m_writeQueue.empty())
+        EdStream::suspendWrite();
+    return 0;
+}
+
+
+int FcgiMplxConn::onHangup()
+{
+    return onRead();
+}
+
+
+int FcgiMplxConn::onError()
+{
+    int err = (m_iSessState == FMC_CONNECTING) ? EIO : ECONNRESET;
+    LS_DBG_L(this, "[FCGI] FcgiMplxConn::onError()");
+    closeSession(err);
+    return -1;
+}
+
+
+void FcgiMplxConn::closeSession(int err)
+{
+    if (m_iSessState == FMC_CLOSED)
+        return;
+    LS_DBG_L(this, "[FCGI] Close connection, error: %d, requests: %d, "
+             "waiting: %d.", err, m_reqs.size(), (int)m_waitQueue.size());
+    m_iSessState = FMC_CLOSED;
+    m_pApp->retireMplxConn(this);
+    if (!err)
+        err = ECONNRESET;
+
+    FcgiRequest *pReq, *pNext;
+    while ((pReq = m_writeQueue.pop_front()) != NULL)
+        ;
+    for (pReq = m_reqs.first(); pReq; pReq = pNext)
+    {
+        pNext = m_reqs.next(pReq->getId());
+        m_reqs.unregist(pReq);
+        pReq->detachSession();
+        pReq->onSessionError(err);
+    }
+    while ((pReq = m_waitQueue.pop_front()) != NULL)
+        pReq->onSessionError(err);
+
+    m_bufOS.getBuf()->clear();
+    if (getfd() != -1)
+        EdStream::close();
+}
+
+
+#define FCGI_INPUT_BUFSIZE GLOBAL_BUF_SIZE
+int FcgiMplxConn::readRecords()
+{
+    int len, used, left, ret = 0;
+    char *pCur;
+    do
+    {
+        len = read(HttpResourceManager::getGlobalBuf(), FCGI_INPUT_BUFSIZE);
+        LS_DBG_H(this, "Read %d bytes from Fast CGI.", len);
+        if (len <= 0)
+            return len;
+        m_tmLastRead = DateTime::s_curTime;
+        pCur = HttpResourceManager::getGlobalBuf();
+        left = len;
+        while (left > 0)
+        {
+            switch (m_iRecStatus)
+            {
+            case REC_HEADER:
+                ret = buildRecHeader(pCur, left, used);
+                break;
+            case REC_CONTENT:
+                used = m_iContentLen - m_recSize;
+                if (used > left)
+                {
+                    used = left;
+                    m_recSize += used;
+                    ret = processRecData(pCur, used);
+                }
+                else
+                {
+                    ret = processRecData(pCur, used);
+                    m_recSize = 0;
+                    if (m_recCur.paddingLength)
+                        m_iRecStatus = REC_PADDING;
+                    else
+                        m_iRecStatus = REC_HEADER;
+                }
+                break;
+            case REC_PADDING:
+                used = m_recCur.paddingLength - m_recSize;
+                if (used > left)
+                {
+                    used = left;
+                    m_recSize += used;
+                }
+                else
+                {
+                    m_iRecStatus = REC_HEADER;
+                    m_recSize = 0;
+                }
+                break;
+            }
+            pCur += used;
+            left -= used;
+            if (ret == -1)
+            {
+                LS_DBG_L(this, "[FCGI] protocol error, Record Status=%d, "
+                         "Record Size=%d, Content Length=%d",
+                         m_iRecStatus, m_recSize, m_iContentLen);
+                errno = EIO;
+                return LS_FAIL;
+            }
+            if (m_iSessState == FMC_CLOSED)
+                return 0;
+        }
+    }
+    while ((len == FCGI_INPUT_BUFSIZE) && (m_iPausedReqs == 0));
+    return 0;
+}
+
+
+int FcgiMplxConn::buildRecHeader(char *pBuf, int size, int &len)
+{
+    len = sizeof(FCGI_Header) - m_recSize;
+    if (len > size)
+    {
+        len = size;
+        memmove((char *)&m_recCur + m_recSize, pBuf, len);
+        m_recSize += len;
+        return 1;
+    }
+    memmove((char *)&m_recCur + m_recSize, pBuf, len);
+    if (LS_LOG_ENABLED(LOG4CXX_NS::Level::DBG_HIGH))
+    {
+        char achBuf[256];
+        StringTool::hexEncode(
+            (char *)&m_recCur, sizeof(FCGI_Header), achBuf);
+        LS_DBG_H(this, "FCGI Header: %s", achBuf);
+    }
+    if (!FcgiRecord::testRecord(m_recCur))
+        return LS_FAIL;
+    m_recSize = 0;
+    m_iContentLen = FcgiRecord::getContentLength(m_recCur);
+    m_iRecId = FcgiRecord::getId(m_recCur);
+    if (m_iContentLen)
+        m_iRecStatus = REC_CONTENT;
+    else
+    {
+        //An application with nothing to tell still ends the negotiation.
+        if (m_iRecId == 0 && m_recCur.type == FCGI_GET_VALUES_RESULT)
+            processManagementRec(pBuf, 0);
+        if (m_recCur.paddingLength)
+            m_iRecStatus = REC_PADDING;
+    }
+    return 0;
+}
+
+
+int FcgiMplxConn::processRecData(char *pBuf, int size)
+{
+    if (m_iRecId == 0)
+    {
+        if (m_recCur.type == FCGI_GET_VALUES_RESULT)
+            return processManagementRec(pBuf, size);
+        return 0;
+    }
+    FcgiRequest *pReq = m_reqs.get(m_iRecId);
+    switch (m_recCur.type)
+    {
+    case FCGI_END_REQUEST:
+        return processEndOfRequestRecord(pReq, pBuf, size);
+    case FCGI_STDOUT:
+        if (pReq)
+            pReq->onStdOut(pBuf, size);
+        break;
+    case FCGI_STDERR:
+        if (pReq)
+            pReq->onStdErr(pBuf, size);
+        break;
+    }
+    return 0;
+}
+
+
+int FcgiMplxConn::processEndOfRequestRecord(FcgiRequest *pReq,
+        char *pBuf, int size)
+{
+    FCGI_EndRequestBody *pBody;
+    if (m_bufRec.empty() && (size >= (int)sizeof(FCGI_EndRequestBody)))
+        pBody = (FCGI_EndRequestBody *)pBuf;
+    else
+    {
+        m_bufRec.append(pBuf, size);
+        if (m_bufRec.size() < (int)sizeof(FCGI_EndRequestBody))
+            return 0;
+        pBody = (FCGI_EndRequestBody *)m_bufRec.begin();
+    }
+    int code = pBody->appStatusB3;
+    code <<= 8;
+    code |= pBody->appStatusB2;
+    code <<= 8;
+    code |= pBody->appStatusB1;
+    code <<= 8;
+    code |= pBody->appStatusB0;
+    int status = pBody->protocolStatus;
+    m_bufRec.clear();
+
+    if (!pReq)
+    {
+        if (m_reqs.release(m_iRecId) == LS_OK)
+            LS_DBG_L(this, "[FCGI] Aborted request %d ended.", m_iRecId);
+        return 0;
+    }
+    LS_DBG_L(this, "[FCGI] Request %d ended, status: %d, protocol status: "
+             "%d.", m_iRecId, code, status);
+    m_writeQueue.remove(pReq);
+    m_reqs.unregist(pReq);
+    if (status == FCGI_CANT_MPX_CONN)
+    {
+        LS_NOTICE(this, "[FCGI] Application %s can not multiplex requests, "
+                  "use one connection per request.", m_pApp->getName());
+        m_pApp->setMultiplexConns(0);
+        drain();
+    }
+    pReq->onEndRequest(code, status);
+    return 0;
+}
+
+
+void FcgiMplxConn::processManagementVal(char *pName, int nameLen,
+                                        char *pValue, int valLen)
+{
+    char ch = *(pValue + valLen);
+    *(pValue + valLen) = 0;
+    int val = strtol(pValue, NULL, 10);
+    *(pValue + valLen) = ch;
+
+    if (strncmp(pName, FCGI_MAX_CONNS, nameLen) == 0)
+        m_pApp->setFcgiMaxConns(val);
+    else if (strncmp(pName, FCGI_MAX_REQS, nameLen) == 0)
+        m_pApp->setFcgiMaxReqs(val);
+    else if (strncmp(pName, FCGI_MPXS_CONNS, nameLen) == 0)
+        m_pApp->setMultiplexConns(val);
+}
+
+
+int FcgiMplxConn::processManagementRec(char *pBuf, int size)
+{
+    m_bufRec.append(pBuf, size);
+    if (m_bufRec.size() < m_iContentLen)
+        return 0;
+    m_bufRec.append("", 1);   //pad a '\0'
+    char *p = m_bufRec.begin();
+    int left = m_iContentLen;
+    char *pName;
+    char *pValue;
+    int nameLen;
+    int valLen;
+    int ret;
+    m_pApp->setMultiplexConns(0);
+    while (left > 0)
+    {
+        ret = FcgiNameValuePair::decode(p, left, pName, nameLen,
+                                        pValue, valLen);
+        if (ret == -1)
+            break;
+        p += ret;
+        left -= ret;
+        if (valLen > 0)
+            processManagementVal(pName, nameLen, pValue, valLen);
+    }
+    m_bufRec.clear();
+    m_pApp->gotManagementInfo();
+    LS_INFO(this, "[FCGI] Application %s %s multiplexing, max requests: %d.",
+            m_pApp->getName(),
+            m_pApp->isMultiplexConns() ? "supports" : "does not support",
+            m_pApp->getFcgiMaxReqs());
+    if (m_iSessState == FMC_NEGOTIATING)
+        setReady();
+    return 0;
+}
+
+
+void FcgiMplxConn::flushResps()
+{
+    FcgiRequest *pReq, *pNext;
+    for (pReq = m_reqs.first(); pReq; pReq = pNext)
+    {
+        pNext = m_reqs.next(pReq->getId());
+        pReq->onReadDone();
+        if (m_iSessState == FMC_CLOSED)
+            break;
+    }
+}
+
+
+void FcgiMplxConn::onSecTimer()
+{
+    if (m_iSessState == FMC_CLOSED)
+        return;
+    if (m_iSessState == FMC_CONNECTING)
+    {
+        if (DateTime::s_curTime - m_tmStart >= FCGI_MPLX_CONNECT_TIMEOUT)
+        {
+            LS_NOTICE(this, "[FCGI] Timeout connecting to %s.",
+                      m_pApp->getURL());
+            closeSession(ETIMEDOUT);
+        }
+        return;
+    }
+    if (m_iSessState == FMC_NEGOTIATING)
+    {
+        if (DateTime::s_curTime - m_tmStart < FCGI_MPLX_NEGOTIATE_TIMEOUT)
+            return;
+        LS_NOTICE(this, "[FCGI] No reply to FCGI_GET_VALUES from %s, assume "
+                  "it does not support multiplexing.", m_pApp->getName());
+        m_pApp->setMultiplexConns(0);
+        m_pApp->gotManagementInfo();
+        setReady();
+        m_iInEvent = 1;
+        startWaiting();
+        m_iInEvent = 0;
+        if (m_iSessState == FMC_CLOSED)
+            return;
+    }
+
+    int timeout = m_pApp->getTimeout();
+    FcgiRequest *pReq, *pNext;
+    for (pReq = m_waitQueue.begin(); pReq != m_waitQueue.end(); pReq = pNext)
+    {
+        pNext = (FcgiRequest *)pReq->next();
+        if (DateTime::s_curTime - pReq->getReqBeginTime() >= timeout)
+        {
+            m_waitQueue.remove(pReq);
+            pReq->onSessionError(ETIMEDOUT);
+        }
+    }
+
+    for (pReq = m_reqs.first(); pReq; pReq = pNext)
+    {
+        pNext = m_reqs.next(pReq->getId());
+        if (DateTime::s_curTime - pReq->getLastAccess() < timeout)
+            continue;
+        LS_NOTICE(pReq, "[FCGI] No response from application in %d seconds, "
+                  "abort request %d.", timeout, pReq->getId());
+        releaseRequest(pReq, 1);
+        pReq->detachSession();
+        pReq->onSessionError(ETIMEDOUT);
+        if (m_iSessState == FMC_CLOSED)
+            return;
+    }
+
+    if (m_reqs.size() > 0)
+    {
+        //Only aborted requests left, the application does not answer.
+        if (!m_reqs.first()
+            && DateTime::s_curTime - m_tmLastRead >= timeout)
+        {
+            LS_NOTICE(this, "[FCGI] Aborted requests never ended, close.");
+            closeSession(ETIMEDOUT);
+        }
+        return;
+    }
+    if (m_iSessState == FMC_DRAINING)
+    {
+        closeSession(0);
+        return;
+    }
+    if (m_tmIdleBegin == 0)
+        m_tmIdleBegin = DateTime::s_curTime;
+    else if (m_waitQueue.empty() && DateTime::s_curTime - m_tmIdleBegin
+             >= m_pApp->getConfigPointer()->getKeepAliveTimeout())
+    {
+        LS_DBG_L(this, "[FCGI] Idle connection timeout, close.");
+        closeSession(0);
+    }
+}
+
+
+const char *FcgiMplxConn::buildLogId()
+{
+    m_logId.len = lsnprintf(m_logId.ptr, MAX_LOGID_LEN, "%s#%u",
+                            m_pApp->getName(), m_uiSeq);
+    return m_logId.ptr;
+}
@@ -0,0 +1,153 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2022  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+#ifndef FCGIMPLXCONN_H
+#define FCGIMPLXCONN_H
+
+#include "fcgidef.h"
+#include "fcgireqlist.h"
+
+#include <lsdef.h>
+#include <edio/bufferedos.h>
+#include <edio/ediostream.h>
+#include <log4cxx/logsession.h>
+#include <util/autobuf.h>
+#include <util/dlinkqueue.h>
+
+#include <time.h>
+
+//Upper limit of requests on one connection, whatever the application says.
+#define FCGI_MPLX_MAX_REQS          128
+//Stop taking request body once this much output is waiting for the socket.
+#define FCGI_MPLX_MAX_OUTBUF        65536
+
+class FcgiApp;
+class FcgiRequest;
+class Multiplexer;
+
+
+/**
+ * A connection to a FastCGI application shared by concurrent requests,
+ * each FcgiRequest is identified by its own request id. Whether the
+ * application can multiplex is asked with FCGI_GET_VALUES on the first
+ * connection, when it can not, every connection carries one request at
+ * a time and is kept open for the next one.
+ *
+ * A connection is never deleted inside its own event handler, a closed
+ * connection is retired to the FcgiApp and released by its timer.
+ */
+class FcgiMplxConn : public EdStream
+    , public DLinkedObj
+    , public LogSession
+{
+public:
+    enum
+    {
+        FMC_CONNECTING,
+        FMC_NEGOTIATING,
+        FMC_READY,
+        FMC_DRAINING,
+        FMC_CLOSED
+    };
+
+    explicit FcgiMplxConn(FcgiApp *pApp);
+    ~FcgiMplxConn();
+
+    int  connectTo(Multiplexer *pMplx);
+
+    bool isUsable() const
+    {   return m_iSessState <= FMC_READY;                   }
+    bool isClosed() const
+    {   return m_iSessState == FMC_CLOSED;                  }
+    bool canStartRequest() const;
+    bool isOutputFull() const
+    {   return m_bufOS.getBuf()->size() >= FCGI_MPLX_MAX_OUTBUF;   }
+    int  getLoad() const
+    {   return m_reqs.size() + m_waitQueue.size();          }
+
+    void attach(FcgiRequest *pReq);
+    void detach(FcgiRequest *pReq);
+    int  startRequest(FcgiRequest *pReq);
+    void releaseRequest(FcgiRequest *pReq, int abort);
+    void waitWrite(FcgiRequest *pReq);
+    void cancelWrite(FcgiRequest *pReq);
+
+    int  sendRecord(const char *pRec, int size);
+    int  writeStream(int streamType, int id, const char *pBuf, int size);
+    int  endOfStream(int streamType, int id);
+
+    void pauseRead();
+    void resumeRead();
+
+    void onSecTimer();
+
+    // EdStream
+    int  onRead();
+    int  onWrite();
+    int  onHangup();
+    int  onError();
+    int  onEventDone(short event)   {   return 0;   }
+
+protected:
+    virtual const char *buildLogId();
+
+private:
+    int  checkReady();
+    int  queryAppAttr();
+    void setReady();
+    void startWaiting();
+    void drain();
+    void closeSession(int err);
+    int  readRecords();
+    int  buildRecHeader(char *pBuf, int size, int &len);
+    int  processRecData(char *pBuf, int size);
+    int  processManagementRec(char *pBuf, int size);
+    void processManagementVal(char *pName, int nameLen,
+                              char *pValue, int valLen);
+    int  processEndOfRequestRecord(FcgiRequest *pReq, char *pBuf, int size);
+    void flushResps();
+
+    enum
+    {
+        REC_HEADER,
+        REC_CONTENT,
+        REC_PADDING
+    };
+
+    FcgiApp            *m_pApp;
+    BufferedOS          m_bufOS;
+    FcgiReqList         m_reqs;
+    AutoBuf             m_bufRec;
+    FCGI_Header         m_recCur;
+    uint16_t            m_recSize;
+    uint16_t            m_iRecStatus;
+    uint16_t            m_iContentLen;
+    uint16_t            m_iRecId;
+    int                 m_iSessState;
+    int                 m_iInEvent;
+    int                 m_iPausedReqs;
+    uint32_t            m_uiSeq;
+    time_t              m_tmStart;
+    time_t              m_tmIdleBegin;
+    time_t              m_tmLastRead;
+    TDLinkQueue<FcgiRequest>    m_waitQueue;
+    TDLinkQueue<FcgiRequest>    m_writeQueue;
+
+    LS_NO_COPY_ASSIGN(FcgiMplxConn);
+};
+
+#endif
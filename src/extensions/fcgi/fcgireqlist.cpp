@@ -29,6 +29,11 @@ class FcgiReqListData : public RequestList
 };
 
 
+//Marks an id still in use by the application after the request is gone.
+static char s_retired;
+#define FCGI_RETIRED_REQ    ((FcgiRequest *)&s_retired)
+
+
 FcgiReqList::FcgiReqList()
     : m_iActiveReqs(0)
     , m_pData(NULL)
@@ -51,7 +56,7 @@ int FcgiReqList::regist(FcgiRequest *pReq)
     int i;
     for (i = 0; i < size; i++)
     {
-        if ((*m_pData)[i] != NULL)
+        if ((*m_pData)[i] == NULL)
         {
             (*m_pData)[i] = pReq;
             break;
@@ -69,7 +74,7 @@ void FcgiReqList::unregist(FcgiRequest *pReq)
 {
     assert(pReq);
     int size = m_pData->size();
-    if (size <= pReq->getId())
+    if ((pReq->getId() > 0) && (pReq->getId() <= size))
     {
         assert(pReq->getId() > 0);
         assert(pReq == (*m_pData)[pReq->getId() - 1]);
@@ -85,10 +90,40 @@ FcgiRequest *FcgiReqList::get(int iId)
     if ((iId < 1) || (iId > (int)m_pData->size()))
         return NULL;
     FcgiRequest *pRet = (*m_pData)[iId - 1];
+    if (pRet == FCGI_RETIRED_REQ)
+        return NULL;
     return pRet;
 }
 
 
+void FcgiReqList::retire(FcgiRequest *pReq)
+{
+    int id = pReq->getId();
+    if ((id < 1) || (id > (int)m_pData->size()))
+        return;
+    assert(pReq == (*m_pData)[id - 1]);
+    (*m_pData)[id - 1] = FCGI_RETIRED_REQ;
+}
+
+
+int FcgiReqList::release(int iId)
+{
+    if (!isRetired(iId))
+        return LS_FAIL;
+    (*m_pData)[iId - 1] = NULL;
+    --m_iActiveReqs;
+    return LS_OK;
+}
+
+
+int FcgiReqList::isRetired(int iId) const
+{
+    if ((iId < 1) || (iId > (int)m_pData->size()))
+        return 0;
+    return ((*m_pData)[iId - 1] == FCGI_RETIRED_REQ);
+}
+
+
 FcgiRequest *FcgiReqList::first()
 {
     return next(0);
@@ -103,10 +138,10 @@ FcgiRequest *FcgiReqList::next(int id)
     for (i = id ; i < size; ++i)
     {
         pRet = (*m_pData)[i];
-        if (pRet)
-            break;
+        if (pRet && pRet != FCGI_RETIRED_REQ)
+            return pRet;
     }
-    return pRet;
+    return NULL;
 }
 
 
@@ -35,6 +35,14 @@ public:
     FcgiRequest *first();
     FcgiRequest *next(int id);
 
+    /**
+     * Keep the id of pReq reserved after the request is gone, until the
+     * application ends it with FCGI_END_REQUEST and release() is called.
+     */
+    void retire(FcgiRequest *pReq);
+    int  release(int iId);
+    int  isRetired(int iId) const;
+
     int size() const
     {   return m_iActiveReqs;   }
     LS_NO_COPY_ASSIGN(FcgiReqList);
@@ -16,70 +16,181 @@
 *    along with this program. If not, see http://www.gnu.org/licenses/.      *
 *****************************************************************************/
 #include "fcgirequest.h"
-#include "fcgirecord.h"
+#include "fcgiapp.h"
 #include "fcgiconnection.h"
+#include "fcgimplxconn.h"
+#include "fcgirecord.h"
+
+#include <edio/multiplexer.h>
 #include <http/httpcgitool.h>
 #include <http/httpextconnector.h>
-#include <http/httplog.h>
 #include <http/httpstatuscode.h>
+#include <log4cxx/logger.h>
+#include <util/datetime.h>
 
 #include <assert.h>
-#include <stdio.h>
+#include <errno.h>
 #include <string.h>
 
-FcgiRequest::FcgiRequest(HttpExtConnector *pConnector)
-    : m_iId(1)
-    , m_iProtocolStatus(-1)
-    , m_iWantWrite(1)
-    , m_iCurStreamHeader(0)
-    , m_iTotalPending(0)
-    , m_pFcgiConn(NULL)
+//Pending STDOUT of one request before the shared connection stops reading.
+#define FCGI_MPLX_MAX_PENDING   (256 * 1024)
+#define FCGI_MPLX_DELIVER_SIZE  16384
+#define FCGI_MPLX_MAX_RETRY     3
+
+
+FcgiRequest::FcgiRequest()
+    : m_pMplxConn(NULL)
+    , m_iId(0)
+    , m_flag(0)
 {
-    //memset( &m_beginReqRec, 0, sizeof( m_beginReqRec ) );
-    setConnector(pConnector);
+    reset();
 }
 
 
 FcgiRequest::~FcgiRequest()
 {
+    close();
 }
 
 
 void FcgiRequest::reset()
 {
-    //m_iId = 0;
-    m_iWantWrite = 1;
-    m_iovec.clear();
-    m_iCurStreamHeader = 0;
-    m_env.clear();
+    m_flag = 0;
+    m_iEndCode = 0;
+    m_iEndStatus = 0;
+    m_bufPending.clear();
+    m_lReqBeginTime = 0;
+    m_lReqSentTime = 0;
+    m_iReqTotalSent = 0;
+    m_iRespRecv = 0;
+}
+
+
+int FcgiRequest::connect(Multiplexer *pMplx)
+{
+    getWorker()->startOnDemond(0);
+    //Not bound to a socket, a failure must never shrink the pool.
+    setReqProcessed(1);
+    setCPState(0);
+    setToClose(0);
+    access(DateTime::s_curTime);
+    setState(PROCESSING);
+    onWrite();
+    return 0;
+}
+
+
+int FcgiRequest::doWrite()
+{
+    HttpExtConnector *pHEC = getConnector();
+    if (!pHEC)
+    {
+        if (m_pMplxConn && !m_iId)
+            releaseSession(0);
+        return 0;
+    }
+    int state = pHEC->getState();
+    if ((!state) || (state & (HEC_FWD_REQ_HEADER | HEC_FWD_REQ_BODY)))
+    {
+        if (!m_iId)
+        {
+            //The connection is gone in the middle of the request body.
+            if (state & HEC_FWD_REQ_BODY)
+            {
+                errno = ECONNRESET;
+                return LS_FAIL;
+            }
+            if (!m_pMplxConn)
+            {
+                m_pMplxConn = ((FcgiApp *)getWorker())->getMplxConn();
+                if (!m_pMplxConn)
+                    return LS_FAIL;
+            }
+            if (!m_pMplxConn->canStartRequest())
+            {
+                m_pMplxConn->attach(this);
+                return 0;
+            }
+            m_pMplxConn->detach(this);
+            m_pMplxConn->startRequest(this);
+        }
+        else if (m_pMplxConn->isOutputFull())
+        {
+            m_pMplxConn->waitWrite(this);
+            return 0;
+        }
+        return pHEC->extOutputReady();
+    }
+    suspendWrite();
+    return 0;
+}
+
+
+int FcgiRequest::onSessionWrite()
+{
+    int ret = onWrite();
+    onEventDone(-1);
+    return ret;
 }
 
 
-int  FcgiRequest::beginRequest(int Role, int iKeepConn)
+void FcgiRequest::onSessionError(int err)
 {
-    assert(m_pFcgiConn != NULL);
-    FCGI_BeginRequestRecord *pRec
-        = (FCGI_BeginRequestRecord *)m_streamHeaders;
-    FcgiRecord::setRecordHeader(
-        pRec->header, FCGI_BEGIN_REQUEST, m_iId, 8);
-    pRec->body.roleB0 = Role & 0xff;
-    pRec->body.roleB1 = (Role >> 8) && 0xff;
-    pRec->body.flags = iKeepConn & 0xff;
-    m_iovec.clear();
-    m_iCurStreamHeader = sizeof(FCGI_BeginRequestRecord);
-    m_iovec.append(m_streamHeaders, sizeof(FCGI_BeginRequestRecord));
-    return 1;
+    LS_DBG_L(this, "[FCGI] Connection failed, error: %d.", err);
+    detachSession();
+    if (getState() == ABORT)
+    {
+        if (getConnector())
+        {
+            incReqProcessed();
+            getConnector()->endResponse(0, 0);
+        }
+        return;
+    }
+    doError(err);
+}
+
+
+void FcgiRequest::onSessionDrain()
+{
+    LS_DBG_L(this, "[FCGI] Connection draining, look for another one.");
+    m_pMplxConn = NULL;
+    onWrite();
+}
+
+
+void FcgiRequest::releaseSession(int abort)
+{
+    if (m_pMplxConn)
+    {
+        if (m_iId)
+            m_pMplxConn->releaseRequest(this, abort);
+        else
+            m_pMplxConn->detach(this);
+        if (m_flag & FRF_PAUSE_SESSION)
+            m_pMplxConn->resumeRead();
+    }
+    detachSession();
 }
 
 
-void  FcgiRequest::abort()
+int FcgiRequest::begin()
 {
-    m_iProtocolStatus = FCGI_ABORT_REQUEST;
-    //sendAbortRec();
+    LS_DBG_M(this, "FcgiRequest::begin(), id: %d", m_iId);
+    FCGI_BeginRequestRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    FcgiRecord::setRecordHeader(rec.header, FCGI_BEGIN_REQUEST, m_iId,
+                                sizeof(FCGI_BeginRequestBody));
+    unsigned short role = getWorker()->getRole();
+    rec.body.roleB0 = role & 0xff;
+    rec.body.roleB1 = (role >> 8) & 0xff;
+    //The connection outlives the request, it is closed by us.
+    rec.body.flags = FCGI_KEEP_CONN;
+    return m_pMplxConn->sendRecord((const char *)&rec, sizeof(rec));
 }
 
 
-int  FcgiRequest::sendReqHeader()
+int FcgiRequest::sendReqHeader()
 {
     int size = m_env.size();
     if (size == 0)
@@ -87,10 +198,16 @@ int  FcgiRequest::sendReqHeader()
         HttpCgiTool::buildFcgiEnv(&m_env, getConnector()->getHttpSession());
         size = m_env.size();
     }
-    int ret = 1;
-    ret = sendSpecial(m_env.get(), size);
+    int ret = m_pMplxConn->writeStream(FCGI_PARAMS, m_iId, m_env.get(), size);
+    setInProcess(1);
     return ret;
+}
 
+
+int FcgiRequest::beginReqBody()
+{
+    LS_DBG_M(this, "FcgiRequest::beginReqBody()");
+    return m_pMplxConn->endOfStream(FCGI_PARAMS, m_iId);
 }
 
 
@@ -101,253 +218,315 @@ int  FcgiRequest::sendReqHeader()
   *
   */
 
-int  FcgiRequest::sendReqBody(const char *pBuf, int size)
+int FcgiRequest::sendReqBody(const char *pBuf, int size)
 {
-    int ret = 1;
-    if (size > 0)
+    if (!m_pMplxConn || !m_iId)
     {
-        if (!m_iovec.empty())
-        {
-            ret = pendingWrite(pBuf, size, FCGI_STDIN);
-            if (flush() == -1)
-                ret = -1;
-        }
-        else
-            ret = m_pFcgiConn->writeStream(FCGI_STDIN, m_iId, pBuf, size);
+        errno = ECONNRESET;
+        return LS_FAIL;
     }
+    if (m_pMplxConn->isOutputFull())
+        return 0;
+    if (size > FCGI_MAX_PACKET_SIZE)
+        size = FCGI_MAX_PACKET_SIZE;
+    int ret = m_pMplxConn->writeStream(FCGI_STDIN, m_iId, pBuf, size);
+    if (ret > 0)
+        m_iReqTotalSent += ret;
     return ret;
 }
 
 
-int FcgiRequest::beginReqBody()
-{
-    if (!m_iovec.empty())
-    {
-        pendingEndStream(FCGI_PARAMS);
-        return 1;
-    }
-    else
-        return m_pFcgiConn->endOfStream(FCGI_PARAMS, m_iId);
-}
-
-
 int FcgiRequest::endOfReqBody()
 {
-    if (!m_iovec.empty())
-    {
-        pendingEndStream(FCGI_STDIN);
-        return flush();
-    }
-    else
-        return m_pFcgiConn->endOfStream(FCGI_STDIN, m_iId);
+    LS_DBG_M(this, "FcgiRequest::endOfReqBody()");
+    m_lReqSentTime = time(NULL);
+    if (m_pMplxConn && m_iId)
+        m_pMplxConn->endOfStream(FCGI_STDIN, m_iId);
+    suspendWrite();
+    return 0;
 }
 
 
-int  FcgiRequest::endOfRequest(int endCode, int status)
+int FcgiRequest::onStdOut(char *pBuf, int size)
 {
-    m_iProtocolStatus = status;
-    HttpExtConnector *pConnector = getConnector();
-    assert(pConnector);
-    if (endCode)
+    HttpExtConnector *pHEC = getConnector();
+    access(DateTime::s_curTime);
+    if (!pHEC || getState() == ABORT)
+        return size;
+    m_iRespRecv += size;
+    if ((m_flag & FRF_SUSPENDED) || !m_bufPending.empty())
     {
-        LS_ERROR(pConnector, "FcgiRequest::endOfRequest( %d, %d)!",
-                 endCode, status);
-        pConnector->endResponse(SC_500, status);
+        m_bufPending.append(pBuf, size);
+        if (m_bufPending.size() > FCGI_MPLX_MAX_PENDING
+            && !(m_flag & FRF_PAUSE_SESSION) && m_pMplxConn)
+        {
+            m_flag |= FRF_PAUSE_SESSION;
+            m_pMplxConn->pauseRead();
+        }
+        return size;
     }
-    else
-        pConnector->endResponse(endCode, status);
-    return 0;
+    LS_DBG_M(this, "Process STDOUT %d bytes", size);
+    m_flag |= FRF_GOT_OUTPUT | FRF_IN_DELIVER;
+    pHEC->processRespData(pBuf, size);
+    m_flag &= ~FRF_IN_DELIVER;
+    return size;
 }
 
 
-int FcgiRequest::begin()
+int FcgiRequest::onStdErr(char *pBuf, int size)
 {
-    return beginRequest(FCGI_RESPONDER,
-                        FCGI_KEEP_CONN);
+    HttpExtConnector *pHEC = getConnector();
+    access(DateTime::s_curTime);
+    if (!pHEC)
+        return size;
+    LS_DBG_M(this, "Process STDERR %d bytes", size);
+    return pHEC->processErrData(pBuf, size);
 }
 
 
-//int  FcgiRequest::onExtWrite( )
-//{
-//    int ret = 0;
-//    HttpExtConnector * pConnector = getConnector();
-//    assert( pConnector );
-//    LS_DBG_M(pConnector, "FcgiRequest::onWrite()");
-//    ret = pConnector->extOutputReady( );
-//    return ret;
-//}
-
-
-int FcgiRequest::onStdOut()
+void FcgiRequest::onReadDone()
 {
-    HttpExtConnector *pConnector = getConnector();
-    assert(pConnector);
-    LS_DBG_M(pConnector, "onStdOut()");
-    return pConnector->extInputReady();
-
+    if (!(m_flag & FRF_GOT_OUTPUT))
+        return;
+    m_flag &= ~FRF_GOT_OUTPUT;
+    if (getConnector() && m_bufPending.empty())
+        getConnector()->flushResp();
 }
 
 
-int  FcgiRequest::processStdOut(char *pBuf, int size)
+int FcgiRequest::onEndRequest(int endCode, int status)
 {
-    HttpExtConnector *pConnector = getConnector();
-    assert(pConnector);
-    LS_DBG_M(pConnector, "Process STDOUT %d bytes", size);
-    return pConnector->processRespData(pBuf, size);
+    if (m_flag & FRF_PAUSE_SESSION)
+        m_pMplxConn->resumeRead();
+    detachSession();
+    if ((status == FCGI_CANT_MPX_CONN || status == FCGI_OVERLOADED)
+        && getState() != ABORT)
+        return retry(status);
+    if (!m_bufPending.empty() && getState() != ABORT)
+    {
+        m_iEndCode = endCode;
+        m_iEndStatus = status;
+        m_flag |= FRF_END_PENDING;
+        return 0;
+    }
+    return finishResp(endCode, status);
 }
 
 
-int  FcgiRequest::processStdErr(char *pBuf, int size)
+int FcgiRequest::retry(int status)
 {
-    HttpExtConnector *pConnector = getConnector();
-    assert(pConnector);
-    LS_DBG_M(pConnector, "Process STDERR %d bytes", size);
-    return pConnector->processErrData(pBuf, size);
+    ExtRequest *pReq = getReq();
+    if (pReq && m_iRespRecv == 0 && pReq->isRecoverable()
+        && pReq->getAttempts() < FCGI_MPLX_MAX_RETRY)
+    {
+        LS_DBG_L(this, "[FCGI] Request rejected, protocol status: %d, retry.",
+                 status);
+        pReq->incAttempts();
+        pReq->resetConnector();
+        return reconnect();
+    }
+    incReqProcessed();
+    setInProcess(0);
+    if (getConnector())
+        getConnector()->endResponse(SC_503, status);
+    return 0;
 }
 
 
-int  FcgiRequest::onError()
+int FcgiRequest::finishResp(int endCode, int status)
 {
-    endOfRequest(SC_500, -1);
+    HttpExtConnector *pHEC = getConnector();
+    releaseSession(0);
+    incReqProcessed();
+    setInProcess(0);
+    if (!pHEC)
+        return 0;
+    if (getState() == ABORT)
+    {
+        setState(PROCESSING);
+        pHEC->endResponse(0, 0);
+    }
+    else if (endCode)
+    {
+        LS_ERROR(this, "FcgiRequest::finishResp( %d, %d)!", endCode, status);
+        pHEC->endResponse(SC_500, status);
+    }
+    else
+        pHEC->endResponse(endCode, status);
     return 0;
 }
 
 
-void FcgiRequest::cleanUp()
+int FcgiRequest::deliverPending()
 {
-    //ExtRequest::cleanUp();
-    if (m_pFcgiConn)
+    HttpExtConnector *pHEC;
+    int len;
+    m_flag |= FRF_IN_DELIVER;
+    while (!(m_flag & FRF_SUSPENDED) && !m_bufPending.empty()
+           && (pHEC = getConnector()) != NULL)
     {
-        FcgiConnection *pConn = m_pFcgiConn;
-        m_pFcgiConn->removeRequest(this);
-        pConn->recycle();
+        len = m_bufPending.size();
+        if (len > FCGI_MPLX_DELIVER_SIZE)
+            len = FCGI_MPLX_DELIVER_SIZE;
+        pHEC->processRespData(m_bufPending.begin(), len);
+        if (getConnector() != pHEC)
+            break;
+        m_bufPending.pop_front(len);
+        pHEC->flushResp();
     }
-    reset();
+    m_flag &= ~FRF_IN_DELIVER;
+    if ((m_flag & FRF_PAUSE_SESSION)
+        && m_bufPending.size() < FCGI_MPLX_MAX_PENDING / 2)
+    {
+        m_flag &= ~FRF_PAUSE_SESSION;
+        m_pMplxConn->resumeRead();
+    }
+    if (m_bufPending.empty() && (m_flag & FRF_END_PENDING))
+    {
+        m_flag &= ~FRF_END_PENDING;
+        return finishResp(m_iEndCode, m_iEndStatus);
+    }
+    return 0;
 }
 
 
-void FcgiRequest::finishRecvBuf()
+void FcgiRequest::continueRead()
 {
-    if (m_pFcgiConn)
-        m_pFcgiConn->finishRecvBuf();
-    m_iProtocolStatus = 0;
+    m_flag &= ~FRF_SUSPENDED;
+    //Never re-enter the delivery loop, it goes on when the call returns.
+    if (!(m_flag & FRF_IN_DELIVER) && !m_bufPending.empty())
+        deliverPending();
 }
 
 
-//void FcgiRequest::continueRead()
-//{
-//    m_iWantRead = 1;
-//    m_pFcgiConn->continueRead();
-//}
+void FcgiRequest::suspendRead()
+{
+    m_flag |= FRF_SUSPENDED;
+}
 
 
 void FcgiRequest::continueWrite()
 {
-    m_iWantWrite = 1;
-    m_pFcgiConn->continueWrite();
+    if (m_pMplxConn && m_iId)
+        m_pMplxConn->waitWrite(this);
 }
 
 
-int FcgiRequest::connUnavail()
+void FcgiRequest::suspendWrite()
 {
-    getConnector()->endResponse(SC_500, -1);
-    return 0;
+    if (m_pMplxConn && m_iId)
+        m_pMplxConn->cancelWrite(this);
 }
 
 
-int FcgiRequest::pendingEndStream(int type)
+void FcgiRequest::abort()
 {
-    assert(m_iCurStreamHeader < 64);
-    FCGI_Header *pRec = (FCGI_Header *)
-                        & (m_streamHeaders[ m_iCurStreamHeader]);
-    m_iCurStreamHeader += sizeof(FCGI_Header);
-    FcgiRecord::setRecordHeader(*pRec, type, m_iId, 0);
-    m_iovec.appendCombine((char *)pRec, sizeof(FCGI_Header));
-    return 1;
+    if (getState() == DISCONNECTED)
+        return;
+    LS_DBG_L(this, "[FCGI] Abort request %d.", m_iId);
+    setState(ABORT);
+    if (m_flag & FRF_END_PENDING)
+    {
+        //Already ended by the application, drop what is left.
+        m_bufPending.clear();
+        deliverPending();
+        return;
+    }
+    m_bufPending.clear();
+    if (m_flag & FRF_PAUSE_SESSION)
+    {
+        m_flag &= ~FRF_PAUSE_SESSION;
+        m_pMplxConn->resumeRead();
+    }
+    if (m_pMplxConn && m_iId)
+    {
+        //The response is ended once the application ends the request.
+        m_pMplxConn->cancelWrite(this);
+        m_pMplxConn->endOfStream(FCGI_ABORT_REQUEST, m_iId);
+        m_flag |= FRF_ABORT_SENT;
+    }
 }
 
 
-int FcgiRequest::pendingWrite(const char *pBuf, int size, int type)
+int FcgiRequest::close()
 {
-    int ret = size;
-    int packetSize = size;
-    if (packetSize > FCGI_MAX_PACKET_SIZE)
-        packetSize = FCGI_MAX_PACKET_SIZE;
-
-    FCGI_Header *pRec = (FCGI_Header *)
-                        & (m_streamHeaders[ m_iCurStreamHeader]);
-    m_iCurStreamHeader += sizeof(FCGI_Header);
-    FcgiRecord::setRecordHeader(*pRec, type, m_iId, packetSize);
-    m_iovec.appendCombine((char *)pRec, sizeof(FCGI_Header));
-    m_iovec.append((char *)pBuf, packetSize);
-    m_iTotalPending += packetSize;
-    if (pRec->paddingLength > 0)
-    {
-        m_iovec.append(FcgiConnection::s_padding, pRec->paddingLength);
-        m_iTotalPending += pRec->paddingLength;
-    }
-    size -= packetSize;
-    pBuf += packetSize;
-    if ((size > 0)
-        || (m_iTotalPending > FCGI_MAX_PACKET_SIZE * 2)
-        || (m_iCurStreamHeader >= 56))
-        ret = flush();
-    if ((size > 0) && (ret > 0))
+    releaseSession(1);
+    if (getState() != DISCONNECTED)
     {
-        size = m_pFcgiConn->writeStream(type, m_iId, pBuf, size);
-        if (size == -1)
-            return LS_FAIL;
-        ret = size + packetSize;
+        LS_DBG_L(this, "[ExtConn] close()");
+        setState(DISCONNECTED);
+        setInProcess(0);
     }
-    return ret;
+    return 0;
 }
 
 
-int  FcgiRequest::sendSpecial(const char *pBuf, int size)
+void FcgiRequest::cleanUp()
 {
-    int ret = 1;
-    if (size > 0)
-        ret = pendingWrite(pBuf, size, FCGI_PARAMS);
-    return ret;
+    setConnector(NULL);
+    close();
+    reset();
+    recycle();
 }
 
 
-int  FcgiRequest::flush()
+int FcgiRequest::doError(int err)
 {
-    int ret = 1;
-    if (!m_iovec.empty())
+    LS_DBG_L(this, "FcgiRequest::doError()");
+    if (getConnector())
     {
-        ret = m_pFcgiConn->cacheWritev(m_iovec);
-        if (ret == -1)
-            return LS_FAIL;
-        assert(ret >= m_iTotalPending + m_iCurStreamHeader);
-        m_iovec.clear();
-        m_iTotalPending = 0;
-        m_iCurStreamHeader = 0;
+        int state = getConnector()->getState();
+        if (!(state & (HEC_FWD_RESP_BODY | HEC_ABORT_REQUEST
+                       | HEC_ERROR | HEC_COMPLETE)))
+        {
+            LS_DBG_L(this, "FastCGI connection failed, try again!");
+            connError(err);
+            return 0;
+        }
+        if (!(state & HEC_COMPLETE))
+            getConnector()->endResponse(SC_500, -1);
     }
-    return ret;
+    return 0;
 }
 
 
-int FcgiRequest::sendAbortRec()
+int FcgiRequest::addRequest(ExtRequest *pReq)
 {
-    LS_DBG_L(getLogger(), "[%s] [FCGI] send abort packet!",
-             getConnector()->getLogId());
-    FCGI_Header rec;
-    FcgiRecord::setRecordHeader(rec, FCGI_ABORT_REQUEST, m_iId, 0);
-    return m_pFcgiConn->sendRecord((const char *)&rec, sizeof(rec));
+    assert(pReq);
+    setConnector((HttpExtConnector *)pReq);
+    reset();
+    m_env.clear();
+    m_lReqBeginTime = time(NULL);
+    return 0;
 }
 
 
-int FcgiRequest::readResp(char *pBuf, int size)
+ExtRequest *FcgiRequest::getReq() const
 {
-    return m_pFcgiConn->readStdOut(m_iId, pBuf, size);
+    return getConnector();
 }
 
 
-void FcgiRequest::onProcessorTimer()
+int FcgiRequest::removeRequest(ExtRequest *pReq)
 {
-    if (m_pFcgiConn)
-        m_pFcgiConn->onProcessorTimer();
+    if (getConnector())
+    {
+        getConnector()->setProcessor(NULL);
+        setConnector(NULL);
+    }
+    return 0;
 }
 
+
+void FcgiRequest::dump()
+{
+    LS_INFO(this,
+            "FastCGI request %d, state: %d, flag: %d, "
+            "Request body sent: %lld, Response received: %lld, pending: %d, "
+            "waiting for response for %ld seconds, "
+            "Total processing time: %ld.",
+            m_iId, getState(), m_flag, (long long)m_iReqTotalSent,
+            (long long)m_iRespRecv, m_bufPending.size(),
+            (m_lReqSentTime) ? time(NULL) - m_lReqSentTime : 0,
+            time(NULL) - m_lReqBeginTime);
+}
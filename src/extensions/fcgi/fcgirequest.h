@@ -22,95 +22,115 @@
 #include "fcgienv.h"
 
 #include <lsdef.h>
-#include <extensions/extrequest.h>
+#include <extensions/extconn.h>
 #include <extensions/httpextprocessor.h>
-#include <util/iovec.h>
+#include <util/autobuf.h>
+#include <util/dlinkqueue.h>
 
 /*
  * Mask for flags component of FCGI_BeginRequestBody
  */
 #define FCGI_KEEP_CONN  1
 
+#define FRF_SUSPENDED       1
+#define FRF_IN_DELIVER      2
+#define FRF_PAUSE_SESSION   4
+#define FRF_END_PENDING     8
+#define FRF_GOT_OUTPUT      16
+#define FRF_ABORT_SENT      32
 
-class FcgiConnection;
+class FcgiMplxConn;
 class HttpExtConnector;
 
-class FcgiRequest : public HttpExtProcessor, public ExtRequest
+
+/**
+ * The ExtConn of a FastCGI application with fcgiMultiplex on. It is not
+ * bound to a socket, it carries one request at a time with its own
+ * request id on a shared FcgiMplxConn, so the connection pool of the
+ * application limits the number of requests in flight instead of the
+ * number of sockets.
+ *
+ * FastCGI has no per request flow control, STDOUT received while the
+ * client is slow is buffered here, the shared connection stops reading
+ * only when one request has too much of it.
+ */
+class FcgiRequest : public ExtConn
+    , public HttpExtProcessor
+    , public DLinkedObj
 {
-    int     m_iId;
-    int     m_iProtocolStatus;
-    //int    m_iWantRead;
-    int     m_iWantWrite;
-    int     m_iCurStreamHeader;
-    IOVec   m_iovec;
-    int     m_iTotalPending;
-    FcgiEnv m_env;
-    char    m_streamHeaders[sizeof(FCGI_Header) * 8 ];
-    //FCGI_Header             m_streamHeaders[5];
-    //FCGI_BeginRequestRecord m_beginReqRec;
-
-    FcgiConnection   *m_pFcgiConn;
-
-    int  pendingEndStream(int type);
-    int  pendingWrite(const char *pBuf, int size, int type);
-    int  sendAbortRec();
-
-    enum
-    {
-        WANT_READ = 1,
-        WANT_WRITE = 2
-    };
+    FcgiMplxConn   *m_pMplxConn;
+    int             m_iId;
+    int             m_flag;
+    int             m_iEndCode;
+    int             m_iEndStatus;
+    AutoBuf         m_bufPending;
+    FcgiEnv         m_env;
+    long            m_lReqBeginTime;
+    long            m_lReqSentTime;
+    int64_t         m_iReqTotalSent;
+    int64_t         m_iRespRecv;
+
+    int         deliverPending();
+    int         finishResp(int endCode, int status);
+    int         retry(int status);
+    void        releaseSession(int abort);
+
+protected:
+    virtual int doRead()    {   return 0;   }
+    virtual int doWrite();
+    virtual int doError(int err);
+    virtual int addRequest(ExtRequest *pReq);
+    virtual ExtRequest *getReq() const;
+    virtual void init(int fd, Multiplexer *pMplx)   {}
+    virtual int connect(Multiplexer *pMplx);
 
 public:
+    virtual int removeRequest(ExtRequest *pReq);
 
-    explicit FcgiRequest(HttpExtConnector *pConnector = 0);
+public:
+    FcgiRequest();
     ~FcgiRequest();
+
+    void setId(int id)          {   m_iId = id;     }
+    int  getId() const          {   return m_iId;   }
+
+    int  onSessionWrite();
+    void onSessionError(int err);
+    void onSessionDrain();
+    int  onStdOut(char *pBuf, int size);
+    int  onStdErr(char *pBuf, int size);
+    int  onEndRequest(int endCode, int status);
+    void onReadDone();
+    void detachSession()
+    {   m_pMplxConn = NULL;  m_iId = 0;  m_flag &= ~FRF_PAUSE_SESSION;    }
+    void setAbortSent()         {   m_flag |= FRF_ABORT_SENT;   }
+    int  isAbortSent() const    {   return m_flag & FRF_ABORT_SENT;     }
+
+    virtual void finishRecvBuf()    {}
+
+    virtual bool wantRead()     {   return false;   }
+    virtual bool wantWrite()    {   return false;   }
+
+    virtual void abort();
+    virtual int  begin();
+    virtual int  beginReqBody();
+    virtual int  endOfReqBody();
+    virtual int  sendReqBody(const char *pBuf, int size);
+    virtual int  readResp(char *pBuf, int size)
+    {   return 0;   }
+    virtual void cleanUp();
+    virtual void dump();
+
+    virtual int sendReqHeader();
+    virtual int close();
     void reset();
 
-    void setFcgiConn(FcgiConnection *pConn)
-    {   m_pFcgiConn = pConn;    }
-
-    FcgiConnection *getFcgiConn() const
-    {   return m_pFcgiConn;     }
-
-    void setId(int id)    {   m_iId = id; }
-    int  getId() const      {   return m_iId;   }
-    int  begin();
-    int  beginRequest(int Role, int iKeepConn = FCGI_KEEP_CONN);
-    int  sendSpecial(const char *pBuf, int size);
-    int  sendReqBody(const char *pBuf, int size);
-    int  sendReqHeader();
-    int  beginReqBody();
-    int  endOfReqBody();
-    int  readResp(char *pBuf, int size);
-    void abort();
-    void cleanUp();
-    int  flush();
-
-    void suspendRead()      {}//    m_iWantRead = 0;    }
-    void continueRead()     {}
-    void suspendWrite()     {    m_iWantWrite = 0;   }
+    void continueRead();
+    void suspendRead();
     void continueWrite();
+    void suspendWrite();
 
-    char wantRead() const   {   return 1;               }
-    char wantWrite() const  {   return m_iWantWrite;    }
-    bool wantAbort() const
-    {   return m_iProtocolStatus == FCGI_ABORT_REQUEST; }
-
-    //int  onExtWrite();
-    int  onStdOut();
-    int  onError();
-    int  processStdOut(char *pBuf, int size);
-    int  processStdErr(char *pBuf, int size);
-    int  endOfRequest(int code, int status);
-    int  sendEndOfStream(int type);
-
-    int  connUnavail();
-
-    void finishRecvBuf();
-    void onProcessorTimer();
-    virtual HttpExtConnector *getExtConnector()
-    {   return HttpExtProcessor::getConnector();    }
+    long getReqBeginTime() const    {   return m_lReqBeginTime;     }
 
     LS_NO_COPY_ASSIGN(FcgiRequest);
 };
@@ -18,11 +18,65 @@
 #include "loadbalancer.h"
 #include <extensions/extrequest.h>
 #include <http/handlertype.h>
+#include <http/httpreq.h>
+#include <http/httpsession.h>
+#include <log4cxx/logger.h>
+#include <lsr/ls_atomic.h>
+#include <lsr/ls_strtool.h>
+#include <lsr/xxhash.h>
+#include <shm/lsshm.h>
+#include <shm/lsshmhash.h>
+#include <shm/lsshmpool.h>
+#include <util/datetime.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define shmLbScore          "LBScore"
+
+// Virtual nodes per worker on the consistent hash ring.
+#define LB_RING_VNODES      64
+// EWMA weight of a new latency sample, 1/8.
+#define LB_EWMA_SHIFT       3
+// Latency charged for a failed request, steers P2C away from it.
+#define LB_FAIL_PENALTY_US  1000000
+
+
+struct LbScore_s
+{
+    int32_t     x_iInFlight;
+    uint32_t    x_iEwmaUs;
+    uint32_t    x_iFails;
+    uint32_t    x_iPad;
+    uint64_t    x_iTotal;
+};
+
+
+struct LbRingNode_s
+{
+    uint32_t    m_hash;
+    int         m_idx;
+};
+
+
+LsShmHash *LoadBalancer::s_pScoreboard = NULL;
+
+
+static int64_t curTimeUs()
+{
+    return (int64_t)DateTime::s_curTime * 1000000 + DateTime::s_curTimeUs;
+}
 
 
 LoadBalancer::LoadBalancer(const char *pName)
     : ExtWorker(HandlerType::HT_LOADBALANCER)
     , m_lastWorker(0)
+    , m_iPolicy(LB_POLICY_LEAST_LOAD)
+    , m_pScoreOff(NULL)
+    , m_pRing(NULL)
+    , m_iRingSize(0)
 {
     setConfigPointer(new ExtWorkerConfig(pName));
 }
@@ -30,6 +84,7 @@ LoadBalancer::LoadBalancer(const char *pName)
 
 LoadBalancer::~LoadBalancer()
 {
+    clearWorkerList();
 }
 
 
@@ -45,6 +100,120 @@ int LoadBalancer::addWorker(ExtWorker *pWorker)
 }
 
 
+void LoadBalancer::clearWorkerList()
+{
+    m_workers.clear();
+    if (m_pScoreOff)
+    {
+        free(m_pScoreOff);
+        m_pScoreOff = NULL;
+    }
+    if (m_pRing)
+    {
+        free(m_pRing);
+        m_pRing = NULL;
+    }
+    m_iRingSize = 0;
+}
+
+
+const char *LoadBalancer::getPolicyName(int policy)
+{
+    static const char *s_pNames[] =
+    {   "least-load", "p2c-ewma", "consistent-hash"   };
+    if (policy < 0 || policy > LB_POLICY_CONSISTENT_HASH)
+        return "unknown";
+    return s_pNames[policy];
+}
+
+
+int LoadBalancer::initScoreboard()
+{
+    LsShm *pShm;
+    LsShmPool *pPool;
+    char achKey[512];
+    int len, valLen;
+    LbScore_t score;
+
+    if (!s_pScoreboard)
+    {
+        if ((pShm = LsShm::open(shmLbScore, 0)) == NULL)
+            return LS_FAIL;
+        if ((pPool = pShm->getGlobalPool()) == NULL)
+            return LS_FAIL;
+        s_pScoreboard = pPool->getNamedHash(shmLbScore, 500,
+                                            LsShmHash::hashXXH32, memcmp, 0);
+        if (!s_pScoreboard)
+            return LS_FAIL;
+        s_pScoreboard->disableAutoLock();
+    }
+
+    m_pScoreOff = (LsShmOffset_t *)calloc(m_workers.size(),
+                                          sizeof(LsShmOffset_t));
+    if (!m_pScoreOff)
+        return LS_FAIL;
+    memset(&score, 0, sizeof(score));
+    s_pScoreboard->lock();
+    for (int i = 0; i < m_workers.size(); ++i)
+    {
+        len = snprintf(achKey, sizeof(achKey), "%s\t%s", getName(),
+                       m_workers[i]->getName());
+        if (len >= (int)sizeof(achKey))
+            len = sizeof(achKey) - 1;
+        m_pScoreOff[i] = s_pScoreboard->find(achKey, len, &valLen);
+        if (m_pScoreOff[i] == 0)
+            m_pScoreOff[i] = s_pScoreboard->insert(achKey, len, &score,
+                                                   sizeof(score));
+    }
+    s_pScoreboard->unlock();
+    return LS_OK;
+}
+
+
+LbScore_t *LoadBalancer::getScore(int n) const
+{
+    if (!m_pScoreOff || m_pScoreOff[n] == 0)
+        return NULL;
+    return (LbScore_t *)s_pScoreboard->offset2ptr(m_pScoreOff[n]);
+}
+
+
+static int cmpRingNode(const void *p1, const void *p2)
+{
+    uint32_t h1 = ((const LbRingNode_t *)p1)->m_hash;
+    uint32_t h2 = ((const LbRingNode_t *)p2)->m_hash;
+    return (h1 < h2) ? -1 : (h1 > h2);
+}
+
+
+int LoadBalancer::buildRing()
+{
+    char achKey[512];
+    int len;
+    int n = m_workers.size() * LB_RING_VNODES;
+    m_pRing = (LbRingNode_t *)malloc(n * sizeof(LbRingNode_t));
+    if (!m_pRing)
+        return LS_FAIL;
+    LbRingNode_t *pNode = m_pRing;
+    for (int i = 0; i < m_workers.size(); ++i)
+    {
+        for (int v = 0; v < LB_RING_VNODES; ++v)
+        {
+            len = snprintf(achKey, sizeof(achKey), "%s#%d",
+                           m_workers[i]->getName(), v);
+            if (len >= (int)sizeof(achKey))
+                len = sizeof(achKey) - 1;
+            pNode->m_hash = XXH32(achKey, len, 0);
+            pNode->m_idx = i;
+            ++pNode;
+        }
+    }
+    qsort(m_pRing, n, sizeof(LbRingNode_t), cmpRingNode);
+    m_iRingSize = n;
+    return LS_OK;
+}
+
+
 int LoadBalancer::workerLoadCompare(ExtWorker *pWorker, ExtWorker *pSelect)
 {
     if (pWorker->getState() == ExtWorker::ST_BAD)
@@ -56,16 +225,21 @@ int LoadBalancer::workerLoadCompare(ExtWorker *pWorker, ExtWorker *pSelect)
 }
 
 
-ExtWorker *LoadBalancer::selectWorker(HttpSession *pSession,
-                                      ExtRequest *pExtReq)
+int LoadBalancer::isAvailable(ExtRequest *pExtReq, int n)
+{
+    return !pExtReq->isWorkerTracked(n)
+           && m_workers[n]->getState() != ExtWorker::ST_BAD;
+}
+
+
+int LoadBalancer::selectLeastLoad(ExtRequest *pExtReq)
 {
     ExtWorker *pWorker, *pSelected = NULL;
-    int select = 0;
+    int select = -1;
     int n = 0;
-    int track = pExtReq->getWorkerTrack();
     while (n < m_workers.size())
     {
-        if ((track & (1 << n)) == 0)
+        if (!pExtReq->isWorkerTracked(n))
         {
             if (!pSelected)
             {
@@ -84,10 +258,204 @@ ExtWorker *LoadBalancer::selectWorker(HttpSession *pSession,
         }
         ++n;
     }
-    if (pSelected)
-        pExtReq->addWorkerTrack(select);
-    return pSelected;
+    return select;
 }
 
 
+static inline uint64_t scoreCost(LbScore_t *pScore)
+{
+    //Unknown latency is cheapest, so a new worker gets a sample quickly.
+    return (uint64_t)(ls_atomic_value(&pScore->x_iInFlight) + 1)
+           * (pScore->x_iEwmaUs + 1);
+}
+
+
+int LoadBalancer::selectP2c(ExtRequest *pExtReq)
+{
+    int n = m_workers.size();
+    int a = -1, b = -1, i, tries;
+
+    for (tries = 0; tries < 8 && b == -1; ++tries)
+    {
+        i = random() % n;
+        if (i == a || !isAvailable(pExtReq, i))
+            continue;
+        if (a == -1)
+            a = i;
+        else
+            b = i;
+    }
+    if (b == -1)
+    {
+        //Most workers have been tried or are down, scan for the rest.
+        for (i = 0; i < n && b == -1; ++i)
+        {
+            if (i == a || !isAvailable(pExtReq, i))
+                continue;
+            if (a == -1)
+                a = i;
+            else
+                b = i;
+        }
+    }
+    if (a == -1)
+        return selectLeastLoad(pExtReq);
+    if (b == -1)
+        return a;
+
+    LbScore_t *pA = getScore(a);
+    LbScore_t *pB = getScore(b);
+    if (!pA || !pB)
+        return (workerLoadCompare(m_workers[b], m_workers[a]) < 0) ? b : a;
+    return (scoreCost(pB) < scoreCost(pA)) ? b : a;
+}
+
+
+int LoadBalancer::selectHash(HttpSession *pSession, ExtRequest *pExtReq)
+{
+    if (!m_pRing && buildRing() != LS_OK)
+        return selectLeastLoad(pExtReq);
+
+    HttpReq *pReq = pSession->getReq();
+    uint32_t hash = XXH32(pReq->getHostStr(), pReq->getHostStrLen(), 0);
+    hash = XXH32(pReq->getURI(), pReq->getURILen(), hash);
+
+    int lo = 0, hi = m_iRingSize, mid;
+    while (lo < hi)
+    {
+        mid = (lo + hi) >> 1;
+        if (m_pRing[mid].m_hash < hash)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (int i = 0; i < m_iRingSize; ++i)
+    {
+        int idx = m_pRing[(lo + i) % m_iRingSize].m_idx;
+        if (isAvailable(pExtReq, idx))
+            return idx;
+    }
+    return selectLeastLoad(pExtReq);
+}
+
+
+ExtWorker *LoadBalancer::selectWorker(HttpSession *pSession,
+                                      ExtRequest *pExtReq)
+{
+    int select;
+    if (m_workers.size() == 0)
+        return NULL;
+
+    //A worker is selected again only when the previous one failed.
+    releaseScore(pExtReq, 1);
+
+    if (m_iPolicy != LB_POLICY_LEAST_LOAD && !m_pScoreOff
+        && initScoreboard() != LS_OK)
+    {
+        LS_WARN("[LB:%s] Failed to init SHM scoreboard, fall back to "
+                "least-load policy.", getName());
+        m_iPolicy = LB_POLICY_LEAST_LOAD;
+    }
+
+    switch (m_iPolicy)
+    {
+    case LB_POLICY_P2C_EWMA:
+        select = selectP2c(pExtReq);
+        break;
+    case LB_POLICY_CONSISTENT_HASH:
+        select = selectHash(pSession, pExtReq);
+        break;
+    default:
+        select = selectLeastLoad(pExtReq);
+        break;
+    }
+    if (select == -1)
+        return NULL;
+
+    pExtReq->addWorkerTrack(select);
+    LbScore_t *pScore = getScore(select);
+    if (pScore)
+    {
+        ls_atomic_add(&pScore->x_iInFlight, 1);
+        pExtReq->setLbWorker(select);
+        pExtReq->setLbStartUs(curTimeUs());
+    }
+    return m_workers[select];
+}
+
+
+void LoadBalancer::onRespHeader(ExtRequest *pExtReq)
+{
+    int n = pExtReq->getLbWorker();
+    LbScore_t *pScore;
+    if (n < 0 || pExtReq->getLbStartUs() == 0
+        || (pScore = getScore(n)) == NULL)
+        return;
+    int64_t latency = curTimeUs() - pExtReq->getLbStartUs();
+    pExtReq->setLbStartUs(0);
+    if (latency < 0)
+        latency = 0;
+    //Concurrent updates from other processes may be lost, that is fine
+    //for a moving average.
+    int64_t ewma = pScore->x_iEwmaUs;
+    if (ewma == 0)
+        ewma = latency;
+    else
+        ewma += (latency - ewma) >> LB_EWMA_SHIFT;
+    pScore->x_iEwmaUs = (ewma > UINT32_MAX) ? UINT32_MAX : ewma;
+}
+
+
+void LoadBalancer::releaseScore(ExtRequest *pExtReq, int failed)
+{
+    int n = pExtReq->getLbWorker();
+    LbScore_t *pScore;
+    if (n < 0)
+        return;
+    pExtReq->setLbWorker(-1);
+    if ((pScore = getScore(n)) == NULL)
+        return;
+    if (ls_atomic_sub(&pScore->x_iInFlight, 1) < 0)
+        ls_atomic_add(&pScore->x_iInFlight, 1);
+    ls_atomic_add(&pScore->x_iTotal, 1);
+    if (failed)
+    {
+        ls_atomic_add(&pScore->x_iFails, 1);
+        uint64_t ewma = pScore->x_iEwmaUs;
+        ewma += (LB_FAIL_PENALTY_US - (int64_t)ewma) >> LB_EWMA_SHIFT;
+        pScore->x_iEwmaUs = ewma;
+    }
+}
+
+
+int LoadBalancer::generateRTReport(int fd, const char *pTypeName)
+{
+    char achBuf[4096];
+    char *p = achBuf;
+    LbScore_t *pScore;
+
+    ExtWorker::generateRTReport(fd, pTypeName);
+    p += ls_snprintf(p, &achBuf[sizeof(achBuf)] - p,
+                     "LB [%s]: POLICY: %s, WORKERS: %d\n",
+                     getName(), getPolicyName(m_iPolicy), m_workers.size());
+    for (int i = 0; i < m_workers.size(); ++i)
+    {
+        if (&achBuf[sizeof(achBuf)] - p < 256)
+        {
+            write(fd, achBuf, p - achBuf);
+            p = achBuf;
+        }
+        if ((pScore = getScore(i)) == NULL)
+            continue;
+        p += ls_snprintf(p, &achBuf[sizeof(achBuf)] - p,
+                         "LB_WORKER [%s] [%s]: INFLIGHT: %d, EWMA_US: %u, "
+                         "FAILS: %u, TOT_REQS: %llu\n",
+                         getName(), m_workers[i]->getName(),
+                         ls_atomic_value(&pScore->x_iInFlight),
+                         pScore->x_iEwmaUs, pScore->x_iFails,
+                         (unsigned long long)pScore->x_iTotal);
+    }
+    write(fd, achBuf, p - achBuf);
+    return 0;
+}
 
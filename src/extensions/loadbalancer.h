@@ -22,12 +22,48 @@
 #include <extensions/extworker.h>
 
 class HttpSession;
+class LsShmHash;
+typedef uint32_t LsShmOffset_t;
+typedef struct LbScore_s LbScore_t;
+typedef struct LbRingNode_s LbRingNode_t;
 
+enum
+{
+    LB_POLICY_LEAST_LOAD,
+    LB_POLICY_P2C_EWMA,
+    LB_POLICY_CONSISTENT_HASH,
+};
+
+/**
+ * LB_POLICY_LEAST_LOAD compares the local queue depth and utilization of
+ * every worker, it only sees the load created by the current process.
+ *
+ * LB_POLICY_P2C_EWMA and LB_POLICY_CONSISTENT_HASH use a scoreboard in SHM
+ * shared by all server processes, tracking in-flight requests and the
+ * EWMA of the response header latency of each worker. P2C picks the
+ * cheaper of two random workers, consistent hash maps a request URL to the
+ * same worker on a hash ring and falls through to the next one on failure.
+ */
 class LoadBalancer: public ExtWorker
 {
 private:
     TPointerList<ExtWorker>     m_workers;
     int                         m_lastWorker;
+    int                         m_iPolicy;
+    LsShmOffset_t              *m_pScoreOff;
+    LbRingNode_t               *m_pRing;
+    int                         m_iRingSize;
+
+    static LsShmHash           *s_pScoreboard;
+
+    int  initScoreboard();
+    int  buildRing();
+    LbScore_t *getScore(int n) const;
+    int  isAvailable(ExtRequest *pExtReq, int n);
+    int  selectLeastLoad(ExtRequest *pExtReq);
+    int  selectP2c(ExtRequest *pExtReq);
+    int  selectHash(HttpSession *pSession, ExtRequest *pExtReq);
+    void releaseScore(ExtRequest *pExtReq, int failed);
 
 protected:
     virtual ExtConn *newConn();
@@ -38,10 +74,20 @@ public:
 
     ~LoadBalancer();
     ExtWorker *selectWorker(HttpSession *pSession, ExtRequest *pExtReq);
+    void onRespHeader(ExtRequest *pExtReq);
+    void onReqDone(ExtRequest *pExtReq, int failed)
+    {   releaseScore(pExtReq, failed);  }
 
     int getWorkerCount() const      {   return m_workers.size();    }
     int addWorker(ExtWorker *pWorker);
-    void clearWorkerList()          {   m_workers.clear();          }
+    void clearWorkerList();
+
+    void setPolicy(int policy)      {   m_iPolicy = policy;         }
+    int  getPolicy() const          {   return m_iPolicy;           }
+    static const char *getPolicyName(int policy);
+
+    virtual int generateRTReport(int fd, const char *pTypeName);
+
     LS_NO_COPY_ASSIGN(LoadBalancer);
 };
 
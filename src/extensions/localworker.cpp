@@ -19,6 +19,7 @@
 
 #include "localworkerconfig.h"
 #include "pidlist.h"
+#include "poolscaler.h"
 #include "cgi/suexec.h"
 #include "registry/extappregistry.h"
 
@@ -62,6 +63,7 @@ LocalWorker::LocalWorker(int type)
     , m_pidListStop(NULL)
     , m_pRestartMarker(NULL)
     , m_pDetached(NULL)
+    , m_pScaler(NULL)
 {
     m_pidList = new PidList();
     m_pidListStop = new PidList();
@@ -79,6 +81,85 @@ LocalWorker::~LocalWorker()
         delete m_pidList;
     if (m_pidListStop)
         delete m_pidListStop;
+    if (m_pScaler)
+        delete m_pScaler;
+}
+
+
+int LocalWorker::generateRTReport(int fd, const char *pTypeName)
+{
+    ExtWorker::generateRTReport(fd, pTypeName);
+    return autoScale(fd, pTypeName);
+}
+
+
+/**
+ * Resize the pool once a second from the stats just finalized. Growing opens
+ * idle connections ahead of the load, which starts the processes, shrinking
+ * closes idle connections and lets the processes exit.
+ */
+int LocalWorker::autoScale(int fd, const char *pTypeName)
+{
+    LocalWorkerConfig &config = getConfig();
+    ConnPool &pool = getConnPool();
+    char achBuf[1024];
+    int total, inUse, waitMs, target, n;
+
+    if (!config.getAutoScale() || selfManaged())
+    {
+        setPoolTarget(0);
+        return 0;
+    }
+    if (!m_pScaler)
+    {
+        m_pScaler = new PoolScaler();
+        if (!m_pScaler)
+            return LS_FAIL;
+    }
+    m_pScaler->setLimits(config.getAutoScaleMinConns(), pool.getMaxConns());
+    m_pScaler->setTargetWaitMs(config.getAutoScaleWaitMs());
+    m_pScaler->setMinFreeMemMB(config.getAutoScaleMinFreeMem());
+    if (getState() != ST_GOOD)
+        return 0;
+
+    total = pool.getTotalConns();
+    inUse = total - pool.getFreeConns();
+    waitMs = takeAvgWaitMs();
+    if (waitMs < getOldestWaitMs())
+        waitMs = getOldestWaitMs();
+    target = m_pScaler->update(inUse, getReqStats()->getRPS(),
+                               getQueuedReqs(), waitMs,
+                               PoolScaler::readFreeMemMB());
+    setPoolTarget(target);
+    if (target > total)
+    {
+        //Spread the process start up over a few seconds.
+        n = (target - total + 1) / 2;
+        if (n < 2)
+            n = 2;
+        if (n > target - total)
+            n = target - total;
+        prepareConns(n);
+    }
+    else if (total > target)
+        trimIdleConns(1);
+
+    if (total > 0)
+    {
+        const HttpVHost *pVHost = config.getVHost();
+        n = ls_snprintf(achBuf, sizeof(achBuf),
+                        "EXTAPP_SCALER [%s] [%s] [%s]: TARGET: %d, MIN: %d, "
+                        "MAX: %d, PRED_RPS: %d, SVC_MS: %d, WAIT_MS: %d, "
+                        "FREE_MEM_MB: %d, ACTION: %s\n",
+                        pTypeName, (pVHost) ? pVHost->getName() : "",
+                        config.getName(), target, m_pScaler->getMin(),
+                        m_pScaler->getMax(), m_pScaler->getPredictedRps(),
+                        m_pScaler->getServiceMs(), m_pScaler->getWaitMs(),
+                        m_pScaler->getFreeMemMB(),
+                        PoolScaler::getActionName(m_pScaler->getAction()));
+        write(fd, achBuf, n);
+    }
+    return 0;
 }
 
 
@@ -23,6 +23,7 @@
 #include <extensions/detached.h>
 
 class PidList;
+class PoolScaler;
 class LocalWorkerConfig;
 
 class RestartMarker
@@ -68,9 +69,11 @@ class LocalWorker : public ExtWorker
     PidList            *m_pidListStop;
     RestartMarker      *m_pRestartMarker;
     DetachedProcess_t  *m_pDetached;
+    PoolScaler         *m_pScaler;
 
 
     void        moveToStopList();
+    int         autoScale(int fd, const char *pTypeName);
 public:
     static time_t       s_tmRestartPhp;
 
@@ -105,6 +108,7 @@ public:
     int addNewProcess();
 
     virtual void onTimer();
+    virtual int generateRTReport(int fd, const char *pTypeName);
 
     int startWorker();
     void setRestartMarker(const char* path, int reset_me_path_pos);
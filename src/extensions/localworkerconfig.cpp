@@ -46,6 +46,10 @@ LocalWorkerConfig::LocalWorkerConfig(const char *pName)
     , m_iRunOnStartUp(0)
     , m_umask(ServerProcessConfig::getInstance().getUMask())
     , m_iPhpHandler(0)
+    , m_iAutoScale(0)
+    , m_iAutoScaleMinConns(1)
+    , m_iAutoScaleWaitMs(100)
+    , m_iAutoScaleMinFreeMem(256)
 {
 }
 
@@ -58,6 +62,10 @@ LocalWorkerConfig::LocalWorkerConfig()
     , m_iRunOnStartUp(0)
     , m_umask(ServerProcessConfig::getInstance().getUMask())
     , m_iPhpHandler(0)
+    , m_iAutoScale(0)
+    , m_iAutoScaleMinConns(1)
+    , m_iAutoScaleWaitMs(100)
+    , m_iAutoScaleMinFreeMem(256)
 {
 }
 
@@ -76,6 +84,10 @@ LocalWorkerConfig::LocalWorkerConfig(const LocalWorkerConfig &rhs)
     m_iRunOnStartUp = rhs.m_iRunOnStartUp;
     m_umask = ServerProcessConfig::getInstance().getUMask();
     m_iPhpHandler = 0;
+    m_iAutoScale = rhs.m_iAutoScale;
+    m_iAutoScaleMinConns = rhs.m_iAutoScaleMinConns;
+    m_iAutoScaleWaitMs = rhs.m_iAutoScaleWaitMs;
+    m_iAutoScaleMinFreeMem = rhs.m_iAutoScaleMinFreeMem;
 }
 
 
@@ -276,6 +288,17 @@ int LocalWorkerConfig::config(const XmlNode *pNode)
         setMaxConns(instances);
     }
 
+    //Size the pool between autoScaleMinConns and maxConns from the queue
+    //wait time and the predicted load.
+    m_iAutoScale = ConfigCtx::getCurConfigCtx()->getLongValue(pNode,
+                   "autoScale", 0, 1, 0);
+    m_iAutoScaleMinConns = ConfigCtx::getCurConfigCtx()->getLongValue(pNode,
+                           "autoScaleMinConns", 1, 2000, 1);
+    m_iAutoScaleWaitMs = ConfigCtx::getCurConfigCtx()->getLongValue(pNode,
+                         "autoScaleWaitMs", 1, 60000, 100);
+    m_iAutoScaleMinFreeMem = ConfigCtx::getCurConfigCtx()->getLongValue(pNode,
+                             "autoScaleMinFreeMem", 0, INT_MAX, 256);
+
     RLimits *pLimits = getRLimits();
 #if defined(RLIMIT_NPROC)
     int mini_nproc = (3 * getMaxConns() + 50)
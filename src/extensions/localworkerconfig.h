@@ -34,6 +34,10 @@ class LocalWorkerConfig : public ExtWorkerConfig
     RLimits     m_rlimits;
     int         m_umask;
     int         m_iPhpHandler;
+    int         m_iAutoScale;
+    int         m_iAutoScaleMinConns;
+    int         m_iAutoScaleWaitMs;
+    int         m_iAutoScaleMinFreeMem;
 
     void operator=(const LocalWorkerConfig &rhs);
     int isUserBlocked(const char *pUser);
@@ -84,6 +88,12 @@ public:
     int isPhpHandler() { return m_iPhpHandler ; }
     void setPhpHandler(int v)       {   m_iPhpHandler = v;      }
 
+    int getAutoScale() const        {   return m_iAutoScale;    }
+    void setAutoScale(int v)        {   m_iAutoScale = v;       }
+    int getAutoScaleMinConns() const    {   return m_iAutoScaleMinConns;    }
+    int getAutoScaleWaitMs() const  {   return m_iAutoScaleWaitMs;      }
+    int getAutoScaleMinFreeMem() const  {   return m_iAutoScaleMinFreeMem;  }
+
     int checkExtAppSelfManagedAndFixEnv(int maxIdleTime);
     void applyStderrLog();
     int config(const XmlNode *pNode);
@@ -32,8 +32,9 @@
 class LsapiEnv : public IEnv
 {
     AutoBuf *m_pBuf;
+    int      m_iBase;
 public:
-    LsapiEnv(AutoBuf *pBuf) : m_pBuf(pBuf) {};
+    LsapiEnv(AutoBuf *pBuf) : m_pBuf(pBuf), m_iBase(0) {};
     ~LsapiEnv() {}
 
     int add(const char *name, size_t nameLen,
@@ -47,7 +48,9 @@ public:
     {   return -1;      }
     void clear() {}
     const char *get() const {  return NULL;   }
-    int bufSize() const      {  return m_pBuf->size();      }
+    //Offset in the packet, including the segments not in m_pBuf.
+    int bufSize() const      {  return m_iBase + m_pBuf->size();    }
+    void setBase(int base)   {  m_iBase = base;                     }
     LS_NO_COPY_ASSIGN(LsapiEnv);
 };
 
@@ -89,6 +92,7 @@ int LsapiReq::addEnv(AutoBuf *pAutoBuf, const char *name, size_t nameLen,
 LsapiReq::LsapiReq(IOVec *pVec)
     : m_bufReq(4096)
     , m_pIovec(pVec)
+    , m_pSpecialEnv(NULL)
 
 {
 }
@@ -146,12 +150,16 @@ int LsapiReq::appendSpecialEnv(LsapiEnv *pEnv, HttpSession *pSession,
     //pHeader->m_cntSpecialEnv = 1;
     //pEnv->add( "\001\004safe_mode", 11, "1", 1 );
     PHPConfig *pConfig = pSession->getReq()->getContext()->getPHPConfig();
+    m_pSpecialEnv = NULL;
     if (pConfig)
     {
         pHeader->m_cntSpecialEnv = pConfig->getCount();
-        m_bufReq.append(pConfig->getLsapiEnv().begin(),
-                        pConfig->getLsapiEnv().size());
-
+        //Prebuilt with the context, goes to its own iovec segment.
+        if (pConfig->getLsapiEnv().size() > 0)
+        {
+            m_pSpecialEnv = &pConfig->getLsapiEnv();
+            pEnv->setBase(m_pSpecialEnv->size());
+        }
     }
     else
         pHeader->m_cntSpecialEnv = 0;
@@ -190,16 +198,25 @@ int LsapiReq::buildReq(HttpSession *pSession, int *totalLen)
     ret = appendEnv(&env, pSession);
     if (ret)
         return ret;
-    int pad = (8 - (m_bufReq.size() % 8)) % 8;
+    int specialLen = m_pSpecialEnv ? m_pSpecialEnv->size() : 0;
+    int pad = (8 - ((specialLen + m_bufReq.size()) % 8)) % 8;
     m_bufReq.append("\0\0\0\0\0\0\0", pad);
-    *totalLen = m_bufReq.size() + sizeof(lsapi_http_header_index)
+    *totalLen = specialLen + m_bufReq.size() + sizeof(lsapi_http_header_index)
                 + ((lsapi_req_header *)m_bufReq.begin())->m_cntUnknownHeaders *
                 sizeof(lsapi_header_offset)
                 + ((lsapi_req_header *)m_bufReq.begin())->m_httpHeaderLen;
     buildPacketHeader(&((lsapi_req_header *)m_bufReq.begin())->m_pktHeader,
                       LSAPI_BEGIN_REQUEST,
                       *totalLen);
-    m_pIovec->append(m_bufReq.begin(), m_bufReq.size());
+    if (specialLen > 0)
+    {
+        m_pIovec->append(m_bufReq.begin(), sizeof(lsapi_req_header));
+        m_pIovec->append(m_pSpecialEnv->begin(), specialLen);
+        m_pIovec->append(m_bufReq.begin() + sizeof(lsapi_req_header),
+                         m_bufReq.size() - sizeof(lsapi_req_header));
+    }
+    else
+        m_pIovec->append(m_bufReq.begin(), m_bufReq.size());
 
     ret = appendHttpHeaderIndex(pReq,
                                 ((lsapi_req_header *)m_bufReq.begin())->m_cntUnknownHeaders);
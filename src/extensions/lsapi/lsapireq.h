@@ -29,10 +29,17 @@ class IOVec;
 class LsapiEnv;
 struct lsapi_packet_header;
 
+/**
+ * LsapiReq builds the LSAPI_BEGIN_REQUEST packet as an iovec. The request
+ * header and the per-request env are built in m_bufReq, the special env of
+ * the context is prebuilt by PHPConfig and sent from there without a copy,
+ * the HTTP header index and the header itself come from HttpReq.
+ */
 class LsapiReq
 {
     AutoBuf     m_bufReq;
     IOVec      *m_pIovec;
+    const AutoBuf *m_pSpecialEnv;
 
     int appendEnv(LsapiEnv *pEnv, HttpSession *pSession);
     int appendSpecialEnv(LsapiEnv *pEnv, HttpSession *pSession,
@@ -0,0 +1,174 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2022  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+#include "poolscaler.h"
+
+#include <util/datetime.h>
+
+#include <stdio.h>
+#include <string.h>
+
+
+PoolScaler::PoolScaler()
+    : m_iMin(1)
+    , m_iMax(1)
+    , m_iTarget(1)
+    , m_iTargetWaitMs(100)
+    , m_iMinFreeMemMB(0)
+    , m_iRpsFast(0)
+    , m_iRpsSlow(0)
+    , m_iPredicted(0)
+    , m_iServiceMs(0)
+    , m_iWaitMs(0)
+    , m_iFreeMemMB(-1)
+    , m_iQuietSecs(0)
+    , m_iAction(PS_HOLD)
+{
+}
+
+
+void PoolScaler::setLimits(int iMin, int iMax)
+{
+    if (iMax < 1)
+        iMax = 1;
+    if (iMin < 1)
+        iMin = 1;
+    if (iMin > iMax)
+        iMin = iMax;
+    //Start from the minimum and grow with the load.
+    if (m_iTarget > iMax)
+        m_iTarget = iMax;
+    if (m_iTarget < iMin)
+        m_iTarget = iMin;
+    m_iMin = iMin;
+    m_iMax = iMax;
+}
+
+
+int PoolScaler::update(int iInUse, int iDone, int iQueued, int iWaitMs,
+                       int iFreeMemMB)
+{
+    int need, trend, step;
+
+    m_iRpsFast += ((iDone << 8) - m_iRpsFast) / 2;
+    m_iRpsSlow += ((iDone << 8) - m_iRpsSlow) / 8;
+    trend = m_iRpsFast - m_iRpsSlow;
+    m_iPredicted = m_iRpsFast + ((trend > 0) ? trend : 0);
+    if (iDone > 0)
+    {
+        int svc = iInUse * 1000 / iDone;
+        if (svc < 1)
+            svc = 1;
+        if (m_iServiceMs == 0)
+            m_iServiceMs = svc;
+        else
+            m_iServiceMs += (svc - m_iServiceMs) / 4;
+    }
+    need = (int)(((int64_t)m_iPredicted * m_iServiceMs * 5 / 4 + 255999)
+                 / 256000);
+    m_iWaitMs = iWaitMs;
+    m_iFreeMemMB = iFreeMemMB;
+
+    if ((iFreeMemMB >= 0) && (iFreeMemMB < m_iMinFreeMemMB))
+    {
+        m_iQuietSecs = 0;
+        if ((iFreeMemMB < m_iMinFreeMemMB / 2) && (m_iTarget > m_iMin))
+        {
+            --m_iTarget;
+            m_iAction = PS_MEM_DOWN;
+        }
+        else
+            m_iAction = PS_MEM_HOLD;
+        return m_iTarget;
+    }
+
+    if ((iWaitMs > m_iTargetWaitMs) && (m_iTarget < m_iMax))
+    {
+        step = m_iTarget / 4;
+        if (step < 1)
+            step = 1;
+        m_iTarget += step;
+        if (m_iTarget < iInUse + iQueued)
+            m_iTarget = iInUse + iQueued;
+        if (m_iTarget < need)
+            m_iTarget = need;
+        m_iAction = PS_UP_WAIT;
+        m_iQuietSecs = 0;
+    }
+    else if ((need > m_iTarget) && (m_iTarget < m_iMax))
+    {
+        m_iTarget = need;
+        m_iAction = PS_UP_LOAD;
+        m_iQuietSecs = 0;
+    }
+    else if ((need < m_iTarget) && (iQueued == 0)
+             && (iInUse < m_iTarget))
+    {
+        m_iAction = PS_HOLD;
+        if ((++m_iQuietSecs >= POOLSCALER_COOLDOWN) && (m_iTarget > m_iMin))
+        {
+            --m_iTarget;
+            m_iAction = PS_DOWN;
+        }
+    }
+    else
+    {
+        m_iQuietSecs = 0;
+        m_iAction = PS_HOLD;
+    }
+    if (m_iTarget > m_iMax)
+        m_iTarget = m_iMax;
+    return m_iTarget;
+}
+
+
+const char *PoolScaler::getActionName(int action)
+{
+    static const char *s_pNames[] =
+    {   "hold", "up-load", "up-wait", "down", "mem-hold", "mem-down"   };
+    if (action < 0 || action > PS_MEM_DOWN)
+        return "unknown";
+    return s_pNames[action];
+}
+
+
+int PoolScaler::readFreeMemMB()
+{
+    static time_t s_tmLastRead = 0;
+    static int s_iFreeMemMB = -1;
+    char achLine[256];
+    long kb;
+    FILE *fp;
+
+    if (s_tmLastRead == DateTime::s_curTime)
+        return s_iFreeMemMB;
+    s_tmLastRead = DateTime::s_curTime;
+    s_iFreeMemMB = -1;
+    if ((fp = fopen("/proc/meminfo", "r")) == NULL)
+        return -1;
+    while (fgets(achLine, sizeof(achLine), fp))
+    {
+        if (strncmp(achLine, "MemAvailable:", 13) == 0)
+        {
+            if (sscanf(achLine + 13, "%ld", &kb) == 1)
+                s_iFreeMemMB = (int)(kb >> 10);
+            break;
+        }
+    }
+    fclose(fp);
+    return s_iFreeMemMB;
+}
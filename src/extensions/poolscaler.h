@@ -0,0 +1,99 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2022  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+#ifndef POOLSCALER_H
+#define POOLSCALER_H
+
+#include <lsdef.h>
+
+//Seconds without pressure before the pool starts to shrink.
+#define POOLSCALER_COOLDOWN         10
+
+
+/**
+ * PoolScaler sizes the connection pool, and so the process pool, of a
+ * local external application. It is fed once a second with the busy
+ * connections, completed requests, queue depth, queue wait time and free
+ * memory.
+ *
+ * The pool starts at the minimum. Service time is derived from busy
+ * connections over throughput. Load is predicted from a 2 second moving
+ * average plus its trend against an 8 second one, the pool grows right
+ * away to serve the predicted load with 25% headroom, or by a quarter, at
+ * least to busy plus queued requests, when the queue wait exceeds the
+ * target.
+ * It shrinks by one a second after POOLSCALER_COOLDOWN quiet seconds. No
+ * growth while free memory is under the configured floor, shrink when it
+ * drops under half of it.
+ */
+class PoolScaler
+{
+public:
+    enum
+    {
+        PS_HOLD,
+        PS_UP_LOAD,
+        PS_UP_WAIT,
+        PS_DOWN,
+        PS_MEM_HOLD,
+        PS_MEM_DOWN,
+    };
+
+    PoolScaler();
+
+    void setLimits(int iMin, int iMax);
+    void setTargetWaitMs(int ms)        {   m_iTargetWaitMs = ms;   }
+    void setMinFreeMemMB(int mb)        {   m_iMinFreeMemMB = mb;   }
+
+    /**
+     * Feed the measurements of the last second, iFreeMemMB is -1 when
+     * unknown. Return the target pool size.
+     */
+    int  update(int iInUse, int iDone, int iQueued, int iWaitMs,
+                int iFreeMemMB);
+
+    int  getTarget() const              {   return m_iTarget;       }
+    int  getMin() const                 {   return m_iMin;          }
+    int  getMax() const                 {   return m_iMax;          }
+    int  getPredictedRps() const        {   return m_iPredicted >> 8;   }
+    int  getServiceMs() const           {   return m_iServiceMs;    }
+    int  getWaitMs() const              {   return m_iWaitMs;       }
+    int  getFreeMemMB() const           {   return m_iFreeMemMB;    }
+    int  getAction() const              {   return m_iAction;       }
+    static const char *getActionName(int action);
+
+    static int readFreeMemMB();
+
+private:
+    int     m_iMin;
+    int     m_iMax;
+    int     m_iTarget;
+    int     m_iTargetWaitMs;
+    int     m_iMinFreeMemMB;
+    int     m_iRpsFast;         // requests per second << 8
+    int     m_iRpsSlow;
+    int     m_iPredicted;
+    int     m_iServiceMs;
+    int     m_iWaitMs;
+    int     m_iFreeMemMB;
+    int     m_iQuietSecs;
+    int     m_iAction;
+
+    LS_NO_COPY_ASSIGN(PoolScaler);
+};
+
+#endif
@@ -17,8 +17,13 @@
 *****************************************************************************/
 #include "proxyconfig.h"
 
+#include <main/configctx.h>
+#include <util/xmlnode.h>
+
 ProxyConfig::ProxyConfig()
     : m_iSsl(0)
+    , m_iHttp2(0)
+    , m_iHttp2Conns(PROXY_H2_DEFAULT_CONNS)
 {}
 
 
@@ -29,4 +34,16 @@ ProxyConfig::~ProxyConfig()
 ProxyConfig::ProxyConfig(const char *pName)
     : LocalWorkerConfig(pName)
     , m_iSsl(0)
+    , m_iHttp2(0)
+    , m_iHttp2Conns(PROXY_H2_DEFAULT_CONNS)
 {}
+
+
+void ProxyConfig::configHttp2(const XmlNode *pNode)
+{
+    m_iHttp2 = ConfigCtx::getCurConfigCtx()->getLongValue(pNode,
+               "proxyHttp2", 0, 1, 0);
+    m_iHttp2Conns = ConfigCtx::getCurConfigCtx()->getLongValue(pNode,
+                    "proxyHttp2Conns", 1, PROXY_H2_MAX_CONNS,
+                    PROXY_H2_DEFAULT_CONNS);
+}
@@ -24,9 +24,15 @@
 #include <lsdef.h>
 #include <extensions/localworkerconfig.h>
 
+#define PROXY_H2_DEFAULT_CONNS      4
+#define PROXY_H2_MAX_CONNS          64
+
+class XmlNode;
 class ProxyConfig : public LocalWorkerConfig
 {
     int     m_iSsl;
+    int     m_iHttp2;
+    int     m_iHttp2Conns;
 public:
     ProxyConfig(const char *pName);
     ProxyConfig();
@@ -34,6 +40,13 @@ public:
 
     int getSsl() const      {   return m_iSsl;  }
     void setSsl(int s)    {   m_iSsl = s;     }
+
+    int getHttp2() const        {   return m_iHttp2;        }
+    void setHttp2(int h)        {   m_iHttp2 = h;           }
+    int getHttp2Conns() const   {   return m_iHttp2Conns;   }
+    void setHttp2Conns(int n)   {   m_iHttp2Conns = n;      }
+
+    void configHttp2(const XmlNode *pNode);
     LS_NO_COPY_ASSIGN(ProxyConfig);
 };
 
@@ -40,6 +40,7 @@
 
 static char s_achForwardHttps[] = "X-Forwarded-Proto: https\r\n";
 static char s_achForwardHost[] = "X-Forwarded-Host: ";
+static char s_achEarlyData[] = "Early-Data: 1\r\n";
 static char s_achChunkedEncoding[] = "Transfer-encoding: chunked\r\n";
 
 ProxyConn::ProxyConn()
@@ -344,6 +345,14 @@ int ProxyConn::sendReqHeader()
         m_iTotalPending += sizeof(s_achForwardHttps) - 1;
     }
 
+    int earlyDataLen;
+    if (pReq->getContextState(EARLY_DATA)
+        && pReq->getHeader("Early-Data", 10, earlyDataLen) == NULL)
+    {
+        m_iovec.append(s_achEarlyData, sizeof(s_achEarlyData) - 1);
+        m_iTotalPending += sizeof(s_achEarlyData) - 1;
+    }
+
     if (pReq->getContentLength() == LSI_BODY_SIZE_CHUNK)
     {
         LS_DBG_L(this, "Unfinished request body is chunk encoded, use chunked encoding ." );
@@ -0,0 +1,1464 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2022  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+#include "proxyh2conn.h"
+#include "proxyconfig.h"
+#include "proxyworker.h"
+
+#include <edio/multiplexer.h>
+#include <extensions/extworker.h>
+#include <h2/unpackedheaders.h>
+#include <http/httpextconnector.h>
+#include <http/httpheader.h>
+#include <http/httpmethod.h>
+#include <http/httpreq.h>
+#include <http/httpresp.h>
+#include <http/httpsession.h>
+#include <http/httpstatuscode.h>
+#include <log4cxx/logger.h>
+#include <lshpack.h>
+#include <socket/coresocket.h>
+#include <spdy/protocoldef.h>
+#include <sslpp/sslconnection.h>
+#include <util/datetime.h>
+#include <util/ssnprintf.h>
+
+#include <ctype.h>
+#include <fcntl.h>
+
+#define PROXY_H2_CONNECT_TIMEOUT    10
+#define PROXY_H2_PING_TIMEOUT       20
+#define PROXY_H2_MAX_FREE_STREAMS   32
+#define PROXY_H2_MAX_HEADER_SIZE    65536
+//Stop opening streams well before the stream id space runs out.
+#define PROXY_H2_LAST_STREAM_ID     0x7fffff00
+
+static uint32_t s_uiSessSeq = 0;
+
+
+static int isProxyConnection(const char *pName, int len)
+{
+    return (len == 16 && strncasecmp(pName, "proxy-connection", 16) == 0);
+}
+
+
+ProxyH2Stream::ProxyH2Stream()
+    : m_pSlot(NULL)
+    , m_bufRespHeaders(0)
+    , m_iRespHeaderReady(0)
+{
+}
+
+
+ProxyH2Stream::~ProxyH2Stream()
+{
+}
+
+
+void ProxyH2Stream::reset()
+{
+    StreamStat::reset();
+    H2StreamBase::reset();
+    m_pSlot = NULL;
+    m_bufRespHeaders.clear();
+    m_iRespHeaderReady = 0;
+}
+
+
+const char *ProxyH2Stream::buildLogId()
+{
+    m_logId.len = lsnprintf(m_logId.ptr, MAX_LOGID_LEN, "%s-%d",
+                            m_pH2Conn->getLogSession()->getLogId(),
+                            getStreamID());
+    return m_logId.ptr;
+}
+
+
+int ProxyH2Stream::onRead()
+{
+    LS_DBG_L(this, "ProxyH2Stream::onRead()");
+    if (!m_pSlot)
+    {
+        setFlag(HIO_FLAG_WANT_READ, 0);
+        return 0;
+    }
+    return m_pSlot->onStreamRead();
+}
+
+
+int ProxyH2Stream::onWrite()
+{
+    LS_DBG_L(this, "ProxyH2Stream::onWrite()");
+    if (m_iWindowOut <= 0)
+        return 0;
+    setFlag(HIO_FLAG_PAUSE_WRITE, 0);
+
+    if (isWantWrite())
+    {
+        if (!m_pSlot)
+        {
+            setFlag(HIO_FLAG_WANT_WRITE, 0);
+            return 0;
+        }
+        m_pSlot->onStreamWrite();
+        if (isWantWrite())
+            m_pH2Conn->needWriteEvent();
+    }
+    return 0;
+}
+
+
+int ProxyH2Stream::onPeerClose()
+{
+    LS_DBG_L(this, "ProxyH2Stream::onPeerClose()");
+    ((ProxyH2Conn *)m_pH2Conn)->recycleStream(this);
+    return 0;
+}
+
+
+void ProxyH2Stream::continueRead()
+{
+    LS_DBG_L(this, "ProxyH2Stream::continueRead()");
+    setFlag(HIO_FLAG_WANT_READ, 1);
+    if (getFlag(HIO_EVENT_PROCESSING))
+        return;
+    if (m_bufRcvd.size() > 0 || m_iRespHeaderReady == 1
+        || getFlag(HIO_FLAG_PEER_SHUTDOWN))
+        onRead();
+}
+
+
+ProxyH2Conn::ProxyH2Conn(ProxyWorker *pWorker)
+    : m_pWorker(pWorker)
+    , m_iSessState(H2C_CONNECTING)
+    , m_uiNextStreamId(1)
+    , m_uiSeq(++s_uiSessSeq)
+    , m_tmStart(0)
+    , m_bufDecode(0)
+    , m_bufXpack(0)
+{
+    H2ConnBase::init();
+    set_h2flag(H2_CONN_FLAG_CLIENT);
+}
+
+
+ProxyH2Conn::~ProxyH2Conn()
+{
+    ProxyH2ExtConn *pSlot;
+    while ((pSlot = m_waitQueue.pop_front()) != NULL)
+        pSlot->detachSession();
+
+    StreamMap::iterator itn, it = m_mapStream.begin();
+    for (; it != m_mapStream.end(); it = itn)
+    {
+        itn = m_mapStream.next(it);
+        ProxyH2Stream *pStream = (ProxyH2Stream *)it;
+        if (pStream->getSlot())
+            pStream->getSlot()->detachSession();
+        m_mapStream.erase(it);
+        removePriQue(pStream);
+        delete pStream;
+    }
+    m_releasedStreams.release_objects();
+    m_freeStreams.release_objects();
+    if (getfd() != -1)
+        SslEdStream::close();
+}
+
+
+int ProxyH2Conn::connectTo(Multiplexer *pMplx, const char *pHost, int hostLen)
+{
+    int fd;
+    m_sHost.setStr(pHost, hostLen);
+    int ret = CoreSocket::connect(m_pWorker->getServerAddr(),
+                                  pMplx->getFLTag(), &fd, 1);
+    if (fd == -1)
+        return LS_FAIL;
+    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    EdStream::init(fd, pMplx, POLLIN | POLLOUT | POLLHUP | POLLERR);
+    setState(SS_CONNECTING);
+    m_tmStart = DateTime::s_curTime;
+
+    if (m_pWorker->getConfig().getSsl())
+    {
+        ls_str_t sni = { (char *)m_sHost.c_str(), (size_t)m_sHost.len() };
+        if (initSsl(NULL, hostLen ? &sni : NULL, true,
+                    m_pWorker->getSslSessCache()) != 1)
+        {
+            LS_NOTICE(this, "[H2] Failed to initialize SSL for backend %s.",
+                      m_pWorker->getURL());
+            SslEdStream::close();
+            return LS_FAIL;
+        }
+    }
+    LS_DBG_L(this, "[H2] Connecting to %s, fd: %d, connect() return %d.",
+             m_pWorker->getURL(), fd, ret);
+    return LS_OK;
+}
+
+
+int ProxyH2Conn::checkReady()
+{
+    if (m_pWorker->getConfig().getSsl())
+    {
+        if (!getSsl() || !getSsl()->isConnected())
+            return 0;
+        if (getSsl()->getAlpnResult() != HIOS_PROTO_HTTP2)
+        {
+            LS_NOTICE(this, "[H2] Backend %s did not negotiate h2 with ALPN.",
+                      m_pWorker->getURL());
+            errno = EPROTO;
+            return LS_FAIL;
+        }
+    }
+    else
+    {
+        int32_t err = 0;
+        if (getSockError(&err) == -1 || err != 0)
+        {
+            if (err)
+                errno = err;
+            return LS_FAIL;
+        }
+    }
+    LS_DBG_L(this, "[H2] Connected to %s, session ready.", m_pWorker->getURL());
+    setState(SS_CONNECTED);
+    //The preface is sent by us, the first frame from a server is SETTINGS.
+    set_h2flag(H2_CONN_FLAG_PREFACE);
+    setOS(static_cast<SslEdStream *>(this));
+    m_iSessState = H2C_READY;
+    guaranteeOutput(H2_CLIENT_PREFACE, H2_CLIENT_PREFACE_LEN);
+    sendSettingsFrame(true);
+    SslEdStream::continueRead();
+    return 1;
+}
+
+
+int ProxyH2Conn::onRead()
+{
+    int ret;
+    if (m_iSessState == H2C_CLOSED)
+        return -1;
+    if (m_iSessState == H2C_CONNECTING)
+    {
+        ret = checkReady();
+        if (ret == 0)
+            return 0;
+        if (ret == LS_FAIL)
+        {
+            closeSession(EIO);
+            return -1;
+        }
+    }
+
+    clr_h2flag(H2_CONN_FLAG_WAIT_PROCESS | H2_CONN_FLAG_PENDING_STREAM);
+    set_h2flag(H2_CONN_FLAG_IN_EVENT);
+    ret = onReadEx2();
+    if (ret != LS_FAIL && m_iSessState != H2C_CLOSED)
+    {
+        startWaiting();
+        if (m_h2flag & H2_CONN_FLAG_WAIT_PROCESS)
+            onWriteEx2();
+    }
+    clr_h2flag(H2_CONN_FLAG_IN_EVENT);
+    if (ret == LS_FAIL)
+    {
+        closeSession(ECONNRESET);
+        return -1;
+    }
+    if (m_iSessState == H2C_CLOSED)
+        return -1;
+    if (m_h2flag & H2_CONN_FLAG_WANT_FLUSH)
+        flush();
+    return ret;
+}
+
+
+int ProxyH2Conn::onWrite()
+{
+    int ret, wantWrite = 0;
+    if (m_iSessState == H2C_CLOSED || getfd() == -1)
+        return -1;
+    if (m_iSessState == H2C_CONNECTING)
+    {
+        ret = checkReady();
+        if (ret == 0)
+            return 0;
+        if (ret == LS_FAIL)
+        {
+            closeSession(EIO);
+            return -1;
+        }
+    }
+
+    setFlag(SS_FLAG_PAUSE_WRITE, 0);
+    set_h2flag(H2_CONN_FLAG_IN_EVENT);
+    startWaiting();
+    if (m_iSessState != H2C_CLOSED)
+        wantWrite = onWriteEx2();
+    clr_h2flag(H2_CONN_FLAG_IN_EVENT);
+    if (m_iSessState == H2C_CLOSED)
+        return -1;
+    if (m_h2flag & H2_CONN_FLAG_WANT_FLUSH)
+        flush();
+
+    if ((wantWrite == 0 || m_iCurDataOutWindow <= 0) && isEmpty())
+    {
+        SslEdStream::suspendWrite();
+        if (m_h2flag & H2_CONN_FLAG_PAUSE_READ)
+        {
+            clr_h2flag(H2_CONN_FLAG_PAUSE_READ);
+            SslEdStream::continueRead();
+        }
+    }
+    return 0;
+}
+
+
+int ProxyH2Conn::onHangup()
+{
+    return onRead();
+}
+
+
+int ProxyH2Conn::onError()
+{
+    int err = (m_iSessState == H2C_CONNECTING) ? EIO : ECONNRESET;
+    LS_DBG_L(this, "[H2] ProxyH2Conn::onError()");
+    closeSession(err);
+    return -1;
+}
+
+
+int ProxyH2Conn::onEventDone(short event)
+{
+    return 0;
+}
+
+
+int ProxyH2Conn::onPeerClose()
+{
+    LS_DBG_L(this, "[H2] Backend closed connection.");
+    closeSession((m_iSessState == H2C_CONNECTING) ? EIO : ECONNRESET);
+    return -1;
+}
+
+
+void ProxyH2Conn::suspendRead()
+{
+    if (getfd() != -1)
+        SslEdStream::suspendRead();
+}
+
+
+void ProxyH2Conn::continueWrite()
+{
+    if (getfd() != -1)
+        SslEdStream::continueWrite();
+}
+
+
+int ProxyH2Conn::flush()
+{
+    if (getState() == SS_CONNECTING || getfd() == -1)
+        return 0;
+    closePendingOut();
+    BufferedOS::flush();
+    if (!isEmpty())
+    {
+        SslEdStream::continueWrite();
+        setFlag(SS_FLAG_PAUSE_WRITE, 1);
+    }
+    else
+        clr_h2flag(H2_CONN_FLAG_WANT_FLUSH);
+    return SslEdStream::flush();
+}
+
+
+int ProxyH2Conn::onWriteEx2()
+{
+    int buffered;
+    if (getfd() == -1)
+        return 0;
+    LS_DBG_H(this, "onWriteEx2() output buffer size=%d, Data Out Window: %d",
+             getBuf()->size(), m_iCurDataOutWindow);
+    if ((buffered = getBuf()->size()) > 0)
+    {
+        if (buffered >= 1369)
+        {
+            flush();
+            if (!isEmpty())
+                return 1;
+        }
+        else
+            set_h2flag(H2_CONN_FLAG_WANT_FLUSH);
+    }
+    if (isPauseWrite())
+    {
+        if (!StreamStat::isWantWrite() && m_iCurDataOutWindow > 0)
+            SslEdStream::continueWrite();
+        return 1;
+    }
+    int wantWrite = processQueue();
+    if (wantWrite && !StreamStat::isWantWrite() && m_iCurDataOutWindow > 0)
+        SslEdStream::continueWrite();
+    return wantWrite;
+}
+
+
+int ProxyH2Conn::verifyStreamId(uint32_t id)
+{
+    //Only responses to the streams opened by us are expected.
+    if ((id & 1) == 0 || id > m_uiLastStreamId)
+    {
+        LS_DBG_L(this, "[H2] Unexpected stream ID %u from backend.", id);
+        return LS_FAIL;
+    }
+    return LS_OK;
+}
+
+
+int ProxyH2Conn::decodeRespHeaders(unsigned char *pSrc, unsigned char *pEnd,
+                                   int &status)
+{
+    static const char s_achStatusLine[] = "HTTP/1.1 000\r\n";
+    lsxpack_header hdr;
+    const char *pName, *pVal;
+    int rc, idx;
+
+    status = 0;
+    m_bufDecode.clear();
+    m_bufDecode.append(s_achStatusLine, sizeof(s_achStatusLine) - 1);
+    if (m_bufXpack.capacity() < 4096)
+        m_bufXpack.reserve(4096);
+    while (pSrc < pEnd)
+    {
+        lsxpack_header_prepare_decode(&hdr, m_bufXpack.begin(), 0,
+                                      m_bufXpack.capacity());
+        rc = lshpack_dec_decode(&m_hpack_dec, (const unsigned char **)&pSrc,
+                                pEnd, &hdr);
+        if (rc == LSHPACK_ERR_MORE_BUF)
+        {
+            int want = m_bufXpack.capacity() * 2;
+            if (want < (int)hdr.val_len)
+                want = hdr.val_len;
+            if (want > PROXY_H2_MAX_HEADER_SIZE)
+                return LS_FAIL;
+            m_bufXpack.reserve(want);
+            continue;
+        }
+        if (rc != LSHPACK_OK)
+            return LS_FAIL;
+
+        pName = lsxpack_header_get_name(&hdr);
+        pVal = lsxpack_header_get_value(&hdr);
+        if (*pName == ':')
+        {
+            if (hdr.name_len == 7 && memcmp(pName, ":status", 7) == 0
+                && hdr.val_len == 3 && isdigit(pVal[0]) && isdigit(pVal[1])
+                && isdigit(pVal[2]))
+            {
+                status = (pVal[0] - '0') * 100 + (pVal[1] - '0') * 10
+                         + pVal[2] - '0';
+                memcpy(m_bufDecode.begin() + 9, pVal, 3);
+            }
+            continue;
+        }
+        idx = HttpHeader::getIndex(pName, hdr.name_len);
+        switch (idx)
+        {
+        case HttpHeader::H_CONNECTION:
+        case HttpHeader::H_KEEP_ALIVE:
+        case HttpHeader::H_TRANSFER_ENCODING:
+        case HttpHeader::H_UPGRADE:
+            continue;
+        case HttpHeader::H_UNKNOWN:
+            if (isProxyConnection(pName, hdr.name_len))
+                continue;
+            break;
+        }
+        if (m_bufDecode.size() + hdr.name_len + hdr.val_len + 4
+            > PROXY_H2_MAX_HEADER_SIZE)
+            return LS_FAIL;
+        m_bufDecode.append(pName, hdr.name_len);
+        m_bufDecode.append(": ", 2);
+        m_bufDecode.append(pVal, hdr.val_len);
+        m_bufDecode.append("\r\n", 2);
+    }
+    m_bufDecode.append("\r\n", 2);
+    return LS_OK;
+}
+
+
+int ProxyH2Conn::decodeHeaders(uint32_t id, unsigned char *src, int length,
+                               unsigned char iHeaderFlag)
+{
+    int status;
+    if (decodeRespHeaders(src, src + length, status) == LS_FAIL)
+    {
+        LS_DBG_L(this, "[H2] Failed to decode response headers of stream %u.",
+                 id);
+        doGoAway(H2_ERROR_COMPRESSION_ERROR);
+        return LS_FAIL;
+    }
+    ProxyH2Stream *pStream = (ProxyH2Stream *)findStream(id);
+    if (!pStream || pStream->getState() != HIOS_CONNECTED)
+        return 0;
+    pStream->setActiveTime(DateTime::s_curTime);
+    if (!pStream->isRespHeaderReady())
+    {
+        if (status == 0)
+        {
+            LS_DBG_L(pStream, "[H2] Response without :status.");
+            sendRstFrame(id, H2_ERROR_PROTOCOL_ERROR);
+            pStream->setState(HIOS_RESET);
+            closeStream(pStream, ECONNRESET);
+            return 0;
+        }
+        //Interim responses are not forwarded.
+        if (status < 200)
+            return 0;
+        pStream->getRespHeaders().swap(m_bufDecode);
+        pStream->setRespHeaderReady(1);
+    }
+    //otherwise trailers, dropped.
+    if (iHeaderFlag & H2_FLAG_END_STREAM)
+        pStream->onPeerShutdown();
+    if (pStream->isWantRead())
+        pStream->onRead();
+    return 0;
+}
+
+
+int ProxyH2Conn::doGoAway(H2ErrorCode status)
+{
+    if (m_iSessState == H2C_CLOSED)
+        return 0;
+    if (status != H2_ERROR_NO_ERROR)
+    {
+        LS_DBG_L(this, "[H2] Session error %d, send GOAWAY.", status);
+        if (m_iSessState != H2C_CONNECTING)
+        {
+            sendFrame8Bytes(H2_FRAME_GOAWAY, 0, 0, status);
+            flush();
+        }
+        set_h2flag(H2_CONN_FLAG_GOAWAY);
+        closeSession(ECONNRESET);
+        return 0;
+    }
+
+    uint32_t lastId = m_uiLastStreamId;
+    uint32_t errCode = 0;
+    if (m_curH2Header.getType() == H2_FRAME_GOAWAY
+        && m_iCurrentFrameRemain >= 8)
+    {
+        unsigned char p[8];
+        m_bufInput.moveTo((char *)p, 8);
+        m_iCurrentFrameRemain -= 8;
+        lastId = beReadUint32(p) & 0x7fffffff;
+        errCode = beReadUint32(p + 4);
+    }
+    LS_DBG_L(this, "[H2] GOAWAY from backend, last stream: %u, error: %u, "
+             "drain %d streams.", lastId, errCode, (int)m_mapStream.size());
+    m_iSessState = H2C_DRAINING;
+
+    //Streams after the last ID were not processed and may be retried.
+    StreamMap::iterator itn, it = m_mapStream.begin();
+    for (; it != m_mapStream.end(); it = itn)
+    {
+        itn = m_mapStream.next(it);
+        if (it->getStreamID() > lastId)
+        {
+            it->setFlag(HIO_FLAG_LOCAL_SHUTDOWN, 1);
+            closeStream((ProxyH2Stream *)it, ECONNRESET);
+        }
+    }
+    ProxyH2ExtConn *pSlot;
+    while ((pSlot = m_waitQueue.pop_front()) != NULL)
+        pSlot->onSessionDrain();
+    return 0;
+}
+
+
+int ProxyH2Conn::onCloseEx()
+{
+    if (m_iSessState != H2C_DRAINING)
+        closeSession(ECONNRESET);
+    return 0;
+}
+
+
+void ProxyH2Conn::closeSession(int err)
+{
+    if (m_iSessState == H2C_CLOSED)
+        return;
+    LS_DBG_L(this, "[H2] Close session, error: %d, streams: %d, waiting: %d.",
+             err, (int)m_mapStream.size(), (int)m_waitQueue.size());
+    m_iSessState = H2C_CLOSED;
+    set_h2flag(H2_CONN_FLAG_GOAWAY);
+    m_pWorker->retireH2Conn(this);
+
+    while (m_mapStream.size() > 0)
+        closeStream((ProxyH2Stream *)m_mapStream.begin(), err);
+
+    ProxyH2ExtConn *pSlot;
+    while ((pSlot = m_waitQueue.pop_front()) != NULL)
+        pSlot->onSessionError(err ? err : ECONNRESET);
+
+    getBuf()->clear();
+    if (getfd() != -1)
+        SslEdStream::close();
+    setState(SS_DISCONNECTED);
+}
+
+
+void ProxyH2Conn::closeStream(ProxyH2Stream *pStream, int err)
+{
+    if (findStream(pStream->getStreamID()) != pStream)
+        return;
+    LS_DBG_L(pStream, "[H2] Close stream, error: %d.", err);
+    if (m_current == pStream)
+        m_current = NULL;
+    m_mapStream.erase(pStream);
+    //Never put a frame on the wire for a stream of a dead session.
+    if (m_iSessState == H2C_CLOSED || pStream->getFlag(HIO_FLAG_PEER_RESET))
+        pStream->setFlag(HIO_FLAG_LOCAL_SHUTDOWN, 1);
+    pStream->closeEx();
+    removePriQue(pStream);
+    m_releasedStreams.push_back(pStream);
+
+    ProxyH2ExtConn *pSlot = pStream->getSlot();
+    if (pSlot)
+    {
+        pStream->setSlot(NULL);
+        pSlot->onStreamClosed(err);
+    }
+    if (!m_waitQueue.empty() && !(m_h2flag & H2_CONN_FLAG_IN_EVENT)
+        && m_iSessState == H2C_READY)
+        continueWrite();
+}
+
+
+void ProxyH2Conn::recycleStream(H2StreamBase *stream)
+{
+    closeStream((ProxyH2Stream *)stream, ECONNRESET);
+}
+
+
+ProxyH2Stream *ProxyH2Conn::newStream(ProxyH2ExtConn *pSlot)
+{
+    ProxyH2Stream *pStream;
+    if (!canStartStream())
+        return NULL;
+    if (!m_freeStreams.empty())
+        pStream = m_freeStreams.pop_back();
+    else
+        pStream = new ProxyH2Stream();
+    pStream->reset();
+    pStream->set_key(m_uiNextStreamId);
+    m_uiLastStreamId = m_uiNextStreamId;
+    m_uiNextStreamId += 2;
+    m_mapStream.insert(pStream);
+    pStream->init(this, NULL);
+    pStream->setFlag(HIO_FLAG_WANT_READ | HIO_FLAG_FLOWCTRL, 1);
+    pStream->setSlot(pSlot);
+    ++m_uiStreams;
+    m_tmIdleBegin = 0;
+    if (m_uiNextStreamId > PROXY_H2_LAST_STREAM_ID)
+        m_iSessState = H2C_DRAINING;
+    LS_DBG_L(pStream, "[H2] New stream, active streams: %d.",
+             (int)m_mapStream.size());
+    return pStream;
+}
+
+
+void ProxyH2Conn::releaseStream(ProxyH2Stream *pStream, int abort)
+{
+    pStream->setSlot(NULL);
+    if (findStream(pStream->getStreamID()) != pStream)
+        return;
+    if (m_iSessState != H2C_CLOSED
+        && (abort || pStream->getFlag(HIO_FLAG_LOCAL_SHUTDOWN
+                                      | HIO_FLAG_PEER_SHUTDOWN)
+                     != (HIO_FLAG_LOCAL_SHUTDOWN | HIO_FLAG_PEER_SHUTDOWN)))
+    {
+        pStream->abort();
+        wantFlush();
+    }
+    closeStream(pStream, 0);
+}
+
+
+void ProxyH2Conn::attach(ProxyH2ExtConn *pSlot)
+{
+    if (!pSlot->next())
+        m_waitQueue.append(pSlot);
+    if (canStartStream() && !(m_h2flag & H2_CONN_FLAG_IN_EVENT))
+        continueWrite();
+}
+
+
+void ProxyH2Conn::detach(ProxyH2ExtConn *pSlot)
+{
+    m_waitQueue.remove(pSlot);
+}
+
+
+void ProxyH2Conn::startWaiting()
+{
+    ProxyH2ExtConn *pSlot;
+    while (canStartStream() && (pSlot = m_waitQueue.pop_front()) != NULL)
+        pSlot->onStreamWrite();
+}
+
+
+void ProxyH2Conn::onSecTimer()
+{
+    if (m_iSessState == H2C_CLOSED)
+        return;
+    if (m_iSessState == H2C_CONNECTING)
+    {
+        if (DateTime::s_curTime - m_tmStart >= PROXY_H2_CONNECT_TIMEOUT)
+        {
+            LS_NOTICE(this, "[H2] Timeout connecting to backend %s.",
+                      m_pWorker->getURL());
+            closeSession(ETIMEDOUT);
+        }
+        return;
+    }
+    m_iControlFrames = 0;
+
+    int timeout = m_pWorker->getTimeout();
+    ProxyH2ExtConn *pSlot, *pNext;
+    for (pSlot = m_waitQueue.begin(); pSlot != m_waitQueue.end();
+         pSlot = pNext)
+    {
+        pNext = (ProxyH2ExtConn *)pSlot->next();
+        if (DateTime::s_curTime - pSlot->getReqBeginTime() >= timeout)
+        {
+            m_waitQueue.remove(pSlot);
+            pSlot->onSessionError(ETIMEDOUT);
+        }
+    }
+
+    int stuck = 0;
+    StreamMap::iterator itn, it = m_mapStream.begin();
+    for (; it != m_mapStream.end(); it = itn)
+    {
+        itn = m_mapStream.next(it);
+        if (it->getState() != HIOS_CONNECTED || !it->isWantRead())
+            continue;
+        if (DateTime::s_curTime - it->getActiveTime() >= timeout)
+        {
+            LS_NOTICE(it, "[H2] No response from backend in %d seconds, "
+                      "cancel stream.", timeout);
+            sendRstFrame(it->getStreamID(), H2_ERROR_CANCEL);
+            it->setState(HIOS_RESET);
+            closeStream((ProxyH2Stream *)it, ETIMEDOUT);
+        }
+        else if (it->isStuckOnRead())
+            ++stuck;
+    }
+    if (m_iSessState == H2C_CLOSED)
+        return;
+
+    if (stuck > 0)
+    {
+        if (m_timevalPing.tv_sec == 0)
+        {
+            //cleared by processPingFrame() when the ACK comes back
+            sendPingFrame(0, (uint8_t *)"RUALIVE?");
+            m_timevalPing.tv_sec = DateTime::s_curTime;
+            m_timevalPing.tv_usec = DateTime::s_curTimeUs;
+        }
+        else if (DateTime::s_curTime - m_timevalPing.tv_sec
+                 >= PROXY_H2_PING_TIMEOUT)
+        {
+            LS_NOTICE(this, "[H2] PING timeout, backend is not responding.");
+            doGoAway(H2_ERROR_PROTOCOL_ERROR);
+            return;
+        }
+    }
+
+    if (m_mapStream.size() == 0)
+    {
+        if (m_iSessState == H2C_DRAINING)
+        {
+            closeSession(0);
+            return;
+        }
+        if (m_tmIdleBegin == 0)
+            m_tmIdleBegin = DateTime::s_curTime;
+        else if (m_waitQueue.empty() && DateTime::s_curTime - m_tmIdleBegin
+                 >= m_pWorker->getConfigPointer()->getKeepAliveTimeout())
+        {
+            LS_DBG_L(this, "[H2] Idle session timeout, close.");
+            sendFrame8Bytes(H2_FRAME_GOAWAY, 0, 0, H2_ERROR_NO_ERROR);
+            flush();
+            closeSession(0);
+            return;
+        }
+    }
+
+    ProxyH2Stream *pStream;
+    while (!m_releasedStreams.empty())
+    {
+        pStream = m_releasedStreams.pop_back();
+        if (m_freeStreams.size() < PROXY_H2_MAX_FREE_STREAMS)
+            m_freeStreams.push_back(pStream);
+        else
+            delete pStream;
+    }
+}
+
+
+const char *ProxyH2Conn::buildLogId()
+{
+    m_logId.len = lsnprintf(m_logId.ptr, MAX_LOGID_LEN, "%s#%u",
+                            m_pWorker->getURL(), m_uiSeq);
+    return m_logId.ptr;
+}
+
+
+ProxyH2ExtConn::ProxyH2ExtConn()
+    : m_pSession(NULL)
+    , m_pStream(NULL)
+    , m_flag(0)
+{
+    reset();
+}
+
+
+ProxyH2ExtConn::~ProxyH2ExtConn()
+{
+    close();
+}
+
+
+void ProxyH2ExtConn::reset()
+{
+    memset(&m_iReqHeaderSize, 0,
+           (char *)(&m_iRespBodyRecv + 1) - (char *)&m_iReqHeaderSize);
+}
+
+
+int ProxyH2ExtConn::getReqHost(const char *&pHost)
+{
+    HttpReq *pReq = getConnector()->getHttpSession()->getReq();
+    int len = pReq->getNewHostLen();
+    if (len > 0)
+    {
+        pHost = pReq->getNewHost();
+        return len;
+    }
+    pHost = pReq->getHeader(HttpHeader::H_HOST);
+    return pReq->getHeaderLen(HttpHeader::H_HOST);
+}
+
+
+int ProxyH2ExtConn::connect(Multiplexer *pMplx)
+{
+    getWorker()->startOnDemond(0);
+    //Not bound to a socket, a failure must never shrink the pool.
+    setReqProcessed(1);
+    setCPState(0);
+    setToClose(0);
+    access(DateTime::s_curTime);
+    setState(PROCESSING);
+    onWrite();
+    return 0;
+}
+
+
+int ProxyH2ExtConn::doWrite()
+{
+    HttpExtConnector *pHEC = getConnector();
+    if (!pHEC)
+    {
+        if (m_pSession && !m_pStream)
+        {
+            m_pSession->detach(this);
+            m_pSession = NULL;
+        }
+        return 0;
+    }
+    int state = pHEC->getState();
+    if ((!state) || (state & (HEC_FWD_REQ_HEADER | HEC_FWD_REQ_BODY)))
+    {
+        if (!m_pStream)
+        {
+            //The stream is gone in the middle of the request body.
+            if (state & HEC_FWD_REQ_BODY)
+            {
+                errno = ECONNRESET;
+                return LS_FAIL;
+            }
+            if (!m_pSession)
+            {
+                const char *pHost;
+                int hostLen = getReqHost(pHost);
+                m_pSession = ((ProxyWorker *)getWorker())->getH2Conn(pHost,
+                                                                     hostLen);
+                if (!m_pSession)
+                    return LS_FAIL;
+            }
+            if (!m_pSession->canStartStream())
+            {
+                m_pSession->attach(this);
+                return 0;
+            }
+            m_pSession->detach(this);
+        }
+        int ret = pHEC->extOutputReady();
+        if (!m_pStream)
+            m_pSession = NULL;
+        if (getState() == ABORT)
+        {
+            if (getConnector())
+            {
+                incReqProcessed();
+                getConnector()->endResponse(0, 0);
+            }
+        }
+        return ret;
+    }
+    suspendWrite();
+    return 0;
+}
+
+
+int ProxyH2ExtConn::onStreamWrite()
+{
+    int ret = onWrite();
+    onEventDone(-1);
+    return ret;
+}
+
+
+int ProxyH2ExtConn::onStreamRead()
+{
+    int ret = onRead();
+    onEventDone(-1);
+    return ret;
+}
+
+
+void ProxyH2ExtConn::onSessionError(int err)
+{
+    LS_DBG_L(this, "[H2] Session failed, error: %d.", err);
+    m_pSession = NULL;
+    connError(err);
+}
+
+
+void ProxyH2ExtConn::onSessionDrain()
+{
+    LS_DBG_L(this, "[H2] Session draining, look for another one.");
+    m_pSession = NULL;
+    onWrite();
+}
+
+
+void ProxyH2ExtConn::onStreamClosed(int err)
+{
+    m_pStream = NULL;
+    m_pSession = NULL;
+    if (getState() == ABORT)
+    {
+        if (getConnector())
+        {
+            incReqProcessed();
+            getConnector()->endResponse(0, 0);
+        }
+        return;
+    }
+    LS_DBG_L(this, "[H2] Stream closed, error: %d.", err);
+    doError(err);
+}
+
+
+void ProxyH2ExtConn::releaseSession(int abort)
+{
+    if (m_pStream)
+    {
+        m_pSession->releaseStream(m_pStream, abort);
+        m_pStream = NULL;
+    }
+    if (m_pSession)
+    {
+        m_pSession->detach(this);
+        m_pSession = NULL;
+    }
+}
+
+
+static void appendReqHeaders(UnpackedHeaders *pHdrs, const char *pLine,
+                             const char *pEnd, int dropXff)
+{
+    const char *pLineEnd, *pMark, *pVal, *pValEnd;
+    int nameLen, index;
+    for (; pLine < pEnd; pLine = pLineEnd + 1)
+    {
+        pLineEnd = (const char *)memchr(pLine, '\n', pEnd - pLine);
+        if (!pLineEnd)
+            pLineEnd = pEnd;
+        pMark = (const char *)memchr(pLine, ':', pLineEnd - pLine);
+        if (!pMark)
+            continue;
+        nameLen = pMark - pLine;
+        while (nameLen > 0 && isspace(pLine[nameLen - 1]))
+            --nameLen;
+        if (nameLen <= 0)
+            continue;
+        pVal = pMark + 1;
+        pValEnd = pLineEnd;
+        while (pVal < pValEnd && isspace(*pVal))
+            ++pVal;
+        while (pValEnd > pVal && isspace(pValEnd[-1]))
+            --pValEnd;
+
+        index = HttpHeader::getIndex(pLine, nameLen);
+        switch (index)
+        {
+        case HttpHeader::H_CONNECTION:
+        case HttpHeader::H_KEEP_ALIVE:
+        case HttpHeader::H_TRANSFER_ENCODING:
+        case HttpHeader::H_UPGRADE:
+        case HttpHeader::H_HOST:
+        case HttpHeader::H_ACC_ENCODING:
+            continue;
+        case HttpHeader::H_TE:
+            //The only value allowed over HTTP/2.
+            if (pValEnd - pVal != 8 || strncasecmp(pVal, "trailers", 8) != 0)
+                continue;
+            break;
+        case HttpHeader::H_X_FORWARDED_FOR:
+            if (dropXff)
+                continue;
+            break;
+        case HttpHeader::H_UNKNOWN:
+            if (isProxyConnection(pLine, nameLen))
+                continue;
+            break;
+        }
+        pHdrs->appendHeader(index, pLine, nameLen, pVal, pValEnd - pVal);
+    }
+}
+
+
+int ProxyH2ExtConn::sendReqHeader()
+{
+    HttpSession *pSession = getConnector()->getHttpSession();
+    HttpReq *pReq = pSession->getReq();
+    const char *pHost;
+    int hostLen;
+
+    m_pStream = m_pSession->newStream(this);
+    if (!m_pStream)
+    {
+        errno = ECONNRESET;
+        return LS_FAIL;
+    }
+
+    UnpackedHeaders hdrs;
+    http_method_t method = (http_method_t)pReq->getMethod();
+    hdrs.setMethod(HttpMethod::get(method), HttpMethod::getLen(method));
+    const char *pUrl = pReq->getOrgReqURL();
+    int urlLen = pReq->getOrgReqURLLen();
+    if (pReq->getRedirects() > 0)
+    {
+        int lineLen = 0;
+        int skip = HttpMethod::getLen(method) + 1;
+        const char *pLine = pReq->encodeReqLine(lineLen);
+        if (lineLen > skip)
+        {
+            pUrl = pLine + skip;
+            urlLen = lineLen - skip;
+        }
+    }
+    hdrs.setUrl(pUrl, urlLen);
+    hostLen = getReqHost(pHost);
+    if (hostLen <= 0)
+    {
+        pHost = getWorker()->getURL();
+        hostLen = strlen(pHost);
+    }
+    hdrs.setHost(pHost, hostLen);
+    hdrs.setSecheme(!((ProxyWorker *)getWorker())->getConfig().getSsl());
+
+    char achXff[256];
+    int xffLen = 0;
+    int dropXff = 0;
+    if (pSession->shouldIncludePeerAddr())
+    {
+        const char *pForward = pReq->getHeader(HttpHeader::H_X_FORWARDED_FOR);
+        const char *pAddr = NULL;
+        int addrLen = 0;
+        if (*pForward != '\0')
+        {
+            xffLen = pReq->getHeaderLen(HttpHeader::H_X_FORWARDED_FOR);
+            if (xffLen > 160)
+                xffLen = 160;
+            memmove(achXff, pForward, xffLen);
+            achXff[xffLen++] = ',';
+            pAddr = pReq->getEnv("PROXY_REMOTE_ADDR", 17, addrLen);
+        }
+        if (!pAddr)
+        {
+            pAddr = pSession->getPeerAddrString();
+            addrLen = pSession->getPeerAddrStrLen();
+        }
+        if (addrLen > (int)sizeof(achXff) - xffLen)
+            addrLen = sizeof(achXff) - xffLen;
+        memmove(achXff + xffLen, pAddr, addrLen);
+        xffLen += addrLen;
+        dropXff = 1;
+    }
+
+    const char *pHeaders = pReq->getOrgReqLine();
+    const char *pEnd = pHeaders + pReq->getHttpHeaderLen();
+    pHeaders = (const char *)memchr(pHeaders + pReq->getOrgReqLineLen(), '\n',
+                                    pEnd - pHeaders - pReq->getOrgReqLineLen());
+    if (pHeaders)
+        appendReqHeaders(&hdrs, pHeaders + 1, pEnd, dropXff);
+
+    if (xffLen > 0)
+        hdrs.appendHeader(HttpHeader::H_X_FORWARDED_FOR, "x-forwarded-for", 15,
+                          achXff, xffLen);
+    const char *pAE = pReq->getHeader(HttpHeader::H_ACC_ENCODING);
+    int aeLen = pReq->getHeaderLen(HttpHeader::H_ACC_ENCODING);
+    if (*pAE != '\0' && aeLen < 4)
+        hdrs.appendHeader(HttpHeader::H_ACC_ENCODING, "accept-encoding", 15,
+                          pAE, aeLen);
+    else
+        hdrs.appendHeader(HttpHeader::H_ACC_ENCODING, "accept-encoding", 15,
+                          "gzip", 4);
+    const char *pOrgHost = pReq->getHeader(HttpHeader::H_HOST);
+    int orgHostLen = pReq->getHeaderLen(HttpHeader::H_HOST);
+    if (orgHostLen > 0)
+        hdrs.appendHeader(HttpHeader::H_UNKNOWN, "x-forwarded-host", 16,
+                          pOrgHost, orgHostLen);
+    if (pSession->isHttps())
+        hdrs.appendHeader(HttpHeader::H_UNKNOWN, "x-forwarded-proto", 17,
+                          "https", 5);
+    int earlyDataLen;
+    if (pReq->getContextState(EARLY_DATA)
+        && pReq->getHeader("Early-Data", 10, earlyDataLen) == NULL)
+        hdrs.appendHeader(HttpHeader::H_UNKNOWN, "early-data", 10, "1", 1);
+
+    int hasBody = (pReq->getBodyBuf() != NULL);
+    if (m_pSession->sendReqHeaders(m_pStream->getStreamID(), 0,
+                                   hasBody ? 0 : H2_FLAG_END_STREAM,
+                                   &hdrs) == LS_FAIL)
+    {
+        releaseSession(1);
+        errno = ECONNRESET;
+        return LS_FAIL;
+    }
+    if (!hasBody)
+        m_pStream->setFlag(HIO_FLAG_LOCAL_SHUTDOWN, 1);
+    m_pSession->wantFlush();
+
+    m_iReqHeaderSize = hdrs.getBuf()->size();
+    m_iReqBodySize = pReq->getContentLength();
+    setInProcess(1);
+    LS_DBG_L(this, "[H2] Request header sent on stream %u, %d bytes.",
+             m_pStream->getStreamID(), m_iReqHeaderSize);
+    return 1;
+}
+
+
+int ProxyH2ExtConn::sendReqBody(const char *pBuf, int size)
+{
+    if (!m_pStream)
+    {
+        errno = ECONNRESET;
+        return LS_FAIL;
+    }
+    int ret = m_pStream->write(pBuf, size);
+    if (ret > 0)
+        m_iReqTotalSent += ret;
+    return ret;
+}
+
+
+int ProxyH2ExtConn::endOfReqBody()
+{
+    m_lReqSentTime = time(NULL);
+    if (m_pStream && !m_pStream->getFlag(HIO_FLAG_LOCAL_SHUTDOWN))
+        m_pStream->sendFin();
+    suspendWrite();
+    return 0;
+}
+
+
+int ProxyH2ExtConn::doRead()
+{
+    LS_DBG_L(this, "ProxyH2ExtConn::doRead()");
+    m_flag |= PH2F_IN_DO_READ;
+    int ret = processResp();
+    if (getState() == ABORT)
+    {
+        if (getConnector())
+        {
+            incReqProcessed();
+            getConnector()->endResponse(0, 0);
+        }
+    }
+    m_flag &= ~PH2F_IN_DO_READ;
+    return ret;
+}
+
+
+int ProxyH2ExtConn::processResp()
+{
+    HttpExtConnector *pHEC = getConnector();
+    if (!pHEC || !m_pStream)
+    {
+        errno = ECONNRESET;
+        return LS_FAIL;
+    }
+    int &respState = pHEC->getRespState();
+    if (!(respState & 0xff))
+    {
+        if (m_pStream->isRespHeaderReady() != 1)
+            return 0;
+        AutoBuf &headers = m_pStream->getRespHeaders();
+        const char *pBuf = headers.begin();
+        int len = headers.size();
+        m_iRespHeaderRecv += len;
+        m_pStream->setRespHeaderReady(2);
+        int ret = pHEC->parseHeader(pBuf, len, 1);
+        headers.clear();
+        switch (ret)
+        {
+        case -2:
+            LS_WARN(this, "Invalid Http response header, retry!");
+            errno = ECONNRESET;
+        //fall through
+        case -1:
+            return LS_FAIL;
+        }
+        if (!(respState & 0xff))
+        {
+            LS_WARN(this, "Incomplete response header from HTTP/2 backend.");
+            errno = ECONNRESET;
+            return LS_FAIL;
+        }
+        HttpReq *pReq = pHEC->getHttpSession()->getReq();
+        if (pReq->noRespBody())
+        {
+            releaseSession(0);
+            incReqProcessed();
+            setInProcess(0);
+            if (pReq->getMethod() == HttpMethod::HTTP_HEAD
+                && pReq->getStatusCode() == SC_200)
+                pHEC->getHttpSession()->getResp()->appendContentLenHeader();
+            pHEC->endResponse(0, 0);
+            return 0;
+        }
+    }
+    return readRespBody();
+}
+
+
+int ProxyH2ExtConn::readRespBody()
+{
+    HttpExtConnector *pHEC = getConnector();
+    size_t bufLen;
+    int ret;
+    while (getState() != ABORT && m_pStream)
+    {
+        char *pBuf = pHEC->getRespBuf(bufLen);
+        if (!pBuf)
+            return LS_FAIL;
+        ret = m_pStream->read(pBuf, bufLen);
+        if (ret > 0)
+        {
+            m_iRespBodyRecv += ret;
+            pHEC->processRespBodyData(pBuf, ret);
+            if (ret > 1024)
+                pHEC->flushResp();
+            if (ret < (int)bufLen && m_pStream && !m_pStream->isEos())
+            {
+                pHEC->flushResp();
+                return 0;
+            }
+        }
+        else if (ret == 0)
+        {
+            pHEC->flushResp();
+            return 0;
+        }
+        else
+        {
+            if (!m_pStream->isEos())
+            {
+                errno = ECONNRESET;
+                return LS_FAIL;
+            }
+            return finishResp();
+        }
+    }
+    return 0;
+}
+
+
+int ProxyH2ExtConn::finishResp()
+{
+    LS_DBG_L(this, "[H2] Response done, %lld bytes body.",
+             (long long)m_iRespBodyRecv);
+    releaseSession(0);
+    incReqProcessed();
+    setInProcess(0);
+    getConnector()->endResponse(0, 0);
+    return 0;
+}
+
+
+void ProxyH2ExtConn::continueRead()
+{
+    if (!m_pStream)
+        return;
+    //Never re-enter doRead(), the stream is read again when it returns.
+    if (isInDoRead())
+        m_pStream->setFlag(HIO_FLAG_WANT_READ, 1);
+    else
+        m_pStream->continueRead();
+}
+
+
+void ProxyH2ExtConn::suspendRead()
+{
+    if (m_pStream)
+        m_pStream->suspendRead();
+}
+
+
+void ProxyH2ExtConn::continueWrite()
+{
+    if (m_pStream)
+        m_pStream->continueWrite();
+}
+
+
+void ProxyH2ExtConn::suspendWrite()
+{
+    if (m_pStream)
+        m_pStream->suspendWrite();
+}
+
+
+void ProxyH2ExtConn::abort()
+{
+    if (getState() == DISCONNECTED)
+        return;
+    LS_DBG_L(this, "[H2] Abort request.");
+    setState(ABORT);
+    if (m_pStream)
+    {
+        //Cancel now, the response is ended once the session drops the stream.
+        m_pStream->abort();
+        m_pStream->continueWrite();
+    }
+}
+
+
+int ProxyH2ExtConn::close()
+{
+    releaseSession(1);
+    if (getState() != DISCONNECTED)
+    {
+        LS_DBG_L(this, "[ExtConn] close()");
+        setState(DISCONNECTED);
+        setInProcess(0);
+    }
+    return 0;
+}
+
+
+void ProxyH2ExtConn::cleanUp()
+{
+    setConnector(NULL);
+    close();
+    reset();
+    recycle();
+}
+
+
+int ProxyH2ExtConn::doError(int err)
+{
+    LS_DBG_L(this, "ProxyH2ExtConn::doError()");
+    if (getConnector())
+    {
+        int state = getConnector()->getState();
+        if (!(state & (HEC_FWD_RESP_BODY | HEC_ABORT_REQUEST
+                       | HEC_ERROR | HEC_COMPLETE)))
+        {
+            LS_DBG_L(this, "HTTP/2 stream failed, try again!");
+            connError(err);
+            return 0;
+        }
+        if (!(state & HEC_COMPLETE))
+            getConnector()->endResponse(SC_500, -1);
+    }
+    return 0;
+}
+
+
+int ProxyH2ExtConn::addRequest(ExtRequest *pReq)
+{
+    assert(pReq);
+    setConnector((HttpExtConnector *)pReq);
+    reset();
+    m_lReqBeginTime = time(NULL);
+    return 0;
+}
+
+
+ExtRequest *ProxyH2ExtConn::getReq() const
+{
+    return getConnector();
+}
+
+
+int ProxyH2ExtConn::removeRequest(ExtRequest *pReq)
+{
+    if (getConnector())
+    {
+        getConnector()->setProcessor(NULL);
+        setConnector(NULL);
+    }
+    return 0;
+}
+
+
+void ProxyH2ExtConn::dump()
+{
+    LS_INFO(this,
+            "Proxy HTTP/2 stream %u, state: %d, "
+            "Request header:%d, body:%lld, sent:%lld, "
+            "Response header: %d, body: %lld bytes received in %ld seconds,"
+            "Total processing time: %ld.",
+            m_pStream ? m_pStream->getStreamID() : 0, getState(),
+            m_iReqHeaderSize, (long long)m_iReqBodySize,
+            (long long)m_iReqTotalSent, m_iRespHeaderRecv,
+            (long long)m_iRespBodyRecv,
+            (m_lReqSentTime) ? time(NULL) - m_lReqSentTime : 0,
+            time(NULL) - m_lReqBeginTime);
+}
+
@@ -0,0 +1,272 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2022  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+#ifndef PROXYH2CONN_H
+#define PROXYH2CONN_H
+
+
+#include <lsdef.h>
+#include <edio/ssledstream.h>
+#include <extensions/extconn.h>
+#include <extensions/httpextprocessor.h>
+#include <h2/h2connbase.h>
+#include <h2/h2streambase.h>
+#include <util/autobuf.h>
+#include <util/autostr.h>
+#include <util/dlinkqueue.h>
+#include <util/gpointerlist.h>
+
+#define PH2F_IN_DO_READ     1
+
+class ProxyWorker;
+class ProxyH2Conn;
+class ProxyH2ExtConn;
+
+
+/**
+ * One request/response exchange on a multiplexed upstream session.
+ * The response header block is kept as HTTP/1.1 text so the usual
+ * HttpExtConnector::parseHeader() can be used on it.
+ */
+class ProxyH2Stream : public H2StreamBase
+{
+public:
+    ProxyH2Stream();
+    ~ProxyH2Stream();
+
+    void reset();
+
+    void setSlot(ProxyH2ExtConn *pSlot)     {   m_pSlot = pSlot;        }
+    ProxyH2ExtConn *getSlot() const         {   return m_pSlot;         }
+
+    AutoBuf &getRespHeaders()               {   return m_bufRespHeaders;    }
+    int  isRespHeaderReady() const          {   return m_iRespHeaderReady;  }
+    void setRespHeaderReady(int n)          {   m_iRespHeaderReady = n;     }
+
+    int  readv(struct iovec *vector, int count)    {   return -1;  }
+
+    int  onRead();
+    int  onWrite();
+    int  onPeerClose();
+
+    void continueRead();
+    void sendFin()                          {   shutdownWrite();        }
+
+protected:
+    virtual const char *buildLogId();
+
+private:
+    ProxyH2ExtConn *m_pSlot;
+    AutoBuf         m_bufRespHeaders;
+    int             m_iRespHeaderReady;
+
+    LS_NO_COPY_ASSIGN(ProxyH2Stream);
+};
+
+
+/**
+ * Client side HTTP/2 session to a proxy backend, over TLS with ALPN "h2"
+ * or over clear text with prior knowledge. Requests waiting for a free
+ * stream are queued on the session and started when the concurrent
+ * stream limit of the peer allows.
+ *
+ * A session is never deleted inside its own event handler, a closed
+ * session is retired to the worker and released by its timer.
+ */
+class ProxyH2Conn : public SslEdStream
+    , public H2ConnBase
+    , public DLinkedObj
+{
+public:
+    enum
+    {
+        H2C_CONNECTING,
+        H2C_READY,
+        H2C_DRAINING,
+        H2C_CLOSED
+    };
+
+    explicit ProxyH2Conn(ProxyWorker *pWorker);
+    ~ProxyH2Conn();
+
+    int  connectTo(Multiplexer *pMplx, const char *pHost, int hostLen);
+
+    bool isSameHost(const char *pHost, int hostLen) const
+    {
+        return (m_sHost.len() == hostLen)
+               && (strncasecmp(m_sHost.c_str(), pHost, hostLen) == 0);
+    }
+    bool isUsable() const
+    {   return m_iSessState <= H2C_READY;                   }
+    bool isClosed() const
+    {   return m_iSessState == H2C_CLOSED;                  }
+    bool canStartStream() const
+    {
+        return (m_iSessState == H2C_READY)
+               && ((int)m_mapStream.size() < m_iPeerMaxStreams);
+    }
+    int  getLoad() const
+    {   return m_mapStream.size() + m_waitQueue.size();     }
+
+    void attach(ProxyH2ExtConn *pSlot);
+    void detach(ProxyH2ExtConn *pSlot);
+
+    ProxyH2Stream *newStream(ProxyH2ExtConn *pSlot);
+    void releaseStream(ProxyH2Stream *pStream, int abort);
+
+    void onSecTimer();
+
+    // H2ConnBase
+    LogSession *getLogSession() const
+    {   return const_cast<ProxyH2Conn *>(this);             }
+    void suspendRead();
+    InputStream *getInStream()
+    {   return static_cast<SslEdStream *>(this);            }
+    int  flush();
+    int  onCloseEx();
+    void recycle()  {}
+    void continueWrite();
+    bool isPauseWrite() const
+    {   return StreamStat::isPauseWrite();                  }
+    int  assignStreamHandler(H2StreamBase *stream)
+    {   return 0;   }
+    int  verifyStreamId(uint32_t id);
+    int  onWriteEx2();
+    int  decodeHeaders(uint32_t id, unsigned char *src, int length,
+                       unsigned char iHeaderFlag);
+    int  doGoAway(H2ErrorCode status);
+    int  appendSendfileOutput(int fd, off_t off, int size)
+    {   return LS_FAIL; }
+    void recycleStream(H2StreamBase *stream);
+
+    // EdStream
+    int  onRead();
+    int  onWrite();
+    int  onHangup();
+    int  onError();
+    int  onEventDone(short event);
+
+protected:
+    int  onPeerClose();
+    virtual const char *buildLogId();
+
+private:
+    int  checkReady();
+    void startWaiting();
+    void closeSession(int err);
+    void closeStream(ProxyH2Stream *pStream, int err);
+    int  decodeRespHeaders(unsigned char *pSrc, unsigned char *pEnd,
+                           int &status);
+
+    ProxyWorker        *m_pWorker;
+    AutoStr2            m_sHost;
+    int                 m_iSessState;
+    uint32_t            m_uiNextStreamId;
+    uint32_t            m_uiSeq;
+    time_t              m_tmStart;
+    AutoBuf             m_bufDecode;
+    AutoBuf             m_bufXpack;
+    TDLinkQueue<ProxyH2ExtConn>     m_waitQueue;
+    TPointerList<ProxyH2Stream>     m_releasedStreams;
+    TPointerList<ProxyH2Stream>     m_freeStreams;
+
+    LS_NO_COPY_ASSIGN(ProxyH2Conn);
+};
+
+
+/**
+ * The ExtConn of a proxy worker with proxyHttp2 on. It is not bound to a
+ * socket, it forwards one request at a time through a stream of a shared
+ * ProxyH2Conn, so the connection pool of the worker limits the number of
+ * requests in flight instead of the number of sockets.
+ */
+class ProxyH2ExtConn : public ExtConn
+    , public HttpExtProcessor
+    , public DLinkedObj
+{
+    ProxyH2Conn    *m_pSession;
+    ProxyH2Stream  *m_pStream;
+    int             m_flag;
+    int             m_iReqHeaderSize;
+    long            m_lReqBeginTime;
+    long            m_lReqSentTime;
+    int             m_iRespHeaderRecv;
+    int64_t         m_iReqBodySize;
+    int64_t         m_iReqTotalSent;
+    int64_t         m_iRespBodyRecv;
+
+    int         processResp();
+    int         readRespBody();
+    int         finishResp();
+    void        releaseSession(int abort);
+    int         getReqHost(const char *&pHost);
+
+protected:
+    virtual int doRead();
+    virtual int doWrite();
+    virtual int doError(int err);
+    virtual int addRequest(ExtRequest *pReq);
+    virtual ExtRequest *getReq() const;
+    virtual void init(int fd, Multiplexer *pMplx)   {}
+    virtual int connect(Multiplexer *pMplx);
+
+public:
+    virtual int removeRequest(ExtRequest *pReq);
+
+public:
+    ProxyH2ExtConn();
+    ~ProxyH2ExtConn();
+
+    void onSessionError(int err);
+    void onSessionDrain();
+    void onStreamClosed(int err);
+    int  onStreamRead();
+    int  onStreamWrite();
+    void detachSession()
+    {   m_pSession = NULL;  m_pStream = NULL;   }
+
+    virtual void finishRecvBuf()    {}
+
+    virtual bool wantRead()     {   return false;   }
+    virtual bool wantWrite()    {   return false;   }
+
+    virtual void abort();
+    virtual int  begin()        {   return 1;       }
+    virtual int  beginReqBody() {   return 1;       }
+    virtual int  endOfReqBody();
+    virtual int  sendReqBody(const char *pBuf, int size);
+    virtual int  readResp(char *pBuf, int size)
+    {   return 0;   }
+    virtual void cleanUp();
+    virtual void dump();
+
+    virtual int sendReqHeader();
+    virtual int close();
+    void reset();
+
+    void continueRead();
+    void suspendRead();
+    void continueWrite();
+    void suspendWrite();
+
+    short isInDoRead() const    {   return m_flag & PH2F_IN_DO_READ;    }
+    long getReqBeginTime() const    {   return m_lReqBeginTime;     }
+
+    LS_NO_COPY_ASSIGN(ProxyH2ExtConn);
+};
+
+#endif
@@ -18,9 +18,14 @@
 #include "proxyworker.h"
 #include "proxyconfig.h"
 #include "proxyconn.h"
+#include "proxyh2conn.h"
+#include <edio/multiplexerfactory.h>
 #include <http/handlertype.h>
+#include <log4cxx/logger.h>
 #include <sslpp/sslsesscache.h>
 
+#include <errno.h>
+
 ProxyWorker::ProxyWorker(const char *pName)
     : LocalWorker(HandlerType::HT_PROXY)
     , m_pSslClientSessCache(NULL)
@@ -31,6 +36,8 @@ ProxyWorker::ProxyWorker(const char *pName)
 
 ProxyWorker::~ProxyWorker()
 {
+    m_h2Conns.release_objects();
+    m_h2Closed.release_objects();
     if (m_pSslClientSessCache)
         delete m_pSslClientSessCache;
 }
@@ -38,6 +45,8 @@ ProxyWorker::~ProxyWorker()
 
 ExtConn *ProxyWorker::newConn()
 {
+    if (getConfig().getHttp2())
+        return new ProxyH2ExtConn();
     ProxyConn *pConn = new ProxyConn();
     //if (( pConn )&&( getConfig().getSsl() ))
     //    pConn->setUseSsl( 1 );
@@ -62,3 +71,63 @@ int ProxyWorker::startEx()
        ret = startWorker();
    return ret;
 }
+
+
+ProxyH2Conn *ProxyWorker::getH2Conn(const char *pHost, int hostLen)
+{
+    ProxyH2Conn *pBest = NULL;
+    int usable = 0;
+    int useSni = getConfig().getSsl();
+    ProxyH2Conn *pConn = m_h2Conns.begin();
+    for (; pConn != m_h2Conns.end(); pConn = (ProxyH2Conn *)pConn->next())
+    {
+        //A draining session does not count against the limit.
+        if (!pConn->isUsable())
+            continue;
+        ++usable;
+        if (useSni && !pConn->isSameHost(pHost, hostLen))
+            continue;
+        if (!pBest || pConn->getLoad() < pBest->getLoad())
+            pBest = pConn;
+    }
+    if (pBest && pBest->canStartStream())
+        return pBest;
+
+    if (usable < getConfig().getHttp2Conns())
+    {
+        pConn = new ProxyH2Conn(this);
+        if (pConn->connectTo(MultiplexerFactory::getMultiplexer(), pHost,
+                             hostLen) == LS_FAIL)
+        {
+            LS_NOTICE("[%s] Failed to connect HTTP/2 session to backend, "
+                      "error: %s.", getName(), strerror(errno));
+            delete pConn;
+            return NULL;
+        }
+        m_h2Conns.append(pConn);
+        return pConn;
+    }
+    if (!pBest)
+        errno = EAGAIN;
+    return pBest;
+}
+
+
+void ProxyWorker::retireH2Conn(ProxyH2Conn *pConn)
+{
+    m_h2Conns.remove(pConn);
+    m_h2Closed.append(pConn);
+}
+
+
+void ProxyWorker::onSecTimer()
+{
+    ProxyH2Conn *pNext, *pConn = m_h2Conns.begin();
+    for (; pConn != m_h2Conns.end(); pConn = pNext)
+    {
+        pNext = (ProxyH2Conn *)pConn->next();
+        pConn->onSecTimer();
+    }
+    m_h2Closed.release_objects();
+    LocalWorker::onSecTimer();
+}
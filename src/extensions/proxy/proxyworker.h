@@ -21,9 +21,11 @@
 
 #include <lsdef.h>
 #include <extensions/localworker.h>
+#include <util/dlinkqueue.h>
 
 class SslClientSessCache;
 class ProxyConfig;
+class ProxyH2Conn;
 class ProxyWorker : public LocalWorker
 {
 protected:
@@ -38,8 +40,14 @@ public:
     {   return *((ProxyConfig *)getConfigPointer());  }
     SslClientSessCache *getSslSessCache();
 
+    ProxyH2Conn *getH2Conn(const char *pHost, int hostLen);
+    void retireH2Conn(ProxyH2Conn *pConn);
+    virtual void onSecTimer();
+
 private:
     SslClientSessCache *m_pSslClientSessCache;
+    TDLinkQueue<ProxyH2Conn>    m_h2Conns;
+    TDLinkQueue<ProxyH2Conn>    m_h2Closed;
 
     LS_NO_COPY_ASSIGN(ProxyWorker);
 };
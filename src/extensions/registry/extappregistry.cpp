@@ -33,12 +33,14 @@
 #include <util/stringtool.h>
 #include <util/xmlnode.h>
 
+#include <extensions/extconnboard.h>
 #include <extensions/extworker.h>
 #include <extensions/loadbalancer.h>
 #include <extensions/localworkerconfig.h>
 #include <extensions/pidlist.h>
 #include <extensions/cgi/cgidworker.h>
 #include <extensions/fcgi/fcgiapp.h>
+#include <extensions/fcgi/fcgiappconfig.h>
 #include <extensions/jk/jworker.h>
 #include <extensions/lsapi/lsapiworker.h>
 #include <extensions/proxy/proxyconfig.h>
@@ -226,6 +228,16 @@ static const char *s_pTypeName[] =
     "LB",
 };
 
+void ExtAppSubRegistry::onSecTimer()
+{
+    ExtAppMap::iterator iter;
+    for (iter = m_pRegistry->begin();
+         iter != m_pRegistry->end();
+         iter = m_pRegistry->next(iter))
+        iter.second()->onSecTimer();
+}
+
+
 int ExtAppSubRegistry::generateRTReport(int fd, int type)
 {
     ExtAppMap::iterator iter;
@@ -379,6 +391,13 @@ void ExtAppRegistry::onTimer()
 }
 
 
+void ExtAppRegistry::onSecTimer()
+{
+    for (int i = 0; i < EA_NUM_APP; ++i)
+        s_registry[i]()->onSecTimer();
+}
+
+
 void ExtAppRegistry::init()
 {
     for (int i = 0; i < EA_NUM_APP; ++i)
@@ -419,6 +438,7 @@ int ExtAppRegistry::generateRTReport(int fd)
         if (i != EA_LOGGER)
             s_registry[i]()->generateRTReport(fd, i);
     }
+    ExtConnBoard::generateRTReport(fd);
     return 0;
 }
 
@@ -935,6 +955,10 @@ ExtWorker *ExtAppRegistry::configExtApp(const XmlNode *pNode, const HttpVHost *p
     pWorker->setRole(role);
 
     pConfig->config(pNode);
+    if (iType == EA_PROXY)
+        ((ProxyWorker *)pWorker)->getConfig().configHttp2(pNode);
+    else if (iType == EA_FCGI)
+        ((FcgiApp *)pWorker)->getConfig().configMultiplex(pNode);
 
     if (!iAutoStart)
     {
@@ -1041,6 +1065,9 @@ int ExtAppRegistry::configLoadBalacner(const XmlNode *pNode,
 
         if (pVHost)
             pLB->getConfigPointer()->setVHost(pVHost);
+        pLB->setPolicy(currentCtx.getLongValue(pNode, "lbPolicy",
+                       LB_POLICY_LEAST_LOAD, LB_POLICY_CONSISTENT_HASH,
+                       LB_POLICY_LEAST_LOAD));
 
         const char *pWorkers = pNode->getChildValue("workers");
 
@@ -59,6 +59,7 @@ public:
     void endConfig();
     void clear();
     void onTimer();
+    void onSecTimer();
     void runOnStartUp();
     int generateRTReport(int fd, int type);
     int generateRTJsonReport(AutoBuf *buf, int type, int *did);
@@ -91,6 +92,7 @@ public:
     static void endConfig();
     static void clear();
     static void onTimer();
+    static void onSecTimer();
     static void runOnStartUp();
     static void init();
     static void shutdown();
@@ -65,6 +65,7 @@ H2ConnBase::H2ConnBase()
     , m_iServerMaxStreams(100)
     , m_iStreamOutInitWindowSize(H2_FCW_INIT_SIZE)
     , m_iMaxPushStreams(100)
+    , m_iPeerMaxStreams(100)
     , m_iPeerMaxFrameSize(H2_DEFAULT_DATAFRAME_SIZE)
     , m_uiPushStreamId(2)
 {
@@ -92,6 +93,7 @@ int H2ConnBase::init()
     m_iStreamOutInitWindowSize = H2_FCW_INIT_SIZE;
     m_iServerMaxStreams = 100;
     m_iMaxPushStreams = 100;
+    m_iPeerMaxStreams = 100;
     m_tmIdleBegin = 0;
     m_uiShutdownStreams = 0;
     m_iCurPushStreams = 0;
@@ -497,7 +499,11 @@ int H2ConnBase::processSettingFrame(H2FrameHeader *pHeader)
                          iEntryValue);
                 return LS_FAIL;
             }
-            lshpack_dec_set_max_capacity(&m_hpack_dec, iEntryValue);
+            //The peer limits the table of our encoder.
+            if (m_h2flag & H2_CONN_FLAG_CLIENT)
+                lshpack_enc_set_max_capacity(&m_hpack_enc, iEntryValue);
+            else
+                lshpack_dec_set_max_capacity(&m_hpack_dec, iEntryValue);
             break;
         case H2_SETTINGS_MAX_FRAME_SIZE:
             if ((iEntryValue < H2_DEFAULT_DATAFRAME_SIZE) ||
@@ -528,6 +534,7 @@ int H2ConnBase::processSettingFrame(H2FrameHeader *pHeader)
             break;
         case H2_SETTINGS_MAX_CONCURRENT_STREAMS:
             m_iMaxPushStreams = iEntryValue ;
+            m_iPeerMaxStreams = iEntryValue ;
             if (m_iMaxPushStreams == 0)
                 set_h2flag(H2_CONN_FLAG_NO_PUSH);
             break;
@@ -1022,20 +1029,23 @@ int H2ConnBase::processDataFramePadding(H2FrameHeader *pHeader)
 
 int H2ConnBase::processContinuationFrame(H2FrameHeader *pHeader)
 {
-    if (m_h2flag & H2_CONN_FLAG_GOAWAY)
+    if ((m_h2flag & (H2_CONN_FLAG_GOAWAY | H2_CONN_FLAG_CLIENT))
+        == H2_CONN_FLAG_GOAWAY)
         return 0;
     uint32_t id = pHeader->getStreamId();
-    if ((id != m_uiLastStreamId)
+    if ((id != m_uiHeaderStreamId)
         || (m_h2flag & H2_CONN_HEADERS_START) == 0)
     {
         LS_DBG_L(getLogSession(), "received unexpected CONTINUATION frame, expect id: %d, "
-                 " connection flag: %d", m_uiLastStreamId, m_h2flag);
+                 " connection flag: %d", m_uiHeaderStreamId, m_h2flag);
         return LS_FAIL;
     }
     if (pHeader->getFlags() & H2_FLAG_END_HEADERS)
         clr_h2flag(H2_CONN_HEADERS_START);
 
-    return processHeaderIn(id, pHeader->getFlags());
+    //END_STREAM is only carried by the HEADERS frame
+    return processHeaderIn(id, pHeader->getFlags()
+                           | (m_iHeaderFlags & H2_FLAG_END_STREAM));
 }
 
 
@@ -1137,7 +1147,9 @@ int H2ConnBase::processPriority(uint32_t id)
 int H2ConnBase::processHeadersFrame(H2FrameHeader *pHeader)
 {
     uint32_t id = pHeader->getStreamId();
-    if (m_h2flag & H2_CONN_FLAG_GOAWAY)
+    //A client still has to decode the responses of the streams in flight.
+    if ((m_h2flag & (H2_CONN_FLAG_GOAWAY | H2_CONN_FLAG_CLIENT))
+        == H2_CONN_FLAG_GOAWAY)
         return 0;
 
     if (verifyStreamId(id) == LS_FAIL)
@@ -1170,6 +1182,8 @@ int H2ConnBase::processHeadersFrame(H2FrameHeader *pHeader)
     if ((iHeaderFlag & H2_FLAG_END_HEADERS) == 0)
         set_h2flag(H2_CONN_HEADERS_START);
 
+    m_uiHeaderStreamId = id;
+    m_iHeaderFlags = iHeaderFlag;
     m_bufInflate.clear();
     return processHeaderIn(id, iHeaderFlag);
 }
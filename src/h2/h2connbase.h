@@ -50,6 +50,7 @@ enum h2flag
     H2_CONN_FLAG_DIRECT_BUF     = (1<<12),
     H2_CONN_FLAG_AUTO_RECYCLE   = (1<<13),
     H2_CONN_FLAG_PENDING_STREAM = (1<<14),
+    H2_CONN_FLAG_CLIENT         = (1<<15),
 };
 
 inline enum h2flag operator|(enum h2flag a, enum h2flag b)
@@ -335,10 +336,12 @@ protected:
     int32_t         m_iServerMaxStreams;
     int32_t         m_iStreamOutInitWindowSize;
     int32_t         m_iMaxPushStreams;
+    int32_t         m_iPeerMaxStreams;
     int32_t         m_iPeerMaxFrameSize;
     uint32_t        m_uiPushStreamId;
 
     uint32_t        m_uiLastStreamId;
+    uint32_t        m_uiHeaderStreamId;
     uint32_t        m_uiStreams;
     uint32_t        m_uiRstStreams;
     H2StreamBase *  m_current;
@@ -360,6 +363,7 @@ protected:
     short           m_iControlFrames;
     char            m_inputState;
     uint8_t         m_padLen;
+    uint8_t         m_iHeaderFlags;
     H2FrameHeader   m_curH2Header;
 
 
@@ -0,0 +1,273 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2022  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+#include "compressoffload.h"
+
+#include <http/httpresp.h>
+#include <http/httpsession.h>
+#include <log4cxx/logger.h>
+#include <lsr/ls_atomic.h>
+#include <util/compressor.h>
+
+#include <string.h>
+
+#define COMPRESS_OFFLOAD_BATCH  (64 * 1024)
+
+static struct Offloader *s_pOffloader = NULL;
+
+int CompressOffload::s_iMinBodySize = 0;
+int CompressOffload::s_iWorkers = 2;
+
+struct ls_offload_api CompressOffload::s_api =
+{
+    CompressOffload::perform,
+    CompressOffload::releaseTask,
+    CompressOffload::onTaskDone
+};
+
+
+void CompressOffload::setOffloadParams(int minBodySize, int workers)
+{
+    s_iMinBodySize = minBodySize;
+    if (workers < 1)
+        workers = 1;
+    s_iWorkers = workers;
+    if (s_pOffloader)
+        offloader_set_max_workers(s_pOffloader, workers);
+}
+
+
+CompressOffload::CompressOffload(HttpSession *pSession,
+                                 Compressor *pCompressor)
+    : m_pSession(pSession)
+    , m_pCompressor(pCompressor)
+    , m_lRawIn(0)
+    , m_iOffloading(0)
+    , m_iInFlight(0)
+    , m_iFlushReq(0)
+    , m_iEndReq(0)
+    , m_iFlush(0)
+    , m_iEnd(0)
+    , m_iEnded(0)
+    , m_iError(0)
+    , m_iOwnCompressor(0)
+    , m_iBatchRet(0)
+{
+    memset(&m_task, 0, sizeof(m_task));
+    m_task.api = &s_api;
+    m_task.param_task_done = this;
+    m_task.ref_cnt = 1;
+}
+
+
+CompressOffload::~CompressOffload()
+{
+    if (m_iOwnCompressor)
+        delete m_pCompressor;
+}
+
+
+int CompressOffload::start(off_t contentLen)
+{
+    if (s_iMinBodySize > 0 && contentLen >= s_iMinBodySize)
+        return startOffload();
+    return LS_OK;
+}
+
+
+int CompressOffload::startOffload()
+{
+    if (!s_pOffloader)
+    {
+        s_pOffloader = offloader_new("COMPRESS", s_iWorkers);
+        if (!s_pOffloader)
+        {
+            LS_ERROR("[COMPRESS] Failed to start offloader, compress "
+                     "dynamic response inline.");
+            s_iMinBodySize = 0;
+            m_iOffloading = -1;
+            return LS_FAIL;
+        }
+    }
+    if (m_output.set(VMBUF_ANON_MAP, COMPRESS_OFFLOAD_BATCH) == LS_FAIL)
+    {
+        m_iOffloading = -1;
+        return LS_FAIL;
+    }
+    //The stream continues in the private buffer, the output produced so far
+    //is already in the response body buffer.
+    m_pCompressor->setCompressCache(&m_output);
+    m_pCompressor->resetCompressCache();
+    m_iOffloading = 1;
+    LS_DBG_M(m_pSession->getLogSession(),
+             "[COMPRESS] offload compression after %lld bytes.",
+             (long long)m_lRawIn);
+    return LS_OK;
+}
+
+
+int CompressOffload::write(const char *pBuf, int len)
+{
+    if (m_iError)
+        return LS_FAIL;
+    if (m_iOffloading <= 0)
+    {
+        m_lRawIn += len;
+        if (m_iOffloading < 0 || s_iMinBodySize <= 0
+            || m_lRawIn < s_iMinBodySize || startOffload() == LS_FAIL)
+            return m_pCompressor->write(pBuf, len);
+    }
+    if (m_pending.append(pBuf, len) == -1)
+        return LS_FAIL;
+    if (m_pending.size() >= COMPRESS_OFFLOAD_BATCH)
+        kick();
+    return len;
+}
+
+
+int CompressOffload::flush()
+{
+    if (m_iOffloading <= 0)
+        return m_pCompressor->flush();
+    m_iFlushReq = 1;
+    kick();
+    return m_iError ? LS_FAIL : LS_OK;
+}
+
+
+int CompressOffload::endStream()
+{
+    if (m_iOffloading <= 0)
+        return m_pCompressor->endStream();
+    if (!m_iEnded && !m_iError)
+    {
+        m_iEndReq = 1;
+        kick();
+    }
+    if (m_iError)
+        return LS_FAIL;
+    return m_iEnded ? LS_OK : LS_AGAIN;
+}
+
+
+int CompressOffload::detach()
+{
+    int inFlight = m_iInFlight;
+    m_pSession = NULL;
+    if (inFlight)
+    {
+        ls_atomic_set(&m_task.is_canceled, 1);
+        m_iOwnCompressor = 1;
+    }
+    releaseTask(&m_task);
+    return inFlight;
+}
+
+
+int CompressOffload::kick()
+{
+    if (m_iInFlight || m_iEnded || m_iError)
+        return LS_OK;
+    if (m_pending.size() == 0 && !m_iFlushReq && !m_iEndReq)
+        return LS_OK;
+    m_input.swap(m_pending);
+    m_iFlush = m_iFlushReq;
+    m_iEnd = m_iEndReq;
+    m_iFlushReq = 0;
+    m_iEndReq = 0;
+    m_iInFlight = 1;
+    m_pSession->setFlag2(HSF2_RESP_COMPRESSING);
+    if (offloader_enqueue(s_pOffloader, &m_task,
+                          (LogSession *)m_pSession) == LS_FAIL)
+    {
+        LS_DBG_M(m_pSession->getLogSession(),
+                 "[COMPRESS] enqueue failed, compress %d bytes in place.",
+                 m_input.size());
+        perform(&m_task);
+        onBatchDone(0);
+    }
+    return LS_OK;
+}
+
+
+int CompressOffload::perform(ls_offload *pTask)
+{
+    CompressOffload *pOffload = (CompressOffload *)pTask->param_task_done;
+    Compressor *pCompressor = pOffload->m_pCompressor;
+    int ret = LS_OK;
+    if (pOffload->m_input.size() > 0
+        && pCompressor->write(pOffload->m_input.begin(),
+                              pOffload->m_input.size()) == -1)
+        ret = LS_FAIL;
+    else if (pOffload->m_iEnd)
+    {
+        if (pCompressor->endStream() != 0)
+            ret = LS_FAIL;
+    }
+    else if (pOffload->m_iFlush && pCompressor->flush() == -1)
+        ret = LS_FAIL;
+    pOffload->m_iBatchRet = ret;
+    return ret;
+}
+
+
+void CompressOffload::releaseTask(ls_offload *pTask)
+{
+    if (--pTask->ref_cnt > 0)
+        return;
+    delete (CompressOffload *)pTask->param_task_done;
+}
+
+
+void CompressOffload::onTaskDone(void *param)
+{
+    ((CompressOffload *)param)->onBatchDone(1);
+}
+
+
+void CompressOffload::appendOutput()
+{
+    char *pBuf;
+    size_t size;
+    while ((pBuf = m_output.getReadBuffer(size)) != NULL && size > 0)
+    {
+        if (m_pSession->getResp()->appendDynBodyEx(pBuf, size) == -1)
+        {
+            m_iError = 1;
+            break;
+        }
+        m_output.readUsed(size);
+    }
+    m_pCompressor->resetCompressCache();
+}
+
+
+void CompressOffload::onBatchDone(int async)
+{
+    m_iInFlight = 0;
+    m_input.clear();
+    if (m_iBatchRet == LS_FAIL)
+        m_iError = 1;
+    else if (m_iEnd)
+        m_iEnded = 1;
+    appendOutput();
+    kick();
+    if (!m_iInFlight)
+        m_pSession->clearFlag2(HSF2_RESP_COMPRESSING);
+    if (async)
+        m_pSession->onCompressOffloaded();
+}
@@ -0,0 +1,106 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2022  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+#ifndef COMPRESSOFFLOAD_H
+#define COMPRESSOFFLOAD_H
+
+#include <lsdef.h>
+#include <lsr/ls_offload.h>
+#include <util/autobuf.h>
+#include <util/vmembuf.h>
+
+#include <sys/types.h>
+
+class Compressor;
+class HttpSession;
+
+/**
+ * CompressOffload moves the compression of a large dynamic response body
+ * from the event loop to the offloader threads. The body is compressed
+ * inline until it grows over the configured size, from then on the raw
+ * body is collected and handed to a worker in batches.
+ *
+ * Only one batch of a stream is in flight at a time. Body arriving while
+ * a batch is in flight goes with the next one, so the output stays in
+ * order. The event loop touches the compressor only while no batch is in
+ * flight, the output of a batch is appended to the response body buffer
+ * when the batch is done.
+ */
+class CompressOffload
+{
+public:
+    CompressOffload(HttpSession *pSession, Compressor *pCompressor);
+
+    static void setOffloadParams(int minBodySize, int workers);
+    static int  getMinBodySize()        {   return s_iMinBodySize;      }
+
+    // Offload from the first byte if the body is known to be large.
+    int  start(off_t contentLen);
+
+    int  write(const char *pBuf, int len);
+    int  flush();
+
+    // Return LS_AGAIN while the last batch is in flight.
+    int  endStream();
+
+    // Called by the session when it is done with the stream, return 1 if a
+    // batch is still in flight and the compressor goes with it.
+    int  detach();
+
+    int  isOffloading() const   {   return m_iOffloading > 0;   }
+    int  isInFlight() const     {   return m_iInFlight;         }
+    int  hasError() const       {   return m_iError;            }
+    int  getPending() const     {   return m_pending.size();    }
+
+private:
+    ~CompressOffload();
+
+    int  startOffload();
+    int  kick();
+    void appendOutput();
+    void onBatchDone(int async);
+
+    static int  perform(ls_offload *pTask);
+    static void releaseTask(ls_offload *pTask);
+    static void onTaskDone(void *param);
+
+    ls_offload      m_task;
+    HttpSession    *m_pSession;
+    Compressor     *m_pCompressor;
+    VMemBuf         m_output;
+    AutoBuf         m_pending;
+    AutoBuf         m_input;
+    off_t           m_lRawIn;
+    char            m_iOffloading;
+    char            m_iInFlight;
+    char            m_iFlushReq;
+    char            m_iEndReq;
+    char            m_iFlush;
+    char            m_iEnd;
+    char            m_iEnded;
+    char            m_iError;
+    char            m_iOwnCompressor;
+    int             m_iBatchRet;
+
+    static struct ls_offload_api s_api;
+    static int      s_iMinBodySize;
+    static int      s_iWorkers;
+
+    LS_NO_COPY_ASSIGN(CompressOffload);
+};
+
+#endif
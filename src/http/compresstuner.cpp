@@ -0,0 +1,269 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2022  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+#include "compresstuner.h"
+
+#include <http/httpserverconfig.h>
+#include <lsr/ls_strtool.h>
+#include <util/autobuf.h>
+
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+
+//CPU time of the event loop, the offloader threads are not part of it.
+static int64_t getLoopCpuUsec()
+{
+    struct rusage ru;
+    int who = RUSAGE_SELF;
+#ifdef RUSAGE_THREAD
+    who = RUSAGE_THREAD;
+#endif
+    if (getrusage(who, &ru) == -1)
+        return 0;
+    return ((int64_t)ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000
+           + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+
+CompressTuner::CompressTuner()
+    : m_iEnabled(0)
+    , m_iLowPct(50)
+    , m_iHighPct(85)
+    , m_iBusy(0)
+    , m_iCompressPct(0)
+    , m_iDownSecs(0)
+    , m_iUpSecs(0)
+    , m_iAction(CT_OFF)
+    , m_lUsec(0)
+    , m_lLastWall(0)
+    , m_lLastCpu(0)
+{
+    memset(m_level, 0, sizeof(m_level));
+    memset(m_lSavedPerCpuSec, 0, sizeof(m_lSavedPerCpuSec));
+    memset(m_lastStats, 0, sizeof(m_lastStats));
+    m_min[Compressor::STATS_GZIP] = 1;
+    m_max[Compressor::STATS_GZIP] = 9;
+    m_min[Compressor::STATS_ZSTD] = 1;
+    m_max[Compressor::STATS_ZSTD] = 19;
+}
+
+
+void CompressTuner::setBusyLimits(int iLowPct, int iHighPct)
+{
+    if (iHighPct > 100)
+        iHighPct = 100;
+    if (iLowPct > iHighPct)
+        iLowPct = iHighPct;
+    m_iLowPct = iLowPct;
+    m_iHighPct = iHighPct;
+}
+
+
+void CompressTuner::setLevelLimits(int slot, int iMin, int iMax)
+{
+    if (iMin < 1)
+        iMin = 1;
+    if (iMax < iMin)
+        iMax = iMin;
+    m_min[slot] = iMin;
+    m_max[slot] = iMax;
+    if (m_level[slot] <= 0)
+        return;
+    if (m_level[slot] < iMin)
+        m_level[slot] = iMin;
+    else if (m_level[slot] > iMax)
+        m_level[slot] = iMax;
+}
+
+
+void CompressTuner::account(int slot, int64_t in, int64_t out, int64_t usec)
+{
+    int64_t saved;
+    if (usec <= 0)
+        return;
+    m_lUsec += usec;
+    saved = (in - out) * 1000000 / usec;
+    if (m_lSavedPerCpuSec[slot] == 0)
+        m_lSavedPerCpuSec[slot] = saved;
+    else
+        m_lSavedPerCpuSec[slot] += (saved - m_lSavedPerCpuSec[slot]) / 4;
+}
+
+
+int CompressTuner::step(int delta)
+{
+    int changed = 0;
+    int level;
+    for (int i = 0; i < Compressor::STATS_COUNT; ++i)
+    {
+        if (m_level[i] <= 0)
+            continue;
+        level = m_level[i] + delta;
+        if (level < m_min[i] || level > m_max[i])
+            continue;
+        m_level[i] = level;
+        changed = 1;
+    }
+    return changed;
+}
+
+
+int CompressTuner::update(int iBusyPct, int64_t iWallUsec)
+{
+    int busy;
+
+    if (iWallUsec <= 0)
+        iWallUsec = 1000000;
+    m_iCompressPct = (m_lUsec * 100 + iWallUsec - 1) / iWallUsec;
+    if (m_iCompressPct > 100)
+        m_iCompressPct = 100;
+    m_lUsec = 0;
+    m_iBusy += ((iBusyPct << 8) - m_iBusy) / 4;
+    busy = m_iBusy >> 8;
+
+    if (!m_iEnabled)
+    {
+        m_iAction = CT_OFF;
+        return m_iAction;
+    }
+    m_iAction = CT_HOLD;
+    if ((busy > m_iHighPct) && (m_iCompressPct > 0))
+    {
+        m_iUpSecs = 0;
+        if (++m_iDownSecs >= COMPRESSTUNER_DOWN_SECS)
+        {
+            m_iDownSecs = 0;
+            if (step(-1))
+                m_iAction = CT_DOWN;
+        }
+    }
+    else if (busy + m_iCompressPct / 2 < m_iLowPct)
+    {
+        m_iDownSecs = 0;
+        if (++m_iUpSecs >= COMPRESSTUNER_UP_SECS)
+        {
+            m_iUpSecs = 0;
+            if (step(1))
+                m_iAction = CT_UP;
+        }
+    }
+    else
+    {
+        m_iDownSecs = 0;
+        m_iUpSecs = 0;
+    }
+    return m_iAction;
+}
+
+
+void CompressTuner::onTimer()
+{
+    CompressStats stats;
+    int64_t now = Compressor::getUsecNow();
+    int64_t cpu = getLoopCpuUsec();
+    int64_t wall = now - m_lLastWall;
+    int busy;
+
+    for (int i = 0; i < Compressor::STATS_COUNT; ++i)
+    {
+        Compressor::getStats(i, &stats);
+        if (m_lLastWall)
+            account(i, stats.m_lBytesIn - m_lastStats[i].m_lBytesIn,
+                    stats.m_lBytesOut - m_lastStats[i].m_lBytesOut,
+                    stats.m_lUsec - m_lastStats[i].m_lUsec);
+        m_lastStats[i] = stats;
+    }
+    if (m_lLastWall && wall > 0)
+    {
+        busy = (cpu - m_lLastCpu) * 100 / wall;
+        if (busy > 100)
+            busy = 100;
+        else if (busy < 0)
+            busy = 0;
+        update(busy, wall);
+        if (m_iEnabled)
+        {
+            //New streams pick up the level, the pooled buffers apply it
+            HttpServerConfig &config = HttpServerConfig::getInstance();
+            if (config.getCompressLevel() != m_level[Compressor::STATS_GZIP])
+                config.setCompressLevel(m_level[Compressor::STATS_GZIP]);
+            if (config.getZstdCompress() > 0
+                && m_level[Compressor::STATS_ZSTD] > 0)
+                config.setZstdCompress(m_level[Compressor::STATS_ZSTD]);
+        }
+    }
+    m_lLastWall = now;
+    m_lLastCpu = cpu;
+}
+
+
+const char *CompressTuner::getActionName(int action)
+{
+    static const char *s_pNames[] =
+    {   "off", "hold", "down", "up"   };
+    if (action < 0 || action > CT_UP)
+        return "unknown";
+    return s_pNames[action];
+}
+
+
+int CompressTuner::generateRTReport(int fd) const
+{
+    char achBuf[512];
+    int n = ls_snprintf(achBuf, sizeof(achBuf),
+                        "COMPRESS_TUNE: BUSY: %d, COMPRESS_CPU: %d, "
+                        "GZIP_LEVEL: %d, GZIP_SAVED_PER_CPU_SEC: %lld, "
+                        "ZSTD_LEVEL: %d, ZSTD_SAVED_PER_CPU_SEC: %lld, "
+                        "ACTION: %s\n",
+                        getBusyPct(), m_iCompressPct,
+                        m_level[Compressor::STATS_GZIP],
+                        (long long)m_lSavedPerCpuSec[Compressor::STATS_GZIP],
+                        m_level[Compressor::STATS_ZSTD],
+                        (long long)m_lSavedPerCpuSec[Compressor::STATS_ZSTD],
+                        getActionName(m_iAction));
+    write(fd, achBuf, n);
+    return 0;
+}
+
+
+int CompressTuner::generateRTJsonReport(AutoBuf *pBuf) const
+{
+    if (pBuf->guarantee(512))
+        return -1;
+    int n = ls_snprintf(pBuf->end(), 512,
+                        ",\n"
+                        "  \"compress_tune\":\n"
+                        "  {\n"
+                        "    \"busy\": %d,\n"
+                        "    \"compress_cpu\": %d,\n"
+                        "    \"gzip_level\": %d,\n"
+                        "    \"gzip_saved_per_cpu_sec\": %lld,\n"
+                        "    \"zstd_level\": %d,\n"
+                        "    \"zstd_saved_per_cpu_sec\": %lld,\n"
+                        "    \"action\": \"%s\"\n"
+                        "  }",
+                        getBusyPct(), m_iCompressPct,
+                        m_level[Compressor::STATS_GZIP],
+                        (long long)m_lSavedPerCpuSec[Compressor::STATS_GZIP],
+                        m_level[Compressor::STATS_ZSTD],
+                        (long long)m_lSavedPerCpuSec[Compressor::STATS_ZSTD],
+                        getActionName(m_iAction));
+    pBuf->used(n);
+    return 0;
+}
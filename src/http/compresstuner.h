@@ -0,0 +1,113 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2022  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+#ifndef COMPRESSTUNER_H
+#define COMPRESSTUNER_H
+
+#include <lsdef.h>
+#include <util/compressor.h>
+
+#include <inttypes.h>
+
+//Seconds over the high mark before the levels go down.
+#define COMPRESSTUNER_DOWN_SECS     3
+//Seconds under the low mark before the levels go up.
+#define COMPRESSTUNER_UP_SECS       10
+
+class AutoBuf;
+
+/**
+ * CompressTuner adjusts the dynamic gzip and zstd compression levels of a
+ * worker to its CPU headroom. It is fed once a second with the event loop
+ * utilization and the compression work of the last second, measured by the
+ * compressors.
+ *
+ * Utilization is smoothed over about 4 seconds. The levels go down by one
+ * after COMPRESSTUNER_DOWN_SECS seconds over the high mark while there is
+ * compression to save, and up by one after COMPRESSTUNER_UP_SECS seconds
+ * under the low mark, leaving room for the compression time to grow by
+ * half at the next level. The count starts over after every change.
+ */
+class CompressTuner
+{
+public:
+    enum
+    {
+        CT_OFF,
+        CT_HOLD,
+        CT_DOWN,
+        CT_UP,
+    };
+
+    CompressTuner();
+
+    void setEnabled(int enabled)        {   m_iEnabled = enabled;   }
+    int  isEnabled() const              {   return m_iEnabled;      }
+    void setBusyLimits(int iLowPct, int iHighPct);
+
+    // Set the current level of a method, 0 if it is disabled, before its
+    // limits.
+    void setLevel(int slot, int level)  {   m_level[slot] = level;  }
+    void setLevelLimits(int slot, int iMin, int iMax);
+
+    // Add the compression work of a method done in the last second.
+    void account(int slot, int64_t in, int64_t out, int64_t usec);
+
+    // Feed the event loop utilization of the last iWallUsec, return the
+    // action taken.
+    int  update(int iBusyPct, int64_t iWallUsec);
+
+    // Sample the worker once a second and apply the levels to the server
+    // config when enabled.
+    void onTimer();
+
+    int  getLevel(int slot) const       {   return m_level[slot];   }
+    int  getBusyPct() const             {   return m_iBusy >> 8;    }
+    int  getCompressPct() const         {   return m_iCompressPct;  }
+    int64_t getSavedPerCpuSec(int slot) const
+    {   return m_lSavedPerCpuSec[slot];     }
+    int  getAction() const              {   return m_iAction;       }
+    static const char *getActionName(int action);
+
+    int  generateRTReport(int fd) const;
+    int  generateRTJsonReport(AutoBuf *pBuf) const;
+
+private:
+    int  step(int delta);
+
+    int     m_iEnabled;
+    int     m_iLowPct;
+    int     m_iHighPct;
+    int     m_iBusy;            // busy percentage << 8
+    int     m_iCompressPct;
+    int     m_iDownSecs;
+    int     m_iUpSecs;
+    int     m_iAction;
+    int     m_level[Compressor::STATS_COUNT];
+    int     m_min[Compressor::STATS_COUNT];
+    int     m_max[Compressor::STATS_COUNT];
+    int64_t m_lUsec;
+    int64_t m_lSavedPerCpuSec[Compressor::STATS_COUNT];
+
+    int64_t m_lLastWall;
+    int64_t m_lLastCpu;
+    CompressStats   m_lastStats[Compressor::STATS_COUNT];
+
+    LS_NO_COPY_ASSIGN(CompressTuner);
+};
+
+#endif
@@ -135,6 +135,9 @@ int HioChainStream::shutdown()
         return 0;
 
     setState(HIOS_SHUTDOWN);
+    //Nobody else owns a detached sub session
+    if (getFlag(HIO_FLAG_BLACK_HOLE) && !m_pParentSession && getHandler())
+        ((HttpSession *)getHandler())->releaseDetached();
     return 0;
 }
 
@@ -203,6 +203,8 @@ int HttpCgiTool::processHeaderLine2(HttpExtConnector *pExtConn,
             pReq->orGzip(UPSTREAM_GZIP);
         else if (strncasecmp(pValue, "deflate", 7) == 0)
             pReq->orGzip(UPSTREAM_DEFLATE);
+        else if (strncasecmp(pValue, "zstd", 4) == 0)
+            pReq->orZstd(UPSTREAM_ZSTD);
 //             if ( !(pReq->gzipAcceptable() & REQ_GZIP_ACCEPT) )
 //                 return 0;
 //         }
@@ -62,6 +62,8 @@ HttpExtConnector::~HttpExtConnector()
 int HttpExtConnector::cleanUp(HttpSession *pSession)
 {
     LS_DBG_M(this, "HttpExtConnector::cleanUp() ...");
+    if (getLB())
+        getLB()->onReqDone(this, 0);
     //if ( !(getState() & (HEC_ABORT_REQUEST|HEC_ERROR|HEC_COMPLETE)) )
     if (!(getState() & (HEC_COMPLETE)))
     {
@@ -181,6 +183,8 @@ int HttpExtConnector::parseHeader(const char *&pBuf, int &len, int proxy)
 
 int  HttpExtConnector::respHeaderDone()
 {
+    if (getLB())
+        getLB()->onRespHeader(this);
     m_pSession->testContentType();
     int ret = m_pSession->respHeaderDone();
     if (m_iRespState & HEC_RESP_AUTHORIZED)
@@ -387,6 +391,8 @@ int HttpExtConnector::endResponse(int endCode, int protocolStatus)
     if (!(m_iState & (HEC_ABORT_REQUEST | HEC_ERROR)) && !endCode
         && getWorker())
         getWorker()->getReqStats()->incReqProcessed();
+    if (getLB())
+        getLB()->onReqDone(this, (m_iState & HEC_ERROR) != 0);
     releaseProcessor();
     if (m_iRespState & HEC_RESP_AUTHORIZED)
     {
@@ -1198,6 +1198,12 @@ int HttpReq::processHeader(int index)
             if (strcasestr(pCur, "br") != NULL)
                 m_iAcceptBr = REQ_BR_ACCEPT |
                 (HttpServerConfig::getInstance().getBrCompress() ? BR_ENABLED : 0);
+            if (len >= 4 && strcasestr(pCur, "zstd") != NULL)
+                m_iAcceptZstd = REQ_ZSTD_ACCEPT |
+                (HttpServerConfig::getInstance().getZstdCompress() ? ZSTD_ENABLED : 0);
+            if (len >= 3 && strcasestr(pCur, "dcz") != NULL)
+                m_iAcceptDcz = REQ_DCZ_ACCEPT |
+                (HttpServerConfig::getInstance().getZstdCompress() ? DCZ_ENABLED : 0);
             *((char *)pBEnd) = ch;
         }
         break;
@@ -1425,6 +1431,12 @@ int HttpReq::processNewReqData(const struct sockaddr *pAddr)
 
     if (!m_pVHost->enableBr())
         andBr(~BR_ENABLED);
+
+    if (!m_pVHost->enableZstd())
+    {
+        andZstd(~ZSTD_ENABLED);
+        andDcz(~DCZ_ENABLED);
+    }
     AccessCache *pAccessCache = m_pVHost->getAccessCache();
     if (pAccessCache)
     {
@@ -66,6 +66,7 @@ enum
 #define CACHE_KEY               (1<<17)
 #define CACHE_PRIVATE_KEY       (1<<18)
 #define AP_USER_DIR             (1<<19)
+#define EARLY_DATA              (1<<20)
 #define LOG_ACCESS_404          (1<<21)
 #define RESP_CONT_LEN_SET       (1<<22)
 
@@ -114,10 +115,23 @@ enum
 #define BR_REQUIRED             (BR_ENABLED | REQ_BR_ACCEPT)
 #define UPSTREAM_BR             4
 
+#define ZSTD_ENABLED            1
+#define REQ_ZSTD_ACCEPT         2
+#define ZSTD_REQUIRED           (ZSTD_ENABLED | REQ_ZSTD_ACCEPT)
+#define UPSTREAM_ZSTD           4
+
+#define DCZ_ENABLED             1
+#define REQ_DCZ_ACCEPT          2
+#define DCZ_REQUIRED            (DCZ_ENABLED | REQ_DCZ_ACCEPT)
+
 
 #define SUB_REQ_DETACHED        1
 #define SUB_REQ_NOABORT         2
 #define SUB_REQ_SETREFERER      4
+#define SUB_REQ_SETHEADERS      LSI_SUBREQ_SET_HEADERS
+#define SUB_REQ_SETENV          LSI_SUBREQ_SET_ENV
+#define SUB_REQ_SEED            32
+#define SUB_REQ_KEEPCRED        LSI_SUBREQ_KEEP_CREDENTIALS
 
 
 struct AAAData;
@@ -263,6 +277,8 @@ private:
     uint16_t            m_iReqFlag;
     char                m_iAcceptGzip;
     char                m_iAcceptBr;
+    char                m_iAcceptZstd;
+    char                m_iAcceptDcz;
 
     off_t               m_lEntityLength;
     off_t               m_lEntityFinished;
@@ -499,6 +515,7 @@ public:
     }
 
     int dropReqHeader(int index);
+    void dropCredentials();
 
     const char *getHostStr()
     {   return m_headerBuf.getp(m_iHostOff);    }
@@ -630,6 +647,12 @@ public:
     void andBr(char b)                      {   m_iAcceptBr &= b;         }
     void orBr(char b)                       {   m_iAcceptBr |= b;         }
 
+    char zstdAcceptable() const             {   return m_iAcceptZstd;     }
+    void andZstd(char b)                    {   m_iAcceptZstd &= b;       }
+    void orZstd(char b)                     {   m_iAcceptZstd |= b;       }
+    char dczAcceptable() const              {   return m_iAcceptDcz;      }
+    void andDcz(char b)                     {   m_iAcceptDcz &= b;        }
+
     int  noRespBody() const            {   return m_iContextState & NO_RESP_BODY;   }
     void setNoRespBody()               {   m_iContextState |= NO_RESP_BODY;      }
     void updateNoRespBodyByStatus(int code)
@@ -894,6 +917,7 @@ public:
     void setNewOrgUrl(const char *pUrl, int len, const char *pQS, int qsLen);
     int cloneReqBody(const char *pBuf, int32_t len);
     int clone(HttpReq *getReq, struct lsi_subreq_s *pSubSessInfo);
+    void cloneMinHeaders(HttpReq *pProto);
     void addContentLenHeader(size_t len);
     void updateReqHeader(int index, const char *pNewValue, int newValueLen);
     void setReferer(const char *getOrgReqURL, int getOrgReqURLLen);
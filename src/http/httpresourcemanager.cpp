@@ -26,6 +26,7 @@
 #include <lsiapi/modulemanager.h>
 #include <util/vmembuf.h>
 #include <util/gzipbuf.h>
+#include <util/zstdbuf.h>
 
 
 char HttpResourceManager::g_aBuf[GLOBAL_BUF_SIZE + 8];
@@ -38,6 +39,9 @@ HttpResourceManager::HttpResourceManager()
     , m_poolChunkOutputStream(10, 10)
     , m_poolVMemBuf(0, 10)
     , m_poolGzipBuf(0, 10)
+#ifdef USE_ZSTD
+    , m_poolZstdBuf(0, 10)
+#endif
     , m_poolHttpSession(20, 20)
     , m_poolNtwkIoLink(20, 20)
 #ifndef NO_SENDFILE
@@ -69,6 +73,9 @@ void HttpResourceManager::releaseAll()
     m_poolChunkOutputStream.shrinkTo(0);
     m_poolVMemBuf.shrinkTo(0);
     m_poolGzipBuf.shrinkTo(0);
+#ifdef USE_ZSTD
+    m_poolZstdBuf.shrinkTo(0);
+#endif
     m_poolHttpSession.shrinkTo(0);
     m_poolNtwkIoLink.shrinkTo(0);
     if (m_pPoolAiosfcb != NULL)
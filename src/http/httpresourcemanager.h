@@ -31,6 +31,7 @@ class ChunkOutputStream;
 class MMapVMemBuf;
 class VMemBuf;
 class GzipBuf;
+class ZstdBuf;
 class HttpSession;
 class NtwkIOLink;
 
@@ -39,6 +40,9 @@ typedef ObjPool<ChunkOutputStream>      ChunkOutputStreamPool;
 typedef ObjPool<MMapVMemBuf>            VMemBufPool;
 typedef ObjPool<GzipBuf>                GzipBufPool;
 typedef ObjPool<GzipBuf>                GunzipBufPool;
+#ifdef USE_ZSTD
+typedef ObjPool<ZstdBuf>                ZstdBufPool;
+#endif
 typedef ObjPool<HttpSession>            HttpSessionPool;
 typedef ObjPool<NtwkIOLink>             NtwkIoLinkPool;
 typedef ObjPool<Aiosfcb>                AiosfcbPool;
@@ -55,6 +59,9 @@ class HttpResourceManager : public TSingleton<HttpResourceManager>
     VMemBufPool             m_poolVMemBuf;
     GzipBufPool             m_poolGzipBuf;
     GunzipBufPool           m_poolGunzipBuf;
+#ifdef USE_ZSTD
+    ZstdBufPool             m_poolZstdBuf;
+#endif
     HttpSessionPool         m_poolHttpSession;
     NtwkIoLinkPool          m_poolNtwkIoLink;
     AiosfcbPool            *m_pPoolAiosfcb;
@@ -75,6 +82,13 @@ public:
     void recycleGunzip(GzipBuf *pBuf)
     {   m_poolGunzipBuf.recycle(pBuf);      }
 
+#ifdef USE_ZSTD
+    ZstdBuf *getZstdBuf()
+    {   return m_poolZstdBuf.get();         }
+    void recycle(ZstdBuf *pBuf)
+    {   m_poolZstdBuf.recycle(pBuf);      }
+#endif
+
     MMapVMemBuf *getVMemBuf();
     //{   return m_poolVMemBuf.get();         }
 
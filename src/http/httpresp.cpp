@@ -17,6 +17,7 @@
 *****************************************************************************/
 #include "httpresp.h"
 
+#include <http/compressoffload.h>
 #include <http/expiresctrl.h>
 
 // #include <http/httpheader.h> //setheader commented out.
@@ -34,6 +35,8 @@ HttpResp::HttpResp(ls_xpool_t *pool)
     : m_respHeaders()
     , m_pRespBodyBuf(NULL)
     , m_pGzipBuf(NULL)
+    , m_pCompressOffload(NULL)
+    , m_iCompressMethod(LSI_NO_COMPRESS)
 {
     m_lEntityLength = 0;
     m_lEntityFinished = 0;
@@ -67,7 +70,9 @@ void HttpResp::resetRespBody()
 
 void HttpResp::rewindRespBodyBuf()
 {
-    if (m_pGzipBuf)
+    //An offloaded stream writes to its own buffer, not the response body
+    if (m_pGzipBuf
+        && !(m_pCompressOffload && m_pCompressOffload->isOffloading()))
         m_pGzipBuf->resetCompressCache();
     else
         rewindRespBodyBuf2();
@@ -241,7 +246,9 @@ int HttpResp::appendDynBody(VMemBuf *pvBuf, int offset, int len)
 int HttpResp::appendDynBody(const char *pBuf, int len)
 {
     int ret = 0;
-    if ((getGzipBuf()) && (getGzipBuf()->getType() == GzipBuf::COMPRESSOR_COMPRESS))
+    if (m_pCompressOffload)
+        ret = m_pCompressOffload->write(pBuf, len);
+    else if ((getGzipBuf()) && (getGzipBuf()->getType() == GzipBuf::COMPRESSOR_COMPRESS))
     {
         ret = getGzipBuf()->write(pBuf, len);
     }
@@ -24,7 +24,8 @@
 #define RANGE_HEADER_LEN    22
 
 class AutoStr2;
-class GzipBuf;
+class CompressOffload;
+class Compressor;
 class ExpiresCtrl;
 class HttpReq;
 class VMemBuf;
@@ -41,7 +42,9 @@ private:
     off_t           m_lEntityFinished;
 
     VMemBuf        *m_pRespBodyBuf;
-    GzipBuf        *m_pGzipBuf;
+    Compressor     *m_pGzipBuf;
+    CompressOffload *m_pCompressOffload;
+    int             m_iCompressMethod;
 
     HttpResp(const HttpResp &rhs);
     void operator=(const HttpResp &rhs);
@@ -82,8 +85,17 @@ public:
     void resetRespBody();
     void rewindRespBodyBuf();
 
-    GzipBuf *getGzipBuf() const            {   return m_pGzipBuf;      }
-    void setGzipBuf(GzipBuf *pGzip)      {   m_pGzipBuf = pGzip;     }
+    // The compressor of the dynamic response body, a GzipBuf unless the
+    // method is LSI_ZSTD_COMPRESS.
+    Compressor *getGzipBuf() const         {   return m_pGzipBuf;      }
+    int getCompressMethod() const           {   return m_iCompressMethod;   }
+    void setGzipBuf(Compressor *pGzip, int method = LSI_GZIP_COMPRESS)
+    {   m_pGzipBuf = pGzip; m_iCompressMethod = method;     }
+
+    CompressOffload *getCompressOffload() const
+    {   return m_pCompressOffload;  }
+    void setCompressOffload(CompressOffload *p)
+    {   m_pCompressOffload = p;     }
 
     HttpRespHeaders &getRespHeaders()
     {   return m_respHeaders;  }
@@ -111,6 +123,16 @@ public:
         m_respHeaders.addBrEncodingHeader();
     }
 
+    void addZstdEncodingHeader()
+    {
+        m_respHeaders.addZstdEncodingHeader();
+    }
+
+    void addDczEncodingHeader(const unsigned char *pDictHash)
+    {
+        m_respHeaders.addDczEncodingHeader(pDictHash);
+    }
+
     void appendChunked()
     {
         m_respHeaders.appendChunked();
@@ -56,6 +56,10 @@ static char s_sGzipEncodingHeader[48] =
     "content-encoding: gzip\r\nvary: Accept-Encoding\r\n";
 static char s_sBrEncodingHeader[46] =
     "content-encoding: br\r\nvary: Accept-Encoding\r\n";
+static char s_sZstdEncodingHeader[48] =
+    "content-encoding: zstd\r\nvary: Accept-Encoding\r\n";
+static char s_sDczEncodingHeader[72] =
+    "content-encoding: dcz\r\nvary: Accept-Encoding, Available-Dictionary\r\n";
 static char s_sCommonHeaders[66] =
     "date: Tue, 09 Jul 2013 13:43:01 GMT\r\nserver";
 static char s_sTurboCharged[66] =
@@ -65,6 +69,8 @@ static int             s_commonHeadersCount = 2;
 static http_header_t   s_commonHeaders[2];
 static http_header_t   s_gzipHeaders[2];
 static http_header_t   s_brHeaders[2];
+static http_header_t   s_zstdHeaders[2];
+static http_header_t   s_dczHeaders[2];
 static http_header_t   s_keepaliveHeader[2];
 static http_header_t   s_chunkedHeader;
 static http_header_t   s_concloseHeader;
@@ -208,6 +214,38 @@ void HttpRespHeaders::addBrEncodingHeader()
 }
 
 
+void HttpRespHeaders::addZstdEncodingHeader()
+{
+    add(s_zstdHeaders, 2, LSI_HEADER_MERGE);
+    updateEtag(ETAG_ZSTD);
+}
+
+
+/**
+ * A delta is only good for the dictionary it was built against, the ETag
+ * carries the start of the dictionary hash.
+ */
+void HttpRespHeaders::addDczEncodingHeader(const unsigned char *pDictHash)
+{
+    char achETag[256];
+    int etagLen;
+    add(s_dczHeaders, 2, LSI_HEADER_MERGE);
+    updateEtag(ETAG_DCZ);
+    const char *pETag = getHeaderToUpdate(H_ETAG, &etagLen);
+    if (!pETag || etagLen < 2 || etagLen > (int)sizeof(achETag) - 20)
+        return;
+    int len = etagLen;
+    if (pETag[len - 1] == '"')
+        --len;
+    memcpy(achETag, pETag, len);
+    achETag[len++] = '-';
+    len += StringTool::hexEncode((const char *)pDictHash, 8, achETag + len);
+    if (pETag[etagLen - 1] == '"')
+        achETag[len++] = '"';
+    add(H_ETAG, "ETag", 4, achETag, len, LSI_HEADER_SET);
+}
+
+
 void HttpRespHeaders::updateEtag(ETAG_ENCODING type)
 {
     int etagLen;
@@ -235,6 +273,14 @@ void HttpRespHeaders::updateEtag(ETAG_ENCODING type)
             *pUpdate++ = 'b';
             *pUpdate++ = 'r';
             break;
+        case ETAG_ZSTD:
+            *pUpdate++ = 'z';
+            *pUpdate++ = 's';
+            break;
+        case ETAG_DCZ:
+            *pUpdate++ = 'd';
+            *pUpdate++ = 'z';
+            break;
         }
     }
 }
@@ -1303,6 +1349,30 @@ void HttpRespHeaders::buildCommonHeaders()
     s_brHeaders[1].val      = s_sBrEncodingHeader + 28;
     s_brHeaders[1].valLen   = 15;
 
+    s_zstdHeaders[0].index    = HttpRespHeaders::H_CONTENT_ENCODING;
+    s_zstdHeaders[0].name     = s_sZstdEncodingHeader;
+    s_zstdHeaders[0].nameLen  = 16;
+    s_zstdHeaders[0].val      = s_sZstdEncodingHeader + 18;
+    s_zstdHeaders[0].valLen   = 4;
+
+    s_zstdHeaders[1].index    = HttpRespHeaders::H_VARY;
+    s_zstdHeaders[1].name     = s_sZstdEncodingHeader + 24;
+    s_zstdHeaders[1].nameLen  = 4;
+    s_zstdHeaders[1].val      = s_sZstdEncodingHeader + 30;
+    s_zstdHeaders[1].valLen   = 15;
+
+    s_dczHeaders[0].index    = HttpRespHeaders::H_CONTENT_ENCODING;
+    s_dczHeaders[0].name     = s_sDczEncodingHeader;
+    s_dczHeaders[0].nameLen  = 16;
+    s_dczHeaders[0].val      = s_sDczEncodingHeader + 18;
+    s_dczHeaders[0].valLen   = 3;
+
+    s_dczHeaders[1].index    = HttpRespHeaders::H_VARY;
+    s_dczHeaders[1].name     = s_sDczEncodingHeader + 23;
+    s_dczHeaders[1].nameLen  = 4;
+    s_dczHeaders[1].val      = s_sDczEncodingHeader + 29;
+    s_dczHeaders[1].valLen   = 37;
+
     s_keepaliveHeader[0].index    = HttpRespHeaders::H_CONNECTION;
     s_keepaliveHeader[0].name     = s_sConnKeepAliveHeader;
     s_keepaliveHeader[0].nameLen  = 10;
@@ -33,6 +33,8 @@ enum ETAG_ENCODING
     ETAG_NO_ENCODE,
     ETAG_BROTLI,
     ETAG_GZIP,
+    ETAG_ZSTD,
+    ETAG_DCZ,
 };
 
 
@@ -206,6 +208,8 @@ public:
 
     void addGzipEncodingHeader();
     void addBrEncodingHeader();
+    void addZstdEncodingHeader();
+    void addDczEncodingHeader(const unsigned char *pDictHash);
     void updateEtag(ETAG_ENCODING type);
     void appendChunked();
     void addCommonHeaders();
@@ -43,6 +43,7 @@ HttpServerConfig::HttpServerConfig()
     , m_iDynGzipCompress(0)
     , m_iCompressLevel(4)
     , m_iBrCompress(0)
+    , m_iZstdCompress(0)
     , m_iEnableLve(0)
     , m_iUsePagespeed(0)
     , m_cooldown(0)
@@ -71,6 +71,7 @@ private:
     int8_t          m_iDynGzipCompress;
     int8_t          m_iCompressLevel;
     int8_t          m_iBrCompress;
+    int8_t          m_iZstdCompress;
     int8_t          m_iEnableLve;
     int8_t          m_iUsePagespeed;
     int8_t          m_cooldown;
@@ -170,6 +171,11 @@ public:
     {   m_iBrCompress = compress;     }
     int8_t  getBrCompress() const           {   return m_iBrCompress;       }
 
+    // Level of dynamic zstd compression, 0 to disable zstd.
+    void setZstdCompress(int32_t compress)
+    {   m_iZstdCompress = compress;   }
+    int8_t  getZstdCompress() const         {   return m_iZstdCompress;     }
+
     void setDebugLevel(int32_t level);
 
     void setUsePagespeed(int n)                  {   m_iUsePagespeed = n;      }
@@ -27,6 +27,7 @@
 #include <http/chunkinputstream.h>
 #include <http/chunkoutputstream.h>
 #include <http/clientcache.h>
+#include <http/compressoffload.h>
 #include <http/connlimitctrl.h>
 #include <http/handlerfactory.h>
 #include <http/handlertype.h>
@@ -75,6 +76,7 @@
 #include <util/accessdef.h>
 #include <util/datetime.h>
 #include <util/gzipbuf.h>
+#include <util/zstdbuf.h>
 #include <util/httputil.h>
 #include <util/vmembuf.h>
 #include <util/blockbuf.h>
@@ -1518,6 +1520,21 @@ int HttpSession::processNewReqInit()
             return SC_403;
         }
     }
+    if (getCrypto() && getCrypto()->isEarlyData())
+    {
+        //Only replay safe requests are served before handshake completes
+        int method = m_request.getMethod();
+        if ((method != HttpMethod::HTTP_GET && method != HttpMethod::HTTP_HEAD
+             && method != HttpMethod::HTTP_OPTIONS)
+            || m_request.getContentLength() != 0)
+        {
+            LS_DBG_L(getLogSession(), "Request received in TLS early data "
+                     "is not idempotent, respond with 425.");
+            return SC_425;
+        }
+        m_request.orContextState(EARLY_DATA);
+        m_request.addEnv("HTTP_EARLY_DATA", 15, "1", 1);
+    }
     getStream()->setLogger(pVHost->getLogger());
     setLogger(pVHost->getLogger());
     if (getStream()->isLogIdBuilt())
@@ -2721,7 +2738,10 @@ int HttpSession::assignHandler(const HttpHandler *pHandler)
                 lockAddOrReplaceFrom(':', pType);
             }
             if (!HttpServerConfig::getInstance().getDynGzipCompress())
+            {
                 m_request.andGzip(~GZIP_ENABLED);
+                m_request.andZstd(~ZSTD_ENABLED);
+            }
             //m_response.reset();
             break;
         }
@@ -3061,7 +3081,7 @@ int HttpSession::doWrite()
     else
         suspendWrite();
 
-    if (ret == 0 &&
+    if (ret == 0 && !getFlag2(HSF2_RESP_COMPRESSING) &&
         ((testFlag(HSF_HANDLER_DONE |
                    HSF_RECV_RESP_BUFFERED |
                    HSF_SEND_RESP_BUFFERED)) == HSF_HANDLER_DONE))
@@ -3923,6 +3943,7 @@ int HttpSession::setupGzipFilter()
         return 0;
 
     char gz = m_request.gzipAcceptable();
+    char zstd = m_request.zstdAcceptable();
     int recvhkptNogzip = m_sessionHooks.getFlag(LSI_HKPT_RECV_RESP_BODY) &
                          LSI_FLAG_DECOMPRESS_REQUIRED;
     int  hkptNogzip = (m_sessionHooks.getFlag(LSI_HKPT_RECV_RESP_BODY)
@@ -3944,8 +3965,13 @@ int HttpSession::setupGzipFilter()
     }
     else
         clearFlag(HSF_RESP_BODY_GZIPCOMPRESSED);
+    if (zstd & UPSTREAM_ZSTD)
+        setFlag2(HSF2_RESP_BODY_ZSTDCOMPRESSED);
+    else
+        clearFlag2(HSF2_RESP_BODY_ZSTDCOMPRESSED);
 
-    if (gz == GZIP_REQUIRED)
+    if (!(zstd & UPSTREAM_ZSTD)
+        && (gz == GZIP_REQUIRED || zstd == ZSTD_REQUIRED))
     {
         if (!hkptNogzip)
         {
@@ -3962,7 +3988,7 @@ int HttpSession::setupGzipFilter()
                     return LS_FAIL;
             }
         }
-        else //turn on compression at SEND_RESP_BODY filter
+        else if (gz == GZIP_REQUIRED) //turn on compression at SEND_RESP_BODY filter
         {
             if (addModgzipFilter(1, HttpServerConfig::getInstance().getCompressLevel()) == -1)
                 return LS_FAIL;
@@ -3980,6 +4006,7 @@ int HttpSession::setupGzipBuf()
     if (getRespBodyBuf())
     {
         LS_DBG_L(getLogSession(), "GZIP the response body in the buffer.");
+        releaseCompressOffload();
         if (getGzipBuf())
         {
             if (getGzipBuf()->isStreamStarted())
@@ -3989,28 +4016,65 @@ int HttpSession::setupGzipBuf()
             }
         }
 
+        int method = LSI_GZIP_COMPRESS;
+        int level = HttpServerConfig::getInstance().getCompressLevel();
+#ifdef USE_ZSTD
+        //zstd is preferred, it is much cheaper than gzip at a similar ratio
+        if (m_request.zstdAcceptable() == ZSTD_REQUIRED
+            && !(m_request.gzipAcceptable() & (UPSTREAM_GZIP | UPSTREAM_DEFLATE)))
+        {
+            method = LSI_ZSTD_COMPRESS;
+            level = HttpServerConfig::getInstance().getZstdCompress();
+        }
+        if (getGzipBuf() && getResp()->getCompressMethod() != method)
+            releaseGzipBuf();
+        if (!getGzipBuf() && method == LSI_ZSTD_COMPRESS)
+            setGzipBuf(HttpResourceManager::getInstance().getZstdBuf(),
+                       LSI_ZSTD_COMPRESS);
+#endif
         if (!getGzipBuf())
             setGzipBuf(HttpResourceManager::getInstance().getGzipBuf());
         if (getGzipBuf())
         {
             getGzipBuf()->setCompressCache(getRespBodyBuf());
-            if ((getGzipBuf()->init(GzipBuf::COMPRESSOR_COMPRESS,
-                                  HttpServerConfig::getInstance().getCompressLevel()) == 0) &&
+            if ((getGzipBuf()->init(Compressor::COMPRESSOR_COMPRESS,
+                                    level) == 0) &&
                 (getGzipBuf()->beginStream() == 0))
             {
-                LS_DBG_M(getLogSession(), "setupGzipBuf() begin GZIP stream.\n");
+                LS_DBG_M(getLogSession(), "setupGzipBuf() begin %s stream.\n",
+                         method == LSI_ZSTD_COMPRESS ? "ZSTD" : "GZIP");
+                if (CompressOffload::getMinBodySize() > 0
+                    && m_pHandler && m_pHandler->getType() >= HandlerType::HT_DYNAMIC
+                    && !getMtFlag(HSF_MT_HANDLER)
+                    && !(m_iFlag & HSF_SUB_SESSION) && !getSsiRuntime())
+                {
+                    m_pCompressOffload = new CompressOffload(this, getGzipBuf());
+                    m_response.setCompressOffload(m_pCompressOffload);
+                    m_pCompressOffload->start(m_response.getContentLen());
+                }
                 m_response.setContentLen(LSI_BODY_SIZE_UNKNOWN);
-                m_response.addGzipEncodingHeader();
-                m_request.orGzip(UPSTREAM_GZIP);
-                setFlag(HSF_RESP_BODY_GZIPCOMPRESSED);
+                if (method == LSI_ZSTD_COMPRESS)
+                {
+                    m_response.addZstdEncodingHeader();
+                    m_request.orZstd(UPSTREAM_ZSTD);
+                    setFlag2(HSF2_RESP_BODY_ZSTDCOMPRESSED);
+                }
+                else
+                {
+                    m_response.addGzipEncodingHeader();
+                    m_request.orGzip(UPSTREAM_GZIP);
+                    setFlag(HSF_RESP_BODY_GZIPCOMPRESSED);
+                }
                 return 0;
             }
             else
             {
                 LS_ERROR(getLogSession(), "Ran out of swapping space while "
-                         "initializing GZIP stream!");
+                         "initializing %s stream!",
+                         method == LSI_ZSTD_COMPRESS ? "ZSTD" : "GZIP");
                 delete getGzipBuf();
                 clearFlag(HSF_RESP_BODY_GZIPCOMPRESSED);
+                clearFlag2(HSF2_RESP_BODY_ZSTDCOMPRESSED);
                 setGzipBuf(NULL);
             }
         }
@@ -4019,15 +4083,71 @@ int HttpSession::setupGzipBuf()
 }
 
 
+void HttpSession::releaseCompressOffload()
+{
+    if (!m_pCompressOffload)
+        return;
+    //A batch in flight keeps the compressor, it is freed with the batch.
+    if (m_pCompressOffload->detach())
+        setGzipBuf(NULL);
+    m_pCompressOffload = NULL;
+    m_response.setCompressOffload(NULL);
+    clearFlag2(HSF2_RESP_COMPRESSING);
+}
+
+
+void HttpSession::onCompressOffloaded()
+{
+    LS_DBG_M(getLogSession(), "onCompressOffloaded(), compressing: %d.",
+             getFlag2(HSF2_RESP_COMPRESSING) ? 1 : 0);
+    if (!testFlag(HSF_HANDLER_DONE))
+    {
+        setFlag(HSF_RESP_FLUSHED, 0);
+        flush();
+        return;
+    }
+    if (getFlag2(HSF2_RESP_COMPRESSING))
+    {
+        //Send what is done so far, the end of the stream is still in flight.
+        setFlag(HSF_RESP_FLUSHED, 0);
+        flush();
+        return;
+    }
+
+    int ret = 0;
+    if (m_pCompressOffload->hasError())
+    {
+        LS_ERROR(getLogSession(), "Ran out of swapping space while "
+                 "terminating GZIP stream!");
+        ret = -1;
+    }
+    else
+        LS_DBG_M(getLogSession(), "endResponse() end offloaded GZIP stream.");
+    if (respBodyReceived(ret) == 0)
+        sendEndResponse();
+    else if (ret == -1)
+        getStream()->tobeClosed();
+}
+
+
 void HttpSession::releaseGzipBuf()
 {
-    GzipBuf *pGzipBuf = getGzipBuf();
-    if (pGzipBuf)
+    releaseCompressOffload();
+    Compressor *pCompressor = getGzipBuf();
+    if (pCompressor)
     {
-        if (pGzipBuf->getType() == GzipBuf::COMPRESSOR_COMPRESS)
-            HttpResourceManager::getInstance().recycle(pGzipBuf);
+#ifdef USE_ZSTD
+        if (getResp()->getCompressMethod() == LSI_ZSTD_COMPRESS)
+            HttpResourceManager::getInstance().recycle(
+                static_cast<ZstdBuf *>(pCompressor));
         else
-            HttpResourceManager::getInstance().recycleGunzip(pGzipBuf);
+#endif
+        if (pCompressor->getType() == Compressor::COMPRESSOR_COMPRESS)
+            HttpResourceManager::getInstance().recycle(
+                static_cast<GzipBuf *>(pCompressor));
+        else
+            HttpResourceManager::getInstance().recycleGunzip(
+                static_cast<GzipBuf *>(pCompressor));
         setGzipBuf(NULL);
     }
 }
@@ -4192,6 +4312,9 @@ int HttpSession::appendRespBodyBufV(const iovec *vector, int count)
 
 int HttpSession::shouldSuspendReadingResp()
 {
+    if (m_pCompressOffload
+        && m_pCompressOffload->getPending() >= 1024 * 1024)
+        return 1;
     if (getRespBodyBuf())
     {
         int buffered = getRespBodyBuf()->getCurWBlkPos() -
@@ -4328,7 +4451,26 @@ int HttpSession::endResponseInternal(int success)
                         NULL, 0, LSI_CBFI_EOF);
     }
 
-    if (getGzipBuf())
+    if (m_pCompressOffload && m_pCompressOffload->isOffloading())
+    {
+        int rc = m_pCompressOffload->endStream();
+        if (rc == LS_AGAIN)
+        {
+            //Finished by onCompressOffloaded()
+            LS_DBG_M(getLogSession(), "endResponse() wait for offloaded "
+                     "GZIP stream.");
+            return ret;
+        }
+        else if (rc == LS_FAIL)
+        {
+            LS_ERROR(getLogSession(), "Ran out of swapping space while "
+                     "terminating GZIP stream!");
+            ret = -1;
+        }
+        else
+            LS_DBG_M(getLogSession(), "endResponse() end GZIP stream.");
+    }
+    else if (getGzipBuf())
     {
         if (getGzipBuf()->endStream())
         {
@@ -4339,7 +4481,12 @@ int HttpSession::endResponseInternal(int success)
         else
             LS_DBG_M(getLogSession(), "endResponse() end GZIP stream.");
     }
+    return respBodyReceived(ret);
+}
+
 
+int HttpSession::respBodyReceived(int ret)
+{
     if (!ret && m_sessionHooks.isEnabled(LSI_HKPT_RCVD_RESP_BODY))
     {
         ret = m_sessionHooks.runCallbackNoParam(LSI_HKPT_RCVD_RESP_BODY,
@@ -4372,6 +4519,18 @@ int HttpSession::endResponse(int success)
     ret = endResponseInternal(success);
     if (ret)
         return ret;
+    if (getFlag2(HSF2_RESP_COMPRESSING))
+    {
+        setState(HSS_WRITING);
+        return 0;
+    }
+    return sendEndResponse();
+}
+
+
+int HttpSession::sendEndResponse()
+{
+    int ret;
     // FIXME ols orig code
 //     if (!isRespHeaderSent() && (m_response.getContentLen() < 0))
     if (!m_request.noRespBody() && !isRespHeaderSent()
@@ -4413,7 +4572,9 @@ int HttpSession::flushBody()
     }
     if (!(testFlag(HSF_HANDLER_DONE)))
     {
-        if (getGzipBuf() && getGzipBuf()->isStreamStarted())
+        if (m_pCompressOffload)
+            m_pCompressOffload->flush();
+        else if (getGzipBuf() && getGzipBuf()->isStreamStarted())
             getGzipBuf()->flush();
 
     }
@@ -4435,7 +4596,7 @@ int HttpSession::flushBody()
     {
         int flush = LSI_CBFI_FLUSH;
         if (((testFlag(HSF_HANDLER_DONE | HSF_RECV_RESP_BUFFERED))) ==
-             HSF_HANDLER_DONE)
+             HSF_HANDLER_DONE && !getFlag2(HSF2_RESP_COMPRESSING))
             flush = LSI_CBFI_EOF;
         ret = runFilter(LSI_HKPT_SEND_RESP_BODY,
                         (filter_term_fn)writeRespBodyTermination,
@@ -4452,7 +4613,7 @@ int HttpSession::flushBody()
         {
             if ((testFlag(HSF_HANDLER_DONE | HSF_RECV_RESP_BUFFERED
                           | HSF_SEND_RESP_BUFFERED | HSF_CHUNK_CLOSED))
-                == HSF_HANDLER_DONE)
+                == HSF_HANDLER_DONE && !getFlag2(HSF2_RESP_COMPRESSING))
             {
                 m_pChunkOS->close();
                 LS_DBG_L(getLogSession(), "Chunk closed!");
@@ -4533,8 +4694,9 @@ int HttpSession::flush()
         if (ret)
             return LS_AGAIN;
     }
-    else if (getFlag(HSF_HANDLER_DONE | HSF_RESP_WAIT_FULL_BODY) ==
-             HSF_RESP_WAIT_FULL_BODY)
+    else if (getFlag(HSF_RESP_WAIT_FULL_BODY)
+             && (!getFlag(HSF_HANDLER_DONE)
+                 || getFlag2(HSF2_RESP_COMPRESSING)))
     {
         LS_DBG_L(getLogSession(), "Cannot flush as response is not finished!");
         return LS_DONE;
@@ -4566,7 +4728,8 @@ int HttpSession::flush()
         if (getFlag(HSF_HANDLER_DONE
                     | HSF_SUSPENDED
                     | HSF_RECV_RESP_BUFFERED
-                    | HSF_SEND_RESP_BUFFERED) == HSF_HANDLER_DONE)
+                    | HSF_SEND_RESP_BUFFERED) == HSF_HANDLER_DONE
+            && !getFlag2(HSF2_RESP_COMPRESSING))
         {
             LS_DBG_L(getLogSession(), "Set the HSS_COMPLETE flag.");
             if (getState() != HSS_COMPLETE)
@@ -5739,7 +5902,8 @@ void HttpSession::testContentType()
     if (!pValue)
         return;
     const MimeSetting *pMIME = NULL;
-    int canCompress = pReq->gzipAcceptable() | pReq->brAcceptable();
+    int canCompress = pReq->gzipAcceptable() | pReq->brAcceptable()
+                      | pReq->zstdAcceptable();
     HttpContext *pContext = &(pReq->getVHost()->getRootContext());
     const ExpiresCtrl *pExpireDefault = pReq->shouldAddExpires();
     int enbale = pContext->getExpires().isEnabled();
@@ -5765,6 +5929,7 @@ void HttpSession::testContentType()
     {
         pReq->andGzip(~GZIP_ENABLED);
         pReq->andBr(~BR_ENABLED);
+        pReq->andZstd(~ZSTD_ENABLED);
     }
 
     if (enbale)
@@ -5784,7 +5949,8 @@ int HttpSession::updateContentCompressible()
 {
     int compressible = 0;
     if ((m_request.gzipAcceptable() == GZIP_REQUIRED)
-        || (m_request.brAcceptable() == BR_REQUIRED))
+        || (m_request.brAcceptable() == BR_REQUIRED)
+        || (m_request.zstdAcceptable() == ZSTD_REQUIRED))
     {
         int len;
         char *pContentType = (char *)m_response.getRespHeaders().getHeader(
@@ -5800,6 +5966,7 @@ int HttpSession::updateContentCompressible()
         {
             m_request.andGzip(~GZIP_ENABLED);
             m_request.andBr(~BR_ENABLED);
+            m_request.andZstd(~ZSTD_ENABLED);
         }
     }
     return compressible;
@@ -40,9 +40,10 @@ class ReqHandler;
 class VHostMap;
 class ChunkInputStream;
 class ChunkOutputStream;
+class CompressOffload;
 class ExtWorker;
 class VMemBuf;
-class GzipBuf;
+class Compressor;
 class SsiBlock;
 class SsiRuntime;
 class SsiScript;
@@ -175,6 +176,11 @@ enum HSPState
 //Start flag2
 #define HSF2_IS_HTTP2               (1<<0)
 #define HSF2_IS_HTTP3               (1<<1)
+#define HSF2_RESP_COMPRESSING       (1<<2)
+#define HSF2_RESP_BODY_ZSTDCOMPRESSED   (1<<3)
+#define HSF2_BG_SUB_SESSION         (1<<4)
+#define HSF2_HOLD_CLIENT_INFO       (1<<5)
+#define HSF2_BG_SEED                (1<<6)
 #define HSF2_EXEC_EXT_CMD           (1<<9)
 #define HSF2_EXEC_POPEN             (1<<10)
 
@@ -209,6 +215,7 @@ class HttpSession
 
     ChunkInputStream     *m_pChunkIS;
     ChunkOutputStream    *m_pChunkOS;
+    CompressOffload      *m_pCompressOffload;
     HttpSession          *m_pCurSubSession;
     ReqHandler           *m_pHandler;
 
@@ -291,6 +298,8 @@ class HttpSession
     char getSsiStackDepth() const;
 
     static int call_nextRequest(lsi_session_t *p, long , void *);
+    static int call_execSubSession(lsi_session_t *p, long , void *);
+    static int call_releaseDetached(lsi_session_t *p, long , void *pParam);
     void markComplete(bool nowait);
 
     void releaseResources();
@@ -481,11 +490,14 @@ private:
     //int resumeHandlerProcess();
     int flushBody();
     int endResponseInternal(int success);
+    int respBodyReceived(int ret);
+    int sendEndResponse();
 
     int getModuleDenyCode(int iHookLevel);
     int processHkptResult(int iHookLevel, int ret);
 
     int detachSubSession(HttpSession *pSubSess);
+    void detachFromConn();
     int  passSendFileToParent(SendFileInfo *pData);
     int  setSendFile(SendFileInfo *pData);
     int detectLoopSubSession(lsi_subreq_t *pSubSessInfo);
@@ -684,8 +696,11 @@ public:
     int setupGzipFilter();
     int setupGzipBuf();
     void releaseGzipBuf();
-    GzipBuf *getGzipBuf() const     {   return getResp()->getGzipBuf();     }
-    void setGzipBuf(GzipBuf *pGzip) {   getResp()->setGzipBuf(pGzip);       }
+    void releaseCompressOffload();
+    void onCompressOffloaded();
+    Compressor *getGzipBuf() const  {   return getResp()->getGzipBuf();     }
+    void setGzipBuf(Compressor *pGzip, int method = LSI_GZIP_COMPRESS)
+    {   getResp()->setGzipBuf(pGzip, method);   }
 
     int execExtCmd(const char *pCmd, int len, int mode = 0);
 
@@ -709,7 +724,8 @@ public:
     //int writeConnStatus( char * pBuf, int bufLen );
 
     void resetResp()
-    {   getResp()->reset();
+    {   releaseCompressOffload();
+        getResp()->reset();
         m_iFlag &= ~HSF_RESP_HEADER_DONE; }
 
     LogSession *getLogSession()     {   return this;     }
@@ -773,6 +789,15 @@ public:
 
     int execSubSession();
 
+    //Start a detached sub session from the event queue, response discarded
+    int startBgSubSession(lsi_subreq_t *pSubSessInfo);
+
+    //An unprocessed detached copy to start background sub sessions from
+    HttpSession *newBgSeed();
+
+    //The detached sub session is done, recycle it from the event queue
+    void releaseDetached();
+
     int onSubSessionRespIncluded(HttpSession *pSubSess);
 
     int onSubSessionEndResp(HttpSession *pSubSess);
@@ -49,7 +49,9 @@
 #include <main/httpserver.h>
 #include <main/mainserverconfig.h>
 #include <main/plainconf.h>
+#include <sslpp/sslcertstore.h>
 #include <sslpp/sslcontext.h>
+#include <sslpp/sslcontextconfig.h>
 #include <util/accesscontrol.h>
 #include <util/datetime.h>
 #include <util/daemonize.h>
@@ -257,6 +259,7 @@ HttpVHost::HttpVHost(const char *pHostName)
     , m_gid(500)
     , m_pRewriteMaps(NULL)
     , m_pSSLCtx(NULL)
+    , m_pLazySslConfig(NULL)
     , m_pSSITagConfig(NULL)
     , m_pRecaptcha(NULL)
     , m_lastAccessLog(NULL)
@@ -300,6 +303,11 @@ HttpVHost::~HttpVHost()
         delete m_pAwstats;
     if (m_pSSLCtx)
         delete m_pSSLCtx;
+    if (m_pLazySslConfig)
+    {
+        SslCertStore::getInstance().remove(getName());
+        delete m_pLazySslConfig;
+    }
     m_pUrlStxFileHash->release_objects();
     delete m_pUrlStxFileHash;
     m_pUrlIdHash->release_objects();
@@ -777,6 +785,33 @@ void HttpVHost::setSslContext(SslContext *pCtx)
 }
 
 
+/**
+ * Keep the SSL configuration only, the SslContext is built by SslCertStore
+ * on the first handshake for this vhost. Client verification needs the
+ * context for every request, such vhosts are always loaded at startup.
+ */
+int HttpVHost::configLazySsl(const XmlNode *pNode)
+{
+    SslContextConfig *pConfig = new SslContextConfig();
+    if (ConfigCtx::getCurConfigCtx()->initSSLContextConfig(pNode, getName(),
+                                                          pConfig) == LS_FAIL
+        || pConfig->m_iClientVerify)
+    {
+        delete pConfig;
+        return LS_FAIL;
+    }
+    if (m_pLazySslConfig)
+    {
+        SslCertStore::getInstance().remove(getName());
+        delete m_pLazySslConfig;
+    }
+    m_pLazySslConfig = pConfig;
+    LS_DBG_L("[VHost:%s] SSL certificate %s will be loaded on demand.",
+             getName(), pConfig->m_sCertFile[0].c_str());
+    return LS_OK;
+}
+
+
 int HttpVHost::isSslClientAuth() const
 {
     return m_pSSLCtx ? m_pSSLCtx->getVerifyMode() : 0;
@@ -900,6 +935,10 @@ int HttpVHost::configBasics(const XmlNode *pVhConfNode, int iChrootLen)
     enableBr((HttpServerConfig::getInstance().getBrCompress()) ?
                ConfigCtx::getCurConfigCtx()->getLongValue(pVhConfNode, "enableBr", 0, 1,
                        1) : 0);
+
+    enableZstd((HttpServerConfig::getInstance().getZstdCompress()) ?
+               ConfigCtx::getCurConfigCtx()->getLongValue(pVhConfNode, "enableZstd", 0, 1,
+                       1) : 0);
     int val = ConfigCtx::getCurConfigCtx()->getLongValue(pVhConfNode, "enableIpGeo", -1, 1, -1);
     if (val == -1)
         val = HttpServer::getInstance().getServerContext().isGeoIpOn();
@@ -3338,9 +3377,13 @@ int HttpVHost::config(const XmlNode *pVhConfNode, int is_uid_set)
                                         p0, "enableQuic", 0, 1, 1);
 
         ConfigCtx currentCtx("ssl");
-        SslContext *pSSLCtx = ConfigCtx::getCurConfigCtx()->newSSLContext(p0, getName(), NULL);
-        if (pSSLCtx)
-            setSslContext(pSSLCtx);
+        if (!SslCertStore::getInstance().isEnabled()
+            || configLazySsl(p0) == LS_FAIL)
+        {
+            SslContext *pSSLCtx = ConfigCtx::getCurConfigCtx()->newSSLContext(p0, getName(), NULL);
+            if (pSSLCtx)
+                setSslContext(pSSLCtx);
+        }
     }
     setFeature(VH_QUIC_LISTENER, enabledQuic);
 
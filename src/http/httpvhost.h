@@ -61,6 +61,7 @@ END_LOG4CXX_NS
 #define VH_BWRAP            (1<<14)
 #define VH_STRICT_OWNER     (1<<15)
 #define VH_NS               (1<<16)
+#define VH_ZSTD             (1<<17)
 
 #define MAX_VHOST_PHP_NUM    100
 
@@ -96,6 +97,7 @@ class RewriteMapList;
 class RLimits;
 class SsiTagConfig;
 class SslContext;
+class SslContextConfig;
 class UserDir;
 class XmlNodeList;
 class ExtWorker;
@@ -210,6 +212,7 @@ private:
 
     RewriteMapList     *m_pRewriteMaps;
     SslContext         *m_pSSLCtx;
+    SslContextConfig   *m_pLazySslConfig;
     SsiTagConfig       *m_pSSITagConfig;
     LsiModuleData       m_moduleData;
     Recaptcha          *m_pRecaptcha;
@@ -287,6 +290,8 @@ public:
 
     ContextTree *getContextTree()
     {   return &m_contexts;     }
+    const ContextTree *getContextTree() const
+    {   return &m_contexts;     }
 
     virtual void setLogLevel(const char *pLevel);
     virtual int  setAccessLogFile(const char *pFileName, int pipe);
@@ -333,6 +338,9 @@ public:
     void enableBr(int enable)         {   setFeature(VH_BR, enable);      }
     int  enableBr() const               {   return m_iFeatures & VH_BR;     }
 
+    void enableZstd(int enable)       {   setFeature(VH_ZSTD, enable);    }
+    int  enableZstd() const             {   return m_iFeatures & VH_ZSTD;   }
+
     void enableCGroup(int enable)       {   setFeature(VH_CGROUP, enable);    }
     int  enableCGroup() const             {   return m_iFeatures & VH_CGROUP;   }
 
@@ -479,6 +487,9 @@ public:
 
     SslContext *getSslContext() const
     {   return m_pSSLCtx;           }
+    SslContextConfig *getLazySslConfig() const
+    {   return m_pLazySslConfig;    }
+    int configLazySsl(const XmlNode *pNode);
     int isSslClientAuth() const;
 
     HTAuth *configAuthRealm(HttpContext *pContext,
@@ -165,6 +165,10 @@ void L4Handler::buildWsReq(HttpReq &req, const char *pIP, int iIpLen,
     pBuff->used(-1 * hasSlashR - 1);
     if (req.isHttps())
         pBuff->append("X-Forwarded-Proto: https\r\n", 26);
+    int earlyDataLen;
+    if (req.getContextState(EARLY_DATA)
+        && req.getHeader("Early-Data", 10, earlyDataLen) == NULL)
+        pBuff->append("Early-Data: 1\r\n", 15);
     pBuff->append("X-Forwarded-For: ", 17);
     pBuff->append(pIP, iIpLen);
     if (hasSlashR)
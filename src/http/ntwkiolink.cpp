@@ -36,6 +36,7 @@
 #include <lsiapi/lsiapi.h>
 #include <lsr/ls_strtool.h>
 #include <socket/gsockaddr.h>
+#include <sslpp/sslasyncpk.h>
 #include <sslpp/sslcontext.h>
 #include <sslpp/sslerror.h>
 #include <util/accessdef.h>
@@ -67,6 +68,9 @@
 //#define SPDY_PLAIN_DEV
 
 int NtwkIOLink::s_iPrevTmToken = 0;
+#ifdef SSL_ASYNC_PK
+struct ls_offload_api *NtwkIOLink::s_pApkApi = NULL;
+#endif
 int NtwkIOLink::s_iTmToken = 0;
 
 class NtwkIOLink::fp_list NtwkIOLink::s_normal
@@ -363,6 +367,10 @@ int NtwkIOLink::setLink(HttpListener *pListener,  int fd, ConnInfo *pInfo)
         {
             m_ssl.setFlag(SslConnection::F_DISABLE_HTTP2, 1);
         }
+#ifdef SSL_ASYNC_PK
+        if (s_pApkApi)
+            ssl_apk_prepare(m_ssl.getSSL(), s_pApkApi, this);
+#endif
         m_ssl.toAccept();
     }
     else
@@ -2045,6 +2053,38 @@ int NtwkIOLink::sslSetupHandler()
 }
 
 
+#ifdef SSL_ASYNC_PK
+/**
+ * Must be called before any SSL_CTX is configured, so that
+ * ssl_ctx_enable_apk() installs the async private key method.
+ */
+void NtwkIOLink::enableAsyncPk()
+{
+    static ls_offload_api s_api;
+    if (s_pApkApi)
+        return;
+    ssl_apk_set_api(&s_api, onAsyncPkDone);
+    s_pApkApi = &s_api;
+}
+
+
+/**
+ * Runs on the event loop once the signature is ready. The SSL object of
+ * a closed connection cancels its sign job when freed, so param is still
+ * the link that started the handshake.
+ */
+void NtwkIOLink::onAsyncPkDone(void *param)
+{
+    NtwkIOLink *pThis = (NtwkIOLink *)param;
+    if (!pThis->m_ssl.getSSL()
+        || pThis->m_ssl.getStatus() != SslConnection::ACCEPTING)
+        return;
+    LS_DBG_L(pThis, "[SSL] async private key sign done, resume handshake.");
+    pThis->SSLAgain();
+}
+#endif
+
+
 int NtwkIOLink::SSLAgain()
 {
     LS_DBG_L(this, "[SSL] SSLAgain()!");
@@ -96,6 +96,10 @@ private:
     static class fp_list_list  *s_pCur_fp_list_list;
 
     static int                  s_iPrevTmToken;
+#ifdef SSL_ASYNC_PK
+    static struct ls_offload_api *s_pApkApi;
+    static void onAsyncPkDone(void *param);
+#endif
     static int                  s_iTmToken;
 
 
@@ -351,6 +355,9 @@ public:
     ThrottleControl *getThrottleCtrl() const;
 
     static void enableThrottle(int enable);
+#ifdef SSL_ASYNC_PK
+    static void enableAsyncPk();
+#endif
     int isThrottle() const
     {   return m_pFpList->m_onTimer_fp != onTimer_; }
 
@@ -755,6 +755,11 @@ int RequestVars::getReqVar(HttpSession *pSession, int type, char *&pValue,
         pValue = (char *)pReq->getOrgReqLine();
         return pReq->getOrgReqLineLen();
     case REF_IS_SUBREQ:
+        if (pSession->getFlag2(HSF2_BG_SUB_SESSION))
+        {
+            strcpy(pValue, "true");
+            return 4;
+        }
         strcpy(pValue, "false");
         return 5;
 
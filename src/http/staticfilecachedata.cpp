@@ -16,25 +16,33 @@
 *    along with this program. If not, see http://www.gnu.org/licenses/.      *
 *****************************************************************************/
 #include <http/staticfilecachedata.h>
+#include <http/staticprecompressor.h>
 #include <main/httpserver.h>
 #include <http/httpcontext.h>
 #include <http/httpheader.h>
 #include <http/httpmime.h>
+#include <http/httpserverconfig.h>
 #include <http/httpreq.h>
 #include <http/httpstatuscode.h>
 #include <log4cxx/logger.h>
 #include <lsiapi/lsiapi.h>
+#include <lsr/ls_base64.h>
 #include <lsr/ls_fileio.h>
 #include <lsr/ls_strtool.h>
 #include <ssi/ssiscript.h>
+#include <util/autobuf.h>
 #include <util/datetime.h>
 #include <util/brotlibuf.h>
+#include <util/zstdbuf.h>
 #include <util/gzipbuf.h>
 #include <util/stringtool.h>
 #include <util/vmembuf.h>
 
 #include <openssl/md5.h>
+#include <openssl/sha.h>
 #include <assert.h>
+#include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -63,6 +71,9 @@ static int      s_iMaxFileSize          = 1024 * 1024;
 static int      s_iMinFileSize          = 300;
 
 static int      s_iBrCompressLevel    = 6;
+static int      s_iZstdCompressLevel  = 12;
+static int      s_iDictCompress       = 0;
+static int      s_iPrecompress        = 0;
 
 static const char *s_compressCachePath = DEFAULT_TMP_DIR;
 
@@ -276,7 +287,7 @@ const char *FileCacheDataEx::getCacheData(
 StaticFileCacheData::StaticFileCacheData()
 {
     memset(&m_pMimeType, 0,
-           (char *)(&m_pBrotli + 1) - (char *)&m_pMimeType);
+           (char *)(m_achDczHash + SFCD_DICT_HASH_LEN) - (char *)&m_pMimeType);
 }
 
 
@@ -287,6 +298,10 @@ StaticFileCacheData::~StaticFileCacheData()
         delete m_pGzip;
     if (m_pBrotli)
         delete m_pBrotli;
+    if (m_pZstd)
+        delete m_pZstd;
+    if (m_pDcz)
+        delete m_pDcz;
     if (m_pSSIScript)
         delete m_pSSIScript;
 }
@@ -306,15 +321,14 @@ int StaticFileCacheData::testMod(HttpReq *pReq)
         }
         if ( m_iETagLen > 0 && *pNonMatch == '*' )
             return SC_304;
-        if (m_iETagLen == len)
+        if (m_iETagLen == len || isDczETag(pNonMatch, len))
         {
-            //ignore trialing ";gz" ";br" .
-            if (len > 3)
-                len -= 3;
-            if (memcmp(pNonMatch, m_pETag, len) == 0)
+            //ignore trialing ";gz" ";br" and the dictionary of a dcz delta.
+            if (memcmp(pNonMatch, m_pETag, m_iETagLen - 3) == 0)
             {
                 //Since we will return 304, but should use the original Etag
-                memcpy(m_pETag, pNonMatch, m_iETagLen);
+                if (m_iETagLen == len)
+                    memcpy(m_pETag, pNonMatch, m_iETagLen);
                 return SC_304;
             }
         }
@@ -334,6 +348,24 @@ int StaticFileCacheData::testMod(HttpReq *pReq)
 }
 
 
+/**
+ * A dcz ETag is the ETag of the file followed by "-" and the start of the
+ * dictionary hash in hex, see HttpRespHeaders::addDczEncodingHeader().
+ */
+int StaticFileCacheData::isDczETag(const char *pETag, int len) const
+{
+    if (m_iETagLen <= 3 || len != m_iETagLen + 1 + 2 * SFCD_DCZ_ETAG_HASH_LEN
+        || pETag[m_iETagLen - 1] != '-' || pETag[len - 1] != '"')
+        return 0;
+    for (const char *p = pETag + m_iETagLen; p < pETag + len - 1; ++p)
+    {
+        if (!isxdigit(*p))
+            return 0;
+    }
+    return 1;
+}
+
+
 int StaticFileCacheData::testIfRange(const char *pMatch, int len)
 {
     if ((*(pMatch + 1) == '/')
@@ -537,7 +569,17 @@ static int createLockFile(const char *pReal, char *p)
 }
 
 
-int StaticFileCacheData::tryCreateCompressed(char useBrotli)
+AutoStr2 *StaticFileCacheData::getCompressedPath(char compressMode)
+{
+    if (compressMode == SFCD_MODE_ZSTD)
+        return &m_zstdPath;
+    if (compressMode == SFCD_MODE_BROTLI)
+        return &m_bredPath;
+    return &m_gzippedPath;
+}
+
+
+int StaticFileCacheData::tryCreateCompressed(char compressMode)
 {
     AutoStr2 *pPath;
     if (!s_iAutoUpdateStaticGzip)
@@ -553,7 +595,7 @@ int StaticFileCacheData::tryCreateCompressed(char useBrotli)
         return LS_FAIL;
     }
 
-    pPath = useBrotli ? &m_bredPath : &m_gzippedPath;
+    pPath = getCompressedPath(compressMode);
     char *p = pPath->buf() + pPath->len() + 4;
     int fd = createLockFile(pPath->buf(), p);
     if (fd == -1)
@@ -564,7 +606,7 @@ int StaticFileCacheData::tryCreateCompressed(char useBrotli)
     close(fd);
     if (size < 409600)
     {
-        long ret = compressFile(useBrotli);
+        long ret = compressFile(compressMode);
         if (ret == -1)
             LS_WARN("Failed to compress file %s, file size %ld!",
                     m_real.c_str(), (long)size);
@@ -587,7 +629,7 @@ int StaticFileCacheData::tryCreateCompressed(char useBrotli)
         //child process
         setpriority(PRIO_PROCESS, 0, 5);
 
-        long ret = compressFile(useBrotli);
+        long ret = compressFile(compressMode);
         if (ret == -1)
             LS_WARN("Failed to compress file %s, file size %ld!",
                     m_real.c_str(), (long)size);
@@ -631,31 +673,30 @@ int StaticFileCacheData::detectTrancate()
 }
 
 
-int StaticFileCacheData::compressFile(char useBrotli)
+int StaticFileCacheData::compressFile(char compressMode)
 {
     int ret;
-    AutoStr2 *pPath;
+    AutoStr2 *pPath = getCompressedPath(compressMode);
 
     GzipBuf gzBuf;
-    Compressor *pCompressor;
+    Compressor *pCompressor = &gzBuf;
     VMemBuf compressBuf;
-    int iCompressLevel;
+    int iCompressLevel = s_iGzipCompressLevel;
 
 #ifdef USE_BROTLI
     BrotliBuf brBuf;
-    if (useBrotli)
+    if (compressMode == SFCD_MODE_BROTLI)
     {
         pCompressor = &brBuf;
-        pPath = &m_bredPath;
         iCompressLevel = s_iBrCompressLevel;
     }
-    else
-    {
 #endif
-        pCompressor = &gzBuf;
-        pPath = &m_gzippedPath;
-        iCompressLevel = s_iGzipCompressLevel;
-#ifdef USE_BROTLI
+#ifdef USE_ZSTD
+    ZstdBuf zstdBuf;
+    if (compressMode == SFCD_MODE_ZSTD)
+    {
+        pCompressor = &zstdBuf;
+        iCompressLevel = s_iZstdCompressLevel;
     }
 #endif
 
@@ -735,6 +776,133 @@ int StaticFileCacheData::compressFile(char useBrotli)
 }
 
 
+const char *StaticFileCacheData::getCompressedSuffix(char compressMode)
+{
+    if (compressMode == SFCD_MODE_ZSTD)
+        return ".zst";
+    if (compressMode == SFCD_MODE_BROTLI)
+        return ".lsb";
+    return ".lsz";
+}
+
+
+char StaticFileCacheData::getPrecompressModes()
+{
+    HttpServerConfig &config = HttpServerConfig::getInstance();
+    char mode = 0;
+    if (config.getGzipCompress())
+        mode |= SFCD_MODE_GZIP;
+#ifdef USE_BROTLI
+    if (config.getBrCompress() && s_iBrCompressLevel > 0)
+        mode |= SFCD_MODE_BROTLI;
+#endif
+#ifdef USE_ZSTD
+    if (config.getZstdCompress())
+        mode |= SFCD_MODE_ZSTD;
+#endif
+    return mode;
+}
+
+
+int StaticFileCacheData::isPrecompressSize(off_t size)
+{
+    return (size >= s_iMinFileSize) && (size <= s_iMaxFileSize);
+}
+
+
+/**
+ * Called by the StaticPrecompressor threads. The output goes to a temporary
+ * file which gets the mtime of the source before it is renamed over pPath,
+ * the request path sees either the old or the complete new file.
+ */
+off_t StaticFileCacheData::compressFd(int fd, off_t size, time_t mtime,
+                                      char compressMode, const char *pPath,
+                                      off_t maxSize)
+{
+    GzipBuf gzBuf;
+    Compressor *pCompressor = &gzBuf;
+    VMemBuf compressBuf;
+    int iCompressLevel = s_iGzipCompressLevel;
+    char achFileName[4096];
+    char achBuf[8192];
+    off_t offset = 0;
+    off_t outSize;
+    int len;
+    int ret = 0;
+
+#ifdef USE_BROTLI
+    BrotliBuf brBuf;
+    if (compressMode == SFCD_MODE_BROTLI)
+    {
+        pCompressor = &brBuf;
+        iCompressLevel = s_iBrCompressLevel;
+    }
+#endif
+#ifdef USE_ZSTD
+    ZstdBuf zstdBuf;
+    if (compressMode == SFCD_MODE_ZSTD)
+    {
+        pCompressor = &zstdBuf;
+        iCompressLevel = s_iZstdCompressLevel;
+    }
+#endif
+
+    pCompressor->disableStats();
+    if ((pCompressor->init(Compressor::COMPRESSOR_COMPRESS,
+                           iCompressLevel) != 0)
+        || (compressBuf.set(VMBUF_ANON_MAP, 8192) == LS_FAIL))
+        return LS_FAIL;
+    snprintf(achFileName, sizeof(achFileName), "%s.XXXXXX", pPath);
+    int outFd = mkstemp(achFileName);
+    if (outFd == -1)
+        return LS_FAIL;
+
+    pCompressor->setCompressCache(&compressBuf);
+    if (pCompressor->beginStream())
+        ret = LS_FAIL;
+    while (ret == 0 && offset < size)
+    {
+        len = (size - offset < (off_t)sizeof(achBuf))
+              ? size - offset : sizeof(achBuf);
+        len = pread(fd, achBuf, len, offset);
+        if (len <= 0 || pCompressor->write(achBuf, len) == LS_FAIL)
+        {
+            ret = LS_FAIL;
+            break;
+        }
+        offset += len;
+        if (compressBuf.getCurWOffset() >= 8192)
+        {
+            if (compressBuf.writeToFile(outFd) == LS_FAIL)
+                ret = LS_FAIL;
+            pCompressor->resetCompressCache();
+            //Give up early on a file that does not shrink
+            if (lseek(outFd, 0, SEEK_CUR) >= maxSize)
+                ret = LS_FAIL;
+        }
+    }
+    if (ret == 0 && pCompressor->endStream() == 0
+        && compressBuf.writeToFile(outFd) == 0)
+    {
+        outSize = lseek(outFd, 0, SEEK_CUR);
+        close(outFd);
+        if (outSize < maxSize)
+        {
+            struct utimbuf utmbuf;
+            utmbuf.actime = mtime;
+            utmbuf.modtime = mtime;
+            if (utime(achFileName, &utmbuf) == 0
+                && rename(achFileName, pPath) == 0)
+                return outSize;
+        }
+    }
+    else
+        close(outFd);
+    unlink(achFileName);
+    return LS_FAIL;
+}
+
+
 int StaticFileCacheData::buildCompressedCache(FileCacheDataEx *&pData,
                                               const struct stat &st)
 {
@@ -758,32 +926,45 @@ int StaticFileCacheData::buildCompressedCache(FileCacheDataEx *&pData,
 }
 
 
-int StaticFileCacheData::buildCompressedPaths()
+int StaticFileCacheData::buildCompressedBasePath(const char *pReal, int len,
+                                                 char *pBuf, int size)
 {
     unsigned char achHash[MD5_DIGEST_LENGTH];
-    char achPath[4096];
-    StringTool::getMd5(m_real.c_str(), m_real.len(), achHash);
     struct stat st;
-    int n = snprintf(achPath, 4096, "%s/%x/%x/", s_compressCachePath,
+    StringTool::getMd5(pReal, len, achHash);
+    int n = snprintf(pBuf, size, "%s/%x/%x/", s_compressCachePath,
                      achHash[0] >> 4, achHash[0] & 0xf);
-    if ((ls_fio_stat(achPath, &st) == -1) && (errno == ENOENT))
+    if (n + 31 > size)
+        return LS_FAIL;
+    if ((ls_fio_stat(pBuf, &st) == -1) && (errno == ENOENT))
     {
-        achPath[n - 3] = 0;
-        mkdir(achPath, 0700);
-        achPath[n - 3] = '/';
-        if ((mkdir(achPath, 0700) == -1) && (errno != EEXIST))
+        pBuf[n - 3] = 0;
+        mkdir(pBuf, 0700);
+        pBuf[n - 3] = '/';
+        if ((mkdir(pBuf, 0700) == -1) && (errno != EEXIST))
         {
             LS_DBG_H("[StaticFileCacheData::buildCompressedPaths] mkdir %s failed.",
-                     achPath);
+                     pBuf);
             return LS_FAIL;
         }
     }
 
     StringTool::hexEncode((const char *)&achHash[1], MD5_DIGEST_LENGTH - 1,
-                          &achPath[n]);
-    n += 30;
+                          &pBuf[n]);
+    return n + 30;
+}
+
+
+int StaticFileCacheData::buildCompressedPaths()
+{
+    char achPath[4096];
+    int n = buildCompressedBasePath(m_real.c_str(), m_real.len(), achPath,
+                                    sizeof(achPath));
+    if (n == LS_FAIL)
+        return LS_FAIL;
     char *pReal = m_gzippedPath.prealloc(n + 6);
-    if ((!pReal) || (!m_bredPath.prealloc(n + 6)))
+    if ((!pReal) || (!m_bredPath.prealloc(n + 6))
+        || (!m_zstdPath.prealloc(n + 6)))
     {
         LS_DBG_H("[StaticFileCacheData::buildCompressedPaths] error. pReal %p m_gzippedPath %s m_bredPath %s.",
                pReal, m_gzippedPath.c_str(), m_bredPath.c_str());
@@ -802,12 +983,24 @@ int StaticFileCacheData::buildCompressedPaths()
     pBred[n + 3] = 'b'; // .lsb
     m_bredPath.setLen(n);
 
+    if (!m_zstdPath.setStr(pReal, n + 6))
+        return LS_FAIL;
+    memmove(m_zstdPath.buf() + n, ".zst", 4);
+    m_zstdPath.setLen(n);
+
     return 0;
 }
 
 
 int StaticFileCacheData::setReadiedCompressData(char compressMode)
 {
+    if ((compressMode & SFCD_MODE_ZSTD) && (m_pZstd))
+    {
+        if ((m_pZstd->isCached() ||
+            (m_pZstd->getfd() != -1)))
+            return 0;
+        return m_pZstd->readyData(m_zstdPath.c_str());
+    }
     if ((compressMode & SFCD_MODE_BROTLI) && (m_pBrotli))
     {
         if ((m_pBrotli->isCached() ||
@@ -826,13 +1019,39 @@ int StaticFileCacheData::setReadiedCompressData(char compressMode)
 }
 
 
+/**
+ * StaticPrecompressor only takes the files under the roots it watches, and
+ * none while it can not cover them.
+ */
+static int isPrecompressed(const AutoStr2 &real, char compressMode)
+{
+#if defined(linux) || defined(__linux) || defined(__linux__) || defined(__gnu_linux__)
+    StaticPrecompressor &precompressor = StaticPrecompressor::getInstance();
+    if (!precompressor.isCovering())
+        return 0;
+    return precompressor.getModes(real.c_str(), real.len()) & compressMode;
+#else
+    return 0;
+#endif
+}
+
+
 int StaticFileCacheData::compressHelper(AutoStr2 &path, FileCacheDataEx *&pData,
-    struct stat &st, int exists, char isBrotli)
+    struct stat &st, int exists, char compressMode)
 {
     int ret;
-    if (exists != -1)
-        unlink(path.c_str());
-    ret = tryCreateCompressed(isBrotli);
+    if (s_iPrecompress && isPrecompressed(m_real, compressMode))
+    {
+        //StaticPrecompressor replaces it, serve the plain file meanwhile
+        LS_DBG_H("Compressed file %s is not ready.", path.c_str());
+        ret = -1;
+    }
+    else
+    {
+        if (exists != -1)
+            unlink(path.c_str());
+        ret = tryCreateCompressed(compressMode);
+    }
     if (ret == -1)
     {
         if (pData)
@@ -863,12 +1082,13 @@ int StaticFileCacheData::readyCompressed(char compressMode)
     if (tm == m_tmLastCheck)
         return setReadiedCompressData(compressMode);
 
-    int statBr = -1, retGz = -1, statGz = -1;
+    int statZstd = -1, statBr = -1, retGz = -1, statGz = -1;
     struct stat stGzip;
     struct stat stBr;
+    struct stat stZstd;
     m_tmLastCheck = tm;
-    // Both paths matter, but bredPath is set last.
-    if (!m_bredPath.c_str() || !*m_bredPath.c_str())
+    // All paths matter, but zstdPath is set last.
+    if (!m_zstdPath.c_str() || !*m_zstdPath.c_str())
     {
         if (buildCompressedPaths() == -1)
         {
@@ -880,6 +1100,28 @@ int StaticFileCacheData::readyCompressed(char compressMode)
     if ((compressMode & SFCD_MODE_BROTLI) && s_iBrCompressLevel == 0)
         compressMode &= ~SFCD_MODE_BROTLI;
 
+    //zstd is preferred, it is much faster to decompress than brotli
+    if (compressMode & SFCD_MODE_ZSTD)
+    {
+        statZstd = ls_fio_stat(m_zstdPath.c_str(), &stZstd);
+        LS_DBG_H("readyCompressed() path %s statZstd %d",
+                m_zstdPath.c_str(), statZstd);
+        if ((statZstd == -1) || (stZstd.st_mtime != getLastMod()))
+        {
+            if ((statZstd = compressHelper(m_zstdPath, m_pZstd, stZstd,
+                                           statZstd, SFCD_MODE_ZSTD)))
+            {
+                LS_DBG_H("readyCompressed compress zstd error %s.",
+                         m_zstdPath.c_str());
+                compressMode &= ~SFCD_MODE_ZSTD;
+            }
+            else
+                compressMode &= ~(SFCD_MODE_BROTLI | SFCD_MODE_GZIP);
+        }
+        else
+            compressMode &= ~(SFCD_MODE_BROTLI | SFCD_MODE_GZIP);
+    }
+
     if (compressMode & SFCD_MODE_BROTLI) // brotli active AND not valid
     {
         statBr = ls_fio_stat(m_bredPath.c_str(), &stBr);
@@ -888,7 +1130,8 @@ int StaticFileCacheData::readyCompressed(char compressMode)
         if ((statBr == -1) || (stBr.st_mtime != getLastMod()))
         {
             // update br
-            if ((statBr = compressHelper(m_bredPath, m_pBrotli, stBr, statBr, 1)))
+            if ((statBr = compressHelper(m_bredPath, m_pBrotli, stBr, statBr,
+                                         SFCD_MODE_BROTLI)))
             {
                 LS_DBG_H("readyCompressed compress br error %s.",
                          m_bredPath.c_str());
@@ -908,7 +1151,8 @@ int StaticFileCacheData::readyCompressed(char compressMode)
                 || (stGzip.st_mtime != getLastMod()));
         LS_DBG_H("readyCompressed() path %s statGz %d retGz %d",
                  m_gzippedPath.c_str(), statGz, retGz);
-        if (retGz && (statGz = compressHelper(m_gzippedPath, m_pGzip, stGzip, statGz, 0)))
+        if (retGz && (statGz = compressHelper(m_gzippedPath, m_pGzip, stGzip, statGz,
+                                                    SFCD_MODE_GZIP)))
         {
             LS_DBG_H("readyCompressed() compress gzip error %s or file size not suitable for gzip.",
                     m_gzippedPath.c_str());
@@ -916,7 +1160,10 @@ int StaticFileCacheData::readyCompressed(char compressMode)
         }
     }
 
-    if ((compressMode & SFCD_MODE_BROTLI)
+    if ((compressMode & SFCD_MODE_ZSTD)
+        && (statZstd != -1) && ((!m_pZstd) || (m_pZstd->isDirty(stZstd))))
+        buildCompressedCache(m_pZstd, stZstd);
+    else if ((compressMode & SFCD_MODE_BROTLI)
         && (statBr != -1) && ((!m_pBrotli) || (m_pBrotli->isDirty(stBr))))
         buildCompressedCache(m_pBrotli, stBr);
     else if ((compressMode & SFCD_MODE_GZIP)
@@ -926,6 +1173,400 @@ int StaticFileCacheData::readyCompressed(char compressMode)
 }
 
 
+int StaticFileCacheData::readFileContent(AutoBuf *pBuf)
+{
+    off_t offset = 0;
+    off_t wanted;
+    int len;
+    const char *pData;
+    char achBuf[8192];
+
+    if ((!m_fileData.isCached() && (m_fileData.getfd() == -1))
+        && (m_fileData.readyData(m_real.c_str()) != 0))
+        return LS_FAIL;
+    if (pBuf->guarantee(getFileSize()) == -1)
+        return LS_FAIL;
+    while ((wanted = getFileSize() - offset) > 0)
+    {
+        len = (wanted < 8192) ? wanted : 8192;
+        pData = m_fileData.getCacheData(offset, wanted, achBuf, len);
+        if (wanted <= 0)
+            return LS_FAIL;
+        pBuf->append(pData, wanted);
+        offset += wanted;
+    }
+    return LS_OK;
+}
+
+
+static int readWholeFile(const char *pPath, AutoBuf *pBuf)
+{
+    struct stat st;
+    int ret = LS_FAIL;
+    int fd = ls_fio_open(pPath, O_RDONLY, 0);
+    if (fd == -1)
+        return LS_FAIL;
+    if (fstat(fd, &st) == 0 && pBuf->guarantee(st.st_size) != -1
+        && pread(fd, pBuf->end(), st.st_size, 0) == st.st_size)
+    {
+        pBuf->used(st.st_size);
+        ret = LS_OK;
+    }
+    close(fd);
+    return ret;
+}
+
+
+static int writeWholeFile(const char *pPath, const char *pBuf, int len)
+{
+    char achFileName[4096];
+    snprintf(achFileName, 4096, "%s.XXXXXX", pPath);
+    int fd = mkstemp(achFileName);
+    if (fd == -1)
+        return LS_FAIL;
+    if (ls_fio_write(fd, pBuf, len) != len)
+    {
+        close(fd);
+        unlink(achFileName);
+        return LS_FAIL;
+    }
+    close(fd);
+    rename(achFileName, pPath);
+    return LS_OK;
+}
+
+
+/**
+ * The dictionaries and deltas of a file sit next to its compressed copies,
+ * named after the SHA-256 of the dictionary.
+ */
+void StaticFileCacheData::buildDictPath(char *pBuf, int size,
+                                        const unsigned char *pHash,
+                                        const char *pSuffix) const
+{
+    char achHex[SFCD_DICT_HASH_LEN * 2 + 1];
+    if (!pHash)
+    {
+        snprintf(pBuf, size, "%.*s.%s", m_gzippedPath.len(),
+                 m_gzippedPath.c_str(), pSuffix);
+        return;
+    }
+    StringTool::hexEncode((const char *)pHash, SFCD_DICT_HASH_LEN, achHex);
+    snprintf(pBuf, size, "%.*s.%s.%s", m_gzippedPath.len(),
+             m_gzippedPath.c_str(), achHex, pSuffix);
+}
+
+
+/**
+ * Only the dictionaries of the current and the previous version of the
+ * file are kept, with the delta against the previous one.
+ */
+void StaticFileCacheData::pruneDictionaries(const unsigned char *pCurHash,
+                                            const unsigned char *pPrevHash)
+{
+    char achCur[SFCD_DICT_HASH_LEN * 2 + 1];
+    char achPrev[SFCD_DICT_HASH_LEN * 2 + 1];
+    char achPath[4096];
+    const char *pBase = strrchr(m_gzippedPath.c_str(), '/');
+    if (!pBase)
+        return;
+    int dirLen = pBase - m_gzippedPath.c_str();
+    int baseLen = m_gzippedPath.len() - dirLen - 1;
+    ++pBase;
+    snprintf(achPath, sizeof(achPath), "%.*s", dirLen, m_gzippedPath.c_str());
+    DIR *pDir = opendir(achPath);
+    if (!pDir)
+        return;
+    StringTool::hexEncode((const char *)pCurHash, SFCD_DICT_HASH_LEN, achCur);
+    if (pPrevHash)
+        StringTool::hexEncode((const char *)pPrevHash, SFCD_DICT_HASH_LEN,
+                              achPrev);
+
+    struct dirent *pEntry;
+    while ((pEntry = readdir(pDir)) != NULL)
+    {
+        //"<name>.<hex>.lsd" or "<name>.<hex>.dcz"
+        const char *pName = pEntry->d_name;
+        if ((strlen(pName) != (size_t)baseLen + SFCD_DICT_HASH_LEN * 2 + 5)
+            || (strncmp(pName, pBase, baseLen) != 0)
+            || (pName[baseLen] != '.'))
+            continue;
+        const char *pHex = pName + baseLen + 1;
+        const char *pSuffix = pHex + SFCD_DICT_HASH_LEN * 2;
+        int isPrev = pPrevHash
+                     && (strncmp(pHex, achPrev, SFCD_DICT_HASH_LEN * 2) == 0);
+        if (strcmp(pSuffix, ".lsd") == 0)
+        {
+            if (isPrev || (strncmp(pHex, achCur, SFCD_DICT_HASH_LEN * 2) == 0))
+                continue;
+        }
+        else if ((strcmp(pSuffix, ".dcz") != 0) || isPrev)
+            continue;
+        snprintf(achPath, sizeof(achPath), "%.*s/%s", dirLen,
+                 m_gzippedPath.c_str(), pName);
+        LS_DBG_H("Remove stale dictionary file %s.", achPath);
+        unlink(achPath);
+    }
+    closedir(pDir);
+}
+
+
+/**
+ * Hash the file and keep a copy of it as a dictionary. "<name>.lsd" records
+ * the hashes of the current and the previous dictionary, its mtime is the
+ * mtime of the file version it was created for.
+ */
+int StaticFileCacheData::saveDictionary(const char *pIndexPath)
+{
+    unsigned char achHashes[SFCD_DICT_HASH_LEN * 2];
+    char achPath[4096];
+    struct stat st;
+    AutoBuf buf(0);
+    AutoBuf index(0);
+    if (readFileContent(&buf) == LS_FAIL)
+        return LS_FAIL;
+    SHA256((const unsigned char *)buf.begin(), buf.size(), achHashes);
+
+    buildDictPath(achPath, sizeof(achPath), achHashes, "lsd");
+    if ((ls_fio_stat(achPath, &st) == -1)
+        && (writeWholeFile(achPath, buf.begin(), buf.size()) == LS_FAIL))
+        return LS_FAIL;
+
+    int hasPrev = 0;
+    if ((readWholeFile(pIndexPath, &index) == LS_OK)
+        && (index.size() == SFCD_DICT_HASH_LEN * 2))
+    {
+        //the previous dictionary stays the same if the content did not change
+        const char *pPrev = index.begin();
+        if (memcmp(pPrev, achHashes, SFCD_DICT_HASH_LEN) == 0)
+            pPrev += SFCD_DICT_HASH_LEN;
+        memcpy(achHashes + SFCD_DICT_HASH_LEN, pPrev, SFCD_DICT_HASH_LEN);
+        hasPrev = (memcmp(achHashes, achHashes + SFCD_DICT_HASH_LEN,
+                          SFCD_DICT_HASH_LEN) != 0);
+    }
+    if (!hasPrev)
+        memcpy(achHashes + SFCD_DICT_HASH_LEN, achHashes, SFCD_DICT_HASH_LEN);
+    if (writeWholeFile(pIndexPath, (const char *)achHashes,
+                       sizeof(achHashes)) == LS_FAIL)
+        return LS_FAIL;
+
+    struct utimbuf utmbuf;
+    utmbuf.actime = m_fileData.getLastMod();
+    utmbuf.modtime = m_fileData.getLastMod();
+    utime(pIndexPath, &utmbuf);
+
+    pruneDictionaries(achHashes,
+                      hasPrev ? achHashes + SFCD_DICT_HASH_LEN : NULL);
+    return LS_OK;
+}
+
+
+/**
+ * Like the deltas, dictionaries are saved in another process, the file is
+ * not offered as a dictionary until then.
+ */
+int StaticFileCacheData::trySaveDictionary(char *pIndexPath)
+{
+    char *p = pIndexPath + strlen(pIndexPath);
+    int fd = createLockFile(pIndexPath, p);
+    if (fd == -1)
+        return LS_FAIL;
+    close(fd);
+
+    LS_DBG_H("To save dictionary of file %s in another process.",
+             m_real.c_str());
+    int forkResult;
+    forkResult = fork();
+    if (forkResult)   //error or parent process
+        return LS_FAIL;
+    //child process
+    setpriority(PRIO_PROCESS, 0, 5);
+
+    if (saveDictionary(pIndexPath) == LS_FAIL)
+        LS_WARN("Failed to save dictionary of file %s!", m_real.c_str());
+    *p = 'l';
+    unlink(pIndexPath);
+    *p = 0;
+    _exit(1);
+}
+
+
+/**
+ * Offer the file as the dictionary its next version is encoded against,
+ * once its copy has been saved for this version of the file.
+ */
+int StaticFileCacheData::readyDictionary()
+{
+    if (m_iDictState)
+        return (m_iDictState > 0) ? LS_OK : LS_FAIL;
+
+    off_t size = getFileSize();
+    if (!s_iDictCompress || (size > s_iMaxFileSize) || (size < s_iMinFileSize)
+        || !m_pMimeType || !m_pMimeType->getExpires()->compressible()
+        || ((!m_zstdPath.c_str() || !*m_zstdPath.c_str())
+            && (buildCompressedPaths() == -1)))
+    {
+        m_iDictState = -1;
+        return LS_FAIL;
+    }
+
+    char achPath[4096];
+    struct stat st;
+    AutoBuf index(0);
+    buildDictPath(achPath, sizeof(achPath), NULL, "lsd");
+    if ((ls_fio_stat(achPath, &st) == 0) && (st.st_mtime == getLastMod())
+        && (readWholeFile(achPath, &index) == LS_OK)
+        && (index.size() == SFCD_DICT_HASH_LEN * 2))
+    {
+        memcpy(m_achDictHash, index.begin(), SFCD_DICT_HASH_LEN);
+        m_iDictState = 1;
+        return LS_OK;
+    }
+    trySaveDictionary(achPath);
+    return LS_FAIL;
+}
+
+
+#ifdef USE_ZSTD
+//A dcz body starts with a skippable zstd frame holding the dictionary hash
+static const char s_achDczHeader[8] = { 0x5e, 0x2a, 0x4d, 0x18, 0x20, 0, 0, 0 };
+
+
+int StaticFileCacheData::compressDelta(const unsigned char *pHash,
+                                       const char *pDeltaPath)
+{
+    char achPath[4096];
+    AutoBuf dict(0);
+    AutoBuf body(0);
+    buildDictPath(achPath, sizeof(achPath), pHash, "lsd");
+    if ((readWholeFile(achPath, &dict) == LS_FAIL)
+        || (readFileContent(&body) == LS_FAIL))
+        return LS_FAIL;
+
+    ZstdBuf zstdBuf;
+    VMemBuf compressBuf;
+    zstdBuf.setDictionary(dict.begin(), dict.size());
+    if ((compressBuf.set(VMBUF_ANON_MAP, 8192) == LS_FAIL)
+        || (zstdBuf.init(Compressor::COMPRESSOR_COMPRESS,
+                         s_iZstdCompressLevel) != 0))
+        return LS_FAIL;
+    zstdBuf.setCompressCache(&compressBuf);
+    if (zstdBuf.beginStream()
+        || (zstdBuf.write(body.begin(), body.size()) == LS_FAIL)
+        || (zstdBuf.endStream() != 0))
+        return LS_FAIL;
+
+    snprintf(achPath, 4096, "%s.XXXXXX", pDeltaPath);
+    int fd = mkstemp(achPath);
+    if (fd == -1)
+        return LS_FAIL;
+    if ((ls_fio_write(fd, s_achDczHeader, sizeof(s_achDczHeader))
+         != sizeof(s_achDczHeader))
+        || (ls_fio_write(fd, pHash, SFCD_DICT_HASH_LEN) != SFCD_DICT_HASH_LEN)
+        || (compressBuf.writeToFile(fd) != 0))
+    {
+        close(fd);
+        unlink(achPath);
+        return LS_FAIL;
+    }
+    off_t size = lseek(fd, (size_t)0, SEEK_CUR);
+    close(fd);
+    rename(achPath, pDeltaPath);
+
+    struct utimbuf utmbuf;
+    utmbuf.actime = m_fileData.getLastMod();
+    utmbuf.modtime = m_fileData.getLastMod();
+    utime(pDeltaPath, &utmbuf);
+    return size;
+}
+
+
+/**
+ * Deltas are always built in another process, the file is sent with the
+ * other encodings until the delta is ready.
+ */
+int StaticFileCacheData::tryCreateDelta(const unsigned char *pHash,
+                                        char *pDeltaPath)
+{
+    char *p = pDeltaPath + strlen(pDeltaPath);
+    int fd = createLockFile(pDeltaPath, p);
+    if (fd == -1)
+        return LS_FAIL;
+    close(fd);
+
+    LS_DBG_H("To create dcz delta %s of file %s in another process.",
+             pDeltaPath, m_real.c_str());
+    int forkResult;
+    forkResult = fork();
+    if (forkResult)   //error or parent process
+        return LS_FAIL;
+    //child process
+    setpriority(PRIO_PROCESS, 0, 5);
+
+    if (compressDelta(pHash, pDeltaPath) == -1)
+        LS_WARN("Failed to create dcz delta of file %s!", m_real.c_str());
+    *p = 'l';
+    unlink(pDeltaPath);
+    *p = 0;
+    _exit(1);
+}
+#endif
+
+
+/**
+ * pAvailDict is the Available-Dictionary header, a structured field byte
+ * sequence ":<base64 of the SHA-256>:". Return the delta against it when
+ * ready, NULL to send the file with the other encodings.
+ */
+FileCacheDataEx *StaticFileCacheData::readyDelta(const char *pAvailDict,
+                                                 int len)
+{
+#ifdef USE_ZSTD
+    unsigned char achHash[SFCD_DICT_HASH_LEN + 4];
+    char achPath[4096];
+    struct stat st;
+
+    if ((len != 46) || (*pAvailDict != ':') || (pAvailDict[len - 1] != ':')
+        || (ls_base64_decode(pAvailDict + 1, len - 2, (char *)achHash)
+            != SFCD_DICT_HASH_LEN))
+        return NULL;
+    if ((readyDictionary() == LS_FAIL)
+        || (memcmp(achHash, m_achDictHash, SFCD_DICT_HASH_LEN) == 0))
+        return NULL;
+
+    buildDictPath(achPath, sizeof(achPath), achHash, "dcz");
+    if (m_pDcz && (memcmp(achHash, m_achDczHash, SFCD_DICT_HASH_LEN) == 0))
+    {
+        if ((m_pDcz->isCached() || (m_pDcz->getfd() != -1))
+            || (m_pDcz->readyData(achPath) == 0))
+            return m_pDcz;
+        return NULL;
+    }
+
+    if ((ls_fio_stat(achPath, &st) == 0) && (st.st_mtime == getLastMod()))
+    {
+        //Only one delta is kept open, the one being sent stays
+        if (m_pDcz && m_pDcz->getRef() > 0)
+            return NULL;
+        if (buildCompressedCache(m_pDcz, st) == LS_FAIL)
+            return NULL;
+        memcpy(m_achDczHash, achHash, SFCD_DICT_HASH_LEN);
+        if (m_pDcz->readyData(achPath) != 0)
+            return NULL;
+        return m_pDcz;
+    }
+
+    //Only a dictionary handed out for this file is used
+    buildDictPath(achPath, sizeof(achPath), achHash, "lsd");
+    if (ls_fio_stat(achPath, &st) == -1)
+        return NULL;
+    buildDictPath(achPath, sizeof(achPath), achHash, "dcz");
+    tryCreateDelta(achHash, achPath);
+#endif
+    return NULL;
+}
+
+
 int StaticFileCacheData::release()
 {
     m_fileData.release();
@@ -933,6 +1574,10 @@ int StaticFileCacheData::release()
         m_pGzip->release();
     if (m_pBrotli)
         m_pBrotli->release();
+    if (m_pZstd)
+        m_pZstd->release();
+    if (m_pDcz)
+        m_pDcz->release();
     return 0;
 }
 
@@ -953,7 +1598,31 @@ void StaticFileCacheData::setCompressCachePath(const char *pPath)
 }
 
 
+const char *StaticFileCacheData::getCompressCachePath()
+{
+    return s_compressCachePath;
+}
+
+
 void StaticFileCacheData::setStaticBrOptions(int level)
 {
     s_iBrCompressLevel = level;
 }
+
+
+void StaticFileCacheData::setStaticZstdOptions(int level)
+{
+    s_iZstdCompressLevel = level;
+}
+
+
+void StaticFileCacheData::setStaticDictOptions(int enable)
+{
+    s_iDictCompress = enable;
+}
+
+
+void StaticFileCacheData::setPrecompress(int enable)
+{
+    s_iPrecompress = enable;
+}
@@ -32,6 +32,7 @@
 #define  DEFAULT_TOTAL_INMEM_CACHE (1024 * 1024 * 20)     // 20M
 #define  DEFAULT_TOTAL_MMAP_CACHE  (1024 * 1024 * 20)     // 20M
 
+class AutoBuf;
 class HttpReq;
 class StaticFileCacheData;
 class MimeSetting;
@@ -115,12 +116,17 @@ public:
 
 #define SFCD_MODE_GZIP      (1<<0)
 #define SFCD_MODE_BROTLI    (1<<1)
+#define SFCD_MODE_ZSTD      (1<<2)
+
+#define SFCD_DICT_HASH_LEN  32      //SHA-256 of a dictionary
+#define SFCD_DCZ_ETAG_HASH_LEN  8   //Bytes of it in the ETag of a dcz delta
 
 class StaticFileCacheData : public CacheElement
 {
     AutoStr2        m_real;
     AutoStr2        m_gzippedPath;
     AutoStr2        m_bredPath;
+    AutoStr2        m_zstdPath;
     AutoStr2        m_sHeaders;
 
     const MimeSetting *m_pMimeType;
@@ -142,6 +148,11 @@ class StaticFileCacheData : public CacheElement
     time_t          m_tmLastCheck;
     FileCacheDataEx *m_pGzip;
     FileCacheDataEx *m_pBrotli;
+    FileCacheDataEx *m_pZstd;
+    FileCacheDataEx *m_pDcz;
+    char            m_iDictState;
+    unsigned char   m_achDictHash[SFCD_DICT_HASH_LEN];
+    unsigned char   m_achDczHash[SFCD_DICT_HASH_LEN];
     FileCacheDataEx m_fileData;
 
     StaticFileCacheData(const StaticFileCacheData &rhs);
@@ -149,14 +160,25 @@ class StaticFileCacheData : public CacheElement
 
     int buildFixedHeaders(int etag);
     int buildCompressedCache(FileCacheDataEx *&pData, const struct stat &st);
-    int tryCreateCompressed(char useBrotli);
+    int tryCreateCompressed(char compressMode);
+    AutoStr2 *getCompressedPath(char compressMode);
 
     int buildCompressedPaths();
     int detectTrancate();
 
     int setReadiedCompressData(char compressMode);
     int compressHelper(AutoStr2 &path, FileCacheDataEx *&pData,
-        struct stat &st, int exists, char isBrotli);
+        struct stat &st, int exists, char compressMode);
+
+    int readFileContent(AutoBuf *pBuf);
+    void buildDictPath(char *pBuf, int size, const unsigned char *pHash,
+                       const char *pSuffix) const;
+    void pruneDictionaries(const unsigned char *pCurHash,
+                           const unsigned char *pPrevHash);
+    int saveDictionary(const char *pIndexPath);
+    int trySaveDictionary(char *pIndexPath);
+    int tryCreateDelta(const unsigned char *pHash, char *pDeltaPath);
+    int compressDelta(const unsigned char *pHash, const char *pDeltaPath);
 public:
 
     int readyCompressed(char compressMode);
@@ -181,6 +203,7 @@ public:
 
     FileCacheDataEx *getGzip() const    {   return m_pGzip;             }
     FileCacheDataEx *getBrotli() const  {   return m_pBrotli;           }
+    FileCacheDataEx *getZstd() const    {   return m_pZstd;             }
     const FileCacheDataEx *getFileData() const {   return &m_fileData;  }
     FileCacheDataEx *getFileData()      {   return &m_fileData;         }
 
@@ -196,6 +219,7 @@ public:
     void setBypassModsec(int v)         { m_bypassModsec = v; }
 
     int testMod(HttpReq *pReq);
+    int isDczETag(const char *pETag, int len) const;
     int testUnMod(HttpReq *pReq);
     int testIfRange(const char *pIR, int len);
     int release();
@@ -210,7 +234,17 @@ public:
         return (pMIME != m_pMimeType) || (pCharset != m_pCharset)
                || (m_iFileETag != etag);
     }
-    int compressFile(char useBrotli);
+    int compressFile(char compressMode);
+
+    /**
+     * Compression Dictionary Transport. The file is offered to the client
+     * as a dictionary for its next version, which is then sent as a dcz
+     * delta against the version the client has.
+     */
+    int readyDictionary();
+    FileCacheDataEx *readyDelta(const char *pAvailDict, int len);
+    FileCacheDataEx *getDcz() const     {   return m_pDcz;              }
+    const unsigned char *getDczHash() const {   return m_achDczHash;    }
 
     int buildHeaders(const MimeSetting *pMIME,
                      const AutoStr2 *pCharset, short etag);
@@ -223,8 +257,30 @@ public:
     static void setUpdateStaticGzipFile(int enable, int level,
                                         size_t min, size_t max);
     static void setCompressCachePath(const char *pPath);
+    static const char *getCompressCachePath();
 
     static void setStaticBrOptions(int level);
+    static void setStaticZstdOptions(int level);
+    static void setStaticDictOptions(int enable);
+
+    /**
+     * With precompression the variants are built by StaticPrecompressor
+     * only, a missing or stale variant is not created on request.
+     */
+    static void setPrecompress(int enable);
+    static char getPrecompressModes();
+    static int  isPrecompressSize(off_t size);
+    static const char *getCompressedSuffix(char compressMode);
+
+    // Build the variant path of a file without the suffix, return its length.
+    static int  buildCompressedBasePath(const char *pReal, int len,
+                                        char *pBuf, int size);
+
+    // Compress size bytes of fd to pPath, return the compressed size,
+    // LS_FAIL on error or if it is not under maxSize.
+    static off_t compressFd(int fd, off_t size, time_t mtime,
+                            char compressMode, const char *pPath,
+                            off_t maxSize);
 };
 
 #endif
@@ -117,6 +117,25 @@ inline int buildStaticFileHeaders(HttpResp *pResp, HttpReq *pReq,
 }
 
 
+//A 304 for a dcz delta keeps the ETag of the delta the client has
+static void addDczETag(HttpReq *pReq, HttpResp *pResp,
+                       StaticFileCacheData *pData)
+{
+    if (!pReq->isHeaderSet(HttpHeader::H_IF_NO_MATCH))
+        return;
+    const char *pNonMatch = pReq->getHeader(HttpHeader::H_IF_NO_MATCH);
+    int len = pReq->getHeaderLen(HttpHeader::H_IF_NO_MATCH);
+    if (*pNonMatch == 'W')
+    {
+        len -= 2;
+        pNonMatch += 2;
+    }
+    if (pData->isDczETag(pNonMatch, len))
+        pResp->getRespHeaders().add(HttpRespHeaders::H_ETAG, "ETag", 4,
+                                    pNonMatch, len, LSI_HEADER_SET);
+}
+
+
 #define FLV_MIME "video/x-flv"
 #define FLV_HEADER "FLV\x1\x1\0\0\0\x9\0\0\0\x9"
 #define FLV_HEADER_LEN (sizeof(FLV_HEADER)-1)
@@ -385,6 +404,40 @@ static int processRange(HttpSession *pSession, HttpReq *pReq,
                         const char *pRange);
 
 
+/**
+ * Offer the file as a dictionary for the later versions of the same URL,
+ * the query string is left out of the match so a versioned URL matches.
+ */
+static void addDictHeaders(HttpReq *pReq, HttpResp *pResp,
+                           const unsigned char *pDczHash)
+{
+    char achMatch[1024];
+    const char *pURL = pReq->getOrgReqURL();
+    int len = pReq->getOrgReqURLLen();
+    const char *p = (const char *)memchr(pURL, '?', len);
+    if (p)
+        len = p - pURL;
+
+    if (pDczHash)
+    {
+        pResp->addDczEncodingHeader(pDczHash);
+        pReq->orZstd(UPSTREAM_ZSTD);
+    }
+    else
+        pResp->getRespHeaders().add(HttpRespHeaders::H_VARY, "Vary", 4,
+                                    "Available-Dictionary", 20,
+                                    LSI_HEADER_MERGE);
+    if (len <= 0 || *pURL != '/' || len > (int)sizeof(achMatch) - 10)
+        return;
+    //Characters with a meaning in a URL pattern are not escaped, skip it
+    for (p = pURL; p < pURL + len; ++p)
+        if (strchr("*+:(){}\\\"", *p))
+            return;
+    len = snprintf(achMatch, sizeof(achMatch), "match=\"%.*s\"", len, pURL);
+    pResp->getRespHeaders().add("Use-As-Dictionary", 17, achMatch, len);
+}
+
+
 ////////////////////////////////////////////////////////////
 //      Internal functions end
 ////////////////////////////////////////////////////////////
@@ -521,8 +574,12 @@ int StaticFileHandler::process(HttpSession *pSession,
     }
 
     char mode = 0;
+    int useDict = 0;
+    FileCacheDataEx *pDelta = NULL;
     if ((pReq->gzipAcceptable() == GZIP_REQUIRED
-         || pReq->brAcceptable() == BR_REQUIRED)
+         || pReq->brAcceptable() == BR_REQUIRED
+         || pReq->zstdAcceptable() == ZSTD_REQUIRED
+         || pReq->dczAcceptable() == DCZ_REQUIRED)
         && ((pSession->getSessionHooks()->getFlag(LSI_HKPT_RECV_RESP_BODY)
              | pSession->getSessionHooks()->getFlag(LSI_HKPT_SEND_RESP_BODY))
             & LSI_FLAG_DECOMPRESS_REQUIRED) == 0)
@@ -530,8 +587,26 @@ int StaticFileHandler::process(HttpSession *pSession,
         mode = (pReq->brAcceptable() == BR_REQUIRED ? SFCD_MODE_BROTLI : 0);
         if (pReq->gzipAcceptable() == GZIP_REQUIRED)
             mode |= SFCD_MODE_GZIP;
+        //An SSI include goes into the dynamic body, which may be gzipped
+        if (pReq->zstdAcceptable() == ZSTD_REQUIRED && !isSSI)
+            mode |= SFCD_MODE_ZSTD;
+        if (pReq->dczAcceptable() == DCZ_REQUIRED && !isSSI && code == SC_200)
+            useDict = (pCache->readyDictionary() == LS_OK);
+    }
+    if (useDict)
+    {
+        int len;
+        const char *pAvail = pReq->getHeader("Available-Dictionary", 20, len);
+        if (pAvail)
+            pDelta = pCache->readyDelta(pAvail, len);
     }
-    ret = pInfo->readyCacheData(mode);
+    if (pDelta)
+    {
+        pInfo->setECache(pDelta);
+        ret = 0;
+    }
+    else
+        ret = pInfo->readyCacheData(mode);
     LS_DBG_L(pReq->getLogSession(), "readyCacheData(%d) return %d",
              mode, ret);
     FileCacheDataEx *pECache = pInfo->getECache();
@@ -553,6 +628,7 @@ int StaticFileHandler::process(HttpSession *pSession,
             case SC_304:
                 pResp->parseAdd(pCache->getHeaderBuf(),
                                 pCache->getETagHeaderLen());
+                addDczETag(pReq, pResp, pCache);
                 break;
             case SC_200:
                 {
@@ -567,6 +643,11 @@ int StaticFileHandler::process(HttpSession *pSession,
             default:
 
                 buildStaticFileHeaders(pResp, pReq, pInfo);
+                if (pECache == pCache->getZstd())
+                {
+                    pResp->addZstdEncodingHeader();
+                    pReq->orZstd(UPSTREAM_ZSTD);
+                }
                 if (pECache == pCache->getBrotli())
                 {
                     pResp->addBrotliEncodingHeader();
@@ -577,6 +658,9 @@ int StaticFileHandler::process(HttpSession *pSession,
                     pResp->addGzipEncodingHeader();
                     pReq->orGzip(UPSTREAM_GZIP);
                 }
+                if (useDict)
+                    addDictHeaders(pReq, pResp, (pECache == pDelta)
+                                   ? pCache->getDczHash() : NULL);
                 pSession->setSendFileBeginEnd(0, pInfo->getECache()->getFileSize());
             }
         } //Xuedong Add for SSI Start
@@ -817,6 +901,7 @@ static int processRange(HttpSession *pSession, HttpReq *pReq,
         pReq->setRange(range);
         pReq->andGzip(~GZIP_ENABLED);
         pReq->andBr(~BR_ENABLED);
+        pReq->andZstd(~ZSTD_ENABLED);
 
         ret = pData->readyCacheData(0);
         if (!ret)
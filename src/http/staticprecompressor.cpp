@@ -0,0 +1,637 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2022  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+#include "staticprecompressor.h"
+
+#if defined(linux) || defined(__linux) || defined(__linux__) || defined(__gnu_linux__)
+
+#include <edio/multiplexer.h>
+#include <edio/multiplexerfactory.h>
+#include <http/contexttree.h>
+#include <http/httpcontext.h>
+#include <http/httpmime.h>
+#include <http/httpvhost.h>
+#include <http/staticfilecachedata.h>
+#include <log4cxx/logger.h>
+#include <lsr/ls_atomic.h>
+#include <lsr/ls_fileio.h>
+#include <lsr/ls_offload.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PRECOMPRESS_WATCH_MASK  (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM \
+                                 | IN_DELETE | IN_CREATE | IN_MOVE_SELF \
+                                 | IN_ONLYDIR)
+
+LS_SINGLETON(StaticPrecompressor);
+
+enum
+{
+    PT_MEASURE,
+    PT_SCAN,
+    PT_FILE,
+};
+
+
+struct PrecompressRoot
+{
+    AutoStr2                m_path;
+    const HttpVHost        *m_pVHost;
+};
+
+
+/**
+ * Mapped before the workers are forked, so the others know whether the
+ * one watching the roots is there to compress their files.
+ */
+struct PrecompressShared
+{
+    pid_t                   m_pidWatcher;
+    int                     m_iWatchFull;
+    int                     m_iDiskFull;
+};
+
+//Not shared, if the workers can not map it
+static PrecompressShared s_unshared;
+
+
+struct PrecompressTask
+{
+    ls_offload              m_task;
+    int                     m_iType;
+    int                     m_iCompressed;
+    AutoStr2                m_path;
+    TPointerList<AutoStr2>  m_subDirs;
+
+    ~PrecompressTask()
+    {   m_subDirs.release_objects();    }
+};
+
+
+struct ls_offload_api StaticPrecompressor::s_api =
+{
+    StaticPrecompressor::perform,
+    StaticPrecompressor::releaseTask,
+    StaticPrecompressor::onTaskDoneCb
+};
+
+
+StaticPrecompressor::StaticPrecompressor()
+    : m_pOffloader(NULL)
+    , m_iEnabled(0)
+    , m_iWorkers(1)
+    , m_pShared(NULL)
+    , m_iDiskFullLogged(0)
+    , m_lMaxDisk(0)
+    , m_lDiskUsed(0)
+{
+    void *p = mmap(NULL, sizeof(PrecompressShared), PROT_READ | PROT_WRITE,
+                   MAP_ANON | MAP_SHARED, -1, 0);
+    m_pShared = (p != MAP_FAILED) ? (PrecompressShared *)p : &s_unshared;
+    memset(m_pShared, 0, sizeof(PrecompressShared));
+}
+
+
+StaticPrecompressor::~StaticPrecompressor()
+{
+    m_roots.release_objects();
+    m_dirs.release_objects();
+    if (m_pShared != &s_unshared)
+        munmap(m_pShared, sizeof(PrecompressShared));
+}
+
+
+void StaticPrecompressor::setOptions(int enable, int workers, long maxDiskMB)
+{
+    m_iEnabled = enable;
+    m_iWorkers = (workers < 1) ? 1 : workers;
+    m_lMaxDisk = (int64_t)maxDiskMB << 20;
+    StaticFileCacheData::setPrecompress(enable);
+}
+
+
+void StaticPrecompressor::addRoot(const HttpVHost *pVHost)
+{
+    const AutoStr2 *pDocRoot = pVHost->getDocRoot();
+    PrecompressRoot *pRoot;
+    if (!pDocRoot || pDocRoot->len() <= 0)
+        return;
+    //vhosts sharing a document root each keep their own settings
+    pRoot = new PrecompressRoot;
+    pRoot->m_pVHost = pVHost;
+    pRoot->m_path.setStr(pDocRoot->c_str(), pDocRoot->len());
+    if (pDocRoot->c_str()[pDocRoot->len() - 1] != '/')
+        pRoot->m_path.append("/", 1);
+    m_roots.push_back(pRoot);
+}
+
+
+/**
+ * The encodings enabled by the vhosts serving the file, for a MIME type
+ * compressible in the context of the file. Called from the offloader
+ * threads too, the roots do not change once the watches are started.
+ */
+char StaticPrecompressor::getModes(const char *pPath, int len) const
+{
+    const PrecompressRoot *pRoot;
+    const HttpVHost *pVHost;
+    const HttpContext *pContext;
+    const MimeSetting *pMime;
+    const char *pSuffix;
+    char achURI[4096];
+    char modes = 0;
+    char vhModes;
+    int rootLen;
+
+    pSuffix = (const char *)memrchr(pPath, '.', len);
+    if (!pSuffix || memchr(pSuffix, '/', pPath + len - pSuffix))
+        pSuffix = NULL;
+    else
+        ++pSuffix;
+    for (int i = 0; i < m_roots.size(); ++i)
+    {
+        pRoot = m_roots[i];
+        pVHost = pRoot->m_pVHost;
+        rootLen = pRoot->m_path.len();
+        if (rootLen > len || len - rootLen + 1 >= (int)sizeof(achURI)
+            || strncmp(pPath, pRoot->m_path.c_str(), rootLen) != 0)
+            continue;
+        vhModes = (pVHost->enableGzip() ? SFCD_MODE_GZIP : 0)
+                  | (pVHost->enableBr() ? SFCD_MODE_BROTLI : 0)
+                  | (pVHost->enableZstd() ? SFCD_MODE_ZSTD : 0);
+        if (!(vhModes & ~modes))
+            continue;
+        //The matching writes into the URI
+        memcpy(achURI, pPath + rootLen - 1, len - rootLen + 1);
+        achURI[len - rootLen + 1] = 0;
+        pContext = pVHost->getContextTree()->bestMatch(achURI,
+                                                       len - rootLen + 1);
+        if (!pContext)
+            pContext = &pVHost->getRootContext();
+        pMime = pContext->determineMime(pSuffix, NULL);
+        if (pMime && pMime->getExpires()->compressible())
+            modes |= vhModes;
+    }
+    return modes & StaticFileCacheData::getPrecompressModes();
+}
+
+
+/**
+ * The variants of a file are left to the watching worker only while it is
+ * alive and has watched and compressed everything so far, otherwise the
+ * request path compresses the file like one outside the roots.
+ */
+int StaticPrecompressor::isCovering() const
+{
+    pid_t pid = ls_atomic_value(&m_pShared->m_pidWatcher);
+    if (pid <= 0 || ls_atomic_value(&m_pShared->m_iWatchFull)
+        || ls_atomic_value(&m_pShared->m_iDiskFull))
+        return 0;
+    return (pid == getpid()) || (kill(pid, 0) == 0) || (errno == EPERM);
+}
+
+
+int StaticPrecompressor::start()
+{
+    int fd;
+    if (!m_iEnabled || m_pOffloader)
+        return LS_OK;
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd == -1)
+    {
+        LS_ERROR("[PRECOMPRESS] inotify_init1() failed: %s, static files "
+                 "are not compressed.", strerror(errno));
+        return LS_FAIL;
+    }
+    m_pOffloader = offloader_new2("PRECOMPRESS", m_iWorkers, 1, m_iWorkers,
+                                  10);
+    if (!m_pOffloader)
+    {
+        close(fd);
+        LS_ERROR("[PRECOMPRESS] Failed to start offloader, static files "
+                 "are not compressed.");
+        return LS_FAIL;
+    }
+    setfd(fd);
+    MultiplexerFactory::getMultiplexer()->add(this, POLLIN | POLLHUP | POLLERR);
+    //A restarted watcher measures and scans everything again
+    ls_atomic_set(&m_pShared->m_iWatchFull, 0);
+    ls_atomic_set(&m_pShared->m_iDiskFull, 0);
+    ls_atomic_set(&m_pShared->m_pidWatcher, getpid());
+    LS_NOTICE("[PRECOMPRESS] Watch %d document roots.",
+              (int)m_roots.size());
+    //The roots are scanned once the disk usage is known
+    return enqueue(PT_MEASURE, StaticFileCacheData::getCompressCachePath(),
+                   strlen(StaticFileCacheData::getCompressCachePath()));
+}
+
+
+int StaticPrecompressor::addWatch(const char *pDir, int len)
+{
+    int wd = inotify_add_watch(getfd(), pDir, PRECOMPRESS_WATCH_MASK);
+    if (wd == -1)
+    {
+        if (errno == ENOSPC && !m_pShared->m_iWatchFull)
+        {
+            ls_atomic_set(&m_pShared->m_iWatchFull, 1);
+            LS_WARN("[PRECOMPRESS] Out of inotify watches at %s, raise "
+                    "fs.inotify.max_user_watches.", pDir);
+        }
+        return LS_FAIL;
+    }
+    while (m_dirs.size() <= wd)
+        m_dirs.push_back((AutoStr2 *)NULL);
+    //Same directory, or a link to it
+    if (m_dirs[wd])
+        return 0;
+    m_dirs[wd] = new AutoStr2(pDir, len);
+    return 1;
+}
+
+
+void StaticPrecompressor::removeWatch(int wd)
+{
+    if (wd < 0 || wd >= m_dirs.size() || !m_dirs[wd])
+        return;
+    delete m_dirs[wd];
+    m_dirs[wd] = NULL;
+}
+
+
+void StaticPrecompressor::removeTree(const char *pDir, int len)
+{
+    AutoStr2 dir(pDir, len);
+    for (int wd = 0; wd < m_dirs.size(); ++wd)
+    {
+        if (m_dirs[wd] && m_dirs[wd]->len() >= len
+            && strncmp(m_dirs[wd]->c_str(), dir.c_str(), len) == 0)
+        {
+            inotify_rm_watch(getfd(), wd);
+            removeWatch(wd);
+        }
+    }
+}
+
+
+int StaticPrecompressor::handleEvents(short event)
+{
+    char achBuf[8192]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    int len;
+    if (!(event & POLLIN))
+        return 0;
+    while ((len = read(getfd(), achBuf, sizeof(achBuf))) > 0)
+        processEvents(achBuf, len);
+    return 0;
+}
+
+
+void StaticPrecompressor::processEvents(const char *pBuf, int len)
+{
+    const struct inotify_event *pEvent;
+    const char *pEnd = pBuf + len;
+    const AutoStr2 *pDir;
+    char achPath[4096];
+    int n;
+
+    for (; pBuf < pEnd; pBuf += sizeof(*pEvent) + pEvent->len)
+    {
+        pEvent = (const struct inotify_event *)pBuf;
+        if (pEvent->mask & IN_Q_OVERFLOW)
+        {
+            LS_NOTICE("[PRECOMPRESS] inotify queue overflow, rescan.");
+            for (n = 0; n < m_dirs.size(); ++n)
+                if (m_dirs[n])
+                    enqueue(PT_SCAN, m_dirs[n]->c_str(), m_dirs[n]->len());
+            continue;
+        }
+        if (pEvent->mask & IN_IGNORED)
+        {
+            removeWatch(pEvent->wd);
+            continue;
+        }
+        if (pEvent->wd >= m_dirs.size() || !(pDir = m_dirs[pEvent->wd]))
+            continue;
+        if (pEvent->mask & IN_MOVE_SELF)
+        {
+            //The tree is watched again under its new name by the IN_MOVED_TO
+            //of the new parent.
+            removeTree(pDir->c_str(), pDir->len());
+            continue;
+        }
+        if (pEvent->len == 0)
+            continue;
+        n = snprintf(achPath, sizeof(achPath), "%s%s", pDir->c_str(),
+                     pEvent->name);
+        if (n >= (int)sizeof(achPath) - 1)
+            continue;
+        if (pEvent->mask & IN_ISDIR)
+        {
+            if (pEvent->mask & (IN_CREATE | IN_MOVED_TO))
+            {
+                achPath[n++] = '/';
+                achPath[n] = 0;
+                if (addWatch(achPath, n) == 1)
+                    enqueue(PT_SCAN, achPath, n);
+            }
+        }
+        else if (pEvent->mask & (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM
+                                 | IN_DELETE))
+            enqueue(PT_FILE, achPath, n);
+    }
+}
+
+
+int StaticPrecompressor::enqueue(int type, const char *pPath, int len)
+{
+    PrecompressTask *pTask = new PrecompressTask;
+    memset(&pTask->m_task, 0, sizeof(pTask->m_task));
+    pTask->m_task.api = &s_api;
+    pTask->m_task.param_task_done = pTask;
+    pTask->m_iType = type;
+    pTask->m_iCompressed = 0;
+    pTask->m_path.setStr(pPath, len);
+    //The task is released when it is done, or here if it fails
+    return offloader_enqueue(m_pOffloader, &pTask->m_task, NULL);
+}
+
+
+int StaticPrecompressor::perform(ls_offload *pTask)
+{
+    PrecompressTask *pPcTask = (PrecompressTask *)pTask->param_task_done;
+    StaticPrecompressor &self = getInstance();
+    switch (pPcTask->m_iType)
+    {
+    case PT_MEASURE:
+        return self.measureCache();
+    case PT_SCAN:
+        return self.scanDir(pPcTask);
+    default:
+        pPcTask->m_iCompressed = self.precompress(pPcTask->m_path.c_str(),
+                                                  pPcTask->m_path.len());
+        return LS_OK;
+    }
+}
+
+
+void StaticPrecompressor::releaseTask(ls_offload *pTask)
+{
+    if (--pTask->ref_cnt > 0)
+        return;
+    delete (PrecompressTask *)pTask->param_task_done;
+}
+
+
+void StaticPrecompressor::onTaskDoneCb(void *param)
+{
+    getInstance().onTaskDone((PrecompressTask *)param);
+}
+
+
+void StaticPrecompressor::onTaskDone(PrecompressTask *pTask)
+{
+    const AutoStr2 *pDir;
+    int i;
+    if (pTask->m_iType == PT_MEASURE)
+    {
+        LS_INFO("[PRECOMPRESS] Compressed files take %lld KB.",
+                (long long)(ls_atomic_value(&m_lDiskUsed) >> 10));
+        for (i = 0; i < m_roots.size(); ++i)
+        {
+            pDir = &m_roots[i]->m_path;
+            if (addWatch(pDir->c_str(), pDir->len()) == 1)
+                enqueue(PT_SCAN, pDir->c_str(), pDir->len());
+        }
+    }
+    else if (pTask->m_iType == PT_SCAN)
+    {
+        LS_DBG_L("[PRECOMPRESS] %s scanned, %d files compressed.",
+                 pTask->m_path.c_str(), pTask->m_iCompressed);
+        for (i = 0; i < pTask->m_subDirs.size(); ++i)
+        {
+            pDir = pTask->m_subDirs[i];
+            if (addWatch(pDir->c_str(), pDir->len()) == 1)
+                enqueue(PT_SCAN, pDir->c_str(), pDir->len());
+        }
+    }
+    else if (pTask->m_iCompressed > 0)
+        LS_DBG_L("[PRECOMPRESS] %s compressed.", pTask->m_path.c_str());
+    if (ls_atomic_value(&m_pShared->m_iDiskFull) && !m_iDiskFullLogged)
+    {
+        m_iDiskFullLogged = 1;
+        LS_NOTICE("[PRECOMPRESS] Compressed files reached the disk limit of "
+                  "%lld MB, stop compressing new files.",
+                  (long long)(m_lMaxDisk >> 20));
+    }
+}
+
+
+/**
+ * Runs in an offloader thread. The variants are in two levels of hex
+ * directories under the cache path, the delta and dictionary files of
+ * the same directories are not counted.
+ */
+int StaticPrecompressor::measureCache()
+{
+    const char *pCache = StaticFileCacheData::getCompressCachePath();
+    char achPath[4096];
+    struct dirent *pEnt;
+    struct stat st;
+    int64_t total = 0;
+    DIR *pDir;
+    int i, j, n, nameLen;
+
+    for (i = 0; i < 16; ++i)
+    {
+        for (j = 0; j < 16; ++j)
+        {
+            n = snprintf(achPath, sizeof(achPath), "%s/%x/%x/", pCache, i, j);
+            if ((pDir = opendir(achPath)) == NULL)
+                continue;
+            while ((pEnt = readdir(pDir)) != NULL)
+            {
+                nameLen = strlen(pEnt->d_name);
+                if (nameLen < 4
+                    || (strcmp(pEnt->d_name + nameLen - 4, ".lsz") != 0
+                        && strcmp(pEnt->d_name + nameLen - 4, ".lsb") != 0
+                        && strcmp(pEnt->d_name + nameLen - 4, ".zst") != 0))
+                    continue;
+                snprintf(achPath + n, sizeof(achPath) - n, "%s",
+                         pEnt->d_name);
+                if (ls_fio_stat(achPath, &st) == 0)
+                    total += st.st_size;
+            }
+            closedir(pDir);
+        }
+    }
+    ls_atomic_add(&m_lDiskUsed, total);
+    return LS_OK;
+}
+
+
+// Runs in an offloader thread, the sub directories go back to the event loop.
+int StaticPrecompressor::scanDir(PrecompressTask *pTask)
+{
+    char achPath[4096];
+    struct dirent *pEnt;
+    struct stat st;
+    DIR *pDir;
+    int n, len;
+
+    if ((pDir = opendir(pTask->m_path.c_str())) == NULL)
+        return LS_FAIL;
+    while ((pEnt = readdir(pDir)) != NULL)
+    {
+        if (pEnt->d_name[0] == '.' && (pEnt->d_name[1] == 0
+            || (pEnt->d_name[1] == '.' && pEnt->d_name[2] == 0)))
+            continue;
+        n = snprintf(achPath, sizeof(achPath), "%s%s",
+                     pTask->m_path.c_str(), pEnt->d_name);
+        if (n >= (int)sizeof(achPath) - 1)
+            continue;
+        if (pEnt->d_type == DT_DIR
+            || ((pEnt->d_type == DT_LNK || pEnt->d_type == DT_UNKNOWN)
+                && ls_fio_stat(achPath, &st) == 0 && S_ISDIR(st.st_mode)))
+        {
+            achPath[n++] = '/';
+            achPath[n] = 0;
+            pTask->m_subDirs.push_back(new AutoStr2(achPath, n));
+        }
+        else
+        {
+            len = precompress(achPath, n);
+            if (len > 0)
+                pTask->m_iCompressed += len;
+        }
+    }
+    closedir(pDir);
+    return LS_OK;
+}
+
+
+/**
+ * Runs in an offloader thread, return the number of variants written. The
+ * variants of a file that is gone are removed.
+ */
+int StaticPrecompressor::precompress(const char *pPath, int len)
+{
+    struct stat st;
+    int fd, ret;
+    char modes;
+
+    if (ls_fio_stat(pPath, &st) == -1)
+    {
+        if (errno == ENOENT)
+            removeVariants(pPath, len);
+        return 0;
+    }
+    if (!S_ISREG(st.st_mode)
+        || !StaticFileCacheData::isPrecompressSize(st.st_size))
+        return 0;
+    if ((modes = getModes(pPath, len)) == 0)
+        return 0;
+    if ((fd = ls_fio_open(pPath, O_RDONLY, 0)) == -1)
+        return 0;
+    ret = precompressFile(pPath, len, fd, st, modes);
+    close(fd);
+    return ret;
+}
+
+
+int StaticPrecompressor::precompressFile(const char *pPath, int len, int fd,
+                                         const struct stat &st, char modes)
+{
+    static const char s_modes[] =
+    {   SFCD_MODE_GZIP, SFCD_MODE_BROTLI, SFCD_MODE_ZSTD    };
+    char achPath[4096];
+    off_t maxSize = st.st_size - st.st_size * PRECOMPRESS_MIN_SAVING / 100;
+    off_t oldSize, size;
+    struct stat stVariant;
+    int count = 0;
+    int n;
+
+    n = StaticFileCacheData::buildCompressedBasePath(pPath, len, achPath,
+                                                     sizeof(achPath) - 4);
+    if (n == LS_FAIL)
+        return 0;
+    for (unsigned int i = 0; i < sizeof(s_modes); ++i)
+    {
+        if (!(modes & s_modes[i]))
+            continue;
+        memcpy(achPath + n, StaticFileCacheData::getCompressedSuffix(s_modes[i]),
+               5);
+        oldSize = 0;
+        if (ls_fio_stat(achPath, &stVariant) == 0)
+        {
+            if (stVariant.st_mtime == st.st_mtime)
+                continue;
+            oldSize = stVariant.st_size;
+        }
+        if (m_lMaxDisk > 0
+            && ls_atomic_value(&m_lDiskUsed) - oldSize + maxSize > m_lMaxDisk)
+        {
+            ls_atomic_set(&m_pShared->m_iDiskFull, 1);
+            size = LS_FAIL;
+        }
+        else
+            size = StaticFileCacheData::compressFd(fd, st.st_size,
+                                                   st.st_mtime, s_modes[i],
+                                                   achPath, maxSize);
+        if (size != LS_FAIL)
+        {
+            ls_atomic_add(&m_lDiskUsed, size - oldSize);
+            ++count;
+        }
+        else if (oldSize > 0 && unlink(achPath) == 0)
+            //Never leave a stale variant behind
+            ls_atomic_add(&m_lDiskUsed, -oldSize);
+    }
+    return count;
+}
+
+
+void StaticPrecompressor::removeVariants(const char *pPath, int len)
+{
+    static const char s_modes[] =
+    {   SFCD_MODE_GZIP, SFCD_MODE_BROTLI, SFCD_MODE_ZSTD    };
+    char achPath[4096];
+    struct stat st;
+    int n;
+
+    n = StaticFileCacheData::buildCompressedBasePath(pPath, len, achPath,
+                                                     sizeof(achPath) - 4);
+    if (n == LS_FAIL)
+        return;
+    for (unsigned int i = 0; i < sizeof(s_modes); ++i)
+    {
+        memcpy(achPath + n, StaticFileCacheData::getCompressedSuffix(s_modes[i]),
+               5);
+        if (ls_fio_stat(achPath, &st) == 0 && unlink(achPath) == 0)
+            ls_atomic_add(&m_lDiskUsed, -(int64_t)st.st_size);
+    }
+}
+
+#endif
@@ -0,0 +1,123 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2022  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+#ifndef STATICPRECOMPRESSOR_H
+#define STATICPRECOMPRESSOR_H
+
+#if defined(linux) || defined(__linux) || defined(__linux__) || defined(__gnu_linux__)
+
+#include <lsdef.h>
+#include <edio/eventreactor.h>
+#include <util/autostr.h>
+#include <util/gpointerlist.h>
+#include <util/tsingleton.h>
+
+#include <inttypes.h>
+
+//A variant has to save this percentage of the file to be kept.
+#define PRECOMPRESS_MIN_SAVING      5
+
+class HttpVHost;
+struct Offloader;
+struct PrecompressRoot;
+struct PrecompressShared;
+struct PrecompressTask;
+
+/**
+ * StaticPrecompressor builds the gzip, brotli and zstd variants of the
+ * static files under the document roots ahead of the requests, the request
+ * path only serves them. It runs in the first worker.
+ *
+ * The cache directory is measured first, then every directory under the
+ * roots is scanned once and watched with inotify, a file is compressed
+ * again when it is written or moved in, its variants are removed when it
+ * goes away. Scans and compression run in low priority offloader threads,
+ * the event loop only keeps the watches.
+ *
+ * Files within the gzip min and max file size are compressed with the
+ * encodings their vhost enables, if their MIME type is compressible in the
+ * context of the file. A variant is dropped if it does not save
+ * PRECOMPRESS_MIN_SAVING percent, no new one is written once the variants
+ * take the configured disk space. Files outside the document roots are
+ * still compressed on request, so are all files while the watching worker
+ * is down or once it runs out of watches or disk space.
+ */
+class StaticPrecompressor : public EventReactor
+                          , public TSingleton<StaticPrecompressor>
+{
+    friend class TSingleton<StaticPrecompressor>;
+public:
+    // maxDiskMB 0 for no limit.
+    void setOptions(int enable, int workers, long maxDiskMB);
+    int  isEnabled() const              {   return m_iEnabled;      }
+
+    // Added in every worker, the watches are started in one.
+    void addRoot(const HttpVHost *pVHost);
+    int  start();
+
+    // The encodings a file under the document roots is precompressed with.
+    char getModes(const char *pPath, int len) const;
+    // Whether the watching worker takes care of the files, in any worker.
+    int  isCovering() const;
+
+    // Run in the offloader threads, return the number of variants written.
+    int  precompress(const char *pPath, int len);
+    int  precompressFile(const char *pPath, int len, int fd,
+                         const struct stat &st, char modes);
+    int64_t getDiskUsed() const         {   return m_lDiskUsed;     }
+
+    virtual int handleEvents(short event);
+
+private:
+    StaticPrecompressor();
+    ~StaticPrecompressor();
+
+    int  addWatch(const char *pDir, int len);
+    void removeWatch(int wd);
+    void removeTree(const char *pDir, int len);
+    void processEvents(const char *pBuf, int len);
+    int  enqueue(int type, const char *pPath, int len);
+    void onTaskDone(PrecompressTask *pTask);
+
+    int  measureCache();
+    int  scanDir(PrecompressTask *pTask);
+    void removeVariants(const char *pPath, int len);
+
+    static int  perform(struct ls_offload *pTask);
+    static void releaseTask(struct ls_offload *pTask);
+    static void onTaskDoneCb(void *param);
+
+    static struct ls_offload_api s_api;
+
+    struct Offloader       *m_pOffloader;
+    TPointerList<PrecompressRoot> m_roots;
+    TPointerList<AutoStr2>  m_dirs;     // watched directories by wd
+    int                     m_iEnabled;
+    int                     m_iWorkers;
+    PrecompressShared      *m_pShared;  // shared by the workers
+    int                     m_iDiskFullLogged;
+    int64_t                 m_lMaxDisk;
+    int64_t                 m_lDiskUsed;
+
+    LS_NO_COPY_ASSIGN(StaticPrecompressor);
+};
+
+LS_SINGLETON_DECL(StaticPrecompressor);
+
+#endif
+
+#endif
@@ -16,6 +16,8 @@
 *    along with this program. If not, see http://www.gnu.org/licenses/.      *
 *****************************************************************************/
 #include <http/httpsession.h>
+#include <http/clientcache.h>
+#include <http/clientinfo.h>
 #include <http/hiochainstream.h>
 #include <http/httpdefs.h>
 #include <http/httpmethod.h>
@@ -24,9 +26,14 @@
 #include <http/httpstatuscode.h>
 #include <ssi/ssiruntime.h>
 
+#include <edio/evtcbque.h>
 #include <log4cxx/logger.h>
 #include <util/datetime.h>
 
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+
 
 //subrequest mode
 //  1. background mode, we do not care the result, result is discarded
@@ -77,7 +84,9 @@ HttpSession *HttpSession::newSubSession(lsi_subreq_t *pSubSessInfo)
             return NULL;
     }
 
-    if (detectLoopSubSession(pSubSessInfo) == 1)
+    //A seed is never processed, it has no loop to detect
+    if (!(pSubSessInfo->m_flag & SUB_REQ_SEED) && !getFlag2(HSF2_BG_SEED)
+        && detectLoopSubSession(pSubSessInfo) == 1)
         return NULL;
 
     HttpSession *pSession = HttpResourceManager::getInstance().getConnection();
@@ -106,6 +115,8 @@ HttpSession *HttpSession::newSubSession(lsi_subreq_t *pSubSessInfo)
         HttpResourceManager::getInstance().recycle(pSession);
         return NULL;
     }
+    if (pSubSessInfo->m_flag & SUB_REQ_DETACHED)
+        pSession->detachFromConn();
 
     pSession->setFlag(HSF_SUB_SESSION);
     pSession->getResp()->reset();
@@ -209,6 +220,118 @@ int HttpSession::execSubSession()
     return ret;
 }
 
+int HttpSession::call_execSubSession(lsi_session_t *p, long , void *)
+{
+    HttpSession *pSession = (HttpSession *)p;
+    pSession->execSubSession();
+    return 0;
+}
+
+
+int HttpSession::startBgSubSession(lsi_subreq_t *pSubSessInfo)
+{
+    lsi_subreq_t info = *pSubSessInfo;
+    info.m_flag |= SUB_REQ_DETACHED | SUB_REQ_NOABORT;
+    HttpSession *pSubSess = newSubSession(&info);
+    if (!pSubSess)
+        return LS_FAIL;
+    //Not made on behalf of the client unless asked. The minimal header set
+    //has none of the parent, the Cookie there was set by the caller.
+    if (!(info.m_flag & (SUB_REQ_SETHEADERS | SUB_REQ_KEEPCRED)))
+        pSubSess->getReq()->dropCredentials();
+    pSubSess->setFlag2(HSF2_BG_SUB_SESSION);
+    //Not from the hook of the current session, it may be in any state.
+    EvtcbQue::getInstance().schedule(call_execSubSession, pSubSess, 0, NULL,
+                                     false);
+    return LS_OK;
+}
+
+
+/**
+ * A detached copy of this request with the minimal header set. It is not
+ * processed, background sub sessions are started from it when no request
+ * of the virtual host is at hand. It holds the client info of localhost
+ * rather than the one of the client, releaseDetached() frees it.
+ */
+HttpSession *HttpSession::newBgSeed()
+{
+    lsi_subreq_t info;
+    struct sockaddr_in addr;
+    ClientInfo *pInfo;
+
+    memset(&info, 0, sizeof(info));
+    info.m_flag = SUB_REQ_DETACHED | SUB_REQ_NOABORT | SUB_REQ_SETHEADERS
+                  | SUB_REQ_SEED;
+    info.m_method = HttpMethod::HTTP_GET;
+    info.m_pUri = "/";
+    info.m_uriLen = 1;
+    HttpSession *pSeed = newSubSession(&info);
+    if (!pSeed)
+        return NULL;
+    pSeed->getReq()->dropCredentials();
+    pSeed->setFlag2(HSF2_BG_SUB_SESSION | HSF2_BG_SEED);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    pInfo = ClientCache::getInstance().getClientInfo((struct sockaddr *)&addr);
+    if (pInfo)
+    {
+        if (pSeed->getFlag2(HSF2_HOLD_CLIENT_INFO) && pSeed->m_pClientInfo)
+            pSeed->m_pClientInfo->decConn();
+        pInfo->incConn();
+        pSeed->m_pClientInfo = pInfo;
+        pSeed->setFlag2(HSF2_HOLD_CLIENT_INFO);
+    }
+    return pSeed;
+}
+
+
+int HttpSession::call_releaseDetached(lsi_session_t *p, long , void *pParam)
+{
+    HttpSession *pSession = (HttpSession *)pParam;
+    LS_DBG_M(pSession->getLogSession(), "Release detached SUB SESSION");
+    if (pSession->getFlag2(HSF2_HOLD_CLIENT_INFO) && pSession->m_pClientInfo)
+    {
+        pSession->m_pClientInfo->decConn();
+        pSession->m_pClientInfo = NULL;
+    }
+    HioStream *pStream = pSession->detachStream();
+    if (pStream)
+        delete pStream;
+    pSession->recycle();
+    return 0;
+}
+
+
+void HttpSession::releaseDetached()
+{
+    //Still on the call stack of closeSession(), defer it.
+    EvtcbQue::getInstance().schedule(call_releaseDetached, NULL, 0, this,
+                                     false);
+}
+
+
+/**
+ * A detached sub session outlives the connection of its parent, it must
+ * not use the SSL session of the connection, and keeps the client info
+ * from being recycled until it is released.
+ */
+void HttpSession::detachFromConn()
+{
+    if (m_request.getCrypto())
+    {
+        m_request.setCrypto(NULL);
+        m_request.setHttps();
+    }
+    if (m_pClientInfo && !getFlag2(HSF2_HOLD_CLIENT_INFO))
+    {
+        m_pClientInfo->incConn();
+        setFlag2(HSF2_HOLD_CLIENT_INFO);
+    }
+}
+
+
 int HttpSession::attachSubSession(HttpSession *pSubSess)
 {
     HioChainStream *pStream = (HioChainStream *)pSubSess->getStream();
@@ -236,7 +359,8 @@ int HttpSession::detachSubSession(HttpSession *pSubSess)
 
     // remove from current sub session list;
     pSubSess->m_pParent = NULL;
-    // add this session to global orphan session list
+    pSubSess->detachFromConn();
+    //Released by its stream when it is done, see HioChainStream::shutdown()
 
 
     return 0;
@@ -512,6 +636,49 @@ int HttpReq::cloneReqBody(const char *pBuf, int32_t len)
 }
 
 
+//The only headers of the parent request a SUB_REQ_SETHEADERS subrequest keeps
+static const int s_minHeaders[] =
+{
+    HttpHeader::H_HOST,
+    HttpHeader::H_ACC_ENCODING,
+    HttpHeader::H_USERAGENT,
+};
+
+
+/**
+ * Build the header block of a subrequest from the request line of the
+ * parent and the headers above. Nothing else is passed on, not even in
+ * the raw header block a proxy backend gets.
+ */
+void HttpReq::cloneMinHeaders(HttpReq *pProto)
+{
+    int i, index;
+    int reqLineEnd = pProto->m_reqLineOff + pProto->m_reqLineLen;
+
+    m_headerBuf.append("\r\n\r\n", 4);
+    m_iReqHeaderBufFinished = m_iHttpHeaderEnd = m_headerBuf.size();
+    memset(m_commonHeaderLen, 0, sizeof(m_commonHeaderLen));
+    memset(m_commonHeaderOffset, 0, sizeof(m_commonHeaderOffset));
+    m_cookies.reset();
+    m_cookies.init();
+    m_iContextState &= ~COOKIE_PARSED;
+    for (i = 0; i < (int)(sizeof(s_minHeaders) / sizeof(int)); ++i)
+    {
+        index = s_minHeaders[i];
+        if (pProto->m_commonHeaderOffset[index] != 0)
+            updateReqHeader(index, pProto->getHeader(index),
+                            pProto->getHeaderLen(index));
+    }
+    //The host is either in the request line or the Host header
+    if (m_iHostOff >= reqLineEnd)
+    {
+        m_iHostOff = m_commonHeaderOffset[HttpHeader::H_HOST];
+        if (!m_iHostOff)
+            m_iHostLen = 0;
+    }
+}
+
+
 int HttpReq::clone(HttpReq *pProto, lsi_subreq_t *pSubSessInfo)
 {
     int ret = 0;
@@ -524,8 +691,13 @@ int HttpReq::clone(HttpReq *pProto, lsi_subreq_t *pSubSessInfo)
 
     int begin = m_headerBuf.size();
 
-    m_headerBuf.append(pProto->m_headerBuf.getp(begin),
-                       m_iHttpHeaderEnd - begin);
+    if (pSubSessInfo->m_flag & SUB_REQ_SETHEADERS)
+        m_headerBuf.append(pProto->m_headerBuf.getp(begin),
+                           pProto->m_reqLineOff + pProto->m_reqLineLen
+                           - begin);
+    else
+        m_headerBuf.append(pProto->m_headerBuf.getp(begin),
+                           m_iHttpHeaderEnd - begin);
 
     memmove(&m_reqLineOff, &pProto->m_reqLineOff,
             (char *)(&m_reqURLLen + 1) - (char *)&m_reqLineOff);
@@ -539,6 +711,8 @@ int HttpReq::clone(HttpReq *pProto, lsi_subreq_t *pSubSessInfo)
     keepAlive(pProto->isKeepAlive());
     m_iAcceptGzip = 0; //pProto->m_iAcceptGzip &
     m_iAcceptBr = 0;
+    m_iAcceptZstd = 0;
+    m_iAcceptDcz = 0;
     m_iRedirects = 0;
     m_iHostOff = pProto->m_iHostOff;
     m_iHostLen = pProto->m_iHostLen;
@@ -551,32 +725,55 @@ int HttpReq::clone(HttpReq *pProto, lsi_subreq_t *pSubSessInfo)
         //copy unkown header index
     }
 
-    if (pProto->m_iContextState & COOKIE_PARSED)
-    {
-        m_iContextState |= COOKIE_PARSED;
-        m_cookies.copy(pProto->m_cookies, m_pPool);
-    }
-    if (pProto->m_commonHeaderOffset[ HttpHeader::H_COOKIE ] >
-        m_iHttpHeaderEnd)
-    {
-        copyCookieHeaderToBufEnd(
-            pProto->m_commonHeaderOffset[ HttpHeader::H_COOKIE ],
-            pProto->getHeader(HttpHeader::H_COOKIE),
-            pProto->getHeaderLen(HttpHeader::H_COOKIE)
-        );
-    }
-    else if (pProto->m_commonHeaderOffset[ HttpHeader::H_COOKIE ]
-             + pProto->m_commonHeaderLen[ HttpHeader::H_COOKIE ] > m_iHttpHeaderEnd)
+    if (pSubSessInfo->m_flag & SUB_REQ_SETHEADERS)
+        cloneMinHeaders(pProto);
+    else
     {
-        m_headerBuf.append(pProto->m_headerBuf.getp(m_iHttpHeaderEnd),
-                           pProto->m_commonHeaderOffset[ HttpHeader::H_COOKIE ]
-                           + pProto->m_commonHeaderLen[ HttpHeader::H_COOKIE ]
-                           + 2 - m_iHttpHeaderEnd);
+        if (pProto->m_iContextState & COOKIE_PARSED)
+        {
+            m_iContextState |= COOKIE_PARSED;
+            m_cookies.copy(pProto->m_cookies, m_pPool);
+        }
+        if (pProto->m_commonHeaderOffset[ HttpHeader::H_COOKIE ] >
+            m_iHttpHeaderEnd)
+        {
+            copyCookieHeaderToBufEnd(
+                pProto->m_commonHeaderOffset[ HttpHeader::H_COOKIE ],
+                pProto->getHeader(HttpHeader::H_COOKIE),
+                pProto->getHeaderLen(HttpHeader::H_COOKIE)
+            );
+        }
+        else if (pProto->m_commonHeaderOffset[ HttpHeader::H_COOKIE ]
+                 + pProto->m_commonHeaderLen[ HttpHeader::H_COOKIE ]
+                 > m_iHttpHeaderEnd)
+        {
+            m_headerBuf.append(pProto->m_headerBuf.getp(m_iHttpHeaderEnd),
+                               pProto->m_commonHeaderOffset[ HttpHeader::H_COOKIE ]
+                               + pProto->m_commonHeaderLen[ HttpHeader::H_COOKIE ]
+                               + 2 - m_iHttpHeaderEnd);
+        }
     }
 
     if (pSubSessInfo->m_flag & SUB_REQ_SETREFERER)
         setReferer(pProto->getOrgReqURL(), pProto->getOrgReqURLLen());
 
+    if (pSubSessInfo->m_flag & SUB_REQ_SETHEADERS)
+    {
+        if (pSubSessInfo->m_cookieLen > 0)
+            updateReqHeader(HttpHeader::H_COOKIE,
+                            pSubSessInfo->m_pCookie ? pSubSessInfo->m_pCookie
+                                                    : "",
+                            pSubSessInfo->m_cookieLen);
+        if (pSubSessInfo->m_pUserAgent)
+            updateReqHeader(HttpHeader::H_USERAGENT,
+                            pSubSessInfo->m_pUserAgent,
+                            pSubSessInfo->m_userAgentLen);
+    }
+
+    if ((pSubSessInfo->m_flag & SUB_REQ_SETENV) && pSubSessInfo->m_pEnvName)
+        addEnv(pSubSessInfo->m_pEnvName, pSubSessInfo->m_envNameLen,
+               pSubSessInfo->m_pEnvValue, pSubSessInfo->m_envValueLen);
+
     if ((pSubSessInfo->m_method == HttpMethod::HTTP_POST)
         && (pSubSessInfo->m_pReqBody != NULL))
     {
@@ -596,7 +793,12 @@ int HttpReq::clone(HttpReq *pProto, lsi_subreq_t *pSubSessInfo)
     int iSrcQsLen = pSubSessInfo->m_qsLen;
     if (iSrcQsLen > 0)
         totalUrlLen += iSrcQsLen + 1;
-    if (totalUrlLen <= pProto->getOrgReqURLLen())
+    //Only the request line is copied with the minimal headers, a URL moved
+    //out of it by setNewOrgUrl() is not there to be replaced in place
+    if (totalUrlLen <= pProto->getOrgReqURLLen()
+        && (!(pSubSessInfo->m_flag & SUB_REQ_SETHEADERS)
+            || pProto->m_reqURLOff + pProto->m_reqURLLen
+               <= pProto->m_reqLineOff + pProto->m_reqLineLen))
     {
         char *pOrgEnd;
         p = pURL = m_headerBuf.getp(pProto->m_reqURLOff);
@@ -640,6 +842,16 @@ int HttpReq::clone(HttpReq *pProto, lsi_subreq_t *pSubSessInfo)
 }
 
 
+void HttpReq::dropCredentials()
+{
+    m_cookies.reset();
+    m_cookies.init();
+    m_iContextState &= ~COOKIE_PARSED;
+    dropReqHeader(HttpHeader::H_COOKIE);
+    dropReqHeader(HttpHeader::H_AUTHORIZATION);
+}
+
+
 void HttpReq::addContentLenHeader(size_t len)
 {
     char sLen[40];
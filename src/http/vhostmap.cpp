@@ -24,6 +24,7 @@
 #include <lsr/ls_strtool.h>
 #include <main/zconfmanager.h>
 #include <socket/gsockaddr.h>
+#include <sslpp/sslcertstore.h>
 #include <sslpp/sslcontext.h>
 #include <util/autobuf.h>
 #include <util/stringlist.h>
@@ -790,8 +791,18 @@ SslContext *VHostMapFindSslContext(void *arg, const char *pName)
             pVHost = pMap->matchVHost(pHost, pHostEnd);
         }
     }
-    if (pVHost && pVHost->getSslContext())
-        return pVHost->getSslContext();
+    if (pVHost)
+    {
+        if (pVHost->getSslContext())
+            return pVHost->getSslContext();
+        if (pVHost->getLazySslConfig())
+        {
+            SslContext *pCtx = SslCertStore::getInstance().get(
+                    pVHost->getName(), pVHost->getLazySslConfig());
+            if (pCtx)
+                return pCtx;
+        }
+    }
     return pMap->getSslContext();
 
 }
@@ -1543,7 +1543,9 @@ static int get_resp_buffer_compress_method(const lsi_session_t *session)
     if (pSession == NULL)
         return LS_FALSE;
 
-    if (pSession->getFlag(HSF_RESP_BODY_BRCOMPRESSED))
+    if (pSession->getFlag2(HSF2_RESP_BODY_ZSTDCOMPRESSED))
+        return LSI_ZSTD_COMPRESS;
+    else if (pSession->getFlag(HSF_RESP_BODY_BRCOMPRESSED))
         return LSI_BR_COMPRESS;
     else if (pSession->getFlag(HSF_RESP_BODY_GZIPCOMPRESSED))
         return LSI_GZIP_COMPRESS;
@@ -1559,7 +1561,10 @@ static int set_resp_buffer_compress_method(const lsi_session_t *session, int met
 
     pSession->clearFlag(HSF_RESP_BODY_BRCOMPRESSED);
     pSession->clearFlag(HSF_RESP_BODY_GZIPCOMPRESSED);
-    if (method == LSI_BR_COMPRESS)
+    pSession->clearFlag2(HSF2_RESP_BODY_ZSTDCOMPRESSED);
+    if (method == LSI_ZSTD_COMPRESS)
+        pSession->setFlag2(HSF2_RESP_BODY_ZSTDCOMPRESSED);
+    else if (method == LSI_BR_COMPRESS)
         pSession->setFlag(HSF_RESP_BODY_BRCOMPRESSED);
     else if (method == LSI_GZIP_COMPRESS)
         pSession->setFlag(HSF_RESP_BODY_GZIPCOMPRESSED);
@@ -2181,6 +2186,35 @@ int get_local_sockaddr(const lsi_session_t *session, char *pIp, int maxLen)
 }
 
 
+static int exec_bg_subreq(const lsi_session_t *session,
+                          lsi_subreq_t *pSubReq)
+{
+    if (!session || !pSubReq || !pSubReq->m_pUri)
+        return LS_FAIL;
+    HttpSession *pSession = (HttpSession *)((LsiSession *)session);
+    return pSession->startBgSubSession(pSubReq);
+}
+
+
+static const lsi_session_t *hold_bg_session(const lsi_session_t *session)
+{
+    if (!session)
+        return NULL;
+    HttpSession *pSession = (HttpSession *)((LsiSession *)session);
+    return pSession->newBgSeed();
+}
+
+
+static void release_bg_session(const lsi_session_t *session)
+{
+    if (!session)
+        return;
+    HttpSession *pSession = (HttpSession *)((LsiSession *)session);
+    if (pSession->getFlag2(HSF2_BG_SEED))
+        pSession->releaseDetached();
+}
+
+
 ls_xpool_t *get_session_pool(const lsi_session_t *session)
 {
     HttpSession *pSession = (HttpSession *)((LsiSession *)session);
@@ -3791,6 +3825,9 @@ void lsiapi_init_server_api()
     pApi->_log_level_ptr = log4cxx::Level::getDefaultLevelPtr();
     pApi->schedule_remove_session_cbs_event = schedule_remove_session_cbs_event;
     pApi->register_thread_cleanup = register_thread_cleanup_ts;
+    pApi->exec_bg_subreq = exec_bg_subreq;
+    pApi->hold_bg_session = hold_bg_session;
+    pApi->release_bg_session = release_bg_session;
 
     g_lsiapi_ts = g_lsiapi;
 
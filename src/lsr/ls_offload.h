@@ -51,6 +51,9 @@ ls_inline struct Offloader *offloader_new(const char *log_id, int workers)
 int offloader_enqueue(struct Offloader *, struct ls_offload *task,
                       void *log_sess);
 
+int offloader_set_max_workers(struct Offloader *, int workers);
+int offloader_get_workers(struct Offloader *);
+
 #ifdef __cplusplus
 }
 #endif
@@ -763,12 +763,10 @@ void ConfigCtx::configCRL(const XmlNode *pNode, SslContext *pSsl)
 }
 
 
-SslContext *ConfigCtx::newSSLContext(const XmlNode *pNode,
-                                    const char *pName, SslContext *pOldContext)
+int ConfigCtx::initSSLContextConfig(const XmlNode *pNode, const char *pName,
+                                    SslContextConfig *pConfig)
 {
-    SslContextConfig config;
     int cv;
-    SslContext *pSsl;
     const char *pTag, *pCertFile, *pKey;
     char achCert[MAX_PATH_LEN], achKey[MAX_PATH_LEN],
          achCAPath[MAX_PATH_LEN], achCAFile[MAX_PATH_LEN],
@@ -778,65 +776,65 @@ SslContext *ConfigCtx::newSSLContext(const XmlNode *pNode,
     {
         LS_NOTICE( "[%s] No SSL certificate configured for [%s]",
                   getLogId(), pName);
-        return NULL;
+        return LS_FAIL;
     }
     if ((pCertFile = getTag(pNode, "certFile")) == NULL)
-        return NULL;
+        return LS_FAIL;
     else if ((pKey = getTag(pNode, "keyFile")) == NULL)
-        return NULL;
+        return LS_FAIL;
 
-    config.m_iEnableMultiCerts =
+    pConfig->m_iEnableMultiCerts =
                     HttpServerConfig::getInstance().getEnableMultiCerts();
-    if (config.m_iEnableMultiCerts)
+    if (pConfig->m_iEnableMultiCerts)
     {
         if (getAbsoluteFile(achCert, pCertFile) != 0)
-            return NULL;
+            return LS_FAIL;
         else if (getAbsoluteFile(achKey, pKey) != 0)
-            return NULL;
+            return LS_FAIL;
     }
     else
     {
         if (getValidFile(achCert, pCertFile, "certificate file") != 0)
-            return NULL;
+            return LS_FAIL;
         else if (getValidFile(achKey, pKey, "key file") != 0)
-            return NULL;
+            return LS_FAIL;
     }
-    config.m_sCertFile[0] = achCert;
-    config.m_sKeyFile[0] = achKey;
-    config.m_sName = pName;
+    pConfig->m_sCertFile[0] = achCert;
+    pConfig->m_sKeyFile[0] = achKey;
+    pConfig->m_sName = pName;
 
     const char *pCipher = pNode->getChildValue( "ciphers" );
     if (pCipher == NULL)
         pCipher = "ALL:!ADH:!EXPORT56:RC4+RSA:+HIGH:+MEDIUM:+SSLv2:+EXP";
-    config.m_sCiphers = pCipher;
+    pConfig->m_sCiphers = pCipher;
 
     if (( pTag = pNode->getChildValue( "CACertPath" )) != NULL )
     {
         if ( getValidFile(achCAPath, pTag, "CA Certificate path" ) != 0 )
-            return NULL;
-        config.m_sCAPath = achCAPath;
+            return LS_FAIL;
+        pConfig->m_sCAPath = achCAPath;
     }
 
     if (( pTag = pNode->getChildValue( "CACertFile" )) != NULL )
     {
         if ( getValidFile(achCAFile, pTag, "CA Certificate file" ) != 0 )
-            return NULL;
-        config.m_sCAFile = achCAFile;
+            return LS_FAIL;
+        pConfig->m_sCAFile = achCAFile;
     }
 
 
     cv = getLongValue( pNode, "clientVerify", 0, 3, 0 );
-    config.m_iClientVerify = cv;
+    pConfig->m_iClientVerify = cv;
     if (cv)
-        config.m_iVerifyDepth = getLongValue(pNode, "verifyDepth", 1, INT_MAX, 1);
+        pConfig->m_iVerifyDepth = getLongValue(pNode, "verifyDepth", 1, INT_MAX, 1);
 
-    config.m_iCertChain = getLongValue( pNode, "certChain", 0, 1, 0 );
-    config.m_iProtocol = getLongValue(pNode, "sslProtocol", 1, 31,
+    pConfig->m_iCertChain = getLongValue( pNode, "certChain", 0, 1, 0 );
+    pConfig->m_iProtocol = getLongValue(pNode, "sslProtocol", 1, 31,
                                       SslContext::SSL_TLS_SAFE);
-    config.m_iEnableECDHE = getLongValue(pNode, "enableECDHE", 0, 1, 1);
-    config.m_iEnableDHE = getLongValue(pNode, "enableDHE", 0, 1, 0);
+    pConfig->m_iEnableECDHE = getLongValue(pNode, "enableECDHE", 0, 1, 1);
+    pConfig->m_iEnableDHE = getLongValue(pNode, "enableDHE", 0, 1, 0);
 
-    if ( config.m_iEnableDHE != 0 )
+    if ( pConfig->m_iEnableDHE != 0 )
     {
         if (( pTag = pNode->getChildValue("DHParam")) != NULL )
         {
@@ -847,19 +845,31 @@ SslContext *ConfigCtx::newSSLContext(const XmlNode *pNode,
                          getLogId(), pTag );
             }
             else
-                config.m_sDHParam = achDHParam;
+                pConfig->m_sDHParam = achDHParam;
         }
     }
 
-    config.m_iEnableSpdy = getLongValue(pNode, "enableSpdy", 0, 15, 12);
-    config.m_iEnableCache = getLongValue(pNode, "sslSessionCache", 0, 1, 0);
-    config.m_iInsecReneg = !getLongValue(pNode, "regenProtection", 0, 1, 1);
-    config.m_iEnableTicket = getLongValue(pNode, "sslSessionTickets",
+    pConfig->m_iEnableSpdy = getLongValue(pNode, "enableSpdy", 0, 15, 12);
+    pConfig->m_iEnableCache = getLongValue(pNode, "sslSessionCache", 0, 1, 0);
+    pConfig->m_iInsecReneg = !getLongValue(pNode, "regenProtection", 0, 1, 1);
+    pConfig->m_iEnableTicket = getLongValue(pNode, "sslSessionTickets",
                                                0, 1, 1);
     int enableStapling = getLongValue(pNode, "enableStapling", 0, 1, 0);
     if ((enableStapling) && (pCertFile != NULL))
-        if (configStapling(pNode, &config) != -1)
-            config.m_iEnableStapling = enableStapling;
+        if (configStapling(pNode, pConfig) != -1)
+            pConfig->m_iEnableStapling = enableStapling;
+    return LS_OK;
+}
+
+
+SslContext *ConfigCtx::newSSLContext(const XmlNode *pNode,
+                                    const char *pName, SslContext *pOldContext)
+{
+    SslContextConfig config;
+    SslContext *pSsl;
+
+    if (initSSLContextConfig(pNode, pName, &config) != LS_OK)
+        return NULL;
 
     pSsl = SslContext::config(pOldContext, &config);
     if ( pSsl == NULL )
@@ -869,7 +879,7 @@ SslContext *ConfigCtx::newSSLContext(const XmlNode *pNode,
         return NULL;
     }
 
-    if (cv)
+    if (config.m_iClientVerify)
     {
         configCRL(pNode, pSsl);
     }
@@ -102,6 +102,8 @@ public:
     static const char *getDocRoot()         {   return s_aDocRoot;    }
 
 
+    int initSSLContextConfig(const XmlNode *pNode, const char *pName,
+                             SslContextConfig *pConfig);
     SslContext *newSSLContext(const XmlNode *pNode, const char *pName,
                               SslContext *pOldContext);
     void configCRL(const XmlNode *pNode, SslContext *pSSL);
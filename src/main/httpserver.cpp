@@ -47,6 +47,8 @@
 
 #include <http/accesslog.h>
 #include <http/clientcache.h>
+#include <http/compressoffload.h>
+#include <http/compresstuner.h>
 #include <http/connlimitctrl.h>
 #include <http/contextlist.h>
 #include <http/denieddir.h>
@@ -78,6 +80,7 @@
 #include <http/serverprocessconfig.h>
 #include <http/staticfilecache.h>
 #include <http/staticfilecachedata.h>
+#include <http/staticprecompressor.h>
 #include <http/stderrlogger.h>
 #include <http/vhostmap.h>
 #include <http/clientinfo.h>
@@ -98,6 +101,10 @@
 #include <quic/udplistener.h>
 
 #include <shm/lsshm.h>
+#include <sslpp/sslasyncpk.h>
+#include <sslpp/sslcertcomp.h>
+#include <sslpp/sslcertstore.h>
+#include <sslpp/sslearlydata.h>
 #include <sslpp/sslcontext.h>
 #include <sslpp/sslcontextconfig.h>
 #include <sslpp/sslengine.h>
@@ -239,6 +246,7 @@ private:
     AutoStr2            m_sIpv4;
     AutoStr2            m_sIpv6;
     HttpMime            m_httpMime;
+    CompressTuner       m_compressTuner;
     long                m_lStartTime;
     pid_t               m_pid;
     gid_t               m_pri_gid;
@@ -299,6 +307,7 @@ private:
     const char *getSwapDir() const     {   return m_sSwapDirectory.c_str();    }
 
     int start();
+    void startPrecompressor(int watch);
     int shutdown();
     void adjustListeners(int iNumChildren);
     int gracefulShutdown();
@@ -561,6 +570,7 @@ int HttpServerImpl::start()
     // if child 1
     if (1 == HttpServerConfig::getInstance().getProcNo())
         ZConfManager::getInstance().sendStartUp();
+    startPrecompressor(1 == HttpServerConfig::getInstance().getProcNo());
     m_dispatcher.run();
     LS_NOTICE("Start shutting down gracefully ...");
     gracefulShutdown();
@@ -571,6 +581,28 @@ int HttpServerImpl::start()
 }
 
 
+/**
+ * Every worker knows the roots, the files outside them are compressed on
+ * request. Only one worker watches them.
+ */
+void HttpServerImpl::startPrecompressor(int watch)
+{
+#if defined(linux) || defined(__linux) || defined(__linux__) || defined(__gnu_linux__)
+    StaticPrecompressor &precompressor = StaticPrecompressor::getInstance();
+    const HttpVHost *pVHost;
+    if (!precompressor.isEnabled())
+        return;
+    for (int i = 0; i < m_vhosts.size(); ++i)
+    {
+        if ((pVHost = m_vhosts.get(i)) != NULL)
+            precompressor.addRoot(pVHost);
+    }
+    if (watch)
+        precompressor.start();
+#endif
+}
+
+
 int HttpServerImpl::shutdown()
 {
     LS_NOTICE("Shutting down ...!");
@@ -931,12 +963,16 @@ int HttpServerImpl::generateRTReport()
     int ret;
     ret = generateProcessReport(pAppender->getfd());
     ret = generateConnReport(pAppender->getfd());
+    ret = m_compressTuner.generateRTReport(pAppender->getfd());
     ret = m_listeners.writeRTReport(pAppender->getfd());
     if (!ret)
         ret = m_vhosts.writeRTReport(pAppender->getfd());
     if (ret)
         LS_ERROR("Failed to generate the real time report!");
     ret = ExtAppRegistry::generateRTReport(pAppender->getfd());
+#ifdef SSL_ASYNC_PK
+    ret = ssl_apk_generate_rt_report(pAppender->getfd());
+#endif
     ret = ClientCache::getInstance().generateBlockedIPReport(
               pAppender->getfd());
 
@@ -949,6 +985,9 @@ int HttpServerImpl::generateRTReport()
     resetStats();
     m_vhosts.resetStats();
     ExtAppRegistry::resetStats();
+#ifdef SSL_ASYNC_PK
+    ssl_apk_reset_stats();
+#endif
     return 0;
 }
 
@@ -964,6 +1003,8 @@ int HttpServerImpl::generateRTJsonReport()
         ret = generateProcessJsonReport(&buf);
     if (!ret)
         ret = generateConnJsonReport(&buf);
+    if (!ret)
+        ret = m_compressTuner.generateRTJsonReport(&buf);
     //if (!ret)
         //ret = m_listeners.writeRTJsonReport(&buf); // Would do nothing
     if (!ret)
@@ -1232,6 +1273,11 @@ void HttpServerImpl::onTimerSecond()
     HttpLog::onTimer();
     ClientCache::getInstance().onTimer();
     m_vhosts.onTimer();
+#ifdef SSL_ASYNC_PK
+    ssl_apk_on_timer();
+#endif
+    m_compressTuner.onTimer();
+    ExtAppRegistry::onSecTimer();
     if (m_lStartTime > 0)
         generateRTReport();
 
@@ -1245,6 +1291,9 @@ void HttpServerImpl::onTimer10Secs()
 {
     ExtAppRegistry::onTimer();
     HttpResourceManager::getInstance().onTimer();
+    if (SslCertStore::getInstance().isEnabled())
+        SslCertStore::getInstance().onTimer();
+    SslOcspStapling::onTimer();
     static int s_timeOut = 3;
     s_timeOut --;
     if (!s_timeOut)
@@ -2835,6 +2884,38 @@ int HttpServerImpl::configTuning(const XmlNode *pRoot)
         0
 #endif
     );
+    config.setZstdCompress(
+#ifdef USE_ZSTD
+        currentCtx.getLongValue(pNode, "enableZstdCompress", 0, 19, 0)
+#else
+        0
+#endif
+    );
+    //Follow the CPU headroom of each worker with the dynamic levels
+    m_compressTuner.setEnabled(
+        currentCtx.getLongValue(pNode, "dynCompressAutoTune", 0, 1, 0));
+    m_compressTuner.setBusyLimits(
+        currentCtx.getLongValue(pNode, "dynCompressBusyLow", 0, 100, 50),
+        currentCtx.getLongValue(pNode, "dynCompressBusyHigh", 1, 100, 85));
+    m_compressTuner.setLevel(Compressor::STATS_GZIP,
+                             config.getCompressLevel());
+    m_compressTuner.setLevelLimits(Compressor::STATS_GZIP,
+        currentCtx.getLongValue(pNode, "gzipCompressLevelMin", 1, 9, 1),
+        currentCtx.getLongValue(pNode, "gzipCompressLevelMax", 1, 9,
+                                config.getCompressLevel()));
+    m_compressTuner.setLevel(Compressor::STATS_ZSTD,
+                             config.getZstdCompress());
+    m_compressTuner.setLevelLimits(Compressor::STATS_ZSTD,
+        currentCtx.getLongValue(pNode, "zstdCompressLevelMin", 1, 19, 1),
+        currentCtx.getLongValue(pNode, "zstdCompressLevelMax", 1, 19,
+                                (config.getZstdCompress() > 0)
+                                ? config.getZstdCompress() : 19));
+    //Dynamic responses over this size are compressed by offloader threads
+    CompressOffload::setOffloadParams(
+        currentCtx.getLongValue(pNode, "dynCompressOffloadSize", 0,
+                                1024 * 1024 * 1024, 0),
+        currentCtx.getLongValue(pNode, "dynCompressOffloadWorkers", 1, 64,
+                                2));
     pValue = pNode->getChildValue("compressibleTypes");
     if (pValue == NULL)
         pValue = "default";
@@ -2850,6 +2931,25 @@ int HttpServerImpl::configTuning(const XmlNode *pRoot)
     StaticFileCacheData::setStaticBrOptions(
         currentCtx.getLongValue(pNode, "brStaticCompressLevel", 0, 11, 6)
     );
+    StaticFileCacheData::setStaticZstdOptions(
+        currentCtx.getLongValue(pNode, "zstdStaticCompressLevel", 1, 19, 12)
+    );
+#ifdef USE_ZSTD
+    //Send the new version of a static file as a delta against the old one
+    StaticFileCacheData::setStaticDictOptions(
+        currentCtx.getLongValue(pNode, "staticDictCompress", 0, 1, 0)
+    );
+#endif
+#if defined(linux) || defined(__linux) || defined(__linux__) || defined(__gnu_linux__)
+    //Compress static files in the background when they change, never on
+    //request
+    StaticPrecompressor::getInstance().setOptions(
+        currentCtx.getLongValue(pNode, "staticPrecompress", 0, 1, 0),
+        currentCtx.getLongValue(pNode, "staticPrecompressWorkers", 1, 16, 1),
+        currentCtx.getLongValue(pNode, "staticPrecompressMaxDisk", 0,
+                                LONG_MAX >> 20, 1024)
+    );
+#endif
 
 
     pValue = pNode->getChildValue("gzipCacheDir");
@@ -2944,6 +3044,9 @@ int HttpServerImpl::configTuning(const XmlNode *pRoot)
         LS_DBG("[OCSP] %s set OCSP verification using proxy server: %s",
                (ret == LS_OK) ? "Successfully" : "Failed to", pOcspProxy);
     }
+    if (SslOcspStapling::initShm(getuid(), getgid()) != LS_OK)
+        LS_WARN("[OCSP] Failed to init SHM OCSP response store, each worker "
+                "will fetch OCSP responses by itself.");
 
     const char *pCAFile;
     char achCAFile[MAX_PATH_LEN];
@@ -2964,6 +3067,40 @@ int HttpServerImpl::configTuning(const XmlNode *pRoot)
     SslContext::set_strict_sni(currentCtx.getLongValue(
                             pNode, "sslStrictSni", 0, 1, 0));
 
+    if (currentCtx.getLongValue(pNode, "sslLazyCertLoad", 0, 1, 0) != 0)
+    {
+        int iMaxCtx = currentCtx.getLongValue(pNode, "sslCertCacheSize",
+                                    1, INT_MAX, LS_SSLCERTSTORE_DEFAULTSIZE);
+        int iIdle = currentCtx.getLongValue(pNode, "sslCertIdleTimeout",
+                                    10, INT_MAX, LS_SSLCERTSTORE_IDLE_SECS);
+        if (SslCertStore::getInstance().init(iMaxCtx, iIdle,
+                                             getuid(), getgid()) != LS_OK)
+            LS_WARN("Failed to init SHM for lazy SSL certificate store, "
+                    "parsed certificates will not be shared.");
+    }
+#ifdef SSLCERTCOMP
+    SslCertComp::activateComp(currentCtx.getLongValue(
+                            pNode, "sslCertCompress", 0, 1, 0));
+#endif
+#ifdef SSL_ASYNC_PK
+    if (currentCtx.getLongValue(pNode, "sslAsyncPk", 0, 1, 0) != 0)
+    {
+        ssl_apk_set_limits(
+            currentCtx.getLongValue(pNode, "sslAsyncPkWorkers", 1, 64, 4),
+            currentCtx.getLongValue(pNode, "sslAsyncPkBatchSize", 1,
+                                    SSL_APK_BATCH_MAX, 8));
+        NtwkIOLink::enableAsyncPk();
+    }
+#endif
+#ifdef OPENSSL_IS_BORINGSSL
+    if (currentCtx.getLongValue(pNode, "sslEarlyData", 0, 1, 0) != 0)
+    {
+        if (SslEarlyData::init(getuid(), getgid()) != LS_OK)
+            LS_WARN("Failed to init SHM anti-replay store, TLS 1.3 early "
+                    "data is disabled.");
+    }
+#endif
+
     initQuic(pNode);
 
     pValue = pNode->getChildValue("proxyProtocol");
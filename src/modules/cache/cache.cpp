@@ -18,14 +18,20 @@
 #include "cacheconfig.h"
 #include "cachectrl.h"
 #include "cacheentry.h"
+#include "cacheesi.h"
 #include "cachehash.h"
+#include "cachememtier.h"
+#include "cacheslabtier.h"
+#include "cachewarmer.h"
 #include "dirhashcachestore.h"
 
 #include <limits.h>
 #include <ls.h>
 #include <lsr/ls_confparser.h>
+#include <lsr/ls_offload.h>
 #include <util/autostr.h>
 #include <util/datetime.h>
+#include <util/gpointerlist.h>
 #include <util/stringtool.h>
 #include <util/ni_fio.h>
 
@@ -50,6 +56,12 @@
 #include <util/autostr.h>
 #include <sys/uio.h>
 #include <zlib.h>
+#ifdef USE_BROTLI
+#include <brotli/encode.h>
+#endif
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
 
 
 
@@ -69,6 +81,23 @@
 #define MAX_HEADER_LEN      16384
 #define Z_BUF_SIZE          16384
 
+//Encoding variants of public objects, see calcVariantHash()
+#define CE_VARIANT_SEED         0x4c535641
+#define CE_VARIANT_BR_QUALITY   9
+#define CE_VARIANT_ZSTD_LEVEL   12
+#ifdef USE_BROTLI
+#define CE_VARIANT_BR           (1 << LSI_BR_COMPRESS)
+#else
+#define CE_VARIANT_BR           0
+#endif
+#ifdef USE_ZSTD
+#define CE_VARIANT_ZSTD         (1 << LSI_ZSTD_COMPRESS)
+#else
+#define CE_VARIANT_ZSTD         0
+#endif
+#define CE_VARIANT_ALL          ((1 << LSI_NO_COMPRESS) | (1 << LSI_GZIP_COMPRESS) \
+                                 | CE_VARIANT_BR | CE_VARIANT_ZSTD)
+
 /////////////////////////////////////////////////////////////////////////////
 extern lsi_module_t MNAME;
 
@@ -115,6 +144,29 @@ enum
     CE_STATE_CACHEFAILED,
 };
 
+//Collapsed forwarding state of a request missed the public cache
+enum
+{
+    CE_FILL_NONE = 0,
+    CE_FILL_OWNER,
+    CE_FILL_WAITING,
+    CE_FILL_DONE,
+};
+
+#define CE_FILL_POLL_MS     20
+#define CE_FILL_PASS_SECS   120
+
+//Seconds a background refresh of a stale object holds its slot at most
+#define CE_REFRESH_TIMEOUT  60
+
+//Env of ESI fragment subrequests, "<assembly id>:<fragment index>"
+#define CE_ESI_ENV          "LSCACHE_ESI"
+#define CE_ESI_ENV_LEN      (sizeof(CE_ESI_ENV) - 1)
+#define CE_ESI_POLL_MS      1000
+
+//Seconds a shell waits for its fragments at most
+#define CE_ESI_TIMEOUT      30
+
 enum HTTP_METHOD
 {
     HTTP_UNKNOWN = 0,
@@ -188,7 +240,20 @@ struct MyMData
     uint8_t         hkptIndex;
     uint8_t         hasCacheFrontend;
     uint8_t         reqCompressType; //0, no, 1: gzip, 2:br
+    uint8_t         reqAcceptBr;
+    uint8_t         reqAcceptZstd;
+    uint8_t         needVariant;
     uint8_t         saveFailed;
+    uint8_t         fillState;
+    uint8_t         staleRefresh;
+    uint8_t         warmSlot; //CacheWarmer slot + 1 of a warm-up subrequest
+    uint8_t         esiIdx;   //fragment index of an ESI fragment subrequest
+    int32_t         esiId;    //assembly of an ESI fragment subrequest, or 0
+    int16_t         slabSeg;  //pinned slab segment + 1 of a hit
+    int32_t         tmFillWait;
+    struct EsiAssembly *pEsi;
+    AutoBuf        *pEsiBody; //body of a fragment subrequest not stored
+    long            fillEvtObj;
     XXH64_state_t   contentState;
     z_stream       *zstream;
     off_t           orgFileLength;
@@ -230,6 +295,16 @@ static lsi_config_key_t paramArray[] =
     {"purgeUri",                18, 0},
     {"reqHeaderVary",           19, 0},
     {"CacheKeyModify",          20, 0},
+    {"memCacheSize",            21, 0},
+    {"memCacheMaxObjSize",      22, 0},
+    {"collapseMissWait",        23, 0},
+    {"staleRevalidate",         24, 0},
+    {"slabCacheSize",           25, 0},
+    {"slabMaxObjSize",          26, 0},
+    {"warmUpList",              27, 0},
+    {"warmUpTopN",              28, 0},
+    {"warmUpConcurrency",       29, 0},
+    {"warmUpVary",              30, 0},
 
     {NULL, 0, 0} //Must have NULL in the last item
 };
@@ -255,6 +330,119 @@ static int createCachePath(const char *path, int mode)
 }
 
 
+static TPointerList<DirHashCacheStore> s_stores;
+
+
+/**
+ * A snapshot is saved a part at a time. The event loop copies the records
+ * of the next part from the shared memory, the offloader thread only writes
+ * it to the file, then the next part is copied when it is done. Only one is
+ * saved at a time, the store is cleared when it is done.
+ */
+struct SnapshotTask
+{
+    ls_offload          m_task;
+    DirHashCacheStore  *m_pStore;
+    SnapshotCursor     *m_pCursor;
+    AutoBuf             m_buf;
+    int                 m_iLast;
+    int                 m_iRet;
+};
+
+static struct Offloader *s_pSnapshotOffloader = NULL;
+static SnapshotTask s_snapshotTask;
+
+
+static int snapshotPerform(ls_offload *pTask)
+{
+    SnapshotTask *pSnapTask = (SnapshotTask *)pTask->param_task_done;
+    pSnapTask->m_iRet = pSnapTask->m_pStore->getManager()->writeSnapshot(
+                            pSnapTask->m_pCursor, pSnapTask->m_buf.begin(),
+                            pSnapTask->m_buf.size(), pSnapTask->m_iLast);
+    return pSnapTask->m_iRet;
+}
+
+
+static void snapshotRelease(ls_offload *pTask)
+{
+    --pTask->ref_cnt;
+}
+
+
+static void endSnapshot(SnapshotTask *pSnapTask)
+{
+    if (pSnapTask->m_pCursor)
+    {
+        if (pSnapTask->m_pCursor->m_fd != -1)
+            close(pSnapTask->m_pCursor->m_fd);
+        delete pSnapTask->m_pCursor;
+        pSnapTask->m_pCursor = NULL;
+    }
+    pSnapTask->m_buf.clear();
+    pSnapTask->m_pStore = NULL;
+}
+
+
+static void queueSnapshotPart(SnapshotTask *pSnapTask)
+{
+    pSnapTask->m_buf.clear();
+    pSnapTask->m_iLast = pSnapTask->m_pStore->getManager()->copySnapshot(
+                             pSnapTask->m_pCursor, &pSnapTask->m_buf);
+    if (pSnapTask->m_iLast == LS_FAIL)
+    {
+        endSnapshot(pSnapTask);
+        return;
+    }
+    if (offloader_enqueue(s_pSnapshotOffloader, &pSnapTask->m_task,
+                          NULL) == -1)
+    {
+        g_api->log(NULL, LSI_LOG_ERROR,
+                   "[%s] failed to queue cache snapshot.\n", ModuleNameStr);
+        endSnapshot(pSnapTask);
+    }
+}
+
+
+static void snapshotDone(void *param)
+{
+    SnapshotTask *pSnapTask = (SnapshotTask *)param;
+    if (pSnapTask->m_iRet == LS_OK && !pSnapTask->m_iLast)
+        queueSnapshotPart(pSnapTask);
+    else
+        endSnapshot(pSnapTask);
+}
+
+
+static struct ls_offload_api s_snapshotApi =
+{
+    snapshotPerform,
+    snapshotRelease,
+    snapshotDone
+};
+
+
+static void saveSnapshotInBackground(DirHashCacheStore *pStore)
+{
+    if (!s_pSnapshotOffloader)
+    {
+        s_pSnapshotOffloader = offloader_new("CACHESNAP", 1);
+        if (!s_pSnapshotOffloader)
+        {
+            g_api->log(NULL, LSI_LOG_ERROR,
+                       "[%s] failed to start the offloader to save cache "
+                       "snapshot.\n", ModuleNameStr);
+            return;
+        }
+        memset(&s_snapshotTask.m_task, 0, sizeof(s_snapshotTask.m_task));
+        s_snapshotTask.m_task.api = &s_snapshotApi;
+        s_snapshotTask.m_task.param_task_done = &s_snapshotTask;
+    }
+    s_snapshotTask.m_pStore = pStore;
+    s_snapshotTask.m_pCursor = new SnapshotCursor;
+    queueSnapshotPart(&s_snapshotTask);
+}
+
+
 static void house_keeping_cb(const void *p)
 {
     DirHashCacheStore *pStore = (DirHashCacheStore *)p;
@@ -262,6 +450,11 @@ static void house_keeping_cb(const void *p)
     {
         pStore->houseKeeping();
         pStore->cleanByTracking(100, 100);
+        if (pStore->getSlabTier())
+            pStore->getSlabTier()->houseKeeping();
+        if (!s_snapshotTask.m_pStore && pStore->getManager()
+            && pStore->getManager()->shouldSaveSnapshot())
+            saveSnapshotInBackground(pStore);
         //g_api->log(NULL, LSI_LOG_DEBUG, "[%s]house_keeping_cb with store %p.\n",
         //           ModuleNameStr, pStore);
     }
@@ -342,6 +535,7 @@ static int parseStoragePath(CacheConfig *pConfig, const char *pValStr,
             pConfig->getStore()->initManager();
             pConfig->setOwnStore(1);
             g_api->set_timer(10*1000, 1, house_keeping_cb, pConfig->getStore());
+            s_stores.push_back(pConfig->getStore());
 
             g_api->log(NULL, LSI_LOG_DEBUG,
                        "[%s]parseConfig setStoragePath [%s] for level %d[name: %s].\n",
@@ -486,6 +680,14 @@ static int parseLine(CacheConfig *pConfig, int param_id,
     case 18:
     case 19:
     case 20:
+    case 21:
+    case 22:
+    case 25:
+    case 26:
+    case 27:
+    case 28:
+    case 29:
+    case 30:
         return i; //return the index for next step parsing
 
     case 16:
@@ -498,6 +700,18 @@ static int parseLine(CacheConfig *pConfig, int param_id,
         defValue = 0;
         break;
 
+    case 23:
+        bit = CACHE_COLLAPSE_WAIT;
+        maxValue = 300;
+        defValue = 0;
+        break;
+
+    case 24:
+        bit = CACHE_STALE_REVALIDATE;
+        maxValue = 64;
+        defValue = 0;
+        break;
+
     default:
         return 0;
     }
@@ -524,6 +738,12 @@ static int parseLine(CacheConfig *pConfig, int param_id,
     case CACHE_ADD_ETAG:
         pConfig->setAddEtagType(value);
         break;
+    case CACHE_COLLAPSE_WAIT:
+        pConfig->setCollapseWait(value);
+        break;
+    case CACHE_STALE_REVALIDATE:
+        pConfig->setStaleRevalidate(value);
+        break;
     default:
         break;
     }
@@ -548,6 +768,7 @@ static void verifyStoreReady(CacheConfig *pConfig)
         pConfig->getStore()->initManager();
         pConfig->setOwnStore(1);
         g_api->set_timer(10*1000, 1, house_keeping_cb, pConfig->getStore());
+        s_stores.push_back(pConfig->getStore());
     }
     else
         g_api->log(NULL, LSI_LOG_ERROR,
@@ -642,6 +863,14 @@ static void *ParseConfig(module_param_info_t *param, int param_count,
 {
     CacheConfig *pInitConfig = (CacheConfig *)_initial_config;
     CacheConfig *pConfig = new CacheConfig;
+    int64_t memCacheSize = 0;
+    int memCacheMaxObj = 0;
+    int64_t slabCacheSize = 0;
+    int slabMaxObj = 0;
+    AutoStr2 warmUpList;
+    int warmUpTopN = CACHE_WARMER_DEF_TOPN;
+    int warmUpConcurrency = CACHE_WARMER_DEF_CONCURRENCY;
+    CacheWarmer *pWarmer = NULL;
     if (!pConfig)
         return NULL;
 
@@ -677,18 +906,102 @@ static void *ParseConfig(module_param_info_t *param, int param_count,
             setVaryList(pConfig, param[i].val, param[i].val_len);
         else if (ret == 20)
             pConfig->parseCacheKeyMod(param[i].val, param[i].val_len);
+        else if (ret == 21)
+            memCacheSize = strtoll(param[i].val, NULL, 10);
+        else if (ret == 22)
+            memCacheMaxObj = atoi(param[i].val);
+        else if (ret == 25)
+            slabCacheSize = strtoll(param[i].val, NULL, 10);
+        else if (ret == 26)
+            slabMaxObj = atoi(param[i].val);
+        else if (ret == 27)
+            warmUpList.setStr(param[i].val, param[i].val_len);
+        else if (ret == 28)
+            warmUpTopN = atoi(param[i].val);
+        else if (ret == 29)
+            warmUpConcurrency = atoi(param[i].val);
+        else if (ret == 30)
+        {
+            if (!pWarmer)
+                pWarmer = new CacheWarmer;
+            pWarmer->addVary(param[i].val, param[i].val_len);
+        }
 
     }
 
     parseNoCacheUrlFinal(pConfig);
     verifyStoreReady(pConfig);
+    //Small objects are kept in a shared memory tier of the store
+    if (memCacheSize > 0 && level != LSI_CFG_CONTEXT && pConfig->getStore()
+        && pConfig->getStore()->initMemTier(memCacheSize, memCacheMaxObj) != 0)
+        g_api->log(NULL, LSI_LOG_ERROR,
+                   "[%s] failed to init memory cache tier, size %lld.\n",
+                   ModuleNameStr, (long long)memCacheSize);
+    //Objects too large for memory go to segment files instead of one file each
+    if (slabCacheSize > 0 && level != LSI_CFG_CONTEXT && pConfig->getStore())
+    {
+        if (pConfig->getStore()->initSlabTier(slabCacheSize, slabMaxObj) == 0)
+        {
+            AutoStr2 slabDir(pConfig->getStore()->getRoot().c_str());
+            slabDir.append("slab/", 5);
+            matchDirectoryPermissions(slabDir.c_str());
+        }
+        else
+            g_api->log(NULL, LSI_LOG_ERROR,
+                       "[%s] failed to init slab cache tier, size %lld.\n",
+                       ModuleNameStr, (long long)slabCacheSize);
+    }
+    //Replay the top URLs of the vhost after a restart or a full purge
+    if (warmUpList.len() > 0 && level != LSI_CFG_VHOST)
+        g_api->log(NULL, LSI_LOG_WARN,
+                   "[%s] warmUpList is only supported at virtual host level.\n",
+                   ModuleNameStr);
+    else if (warmUpList.len() > 0)
+    {
+        if (!pWarmer)
+            pWarmer = new CacheWarmer;
+        if (warmUpTopN <= 0 || warmUpTopN > CACHE_WARMER_MAX_TOPN)
+            warmUpTopN = CACHE_WARMER_DEF_TOPN;
+        if (warmUpConcurrency <= 0
+            || warmUpConcurrency > CACHE_WARMER_MAX_CONCURRENCY)
+            warmUpConcurrency = CACHE_WARMER_DEF_CONCURRENCY;
+        pWarmer->setConcurrency(warmUpConcurrency);
+        int count = pWarmer->load(warmUpList.c_str(), warmUpTopN);
+        if (count > 0)
+        {
+            pConfig->setWarmer(pWarmer);
+            pWarmer = NULL;
+            g_api->log(NULL, LSI_LOG_INFO,
+                       "[%s] loaded %d URLs to warm up from %s.\n",
+                       ModuleNameStr, count, warmUpList.c_str());
+        }
+        else
+            g_api->log(NULL, LSI_LOG_ERROR,
+                       "[%s] no URL to warm up from %s.\n",
+                       ModuleNameStr, warmUpList.c_str());
+    }
+    if (pWarmer)
+        delete pWarmer;
     return (void *)pConfig;
 }
 
 
 static void FreeConfig(void *_config)
 {
-    delete(CacheConfig *)_config;
+    CacheConfig *pConfig = (CacheConfig *)_config;
+    TPointerList<DirHashCacheStore>::iterator iter;
+    if (pConfig->getOwnStore())
+    {
+        for (iter = s_stores.begin(); iter != s_stores.end(); ++iter)
+        {
+            if (*iter == pConfig->getStore())
+            {
+                s_stores.erase(iter);
+                break;
+            }
+        }
+    }
+    delete pConfig;
 }
 
 
@@ -1054,8 +1367,13 @@ int getPrivateCacheCookie(HttpReq *pReq, char *pDest, char *pDestEnd)
 }
 
 
+/**
+ * Append the vary cookie to the key, a missing one counts by its name.
+ * With presentOnly, missing ones are skipped, the result is a Cookie header
+ * that gives the same key to a subrequest.
+ */
 char *appendVaryCookie(HttpReq *pReq, const char *pCookeName, int len,
-                       char *pDest, char *pDestEnd)
+                       char *pDest, char *pDestEnd, int presentOnly)
 {
     cookieval_t *pIndex = pReq->getCookie(pCookeName, len);
     if (pIndex)
@@ -1063,7 +1381,7 @@ char *appendVaryCookie(HttpReq *pReq, const char *pCookeName, int len,
         const char *pCookie = pReq->getHeaderBuf().getp(pIndex->keyOff);
         pDest = copyCookie(pDest, pDestEnd, pIndex, pCookie);
     }
-    else
+    else if (!presentOnly)
     {
         pDest = copyCookie0(pDest, pDestEnd, pCookeName, len);
     }
@@ -1072,7 +1390,8 @@ char *appendVaryCookie(HttpReq *pReq, const char *pCookeName, int len,
 
 
 char *scanVaryOnList(HttpReq *pReq, const char *pListBegin,
-                     const char *pListEnd, char *pDest, char *pDestEnd)
+                     const char *pListEnd, char *pDest, char *pDestEnd,
+                     int presentOnly)
 {
     while (pListBegin < pListEnd)
     {
@@ -1092,7 +1411,7 @@ char *scanVaryOnList(HttpReq *pReq, const char *pListBegin,
         if (pVaryEnd - pVary > 0)
         {
             pDest = appendVaryCookie(pReq, pVary, pVaryEnd - pVary,
-                                     pDest, pDestEnd);
+                                     pDest, pDestEnd, presentOnly);
         }
     }
     return pDest;
@@ -1100,12 +1419,12 @@ char *scanVaryOnList(HttpReq *pReq, const char *pListBegin,
 
 
 int getCacheVaryCookie(const lsi_session_t *session, HttpReq *pReq,
-                       char *pDest, char *pDestEnd)
+                       char *pDest, char *pDestEnd, int presentOnly)
 {
     pReq->parseCookies();
 
     char *p = pDest;
-    p = appendVaryCookie(pReq, "_lscache_vary", 13, p, pDestEnd);
+    p = appendVaryCookie(pReq, "_lscache_vary", 13, p, pDestEnd, presentOnly);
 
     MyMData *myData = (MyMData *)g_api->get_module_data(session, &MNAME,
                       LSI_DATA_HTTP);
@@ -1117,13 +1436,13 @@ int getCacheVaryCookie(const lsi_session_t *session, HttpReq *pReq,
         {
             pBegin = myData->pCacheCtrlVary->c_str();
             pEnd = myData->pCacheCtrlVary->c_str() + myData->pCacheCtrlVary->len();
-            p = scanVaryOnList(pReq, pBegin, pEnd, p, pDestEnd);
+            p = scanVaryOnList(pReq, pBegin, pEnd, p, pDestEnd, presentOnly);
         }
         if (myData->pCacheVary)
         {
             pBegin = myData->pCacheVary->c_str();
             pEnd = myData->pCacheVary->c_str() + myData->pCacheVary->len();
-            p = scanVaryOnList(pReq, pBegin, pEnd, p, pDestEnd);
+            p = scanVaryOnList(pReq, pBegin, pEnd, p, pDestEnd, presentOnly);
         }
     }
 
@@ -1364,7 +1683,7 @@ void buildCacheKey(const lsi_session_t *session, const char *uri, int uriLen,
     else
     {
         pKey->m_iCookieVary = getCacheVaryCookie(session, pReq, pCookieBuf,
-                              pCookieBufEnd);
+                              pCookieBufEnd, 0);
 
         int len;
         const char *buf;
@@ -1535,6 +1854,355 @@ static void setCacheEntry(MyMData *data, CacheEntry *pEntry)
 }
 
 
+/**
+ * A stale public object being refreshed by a background subrequest, keyed by
+ * the public CacheHash. The subrequest claims it when it looks up the object
+ * and drops it when done.
+ */
+struct StaleRefresh
+{
+    unsigned char   key[HASH_KEY_LEN];
+    AutoStr2        host;
+    int32_t         tmStart;
+    uint8_t         claimed;
+};
+
+static TPointerList<StaleRefresh> s_staleRefreshes;
+
+
+static StaleRefresh *findStaleRefresh(const unsigned char *pKey)
+{
+    TPointerList<StaleRefresh>::iterator iter;
+    for (iter = s_staleRefreshes.begin(); iter != s_staleRefreshes.end();
+         ++iter)
+    {
+        if (memcmp((*iter)->key, pKey, HASH_KEY_LEN) == 0)
+            return *iter;
+    }
+    return NULL;
+}
+
+
+static void removeStaleRefresh(const unsigned char *pKey)
+{
+    int i = s_staleRefreshes.size();
+    while (--i >= 0)
+    {
+        StaleRefresh *pRefresh = s_staleRefreshes[i];
+        if ((pKey && memcmp(pRefresh->key, pKey, HASH_KEY_LEN) == 0)
+            || (!pKey && DateTime::s_curTime - pRefresh->tmStart
+                         >= CE_REFRESH_TIMEOUT))
+        {
+            s_staleRefreshes.erase(s_staleRefreshes.begin() + i);
+            delete pRefresh;
+        }
+    }
+}
+
+
+static int isSubRequest(const lsi_session_t *session)
+{
+    char achVal[8];
+    return (g_api->get_req_var_by_id(session, LSI_VAR_IS_SUBREQ, achVal,
+                                     sizeof(achVal)) == 4);
+}
+
+
+/**
+ * Return 1 if the stale public entry should be served while a background
+ * subrequest refreshes it, 0 to update it in-band with this request.
+ * Background refreshes are limited per host, over the limit the stale copy
+ * is served and a later request starts the refresh. The subrequest has the
+ * minimal header set and the vary cookies of this request, so it gets the
+ * same public key; a URL also varying on other request headers is
+ * refreshed in-band.
+ */
+static int refreshInBackground(lsi_param_t *rec, MyMData *myData)
+{
+    int limit = myData->pConfig->getStaleRevalidate();
+    const unsigned char *pKey = myData->cePublicHash.getKey();
+    HttpReq *pReq = ((HttpSession *)rec->session)->getReq();
+    char achCookie[MAX_HEADER_LEN + 8];
+    StaleRefresh *pRefresh;
+    lsi_subreq_t subReq;
+    int count = 0;
+
+    if (limit <= 0 || !g_api->exec_bg_subreq || !myData->pOrgUri)
+        return 0;
+    removeStaleRefresh(NULL);
+    if ((pRefresh = findStaleRefresh(pKey)) != NULL)
+    {
+        if (pRefresh->claimed || !isSubRequest(rec->session))
+            return 1;
+        pRefresh->claimed = 1;
+        myData->staleRefresh = 1;
+        return 0;
+    }
+    if (isSubRequest(rec->session))
+        return 0;
+
+    TPointerList<StaleRefresh>::iterator iter;
+    for (iter = s_staleRefreshes.begin(); iter != s_staleRefreshes.end();
+         ++iter)
+    {
+        if ((*iter)->host.len() == myData->hostPortLen
+            && memcmp((*iter)->host.c_str(), myData->pOrgUri,
+                      myData->hostPortLen) == 0)
+            ++count;
+    }
+    if (count >= limit)
+    {
+        g_api->log(rec->session, LSI_LOG_DEBUG,
+                   "[%s] %d background refreshes for [%.*s], serve stale.\n",
+                   ModuleNameStr, count, myData->hostPortLen, myData->pOrgUri);
+        return 1;
+    }
+
+    if (myData->pConfig->getStore()->getManager()->getUrlVaryId(
+            myData->pOrgUri, myData->orgUriLen + myData->hostPortLen) > 0)
+        return 0;
+
+    memset(&subReq, 0, sizeof(subReq));
+    subReq.m_flag = LSI_SUBREQ_SET_HEADERS;
+    subReq.m_method = HTTP_GET;
+    subReq.m_pUri = myData->pOrgUri + myData->hostPortLen;
+    subReq.m_uriLen = myData->orgUriLen;
+    subReq.m_pQs = g_api->get_req_query_string(rec->session, &subReq.m_qsLen);
+    subReq.m_pCookie = achCookie;
+    subReq.m_cookieLen = getCacheVaryCookie(rec->session, pReq, achCookie,
+                                            achCookie + MAX_HEADER_LEN, 1);
+    if (g_api->exec_bg_subreq(rec->session, &subReq) != LS_OK)
+        return 0;
+
+    pRefresh = new StaleRefresh;
+    memmove(pRefresh->key, pKey, HASH_KEY_LEN);
+    pRefresh->host.setStr(myData->pOrgUri, myData->hostPortLen);
+    pRefresh->tmStart = DateTime::s_curTime;
+    pRefresh->claimed = 0;
+    s_staleRefreshes.push_back(pRefresh);
+    g_api->log(rec->session, LSI_LOG_DEBUG,
+               "[%s] serve stale, refresh [%s] in background.\n",
+               ModuleNameStr, myData->pOrgUri);
+    return 1;
+}
+
+
+/**
+ * Free the slot of a warm-up subrequest, the last one of a pass logs how
+ * long the pass took.
+ */
+static void releaseWarmSlot(const lsi_session_t *session, MyMData *myData)
+{
+    CacheWarmer *pWarmer = myData->pConfig->getWarmer();
+    if (pWarmer && pWarmer->release(myData->warmSlot - 1))
+        g_api->log(session, LSI_LOG_INFO,
+                   "[%s] cache warm-up pass done in %d seconds.\n",
+                   ModuleNameStr,
+                   (int)(DateTime::s_curTime - pWarmer->getPassStart()));
+    myData->warmSlot = 0;
+}
+
+
+/**
+ * Start warm-up subrequests from the seed while the warmer of the vhost has
+ * free slots, a full purge of the cache starts a new pass. The subrequests
+ * carry the cookies and user agent of the vary combination.
+ */
+static void pumpWarmer(CacheWarmer *pWarmer)
+{
+    const lsi_session_t *session = pWarmer->getSeed();
+    const AutoStr2 *pUrl;
+    const CacheWarmVary *pVary;
+    lsi_subreq_t subReq;
+    int slot;
+
+    if (!session || !pWarmer->getStore()->getManager())
+        return;
+    if (pWarmer->restart(pWarmer->getStore()->getManager()->getPurgeTime()))
+        g_api->log(NULL, LSI_LOG_INFO,
+                   "[%s] start cache warm-up pass of %d URLs.\n",
+                   ModuleNameStr, pWarmer->getUrlCount());
+
+    while ((slot = pWarmer->next(&pUrl, &pVary)) != -1)
+    {
+        const char *pQs = (const char *)memchr(pUrl->c_str(), '?',
+                                               pUrl->len());
+        memset(&subReq, 0, sizeof(subReq));
+        subReq.m_flag = LSI_SUBREQ_SET_HEADERS;
+        subReq.m_method = HTTP_GET;
+        subReq.m_pUri = pUrl->c_str();
+        subReq.m_uriLen = pQs ? pQs - pUrl->c_str() : pUrl->len();
+        if (pQs)
+        {
+            subReq.m_pQs = pQs + 1;
+            subReq.m_qsLen = pUrl->len() - subReq.m_uriLen - 1;
+        }
+        subReq.m_pCookie = pVary->m_cookie.c_str();
+        subReq.m_cookieLen = pVary->m_cookie.len();
+        if (pVary->m_userAgent.len() > 0)
+        {
+            subReq.m_pUserAgent = pVary->m_userAgent.c_str();
+            subReq.m_userAgentLen = pVary->m_userAgent.len();
+        }
+        if (g_api->exec_bg_subreq(session, &subReq) != LS_OK)
+        {
+            //Skipped, the timer carries on with the next URL
+            g_api->log(NULL, LSI_LOG_DEBUG,
+                       "[%s] failed to start warm-up of [%s].\n",
+                       ModuleNameStr, pUrl->c_str());
+            pWarmer->release(slot);
+            break;
+        }
+        g_api->log(NULL, LSI_LOG_DEBUG,
+                   "[%s] warm up [%s] in background.\n",
+                   ModuleNameStr, pUrl->c_str());
+    }
+}
+
+
+static void warm_timer_cb(const void *p)
+{
+    pumpWarmer((CacheWarmer *)p);
+}
+
+
+/**
+ * The first request of the vhost leaves a seed for the warmer, from then on
+ * the timer drives the passes.
+ */
+static void startWarmer(const lsi_session_t *session, CacheConfig *pConfig)
+{
+    CacheWarmer *pWarmer = pConfig->getWarmer();
+    const lsi_session_t *pSeed;
+    int id;
+
+    if (!g_api->hold_bg_session || !pConfig->getStore())
+        return;
+    if ((pSeed = g_api->hold_bg_session(session)) == NULL)
+        return;
+    id = g_api->set_timer(CACHE_WARMER_TIMER_MS, 1, warm_timer_cb, pWarmer);
+    pWarmer->setSeed(pSeed, pConfig->getStore(), id);
+    pumpWarmer(pWarmer);
+}
+
+
+/**
+ * A public object is stored with the encoding of the response that filled
+ * it, the other encodings are kept as separate variant objects with the
+ * same key, under a hash derived from the public hash.
+ */
+static void calcVariantHash(const CacheHash &hash, int compressType,
+                            CacheHash *pVariant)
+{
+    pVariant->setKey(XXH64(hash.getKey(), HASH_KEY_LEN,
+                           CE_VARIANT_SEED + compressType));
+}
+
+
+static int getWantedCompressType(MyMData *myData)
+{
+#ifdef USE_ZSTD
+    if (myData->reqAcceptZstd)
+        return LSI_ZSTD_COMPRESS;
+#endif
+#ifdef USE_BROTLI
+    if (myData->reqAcceptBr)
+        return LSI_BR_COMPRESS;
+#endif
+    return myData->reqCompressType;
+}
+
+
+//A variant older than the object it was built from belongs to a replaced one
+static CacheEntry *findVariant(MyMData *myData, CacheEntry *pPrimary,
+                               int compressType)
+{
+    CacheHash hash;
+    calcVariantHash(myData->cePublicHash, compressType, &hash);
+    int savedIpLen = myData->cacheKey.m_ipLen;
+    myData->cacheKey.m_ipLen = 0 - savedIpLen;
+    CacheEntry *pEntry = myData->pConfig->getStore()->getCacheEntry(hash,
+                         &myData->cacheKey, myData->pConfig->getMaxStale(), -1);
+    myData->cacheKey.m_ipLen = savedIpLen;
+    if (!pEntry || pEntry->isStale() || pEntry->isUnderConstruct()
+        || pEntry->getCompressType() != compressType
+        || pEntry->isOlderThan(pPrimary->getHeader().m_tmCreated,
+                               pPrimary->getHeader().m_msCreated))
+        return NULL;
+    return pEntry;
+}
+
+
+/**
+ * Switch a public hit to the variant matching the request encoding, so the
+ * object is sent as stored instead of being transcoded on every hit. When
+ * there is none yet, the handler builds the variants in the background.
+ */
+static void selectVariant(lsi_param_t *rec, MyMData *myData)
+{
+    CacheEntry *pPrimary = myData->pEntry;
+    int wanted = getWantedCompressType(myData);
+    int compressType = pPrimary->getCompressType();
+    if (compressType == wanted || compressType == LSI_BR_COMPRESS)
+        return;
+
+    CacheEntry *pVariant = findVariant(myData, pPrimary, wanted);
+    if (!pVariant)
+    {
+        int missing = CE_VARIANT_ALL & ~(1 << compressType);
+#ifdef USE_BROTLI
+        if (wanted == LSI_ZSTD_COMPRESS && myData->reqAcceptBr)
+        {
+            pVariant = findVariant(myData, pPrimary, LSI_BR_COMPRESS);
+            if (pVariant)
+                missing &= ~(1 << LSI_BR_COMPRESS);
+        }
+#endif
+        if (!pVariant && wanted != LSI_GZIP_COMPRESS
+            && compressType == LSI_NO_COMPRESS
+            && myData->reqCompressType == LSI_GZIP_COMPRESS)
+        {
+            pVariant = findVariant(myData, pPrimary, LSI_GZIP_COMPRESS);
+            if (pVariant)
+                missing &= ~(1 << LSI_GZIP_COMPRESS);
+        }
+        //The identity copy stored by the first decoded hit of a zstd object
+        if (!pVariant && compressType == LSI_ZSTD_COMPRESS)
+        {
+            pVariant = findVariant(myData, pPrimary, LSI_NO_COMPRESS);
+            if (pVariant)
+                missing &= ~(1 << LSI_NO_COMPRESS);
+        }
+        //Built from the object served, flagged once the build is started
+        if (myData->iMethod == HTTP_GET && !pPrimary->isVariantQueued()
+            && !(pVariant && pVariant->isVariantQueued()))
+            myData->needVariant = missing;
+    }
+    if (pVariant)
+    {
+        g_api->log(rec->session, LSI_LOG_DEBUG,
+                   "[%s] use variant with compressType %d instead of %d.\n",
+                   ModuleNameStr, pVariant->getCompressType(), compressType);
+        setCacheEntry(myData, pVariant);
+    }
+}
+
+
+/**
+ * A private zstd object is not decoded on every hit of a client without
+ * zstd, it is a miss and filled again in the encoding of the client.
+ */
+static int isPrivateServable(MyMData *myData, CacheEntry *pEntry)
+{
+#ifdef USE_ZSTD
+    if (pEntry->getCompressType() == LSI_ZSTD_COMPRESS
+        && !myData->reqAcceptZstd)
+        return 0;
+#endif
+    return 1;
+}
+
+
 short lookUpCache(lsi_param_t *rec, MyMData *myData, int no_vary,
                   const char *uri, int uriLen,
                   DirHashCacheStore *pDirHashCacheStore,
@@ -1556,7 +2224,7 @@ short lookUpCache(lsi_param_t *rec, MyMData *myData, int no_vary,
               &myData->cacheKey, pConfig->getMaxStale(), lastCacheFlush);
     setCacheEntry(myData, pEntry);
     if (pEntry && (!pEntry->isStale() || pEntry->isUpdating())
-        && !pEntry->isUnderConstruct())
+        && !pEntry->isUnderConstruct() && isPrivateServable(myData, pEntry))
         return CE_STATE_HAS_PRIVATE_CACHE;
 
     if (doPublic)
@@ -1571,7 +2239,8 @@ short lookUpCache(lsi_param_t *rec, MyMData *myData, int no_vary,
         myData->cacheKey.m_ipLen = savedIpLen;
         if (pEntry)
         {
-            if (pEntry->isStale() && !pEntry->isUpdating())
+            if (pEntry->isStale() && !pEntry->isUpdating()
+                && !refreshInBackground(rec, myData))
             {
                 CacheEntry *pNewEntry = myData->pConfig->getStore()->
                                         createCacheEntry(myData->cePublicHash,
@@ -1590,7 +2259,12 @@ short lookUpCache(lsi_param_t *rec, MyMData *myData, int no_vary,
             }
 
             if (!pEntry->isUnderConstruct())
+            {
+                //A shell is assembled from its stored copy only
+                if (!pEntry->isStale() && !pEntry->isEsi())
+                    selectVariant(rec, myData);
                 return CE_STATE_HAS_PUBLIC_CACHE;
+            }
             else
                 return CE_STATE_NOCACHE;
         }
@@ -1603,24 +2277,565 @@ short lookUpCache(lsi_param_t *rec, MyMData *myData, int no_vary,
 }
 
 
-static int releaseMData(void *data)
-{
-    MyMData *myData = (MyMData *)data;
-    if (myData)
-    {
-        if (myData->pEntry)
-            myData->pEntry->decRef();
+static TPointerList<MyMData> s_fillWaiters;
+static int s_fillTimerId = -1;
 
-        if (myData->pOrgUri)
-            delete []myData->pOrgUri;
 
-        if (myData->zstream)
+static void checkFillTimer();
+
+
+static void removeFillWaiter(MyMData *myData)
+{
+    TPointerList<MyMData>::iterator iter;
+    for (iter = s_fillWaiters.begin(); iter != s_fillWaiters.end(); ++iter)
+    {
+        if (*iter == myData)
         {
-            deflateEnd(myData->zstream);
-            delete myData->zstream;
+            s_fillWaiters.erase(iter);
+            break;
         }
-        if (myData->pCacheCtrlVary)
-            delete myData->pCacheCtrlVary;
+    }
+    myData->fillEvtObj = 0;
+    checkFillTimer();
+}
+
+
+/**
+ * Resume the requests waiting for the object of pKey, or when pKey is NULL,
+ * those whose fill lock is gone or that waited long enough.
+ */
+static void wakeFillWaiters(const unsigned char *pKey)
+{
+    MyMData *pWaiter;
+    long evtObj;
+    int i = s_fillWaiters.size();
+    while (--i >= 0)
+    {
+        pWaiter = s_fillWaiters[i];
+        if (pKey)
+        {
+            if (memcmp(pKey, pWaiter->cePublicHash.getKey(), HASH_KEY_LEN) != 0)
+                continue;
+        }
+        else if ((DateTime::s_curTime - pWaiter->tmFillWait
+                  < pWaiter->pConfig->getCollapseWait())
+                 && pWaiter->pConfig->getStore()->getManager()->isFillLocked(
+                     pWaiter->cePublicHash.getKey(), HASH_KEY_LEN))
+            continue;
+        s_fillWaiters.erase(s_fillWaiters.begin() + i);
+        evtObj = pWaiter->fillEvtObj;
+        pWaiter->fillEvtObj = 0;
+        g_api->schedule_event(evtObj, 1);
+    }
+    checkFillTimer();
+}
+
+
+//Fill locks held by other processes are polled
+static void fillTimerCb(const void *p)
+{
+    wakeFillWaiters(NULL);
+}
+
+
+static void checkFillTimer()
+{
+    if (s_fillWaiters.size() == 0)
+    {
+        if (s_fillTimerId != -1)
+        {
+            g_api->remove_timer(s_fillTimerId);
+            s_fillTimerId = -1;
+        }
+    }
+    else if (s_fillTimerId == -1)
+        s_fillTimerId = g_api->set_timer(CE_FILL_POLL_MS, 1, fillTimerCb, NULL);
+}
+
+
+/**
+ * With iPassSecs > 0 the response will not be cached publicly, misses of
+ * the object do not wait for a filler for that long.
+ */
+static void releaseFill(MyMData *myData, int iPassSecs)
+{
+    if (myData->fillState != CE_FILL_OWNER)
+        return;
+    myData->fillState = CE_FILL_DONE;
+    myData->pConfig->getStore()->getManager()->unlockFill(
+        myData->cePublicHash.getKey(), HASH_KEY_LEN, iPassSecs);
+    wakeFillWaiters(myData->cePublicHash.getKey());
+}
+
+
+static int inflateToBuf(const unsigned char *pBuf, int len, AutoBuf *pOut);
+static int decodeToBuf(int compressType, const char *pBuf, int len,
+                       AutoBuf *pOut);
+
+
+/**
+ * Copy the body of an entry, and the fragment map following the body of a
+ * shell when pMap is given. The entry is not locked while its copy is used.
+ */
+static int readEntryBody(CacheConfig *pConfig, CacheEntry *pEntry,
+                         AutoBuf *pBuf, CacheEsiMap *pMap)
+{
+    int len = pEntry->getPart2Len();
+    off_t offset = pEntry->getPart2Offset();
+    char achHeader[64];
+    const char *pImage;
+    CacheMemTier *pMemTier;
+    int mapLen;
+
+    if (len < 0 || pBuf->guarantee(len) == -1)
+        return LS_FAIL;
+    if (pEntry->isInMem())
+    {
+        AutoBuf image(0);
+        pMemTier = pConfig->getStore()->getMemTier();
+        if (!pMemTier || pMemTier->copyImage(pEntry, &image) != LS_OK)
+            return LS_FAIL;
+        pImage = image.begin();
+        pBuf->append(pImage + offset, len);
+        if (!pMap)
+            return LS_OK;
+        if ((mapLen = CacheEsiMap::getSavedLen(pImage + offset + len,
+                                          CacheEsiMap::getHeaderLen())) <= 0)
+            return LS_FAIL;
+        return pMap->load(pImage + offset + len, mapLen, len);
+    }
+
+    if (pread(pEntry->getFdStore(), pBuf->end(), len, offset) != len)
+        return LS_FAIL;
+    pBuf->used(len);
+    if (!pMap)
+        return LS_OK;
+    offset += len;
+    if (pread(pEntry->getFdStore(), achHeader, CacheEsiMap::getHeaderLen(),
+              offset) != CacheEsiMap::getHeaderLen()
+        || (mapLen = CacheEsiMap::getSavedLen(achHeader,
+                                     CacheEsiMap::getHeaderLen())) <= 0)
+        return LS_FAIL;
+    AutoBuf mapBuf(mapLen);
+    if (pread(pEntry->getFdStore(), mapBuf.begin(), mapLen, offset) != mapLen)
+        return LS_FAIL;
+    return pMap->load(mapBuf.begin(), mapLen, len);
+}
+
+
+/**
+ * ESI assembly. A shell stored with "esi=on" keeps the map of its include
+ * tags after its body. When it is served, all of its fragments are started
+ * at once as detached subrequests tagged with CE_ESI_ENV, each is served
+ * from or stored to the cache like any other request, then hands its body
+ * back to the shell; one that is not stored hands over the body as
+ * received. The fragments are requested with the cookies and authorization
+ * of the shell request. The shell is sent in order as the fragment it stops
+ * at becomes ready. A fragment that fails renders empty.
+ */
+enum
+{
+    CE_ESI_PENDING = 0,
+    CE_ESI_READY,
+    CE_ESI_FAILED,
+};
+
+struct EsiFragmentBody
+{
+    AutoBuf     body;
+    uint8_t     state;
+    uint8_t     isHit;
+};
+
+struct EsiAssembly
+{
+    int32_t     id;
+    int32_t     tmStart;
+    long        evtObj;
+    int         iNext;
+    int         iShellOff;
+    AutoBuf     shell;
+    CacheEsiMap map;
+    TPointerList<EsiFragmentBody> fragments;
+
+    ~EsiAssembly()  {   fragments.release_objects();    }
+};
+
+
+static TPointerList<EsiAssembly> s_esiAssemblies;
+static int32_t s_esiSeq = 0;
+static int s_esiTimerId = -1;
+
+
+static EsiAssembly *findEsiAssembly(int32_t id)
+{
+    TPointerList<EsiAssembly>::iterator iter;
+    for (iter = s_esiAssemblies.begin(); iter != s_esiAssemblies.end();
+         ++iter)
+    {
+        if ((*iter)->id == id)
+            return *iter;
+    }
+    return NULL;
+}
+
+
+static void wakeEsiAssembly(EsiAssembly *pEsi)
+{
+    long evtObj = pEsi->evtObj;
+    if (!evtObj)
+        return;
+    pEsi->evtObj = 0;
+    g_api->schedule_event(evtObj, 1);
+}
+
+
+//Fragments not back in time render empty
+static void esiTimerCb(const void *p)
+{
+    TPointerList<EsiAssembly>::iterator iter;
+    EsiAssembly *pEsi;
+    int i, failed;
+    for (iter = s_esiAssemblies.begin(); iter != s_esiAssemblies.end();
+         ++iter)
+    {
+        pEsi = *iter;
+        if (DateTime::s_curTime - pEsi->tmStart < CE_ESI_TIMEOUT)
+            continue;
+        failed = 0;
+        for (i = pEsi->iNext; i < pEsi->fragments.size(); ++i)
+        {
+            if (pEsi->fragments[i]->state == CE_ESI_PENDING)
+            {
+                pEsi->fragments[i]->state = CE_ESI_FAILED;
+                ++failed;
+            }
+        }
+        if (!failed)
+            continue;
+        g_api->log(NULL, LSI_LOG_INFO,
+                   "[%s] %d ESI fragments timed out.\n", ModuleNameStr,
+                   failed);
+        wakeEsiAssembly(pEsi);
+    }
+}
+
+
+static void checkEsiTimer()
+{
+    if (s_esiAssemblies.size() == 0)
+    {
+        if (s_esiTimerId != -1)
+        {
+            g_api->remove_timer(s_esiTimerId);
+            s_esiTimerId = -1;
+        }
+    }
+    else if (s_esiTimerId == -1)
+        s_esiTimerId = g_api->set_timer(CE_ESI_POLL_MS, 1, esiTimerCb, NULL);
+}
+
+
+static void releaseEsiAssembly(MyMData *myData)
+{
+    TPointerList<EsiAssembly>::iterator iter;
+    for (iter = s_esiAssemblies.begin(); iter != s_esiAssemblies.end();
+         ++iter)
+    {
+        if (*iter == myData->pEsi)
+        {
+            s_esiAssemblies.erase(iter);
+            break;
+        }
+    }
+    delete myData->pEsi;
+    myData->pEsi = NULL;
+    checkEsiTimer();
+}
+
+
+/**
+ * Hand the body of a fragment subrequest to its shell, a NULL body fails
+ * the fragment.
+ */
+static void deliverEsiFragment(MyMData *myData, const char *pBody, int len,
+                               int isHit)
+{
+    EsiAssembly *pEsi = findEsiAssembly(myData->esiId);
+    EsiFragmentBody *pFragment;
+    myData->esiId = 0;
+    if (!pEsi || myData->esiIdx >= pEsi->fragments.size())
+        return;
+    pFragment = pEsi->fragments[myData->esiIdx];
+    if (pFragment->state != CE_ESI_PENDING)
+        return;
+    if (pBody)
+    {
+        pFragment->body.append(pBody, len);
+        pFragment->state = CE_ESI_READY;
+        pFragment->isHit = isHit;
+    }
+    else
+        pFragment->state = CE_ESI_FAILED;
+    wakeEsiAssembly(pEsi);
+}
+
+
+//Fragments are assembled as plain text, a brotli body fails the fragment.
+static void deliverEsiEntry(MyMData *myData, int isHit)
+{
+    CacheEntry *pEntry = myData->pEntry;
+    AutoBuf buf;
+    AutoBuf plain;
+    const char *pBody = NULL;
+
+    if (pEntry && pEntry->getCompressType() != LSI_BR_COMPRESS
+        && readEntryBody(myData->pConfig, pEntry, &buf, NULL) == LS_OK)
+    {
+        if (pEntry->getCompressType() == LSI_NO_COMPRESS)
+            pBody = buf.begin();
+        else if (decodeToBuf(pEntry->getCompressType(), buf.begin(),
+                             buf.size(), &plain) != LS_FAIL)
+        {
+            buf.swap(plain);
+            pBody = buf.begin();
+        }
+    }
+    deliverEsiFragment(myData, pBody, buf.size(), isHit);
+}
+
+
+//Tell a fragment subrequest started by a shell of this process.
+static void claimEsiFragment(const lsi_session_t *session, MyMData *myData)
+{
+    char achVal[32];
+    char *pEnd;
+    EsiAssembly *pEsi;
+    long id, idx;
+    int len = g_api->get_req_env(session, CE_ESI_ENV, CE_ESI_ENV_LEN, achVal,
+                                 sizeof(achVal) - 1);
+    if (len <= 0)
+        return;
+    achVal[len] = 0;
+    id = strtol(achVal, &pEnd, 10);
+    if (*pEnd != ':')
+        return;
+    idx = strtol(pEnd + 1, &pEnd, 10);
+    if ((pEsi = findEsiAssembly(id)) == NULL || idx < 0
+        || idx >= pEsi->fragments.size())
+        return;
+    myData->esiId = id;
+    myData->esiIdx = idx;
+}
+
+
+//Parse the include tags of a shell just stored and save them after the body.
+static void saveEsiMap(const lsi_session_t *session, MyMData *myData, int fd)
+{
+    CacheEntry *pEntry = myData->pEntry;
+    CacheEsiMap map;
+    AutoBuf buf;
+
+    if (readEntryBody(myData->pConfig, pEntry, &buf, NULL) == LS_OK
+        && map.parse(buf.begin(), buf.size()) > 0)
+    {
+        buf.clear();
+        map.save(&buf);
+        if (write(fd, buf.begin(), buf.size()) == buf.size())
+        {
+            g_api->log(session, LSI_LOG_DEBUG,
+                       "[%s] ESI shell with %d fragments.\n",
+                       ModuleNameStr, map.getCount());
+            return;
+        }
+    }
+    pEntry->setFlag(CeHeader::CEH_ESI, 0);
+}
+
+
+static int esiResumeCb(lsi_session_t *session, long lParam, void *pParam)
+{
+    if (!session)
+        return 0;
+    g_api->set_handler_write_state(session, 1);
+    return 0;
+}
+
+
+/**
+ * Send the shell up to the first fragment not back yet, return 1 when all
+ * is sent, 0 to wait for more fragments, -1 on error.
+ */
+static int writeEsi(const lsi_session_t *session, EsiAssembly *pEsi)
+{
+    const CacheEsiFragment *pInclude;
+    EsiFragmentBody *pFragment;
+    while (pEsi->iNext < pEsi->fragments.size())
+    {
+        pInclude = pEsi->map.getFragment(pEsi->iNext);
+        if (pInclude->m_offset > pEsi->iShellOff)
+        {
+            if (g_api->append_resp_body(session,
+                                        pEsi->shell.begin() + pEsi->iShellOff,
+                                        pInclude->m_offset - pEsi->iShellOff)
+                < 0)
+                return -1;
+            pEsi->iShellOff = pInclude->m_offset;
+        }
+        pFragment = pEsi->fragments[pEsi->iNext];
+        if (pFragment->state == CE_ESI_PENDING)
+            return 0;
+        if (pFragment->state == CE_ESI_READY && pFragment->body.size() > 0
+            && g_api->append_resp_body(session, pFragment->body.begin(),
+                                       pFragment->body.size()) < 0)
+            return -1;
+        pEsi->iShellOff += pInclude->m_len;
+        ++pEsi->iNext;
+    }
+    if (pEsi->iShellOff < pEsi->shell.size())
+    {
+        if (g_api->append_resp_body(session,
+                                    pEsi->shell.begin() + pEsi->iShellOff,
+                                    pEsi->shell.size() - pEsi->iShellOff) < 0)
+            return -1;
+        pEsi->iShellOff = pEsi->shell.size();
+    }
+    return 1;
+}
+
+
+//A full page hit has all of its fragments served from the cache.
+static void countEsiHit(MyMData *myData)
+{
+    EsiAssembly *pEsi = myData->pEsi;
+    int i, isFull = 1;
+    for (i = 0; i < pEsi->fragments.size(); ++i)
+    {
+        if (!pEsi->fragments[i]->isHit)
+        {
+            isFull = 0;
+            break;
+        }
+    }
+    myData->pConfig->getStore()->getManager()->incFullPageHits(isFull);
+}
+
+
+/**
+ * Serve a shell, return LS_FAIL if it can not be loaded. The handler goes
+ * on in onWriteEsi() until the last fragment is sent.
+ */
+static int startEsi(const lsi_session_t *session, MyMData *myData)
+{
+    EsiAssembly *pEsi = new EsiAssembly;
+    const CacheEsiFragment *pInclude;
+    EsiFragmentBody *pFragment;
+    lsi_subreq_t subReq;
+    char achEnv[32];
+    const char *pQs;
+    int i;
+
+    if (readEntryBody(myData->pConfig, myData->pEntry, &pEsi->shell,
+                      &pEsi->map) != LS_OK)
+    {
+        g_api->log(session, LSI_LOG_ERROR,
+                   "[%s] failed to load ESI shell %s.\n", ModuleNameStr,
+                   myData->pOrgUri);
+        delete pEsi;
+        return LS_FAIL;
+    }
+    if (++s_esiSeq <= 0)
+        s_esiSeq = 1;
+    pEsi->id = s_esiSeq;
+    pEsi->tmStart = DateTime::s_curTime;
+    pEsi->evtObj = 0;
+    pEsi->iNext = 0;
+    pEsi->iShellOff = 0;
+    s_esiAssemblies.push_back(pEsi);
+    myData->pEsi = pEsi;
+    checkEsiTimer();
+
+    for (i = 0; i < pEsi->map.getCount(); ++i)
+    {
+        pFragment = new EsiFragmentBody;
+        pFragment->state = CE_ESI_FAILED;
+        pFragment->isHit = 0;
+        pEsi->fragments.push_back(pFragment);
+    }
+    for (i = 0; i < pEsi->map.getCount(); ++i)
+    {
+        pInclude = pEsi->map.getFragment(i);
+        if (pInclude->m_src.len() == 0 || !g_api->exec_bg_subreq)
+            continue;
+        pQs = (const char *)memchr(pInclude->m_src.c_str(), '?',
+                                   pInclude->m_src.len());
+        memset(&subReq, 0, sizeof(subReq));
+        subReq.m_flag = LSI_SUBREQ_SET_ENV | LSI_SUBREQ_KEEP_CREDENTIALS;
+        subReq.m_method = HTTP_GET;
+        subReq.m_pUri = pInclude->m_src.c_str();
+        subReq.m_uriLen = pQs ? pQs - subReq.m_pUri : pInclude->m_src.len();
+        if (pQs)
+        {
+            subReq.m_pQs = pQs + 1;
+            subReq.m_qsLen = pInclude->m_src.len() - subReq.m_uriLen - 1;
+        }
+        subReq.m_pEnvName = CE_ESI_ENV;
+        subReq.m_envNameLen = CE_ESI_ENV_LEN;
+        subReq.m_pEnvValue = achEnv;
+        subReq.m_envValueLen = snprintf(achEnv, sizeof(achEnv), "%d:%d",
+                                        pEsi->id, i);
+        //A fragment served while started is delivered right away
+        pEsi->fragments[i]->state = CE_ESI_PENDING;
+        if (g_api->exec_bg_subreq(session, &subReq) != LS_OK)
+        {
+            pEsi->fragments[i]->state = CE_ESI_FAILED;
+            g_api->log(session, LSI_LOG_DEBUG,
+                       "[%s] failed to start ESI fragment [%s].\n",
+                       ModuleNameStr, pInclude->m_src.c_str());
+        }
+    }
+
+    g_api->set_resp_buffer_compress_method(session, LSI_NO_COMPRESS);
+    g_api->log(session, LSI_LOG_DEBUG,
+               "[%s] assemble ESI shell %s with %d fragments.\n",
+               ModuleNameStr, myData->pOrgUri, pEsi->map.getCount());
+    return LS_OK;
+}
+
+
+static int releaseMData(void *data)
+{
+    MyMData *myData = (MyMData *)data;
+    if (myData)
+    {
+        if (myData->fillEvtObj)
+            removeFillWaiter(myData);
+        releaseFill(myData, 0);
+        if (myData->staleRefresh)
+            removeStaleRefresh(myData->cePublicHash.getKey());
+        if (myData->warmSlot)
+            releaseWarmSlot(NULL, myData);
+        if (myData->slabSeg)
+            myData->pConfig->getStore()->getSlabTier()->unpin(
+                myData->slabSeg - 1);
+        if (myData->pEsi)
+            releaseEsiAssembly(myData);
+        //A fragment subrequest ended without its body
+        if (myData->esiId)
+            deliverEsiFragment(myData, NULL, 0, 0);
+        if (myData->pEntry)
+            myData->pEntry->decRef();
+
+        if (myData->pOrgUri)
+            delete []myData->pOrgUri;
+
+        if (myData->zstream)
+        {
+            deflateEnd(myData->zstream);
+            delete myData->zstream;
+        }
+        if (myData->pCacheCtrlVary)
+            delete myData->pCacheCtrlVary;
 
         if (myData->pCacheVary)
             delete myData->pCacheVary;
@@ -1628,6 +2843,9 @@ static int releaseMData(void *data)
         if (myData->pCacheKeyModList)
             delete myData->pCacheKeyModList;
 
+        if (myData->pEsiBody)
+            delete myData->pEsiBody;
+
         myData->qsBuf.release();
         delete myData;
     }
@@ -1715,6 +2933,26 @@ void getRespHeader(const lsi_session_t *session, int header_index, char **buf,
     }
 }
 
+
+//Without a Content-Type the response is taken as compressible
+static int isRespCompressible(const lsi_session_t *session)
+{
+    int contentTypelen;
+    char *pContentType = NULL;
+    getRespHeader(session, LSI_RSPHDR_CONTENT_TYPE, &pContentType,
+                  &contentTypelen);
+
+    if (pContentType && contentTypelen > 0)
+    {
+        char ch = pContentType[contentTypelen];
+        pContentType[contentTypelen] = 0;
+        char compressible = HttpMime::getMime()->compressible(pContentType);
+        pContentType[contentTypelen] = ch;
+        return compressible;
+    }
+    return 1;
+}
+
 static int bypassUrimapHook(lsi_param_t *rec, MyMData *myData)
 {
 #ifdef USE_RECV_REQ_HEADER_HOOK
@@ -1836,8 +3074,22 @@ static int endCache(lsi_param_t *rec)
 {
     MyMData *myData = (MyMData *)g_api->get_module_data(rec->session, &MNAME,
                       LSI_DATA_HTTP);
+    //Carry on warming up as warm-up subrequests finish
+    if (myData && myData->warmSlot)
+    {
+        CacheWarmer *pWarmer = myData->pConfig->getWarmer();
+        releaseWarmSlot(rec->session, myData);
+        if (pWarmer)
+            pumpWarmer(pWarmer);
+    }
     if (myData)
     {
+        if (myData->fillEvtObj)
+        {
+            long evtObj = myData->fillEvtObj;
+            removeFillWaiter(myData);
+            g_api->cancel_event(rec->session, evtObj);
+        }
         if (myData->hkptIndex)
         {
             //check if static file not optmized, or 0 byte content
@@ -1871,6 +3123,8 @@ static int endCache(lsi_param_t *rec)
 
                 lseek(fd, 0, SEEK_END);
                 deflateBufAndWriteToFile(myData, NULL, 0, 1, fd);
+                if (myData->pEntry->isEsi())
+                    saveEsiMap(rec->session, myData, fd);
 
                 if (myData->pConfig->getAddEtagType() == 2)
                 {
@@ -1890,10 +3144,13 @@ static int endCache(lsi_param_t *rec)
                 myData->pConfig->getStore()->publish(myData->pEntry);
                 myData->pConfig->getStore()->getManager()->addTracking(myData->pEntry);
                 myData->iCacheState = CE_STATE_CACHED;  //Succeed
+                releaseFill(myData, 0);
                 g_api->log(NULL, LSI_LOG_DEBUG,
                            "[%s] published %s, content length %ld.\n",
                            ModuleNameStr, myData->pOrgUri,
                            myData->orgFileLength);
+                if (myData->esiId)
+                    deliverEsiEntry(myData, 0);
             }
         }
         return cancelCache(rec);
@@ -1924,7 +3181,7 @@ static int getControlFlag(CacheConfig *pConfig)
 static void processPurge(const lsi_session_t *session,
                          const char *pValue, int valLen);
 
-static int createEntry(lsi_param_t *rec)
+static int doCreateEntry(lsi_param_t *rec)
 {
     //If have special cache headers, handle them here even if myData is NULL.
     struct iovec iov[100];
@@ -2144,6 +3401,8 @@ static int createEntry(lsi_param_t *rec)
                                  *hash, &myData->cacheKey));
         if (myData->pEntry == NULL)
         {
+            //Not a reason to pass the object
+            releaseFill(myData, 0);
             int error = myData->pConfig->getStore()->getLastError();
             if (error == EPERM)
                 g_api->log(rec->session, LSI_LOG_ERROR,
@@ -2180,6 +3439,97 @@ static int createEntry(lsi_param_t *rec)
 }
 
 
+/**
+ * A fragment subrequest whose response is not stored keeps the body hook to
+ * hand the body to its shell, myData is made again if it was freed.
+ */
+static void captureEsiFragment(lsi_param_t *rec, MyMData *myData,
+                               int32_t esiId, uint8_t esiIdx)
+{
+    int hkpt = LSI_HKPT_RCVD_RESP_BODY;
+    const char *pHandlerType = g_api->get_req_handler_type(rec->session);
+    if (pHandlerType && strcmp(pHandlerType, "static") == 0)
+        hkpt = LSI_HKPT_SEND_RESP_BODY;
+    if (!myData)
+    {
+        myData = new MyMData;
+        memset((void *)myData, 0, sizeof(MyMData));
+        g_api->set_module_data(rec->session, &MNAME, LSI_DATA_HTTP,
+                               (void *)myData);
+    }
+    else
+        clearHooksOnly(rec->session);
+    myData->esiId = esiId;
+    myData->esiIdx = esiIdx;
+    myData->pEsiBody = new AutoBuf(0);
+    myData->hkptIndex = hkpt;
+    myData->iHaveAddedHook = 2;
+    g_api->enable_hook(rec->session, &MNAME, 1, &hkpt, 1);
+}
+
+
+//Plain text for the shell, a brotli or unknown encoding fails the fragment.
+static void finishEsiCapture(const lsi_session_t *session, MyMData *myData)
+{
+    AutoBuf plain;
+    char *pEncoding = NULL;
+    int encodingLen = 0;
+    const char *pBody = myData->pEsiBody->size() ? myData->pEsiBody->begin()
+                                                 : "";
+    int len = myData->pEsiBody->size();
+
+    getRespHeader(session, LSI_RSPHDR_CONTENT_ENCODING, &pEncoding,
+                  &encodingLen);
+    if (pEncoding && encodingLen > 0)
+    {
+        if (encodingLen == 4 && strncasecmp(pEncoding, "gzip", 4) == 0
+            && decodeToBuf(LSI_GZIP_COMPRESS, pBody, len, &plain) != LS_FAIL)
+        {
+            pBody = plain.size() ? plain.begin() : "";
+            len = plain.size();
+        }
+        else
+            pBody = NULL;
+    }
+    deliverEsiFragment(myData, pBody, len, 0);
+}
+
+
+static int createEntry(lsi_param_t *rec)
+{
+    MyMData *myData = (MyMData *)g_api->get_module_data(rec->session, &MNAME,
+                                                        LSI_DATA_HTTP);
+    int32_t esiId = 0;
+    uint8_t esiIdx = 0;
+    //Not failed if myData is freed on the way
+    if (myData && myData->esiId)
+    {
+        esiId = myData->esiId;
+        esiIdx = myData->esiIdx;
+        myData->esiId = 0;
+    }
+    int ret = doCreateEntry(rec);
+    myData = (MyMData *)g_api->get_module_data(rec->session, &MNAME,
+                                               LSI_DATA_HTTP);
+    //The filler got a response that is not publicly cacheable, hit-for-pass
+    if (myData && myData->fillState == CE_FILL_OWNER
+        && (myData->iCacheState != CE_STATE_WILLCACHE
+            || myData->pEntry->isPrivate()))
+        releaseFill(myData, CE_FILL_PASS_SECS);
+    if (esiId)
+    {
+        if (myData && myData->iCacheState == CE_STATE_WILLCACHE)
+        {
+            myData->esiId = esiId;
+            myData->esiIdx = esiIdx;
+        }
+        else
+            captureEsiFragment(rec, myData, esiId, esiIdx);
+    }
+    return ret;
+}
+
+
 int cacheHeader(lsi_param_t *rec, MyMData *myData)
 {
     myData->pEntry->setMaxStale(myData->pConfig->getMaxStale());
@@ -2308,23 +3658,8 @@ int cacheHeader(lsi_param_t *rec, MyMData *myData)
      * If need to gzip but it is a small static file, no need
      * Or it is not compressible, no need
      */
-    if (needGzip)
-    {
-        int contentTypelen;
-        char *pContentType = NULL;
-        getRespHeader(rec->session, LSI_RSPHDR_CONTENT_TYPE, &pContentType,
-                      &contentTypelen);
-
-        if (pContentType && contentTypelen > 0)
-        {
-            char ch = pContentType[contentTypelen];
-            pContentType[contentTypelen] = 0;
-            char compressible = HttpMime::getMime()->compressible(pContentType);
-            pContentType[contentTypelen] = ch;
-            if (!compressible)
-                needGzip = false;
-        }
-    }
+    if (needGzip && !isRespCompressible(rec->session))
+        needGzip = false;
 
     const char *phandlerType = g_api->get_req_handler_type(rec->session);
     if (needGzip && phandlerType && strlen(phandlerType) == 6 &&
@@ -2349,6 +3684,15 @@ int cacheHeader(lsi_param_t *rec, MyMData *myData)
         }
     }
 
+    /**
+     * A shell is stored as it is sent, its include tags are looked up once
+     * the body is complete.
+     */
+    int isEsi = ((myData->cacheCtrl.getFlags() & CacheCtrl::esi_on)
+        && g_api->get_resp_buffer_compress_method(rec->session) == 0);
+    if (isEsi)
+        needGzip = false;
+
     if (needGzip)
     {
         myData->zstream = new z_stream;
@@ -2369,6 +3713,7 @@ int cacheHeader(lsi_param_t *rec, MyMData *myData)
     if (compress_method == 0 && needGzip)
         compress_method  = 1;
     myData->pEntry->markReady(compress_method);
+    myData->pEntry->setFlag(CeHeader::CEH_ESI, isEsi);
 
     myData->pEntry->saveCeHeader();
 
@@ -2452,6 +3797,27 @@ int cacheTofile(lsi_param_t *rec)
     if (!myData)
         return 0;
 
+    if (myData->pEsiBody)
+    {
+        void *pRespBodyBuf = g_api->get_resp_body_buf(rec->session);
+        off_t offset = 0;
+        const char *pBuf;
+        int len;
+        while (!g_api->is_body_buf_eof(pRespBodyBuf, offset))
+        {
+            len = 0;
+            pBuf = g_api->acquire_body_buf_block(pRespBodyBuf, offset, &len);
+            if (!pBuf || len <= 0)
+                break;
+            myData->pEsiBody->append(pBuf, len);
+            g_api->release_body_buf_block(pRespBodyBuf, offset);
+            offset += len;
+        }
+        finishEsiCapture(rec->session, myData);
+        clearHooks(rec->session);
+        return 0;
+    }
+
     if (myData->iCacheSendBody == 0) //uninit
     {
         myData->iCacheSendBody = 1; //need cache
@@ -2542,6 +3908,20 @@ int cacheTofileFilter(lsi_param_t *rec)
     if (!myData || myData->saveFailed)
         return rec->len1;
 
+    if (myData->pEsiBody)
+    {
+        int ret = g_api->stream_write_next(rec, (const char *)rec->ptr1,
+                                           rec->len1);
+        if (ret > 0)
+            myData->pEsiBody->append((const char *)rec->ptr1, ret);
+        if (rec->flag_in & LSI_CBFI_EOF)
+        {
+            finishEsiCapture(rec->session, myData);
+            clearHooks(rec->session);
+        }
+        return ret;
+    }
+
     if (myData->iCacheSendBody == 0) //uninit
     {
         myData->iCacheSendBody = 1; //need cache
@@ -2805,6 +4185,60 @@ static int sessionBegin(lsi_param_t *rec)
     return 0;
 }
 
+static int checkAssignHandler(lsi_param_t *rec);
+
+
+//The object waited for is published or the wait is over, look it up again.
+static int fillWaitDoneCb(lsi_session_t *session, long lParam, void *pParam)
+{
+    lsi_param_t param;
+    if (!session)
+        return 0;
+    memset(&param, 0, sizeof(param));
+    param.session = session;
+    g_api->log(session, LSI_LOG_DEBUG,
+               "[%s] fill wait is over, look up cache again.\n",
+               ModuleNameStr);
+    g_api->resume(session, checkAssignHandler(&param));
+    return 0;
+}
+
+
+/**
+ * Collapsed forwarding of cache misses. The first request missed a public
+ * object in any process takes its fill lock and goes to the backend, the
+ * others are suspended until it is published or the lock is released.
+ * A request only waits once.
+ */
+static int waitForFill(lsi_param_t *rec, MyMData *myData)
+{
+    int wait = myData->pConfig->getCollapseWait();
+    if (wait <= 0 || myData->fillState != CE_FILL_NONE
+        || !myData->pConfig->isCheckPublic())
+        return 0;
+    int ret = myData->pConfig->getStore()->getManager()->lockFill(
+                  myData->cePublicHash.getKey(), HASH_KEY_LEN, wait);
+    if (ret != 0)
+    {
+        //Hit-for-pass goes to the backend without owning the fill
+        myData->fillState = (ret > 0) ? CE_FILL_OWNER : CE_FILL_DONE;
+        return 0;
+    }
+    myData->fillState = CE_FILL_WAITING;
+    myData->fillEvtObj = g_api->get_event_obj(fillWaitDoneCb, rec->session,
+                                              0, NULL);
+    if (!myData->fillEvtObj)
+        return 0;
+    myData->tmFillWait = DateTime::s_curTime;
+    s_fillWaiters.push_back(myData);
+    checkFillTimer();
+    g_api->log(rec->session, LSI_LOG_DEBUG,
+               "[%s] %s is being filled by another request, wait.\n",
+               ModuleNameStr, myData->pOrgUri);
+    return 1;
+}
+
+
 static int checkAssignHandler(lsi_param_t *rec)
 {
     char val[3] = {0};
@@ -2905,6 +4339,24 @@ static int checkAssignHandler(lsi_param_t *rec)
     myData->pConfig = pConfig;
     myData->iMethod = method;
 
+    if (!myData->esiId && isSubRequest(rec->session))
+        claimEsiFragment(rec->session, myData);
+
+    if (pConfig->getWarmer())
+    {
+        if (!myData->warmSlot && myData->pOrgUri && isSubRequest(rec->session))
+        {
+            int qsLen;
+            const char *pQs = g_api->get_req_query_string(rec->session, &qsLen);
+            myData->warmSlot = 1 + pConfig->getWarmer()->claim(
+                                   myData->pOrgUri + myData->hostPortLen,
+                                   myData->orgUriLen, pQs, qsLen);
+        }
+        else if (!pConfig->getWarmer()->getSeed()
+                 && !isSubRequest(rec->session))
+            startWarmer(rec->session, pConfig);
+    }
+
     if (myData->iMethod == HTTP_PURGE || myData->iMethod == HTTP_REFRESH)
     {
         g_api->log(rec->session, LSI_LOG_DEBUG,
@@ -2953,11 +4405,20 @@ static int checkAssignHandler(lsi_param_t *rec)
         char orgChar = encoding[encodingLen];
         encoding[encodingLen] = 0;
         myData->reqCompressType = (encodingLen >= 4 && strcasestr(encoding, "gzip"));
-        if (myData->reqCompressType == LSI_NO_COMPRESS &&
-            encodingLen >= 2 && strcasestr(encoding, "br"))
+        myData->reqAcceptBr = (encodingLen >= 2 && strcasestr(encoding, "br"));
+        myData->reqAcceptZstd = (encodingLen >= 4
+                                 && strcasestr(encoding, "zstd"));
+        if (myData->reqCompressType == LSI_NO_COMPRESS && myData->reqAcceptBr)
             myData->reqCompressType = LSI_BR_COMPRESS;
         encoding[encodingLen] = orgChar;
     }
+    //ESI fragments are assembled as plain text
+    if (myData->esiId)
+    {
+        myData->reqCompressType = LSI_NO_COMPRESS;
+        myData->reqAcceptBr = 0;
+        myData->reqAcceptZstd = 0;
+    }
 
     myData->iCacheState = lookUpCache(rec, myData,
                                    cacheCtrl.getFlags() & CacheCtrl::no_vary,
@@ -2982,6 +4443,18 @@ static int checkAssignHandler(lsi_param_t *rec)
     if (myData->iCacheState != CE_STATE_NOCACHE)
         checkFileUpdateWithCache(rec, myData);//may change state
 
+    //The slab segment of a hit is not reused until the response is sent
+    if ((myData->iCacheState == CE_STATE_HAS_PRIVATE_CACHE
+         || myData->iCacheState == CE_STATE_HAS_PUBLIC_CACHE)
+        && myData->pEntry->isInSlab() && !myData->slabSeg)
+    {
+        int seg = myData->pConfig->getStore()->getSlabTier()->pin(
+                      myData->pEntry);
+        if (seg == -1)
+            myData->iCacheState = CE_STATE_NOCACHE;
+        else
+            myData->slabSeg = seg + 1;
+    }
 
     if (myData->iCacheState != CE_STATE_NOCACHE && myData->iCacheState != CE_STATE_UPDATE_STALE)
     {
@@ -2996,7 +4469,8 @@ static int checkAssignHandler(lsi_param_t *rec)
             )
         {
             assert(myData->pEntry);
-            assert(myData->pEntry->getFdStore() != -1);
+            assert(myData->pEntry->isInMem()
+                   || myData->pEntry->getFdStore() != -1);
 
             if (LS_OK != g_api->register_req_handler(rec->session, &MNAME, 0))
             {
@@ -3038,6 +4512,8 @@ static int checkAssignHandler(lsi_param_t *rec)
         if (!myData->cacheCtrl.isCacheOff()
             || (myData->pConfig->isCheckPublic() || myData->pConfig->isPrivateCheck()))
         {
+            if (waitForFill(rec, myData))
+                return LSI_SUSPEND;
             myData->iHaveAddedHook = 1;
 
             //g_api->set_session_hook_flag( rec->_session, LSI_HKPT_RCVD_RESP_BODY, &MNAME, 1 );
@@ -3183,6 +4659,20 @@ int releaseIpCounter(void *data)
 }
 
 
+//Save the cache index on shutdown, restored when the server starts again.
+static int saveSnapshots(lsi_param_t *rec)
+{
+    TPointerList<DirHashCacheStore>::iterator iter;
+    for (iter = s_stores.begin(); iter != s_stores.end(); ++iter)
+    {
+        //Leave the one being written to its thread, they share the tmp file
+        if ((*iter)->getManager() && *iter != s_snapshotTask.m_pStore)
+            (*iter)->getManager()->saveSnapshot();
+    }
+    return 0;
+}
+
+
 static lsi_serverhook_t serverHooks[] =
 {
     {LSI_HKPT_HTTP_BEGIN,       sessionBegin,       LSI_HOOK_FIRST,  LSI_FLAG_ENABLED},
@@ -3197,6 +4687,7 @@ static lsi_serverhook_t serverHooks[] =
 
     {LSI_HKPT_RCVD_RESP_BODY,   cacheTofile,        LSI_HOOK_LAST + 1,  0},
     {LSI_HKPT_SEND_RESP_BODY,   cacheTofileFilter,  LSI_HOOK_LAST + 1,  0},
+    {LSI_HKPT_MAIN_ATEXIT,      saveSnapshots,      LSI_HOOK_NORMAL,    LSI_FLAG_ENABLED},
     LSI_HOOK_END   //Must put this at the end position
 };
 
@@ -3267,6 +4758,7 @@ static void purgeAllByTag(const lsi_session_t *session, MyMData *myData,
 
     pStore->getManager()->processPurgeCmd(
         pValue, valLen, DateTime::s_curTime, DateTime::s_curTimeUs / 1000, stale);
+    pStore->startTagPurge();
     g_api->log(session, LSI_LOG_DEBUG,  "[%s] PURGE public cache: %.*s\n",
                ModuleNameStr, valLen, pValue);
 }
@@ -3352,6 +4844,7 @@ static void processPurge2(const lsi_session_t *session,
     {
         pStore->getManager()->processPurgeCmd(
             pValue, valLen, DateTime::s_curTime, DateTime::s_curTimeUs / 1000, stale);
+        pStore->startTagPurge();
         g_api->log(session, LSI_LOG_DEBUG,  "[%s] PURGE public cache: %.*s\n",
                    ModuleNameStr, valLen, pValue);
     }
@@ -3554,6 +5047,523 @@ static void toggleGzipState(MyMData *myData, int needCompressType)
 }
 
 
+/**
+ * return the decompressed size, -1 for error
+ */
+static int inflateToBuf(const unsigned char *pBuf, int len, AutoBuf *pOut)
+{
+    z_stream *zstream = new z_stream;
+    if (initZstream(zstream, false))
+    {
+        delete zstream;
+        return LS_FAIL;
+    }
+    zstream->next_in = (Bytef *)pBuf;
+    zstream->avail_in = len;
+
+    int z_ret;
+    int avail;
+    do
+    {
+        if (pOut->guarantee(Z_BUF_SIZE) == -1)
+            break;
+        avail = pOut->available();
+        zstream->next_out = (Bytef *)pOut->end();
+        zstream->avail_out = avail;
+        z_ret = inflate(zstream, Z_FINISH);
+        pOut->used(avail - zstream->avail_out);
+    } while ((z_ret == Z_OK || z_ret == Z_BUF_ERROR)
+             && zstream->avail_out == 0);
+
+    len = (z_ret == Z_STREAM_END) ? pOut->size() : LS_FAIL;
+    uninitZstream(zstream, false);
+    return len;
+}
+
+
+#ifdef USE_ZSTD
+/**
+ * return the decompressed size, -1 for error
+ */
+static int zstdDecodeToBuf(const char *pBuf, int len, AutoBuf *pOut)
+{
+    ZSTD_DCtx *pDCtx = ZSTD_createDCtx();
+    if (!pDCtx)
+        return LS_FAIL;
+    ZSTD_inBuffer in = { pBuf, (size_t)len, 0 };
+    ZSTD_outBuffer out;
+    size_t ret;
+    do
+    {
+        if (pOut->guarantee(Z_BUF_SIZE) == -1)
+        {
+            ret = 1;
+            break;
+        }
+        out.dst = pOut->end();
+        out.size = pOut->available();
+        out.pos = 0;
+        ret = ZSTD_decompressStream(pDCtx, &out, &in);
+        pOut->used(out.pos);
+    } while (!ZSTD_isError(ret) && ret != 0
+             && (in.pos < in.size || out.pos == out.size));
+    ZSTD_freeDCtx(pDCtx);
+    return (ret == 0) ? pOut->size() : LS_FAIL;
+}
+#endif
+
+
+//Decode a gzip or zstd body, return the decompressed size, -1 for error
+static int decodeToBuf(int compressType, const char *pBuf, int len,
+                       AutoBuf *pOut)
+{
+    if (compressType == LSI_GZIP_COMPRESS)
+        return inflateToBuf((const unsigned char *)pBuf, len, pOut);
+#ifdef USE_ZSTD
+    if (compressType == LSI_ZSTD_COMPRESS)
+        return zstdDecodeToBuf(pBuf, len, pOut);
+#endif
+    return LS_FAIL;
+}
+
+
+/**
+ * return the size of the gzip body, -1 for error
+ */
+static int deflateToBuf(const char *pBuf, int len, AutoBuf *pOut)
+{
+    z_stream *zstream = new z_stream;
+    if (initZstream(zstream, true))
+    {
+        delete zstream;
+        return LS_FAIL;
+    }
+    zstream->next_in = (Bytef *)pBuf;
+    zstream->avail_in = len;
+
+    int z_ret;
+    int avail;
+    do
+    {
+        if (pOut->guarantee(Z_BUF_SIZE) == -1)
+        {
+            z_ret = Z_MEM_ERROR;
+            break;
+        }
+        avail = pOut->available();
+        zstream->next_out = (Bytef *)pOut->end();
+        zstream->avail_out = avail;
+        z_ret = deflate(zstream, Z_FINISH);
+        pOut->used(avail - zstream->avail_out);
+    } while (z_ret == Z_OK);
+
+    len = (z_ret == Z_STREAM_END) ? pOut->size() : LS_FAIL;
+    uninitZstream(zstream, true);
+    return len;
+}
+
+
+/**
+ * Compress pBuf in compressType to pOut, it does not touch the store so
+ * it runs in the offloader thread.
+ * return the size of the body in compressType, -1 for error
+ */
+static int encodeVariantBody(int compressType, const char *pBuf, int len,
+                             AutoBuf *pOut)
+{
+    int ret = LS_FAIL;
+    if (compressType == LSI_GZIP_COMPRESS)
+        ret = deflateToBuf(pBuf, len, pOut);
+#ifdef USE_BROTLI
+    else if (compressType == LSI_BR_COMPRESS)
+    {
+        size_t outLen = BrotliEncoderMaxCompressedSize(len);
+        if (outLen == 0 || pOut->guarantee(outLen) == -1)
+            return LS_FAIL;
+        if (BrotliEncoderCompress(CE_VARIANT_BR_QUALITY, BROTLI_DEFAULT_WINDOW,
+                                  BROTLI_MODE_TEXT, len, (const uint8_t *)pBuf,
+                                  &outLen, (uint8_t *)pOut->end())
+            == BROTLI_TRUE)
+        {
+            pOut->used(outLen);
+            ret = pOut->size();
+        }
+    }
+#endif
+#ifdef USE_ZSTD
+    else if (compressType == LSI_ZSTD_COMPRESS)
+    {
+        size_t outLen = ZSTD_compressBound(len);
+        if (pOut->guarantee(outLen) == -1)
+            return LS_FAIL;
+        outLen = ZSTD_compress(pOut->end(), outLen, pBuf, len,
+                               CE_VARIANT_ZSTD_LEVEL);
+        if (!ZSTD_isError(outLen))
+        {
+            pOut->used(outLen);
+            ret = pOut->size();
+        }
+    }
+#endif
+    return ret;
+}
+
+
+/**
+ * Create the entry of a public variant of pSrc in compressType, with the
+ * headers of pSrc. The variant keeps the expire time of the source, it is
+ * created now so the lookup can tell it from variants of an object which
+ * has been replaced since. The body is saved by saveVariant().
+ */
+static CacheEntry *createVariant(CacheConfig *pConfig, CacheEntry *pSrc,
+                                 const CacheHash &publicHash, CacheKey *pKey,
+                                 int compressType, int part1Len)
+{
+    CacheHash hash;
+    calcVariantHash(publicHash, compressType, &hash);
+
+    //Variants are public objects
+    int savedIpLen = pKey->m_ipLen;
+    const char *pSavedIp = pKey->m_pIP;
+    pKey->m_pIP = NULL;
+    pKey->m_ipLen = 0;
+    CacheEntry *pEntry = pConfig->getStore()->createCacheEntry(hash, pKey);
+    pKey->m_pIP = pSavedIp;
+    pKey->m_ipLen = savedIpLen;
+    if (!pEntry)
+        return NULL;        //being built by another process
+
+    CeHeader &header = pEntry->getHeader();
+    uint16_t keyLen = header.m_keyLen;
+    int16_t privLen = header.m_iPrivLen;
+    header = pSrc->getHeader();
+    header.m_keyLen = keyLen;
+    header.m_iPrivLen = privLen;
+    header.m_flag &= ~(CeHeader::CEH_PRIVATE | CeHeader::CEH_STALE
+                       | CeHeader::CEH_UPDATING);
+    header.m_tmCreated = (int32_t)DateTime_s_curTime;
+    header.m_msCreated = (int32_t)DateTime_s_curTimeMs;
+    pEntry->setTag(pSrc->getTag().c_str(), pSrc->getHeader().m_tagLen);
+    pEntry->setPart1Len(part1Len);
+    return pEntry;
+}
+
+
+/**
+ * Write the headers and the body already in compressType of a variant
+ * created by createVariant(), then publish it. The entry is canceled if it
+ * fails.
+ */
+static int saveVariant(DirHashCacheStore *pStore, CacheEntry *pEntry,
+                       int compressType, const char *pPart1, int part1Len,
+                       const char *pBody, int bodyLen)
+{
+    int fd = pEntry->getFdStore();
+    if (bodyLen <= 0 || pEntry->saveCeHeader() != 0
+        || write(fd, pPart1, part1Len) != part1Len
+        || write(fd, pBody, bodyLen) != bodyLen)
+    {
+        pStore->cancelEntry(pEntry, 1);
+        return LS_FAIL;
+    }
+    pEntry->setPart2Len(bodyLen);
+    pEntry->markReady(compressType);
+    if (pEntry->saveCeHeader() != 0 || pStore->publish(pEntry) != 0)
+    {
+        pStore->cancelEntry(pEntry, 1);
+        return LS_FAIL;
+    }
+    pStore->getManager()->addTracking(pEntry);
+    g_api->log(NULL, LSI_LOG_DEBUG,
+               "[%s] stored variant with compressType %d, %d bytes.\n",
+               ModuleNameStr, compressType, bodyLen);
+    return LS_OK;
+}
+
+
+/**
+ * The missing encodings of a public object are built in the offloader.
+ * The entries of the variants are created and the source is copied on the
+ * event loop, the offloader thread only decodes and compresses the copy,
+ * the bodies are then saved and published on the event loop when it is
+ * done. Entries left when the task is released are canceled. An identity
+ * variant of a decoded hit is queued the same way, so it is written after
+ * the hit rather than on its way.
+ */
+struct VariantTask
+{
+    ls_offload          m_task;
+    DirHashCacheStore  *m_pStore;
+    int                 m_iSrcType;
+    AutoBuf             m_part1;
+    AutoBuf             m_plain;
+    CacheEntry         *m_pEntries[LSI_ZSTD_COMPRESS + 1];
+    AutoBuf             m_bodies[LSI_ZSTD_COMPRESS + 1];
+};
+
+static struct Offloader *s_pVariantOffloader = NULL;
+
+
+static int variantPerform(ls_offload *pTask)
+{
+    VariantTask *pVarTask = (VariantTask *)pTask->param_task_done;
+    if (pVarTask->m_iSrcType != LSI_NO_COMPRESS)
+    {
+        AutoBuf plain(0);
+        if (decodeToBuf(pVarTask->m_iSrcType, pVarTask->m_plain.begin(),
+                        pVarTask->m_plain.size(), &plain) < 0)
+            return LS_FAIL;
+        pVarTask->m_plain.swap(plain);
+        pVarTask->m_iSrcType = LSI_NO_COMPRESS;
+    }
+    for (int compressType = LSI_GZIP_COMPRESS;
+         compressType <= LSI_ZSTD_COMPRESS; ++compressType)
+    {
+        if (pVarTask->m_pEntries[compressType])
+            encodeVariantBody(compressType, pVarTask->m_plain.begin(),
+                              pVarTask->m_plain.size(),
+                              &pVarTask->m_bodies[compressType]);
+    }
+    return LS_OK;
+}
+
+
+static void variantRelease(ls_offload *pTask)
+{
+    if (--pTask->ref_cnt > 0)
+        return;
+    VariantTask *pVarTask = (VariantTask *)pTask->param_task_done;
+    for (int compressType = LSI_NO_COMPRESS;
+         compressType <= LSI_ZSTD_COMPRESS; ++compressType)
+    {
+        if (pVarTask->m_pEntries[compressType])
+            pVarTask->m_pStore->cancelEntry(
+                pVarTask->m_pEntries[compressType], 1);
+    }
+    delete pVarTask;
+}
+
+
+static void variantDone(void *param)
+{
+    VariantTask *pVarTask = (VariantTask *)param;
+    const AutoBuf *pBody;
+    //Not decoded, the entries are canceled on release
+    if (pVarTask->m_iSrcType != LSI_NO_COMPRESS)
+        return;
+    for (int compressType = LSI_NO_COMPRESS;
+         compressType <= LSI_ZSTD_COMPRESS; ++compressType)
+    {
+        if (!pVarTask->m_pEntries[compressType])
+            continue;
+        pBody = (compressType == LSI_NO_COMPRESS) ? &pVarTask->m_plain
+                : &pVarTask->m_bodies[compressType];
+        saveVariant(pVarTask->m_pStore, pVarTask->m_pEntries[compressType],
+                    compressType, pVarTask->m_part1.begin(),
+                    pVarTask->m_part1.size(), pBody->begin(), pBody->size());
+        pVarTask->m_pEntries[compressType] = NULL;
+    }
+}
+
+
+static struct ls_offload_api s_variantApi =
+{
+    variantPerform,
+    variantRelease,
+    variantDone
+};
+
+
+static VariantTask *newVariantTask(CacheConfig *pConfig, int srcType)
+{
+    if (!s_pVariantOffloader)
+    {
+        s_pVariantOffloader = offloader_new("CACHEVAR", 1);
+        if (!s_pVariantOffloader)
+        {
+            g_api->log(NULL, LSI_LOG_ERROR,
+                       "[%s] failed to start the offloader to build cache "
+                       "variants.\n", ModuleNameStr);
+            return NULL;
+        }
+    }
+    VariantTask *pVarTask = new VariantTask;
+    memset(&pVarTask->m_task, 0, sizeof(pVarTask->m_task));
+    pVarTask->m_task.api = &s_variantApi;
+    pVarTask->m_task.param_task_done = pVarTask;
+    pVarTask->m_pStore = pConfig->getStore();
+    pVarTask->m_iSrcType = srcType;
+    memset(pVarTask->m_pEntries, 0, sizeof(pVarTask->m_pEntries));
+    return pVarTask;
+}
+
+
+//The task is released when it is done, or here if it fails
+static int queueVariantTask(VariantTask *pVarTask)
+{
+    int compressType;
+    for (compressType = LSI_NO_COMPRESS; compressType <= LSI_ZSTD_COMPRESS;
+         ++compressType)
+    {
+        if (pVarTask->m_pEntries[compressType])
+            break;
+    }
+    if (compressType > LSI_ZSTD_COMPRESS)
+    {
+        delete pVarTask;
+        return LS_FAIL;
+    }
+    if (offloader_enqueue(s_pVariantOffloader, &pVarTask->m_task,
+                          NULL) == -1)
+    {
+        g_api->log(NULL, LSI_LOG_ERROR,
+                   "[%s] failed to queue cache variants.\n", ModuleNameStr);
+        return LS_FAIL;
+    }
+    return LS_OK;
+}
+
+
+/**
+ * Copy the response headers and the body of an entry, the entry is not
+ * locked while its copy is used.
+ */
+static int readEntryImage(CacheConfig *pConfig, CacheEntry *pEntry,
+                          AutoBuf *pPart1, AutoBuf *pBody)
+{
+    int part1offset = pEntry->getPart1Offset();
+    int part1Len = pEntry->getPart2Offset() - part1offset;
+    if (part1Len < 0 || pPart1->guarantee(part1Len) == -1)
+        return LS_FAIL;
+    if (pEntry->isInMem())
+    {
+        AutoBuf image(0);
+        CacheMemTier *pMemTier = pConfig->getStore()->getMemTier();
+        if (!pMemTier || pMemTier->copyImage(pEntry, &image) != LS_OK)
+            return LS_FAIL;
+        pPart1->append(image.begin() + part1offset, part1Len);
+    }
+    else
+    {
+        if (pread(pEntry->getFdStore(), pPart1->end(), part1Len,
+                  part1offset) != part1Len)
+            return LS_FAIL;
+        pPart1->used(part1Len);
+    }
+    return readEntryBody(pConfig, pEntry, pBody, NULL);
+}
+
+
+/**
+ * Build the missing encodings of the object just served in the offloader,
+ * the object is served as stored until they are ready.
+ */
+static void buildVariants(const lsi_session_t *session, MyMData *myData)
+{
+    CacheEntry *pEntry = myData->pEntry;
+    int build = myData->needVariant & ~(1 << pEntry->getCompressType());
+    myData->needVariant = 0;
+    pEntry->setVariantQueued(1);
+
+    //A brotli body is not decompressed here, small or binary content is
+    //left to the server
+    if (!build || pEntry->getCompressType() == LSI_BR_COMPRESS
+        || getEntryContentLength(myData) < 200
+        || !isRespCompressible(session))
+        return;
+
+    VariantTask *pVarTask = newVariantTask(myData->pConfig,
+                                           pEntry->getCompressType());
+    if (!pVarTask)
+        return;
+    if (readEntryImage(myData->pConfig, pEntry, &pVarTask->m_part1,
+                       &pVarTask->m_plain) != LS_OK)
+    {
+        delete pVarTask;
+        return;
+    }
+
+    for (int compressType = LSI_NO_COMPRESS; compressType <= LSI_ZSTD_COMPRESS;
+         ++compressType)
+    {
+        if (build & (1 << compressType))
+            pVarTask->m_pEntries[compressType] = createVariant(
+                    myData->pConfig, pEntry, myData->cePublicHash,
+                    &myData->cacheKey, compressType, pVarTask->m_part1.size());
+    }
+    if (queueVariantTask(pVarTask) == LS_OK)
+        g_api->log(session, LSI_LOG_DEBUG,
+                   "[%s] buildVariants queued compressType mask %d.\n",
+                   ModuleNameStr, build);
+}
+
+
+/**
+ * Store the body of a public zstd object decoded for a hit as it is, the
+ * body is taken from pPlain.
+ */
+static int storeIdentityVariant(MyMData *myData, const char *pPart1,
+                                int part1Len, AutoBuf *pPlain)
+{
+    VariantTask *pVarTask = newVariantTask(myData->pConfig, LSI_NO_COMPRESS);
+    if (!pVarTask)
+        return LS_FAIL;
+    if (pVarTask->m_part1.append(pPart1, part1Len) != part1Len)
+    {
+        delete pVarTask;
+        return LS_FAIL;
+    }
+    pVarTask->m_pEntries[LSI_NO_COMPRESS] = createVariant(
+            myData->pConfig, myData->pEntry, myData->cePublicHash,
+            &myData->cacheKey, LSI_NO_COMPRESS, part1Len);
+    pVarTask->m_plain.swap(*pPlain);
+    return queueVariantTask(pVarTask);
+}
+
+
+static int onWriteEsi(const lsi_session_t *session)
+{
+    MyMData *myData = (MyMData *)g_api->get_module_data(session, &MNAME,
+                      LSI_DATA_HTTP);
+    if (!myData || !myData->pEsi)
+        return LSI_RSP_DONE;
+
+    EsiAssembly *pEsi = myData->pEsi;
+    int ret = writeEsi(session, pEsi);
+    if (ret == 0)
+    {
+        //Resumed by the next fragment back, or the timer
+        if (!pEsi->evtObj)
+            pEsi->evtObj = g_api->get_event_obj(esiResumeCb, session, 0,
+                                                NULL);
+        if (pEsi->evtObj)
+            g_api->set_handler_write_state(session, 0);
+        return LSI_RSP_MORE;
+    }
+    if (ret == 1)
+        countEsiHit(myData);
+    else
+        g_api->log(session, LSI_LOG_DEBUG,
+                   "[%s] failed to send ESI shell %s.\n", ModuleNameStr,
+                   myData->pOrgUri);
+    g_api->free_module_data(session, &MNAME, LSI_DATA_HTTP, releaseMData);
+    return (ret == 1) ? LSI_RSP_DONE : LSI_RSP_ERROR;
+}
+
+
+static int cleanUpEsi(const lsi_session_t *session)
+{
+    MyMData *myData = (MyMData *)g_api->get_module_data(session, &MNAME,
+                      LSI_DATA_HTTP);
+    if (myData && myData->pEsi && myData->pEsi->evtObj)
+    {
+        g_api->cancel_event(session, myData->pEsi->evtObj);
+        myData->pEsi->evtObj = 0;
+    }
+    return 0;
+}
+
+
 static int handlerProcess(const lsi_session_t *session)
 {
     MyMData *myData = (MyMData *)g_api->get_module_data(session, &MNAME,
@@ -3659,20 +5669,73 @@ static int handlerProcess(const lsi_session_t *session)
 
     myData->pEntry->setLastAccess(DateTime::s_curTime);
 
+    //A fragment of a shell being assembled only hands its body over
+    if (myData->esiId)
+    {
+        deliverEsiEntry(myData, 1);
+        g_api->end_resp(session);
+        g_api->free_module_data(session, &MNAME, LSI_DATA_HTTP, releaseMData);
+        return 0;
+    }
+
     char tmBuf[RFC_1123_TIME_LEN + 1];
     int len;
     int fd = myData->pEntry->getFdStore();
     CeHeader &CeHeader = myData->pEntry->getHeader();
     int compressType = myData->pEntry->getCompressType();
 
+    //Sent decoded to a client without zstd once, then kept as a variant
+    AutoBuf plain(0);
+    int decoded = 0;
+#ifdef USE_ZSTD
+    if (compressType == LSI_ZSTD_COMPRESS && !myData->reqAcceptZstd
+        && myData->iMethod == HTTP_GET)
+    {
+        AutoBuf body(0);
+        if (readEntryBody(myData->pConfig, myData->pEntry, &body, NULL) != LS_OK
+            || zstdDecodeToBuf(body.begin(), body.size(), &plain) == LS_FAIL)
+        {
+            g_api->log(session, LSI_LOG_ERROR,
+                       "[%s] failed to decode zstd object, "
+                       "handlerProcess return 500.\n", ModuleNameStr);
+            g_api->free_module_data(session, &MNAME, LSI_DATA_HTTP, releaseMData);
+            return 500;
+        }
+        compressType = LSI_NO_COMPRESS;
+        decoded = 1;
+    }
+#endif
+
     int hitIdx = (myData->iCacheState == CE_STATE_HAS_PRIVATE_CACHE) ? 1 : 0;
 
     ((HttpSession *)session)->incStatsCacheHits(1 + hitIdx);
 
     char *buff = NULL;
+    const char *pPart1 = NULL;
     char *pBuffOrg = NULL;
+    const char *pImage = NULL;
+    AutoBuf image(0);
+    CacheMemTier *pMemTier;
     int part1offset = myData->pEntry->getPart1Offset();
     int part2offset = myData->pEntry->getPart2Offset();
+    //Slab objects start in the middle of a segment, map from their page
+    off_t mapOffset = myData->pEntry->getStartOffset()
+                      & ~((off_t)getpagesize() - 1);
+    int mapLen = part2offset - mapOffset;
+    if (myData->pEntry->isInMem())
+    {
+        //Served from a copy, the shared memory tier is not locked while sending
+        pMemTier = myData->pConfig->getStore()->getMemTier();
+        if (!pMemTier || pMemTier->copyImage(myData->pEntry, &image) != LS_OK)
+        {
+            g_api->log(session, LSI_LOG_ERROR,
+                       "[%s] memory cache object is gone, "
+                       "handlerProcess return 500.\n", ModuleNameStr);
+            g_api->free_module_data(session, &MNAME, LSI_DATA_HTTP, releaseMData);
+            return 500;
+        }
+        pImage = image.begin();
+    }
     if (part2offset - part1offset > 0)
     {
 #ifdef CACHE_RESP_HEADER
@@ -3680,23 +5743,27 @@ static int handlerProcess(const lsi_session_t *session)
             buff = (char *)(myData->m_pEntry->m_sRespHeader.c_str());
         else
 #endif
+        if (pImage)
+            buff = (char *)pImage + part1offset;
+        else
         {
-            buff  = (char *)mmap((caddr_t)0, part2offset,
-                                 PROT_READ, MAP_SHARED, fd, 0);
+            buff  = (char *)mmap((caddr_t)0, mapLen,
+                                 PROT_READ, MAP_SHARED, fd, mapOffset);
             if (buff == (char *)(-1))
             {
                 g_api->log(session, LSI_LOG_ERROR,
                            "[%s] mmap() failed, fd: %d, size: %d, error: %s, "
                            "handlerProcess return 500.\n",
-                           ModuleNameStr, fd, part2offset, strerror(errno));
+                           ModuleNameStr, fd, mapLen, strerror(errno));
                 g_api->free_module_data(session, &MNAME, LSI_DATA_HTTP, releaseMData);
                 return 500;
             }
             pBuffOrg = buff;
-            buff += part1offset;
+            buff += part1offset - mapOffset;
         }
 
-        if (CeHeader.m_lenETag > 0)
+        //An assembled page differs from the shell, it has no validator
+        if (CeHeader.m_lenETag > 0 && !myData->pEntry->isEsi())
         {
             char *pEtag = buff;
             AutoStr2 str;
@@ -3714,7 +5781,7 @@ static int handlerProcess(const lsi_session_t *session)
 
                 g_api->set_status_code(session, 304);
                 if (pBuffOrg)
-                    munmap((caddr_t)pBuffOrg, part2offset);
+                    munmap((caddr_t)pBuffOrg, mapLen);
                 g_api->end_resp(session);
                 g_api->free_module_data(session, &MNAME, LSI_DATA_HTTP, releaseMData);
                 g_api->log(session, LSI_LOG_DEBUG,
@@ -3745,6 +5812,11 @@ static int handlerProcess(const lsi_session_t *session)
                         *pUpdate++ = 'b';
                         *pUpdate++ = 'r';
                     }
+                    else if (compressType == 3)
+                    {
+                        *pUpdate++ = 'z';
+                        *pUpdate++ = 's';
+                    }
                 }
             }
 
@@ -3755,6 +5827,7 @@ static int handlerProcess(const lsi_session_t *session)
                        ModuleNameStr, pEtag);
         }
 
+        pPart1 = buff;
         buff += CeHeader.m_lenETag + CeHeader.m_lenStxFilePath;
         len = part2offset - part1offset -
               CeHeader.m_lenETag - CeHeader.m_lenStxFilePath;
@@ -3795,13 +5868,26 @@ static int handlerProcess(const lsi_session_t *session)
 
     //assert(strcasestr(myData->pOrgUri, "fonts/ProximaNova-Regular.woff") == NULL);
 
+    if (myData->iMethod == HTTP_GET && myData->pEntry->isEsi())
+    {
+        if (pBuffOrg)
+            munmap((caddr_t)pBuffOrg, mapLen);
+        if (startEsi(session, myData) == LS_OK)
+            return 0;
+        g_api->free_module_data(session, &MNAME, LSI_DATA_HTTP, releaseMData);
+        return 500;
+    }
+
     int ret  = 0;
     if (myData->iMethod == HTTP_GET)
     {
         off_t length = myData->pEntry->getContentTotalLen() -
                        (part2offset - part1offset);
+        if (decoded)
+            length = plain.size();
 
-        if (compressType == LSI_NO_COMPRESS)
+        //A decoded object is never switched, it only goes by variants
+        if (compressType == LSI_NO_COMPRESS && !decoded)
         {
             if (myData->reqCompressType == LSI_GZIP_COMPRESS)
                 myData->pEntry->incHits();
@@ -3830,6 +5916,14 @@ static int handlerProcess(const lsi_session_t *session)
                        "[%s] set_resp_header [Content-Encoding: br].\n",
                        ModuleNameStr);
         }
+        else if (compressType == LSI_ZSTD_COMPRESS)
+        {
+            g_api->set_resp_header(session, LSI_RSPHDR_CONTENT_ENCODING,
+                                   NULL, 0, "zstd", 4, LSI_HEADEROP_SET);
+            g_api->log(session, LSI_LOG_DEBUG,
+                       "[%s] set_resp_header [Content-Encoding: zstd].\n",
+                       ModuleNameStr);
+        }
         g_api->set_resp_buffer_compress_method(session, compressType);
 
 
@@ -3840,15 +5934,44 @@ static int handlerProcess(const lsi_session_t *session)
                    "[%s] handlerProcess fd %d, offset %d, length %ld\n",
                    ModuleNameStr, fd, part2offset, length);
 
-        if (g_api->send_file2(session, fd, part2offset, length) == 0)
+        if (decoded)
+        {
+            if (g_api->append_resp_body(session, plain.begin(), length) >= 0)
+                g_api->end_resp(session);
+            else
+                ret = 500;
+            //Kept as the identity variant, the next hits are not decoded
+            if (pPart1 && hitIdx == 0
+                && storeIdentityVariant(myData, pPart1,
+                                        part2offset - part1offset,
+                                        &plain) == LS_OK)
+                myData->needVariant &= ~(1 << LSI_NO_COMPRESS);
+        }
+        else if (pImage)
+        {
+            ret = g_api->append_resp_body(session, pImage + part2offset,
+                                          length);
+            if (ret >= 0)
+            {
+                ret = 0;
+                g_api->end_resp(session);
+            }
+            else
+                ret = 500;
+        }
+        else if (g_api->send_file2(session, fd, part2offset, length) == 0)
             g_api->end_resp(session);
         else
             ret = 500;
 
         /**
-         * For testing, disable the code
+         * Public objects keep the other encodings as variants, private
+         * ones are switched to the encoding asked for the most.
          */
-        if (myData->pEntry->getHits() >= 10)
+        if (myData->needVariant)
+            buildVariants(session, myData);
+        else if (myData->pEntry->getHits() >= 10 && myData->pEntry->isPrivate()
+            && !myData->pEntry->isInMem() && !myData->pEntry->isInSlab())
         {
             g_api->log(session, LSI_LOG_DEBUG,
                        "[%s] handlerProcess check entry hit %ld times, "
@@ -3862,12 +5985,12 @@ static int handlerProcess(const lsi_session_t *session)
         g_api->end_resp(session);
 
     if (pBuffOrg)
-        munmap((caddr_t)pBuffOrg, part2offset);
+        munmap((caddr_t)pBuffOrg, mapLen);
     g_api->free_module_data(session, &MNAME, LSI_DATA_HTTP, releaseMData);
     return ret;
 }
 
-lsi_reqhdlr_t cache_handler = { handlerProcess, NULL, NULL, NULL,
+lsi_reqhdlr_t cache_handler = { handlerProcess, NULL, onWriteEsi, cleanUpEsi,
                                 NULL, NULL, NULL,  };
 lsi_confparser_t cacheDealConfig = { ParseConfig, FreeConfig, paramArray };
 lsi_module_t cache = { LSI_MODULE_SIGNATURE, init, &cache_handler,
@@ -19,6 +19,7 @@
 #include "ls.h"
 #include <new>
 
+#include "cachewarmer.h"
 #include "dirhashcachestore.h"
 #include <http/httpvhost.h>
 
@@ -72,10 +73,13 @@ CacheConfig::CacheConfig()
       //, m_iBypassPercentage(5)
     , m_iLevele(0)
     , m_iAddEtag(0)
+    , m_iCollapseWait(0)
+    , m_iStaleRevalidate(0)
     , m_iOnlyUseOwnUrlExclude(0)
     , m_iOwnStore(0)
     , m_iOwnPurgeUri(0)
     , m_iOwnVaryList(0)
+    , m_iOwnWarmer(0)
     , m_pUrlExclude(NULL)
     , m_pParentUrlExclude(NULL)
     , m_pVHostMapExclude(NULL)
@@ -83,6 +87,7 @@ CacheConfig::CacheConfig()
     , m_pPurgeUri(NULL)
     , m_pVaryList(NULL)
     , m_pKeyModList(NULL)
+    , m_pWarmer(NULL)
 {
 }
 
@@ -101,6 +106,8 @@ CacheConfig::~CacheConfig()
         delete m_pVaryList;
     if (m_pKeyModList && (m_iCacheConfigBits & CACHE_KEY_MOD_SET))
         delete m_pKeyModList;
+    if (m_iOwnWarmer && m_pWarmer)
+        delete m_pWarmer;
 
     m_pUrlExclude = NULL;
     m_pVaryList = NULL;
@@ -111,6 +118,8 @@ CacheConfig::~CacheConfig()
     m_iOwnStore = 0;
     m_iOwnPurgeUri = 0;
     m_iOwnVaryList = 0;
+    m_pWarmer = NULL;
+    m_iOwnWarmer = 0;
 }
 
 
@@ -128,10 +137,14 @@ void CacheConfig::inherit(const CacheConfig *pParent)
         m_pStore = pParent->getStore();
         m_iOwnStore = 0;
         m_iAddEtag = pParent->getAddEtagType();
+        m_iCollapseWait = pParent->getCollapseWait();
+        m_iStaleRevalidate = pParent->getStaleRevalidate();
         m_pPurgeUri = pParent->getPurgeUri();
         m_iOwnPurgeUri = 0;
         m_pVaryList = pParent->getVaryList();
         m_iOwnVaryList = 0;
+        m_pWarmer = pParent->getWarmer();
+        m_iOwnWarmer = 0;
     }
 }
 
@@ -148,6 +161,10 @@ void CacheConfig::apply(const CacheConfig *pParent)
             m_iMaxStale = pParent->m_iMaxStale;
         if (pParent->m_iCacheConfigBits & CACHE_MAX_OBJ_SIZE)
             m_lMaxObjSize = pParent->m_lMaxObjSize;
+        if (pParent->m_iCacheConfigBits & CACHE_COLLAPSE_WAIT)
+            m_iCollapseWait = pParent->m_iCollapseWait;
+        if (pParent->m_iCacheConfigBits & CACHE_STALE_REVALIDATE)
+            m_iStaleRevalidate = pParent->m_iStaleRevalidate;
 
         m_iCacheFlag = (pParent->m_iCacheFlag & pParent->m_iCacheConfigBits) |
                        (m_iCacheFlag & ~pParent->m_iCacheConfigBits);
@@ -189,6 +206,15 @@ void CacheConfig::setVaryList(StringList *pList)
 }
 
 
+void CacheConfig::setWarmer(CacheWarmer *pWarmer)
+{
+    if (m_iOwnWarmer && m_pWarmer)
+        delete m_pWarmer;
+    m_pWarmer = pWarmer;
+    m_iOwnWarmer = 1;
+}
+
+
 int CacheConfig::parseCacheKeyMod(const char *pConfig, int len)
 {   
     if ((m_iCacheConfigBits & CACHE_KEY_MOD_SET) == 0)
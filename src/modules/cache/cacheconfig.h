@@ -100,12 +100,15 @@ private:
 #define CACHE_NO_VARY                       (1<<14)
 #define CACHE_ADD_ETAG                      (1<<15)
 #define CACHE_KEY_MOD_SET                   (1<<16)
+#define CACHE_COLLAPSE_WAIT                 (1<<17)
+#define CACHE_STALE_REVALIDATE              (1<<18)
 
 
 class StringList;
 
 
 class DirHashCacheStore;
+class CacheWarmer;
 
 class CacheConfig
 {
@@ -143,6 +146,12 @@ public:
     long getMaxObjSize() const      {   return m_lMaxObjSize;   }
     void setAddEtagType(int v)      {   m_iAddEtag = v;     }
     int getAddEtagType() const      { return m_iAddEtag;    }
+    //Seconds a miss waits for another request filling the same object
+    void setCollapseWait(int v)     {   m_iCollapseWait = v;    }
+    int getCollapseWait() const     {   return m_iCollapseWait; }
+    //Max background refreshes of stale objects per host, 0 is in-band
+    void setStaleRevalidate(int v)  {   m_iStaleRevalidate = v;     }
+    int getStaleRevalidate() const  {   return m_iStaleRevalidate;  }
     char *getPurgeUri() const       { return m_pPurgeUri;   };
     
     StringList *getVaryList() const {   return m_pVaryList;    }
@@ -171,7 +180,7 @@ public:
     int isOnlyUseOwnUrlExclude()    { return m_iOnlyUseOwnUrlExclude; }
 
     void setOwnStore(int v)    { m_iOwnStore = v; }
-    //int getOwnStore()    { return m_iOwnStore; }
+    int getOwnStore() const    { return m_iOwnStore; }
     void setOwnPurgeUri(int v)    { m_iOwnPurgeUri = v; }
 
     Aho *getUrlExclude() const         {   return m_pUrlExclude;     }
@@ -185,6 +194,10 @@ public:
     DirHashCacheStore *getStore() const { return m_pStore; }
     void setStore(DirHashCacheStore *pStore) { m_pStore = pStore; }
 
+    //Replays the top URLs after a restart or a full purge, vhost level
+    CacheWarmer *getWarmer() const  {   return m_pWarmer;   }
+    void setWarmer(CacheWarmer *pWarmer);
+
     void setPurgeUri(const char *val, int valLen)
     {
         m_iOwnPurgeUri = 1;
@@ -204,10 +217,13 @@ private:
 
     int8_t  m_iLevele;  //SERVER, VHOST or context
     int8_t  m_iAddEtag;  //0, no, 1: add size-mtime; 2: xxhash64
+    int16_t m_iCollapseWait;
+    int16_t m_iStaleRevalidate;
     int     m_iOnlyUseOwnUrlExclude  : 4;
     int     m_iOwnStore : 4;
     int     m_iOwnPurgeUri : 4;
     int     m_iOwnVaryList : 4;
+    int     m_iOwnWarmer : 4;
 
     Aho        *m_pUrlExclude; //server and Vhost level can have it
     Aho        *m_pParentUrlExclude;
@@ -216,6 +232,7 @@ private:
     char       *m_pPurgeUri; //server and Vhost level can have it
     StringList *m_pVaryList; 
     CacheKeyModList *m_pKeyModList;
+    CacheWarmer *m_pWarmer;
 };
 
 #endif
@@ -30,9 +30,13 @@ CacheEntry::CacheEntry()
     , m_iHits(0)
     , m_isDirty(0)
     , m_isBuilding(0)
+    , m_isInMem(0)
+    , m_isInSlab(0)
+    , m_isVariantQueued(0)
     , m_needDelay(0)
     , m_startOffset(0)
     , m_fdStore(-1)
+    , m_iSlabSeg(-1)
     , m_iVaryFlag(0)
     , m_pWaitQue(NULL)
 {
@@ -84,6 +84,22 @@ public:
     int  isDirty() const            {   return m_isDirty;       }
     int  isBuilding() const         {   return m_isBuilding;    }
 
+    //Stored in the shared memory tier instead of a file.
+    void setInMem(int v)            {   m_isInMem = (v != 0);   }
+    int  isInMem() const            {   return m_isInMem;       }
+
+    //Stored in a segment file of the slab tier.
+    void setInSlab(int v)           {   m_isInSlab = (v != 0);  }
+    int  isInSlab() const           {   return m_isInSlab;      }
+
+    //The slab segment the fd store refers to, -1 if none.
+    void setSlabSeg(int seg)        {   m_iSlabSeg = seg;       }
+    int  getSlabSeg() const         {   return m_iSlabSeg;      }
+
+    //Encoding variants of this object are being built by a child process.
+    void setVariantQueued(int v)    {   m_isVariantQueued = (v != 0);   }
+    int  isVariantQueued() const    {   return m_isVariantQueued;       }
+
 //     void incTestHits()              {   ++m_iTestHits;    }
 //     long getTestHits() const        {   return m_iTestHits;    }
 
@@ -168,6 +184,10 @@ public:
     int isPrivate() const
     {   return m_header.m_flag & CeHeader::CEH_PRIVATE;     }
 
+    //A shell with <esi:include> tags, its fragment map follows the body.
+    int isEsi() const
+    {   return m_header.m_flag & CeHeader::CEH_ESI;         }
+
     CeHeader &getHeader()               {   return m_header;            }
     AutoStr  &getKey()                  {   return m_sKey;              }
     int       getKeyLen()               {   return m_header.m_keyLen;   }
@@ -211,9 +231,12 @@ private:
     /**
      * When this reach 10, then means currrent cache need to change gzip/ungzip
      */
-    uint32_t    m_iHits:29;
+    uint32_t    m_iHits:26;
     uint32_t    m_isDirty:1;
     uint32_t    m_isBuilding:1;
+    uint32_t    m_isInMem:1;
+    uint32_t    m_isInSlab:1;
+    uint32_t    m_isVariantQueued:1;
 
     int         m_needDelay; //delay serving if have cache, in URI_MAP instead of recv req header */
     CacheHash   m_hashKey;
@@ -221,6 +244,7 @@ private:
     off_t       m_startOffset;
     CeHeader    m_header;
     int         m_fdStore;
+    int         m_iSlabSeg;
     int32_t     m_iVaryFlag;  //each bit indicate a vary req header
     AutoStr     m_sKey;
 
@@ -0,0 +1,263 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2018  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+#include "cacheesi.h"
+
+#include <util/autobuf.h>
+
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+
+#define CACHE_ESI_MAP_MAGIC     0x4d495345  //"ESIM"
+
+static const char s_achIncludeTag[] = "<esi:include";
+static const char s_achIncludeEnd[] = "</esi:include>";
+
+
+typedef struct esimapheader_s
+{
+    int32_t     magic;
+    int32_t     count;
+    int32_t     len;
+} esimapheader_t;
+
+
+typedef struct esimapentry_s
+{
+    int32_t     offset;
+    int32_t     len;
+    int32_t     srcLen;
+} esimapentry_t;
+
+
+//Return the value of the src attribute between p and pEnd, NULL if none.
+static const char *findSrc(const char *p, const char *pEnd, int *len)
+{
+    const char *pVal;
+    char quote;
+    while ((p = (const char *)memmem(p, pEnd - p, "src", 3)) != NULL)
+    {
+        if (!isspace(p[-1]))
+        {
+            p += 3;
+            continue;
+        }
+        p += 3;
+        while (p < pEnd && isspace(*p))
+            ++p;
+        if (p >= pEnd || *p != '=')
+            continue;
+        ++p;
+        while (p < pEnd && isspace(*p))
+            ++p;
+        if (p >= pEnd)
+            return NULL;
+        if (*p == '"' || *p == '\'')
+        {
+            quote = *p++;
+            pVal = (const char *)memchr(p, quote, pEnd - p);
+            if (!pVal)
+                return NULL;
+        }
+        else
+        {
+            //Up to the "/" of a self-closing tag, pEnd is at its ">"
+            pVal = p;
+            while (pVal < pEnd && !isspace(*pVal)
+                   && !(*pVal == '/' && pVal + 1 == pEnd))
+                ++pVal;
+        }
+        *len = pVal - p;
+        return p;
+    }
+    return NULL;
+}
+
+
+/**
+ * Only fragments of the same virtual host are fetched, an absolute URL is
+ * reduced to its path. Anything else is left empty.
+ */
+static void setSrc(AutoStr2 &src, const char *p, int len)
+{
+    char achSrc[CACHE_ESI_MAX_SRC_LEN];
+    const char *pEnd = p + len;
+    char *pDest = achSrc;
+
+    if (len > 7 && strncasecmp(p, "http://", 7) == 0)
+        p += 5;
+    else if (len > 8 && strncasecmp(p, "https://", 8) == 0)
+        p += 6;
+    if (pEnd - p > 2 && p[0] == '/' && p[1] == '/')
+    {
+        p = (const char *)memchr(p + 2, '/', pEnd - p - 2);
+        if (!p)
+            return;
+    }
+    if (p >= pEnd || *p != '/' || pEnd - p >= CACHE_ESI_MAX_SRC_LEN)
+        return;
+    while (p < pEnd)
+    {
+        *pDest++ = *p;
+        if (*p == '&' && pEnd - p >= 5 && strncmp(p, "&amp;", 5) == 0)
+            p += 5;
+        else
+            ++p;
+    }
+    src.setStr(achSrc, pDest - achSrc);
+}
+
+
+CacheEsiMap::CacheEsiMap()
+{
+}
+
+
+CacheEsiMap::~CacheEsiMap()
+{
+    m_fragments.release_objects();
+}
+
+
+int CacheEsiMap::parse(const char *pBody, int len)
+{
+    const char *p = pBody;
+    const char *pEnd = pBody + len;
+    const char *pTagEnd;
+    const char *pSrc;
+    int srcLen;
+    CacheEsiFragment *pFragment;
+
+    m_fragments.release_objects();
+    while (m_fragments.size() < CACHE_ESI_MAX_FRAGMENTS
+           && (p = (const char *)memmem(p, pEnd - p, s_achIncludeTag,
+                                        sizeof(s_achIncludeTag) - 1)) != NULL)
+    {
+        pTagEnd = (const char *)memchr(p, '>', pEnd - p);
+        if (!pTagEnd)
+            break;
+        pFragment = new CacheEsiFragment;
+        pFragment->m_offset = p - pBody;
+        pSrc = findSrc(p + sizeof(s_achIncludeTag) - 1, pTagEnd, &srcLen);
+        if (pSrc)
+            setSrc(pFragment->m_src, pSrc, srcLen);
+
+        ++pTagEnd;
+        if (pTagEnd[-2] != '/'
+            && pEnd - pTagEnd >= (int)sizeof(s_achIncludeEnd) - 1
+            && strncasecmp(pTagEnd, s_achIncludeEnd,
+                           sizeof(s_achIncludeEnd) - 1) == 0)
+            pTagEnd += sizeof(s_achIncludeEnd) - 1;
+        pFragment->m_len = pTagEnd - p;
+        m_fragments.push_back(pFragment);
+        p = pTagEnd;
+    }
+    return m_fragments.size();
+}
+
+
+int CacheEsiMap::save(AutoBuf *pBuf) const
+{
+    esimapheader_t header;
+    esimapentry_t entry;
+    int i;
+
+    header.magic = CACHE_ESI_MAP_MAGIC;
+    header.count = m_fragments.size();
+    header.len = sizeof(header) + sizeof(entry) * header.count;
+    for (i = 0; i < header.count; ++i)
+        header.len += m_fragments[i]->m_src.len();
+
+    pBuf->append((const char *)&header, sizeof(header));
+    for (i = 0; i < header.count; ++i)
+    {
+        entry.offset = m_fragments[i]->m_offset;
+        entry.len = m_fragments[i]->m_len;
+        entry.srcLen = m_fragments[i]->m_src.len();
+        pBuf->append((const char *)&entry, sizeof(entry));
+        if (entry.srcLen > 0)
+            pBuf->append(m_fragments[i]->m_src.c_str(), entry.srcLen);
+    }
+    return header.len;
+}
+
+
+int CacheEsiMap::getHeaderLen()
+{
+    return sizeof(esimapheader_t);
+}
+
+
+int CacheEsiMap::getSavedLen(const char *pHeader, int len)
+{
+    esimapheader_t header;
+    if (len < (int)sizeof(header))
+        return LS_FAIL;
+    memcpy(&header, pHeader, sizeof(header));
+    if (header.magic != CACHE_ESI_MAP_MAGIC || header.count < 0
+        || header.count > CACHE_ESI_MAX_FRAGMENTS
+        || header.len < (int)sizeof(header))
+        return LS_FAIL;
+    return header.len;
+}
+
+
+int CacheEsiMap::load(const char *pBuf, int len, int bodyLen)
+{
+    esimapheader_t header;
+    esimapentry_t entry;
+    CacheEsiFragment *pFragment;
+    const char *pEnd;
+    int32_t lastEnd = 0;
+    int i;
+
+    m_fragments.release_objects();
+    if (getSavedLen(pBuf, len) == LS_FAIL)
+        return LS_FAIL;
+    memcpy(&header, pBuf, sizeof(header));
+    if (header.len > len)
+        return LS_FAIL;
+    pEnd = pBuf + header.len;
+    pBuf += sizeof(header);
+    for (i = 0; i < header.count; ++i)
+    {
+        if (pEnd - pBuf < (int)sizeof(entry))
+            break;
+        memcpy(&entry, pBuf, sizeof(entry));
+        pBuf += sizeof(entry);
+        //In order and inside the body
+        if (entry.offset < lastEnd || entry.len <= 0
+            || entry.len > bodyLen - entry.offset
+            || entry.srcLen < 0 || entry.srcLen > pEnd - pBuf)
+            break;
+        lastEnd = entry.offset + entry.len;
+        pFragment = new CacheEsiFragment;
+        pFragment->m_offset = entry.offset;
+        pFragment->m_len = entry.len;
+        if (entry.srcLen > 0)
+            pFragment->m_src.setStr(pBuf, entry.srcLen);
+        pBuf += entry.srcLen;
+        m_fragments.push_back(pFragment);
+    }
+    if (i < header.count)
+    {
+        m_fragments.release_objects();
+        return LS_FAIL;
+    }
+    return LS_OK;
+}
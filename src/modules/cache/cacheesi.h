@@ -0,0 +1,79 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2018  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+#ifndef CACHEESI_H
+#define CACHEESI_H
+
+#include <lsdef.h>
+#include <util/autostr.h>
+#include <util/gpointerlist.h>
+#include <inttypes.h>
+
+#define CACHE_ESI_MAX_FRAGMENTS     64
+#define CACHE_ESI_MAX_SRC_LEN       2048
+
+class AutoBuf;
+
+/**
+ * An <esi:include> tag of a shell, the tag is replaced by the response
+ * of src when the shell is served. An empty src renders nothing.
+ */
+struct CacheEsiFragment
+{
+    int32_t     m_offset;
+    int32_t     m_len;
+    AutoStr2    m_src;
+};
+
+
+/**
+ * CacheEsiMap is the list of <esi:include> tags of a cached shell, in the
+ * order they appear. It is built once when the shell is stored and saved
+ * after its body, so a hit does not scan the body again.
+ */
+class CacheEsiMap
+{
+public:
+    CacheEsiMap();
+    ~CacheEsiMap();
+
+    // Find the include tags of a body, return the number found.
+    int parse(const char *pBody, int len);
+
+    // Append the saved form of the map to pBuf, return its length.
+    int save(AutoBuf *pBuf) const;
+
+    // Return the length of the saved map starting with pHeader, -1 if none.
+    static int getSavedLen(const char *pHeader, int len);
+    static int getHeaderLen();
+
+    // Load a saved map of a body of bodyLen bytes, return LS_OK or LS_FAIL.
+    int load(const char *pBuf, int len, int bodyLen);
+
+    int getCount() const            {   return m_fragments.size();  }
+    const CacheEsiFragment *getFragment(int i) const
+    {   return m_fragments[i];      }
+
+    void clear()                    {   m_fragments.release_objects();  }
+
+private:
+    TPointerList<CacheEsiFragment>  m_fragments;
+
+    LS_NO_COPY_ASSIGN(CacheEsiMap);
+};
+
+#endif
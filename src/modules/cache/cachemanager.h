@@ -34,6 +34,27 @@ class CacheInfo;
 class Str2Id;
 class UrlVary;
 
+/**
+ * A snapshot saved in steps. copySnapshot() fills a buffer from the shared
+ * memory on the event loop, writeSnapshot() only writes it to the file and
+ * may run in another thread, one step at a time.
+ */
+struct SnapshotCursor
+{
+    int32_t     m_iSection;     //0 before the header
+    int32_t     m_iRecs;        //records copied of the section
+    int32_t     m_iTracked;     //records of the public tracker
+    int         m_fd;           //temp file, -1 before the first write
+    AutoStr2    m_lastKey;      //last key copied of the section
+
+    SnapshotCursor()
+        : m_iSection(0)
+        , m_iRecs(0)
+        , m_iTracked(0)
+        , m_fd(-1)
+    {}
+};
+
 #define PDF_MATCH   0
 #define PDF_PREFIX  1
 #define PDF_POSTFIX 2
@@ -54,6 +75,7 @@ class UrlVary;
 
 #define CM_TRACK_LITEMAGE 1
 #define CM_TRACK_PRIVATE  2
+#define CM_TRACK_TAGGED   4
 
 typedef struct shm_objtrack_s
 {
@@ -65,6 +87,17 @@ typedef struct shm_objtrack_s
 }shm_objtrack_t;
 
 
+#define CACHE_FILL_MAX_SECS     600
+
+//Owner of the cross process fill of a missed public object, no owner pid
+//marks an object found uncacheable, misses go to the backend right away.
+typedef struct shm_filllock_s
+{
+    int32_t     x_pid;
+    uint32_t    x_tmExpire;
+}shm_filllock_t;
+
+
 typedef struct purgeinfo_s
 {
     int32_t     tmSecs;
@@ -110,6 +143,7 @@ public:
         m_tmPurgeSecs = curTime;
         m_tmPurgeMsecs = curTimeMs;
     }
+    int32_t getPurgeTime() const    {   return m_tmPurgeSecs;   }
 
     int  shouldPurge(int32_t sec, int16_t msec)
     {
@@ -152,6 +186,10 @@ public:
     int32_t getNewPurgeCount() const
     {   return m_iSessionPurged - m_iLastCleanSessPurge;    }
 
+    int32_t getLastSnapshot() const {   return m_tmLastSnapshot;    }
+    char setLastSnapshot(int32_t tmOld, int32_t tmNow)
+    {   return ls_atomic_cas32(&m_tmLastSnapshot, tmOld, tmNow);       }
+
     uint32_t getFlags() const       {   return m_iFlags;        }
     void     setFlags(uint32_t f)   {   m_iFlags = f;        }
     
@@ -183,7 +221,8 @@ private:
     uint32_t        m_tmLastCleanDiskCache;
     uint32_t        m_iLastCleanSessPurge;
     uint32_t        m_iFlags;
-    char            m_reserved[252] /* Padding, do not remove */
+    uint32_t        m_tmLastSnapshot;
+    char            m_reserved[248] /* Padding, do not remove */
 #if __clang__
                                     __attribute__((unused))
 #endif
@@ -251,6 +290,10 @@ public:
     void    incFullPageHits(int isFull)
     {   getCacheInfo()->incFullPageHits(isFull);     }
 
+    //Time of the last purge of all public entries
+    int32_t getPurgeTime()
+    {   return getCacheInfo()->getPurgeTime();          }
+
     virtual int houseKeeping() = 0;
     virtual int shouldCleanDiskCache() = 0;
       
@@ -266,6 +309,49 @@ public:
     virtual int  isInTracker(const unsigned char* getKey, int keyLen, 
                              int isPrivate) = 0;
 
+    /**
+     * Collapsed forwarding of cache misses, the first miss of a public
+     * object takes the fill lock and goes to the backend, others wait for
+     * it. lockFill() returns 1 if the lock was taken by the caller, 0 if
+     * another request fills the object and -1 if it is marked hit-for-pass.
+     * The lock expires after iTimeout seconds if not released.
+     * unlockFill() only releases a lock owned by this process, with
+     * iPassSecs > 0 it is turned into a hit-for-pass marker.
+     */
+    virtual int  lockFill(const unsigned char *pKey, int keyLen,
+                          int iTimeout) = 0;
+    virtual void unlockFill(const unsigned char *pKey, int keyLen,
+                            int iPassSecs) = 0;
+    virtual int  isFillLocked(const unsigned char *pKey, int keyLen) = 0;
+
+    /**
+     * Public entries are indexed by their tags when tracked. A purge of an
+     * exact tag queues the tag, processTagPurges() then passes up to maxCnt
+     * indexed entries created before the purge to purgeEntry() with the
+     * purge flags. Return the number of tags still queued.
+     */
+    virtual int  processTagPurges(int maxCnt,
+                                  void (*purgeEntry)(void *,
+                                          const unsigned char *, int),
+                                  void *param) = 0;
+
+    /**
+     * The tracked public entries, vary ids, purge records and tag index are
+     * saved to a snapshot in the store directory, purges are journaled
+     * until the next one. init() restores both when the shared memory is
+     * created again, so a restart does not start with an empty tracker.
+     * shouldSaveSnapshot() returns 1 to one process per interval.
+     * copySnapshot() appends the next part of the snapshot to pBuf, it
+     * returns 1 once the snapshot is complete, 0 if more is to be copied.
+     * writeSnapshot() writes the part, the last one moves the file in
+     * place. saveSnapshot() does all the steps at once.
+     */
+    virtual int  shouldSaveSnapshot() = 0;
+    virtual int  copySnapshot(SnapshotCursor *pCursor, AutoBuf *pBuf) = 0;
+    virtual int  writeSnapshot(SnapshotCursor *pCursor, const char *pBuf,
+                               int len, int isLast) = 0;
+    virtual int  saveSnapshot() = 0;
+
 private:
     virtual CacheInfo *getCacheInfo() = 0;
 
@@ -0,0 +1,411 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2018  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+#include <ls.h>
+#include "cachememtier.h"
+#include "cacheentry.h"
+#include "cachestore.h"
+#include "dirhashcachestore.h"
+
+#include <shm/lsshm.h>
+#include <shm/lsshmhash.h>
+#include <shm/lsshmpool.h>
+#include <util/autobuf.h>
+#include <util/datetime.h>
+#include <util/ni_fio.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#define shmCacheMemTier     ".cachemem"
+#define CACHE_MEMINFO_MAGIC 0x434d0001
+
+
+typedef struct cachememinfo_s
+{
+    int32_t     x_iMagic;
+    int32_t     x_iObjs;
+    int64_t     x_iSize;
+    uint32_t    x_iStored;
+    uint32_t    x_iHits;
+    uint32_t    x_iEvicted;
+    uint32_t    x_iDemoted;
+} cachememinfo_t;
+
+
+static int buildKey(char *pBuf, const unsigned char *pHash, int isPrivate)
+{
+    memmove(pBuf, pHash, HASH_KEY_LEN);
+    pBuf[HASH_KEY_LEN] = (isPrivate != 0);
+    return HASH_KEY_LEN + 1;
+}
+
+
+//The image is "LSCH" + CeHeader, the header may not be aligned in SHM.
+static void getImageHeader(const uint8_t *pImage, CeHeader *pHeader)
+{
+    memmove((void *)pHeader, pImage + CACHE_ENTRY_MAGIC_LEN, sizeof(CeHeader));
+}
+
+
+CacheMemTier::CacheMemTier(DirHashCacheStore *pStore)
+    : m_pStore(pStore)
+    , m_pHash(NULL)
+    , m_infoOff(0)
+    , m_iMaxSize(0)
+    , m_iMaxObjSize(CACHE_MEMTIER_DEF_MAX_OBJ)
+{
+}
+
+
+CacheMemTier::~CacheMemTier()
+{
+}
+
+
+int CacheMemTier::init(const char *pStoreDir, int64_t iMaxSize,
+                       int iMaxObjSize)
+{
+    LsShm *pShm;
+    LsShmPool *pPool;
+    LsShmReg *pReg;
+    cachememinfo_t *pInfo;
+
+    if (m_pHash)
+        return LS_OK;
+    if ((pShm = LsShm::open(shmCacheMemTier, 40960, pStoreDir)) == NULL)
+    {
+        g_api->log(NULL, LSI_LOG_ERROR,
+                   "[CACHE] failed to open memory tier in [%s]: %s\n",
+                   pStoreDir, LsShm::getErrMsg());
+        LsShm::clrErrMsg();
+        return LS_FAIL;
+    }
+    if ((pPool = pShm->getGlobalPool()) == NULL)
+        return LS_FAIL;
+    m_pHash = pPool->getNamedHash("memtier", 1000, LsShmHash::hashXXH32,
+                                  memcmp, LSSHM_FLAG_LRU);
+    if (!m_pHash)
+        return LS_FAIL;
+    m_pHash->disableAutoLock();
+
+    m_pHash->lock();
+    if ((pReg = pShm->findReg("CMEMINFO")) != NULL)
+    {
+        m_infoOff = pReg->x_iValue;
+        if (getInfo()->x_iMagic != CACHE_MEMINFO_MAGIC)
+            m_infoOff = 0;
+    }
+    else if ((m_infoOff = pPool->alloc2(sizeof(cachememinfo_t))) != 0)
+    {
+        if ((pReg = pShm->addReg("CMEMINFO")) != NULL)
+        {
+            pInfo = getInfo();
+            memset(pInfo, 0, sizeof(*pInfo));
+            pInfo->x_iMagic = CACHE_MEMINFO_MAGIC;
+            pReg->x_iValue = m_infoOff;
+        }
+        else
+            m_infoOff = 0;
+    }
+    m_pHash->unlock();
+    if (m_infoOff == 0)
+    {
+        m_pHash = NULL;
+        return LS_FAIL;
+    }
+
+    if (iMaxObjSize <= 0)
+        iMaxObjSize = CACHE_MEMTIER_DEF_MAX_OBJ;
+    else if (iMaxObjSize > CACHE_MEMTIER_MAX_OBJ)
+        iMaxObjSize = CACHE_MEMTIER_MAX_OBJ;
+    m_iMaxObjSize = iMaxObjSize;
+    m_iMaxSize = iMaxSize;
+    g_api->log(NULL, LSI_LOG_DEBUG,
+               "[CACHE] memory tier in [%s], size: %lld, max object size: %d, "
+               "%d objects cached.\n", pStoreDir, (long long)m_iMaxSize,
+               m_iMaxObjSize, getInfo()->x_iObjs);
+    return LS_OK;
+}
+
+
+cachememinfo_t *CacheMemTier::getInfo() const
+{
+    return (cachememinfo_t *)m_pHash->offset2ptr(m_infoOff);
+}
+
+
+LsShmHIterOff CacheMemTier::findObj(const unsigned char *pHash,
+                                    int isPrivate)
+{
+    char achKey[HASH_KEY_LEN + 1];
+    ls_strpair_t parms;
+    int len = buildKey(achKey, pHash, isPrivate);
+    return m_pHash->findIterator(LsShmHash::setParms(&parms, achKey, len,
+                                 NULL, 0));
+}
+
+
+void CacheMemTier::removeObj(const unsigned char *pHash, int isPrivate)
+{
+    LsShmHIterOff iterOff = findObj(pHash, isPrivate);
+    if (iterOff.m_iOffset == 0)
+        return;
+    cachememinfo_t *pInfo = getInfo();
+    pInfo->x_iSize -= m_pHash->offset2iterator(iterOff)->getValLen();
+    --pInfo->x_iObjs;
+    m_pHash->eraseIterator(iterOff);
+}
+
+
+//An object trimmed from the tier, written back once it is unlocked.
+typedef struct memvictim_s
+{
+    struct memvictim_s *m_pNext;
+    int                 m_iLen;
+    int                 m_iStale;
+    unsigned char       m_achKey[HASH_KEY_LEN + 1];
+    char                m_achImage[1];
+} memvictim_t;
+
+
+typedef struct
+{
+    CacheMemTier   *m_pTier;
+    memvictim_t    *m_pVictims;
+} evictarg_t;
+
+
+/**
+ * Called for each object trimmed from the LRU end with the tier locked,
+ * keep a copy unless it is past any use. No I/O here, the lock is shared
+ * by all processes.
+ */
+int CacheMemTier::evictCb(LsShmHElem *pElem, void *pArg)
+{
+    evictarg_t *pEvict = (evictarg_t *)pArg;
+    cachememinfo_t *pInfo = pEvict->m_pTier->getInfo();
+    memvictim_t *pVictim;
+    CeHeader header;
+    int len = pElem->getValLen();
+
+    pInfo->x_iSize -= len;
+    --pInfo->x_iObjs;
+    ++pInfo->x_iEvicted;
+    getImageHeader(pElem->getVal(), &header);
+    if (DateTime::s_curTime - header.m_tmExpire > MAX_STALE_AGE)
+        return 0;
+    pVictim = (memvictim_t *)malloc(sizeof(memvictim_t) + len);
+    if (!pVictim)
+        return 0;
+    memmove(pVictim->m_achKey, pElem->getKey(), HASH_KEY_LEN + 1);
+    memmove(pVictim->m_achImage, pElem->getVal(), len);
+    pVictim->m_iLen = len;
+    pVictim->m_iStale = header.m_flag & CeHeader::CEH_STALE;
+    pVictim->m_pNext = pEvict->m_pVictims;
+    pEvict->m_pVictims = pVictim;
+    return 0;
+}
+
+
+void CacheMemTier::demote(memvictim_t *pVictims)
+{
+    memvictim_t *pNext;
+    int demoted = 0;
+
+    while (pVictims)
+    {
+        pNext = pVictims->m_pNext;
+        if (m_pStore->demoteEntry(pVictims->m_achKey,
+                                  pVictims->m_achKey[HASH_KEY_LEN],
+                                  pVictims->m_iStale, pVictims->m_achImage,
+                                  pVictims->m_iLen) == 0)
+            ++demoted;
+        free(pVictims);
+        pVictims = pNext;
+    }
+    if (demoted)
+    {
+        m_pHash->lock();
+        getInfo()->x_iDemoted += demoted;
+        m_pHash->unlock();
+    }
+}
+
+
+int CacheMemTier::store(CacheEntry *pEntry, int fd, int iLen)
+{
+    char achKey[HASH_KEY_LEN + 1];
+    char *pImage;
+    cachememinfo_t *pInfo;
+    LsShmOffset_t offVal;
+    evictarg_t evict;
+    int64_t need;
+    int keyLen;
+
+    if (!m_pHash || iLen > m_iMaxObjSize || iLen > m_iMaxSize)
+        return LS_FAIL;
+    if ((pImage = (char *)malloc(iLen)) == NULL)
+        return LS_FAIL;
+    if ((nio_pread(fd, pImage, iLen, pEntry->getStartOffset()) != iLen)
+        || (*(int *)pImage != CE_ID))
+    {
+        free(pImage);
+        return LS_FAIL;
+    }
+    keyLen = buildKey(achKey, pEntry->getHashKey().getKey(),
+                      pEntry->isPrivate());
+
+    evict.m_pTier = this;
+    evict.m_pVictims = NULL;
+    m_pHash->lock();
+    removeObj(pEntry->getHashKey().getKey(), pEntry->isPrivate());
+    need = getInfo()->x_iSize + iLen - m_iMaxSize;
+    if (need > 0)
+        m_pHash->trimsize((int)need, evictCb, &evict);
+    offVal = m_pHash->insert(achKey, keyLen, pImage, iLen);
+    if (offVal != 0)
+    {
+        pInfo = getInfo();
+        pInfo->x_iSize += iLen;
+        ++pInfo->x_iObjs;
+        ++pInfo->x_iStored;
+    }
+    m_pHash->unlock();
+    free(pImage);
+    demote(evict.m_pVictims);
+    return (offVal != 0) ? LS_OK : LS_FAIL;
+}
+
+
+int CacheMemTier::load(const unsigned char *pHash, int isPrivate,
+                       CacheEntry *pEntry)
+{
+    LsShmHIterOff iterOff;
+    const uint8_t *pImage;
+    CeHeader &header = pEntry->getHeader();
+    int ret = LS_FAIL;
+    int len;
+    char *p;
+
+    m_pHash->lock();
+    iterOff = findObj(pHash, isPrivate);
+    if (iterOff.m_iOffset != 0)
+    {
+        pImage = m_pHash->offset2iterator(iterOff)->getVal();
+        getImageHeader(pImage, &header);
+        pImage += CACHE_ENTRY_MAGIC_LEN + sizeof(CeHeader);
+        ret = LS_OK;
+        if ((len = header.m_keyLen) > 0)
+        {
+            if ((p = pEntry->getKey().prealloc(len + 1)) != NULL)
+            {
+                memmove(p, pImage, len);
+                p[len] = 0;
+            }
+            else
+                ret = LS_FAIL;
+        }
+        if ((len = header.m_tagLen) > 0)
+            pEntry->setTag((const char *)pImage + header.m_keyLen, len);
+        m_pHash->touchLru(iterOff);
+    }
+    m_pHash->unlock();
+    return ret;
+}
+
+
+int CacheMemTier::isChanged(CacheEntry *pEntry)
+{
+    LsShmHIterOff iterOff;
+    CeHeader header;
+    int changed = 1;
+
+    m_pHash->lock();
+    iterOff = findObj(pEntry->getHashKey().getKey(), pEntry->isPrivate());
+    if (iterOff.m_iOffset != 0)
+    {
+        getImageHeader(m_pHash->offset2iterator(iterOff)->getVal(), &header);
+        if ((header.m_tmCreated == pEntry->getHeader().m_tmCreated)
+            && (header.m_msCreated == pEntry->getHeader().m_msCreated))
+        {
+            changed = 0;
+            if (header.m_flag & CeHeader::CEH_STALE)
+                pEntry->setStale(1);
+        }
+    }
+    m_pHash->unlock();
+    return changed;
+}
+
+
+int CacheMemTier::setStale(const unsigned char *pHash, int isPrivate)
+{
+    LsShmHIterOff iterOff;
+    uint8_t *pImage;
+    CeHeader header;
+
+    m_pHash->lock();
+    iterOff = findObj(pHash, isPrivate);
+    if (iterOff.m_iOffset != 0)
+    {
+        pImage = m_pHash->offset2iterator(iterOff)->getVal();
+        getImageHeader(pImage, &header);
+        header.m_flag |= CeHeader::CEH_STALE;
+        memmove(pImage + CACHE_ENTRY_MAGIC_LEN, (void *)&header,
+                sizeof(CeHeader));
+    }
+    m_pHash->unlock();
+    return (iterOff.m_iOffset != 0) ? LS_OK : LS_FAIL;
+}
+
+
+int CacheMemTier::remove(const unsigned char *pHash, int isPrivate)
+{
+    m_pHash->lock();
+    removeObj(pHash, isPrivate);
+    m_pHash->unlock();
+    return LS_OK;
+}
+
+
+int CacheMemTier::copyImage(CacheEntry *pEntry, AutoBuf *pBuf)
+{
+    LsShmHIterOff iterOff;
+    LsShmHElem *pElem;
+    CeHeader header;
+    int ret = LS_FAIL;
+
+    m_pHash->lock();
+    iterOff = findObj(pEntry->getHashKey().getKey(), pEntry->isPrivate());
+    if (iterOff.m_iOffset != 0)
+    {
+        pElem = m_pHash->offset2iterator(iterOff);
+        getImageHeader(pElem->getVal(), &header);
+        if ((header.m_tmCreated == pEntry->getHeader().m_tmCreated)
+            && (header.m_msCreated == pEntry->getHeader().m_msCreated)
+            && pBuf->append((const char *)pElem->getVal(),
+                            pElem->getValLen()) != -1)
+        {
+            m_pHash->touchLru(iterOff);
+            ++getInfo()->x_iHits;
+            ret = LS_OK;
+        }
+    }
+    m_pHash->unlock();
+    return ret;
+}
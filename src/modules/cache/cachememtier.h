@@ -0,0 +1,88 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2018  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+#ifndef CACHEMEMTIER_H
+#define CACHEMEMTIER_H
+
+#include <lsdef.h>
+#include <shm/lsshmtypes.h>
+#include <inttypes.h>
+
+#define CACHE_MEMTIER_DEF_MAX_OBJ   (16 * 1024)
+#define CACHE_MEMTIER_MAX_OBJ       (1024 * 1024)
+
+class AutoBuf;
+class CacheEntry;
+class DirHashCacheStore;
+class LsShmHash;
+struct cachememinfo_s;
+struct memvictim_s;
+struct lsShm_hElem_s;
+
+/**
+ * CacheMemTier keeps small cache objects in a shared memory LRU hash
+ * instead of files, shared by all server processes. An object is the same
+ * "LSCH" image DirHashCacheStore writes to disk, keyed by the CacheHash key
+ * and the private flag. When the tier is full the least recently used
+ * objects are written back to their disk location by the store, after the
+ * tier is unlocked.
+ */
+class CacheMemTier
+{
+public:
+    explicit CacheMemTier(DirHashCacheStore *pStore);
+    ~CacheMemTier();
+
+    int init(const char *pStoreDir, int64_t iMaxSize, int iMaxObjSize);
+
+    int getMaxObjSize() const   {   return m_iMaxObjSize;   }
+
+    // Copy the published entry image of iLen bytes from fd.
+    int store(CacheEntry *pEntry, int fd, int iLen);
+
+    // Fill a new entry with the header, key and tag of a stored object.
+    int load(const unsigned char *pHash, int isPrivate, CacheEntry *pEntry);
+
+    // Return 1 if the object is gone or has been replaced.
+    int isChanged(CacheEntry *pEntry);
+
+    int setStale(const unsigned char *pHash, int isPrivate);
+    int remove(const unsigned char *pHash, int isPrivate);
+
+    /**
+     * Copy the image of the entry to pBuf, so that it can be sent without
+     * holding the tier lock. Fail if it is no longer there.
+     */
+    int copyImage(CacheEntry *pEntry, AutoBuf *pBuf);
+
+private:
+    DirHashCacheStore      *m_pStore;
+    LsShmHash              *m_pHash;
+    LsShmOffset_t           m_infoOff;
+    int64_t                 m_iMaxSize;
+    int                     m_iMaxObjSize;
+
+    struct cachememinfo_s *getInfo() const;
+    LsShmHIterOff findObj(const unsigned char *pHash, int isPrivate);
+    void removeObj(const unsigned char *pHash, int isPrivate);
+    static int evictCb(struct lsShm_hElem_s *pElem, void *pArg);
+    void demote(struct memvictim_s *pVictims);
+
+    LS_NO_COPY_ASSIGN(CacheMemTier);
+};
+
+#endif
@@ -0,0 +1,821 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2018  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+#include <ls.h>
+#include "cacheslabtier.h"
+#include "cacheentry.h"
+#include "cachemanager.h"
+#include "dirhashcachestore.h"
+
+#include <shm/lsshm.h>
+#include <shm/lsshmhash.h>
+#include <shm/lsshmpool.h>
+#include <util/datetime.h>
+#include <util/ni_fio.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define shmCacheSlabTier        ".cacheslab"
+#define CACHE_SLABINFO_MAGIC    0x43530002
+#define CACHE_SLABREC_MAGIC     0x4c534c42
+
+#define SLAB_RECLAIM_TIMEOUT    300
+//Bytes of a segment walked per house keeping call.
+#define SLAB_RECLAIM_STEP       (16 * 1024 * 1024)
+//Readers left by a process that died do not hold a segment longer.
+#define SLAB_PIN_TIMEOUT        3600
+
+#define SLAB_ALIGN(x)           (((x) + 7) & ~7)
+
+enum
+{
+    SLAB_SEG_FREE,
+    SLAB_SEG_ACTIVE,
+    SLAB_SEG_FULL,
+    SLAB_SEG_RECLAIM,
+};
+
+#define SLAB_OBJ_STALE          1
+
+
+typedef struct cacheslabseg_s
+{
+    int32_t     x_iState;
+    int32_t     x_iEnd;
+    int32_t     x_iLive;
+    int32_t     x_iSeq;
+    int32_t     x_tmFree;
+    int32_t     x_iReaders;
+    int32_t     x_tmPinned;
+    int32_t     x_iReclaimOff;
+    int32_t     x_iEvict;
+} cacheslabseg_t;
+
+
+typedef struct cacheslabinfo_s
+{
+    int32_t     x_iMagic;
+    int32_t     x_iSegs;
+    int32_t     x_iHead;
+    int32_t     x_iSeq;
+    int32_t     x_iObjs;
+    pid_t       x_pidReclaim;
+    int32_t     x_tmReclaim;
+    uint32_t    x_iStored;
+    uint32_t    x_iFull;
+    uint32_t    x_iMoved;
+    uint32_t    x_iEvicted;
+    uint32_t    x_iReclaimed;
+    cacheslabseg_t  x_segs[1];
+} cacheslabinfo_t;
+
+
+typedef struct cacheslabidx_s
+{
+    int32_t     x_iSeg;
+    int32_t     x_iOff;
+    int32_t     x_iLen;
+    int32_t     x_tmCreated;
+    int16_t     x_msCreated;
+    int16_t     x_iFlag;
+} cacheslabidx_t;
+
+
+//Each object in a segment file is this record followed by the image.
+typedef struct cacheslabrec_s
+{
+    int32_t     x_iMagic;
+    int32_t     x_iLen;
+    unsigned char x_key[HASH_KEY_LEN];
+    int32_t     x_isPrivate;
+    int32_t     x_iReserved;
+} cacheslabrec_t;
+
+
+static int buildKey(char *pBuf, const unsigned char *pHash, int isPrivate)
+{
+    memmove(pBuf, pHash, HASH_KEY_LEN);
+    pBuf[HASH_KEY_LEN] = (isPrivate != 0);
+    return HASH_KEY_LEN + 1;
+}
+
+
+CacheSlabTier::CacheSlabTier(DirHashCacheStore *pStore)
+    : m_pStore(pStore)
+    , m_pHash(NULL)
+    , m_infoOff(0)
+    , m_iMaxObjSize(CACHE_SLAB_DEF_MAX_OBJ)
+    , m_iSegs(0)
+    , m_pSegFds(NULL)
+    , m_pDir(NULL)
+{
+}
+
+
+CacheSlabTier::~CacheSlabTier()
+{
+    if (m_pSegFds)
+    {
+        for (int i = 0; i < m_iSegs; ++i)
+        {
+            if (m_pSegFds[i] != -1)
+                close(m_pSegFds[i]);
+        }
+        free(m_pSegFds);
+    }
+    if (m_pDir)
+        free(m_pDir);
+}
+
+
+int CacheSlabTier::init(const char *pStoreDir, int64_t iMaxSize,
+                        int iMaxObjSize)
+{
+    char achDir[4096];
+    LsShm *pShm;
+    LsShmPool *pPool;
+    LsShmReg *pReg;
+    cacheslabinfo_t *pInfo;
+    int segs;
+
+    if (m_pHash)
+        return LS_OK;
+    segs = (int)(iMaxSize / CACHE_SLAB_SEG_SIZE);
+    if (segs < 4)
+        segs = 4;
+    else if (segs > CACHE_SLAB_MAX_SEGS)
+        segs = CACHE_SLAB_MAX_SEGS;
+
+    snprintf(achDir, sizeof(achDir), "%sslab/", pStoreDir);
+    if ((mkdir(achDir, 0770) == -1) && (errno != EEXIST))
+    {
+        g_api->log(NULL, LSI_LOG_ERROR,
+                   "[CACHE] failed to create slab directory [%s]: %s\n",
+                   achDir, strerror(errno));
+        return LS_FAIL;
+    }
+    if ((pShm = LsShm::open(shmCacheSlabTier, 40960, pStoreDir)) == NULL)
+    {
+        g_api->log(NULL, LSI_LOG_ERROR,
+                   "[CACHE] failed to open slab index in [%s]: %s\n",
+                   pStoreDir, LsShm::getErrMsg());
+        LsShm::clrErrMsg();
+        return LS_FAIL;
+    }
+    if ((pPool = pShm->getGlobalPool()) == NULL)
+        return LS_FAIL;
+    m_pHash = pPool->getNamedHash("slabindex", 1000, LsShmHash::hashXXH32,
+                                  memcmp, 0);
+    if (!m_pHash)
+        return LS_FAIL;
+    m_pHash->disableAutoLock();
+
+    m_pHash->lock();
+    if ((pReg = pShm->findReg("CSLABINF")) != NULL)
+    {
+        m_infoOff = pReg->x_iValue;
+        if (getInfo()->x_iMagic != CACHE_SLABINFO_MAGIC)
+            m_infoOff = 0;
+    }
+    else if ((m_infoOff = pPool->alloc2(sizeof(cacheslabinfo_t)
+                            + (segs - 1) * sizeof(cacheslabseg_t))) != 0)
+    {
+        if ((pReg = pShm->addReg("CSLABINF")) != NULL)
+        {
+            pInfo = getInfo();
+            memset(pInfo, 0, sizeof(*pInfo)
+                   + (segs - 1) * sizeof(cacheslabseg_t));
+            pInfo->x_iMagic = CACHE_SLABINFO_MAGIC;
+            pInfo->x_iSegs = segs;
+            pInfo->x_iHead = -1;
+            pReg->x_iValue = m_infoOff;
+        }
+        else
+            m_infoOff = 0;
+    }
+    //The segment table is sized when the index is created, a new size
+    //takes effect once the cache storage is cleared.
+    if (m_infoOff != 0)
+        m_iSegs = getInfo()->x_iSegs;
+    m_pHash->unlock();
+    if (m_infoOff == 0)
+    {
+        m_pHash = NULL;
+        return LS_FAIL;
+    }
+
+    m_pSegFds = (int *)malloc(m_iSegs * sizeof(int));
+    if (!m_pSegFds)
+    {
+        m_pHash = NULL;
+        return LS_FAIL;
+    }
+    for (int i = 0; i < m_iSegs; ++i)
+        m_pSegFds[i] = -1;
+    m_pDir = strdup(achDir);
+
+    if (iMaxObjSize <= 0)
+        iMaxObjSize = CACHE_SLAB_DEF_MAX_OBJ;
+    else if (iMaxObjSize > CACHE_SLAB_MAX_OBJ)
+        iMaxObjSize = CACHE_SLAB_MAX_OBJ;
+    m_iMaxObjSize = iMaxObjSize;
+    g_api->log(NULL, LSI_LOG_DEBUG,
+               "[CACHE] slab tier in [%s], %d segments of %d bytes, "
+               "max object size: %d, %d objects cached.\n", m_pDir, m_iSegs,
+               CACHE_SLAB_SEG_SIZE, m_iMaxObjSize, getInfo()->x_iObjs);
+    return LS_OK;
+}
+
+
+cacheslabinfo_t *CacheSlabTier::getInfo() const
+{
+    return (cacheslabinfo_t *)m_pHash->offset2ptr(m_infoOff);
+}
+
+
+cacheslabseg_t *CacheSlabTier::getSeg(int seg) const
+{
+    return &getInfo()->x_segs[seg];
+}
+
+
+cacheslabidx_t *CacheSlabTier::findIdx(const unsigned char *pHash,
+                                       int isPrivate)
+{
+    char achKey[HASH_KEY_LEN + 1];
+    LsShmOffset_t offVal;
+    int valLen;
+    int len = buildKey(achKey, pHash, isPrivate);
+    offVal = m_pHash->find(achKey, len, &valLen);
+    if ((offVal == 0) || (valLen != sizeof(cacheslabidx_t)))
+        return NULL;
+    return (cacheslabidx_t *)m_pHash->offset2ptr(offVal);
+}
+
+
+/**
+ * Segment files are opened once per process and preallocated by whoever
+ * opens them first.
+ */
+int CacheSlabTier::getSegFd(int seg)
+{
+    char achPath[4096];
+    struct stat st;
+    int fd;
+
+    if (m_pSegFds[seg] != -1)
+        return m_pSegFds[seg];
+    snprintf(achPath, sizeof(achPath), "%s%04x", m_pDir, seg);
+    fd = ::open(achPath, O_RDWR | O_CREAT, 0660);
+    if (fd == -1)
+    {
+        g_api->log(NULL, LSI_LOG_ERROR,
+                   "[CACHE] failed to open slab segment [%s]: %s\n",
+                   achPath, strerror(errno));
+        return -1;
+    }
+    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    if ((fstat(fd, &st) == 0) && (st.st_size < CACHE_SLAB_SEG_SIZE))
+        posix_fallocate(fd, 0, CACHE_SLAB_SEG_SIZE);
+    m_pSegFds[seg] = fd;
+    return fd;
+}
+
+
+static int isPinned(const cacheslabseg_t *pSeg)
+{
+    return (pSeg->x_iReaders > 0)
+           && (DateTime::s_curTime - pSeg->x_tmPinned < SLAB_PIN_TIMEOUT);
+}
+
+
+/**
+ * Reserve iLen bytes at the head segment, switch to the free segment freed
+ * the longest ago when the head is full. A free segment is not reused while
+ * responses are still sent from it. Called with the tier locked.
+ */
+int CacheSlabTier::reserve(int iLen, int *pOff)
+{
+    cacheslabinfo_t *pInfo = getInfo();
+    cacheslabseg_t *pSeg;
+    int best = -1;
+    int i;
+
+    if (pInfo->x_iHead >= 0)
+    {
+        pSeg = getSeg(pInfo->x_iHead);
+        if (pSeg->x_iEnd + iLen <= CACHE_SLAB_SEG_SIZE)
+        {
+            *pOff = pSeg->x_iEnd;
+            pSeg->x_iEnd += iLen;
+            return pInfo->x_iHead;
+        }
+        pSeg->x_iState = SLAB_SEG_FULL;
+        pInfo->x_iHead = -1;
+    }
+    for (i = 0; i < m_iSegs; ++i)
+    {
+        pSeg = getSeg(i);
+        if ((pSeg->x_iState == SLAB_SEG_FREE) && !isPinned(pSeg)
+            && ((best == -1) || (pSeg->x_tmFree < getSeg(best)->x_tmFree)))
+            best = i;
+    }
+    if (best == -1)
+        return -1;
+    pSeg = getSeg(best);
+    pSeg->x_iState = SLAB_SEG_ACTIVE;
+    pSeg->x_iEnd = iLen;
+    pSeg->x_iLive = 0;
+    pSeg->x_iReaders = 0;
+    pSeg->x_iSeq = ++pInfo->x_iSeq;
+    pInfo->x_iHead = best;
+    *pOff = 0;
+    return best;
+}
+
+
+//Called with the tier locked.
+void CacheSlabTier::removeIdx(const unsigned char *pHash, int isPrivate)
+{
+    char achKey[HASH_KEY_LEN + 1];
+    cacheslabidx_t *pIdx = findIdx(pHash, isPrivate);
+    if (!pIdx)
+        return;
+    getSeg(pIdx->x_iSeg)->x_iLive -= SLAB_ALIGN(sizeof(cacheslabrec_t)
+                                                + pIdx->x_iLen);
+    --getInfo()->x_iObjs;
+    m_pHash->remove(achKey, buildKey(achKey, pHash, isPrivate));
+}
+
+
+/**
+ * Write the record in pRec, a cacheslabrec_t followed by the image, to the
+ * head segment and index it. When moving an object, pCopyOf is its current
+ * location, the index is only updated if the object has not been replaced
+ * or removed meanwhile.
+ */
+int CacheSlabTier::append(const unsigned char *pHash, int isPrivate,
+                          char *pRec, int iLen, const cacheslabidx_t *pCopyOf)
+{
+    char achKey[HASH_KEY_LEN + 1];
+    cacheslabrec_t *pHdr = (cacheslabrec_t *)pRec;
+    cacheslabidx_t idx;
+    cacheslabidx_t *pIdx;
+    CeHeader header;
+    int total = SLAB_ALIGN(iLen);
+    int seg, off, fd, keyLen;
+
+    pHdr->x_iMagic = CACHE_SLABREC_MAGIC;
+    pHdr->x_iLen = iLen - sizeof(cacheslabrec_t);
+    memmove(pHdr->x_key, pHash, HASH_KEY_LEN);
+    pHdr->x_isPrivate = (isPrivate != 0);
+    pHdr->x_iReserved = 0;
+
+    m_pHash->lock();
+    seg = reserve(total, &off);
+    if (seg == -1)
+        ++getInfo()->x_iFull;
+    m_pHash->unlock();
+    if (seg == -1)
+        return LS_FAIL;
+    if (((fd = getSegFd(seg)) == -1)
+        || (nio_pwrite(fd, pRec, iLen, off) != iLen))
+        return LS_FAIL;
+
+    m_pHash->lock();
+    if (pCopyOf)
+    {
+        pIdx = findIdx(pHash, isPrivate);
+        if (!pIdx || (pIdx->x_iSeg != pCopyOf->x_iSeg)
+            || (pIdx->x_iOff != pCopyOf->x_iOff))
+        {
+            m_pHash->unlock();
+            return LS_FAIL;
+        }
+        pIdx->x_iSeg = seg;
+        pIdx->x_iOff = off;
+        getSeg(seg)->x_iLive += total;
+        getSeg(pCopyOf->x_iSeg)->x_iLive -= total;
+        ++getInfo()->x_iMoved;
+        m_pHash->unlock();
+        return LS_OK;
+    }
+
+    memmove((void *)&header, pRec + sizeof(cacheslabrec_t)
+            + CACHE_ENTRY_MAGIC_LEN, sizeof(CeHeader));
+    idx.x_iSeg = seg;
+    idx.x_iOff = off;
+    idx.x_iLen = pHdr->x_iLen;
+    idx.x_tmCreated = header.m_tmCreated;
+    idx.x_msCreated = header.m_msCreated;
+    idx.x_iFlag = (header.m_flag & CeHeader::CEH_STALE) ? SLAB_OBJ_STALE : 0;
+    removeIdx(pHash, isPrivate);
+    keyLen = buildKey(achKey, pHash, isPrivate);
+    if (m_pHash->insert(achKey, keyLen, &idx, sizeof(idx)) != 0)
+    {
+        getSeg(seg)->x_iLive += total;
+        ++getInfo()->x_iObjs;
+        ++getInfo()->x_iStored;
+        seg = LS_OK;
+    }
+    else
+        seg = LS_FAIL;
+    m_pHash->unlock();
+    return seg;
+}
+
+
+int CacheSlabTier::store(CacheEntry *pEntry, int fd, int iLen)
+{
+    char *pRec;
+    int ret;
+
+    if (!m_pHash || iLen > m_iMaxObjSize)
+        return LS_FAIL;
+    if ((pRec = (char *)malloc(sizeof(cacheslabrec_t) + iLen)) == NULL)
+        return LS_FAIL;
+    if ((nio_pread(fd, pRec + sizeof(cacheslabrec_t), iLen,
+                   pEntry->getStartOffset()) != iLen)
+        || (*(int *)(pRec + sizeof(cacheslabrec_t)) != CE_ID))
+    {
+        free(pRec);
+        return LS_FAIL;
+    }
+    ret = append(pEntry->getHashKey().getKey(), pEntry->isPrivate(), pRec,
+                 sizeof(cacheslabrec_t) + iLen, NULL);
+    free(pRec);
+    return ret;
+}
+
+
+int CacheSlabTier::storeImage(const unsigned char *pHash, int isPrivate,
+                              const char *pImage, int iLen)
+{
+    char *pRec;
+    int ret;
+
+    if (!m_pHash || iLen > m_iMaxObjSize)
+        return LS_FAIL;
+    if ((pRec = (char *)malloc(sizeof(cacheslabrec_t) + iLen)) == NULL)
+        return LS_FAIL;
+    memmove(pRec + sizeof(cacheslabrec_t), pImage, iLen);
+    ret = append(pHash, isPrivate, pRec, sizeof(cacheslabrec_t) + iLen, NULL);
+    free(pRec);
+    return ret;
+}
+
+
+int CacheSlabTier::attach(const unsigned char *pHash, int isPrivate,
+                          CacheEntry *pEntry)
+{
+    cacheslabidx_t *pIdx;
+    cacheslabidx_t idx;
+    int fd;
+
+    m_pHash->lock();
+    pIdx = findIdx(pHash, isPrivate);
+    if (pIdx)
+        idx = *pIdx;
+    m_pHash->unlock();
+    if (!pIdx || ((fd = getSegFd(idx.x_iSeg)) == -1))
+        return LS_FAIL;
+    if ((fd = dup(fd)) == -1)
+        return LS_FAIL;
+    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    if (pEntry->getFdStore() != -1)
+        close(pEntry->getFdStore());
+    pEntry->setFdStore(fd);
+    pEntry->setSlabSeg(idx.x_iSeg);
+    pEntry->setStartOffset(idx.x_iOff + sizeof(cacheslabrec_t));
+    return LS_OK;
+}
+
+
+int CacheSlabTier::attach(CacheEntry *pEntry)
+{
+    return attach(pEntry->getHashKey().getKey(), pEntry->isPrivate(), pEntry);
+}
+
+
+int CacheSlabTier::load(const unsigned char *pHash, int isPrivate,
+                        CacheEntry *pEntry)
+{
+    if (attach(pHash, isPrivate, pEntry) != LS_OK)
+        return LS_FAIL;
+    if (pEntry->loadCeHeader() == -1)
+        return LS_FAIL;
+    return isChanged(pEntry) ? LS_FAIL : LS_OK;
+}
+
+
+int CacheSlabTier::isChanged(CacheEntry *pEntry)
+{
+    cacheslabidx_t *pIdx;
+    int changed = 1;
+
+    m_pHash->lock();
+    pIdx = findIdx(pEntry->getHashKey().getKey(), pEntry->isPrivate());
+    if (pIdx && (pIdx->x_iSeg == pEntry->getSlabSeg())
+        && (pIdx->x_iOff + (off_t)sizeof(cacheslabrec_t)
+            == pEntry->getStartOffset())
+        && (pIdx->x_tmCreated == pEntry->getHeader().m_tmCreated)
+        && (pIdx->x_msCreated == pEntry->getHeader().m_msCreated))
+    {
+        changed = 0;
+        if (pIdx->x_iFlag & SLAB_OBJ_STALE)
+            pEntry->setStale(1);
+    }
+    m_pHash->unlock();
+    return changed;
+}
+
+
+int CacheSlabTier::pin(CacheEntry *pEntry)
+{
+    cacheslabidx_t *pIdx;
+    cacheslabseg_t *pSeg;
+    int seg = -1;
+
+    m_pHash->lock();
+    pIdx = findIdx(pEntry->getHashKey().getKey(), pEntry->isPrivate());
+    if (pIdx && (pIdx->x_iSeg == pEntry->getSlabSeg())
+        && (pIdx->x_iOff + (off_t)sizeof(cacheslabrec_t)
+            == pEntry->getStartOffset())
+        && (pIdx->x_tmCreated == pEntry->getHeader().m_tmCreated)
+        && (pIdx->x_msCreated == pEntry->getHeader().m_msCreated))
+    {
+        seg = pIdx->x_iSeg;
+        pSeg = getSeg(seg);
+        ++pSeg->x_iReaders;
+        pSeg->x_tmPinned = DateTime::s_curTime;
+    }
+    m_pHash->unlock();
+    return seg;
+}
+
+
+void CacheSlabTier::unpin(int seg)
+{
+    cacheslabseg_t *pSeg;
+
+    if (seg < 0 || seg >= m_iSegs)
+        return;
+    m_pHash->lock();
+    pSeg = getSeg(seg);
+    if (pSeg->x_iReaders > 0)
+        --pSeg->x_iReaders;
+    m_pHash->unlock();
+}
+
+
+int CacheSlabTier::setStale(const unsigned char *pHash, int isPrivate)
+{
+    cacheslabidx_t *pIdx;
+
+    m_pHash->lock();
+    if ((pIdx = findIdx(pHash, isPrivate)) != NULL)
+        pIdx->x_iFlag |= SLAB_OBJ_STALE;
+    m_pHash->unlock();
+    return (pIdx != NULL) ? LS_OK : LS_FAIL;
+}
+
+
+int CacheSlabTier::remove(const unsigned char *pHash, int isPrivate)
+{
+    m_pHash->lock();
+    removeIdx(pHash, isPrivate);
+    m_pHash->unlock();
+    return LS_OK;
+}
+
+
+/**
+ * Pick a full segment to reclaim when free segments run low, the one with
+ * the least live data if at most half of it is live, otherwise the oldest
+ * one is evicted. Only one process reclaims at a time, a segment being
+ * reclaimed is picked again until it is done.
+ */
+int CacheSlabTier::claimVictim(int *pEvict)
+{
+    cacheslabinfo_t *pInfo = getInfo();
+    cacheslabseg_t *pSeg;
+    int minFree = m_iSegs / 32;
+    int nFree = 0;
+    int least = -1;
+    int oldest = -1;
+    int left = -1;
+    int i;
+
+    if (minFree < 2)
+        minFree = 2;
+    if ((pInfo->x_pidReclaim != 0) && (pInfo->x_pidReclaim != getpid())
+        && (kill(pInfo->x_pidReclaim, 0) == 0)
+        && (DateTime::s_curTime - pInfo->x_tmReclaim < SLAB_RECLAIM_TIMEOUT))
+        return -1;
+    for (i = 0; i < m_iSegs; ++i)
+    {
+        pSeg = getSeg(i);
+        if (pSeg->x_iState == SLAB_SEG_FREE)
+            ++nFree;
+        else if (pSeg->x_iState == SLAB_SEG_RECLAIM)
+            left = i;
+        else if (pSeg->x_iState == SLAB_SEG_FULL)
+        {
+            if ((least == -1) || (pSeg->x_iLive < getSeg(least)->x_iLive))
+                least = i;
+            if ((oldest == -1) || (pSeg->x_iSeq < getSeg(oldest)->x_iSeq))
+                oldest = i;
+        }
+    }
+    if (left != -1)
+    {
+        //Being reclaimed, or left over by a process that died meanwhile.
+        *pEvict = getSeg(left)->x_iEvict;
+        i = left;
+    }
+    else if ((nFree >= minFree) || (least == -1))
+        return -1;
+    else if (getSeg(least)->x_iLive <= CACHE_SLAB_SEG_SIZE / 2)
+    {
+        *pEvict = 0;
+        i = least;
+    }
+    else
+    {
+        *pEvict = 1;
+        i = oldest;
+    }
+    if (i != left)
+    {
+        pSeg = getSeg(i);
+        pSeg->x_iState = SLAB_SEG_RECLAIM;
+        pSeg->x_iReclaimOff = 0;
+        pSeg->x_iEvict = *pEvict;
+    }
+    pInfo->x_pidReclaim = getpid();
+    pInfo->x_tmReclaim = DateTime::s_curTime;
+    return i;
+}
+
+
+/**
+ * Walk the records of a segment, copy the ones still indexed there to the
+ * head segment, or drop them when evicting, then free the segment. Up to
+ * SLAB_RECLAIM_STEP bytes are walked per call, the position is kept in the
+ * segment for the next one. Return 1 when the segment is free.
+ */
+int CacheSlabTier::reclaim(int seg, int evict)
+{
+    cacheslabrec_t rec;
+    cacheslabidx_t *pIdx;
+    cacheslabidx_t idx;
+    LsShmHash::iteroffset iter, iterNext;
+    char *pBuf = NULL;
+    int bufLen = 0;
+    int fd = getSegFd(seg);
+    int off, stop, end, len, live, moved = 0, dropped = 0;
+
+    m_pHash->lock();
+    end = getSeg(seg)->x_iEnd;
+    off = getSeg(seg)->x_iReclaimOff;
+    m_pHash->unlock();
+    stop = off + SLAB_RECLAIM_STEP;
+    while ((fd != -1) && (off < end) && (off < stop))
+    {
+        if ((nio_pread(fd, &rec, sizeof(rec), off) != (int)sizeof(rec))
+            || (rec.x_iMagic != CACHE_SLABREC_MAGIC) || (rec.x_iLen <= 0)
+            || (off + (int)sizeof(rec) + rec.x_iLen > end))
+            break;
+        len = sizeof(rec) + rec.x_iLen;
+
+        m_pHash->lock();
+        pIdx = findIdx(rec.x_key, rec.x_isPrivate);
+        live = (pIdx && (pIdx->x_iSeg == seg) && (pIdx->x_iOff == off));
+        if (live)
+            idx = *pIdx;
+        m_pHash->unlock();
+
+        if (live && !evict)
+        {
+            if (bufLen < len)
+            {
+                free(pBuf);
+                bufLen = len;
+                if ((pBuf = (char *)malloc(bufLen)) == NULL)
+                    bufLen = 0;
+            }
+            if (pBuf && (nio_pread(fd, pBuf, len, off) == len)
+                && (append(rec.x_key, rec.x_isPrivate, pBuf, len, &idx)
+                    == LS_OK))
+            {
+                ++moved;
+                live = 0;
+            }
+        }
+        if (live)
+        {
+            m_pHash->lock();
+            pIdx = findIdx(rec.x_key, rec.x_isPrivate);
+            if (pIdx && (pIdx->x_iSeg == seg) && (pIdx->x_iOff == off))
+            {
+                removeIdx(rec.x_key, rec.x_isPrivate);
+                ++getInfo()->x_iEvicted;
+            }
+            else
+                live = 0;
+            m_pHash->unlock();
+            if (live)
+            {
+                m_pStore->getManager()->removeTracking(
+                    (const char *)rec.x_key, HASH_KEY_LEN, rec.x_isPrivate);
+                ++dropped;
+            }
+        }
+        off += SLAB_ALIGN(len);
+    }
+    free(pBuf);
+
+    m_pHash->lock();
+    if ((fd != -1) && (off < end) && (off >= stop))
+    {
+        getSeg(seg)->x_iReclaimOff = off;
+        getInfo()->x_tmReclaim = DateTime::s_curTime;
+        m_pHash->unlock();
+        g_api->log(NULL, LSI_LOG_DEBUG,
+                   "[CACHE] reclaiming slab segment %d, %d of %d bytes, "
+                   "%d objects moved, %d dropped.\n", seg, off, end, moved,
+                   dropped);
+        return 0;
+    }
+    if (off < end)
+    {
+        //Unreadable record, drop whatever is still indexed in the segment.
+        iter = m_pHash->begin();
+        while (iter.m_iOffset != 0)
+        {
+            iterNext = m_pHash->next(iter);
+            if (m_pHash->offset2iterator(iter)->getValLen()
+                == sizeof(cacheslabidx_t))
+            {
+                memmove(&idx, m_pHash->offset2iterator(iter)->getVal(),
+                        sizeof(idx));
+                if (idx.x_iSeg == seg)
+                {
+                    --getInfo()->x_iObjs;
+                    m_pHash->eraseIterator(iter);
+                    ++dropped;
+                }
+            }
+            iter = iterNext;
+        }
+    }
+    cacheslabseg_t *pSeg = getSeg(seg);
+    pSeg->x_iState = SLAB_SEG_FREE;
+    pSeg->x_iEnd = 0;
+    pSeg->x_iLive = 0;
+    pSeg->x_iReclaimOff = 0;
+    pSeg->x_tmFree = DateTime::s_curTime;
+    ++getInfo()->x_iReclaimed;
+    getInfo()->x_pidReclaim = 0;
+    m_pHash->unlock();
+
+    g_api->log(NULL, LSI_LOG_DEBUG,
+               "[CACHE] slab segment %d reclaimed, %d objects moved, "
+               "%d dropped.\n", seg, moved, dropped);
+    return 1;
+}
+
+
+void CacheSlabTier::houseKeeping()
+{
+    int seg, evict = 0;
+
+    if (!m_pHash)
+        return;
+    m_pHash->lock();
+    seg = claimVictim(&evict);
+    m_pHash->unlock();
+    if (seg != -1)
+        reclaim(seg, evict);
+}
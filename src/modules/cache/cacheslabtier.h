@@ -0,0 +1,116 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2018  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+#ifndef CACHESLABTIER_H
+#define CACHESLABTIER_H
+
+#include <lsdef.h>
+#include <shm/lsshmtypes.h>
+#include <inttypes.h>
+
+#define CACHE_SLAB_SEG_SIZE         (128 * 1024 * 1024)
+#define CACHE_SLAB_MAX_SEGS         16384
+#define CACHE_SLAB_DEF_MAX_OBJ      (1024 * 1024)
+#define CACHE_SLAB_MAX_OBJ          (16 * 1024 * 1024)
+
+class CacheEntry;
+class DirHashCacheStore;
+class LsShmHash;
+struct cacheslabinfo_s;
+struct cacheslabseg_s;
+struct cacheslabidx_s;
+
+/**
+ * CacheSlabTier appends cache objects to large preallocated segment files
+ * under "<store>/slab/" instead of one file per object, so millions of
+ * small objects do not cost an inode and a directory entry each. An index
+ * in shared memory maps the CacheHash key and the private flag to the
+ * segment, offset and length of the "LSCH" image, entries are served from
+ * a duplicate of the segment fd.
+ * Space is reclaimed a segment at a time, live objects of the segment with
+ * the least live data are copied to the head segment, or when most of the
+ * data is still live, the oldest segment is evicted. A freed segment is
+ * reused once no response is being sent from it.
+ */
+class CacheSlabTier
+{
+public:
+    explicit CacheSlabTier(DirHashCacheStore *pStore);
+    ~CacheSlabTier();
+
+    int init(const char *pStoreDir, int64_t iMaxSize, int iMaxObjSize);
+
+    int getMaxObjSize() const   {   return m_iMaxObjSize;   }
+
+    // Append the published entry image of iLen bytes from fd.
+    int store(CacheEntry *pEntry, int fd, int iLen);
+
+    // Append an image already in memory, used for memory tier evictions.
+    int storeImage(const unsigned char *pHash, int isPrivate,
+                   const char *pImage, int iLen);
+
+    /**
+     * Point the entry to its stored object, the entry gets its own fd of
+     * the segment, the segment number and the start offset of the image.
+     */
+    int attach(CacheEntry *pEntry);
+
+    // Attach a new entry and load its header, key and tag.
+    int load(const unsigned char *pHash, int isPrivate, CacheEntry *pEntry);
+
+    // Return 1 if the object is gone or has been replaced.
+    int isChanged(CacheEntry *pEntry);
+
+    int setStale(const unsigned char *pHash, int isPrivate);
+    int remove(const unsigned char *pHash, int isPrivate);
+
+    /**
+     * Keep the segment of the entry from being reused while a response is
+     * sent from it. Return the segment, or -1 if the object has moved.
+     */
+    int  pin(CacheEntry *pEntry);
+    void unpin(int seg);
+
+    // Reclaim a segment a step at a time when running out of free ones.
+    void houseKeeping();
+
+private:
+    DirHashCacheStore      *m_pStore;
+    LsShmHash              *m_pHash;
+    LsShmOffset_t           m_infoOff;
+    int                     m_iMaxObjSize;
+    int                     m_iSegs;
+    int                    *m_pSegFds;
+    char                   *m_pDir;
+
+    struct cacheslabinfo_s *getInfo() const;
+    struct cacheslabseg_s *getSeg(int seg) const;
+    struct cacheslabidx_s *findIdx(const unsigned char *pHash, int isPrivate);
+    int  getSegFd(int seg);
+    int  reserve(int iLen, int *pOff);
+    int  append(const unsigned char *pHash, int isPrivate, char *pRec,
+                int iLen, const struct cacheslabidx_s *pCopyOf);
+    int  attach(const unsigned char *pHash, int isPrivate,
+                CacheEntry *pEntry);
+    void removeIdx(const unsigned char *pHash, int isPrivate);
+    int  claimVictim(int *pEvict);
+    int  reclaim(int seg, int evict);
+
+    LS_NO_COPY_ASSIGN(CacheSlabTier);
+};
+
+#endif
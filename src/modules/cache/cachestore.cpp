@@ -34,6 +34,7 @@ CacheStore::CacheStore()
     , m_iTotalHit(0)
     , m_iTotalMiss(0)
     , m_lastError(0)
+    , m_iTagPurgeTimer(-1)
     , m_pManager(NULL)
 {
 }
@@ -41,6 +42,8 @@ CacheStore::CacheStore()
 
 CacheStore::~CacheStore()
 {
+    if (m_iTagPurgeTimer != -1)
+        g_api->remove_timer(m_iTagPurgeTimer);
     release_objects();
     m_dirtyList.release_objects();
     if (m_pManager)
@@ -261,3 +264,40 @@ int CacheStore::cleanByTracking(int public_max, int private_max)
     return 0;
 }
 
+
+#define TAG_PURGE_BATCH     200
+
+void CacheStore::purgeByTagCb(void *pParam, const unsigned char *pKey,
+                              int flag)
+{
+    CacheStore *pThis = (CacheStore *)pParam;
+    if (flag & PDF_STALE)
+        pThis->staleEntryByHash(pKey, 0);
+    else
+    {
+        pThis->removeEntryByHash(pKey, 0);
+        pThis->getManager()->removeTracking((const char *)pKey,
+                                            HASH_KEY_LEN, 0);
+    }
+}
+
+
+void CacheStore::tagPurgeTimerCb(const void *pParam)
+{
+    CacheStore *pThis = (CacheStore *)pParam;
+    if (pThis->getManager()->processTagPurges(TAG_PURGE_BATCH,
+            CacheStore::purgeByTagCb, pThis) == 0)
+    {
+        g_api->remove_timer(pThis->m_iTagPurgeTimer);
+        pThis->m_iTagPurgeTimer = -1;
+    }
+}
+
+
+void CacheStore::startTagPurge()
+{
+    if (!getManager() || m_iTagPurgeTimer != -1)
+        return;
+    m_iTagPurgeTimer = g_api->set_timer(100, 1, CacheStore::tagPurgeTimerCb,
+                                        this);
+}
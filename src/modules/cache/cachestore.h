@@ -114,16 +114,28 @@ public:
     static int cleanByTrackingCb(void *, void *);
 
     virtual void removeEntryByHash(const unsigned char * pKey, int keyLen) = 0;
+    virtual void staleEntryByHash(const unsigned char *pKey, int isPrivate) = 0;
+
+    /**
+     * Start removing the entries indexed under the tags of a purge command
+     * in the background, a batch every 100ms until the queue is empty.
+     */
+    void startTagPurge();
 
 protected:
     virtual int renameDiskEntry(CacheEntry *pEntry, char *pFrom, size_t maxFrom,
                                 const char *pFromSuffix, const char *pToSuffix, int validate) = 0;
 
 private:
+    static void tagPurgeTimerCb(const void *pParam);
+    static void purgeByTagCb(void *pParam, const unsigned char *pKey,
+                             int flag);
+
     int m_iTotalEntries;
     int m_iTotalHit;
     int m_iTotalMiss;
     int m_lastError;
+    int m_iTagPurgeTimer;
 
     TPointerList< CacheEntry >       m_dirtyList;
     CacheManager                    *m_pManager;
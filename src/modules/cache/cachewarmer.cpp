@@ -0,0 +1,394 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2018  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+#include "cachewarmer.h"
+
+#include <http/httpserverconfig.h>
+#include <util/datetime.h>
+#include <util/hashstringmap.h>
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHE_WARMER_MAX_URL_LEN    2048
+
+
+//A ranked URL, ties keep the order the URLs are first seen.
+struct WarmUrl
+{
+    AutoStr2    url;
+    int         count;
+    int         order;
+};
+
+typedef HashStringMap<WarmUrl *> WarmUrlMap;
+
+
+static int compareUrl(const void *p1, const void *p2)
+{
+    const WarmUrl *pUrl1 = *(const WarmUrl **)p1;
+    const WarmUrl *pUrl2 = *(const WarmUrl **)p2;
+    if (pUrl1->count != pUrl2->count)
+        return pUrl2->count - pUrl1->count;
+    return pUrl1->order - pUrl2->order;
+}
+
+
+static void countUrl(WarmUrlMap &map, TPointerList<WarmUrl> &list,
+                     const char *p, int len)
+{
+    char achUrl[CACHE_WARMER_MAX_URL_LEN + 1];
+    const char *pHash;
+
+    //Keep the path and query string of an absolute URL
+    if ((len > 7 && strncasecmp(p, "http://", 7) == 0)
+        || (len > 8 && strncasecmp(p, "https://", 8) == 0))
+    {
+        const char *pPath = (const char *)memchr(p + 7, '/', len - 7);
+        if (pPath)
+        {
+            len -= pPath - p;
+            p = pPath;
+        }
+        else
+        {
+            p = "/";
+            len = 1;
+        }
+    }
+    if ((pHash = (const char *)memchr(p, '#', len)) != NULL)
+        len = pHash - p;
+    if (len <= 0 || *p != '/' || len > CACHE_WARMER_MAX_URL_LEN)
+        return;
+    memmove(achUrl, p, len);
+    achUrl[len] = 0;
+
+    WarmUrlMap::iterator iter = map.find(achUrl);
+    if (iter != map.end())
+    {
+        ++iter.second()->count;
+        return;
+    }
+    WarmUrl *pUrl = new WarmUrl;
+    pUrl->url.setStr(achUrl, len);
+    pUrl->count = 1;
+    pUrl->order = list.size();
+    list.push_back(pUrl);
+    map.insert(pUrl->url.c_str(), pUrl);
+}
+
+
+//Every "<loc>" of a sitemap counts once, "&amp;" is the only entity used.
+static void parseSitemap(WarmUrlMap &map, TPointerList<WarmUrl> &list,
+                         const char *p, const char *pEnd)
+{
+    char achUrl[CACHE_WARMER_MAX_URL_LEN];
+    const char *pLoc;
+    while ((pLoc = (const char *)memmem(p, pEnd - p, "<loc>", 5)) != NULL)
+    {
+        pLoc += 5;
+        const char *pLocEnd = (const char *)memmem(pLoc, pEnd - pLoc,
+                                                   "</loc>", 6);
+        if (!pLocEnd)
+            break;
+        p = pLocEnd + 6;
+        while (pLoc < pLocEnd && isspace(*pLoc))
+            ++pLoc;
+        while (pLocEnd > pLoc && isspace(pLocEnd[-1]))
+            --pLocEnd;
+
+        int len = 0;
+        while (pLoc < pLocEnd && len < CACHE_WARMER_MAX_URL_LEN)
+        {
+            achUrl[len++] = *pLoc;
+            if (*pLoc == '&' && pLocEnd - pLoc >= 5
+                && strncmp(pLoc, "&amp;", 5) == 0)
+                pLoc += 5;
+            else
+                ++pLoc;
+        }
+        if (pLoc == pLocEnd)
+            countUrl(map, list, achUrl, len);
+    }
+}
+
+
+/**
+ * An access log line counts the URL of a successful GET request, any other
+ * line is a URL list entry, the first token is the URL.
+ */
+static void parseLine(WarmUrlMap &map, TPointerList<WarmUrl> &list,
+                      const char *p, const char *pEnd)
+{
+    const char *pReq = (const char *)memmem(p, pEnd - p, "\"GET ", 5);
+    if (pReq)
+    {
+        const char *pUrl = pReq + 5;
+        const char *pUrlEnd = pUrl;
+        while (pUrlEnd < pEnd && *pUrlEnd != ' ' && *pUrlEnd != '"')
+            ++pUrlEnd;
+        const char *pQuote = (const char *)memchr(pUrlEnd, '"',
+                                                  pEnd - pUrlEnd);
+        if (!pQuote)
+            return;
+        int status = strtol(pQuote + 1, NULL, 10);
+        if ((status >= 200 && status < 300) || status == 304)
+            countUrl(map, list, pUrl, pUrlEnd - pUrl);
+        return;
+    }
+
+    while (p < pEnd && isspace(*p))
+        ++p;
+    if (p >= pEnd || *p == '#')
+        return;
+    const char *pTokenEnd = p;
+    while (pTokenEnd < pEnd && !isspace(*pTokenEnd))
+        ++pTokenEnd;
+    countUrl(map, list, p, pTokenEnd - p);
+}
+
+
+CacheWarmer::CacheWarmer()
+    : m_iConcurrency(CACHE_WARMER_DEF_CONCURRENCY)
+    , m_tmPurge(0)
+    , m_tmPass(0)
+    , m_iNext(0)
+    , m_iTotal(0)
+    , m_iProc(0)
+    , m_iProcs(1)
+    , m_iTimerId(-1)
+    , m_pSeed(NULL)
+    , m_pStore(NULL)
+{
+    memset(m_slots, 0, sizeof(m_slots));
+}
+
+
+CacheWarmer::~CacheWarmer()
+{
+    if (m_iTimerId != -1)
+        g_api->remove_timer(m_iTimerId);
+    if (m_pSeed)
+        g_api->release_bg_session(m_pSeed);
+    m_urls.release_objects();
+    m_varies.release_objects();
+}
+
+
+void CacheWarmer::setSeed(const lsi_session_t *pSeed,
+                          DirHashCacheStore *pStore, int iTimerId)
+{
+    m_pSeed = pSeed;
+    m_pStore = pStore;
+    m_iTimerId = iTimerId;
+}
+
+
+int CacheWarmer::load(const char *pPath, int iTopN)
+{
+    struct stat st;
+    int fd = open(pPath, O_RDONLY);
+    if (fd == -1)
+        return LS_FAIL;
+    if (fstat(fd, &st) == -1 || st.st_size <= 0)
+    {
+        close(fd);
+        return LS_FAIL;
+    }
+    const char *pBegin = (const char *)mmap(NULL, st.st_size, PROT_READ,
+                                            MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (pBegin == MAP_FAILED)
+        return LS_FAIL;
+    const char *pEnd = pBegin + st.st_size;
+
+    WarmUrlMap map;
+    TPointerList<WarmUrl> list;
+    int head = (st.st_size < 4096) ? st.st_size : 4096;
+    if (memmem(pBegin, head, "<urlset", 7) || memmem(pBegin, head, "<loc>", 5))
+        parseSitemap(map, list, pBegin, pEnd);
+    else
+    {
+        const char *p = pBegin;
+        while (p < pEnd)
+        {
+            const char *pLineEnd = (const char *)memchr(p, '\n', pEnd - p);
+            if (!pLineEnd)
+                pLineEnd = pEnd;
+            parseLine(map, list, p, pLineEnd);
+            p = pLineEnd + 1;
+        }
+    }
+    munmap((void *)pBegin, st.st_size);
+
+    list.sort(compareUrl);
+    m_urls.release_objects();
+    TPointerList<WarmUrl>::iterator iter;
+    for (iter = list.begin(); iter != list.end(); ++iter)
+    {
+        if ((int)m_urls.size() >= iTopN)
+            break;
+        m_urls.push_back(new AutoStr2((*iter)->url));
+    }
+    map.clear();
+    list.release_objects();
+
+    if (m_varies.size() == 0)
+        addVary("", 0);
+    return m_urls.size();
+}
+
+
+void CacheWarmer::addVary(const char *pSpec, int len)
+{
+    const char *pEnd = pSpec + len;
+    const char *pSep = (const char *)memchr(pSpec, '|', len);
+    const char *pCookieEnd = pSep ? pSep : pEnd;
+    CacheWarmVary *pVary = new CacheWarmVary;
+
+    while (pSpec < pCookieEnd && isspace(*pSpec))
+        ++pSpec;
+    while (pCookieEnd > pSpec && isspace(pCookieEnd[-1]))
+        --pCookieEnd;
+    if (pCookieEnd > pSpec)
+        pVary->m_cookie.setStr(pSpec, pCookieEnd - pSpec);
+    if (pSep)
+    {
+        const char *pUa = pSep + 1;
+        while (pUa < pEnd && isspace(*pUa))
+            ++pUa;
+        while (pEnd > pUa && isspace(pEnd[-1]))
+            --pEnd;
+        if (pEnd > pUa)
+            pVary->m_userAgent.setStr(pUa, pEnd - pUa);
+    }
+    m_varies.push_back(pVary);
+}
+
+
+//The URLs of this process, every m_iProcs-th starting from m_iProc.
+int CacheWarmer::getSlice() const
+{
+    int count = m_urls.size();
+    if (count <= m_iProc)
+        return 0;
+    return (count - m_iProc + m_iProcs - 1) / m_iProcs;
+}
+
+
+int CacheWarmer::restart(int32_t tmPurge)
+{
+    if (m_urls.size() == 0 || tmPurge == m_tmPurge
+        || tmPurge > DateTime::s_curTime)
+        return 0;
+    HttpServerConfig &config = HttpServerConfig::getInstance();
+    m_iProcs = config.getChildren();
+    if (m_iProcs < 1)
+        m_iProcs = 1;
+    m_iProc = config.getProcNo() - 1;
+    if (m_iProc < 0)
+        m_iProc = 0;
+    m_iProc %= m_iProcs;
+
+    m_tmPurge = tmPurge;
+    m_tmPass = DateTime::s_curTime;
+    m_iNext = 0;
+    m_iTotal = getSlice() * m_varies.size();
+    return 1;
+}
+
+
+void CacheWarmer::expireSlots()
+{
+    for (int i = 0; i < CACHE_WARMER_MAX_CONCURRENCY; ++i)
+    {
+        if (m_slots[i].tmStart && DateTime::s_curTime - m_slots[i].tmStart
+                                  >= CACHE_WARMER_SLOT_TIMEOUT)
+            m_slots[i].tmStart = 0;
+    }
+}
+
+
+int CacheWarmer::next(const AutoStr2 **pUrl, const CacheWarmVary **pVary)
+{
+    int slot;
+    if (m_iNext >= m_iTotal)
+        return -1;
+    expireSlots();
+    for (slot = 0; slot < m_iConcurrency; ++slot)
+    {
+        if (m_slots[slot].tmStart == 0)
+            break;
+    }
+    if (slot >= m_iConcurrency)
+        return -1;
+
+    //Warm every URL once before moving on to the next vary combination
+    int slice = getSlice();
+    int i = m_iNext++;
+    m_slots[slot].tmStart = DateTime::s_curTime;
+    m_slots[slot].iUrl = (i % slice) * m_iProcs + m_iProc;
+    m_slots[slot].claimed = 0;
+    *pUrl = m_urls[m_slots[slot].iUrl];
+    *pVary = m_varies[i / slice];
+    return slot;
+}
+
+
+int CacheWarmer::claim(const char *pUri, int uriLen, const char *pQs,
+                       int qsLen)
+{
+    int len = uriLen + ((qsLen > 0) ? qsLen + 1 : 0);
+    for (int i = 0; i < CACHE_WARMER_MAX_CONCURRENCY; ++i)
+    {
+        if (!m_slots[i].tmStart || m_slots[i].claimed)
+            continue;
+        const AutoStr2 *pUrl = m_urls[m_slots[i].iUrl];
+        const char *p = pUrl->c_str();
+        if (pUrl->len() != len || memcmp(p, pUri, uriLen) != 0)
+            continue;
+        if (qsLen > 0 && (p[uriLen] != '?'
+                          || memcmp(p + uriLen + 1, pQs, qsLen) != 0))
+            continue;
+        m_slots[i].claimed = 1;
+        return i;
+    }
+    return -1;
+}
+
+
+int CacheWarmer::release(int slot)
+{
+    if (slot < 0 || slot >= CACHE_WARMER_MAX_CONCURRENCY
+        || m_slots[slot].tmStart == 0)
+        return 0;
+    m_slots[slot].tmStart = 0;
+    if (m_iNext < m_iTotal)
+        return 0;
+    for (int i = 0; i < CACHE_WARMER_MAX_CONCURRENCY; ++i)
+    {
+        if (m_slots[i].tmStart)
+            return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,130 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2018  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+#ifndef CACHEWARMER_H
+#define CACHEWARMER_H
+
+#include <lsdef.h>
+#include <ls.h>
+#include <util/autostr.h>
+#include <util/gpointerlist.h>
+#include <inttypes.h>
+
+#define CACHE_WARMER_DEF_TOPN           500
+#define CACHE_WARMER_MAX_TOPN           100000
+#define CACHE_WARMER_DEF_CONCURRENCY    2
+#define CACHE_WARMER_MAX_CONCURRENCY    64
+#define CACHE_WARMER_SLOT_TIMEOUT       60
+#define CACHE_WARMER_TIMER_MS           1000
+
+class DirHashCacheStore;
+
+/**
+ * A request header combination the URLs are warmed with, an empty cookie
+ * sends no cookie, an empty user agent keeps the one of the seed.
+ */
+struct CacheWarmVary
+{
+    AutoStr2    m_cookie;
+    AutoStr2    m_userAgent;
+};
+
+
+typedef struct cachewarmslot_s
+{
+    int32_t     tmStart;
+    int32_t     iUrl;
+    int32_t     claimed;
+} cachewarmslot_t;
+
+
+/**
+ * CacheWarmer replays the most requested URLs of a virtual host after the
+ * server starts or the cache is purged, so the cache is refilled before
+ * users hit the backend. The URLs are ranked from an access log, a sitemap
+ * or a plain URL list, each is requested once per vary combination as a
+ * detached subrequest. Every server process warms its own share of the
+ * list, with at most the configured number of subrequests in flight.
+ *
+ * The subrequests are started from a seed, a detached copy of the first
+ * request of the virtual host in the process, by a timer and as the
+ * previous ones finish, a pass does not wait for user requests.
+ */
+class CacheWarmer
+{
+public:
+    CacheWarmer();
+    ~CacheWarmer();
+
+    // Load the iTopN most requested URLs, return the number of URLs kept.
+    int load(const char *pPath, int iTopN);
+
+    // Add a vary combination, "<cookie>[|<user agent>]".
+    void addVary(const char *pSpec, int len);
+
+    void setConcurrency(int n)      {   m_iConcurrency = n;         }
+    int  getConcurrency() const     {   return m_iConcurrency;      }
+    int  getUrlCount() const        {   return m_urls.size();       }
+
+    /**
+     * Start a new pass over the URLs of this process if the cache has been
+     * fully purged since the last one, tmPurge is the time of that purge.
+     */
+    int restart(int32_t tmPurge);
+
+    /**
+     * Reserve a slot for the next URL and vary combination to request,
+     * return -1 when the pass is done or enough subrequests are in flight.
+     */
+    int next(const AutoStr2 **pUrl, const CacheWarmVary **pVary);
+
+    // Claim the slot of the warm-up subrequest for the URL, -1 if none.
+    int claim(const char *pUri, int uriLen, const char *pQs, int qsLen);
+
+    // Free a slot, return 1 if it completes the pass.
+    int release(int slot);
+
+    int32_t getPassStart() const    {   return m_tmPass;            }
+
+    // Take over the seed and the timer, both are freed with the warmer.
+    void setSeed(const lsi_session_t *pSeed, DirHashCacheStore *pStore,
+                 int iTimerId);
+    const lsi_session_t *getSeed() const    {   return m_pSeed;     }
+    DirHashCacheStore *getStore() const     {   return m_pStore;    }
+
+private:
+    TPointerList<AutoStr2>      m_urls;
+    TPointerList<CacheWarmVary> m_varies;
+    cachewarmslot_t             m_slots[CACHE_WARMER_MAX_CONCURRENCY];
+    int                         m_iConcurrency;
+    int32_t                     m_tmPurge;
+    int32_t                     m_tmPass;
+    int                         m_iNext;
+    int                         m_iTotal;
+    int                         m_iProc;
+    int                         m_iProcs;
+    int                         m_iTimerId;
+    const lsi_session_t        *m_pSeed;
+    DirHashCacheStore          *m_pStore;
+
+    int  getSlice() const;
+    void expireSlots();
+
+    LS_NO_COPY_ASSIGN(CacheWarmer);
+};
+
+#endif
@@ -19,6 +19,8 @@
 #include "dirhashcachestore.h"
 #include "dirhashcacheentry.h"
 #include "cachehash.h"
+#include "cachememtier.h"
+#include "cacheslabtier.h"
 
 #include <util/datetime.h>
 #include <util/stringtool.h>
@@ -37,6 +39,8 @@
 
 DirHashCacheStore::DirHashCacheStore()
     : CacheStore()
+    , m_pMemTier(NULL)
+    , m_pSlabTier(NULL)
 {
 }
 
@@ -44,6 +48,40 @@ DirHashCacheStore::DirHashCacheStore()
 DirHashCacheStore::~DirHashCacheStore()
 {
     release_objects();
+    if (m_pMemTier)
+        delete m_pMemTier;
+    if (m_pSlabTier)
+        delete m_pSlabTier;
+}
+
+
+int DirHashCacheStore::initMemTier(int64_t iMaxSize, int iMaxObjSize)
+{
+    if (m_pMemTier)
+        return 0;
+    m_pMemTier = new CacheMemTier(this);
+    if (m_pMemTier->init(getRoot().c_str(), iMaxSize, iMaxObjSize) != LS_OK)
+    {
+        delete m_pMemTier;
+        m_pMemTier = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+
+int DirHashCacheStore::initSlabTier(int64_t iMaxSize, int iMaxObjSize)
+{
+    if (m_pSlabTier)
+        return 0;
+    m_pSlabTier = new CacheSlabTier(this);
+    if (m_pSlabTier->init(getRoot().c_str(), iMaxSize, iMaxObjSize) != LS_OK)
+    {
+        delete m_pSlabTier;
+        m_pSlabTier = NULL;
+        return -1;
+    }
+    return 0;
 }
 
 
@@ -57,6 +95,12 @@ int DirHashCacheStore::clearStrage()
 int DirHashCacheStore::updateEntryState(DirHashCacheEntry *pEntry)
 {
     struct stat st;
+    if (pEntry->isInMem() || pEntry->isInSlab())
+    {
+        pEntry->m_lastCheck = DateTime::s_curTime;
+        pEntry->setLastAccess(DateTime::s_curTime);
+        return 0;
+    }
     if (fstat(pEntry->getFdStore(), &st) == -1)
         return -1;
     pEntry->m_lastCheck = DateTime::s_curTime;
@@ -168,9 +212,25 @@ CacheEntry *DirHashCacheStore::getCacheEntry(CacheHash &hash,
         if ((DateTime::s_curTime != lastCheck)
             || (lastCheck == -1))   //This entry is being written to disk
         {
-            pathLen = buildCacheLocation(achBuf, 4096, hash.getKey(),
-                                         pEntry->isPrivate());
-            if (isChanged((DirHashCacheEntry *)pEntry, achBuf, pathLen, sizeof(achBuf)))
+            int changed;
+            if (pEntry->isInMem())
+            {
+                ((DirHashCacheEntry *)pEntry)->m_lastCheck = DateTime::s_curTime;
+                changed = (!m_pMemTier || m_pMemTier->isChanged(pEntry));
+            }
+            else if (pEntry->isInSlab())
+            {
+                ((DirHashCacheEntry *)pEntry)->m_lastCheck = DateTime::s_curTime;
+                changed = (!m_pSlabTier || m_pSlabTier->isChanged(pEntry));
+            }
+            else
+            {
+                pathLen = buildCacheLocation(achBuf, 4096, hash.getKey(),
+                                             pEntry->isPrivate());
+                changed = isChanged((DirHashCacheEntry *)pEntry, achBuf,
+                                    pathLen, sizeof(achBuf));
+            }
+            if (changed)
             {
                 g_api->log(NULL, LSI_LOG_DEBUG, "[CACHE] [%p] path [%s] has been modified "
                            "on disk, mark dirty", pEntry, achBuf);
@@ -192,8 +252,13 @@ CacheEntry *DirHashCacheStore::getCacheEntry(CacheHash &hash,
                                        pKey->m_pIP != NULL))
             return NULL;
     }
+    if (!pEntry && m_pMemTier)
+        pEntry = loadMemEntry(hash, pKey->m_pIP != NULL, maxStale);
+    if (!pEntry && m_pSlabTier)
+        pEntry = loadSlabEntry(hash, pKey->m_pIP != NULL, maxStale);
 
-    if ((pEntry == NULL) || (pEntry->getFdStore() == -1))
+    if ((pEntry == NULL)
+        || (!pEntry->isInMem() && (pEntry->getFdStore() == -1)))
     {
         if (!pathLen)
             pathLen = buildCacheLocation(achBuf, 4096, hash.getKey(),
@@ -575,6 +640,20 @@ int DirHashCacheStore::saveEntry(CacheEntry *pEntry)
 void DirHashCacheStore::removePermEntry(CacheEntry *pEntry)
 {
     char achBuf[4096];
+    if (pEntry->isInMem())
+    {
+        if (m_pMemTier)
+            m_pMemTier->remove(pEntry->getHashKey().getKey(),
+                               pEntry->isPrivate());
+        return;
+    }
+    if (pEntry->isInSlab())
+    {
+        if (m_pSlabTier)
+            m_pSlabTier->remove(pEntry->getHashKey().getKey(),
+                                pEntry->isPrivate());
+        return;
+    }
     buildCacheLocation(achBuf, 4096, pEntry->getHashKey().getKey(),
                        pEntry->isPrivate());
     unlink(achBuf);
@@ -645,6 +724,20 @@ int DirHashCacheStore::renameDiskEntry(CacheEntry *pEntry, char *pFrom,
     char achFrom[4096];
     char achTo[4096];
     int fd = pEntry->getFdStore();
+    if (pEntry->isInMem())
+    {
+        if (!m_pMemTier || (pToSuffix == NULL) || strcmp(pToSuffix, ".S") != 0)
+            return -1;
+        return (m_pMemTier->setStale(pEntry->getHashKey().getKey(),
+                                     pEntry->isPrivate()) == LS_OK) ? 0 : -2;
+    }
+    if (pEntry->isInSlab())
+    {
+        if (!m_pSlabTier || (pToSuffix == NULL) || strcmp(pToSuffix, ".S") != 0)
+            return -1;
+        return (m_pSlabTier->setStale(pEntry->getHashKey().getKey(),
+                                      pEntry->isPrivate()) == LS_OK) ? 0 : -2;
+    }
     if (!pFrom)
     {
         pFrom = achFrom;
@@ -741,10 +834,34 @@ int DirHashCacheStore::publish(CacheEntry *pEntry)
     pEntry->setBuilding(0);
     if (updateEntryExpire(pEntry) != 0)
         return -1;
+    if (m_pMemTier && publishToMem(pEntry, achTmp, sizeof(achTmp)) == 0)
+    {
+        if (pEntry->isDirty())
+        {
+            g_api->log(NULL, LSI_LOG_DEBUG,
+                       "[CACHE] [%s] is marked dirty, do not add to hash.", achTmp);
+            return 0;
+        }
+        return updateHashEntry(pEntry);
+    }
+    if (m_pSlabTier && publishToSlab(pEntry, achTmp, sizeof(achTmp)) == 0)
+    {
+        if (pEntry->isDirty())
+        {
+            g_api->log(NULL, LSI_LOG_DEBUG,
+                       "[CACHE] [%s] is marked dirty, do not add to hash.", achTmp);
+            return 0;
+        }
+        return updateHashEntry(pEntry);
+    }
     int ret = renameDiskEntry(pEntry, achTmp, sizeof(achTmp), ".tmp", NULL,
                               DHCS_SOURCE_MATCH | DHCS_DEST_CHECK);
     if (ret)
         return ret;
+    if (m_pMemTier)
+        m_pMemTier->remove(pEntry->getHashKey().getKey(), pEntry->isPrivate());
+    if (m_pSlabTier)
+        m_pSlabTier->remove(pEntry->getHashKey().getKey(), pEntry->isPrivate());
 
     int len = strlen(achTmp);
     achTmp[len - 3] = 'S';
@@ -769,6 +886,10 @@ void DirHashCacheStore::removeEntryByHash(const unsigned char *pKey, int isPriva
     pathEnd = &achBuf[0] + buildCacheLocation(achBuf, 4096, pKey, isPrivate);
 
     g_api->log(NULL, LSI_LOG_DEBUG, "[CACHE] remove cache object [%s].\n", achBuf);
+    if (m_pMemTier)
+        m_pMemTier->remove(pKey, isPrivate);
+    if (m_pSlabTier)
+        m_pSlabTier->remove(pKey, isPrivate);
     unlink(achBuf);
 
     pathEnd -= 2 * HASH_KEY_LEN + 1;
@@ -785,14 +906,220 @@ void DirHashCacheStore::removeEntryByHash(const unsigned char *pKey, int isPriva
 }
 
 
+void DirHashCacheStore::staleEntryByHash(const unsigned char *pKey,
+                                         int isPrivate)
+{
+    char achBuf[4096];
+    char achTo[4096];
+    int n;
+
+    if (m_pMemTier && m_pMemTier->setStale(pKey, isPrivate) == LS_OK)
+        return;
+    if (m_pSlabTier && m_pSlabTier->setStale(pKey, isPrivate) == LS_OK)
+        return;
+    n = buildCacheLocation(achBuf, 4090, pKey, isPrivate);
+    memmove(achTo, achBuf, n);
+    lstrncpy(&achTo[n], ".S", sizeof(achTo) - n);
+    if (rename(achBuf, achTo) == 0)
+        g_api->log(NULL, LSI_LOG_DEBUG, "[CACHE] mark stale [%s].\n", achBuf);
+}
+
+
 void DirHashCacheStore::removeDeadEntry(CacheEntry *pEntry,
                                         const CacheHash &hash,
                                         char *achBuf)
 {
     getManager()->removeTracking((const char *)hash.getKey(),
                                     HASH_KEY_LEN, pEntry->isPrivate());
+    if (pEntry->isInMem())
+    {
+        if (m_pMemTier)
+            m_pMemTier->remove(hash.getKey(), pEntry->isPrivate());
+        delete pEntry;
+        return;
+    }
+    if (pEntry->isInSlab())
+    {
+        if (m_pSlabTier)
+            m_pSlabTier->remove(hash.getKey(), pEntry->isPrivate());
+        delete pEntry;
+        return;
+    }
     if (!achBuf[0])
         buildCacheLocation(achBuf, 4096, hash.getKey(), pEntry->isPrivate());
     delete pEntry;
     unlink(achBuf);
 }
+
+
+/**
+ * Move a finished entry from its .tmp file to the memory tier, the .tmp
+ * file is only used as the staging buffer while the entry is built.
+ * Entries of static files are left on disk, they are checked against the
+ * file with the stored path.
+ */
+int DirHashCacheStore::publishToMem(CacheEntry *pEntry, char *pBuf,
+                                    size_t maxBuf)
+{
+    struct stat stFd;
+    struct stat stTmp;
+    int fd = pEntry->getFdStore();
+    int n;
+
+    if (pEntry->getHeader().m_lenStxFilePath > 0)
+        return -1;
+    if ((fstat(fd, &stFd) == -1)
+        || (stFd.st_size - pEntry->getStartOffset()
+            > m_pMemTier->getMaxObjSize()))
+        return -1;
+    n = buildCacheLocation(pBuf, maxBuf - 8, pEntry->getHashKey().getKey(),
+                           pEntry->isPrivate());
+    lstrncpy(&pBuf[n], ".tmp", maxBuf - n);
+    if ((nio_stat(pBuf, &stTmp) == -1) || (stTmp.st_ino != stFd.st_ino))
+        return -1;
+    if (m_pMemTier->store(pEntry, fd,
+                          stFd.st_size - pEntry->getStartOffset()) != LS_OK)
+        return -1;
+
+    unlink(pBuf);
+    lstrncpy(&pBuf[n], ".S", maxBuf - n);
+    unlink(pBuf);
+    pBuf[n] = 0;
+    unlink(pBuf);
+    close(fd);
+    pEntry->setFdStore(-1);
+    pEntry->setInMem(1);
+    if (m_pSlabTier)
+        m_pSlabTier->remove(pEntry->getHashKey().getKey(), pEntry->isPrivate());
+    return 0;
+}
+
+
+CacheEntry *DirHashCacheStore::loadMemEntry(const CacheHash &hash,
+                                            int isPrivate, int maxStale)
+{
+    CacheEntry *pEntry = new DirHashCacheEntry();
+    pEntry->setHashKey(hash);
+    if (m_pMemTier->load(hash.getKey(), isPrivate, pEntry) != LS_OK)
+    {
+        delete pEntry;
+        return NULL;
+    }
+    pEntry->setInMem(1);
+    updateEntryState((DirHashCacheEntry *)pEntry);
+    pEntry->setMaxStale(maxStale);
+    debug_dump(pEntry, "load entry from memory tier");
+    return pEntry;
+}
+
+
+/**
+ * Move a finished entry from its .tmp file to the slab tier, it is served
+ * from the segment file afterwards. If the segment can not be opened the
+ * unlinked .tmp file keeps serving this entry.
+ */
+int DirHashCacheStore::publishToSlab(CacheEntry *pEntry, char *pBuf,
+                                     size_t maxBuf)
+{
+    struct stat stFd;
+    struct stat stTmp;
+    int fd = pEntry->getFdStore();
+    int n;
+
+    if (pEntry->getHeader().m_lenStxFilePath > 0)
+        return -1;
+    if ((fstat(fd, &stFd) == -1)
+        || (stFd.st_size - pEntry->getStartOffset()
+            > m_pSlabTier->getMaxObjSize()))
+        return -1;
+    n = buildCacheLocation(pBuf, maxBuf - 8, pEntry->getHashKey().getKey(),
+                           pEntry->isPrivate());
+    lstrncpy(&pBuf[n], ".tmp", maxBuf - n);
+    if ((nio_stat(pBuf, &stTmp) == -1) || (stTmp.st_ino != stFd.st_ino))
+        return -1;
+    if (m_pSlabTier->store(pEntry, fd,
+                           stFd.st_size - pEntry->getStartOffset()) != LS_OK)
+        return -1;
+    if (m_pMemTier)
+        m_pMemTier->remove(pEntry->getHashKey().getKey(), pEntry->isPrivate());
+
+    unlink(pBuf);
+    lstrncpy(&pBuf[n], ".S", maxBuf - n);
+    unlink(pBuf);
+    pBuf[n] = 0;
+    unlink(pBuf);
+    if (m_pSlabTier->attach(pEntry) == LS_OK)
+        pEntry->setInSlab(1);
+    return 0;
+}
+
+
+CacheEntry *DirHashCacheStore::loadSlabEntry(const CacheHash &hash,
+                                             int isPrivate, int maxStale)
+{
+    CacheEntry *pEntry = new DirHashCacheEntry();
+    pEntry->setHashKey(hash);
+    if (m_pSlabTier->load(hash.getKey(), isPrivate, pEntry) != LS_OK)
+    {
+        delete pEntry;
+        return NULL;
+    }
+    pEntry->setInSlab(1);
+    updateEntryState((DirHashCacheEntry *)pEntry);
+    pEntry->setMaxStale(maxStale);
+    debug_dump(pEntry, "load entry from slab tier");
+    return pEntry;
+}
+
+
+/**
+ * Write back an object evicted from the memory tier to the slab tier, or
+ * its disk location. The victim was copied out of the memory tier, which is
+ * unlocked by now; the slab tier takes its own lock in storeImage().
+ */
+int DirHashCacheStore::demoteEntry(const unsigned char *pHashKey,
+                                   int isPrivate, int isStale,
+                                   const char *pImage, int len)
+{
+    char achBuf[4096];
+    char achTo[4096];
+    char *pPathEnd;
+    struct stat st;
+    int n;
+
+    if (m_pSlabTier && (len <= m_pSlabTier->getMaxObjSize())
+        && (m_pSlabTier->storeImage(pHashKey, isPrivate, pImage, len) == LS_OK))
+        return 0;
+    n = buildCacheLocation(achBuf, 4090, pHashKey, isPrivate);
+    TempUmask tumsk(0007);
+
+    pPathEnd = &achBuf[n - 2 * HASH_KEY_LEN - 1];
+    *pPathEnd = 0;
+    if ((nio_stat(achBuf, &st) == -1) && (errno == ENOENT))
+    {
+        if (createMissingPath(achBuf, pPathEnd, isPrivate) == -1)
+            return -1;
+    }
+    *pPathEnd = '/';
+
+    memmove(achTo, achBuf, n + 1);
+    if (isStale)
+        lstrncpy(&achTo[n], ".S", sizeof(achTo) - n);
+    lstrncpy(&achBuf[n], ".dm", sizeof(achBuf) - n);
+    int fd = ::open(achBuf, O_RDWR | O_CREAT | O_TRUNC, 0660);
+    if (fd == -1)
+        return -1;
+    if (nio_write(fd, pImage, len) != len)
+    {
+        close(fd);
+        unlink(achBuf);
+        return -1;
+    }
+    close(fd);
+    if (rename(achBuf, achTo) == -1)
+    {
+        unlink(achBuf);
+        return -1;
+    }
+    return 0;
+}
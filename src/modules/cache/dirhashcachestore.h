@@ -23,6 +23,8 @@
 
 
 class CacheHash;
+class CacheMemTier;
+class CacheSlabTier;
 class DirHashCacheEntry;
 
 class DirHashCacheStore : public CacheStore
@@ -50,7 +52,18 @@ class DirHashCacheStore : public CacheStore
     
     int updateEntryExpire(CacheEntry *pEntry);
     int updateHashEntry(CacheEntry* pEntry);
-    
+
+    int publishToMem(CacheEntry *pEntry, char *pBuf, size_t maxBuf);
+    CacheEntry *loadMemEntry(const CacheHash &hash, int isPrivate,
+                             int maxStale);
+
+    int publishToSlab(CacheEntry *pEntry, char *pBuf, size_t maxBuf);
+    CacheEntry *loadSlabEntry(const CacheHash &hash, int isPrivate,
+                              int maxStale);
+
+    CacheMemTier   *m_pMemTier;
+    CacheSlabTier  *m_pSlabTier;
+
 protected:
     int renameDiskEntry(CacheEntry *pEntry, char *pFrom, size_t maxFrom,
                         const char *pFromSuffix, const char *pToSuffix,
@@ -84,9 +97,17 @@ public:
     virtual void removePermEntry(CacheEntry *pEntry);
     
     virtual void removeEntryByHash(const unsigned char * pKey, int keyLen);
+    virtual void staleEntryByHash(const unsigned char *pKey, int isPrivate);
 
     void getEntryFilePath(CacheEntry *pEntry, char *pPath, int &len);
 
+    int initMemTier(int64_t iMaxSize, int iMaxObjSize);
+    CacheMemTier *getMemTier() const    {   return m_pMemTier;  }
+    int initSlabTier(int64_t iMaxSize, int iMaxObjSize);
+    CacheSlabTier *getSlabTier() const  {   return m_pSlabTier; }
+    int demoteEntry(const unsigned char *pHashKey, int isPrivate, int isStale,
+                    const char *pImage, int len);
+
 //    int &ls_fio_stat(char achBuf[4096], struct stat *st);
 
 
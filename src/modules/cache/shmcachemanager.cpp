@@ -20,10 +20,57 @@
 #include "cacheentry.h"
 #include <log4cxx/logger.h>
 #include <shm/lsshmhash.h>
+#include <util/autobuf.h>
 #include <util/datetime.h>
+#include <util/ni_fio.h>
 #include <util/pcutil.h>
 
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define TAGIDX_CHUNK        256
+#define TAGIDX_MAX_CHUNKS   4096
+#define TAGIDX_MAX_TAG_LEN  512
+
+/**
+ * Tag index, the head record is keyed by the tag, the entry hashes are
+ * appended to chunks keyed by the tag, a '\0' and the chunk number.
+ * A purge seals the chunks present at that time, they are consumed from
+ * x_iFirst to x_iPurgeEnd by the background pass, new entries go to
+ * chunks after them. Housekeeping drops the hashes no longer tracked and
+ * the chunks left empty.
+ */
+typedef struct shm_tagidx_s
+{
+    int32_t     x_iFirst;
+    int32_t     x_iEnd;
+    int32_t     x_iPurgeEnd;
+    int32_t     x_tmPurge;
+    uint8_t     x_flag;
+    uint8_t     x_isSealed;
+    uint8_t     x_reserve[2];
+} shm_tagidx_t;
+
+typedef struct shm_tagchunk_s
+{
+    int32_t         x_iCount;
+    unsigned char   x_keys[TAGIDX_CHUNK][HASH_KEY_LEN];
+} shm_tagchunk_t;
+
+
+static int buildChunkKey(char *pBuf, const char *pTag, int len, int32_t idx)
+{
+    memmove(pBuf, pTag, len);
+    pBuf[len] = 0;
+    memmove(&pBuf[len + 1], &idx, sizeof(idx));
+    return len + 1 + sizeof(idx);
+}
+
 
 typedef struct shm_purgedata_s
 {
@@ -317,6 +364,11 @@ ShmCacheManager::~ShmCacheManager()
         m_pPubTracker->close();
     if (m_pPrivTracker != NULL)
         m_pPrivTracker->close();
+    if (m_pFillLocks != NULL)
+        m_pFillLocks->close();
+    if (m_pTagIndex != NULL)
+        m_pTagIndex->close();
+    m_tagPurgeQueue.release_objects();
 //     if (m_pPurgeShmBridge)
 //         delete m_pPurgeShmBridge;
     m_id2StrList.release_objects();
@@ -704,6 +756,9 @@ int ShmCacheManager::processPurgeCmdEx(
         {
             addUpdate(pValue, pValueEnd - pValue, flag, (int32_t)curTime,
                       (int16_t)curTimeMS);
+            if (!(flag & (PDF_PREFIX | PDF_POSTFIX)))
+                queueTagPurge(pValue, pValueEnd - pValue, flag,
+                              (int32_t)curTime);
             
 //             CacheInfo *pInfo = (CacheInfo *)m_pStr2IdHash->
 //                                 offset2ptr(m_CacheInfoOff);
@@ -907,6 +962,8 @@ int ShmCacheManager::initCacheInfo(LsShmPool *pPool)
         pCacheInfoReg = pPool->getShm()->addReg("CACHINFO");
         //should use CAS to make sure nobody take over it before us
         pCacheInfoReg->x_iValue = infoOff;
+        m_CacheInfoOff = infoOff + sizeof(int32_t);
+        return 1;
     }
     else
     {
@@ -961,6 +1018,19 @@ int ShmCacheManager::initTables(LsShmPool *pPool)
                                          LSSHM_FLAG_LRU);
     if (!m_pPrivTracker)
         return -1;
+
+    m_pFillLocks = pPool->getNamedHash("filllock", 100,
+                                       LsShmHash::hashXXH32, memcmp,
+                                       LSSHM_FLAG_LRU);
+    if (!m_pFillLocks)
+        return -1;
+    m_pFillLocks->disableAutoLock();
+
+    m_pTagIndex = pPool->getNamedHash("tagindex", 1000,
+                                      LsShmHash::hashXXH32, memcmp, 0);
+    if (!m_pTagIndex)
+        return -1;
+    m_pTagIndex->disableAutoLock();
     
     populatePrivateTag();
     return 0;
@@ -972,6 +1042,7 @@ int ShmCacheManager::init(const char *pStoreDir)
     LsShmPool *pPool;
     const char *pFileName = ".cacheman";
     int attempts;
+    int created = 0;
     int ret = -1;
     for (attempts = 0; attempts < 3; ++attempts)
     {
@@ -998,7 +1069,7 @@ int ShmCacheManager::init(const char *pStoreDir)
         pPool->disableAutoLock();
         pPool->lock();
 
-        if ((initCacheInfo(pPool) == LS_FAIL)
+        if (((created = initCacheInfo(pPool)) == LS_FAIL)
             || (ret = initTables(pPool)) == LS_FAIL)
         {
             pPool->unlock();
@@ -1013,6 +1084,13 @@ int ShmCacheManager::init(const char *pStoreDir)
     pPool->unlock();
     pPool->enableAutoLock();
 
+    m_sStoreDir.setStr(pStoreDir);
+    if (ret != LS_FAIL && created == 1)
+    {
+        loadSnapshot();
+        getCacheInfo()->setLastSnapshot(getCacheInfo()->getLastSnapshot(),
+                                        time(NULL));
+    }
     return ret;
 }
 
@@ -1163,6 +1241,8 @@ int ShmCacheManager::houseKeeping()
     if (getCacheInfo()->setLastHouseKeeping(last, DateTime::s_curTime) == 0)
         return 0;
     cleanupExpiredSessions();
+    cleanupFillLocks();
+    pruneTagIndex();
     return 1;
 }
 
@@ -1200,6 +1280,7 @@ int ShmCacheManager::addTracking2(CacheEntry * pEntry, LsShmHash *pTracker)
     shm_objtrack_t *pData;
     int valLen = sizeof(*pData);
     int flag = LSSHM_FLAG_NONE;
+    int needIndex = 0;
     
     pTracker->disableAutoLock();
     pTracker->lock();
@@ -1228,14 +1309,384 @@ int ShmCacheManager::addTracking2(CacheEntry * pEntry, LsShmHash *pTracker)
 //         }
         pData->x_tmCreated = pEntry->getHeader().m_tmCreated;  
         pData->x_tmExpire = pEntry->getExpireTime() + pEntry->getMaxStale();
+        if (pTracker == m_pPubTracker && !(pData->x_flag & CM_TRACK_TAGGED)
+            && pEntry->getHeader().m_tagLen > 0)
+        {
+            pData->x_flag |= CM_TRACK_TAGGED;
+            needIndex = 1;
+        }
         
     }
     pTracker->unlock();
     pTracker->enableAutoLock();
+    if (needIndex)
+        addTagIndex(pEntry);
     return offVal;    
 }
 
 
+void ShmCacheManager::addTagIndex(CacheEntry *pEntry)
+{
+    const char *p = pEntry->getTag().c_str();
+    const char *pEnd = p + pEntry->getHeader().m_tagLen;
+    const char *pComma, *pTagEnd;
+
+    if (!m_pTagIndex || !p)
+        return;
+    m_pTagIndex->lock();
+    while (p < pEnd)
+    {
+        pComma = (const char *)memchr(p, ',', pEnd - p);
+        if (pComma == NULL)
+            pComma = pEnd;
+        while (p < pComma && isspace(*p))
+            ++p;
+        if (strncasecmp(p, "public:", 7) == 0)
+        {
+            p += 7;
+            while (p < pComma && isspace(*p))
+                ++p;
+        }
+        pTagEnd = pComma;
+        while (pTagEnd > p && isspace(pTagEnd[-1]))
+            --pTagEnd;
+        if (pTagEnd > p && pTagEnd - p <= TAGIDX_MAX_TAG_LEN)
+            indexTag(p, pTagEnd - p, pEntry->getHashKey().getKey());
+        p = pComma + 1;
+    }
+    m_pTagIndex->unlock();
+}
+
+
+//Called with the tag index locked.
+int ShmCacheManager::indexTag(const char *pTag, int len,
+                              const unsigned char *pKey)
+{
+    char achKey[TAGIDX_MAX_TAG_LEN + 8];
+    shm_tagidx_t *pIdx;
+    shm_tagchunk_t *pChunk;
+    LsShmOffset_t offIdx, offChunk;
+    int valLen = sizeof(*pIdx);
+    int flag = LSSHM_FLAG_NONE;
+    int keyLen;
+
+    offIdx = m_pTagIndex->get(pTag, len, &valLen, &flag);
+    if (offIdx == 0)
+        return -1;
+    pIdx = (shm_tagidx_t *)m_pTagIndex->offset2ptr(offIdx);
+    if (flag & LSSHM_VAL_CREATED)
+        memset(pIdx, 0, sizeof(*pIdx));
+
+    offChunk = 0;
+    if (pIdx->x_iEnd > pIdx->x_iFirst && !pIdx->x_isSealed)
+    {
+        keyLen = buildChunkKey(achKey, pTag, len, pIdx->x_iEnd - 1);
+        offChunk = m_pTagIndex->find(achKey, keyLen, &valLen);
+        if (offChunk != 0 && ((shm_tagchunk_t *)m_pTagIndex->offset2ptr(
+                                  offChunk))->x_iCount >= TAGIDX_CHUNK)
+            offChunk = 0;
+    }
+    if (offChunk == 0)
+    {
+        if (pIdx->x_iEnd - pIdx->x_iFirst >= TAGIDX_MAX_CHUNKS)
+            return -1;
+        keyLen = buildChunkKey(achKey, pTag, len, pIdx->x_iEnd);
+        valLen = sizeof(*pChunk);
+        flag = LSSHM_FLAG_NONE;
+        offChunk = m_pTagIndex->get(achKey, keyLen, &valLen, &flag);
+        if (offChunk == 0)
+            return -1;
+        //May be remapped by the allocation
+        pIdx = (shm_tagidx_t *)m_pTagIndex->offset2ptr(offIdx);
+        ++pIdx->x_iEnd;
+        pIdx->x_isSealed = 0;
+        ((shm_tagchunk_t *)m_pTagIndex->offset2ptr(offChunk))->x_iCount = 0;
+    }
+    pChunk = (shm_tagchunk_t *)m_pTagIndex->offset2ptr(offChunk);
+    memmove(pChunk->x_keys[pChunk->x_iCount++], pKey, HASH_KEY_LEN);
+    return 0;
+}
+
+
+void ShmCacheManager::queueTagPurge(const char *pTag, int len, int flag,
+                                    int32_t sec)
+{
+    shm_tagidx_t *pIdx;
+    LsShmOffset_t offIdx;
+    int valLen;
+    int pending = 0;
+
+    if (!m_pTagIndex || len > TAGIDX_MAX_TAG_LEN)
+        return;
+    m_pTagIndex->lock();
+    offIdx = m_pTagIndex->find(pTag, len, &valLen);
+    if (offIdx != 0)
+    {
+        pIdx = (shm_tagidx_t *)m_pTagIndex->offset2ptr(offIdx);
+        if (pIdx->x_iEnd > pIdx->x_iFirst)
+        {
+            pending = 1;
+            pIdx->x_iPurgeEnd = pIdx->x_iEnd;
+            pIdx->x_isSealed = 1;
+            pIdx->x_tmPurge = sec;
+            pIdx->x_flag = flag;
+        }
+    }
+    m_pTagIndex->unlock();
+    if (!pending)
+        return;
+    for (int i = 0; i < m_tagPurgeQueue.size(); ++i)
+    {
+        if (m_tagPurgeQueue[i]->len() == len
+            && memcmp(m_tagPurgeQueue[i]->c_str(), pTag, len) == 0)
+            return;
+    }
+    m_tagPurgeQueue.push_back(new AutoStr2(pTag, len));
+}
+
+
+/**
+ * Take the oldest chunk sealed by the pending purge of a tag, return the
+ * number of hashes copied to pKeys, -1 when the purge is done.
+ */
+int ShmCacheManager::popTagChunk(const char *pTag, int len,
+                                 unsigned char *pKeys, int32_t *pSec,
+                                 int *pFlag)
+{
+    char achKey[TAGIDX_MAX_TAG_LEN + 8];
+    shm_tagidx_t *pIdx;
+    shm_tagchunk_t *pChunk;
+    LsShmOffset_t offIdx, offChunk;
+    int valLen, keyLen;
+    int count = -1;
+
+    m_pTagIndex->lock();
+    offIdx = m_pTagIndex->find(pTag, len, &valLen);
+    if (offIdx != 0)
+    {
+        pIdx = (shm_tagidx_t *)m_pTagIndex->offset2ptr(offIdx);
+        if (pIdx->x_iFirst < pIdx->x_iPurgeEnd)
+        {
+            *pSec = pIdx->x_tmPurge;
+            *pFlag = pIdx->x_flag;
+            keyLen = buildChunkKey(achKey, pTag, len, pIdx->x_iFirst++);
+            count = 0;
+            offChunk = m_pTagIndex->find(achKey, keyLen, &valLen);
+            if (offChunk != 0)
+            {
+                pChunk = (shm_tagchunk_t *)m_pTagIndex->offset2ptr(offChunk);
+                count = pChunk->x_iCount;
+                memmove(pKeys, pChunk->x_keys, count * HASH_KEY_LEN);
+                m_pTagIndex->remove(achKey, keyLen);
+            }
+        }
+        else
+        {
+            pIdx->x_flag = 0;
+            if (pIdx->x_iFirst >= pIdx->x_iEnd)
+                m_pTagIndex->remove(pTag, len);
+        }
+    }
+    m_pTagIndex->unlock();
+    return count;
+}
+
+
+int ShmCacheManager::processTagPurges(int maxCnt,
+        void (*purgeEntry)(void *, const unsigned char *, int), void *param)
+{
+    unsigned char achKeys[TAGIDX_CHUNK * HASH_KEY_LEN];
+    const unsigned char *pKey;
+    shm_objtrack_t *pData;
+    LsShmOffset_t offVal;
+    AutoStr2 *pTag;
+    int32_t sec;
+    int flag, count, valLen, purge;
+    int done = 0;
+
+    while (done < maxCnt && m_tagPurgeQueue.size() > 0)
+    {
+        pTag = m_tagPurgeQueue[0];
+        count = popTagChunk(pTag->c_str(), pTag->len(), achKeys, &sec, &flag);
+        if (count == -1)
+        {
+            m_tagPurgeQueue.erase(m_tagPurgeQueue.begin());
+            delete pTag;
+            continue;
+        }
+        for (int i = 0; i < count; ++i)
+        {
+            //Only the entries still tracked and created before the purge
+            pKey = &achKeys[i * HASH_KEY_LEN];
+            m_pPubTracker->disableAutoLock();
+            m_pPubTracker->lock();
+            offVal = m_pPubTracker->find(pKey, HASH_KEY_LEN, &valLen);
+            purge = 0;
+            if (offVal != 0)
+            {
+                pData = (shm_objtrack_t *)m_pPubTracker->offset2ptr(offVal);
+                purge = ((int32_t)pData->x_tmCreated <= sec);
+            }
+            m_pPubTracker->unlock();
+            m_pPubTracker->enableAutoLock();
+            if (purge)
+            {
+                (*purgeEntry)(param, pKey, flag);
+                ++done;
+            }
+        }
+    }
+    return m_tagPurgeQueue.size();
+}
+
+
+int ShmCacheManager::isPubTracked(const unsigned char *pKey)
+{
+    int valLen;
+    LsShmOffset_t offVal;
+    m_pPubTracker->disableAutoLock();
+    m_pPubTracker->lock();
+    offVal = m_pPubTracker->find(pKey, HASH_KEY_LEN, &valLen);
+    m_pPubTracker->unlock();
+    m_pPubTracker->enableAutoLock();
+    return offVal != 0;
+}
+
+
+/**
+ * Drop the hashes of entries no longer tracked from the chunks of a tag,
+ * remove the chunks left empty and the tag once it has none. The tracker is
+ * checked without the index locked, so only the hashes copied out are
+ * filtered, those appended meanwhile are kept. The chunks sealed by a
+ * pending purge are left to the purge.
+ */
+void ShmCacheManager::pruneTag(const char *pTag, int len)
+{
+    unsigned char achKeys[TAGIDX_CHUNK * HASH_KEY_LEN];
+    char achKey[TAGIDX_MAX_TAG_LEN + 8];
+    shm_tagidx_t *pIdx;
+    shm_tagchunk_t *pChunk;
+    LsShmOffset_t offIdx, offChunk;
+    int32_t idx, end;
+    int valLen, keyLen, count, kept;
+
+    m_pTagIndex->lock();
+    offIdx = m_pTagIndex->find(pTag, len, &valLen);
+    if (offIdx == 0)
+    {
+        m_pTagIndex->unlock();
+        return;
+    }
+    pIdx = (shm_tagidx_t *)m_pTagIndex->offset2ptr(offIdx);
+    idx = pIdx->x_iFirst;
+    if (idx < pIdx->x_iPurgeEnd)
+        idx = pIdx->x_iPurgeEnd;
+    end = pIdx->x_iEnd;
+    m_pTagIndex->unlock();
+
+    for (; idx < end; ++idx)
+    {
+        keyLen = buildChunkKey(achKey, pTag, len, idx);
+        m_pTagIndex->lock();
+        offChunk = m_pTagIndex->find(achKey, keyLen, &valLen);
+        count = 0;
+        if (offChunk != 0)
+        {
+            pChunk = (shm_tagchunk_t *)m_pTagIndex->offset2ptr(offChunk);
+            count = pChunk->x_iCount;
+            memmove(achKeys, pChunk->x_keys, count * HASH_KEY_LEN);
+        }
+        m_pTagIndex->unlock();
+        if (offChunk == 0)
+            continue;
+
+        kept = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            if (!isPubTracked(&achKeys[i * HASH_KEY_LEN]))
+                continue;
+            if (kept != i)
+                memmove(&achKeys[kept * HASH_KEY_LEN],
+                        &achKeys[i * HASH_KEY_LEN], HASH_KEY_LEN);
+            ++kept;
+        }
+        if (kept == count)
+            continue;
+
+        m_pTagIndex->lock();
+        offChunk = m_pTagIndex->find(achKey, keyLen, &valLen);
+        if (offChunk != 0)
+        {
+            pChunk = (shm_tagchunk_t *)m_pTagIndex->offset2ptr(offChunk);
+            //Consumed by a purge in the mean time if it shrunk
+            if (pChunk->x_iCount >= count)
+            {
+                memmove(pChunk->x_keys[kept], pChunk->x_keys[count],
+                        (pChunk->x_iCount - count) * HASH_KEY_LEN);
+                memmove(pChunk->x_keys, achKeys, kept * HASH_KEY_LEN);
+                pChunk->x_iCount -= count - kept;
+                if (pChunk->x_iCount == 0)
+                    m_pTagIndex->remove(achKey, keyLen);
+            }
+        }
+        m_pTagIndex->unlock();
+    }
+
+    m_pTagIndex->lock();
+    offIdx = m_pTagIndex->find(pTag, len, &valLen);
+    if (offIdx != 0)
+    {
+        pIdx = (shm_tagidx_t *)m_pTagIndex->offset2ptr(offIdx);
+        if (pIdx->x_iFirst >= pIdx->x_iPurgeEnd)
+        {
+            while (pIdx->x_iFirst < pIdx->x_iEnd)
+            {
+                keyLen = buildChunkKey(achKey, pTag, len, pIdx->x_iFirst);
+                if (m_pTagIndex->find(achKey, keyLen, &valLen) != 0)
+                    break;
+                ++pIdx->x_iFirst;
+            }
+            pIdx->x_iPurgeEnd = pIdx->x_iFirst;
+            if (pIdx->x_iFirst >= pIdx->x_iEnd && pIdx->x_flag == 0)
+                m_pTagIndex->remove(pTag, len);
+        }
+    }
+    m_pTagIndex->unlock();
+}
+
+
+void ShmCacheManager::pruneTagIndex()
+{
+    LsShmHash::iteroffset iterOff;
+    LsShmHash::iterator iter;
+    TPointerList<AutoStr2> tags;
+    const uint8_t *pKey;
+    int keyLen;
+
+    if (!m_pTagIndex || !m_pPubTracker)
+        return;
+    m_pTagIndex->lock();
+    for (iterOff = m_pTagIndex->begin(); iterOff.m_iOffset != 0;
+         iterOff = m_pTagIndex->next(iterOff))
+    {
+        iter = m_pTagIndex->offset2iterator(iterOff);
+        pKey = iter->getKey();
+        keyLen = iter->getKeyLen();
+        //Skip the chunks, "<tag>\0<idx>"
+        if (keyLen > (int)sizeof(int32_t)
+            && pKey[keyLen - sizeof(int32_t) - 1] == 0)
+            continue;
+        if (keyLen <= TAGIDX_MAX_TAG_LEN)
+            tags.push_back(new AutoStr2((const char *)pKey, keyLen));
+    }
+    m_pTagIndex->unlock();
+
+    for (int i = 0; i < tags.size(); ++i)
+        pruneTag(tags[i]->c_str(), tags[i]->len());
+    tags.release_objects();
+}
+
+
 // called when ondisk entry was removed.
 int ShmCacheManager::removeTracking(const char *pKey, int keyLen, int isPrivate)
 {
@@ -1284,3 +1735,523 @@ int ShmCacheManager::isInTracker(const unsigned char* pKey, int keyLen,
 }
 
 
+static pid_t getFillPid()
+{
+    static pid_t s_pid = 0;
+    if (s_pid == 0)
+        s_pid = getpid();
+    return s_pid;
+}
+
+
+int ShmCacheManager::lockFill(const unsigned char *pKey, int keyLen,
+                              int iTimeout)
+{
+    shm_filllock_t *pData;
+    int valLen = sizeof(*pData);
+    int flag = LSSHM_FLAG_NONE;
+    int ret = 1;
+
+    if (!m_pFillLocks)
+        return 1;
+    m_pFillLocks->lock();
+    LsShmOffset_t offVal = m_pFillLocks->get(pKey, keyLen, &valLen, &flag);
+    if (offVal != 0 && !(flag & LSSHM_VAL_CREATED))
+    {
+        pData = (shm_filllock_t *)m_pFillLocks->offset2ptr(offVal);
+        if (pData->x_tmExpire >= (uint32_t)DateTime::s_curTime)
+            ret = (pData->x_pid == 0) ? -1 : 0;
+        else
+        {
+            //Expired, start a new one so that it is not trimmed as old
+            m_pFillLocks->remove(pKey, keyLen);
+            valLen = sizeof(*pData);
+            offVal = m_pFillLocks->get(pKey, keyLen, &valLen, &flag);
+        }
+    }
+    if (offVal != 0 && ret == 1)
+    {
+        pData = (shm_filllock_t *)m_pFillLocks->offset2ptr(offVal);
+        pData->x_pid = getFillPid();
+        pData->x_tmExpire = DateTime::s_curTime + iTimeout;
+    }
+    m_pFillLocks->unlock();
+    return ret;
+}
+
+
+void ShmCacheManager::unlockFill(const unsigned char *pKey, int keyLen,
+                                 int iPassSecs)
+{
+    shm_filllock_t *pData;
+    int valLen;
+
+    if (!m_pFillLocks)
+        return;
+    m_pFillLocks->lock();
+    LsShmOffset_t offVal = m_pFillLocks->find(pKey, keyLen, &valLen);
+    if (offVal != 0)
+    {
+        //May have expired and been taken over by another process
+        pData = (shm_filllock_t *)m_pFillLocks->offset2ptr(offVal);
+        if (pData->x_pid == getFillPid())
+        {
+            if (iPassSecs > 0)
+            {
+                pData->x_pid = 0;
+                pData->x_tmExpire = DateTime::s_curTime + iPassSecs;
+            }
+            else
+                m_pFillLocks->remove(pKey, keyLen);
+        }
+    }
+    m_pFillLocks->unlock();
+}
+
+
+int ShmCacheManager::isFillLocked(const unsigned char *pKey, int keyLen)
+{
+    shm_filllock_t *pData;
+    int valLen;
+    int ret = 0;
+
+    if (!m_pFillLocks)
+        return 0;
+    m_pFillLocks->lock();
+    LsShmOffset_t offVal = m_pFillLocks->find(pKey, keyLen, &valLen);
+    if (offVal != 0)
+    {
+        pData = (shm_filllock_t *)m_pFillLocks->offset2ptr(offVal);
+        ret = (pData->x_pid != 0
+               && pData->x_tmExpire >= (uint32_t)DateTime::s_curTime);
+    }
+    m_pFillLocks->unlock();
+    return ret;
+}
+
+
+//Fill locks and hit-for-pass markers never live longer than this.
+void ShmCacheManager::cleanupFillLocks()
+{
+    if (!m_pFillLocks)
+        return;
+    m_pFillLocks->lock();
+    m_pFillLocks->trim(DateTime::s_curTime - CACHE_FILL_MAX_SECS, NULL, NULL);
+    m_pFillLocks->unlock();
+}
+
+
+
+
+#define CACHE_SNAPSHOT_FILE     ".cacheidx"
+#define CACHE_JOURNAL_FILE      ".cachepurge"
+#define CACHE_SNAPSHOT_MAGIC    0x4943534c      //"LSCI"
+#define CACHE_SNAPSHOT_INTERVAL 600
+#define SNAPSHOT_BATCH          1000
+#define SNAPSHOT_CHUNK          (1024 * 1024)
+
+enum
+{
+    SNAP_END,
+    SNAP_PUBLIC_PURGE,
+    SNAP_URL_VARY,
+    SNAP_ID2VARY,
+    SNAP_PUB_TRACKER,
+    SNAP_TAG_INDEX,
+};
+
+/**
+ * Snapshot file, the header and the CacheInfo are followed by sections of
+ * a section id and hash records of key length, value length, key and
+ * value, ended by a 0 key length. SNAP_END ends the file.
+ */
+typedef struct snapshot_hdr_s
+{
+    int32_t     x_iMagic;
+    int32_t     x_iInfoLen;
+    int32_t     x_tmSaved;
+    int32_t     x_iReserved;
+} snapshot_hdr_t;
+
+typedef struct purgejournal_s
+{
+    int32_t     x_tmSecs;
+    int16_t     x_tmMsec;
+    int16_t     x_isStale;
+    int32_t     x_iLen;
+} purgejournal_t;
+
+
+static void buildStorePath(char *pBuf, int len, const char *pDir,
+                           const char *pName, const char *pSuffix)
+{
+    snprintf(pBuf, len, "%s%s%s", pDir, pName, pSuffix);
+}
+
+
+LsShmHash *ShmCacheManager::getSnapshotHash(int id)
+{
+    switch (id)
+    {
+    case SNAP_PUBLIC_PURGE:
+        return m_pPublicPurge;
+    case SNAP_URL_VARY:
+        return (LsShmHash *)m_pUrlVary;
+    case SNAP_ID2VARY:
+        return m_pId2VaryStr;
+    case SNAP_PUB_TRACKER:
+        return m_pPubTracker;
+    case SNAP_TAG_INDEX:
+        return m_pTagIndex;
+    }
+    return NULL;
+}
+
+
+void ShmCacheManager::journalPurge(const char *pValue, int iValLen,
+                                   time_t curTime, int curTimeMS, int stale)
+{
+    char achPath[4096];
+    struct iovec iov[2];
+    purgejournal_t rec;
+    int fd;
+
+    if (!m_sStoreDir.c_str())
+        return;
+    buildStorePath(achPath, sizeof(achPath), m_sStoreDir.c_str(),
+                   CACHE_JOURNAL_FILE, "");
+    fd = ::open(achPath, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0660);
+    if (fd == -1)
+        return;
+    rec.x_tmSecs = curTime;
+    rec.x_tmMsec = curTimeMS;
+    rec.x_isStale = (stale != 0);
+    rec.x_iLen = iValLen;
+    iov[0].iov_base = &rec;
+    iov[0].iov_len = sizeof(rec);
+    iov[1].iov_base = (void *)pValue;
+    iov[1].iov_len = iValLen;
+    writev(fd, iov, 2);
+    close(fd);
+}
+
+
+void ShmCacheManager::replayJournal(const char *pPath)
+{
+    purgejournal_t rec;
+    struct stat st;
+    const char *pBegin, *p, *pEnd;
+    int fd, count = 0;
+
+    if ((fd = ::open(pPath, O_RDONLY)) == -1)
+        return;
+    if ((fstat(fd, &st) == -1) || (st.st_size == 0)
+        || ((pBegin = (const char *)mmap(NULL, st.st_size, PROT_READ,
+                                         MAP_PRIVATE, fd, 0))
+            == (const char *)MAP_FAILED))
+    {
+        close(fd);
+        return;
+    }
+    close(fd);
+    p = pBegin;
+    pEnd = pBegin + st.st_size;
+    while (p + sizeof(rec) <= pEnd)
+    {
+        memmove(&rec, p, sizeof(rec));
+        p += sizeof(rec);
+        if ((rec.x_iLen < 0) || (rec.x_iLen > pEnd - p))
+            break;
+        processPurgeCmdEx(NULL, p, rec.x_iLen, rec.x_tmSecs, rec.x_tmMsec,
+                          rec.x_isStale);
+        p += rec.x_iLen;
+        ++count;
+    }
+    munmap((void *)pBegin, st.st_size);
+    LOG4CXX_NS::Logger::getRootLogger()->info(
+        "[CACHE] replayed %d purge commands from [%s].", count, pPath);
+}
+
+
+int ShmCacheManager::shouldSaveSnapshot()
+{
+    int32_t last = getCacheInfo()->getLastSnapshot();
+    if (DateTime::s_curTime - last < CACHE_SNAPSHOT_INTERVAL)
+        return 0;
+    return getCacheInfo()->setLastSnapshot(last, DateTime::s_curTime) != 0;
+}
+
+
+/**
+ * Copy the records of a hash to pBuf, it is locked a batch at a time, until
+ * pBuf holds SNAPSHOT_CHUNK bytes. The walk resumes after the last key
+ * copied, if that key is gone meanwhile the rest is skipped, a snapshot
+ * only needs to be mostly complete. Return 1 when the hash is done.
+ */
+int ShmCacheManager::copyHash(LsShmHash *pHash, SnapshotCursor *pCursor,
+                              AutoBuf *pBuf)
+{
+    LsShmHash::iteroffset iterOff;
+    LsShmHash::iterator iter;
+    ls_strpair_t parms;
+    int32_t lens[2];
+    int n;
+
+    while (pHash && pBuf->size() < SNAPSHOT_CHUNK)
+    {
+        LsShmHashLocker locker(pHash);
+        if (pCursor->m_iRecs == 0)
+            iterOff = pHash->begin();
+        else
+        {
+            ls_str_set(&parms.key, (char *)pCursor->m_lastKey.c_str(),
+                       pCursor->m_lastKey.len());
+            iterOff = pHash->findIterator(&parms);
+            if (iterOff.m_iOffset != 0)
+                iterOff = pHash->next(iterOff);
+        }
+        for (n = 0; (n < SNAPSHOT_BATCH) && (iterOff.m_iOffset != 0); ++n)
+        {
+            iter = pHash->offset2iterator(iterOff);
+            lens[0] = iter->getKeyLen();
+            lens[1] = iter->getValLen();
+            pBuf->append((const char *)lens, sizeof(lens));
+            pBuf->append((const char *)iter->getKey(), lens[0]);
+            pBuf->append((const char *)iter->getVal(), lens[1]);
+            ++pCursor->m_iRecs;
+            if (n == SNAPSHOT_BATCH - 1)
+                pCursor->m_lastKey.setStr((const char *)iter->getKey(),
+                                          lens[0]);
+            iterOff = pHash->next(iterOff);
+        }
+        if (iterOff.m_iOffset == 0)
+            return 1;
+    }
+    return (pHash == NULL);
+}
+
+
+int ShmCacheManager::copySnapshot(SnapshotCursor *pCursor, AutoBuf *pBuf)
+{
+    char achJournal[4096];
+    char achOld[4096];
+    snapshot_hdr_t hdr;
+    int32_t lens[2];
+    int32_t id;
+    const char *pDir = m_sStoreDir.c_str();
+
+    if (!pDir)
+        return LS_FAIL;
+    if (pCursor->m_iSection == SNAP_END)
+    {
+        //Purges from now on go to a new journal, the current one is covered
+        //by this snapshot. Keep the old one if the last snapshot did not
+        //finish.
+        buildStorePath(achJournal, sizeof(achJournal), pDir,
+                       CACHE_JOURNAL_FILE, "");
+        buildStorePath(achOld, sizeof(achOld), pDir, CACHE_JOURNAL_FILE,
+                       ".old");
+        if (access(achOld, F_OK) == -1)
+            rename(achJournal, achOld);
+        hdr.x_iMagic = CACHE_SNAPSHOT_MAGIC;
+        hdr.x_iInfoLen = sizeof(CacheInfo);
+        hdr.x_tmSaved = time(NULL);
+        hdr.x_iReserved = 0;
+        pBuf->append((const char *)&hdr, sizeof(hdr));
+        pBuf->append((const char *)getCacheInfo(), sizeof(CacheInfo));
+        pCursor->m_iSection = id = SNAP_PUBLIC_PURGE;
+        pBuf->append((const char *)&id, sizeof(id));
+    }
+    while (pCursor->m_iSection <= SNAP_TAG_INDEX)
+    {
+        if (!copyHash(getSnapshotHash(pCursor->m_iSection), pCursor, pBuf))
+            return 0;
+        lens[0] = lens[1] = 0;
+        pBuf->append((const char *)lens, sizeof(lens));
+        if (pCursor->m_iSection == SNAP_PUB_TRACKER)
+            pCursor->m_iTracked = pCursor->m_iRecs;
+        pCursor->m_iRecs = 0;
+        pCursor->m_lastKey.release();
+        id = ++pCursor->m_iSection;
+        if (id > SNAP_TAG_INDEX)
+            id = SNAP_END;
+        pBuf->append((const char *)&id, sizeof(id));
+    }
+    return 1;
+}
+
+
+/**
+ * File I/O only, the shared memory is not touched. A failed write removes
+ * the temp file, the snapshot is given up.
+ */
+int ShmCacheManager::writeSnapshot(SnapshotCursor *pCursor, const char *pBuf,
+                                   int len, int isLast)
+{
+    char achPath[4096];
+    char achTmp[4096];
+    char achOld[4096];
+    const char *pDir = m_sStoreDir.c_str();
+
+    if (!pDir)
+        return LS_FAIL;
+    buildStorePath(achTmp, sizeof(achTmp), pDir, CACHE_SNAPSHOT_FILE, ".tmp");
+    if (pCursor->m_fd == -1)
+    {
+        pCursor->m_fd = ::open(achTmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                               0660);
+        if (pCursor->m_fd == -1)
+        {
+            LOG4CXX_NS::Logger::getRootLogger()->error(
+                "[CACHE] failed to create snapshot [%s]: %s", achTmp,
+                strerror(errno));
+            return LS_FAIL;
+        }
+    }
+    if (nio_write(pCursor->m_fd, pBuf, len) != len)
+    {
+        LOG4CXX_NS::Logger::getRootLogger()->error(
+            "[CACHE] failed to write snapshot [%s].", achTmp);
+        close(pCursor->m_fd);
+        pCursor->m_fd = -1;
+        unlink(achTmp);
+        return LS_FAIL;
+    }
+    if (!isLast)
+        return LS_OK;
+    close(pCursor->m_fd);
+    pCursor->m_fd = -1;
+    buildStorePath(achPath, sizeof(achPath), pDir, CACHE_SNAPSHOT_FILE, "");
+    buildStorePath(achOld, sizeof(achOld), pDir, CACHE_JOURNAL_FILE, ".old");
+    if (rename(achTmp, achPath) == -1)
+    {
+        unlink(achTmp);
+        return LS_FAIL;
+    }
+    unlink(achOld);
+    LOG4CXX_NS::Logger::getRootLogger()->info(
+        "[CACHE] saved snapshot of %d tracked entries to [%s].",
+        pCursor->m_iTracked, achPath);
+    return LS_OK;
+}
+
+
+int ShmCacheManager::saveSnapshot()
+{
+    SnapshotCursor cursor;
+    AutoBuf buf(SNAPSHOT_CHUNK);
+    int done;
+
+    do
+    {
+        buf.clear();
+        if ((done = copySnapshot(&cursor, &buf)) == LS_FAIL)
+            return LS_FAIL;
+        if (writeSnapshot(&cursor, buf.begin(), buf.size(), done) != LS_OK)
+            return LS_FAIL;
+    }
+    while (!done);
+    return LS_OK;
+}
+
+
+/**
+ * Restore a snapshot into a newly created cache manager, then replay the
+ * purges journaled after it. The file is checked completely before
+ * anything is restored. Expired tracker records are skipped.
+ */
+int ShmCacheManager::loadSnapshot()
+{
+    char achPath[4096];
+    snapshot_hdr_t hdr;
+    shm_objtrack_t track;
+    struct stat st;
+    const char *pBegin, *p, *pEnd;
+    LsShmHash *pHash;
+    int32_t id, lens[2];
+    int fd, pass, count = 0;
+    uint32_t now = time(NULL);
+
+    buildStorePath(achPath, sizeof(achPath), m_sStoreDir.c_str(),
+                   CACHE_SNAPSHOT_FILE, "");
+    if ((fd = ::open(achPath, O_RDONLY)) == -1)
+        return LS_FAIL;
+    if ((fstat(fd, &st) == -1)
+        || (st.st_size < (off_t)(sizeof(hdr) + sizeof(CacheInfo)))
+        || ((pBegin = (const char *)mmap(NULL, st.st_size, PROT_READ,
+                                         MAP_PRIVATE, fd, 0))
+            == (const char *)MAP_FAILED))
+    {
+        close(fd);
+        return LS_FAIL;
+    }
+    close(fd);
+    pEnd = pBegin + st.st_size;
+    memmove(&hdr, pBegin, sizeof(hdr));
+    if ((hdr.x_iMagic != CACHE_SNAPSHOT_MAGIC)
+        || (hdr.x_iInfoLen != (int32_t)sizeof(CacheInfo)))
+    {
+        munmap((void *)pBegin, st.st_size);
+        return LS_FAIL;
+    }
+
+    for (pass = 0; pass < 2; ++pass)
+    {
+        p = pBegin + sizeof(hdr) + sizeof(CacheInfo);
+        id = -1;
+        while (p + sizeof(id) <= pEnd)
+        {
+            memmove(&id, p, sizeof(id));
+            p += sizeof(id);
+            if (id == SNAP_END)
+                break;
+            pHash = pass ? getSnapshotHash(id) : NULL;
+            lens[0] = -1;
+            while (p + sizeof(lens) <= pEnd)
+            {
+                memmove(lens, p, sizeof(lens));
+                p += sizeof(lens);
+                if (lens[0] <= 0 || lens[1] < 0
+                    || lens[0] + lens[1] > pEnd - p)
+                    break;
+                if (pHash && (id == SNAP_PUB_TRACKER))
+                {
+                    if (lens[1] == sizeof(track))
+                        memmove(&track, p + lens[0], sizeof(track));
+                    if ((lens[1] != sizeof(track)) || (track.x_tmExpire < now))
+                        pHash = NULL;
+                    else
+                        ++count;
+                }
+                if (pHash)
+                    pHash->set(p, lens[0], p + lens[0], lens[1]);
+                pHash = pass ? getSnapshotHash(id) : NULL;
+                p += lens[0] + lens[1];
+            }
+            if (lens[0] != 0)
+                break;
+        }
+        if (id != SNAP_END)
+        {
+            LOG4CXX_NS::Logger::getRootLogger()->error(
+                "[CACHE] snapshot [%s] is incomplete, ignored.", achPath);
+            munmap((void *)pBegin, st.st_size);
+            return LS_FAIL;
+        }
+        if (pass == 0)
+            memmove((void *)getCacheInfo(), pBegin + sizeof(hdr),
+                    sizeof(CacheInfo));
+    }
+    munmap((void *)pBegin, st.st_size);
+    LOG4CXX_NS::Logger::getRootLogger()->info(
+        "[CACHE] restored %d tracked entries from snapshot [%s].", count,
+        achPath);
+
+    buildStorePath(achPath, sizeof(achPath), m_sStoreDir.c_str(),
+                   CACHE_JOURNAL_FILE, ".old");
+    replayJournal(achPath);
+    buildStorePath(achPath, sizeof(achPath), m_sStoreDir.c_str(),
+                   CACHE_JOURNAL_FILE, "");
+    replayJournal(achPath);
+    return LS_OK;
+}
@@ -21,6 +21,8 @@
 #include <shm/lsshmtypes.h>
 #include "cachemanager.h"
 
+#include <stdio.h>
+
 class LsShmHash;
 class LsShmPool;
 struct CacheKey;
@@ -38,6 +40,8 @@ public:
         , m_pSessions(NULL)
         , m_pPubTracker(NULL)
         , m_pPrivTracker(NULL)
+        , m_pFillLocks(NULL)
+        , m_pTagIndex(NULL)
         , m_pStr2IdHash(NULL)
         , m_pUrlVary(NULL)
         , m_pId2VaryStr(NULL)
@@ -53,6 +57,7 @@ public:
     int processPurgeCmd(const char *pValue, int iValLen, time_t curTime,
                         int curTimeMS, int stale)
     {
+        journalPurge(pValue, iValLen, curTime, curTimeMS, stale);
         return processPurgeCmdEx(NULL, pValue, iValLen, curTime, curTimeMS, stale);
     }
     int processPrivatePurgeCmd(CacheKey *pKey, const char *pValue, int iValLen,
@@ -99,18 +104,36 @@ public:
     int  trimExpiredByTracking(int isPrivate, int maxCnt, int (*removeEntry)(void *, void *), void *param);
     int  isInTracker(const unsigned char* getKey, int keyLen, int isPrivate);
 
+    int  lockFill(const unsigned char *pKey, int keyLen, int iTimeout);
+    void unlockFill(const unsigned char *pKey, int keyLen, int iPassSecs);
+    int  isFillLocked(const unsigned char *pKey, int keyLen);
+
+    int  processTagPurges(int maxCnt,
+                          void (*purgeEntry)(void *, const unsigned char *, int),
+                          void *param);
+
+    int  shouldSaveSnapshot();
+    int  copySnapshot(SnapshotCursor *pCursor, AutoBuf *pBuf);
+    int  writeSnapshot(SnapshotCursor *pCursor, const char *pBuf, int len,
+                       int isLast);
+    int  saveSnapshot();
+
 
 private:
     LsShmHash               *m_pPublicPurge;
     LsShmHash               *m_pSessions;
     LsShmHash               *m_pPubTracker;
     LsShmHash               *m_pPrivTracker;
+    LsShmHash               *m_pFillLocks;
+    LsShmHash               *m_pTagIndex;
+    TPointerList<AutoStr2>   m_tagPurgeQueue;
     LsShmHash               *m_pStr2IdHash;
     TShmHash<int32_t>       *m_pUrlVary;
     LsShmHash               *m_pId2VaryStr;
     TPointerList<AutoStr2>   m_id2StrList;
     LsShmOffset_t            m_CacheInfoOff;
     int                      m_attempts;
+    AutoStr2                 m_sStoreDir;
 
 
     LsShmOffset_t getSession(const char *pId, int len);
@@ -138,9 +161,24 @@ private:
     
     
     void cleanupExpiredSessions();
+    void cleanupFillLocks();
     int  cleanDiskCache();
     
     int  addTracking2(CacheEntry * pEntry, LsShmHash *pTracker);
+    void addTagIndex(CacheEntry *pEntry);
+    int  indexTag(const char *pTag, int len, const unsigned char *pKey);
+    void queueTagPurge(const char *pTag, int len, int flag, int32_t sec);
+    int  popTagChunk(const char *pTag, int len, unsigned char *pKeys,
+                     int32_t *pSec, int *pFlag);
+    void pruneTagIndex();
+    void pruneTag(const char *pTag, int len);
+    int  isPubTracked(const unsigned char *pKey);
+    void journalPurge(const char *pValue, int iValLen, time_t curTime,
+                      int curTimeMS, int stale);
+    void replayJournal(const char *pPath);
+    LsShmHash *getSnapshotHash(int id);
+    int  copyHash(LsShmHash *pHash, SnapshotCursor *pCursor, AutoBuf *pBuf);
+    int  loadSnapshot();
     LsShmHash *getTracker(int isPrivate)
     {
         return isPrivate ? m_pPrivTracker : m_pPubTracker;
@@ -104,6 +104,7 @@ int SsiEngine::beginExecute(HttpSession *pSession,
                 pSession->setupGzipFilter();
         }
         pReq->andGzip(~GZIP_ENABLED);    //disable GZIP
+        pReq->andZstd(~ZSTD_ENABLED);
     }
     else
         pSession->setupRespBodyBuf();
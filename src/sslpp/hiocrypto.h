@@ -48,6 +48,8 @@ public:
     {   return 0;       }
     virtual bool verifyContext(SslContext *ctx)
     {   return true;    }
+    virtual int  isEarlyData() const
+    {   return 0;       }
     int  buildVerifyErrorString(char *pBuf, int len) const
     {   return 0;       }
     
@@ -20,12 +20,15 @@
 
 #ifdef SSL_ASYNC_PK
 
+#include <edio/evtcbque.h>
 #include <log4cxx/logger.h>
+#include <lsr/ls_strtool.h>
 
 #include <assert.h>
 #include <errno.h>
 #include <string.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #define DEBUGGING
@@ -50,7 +53,38 @@
 struct Offloader * s_offloader = NULL;
 
 static int  s_ssl_apk_index = -1;
+static int  s_apk_start_failed = 0;
 void ssl_apk_offload_release(ssl_apk_offload_t *t);
+static int ssl_apk_batch_add(ssl_apk_offload_t *data);
+static int ssl_apk_sign_ex(EVP_MD_CTX *ctx, ssl_apk_offload_t *data);
+
+/**
+ * Only touched from the event loop thread; worker threads report timing
+ * through the ssl_apk_offload_t they processed.
+ */
+static struct
+{
+    ssl_apk_batch_t *m_pPending;
+    int              m_iBatchSize;
+    int              m_iMinWorkers;
+    int              m_iMaxWorkers;
+    int              m_iWorkers;
+    int              m_iInflight;
+    int              m_iPeakInflight;
+    long             m_lSigns;
+    long             m_lBatches;
+    long             m_lQueueUs;
+    long             m_lSignUs;
+    long long        m_llTotalSigns;
+} s_apk = { NULL, 8, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+
+
+static inline int64_t ssl_apk_now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
 
 static void ssl_free_apk_data(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx,
                         long argl, void *argp)
@@ -82,6 +116,32 @@ static const SSL_PRIVATE_KEY_METHOD s_async_private_key_method =
     { AsyncPrivateKeySign, AsyncPrivateKeyDecrypt, AsyncPrivateKeyComplete };
 
 
+static ssl_private_key_result_t ssl_apk_sign_inline(
+    SSL *ssl, uint8_t *out, size_t *out_len, size_t max_out,
+    uint16_t signature_algorithm, const uint8_t *in, size_t in_len)
+{
+    ssl_apk_offload_t data;
+    memset(&data, 0, sizeof(data));
+    data.m_pkey = SSL_get_privatekey(ssl);
+    if (NULL == data.m_pkey || EVP_PKEY_id(data.m_pkey) !=
+            SSL_get_signature_algorithm_key_type(signature_algorithm))
+        return ssl_private_key_failure;
+    data.m_sig_alg = signature_algorithm;
+    data.m_sign = (char *)out;
+    data.m_sign_size = max_out;
+    data.m_in = (uint8_t *)in;
+    data.m_in_len = in_len;
+    EVP_MD_CTX ctx;
+    EVP_MD_CTX_init(&ctx);
+    int ret = ssl_apk_sign_ex(&ctx, &data);
+    EVP_MD_CTX_cleanup(&ctx);
+    if (ret != 0)
+        return ssl_private_key_failure;
+    *out_len = data.m_sign_size;
+    return ssl_private_key_success;
+}
+
+
 static ssl_private_key_result_t AsyncPrivateKeySign(
     SSL* ssl, uint8_t* out, size_t* out_len, size_t max_out, 
     uint16_t signature_algorithm, const uint8_t* in, size_t in_len)
@@ -90,8 +150,12 @@ static ssl_private_key_result_t AsyncPrivateKeySign(
     
     if (!data)
     {
-        DEBUG_MESSAGE("[SSL: %p] AsyncPrivateKeySign method not defined\n", ssl);
-        return ssl_private_key_failure;
+        // QUIC and other SSL objects not set up by ssl_apk_prepare() share
+        // the SSL_CTX; sign those in place.
+        DEBUG_MESSAGE("[SSL: %p] AsyncPrivateKeySign no async data, sign in "
+                      "place\n", ssl);
+        return ssl_apk_sign_inline(ssl, out, out_len, max_out,
+                                   signature_algorithm, in, in_len);
     }
     if (data->m_header.is_canceled)
     {
@@ -136,15 +200,27 @@ static ssl_private_key_result_t AsyncPrivateKeySign(
 
     DEBUG_MESSAGE("[SSL: %p] AsyncPrivateKeySign add job: %p, max_out: %ld, "
                   "in_len: %ld\n", ssl, data, max_out, in_len);
-    if (offloader_enqueue(s_offloader, &data->m_header, NULL) == LS_FAIL)
+    if (ssl_apk_batch_add(data) == LS_FAIL)
     {
-        ERROR_MESSAGE("[SSL: %p] AsyncPrivateKeySign SSL add of job of sign "
-                      "failed\n", ssl);
+        ERROR_MESSAGE("[SSL: %p] AsyncPrivateKeySign unable to batch job, "
+                      "sign in place\n", ssl);
+        EVP_MD_CTX ctx;
+        EVP_MD_CTX_init(&ctx);
+        int ret = ssl_apk_sign_ex(&ctx, data);
+        EVP_MD_CTX_cleanup(&ctx);
+        ssl_private_key_result_t result = ssl_private_key_failure;
+        if (ret == 0 && data->m_sign_size <= max_out)
+        {
+            memcpy(out, data->m_sign, data->m_sign_size);
+            *out_len = data->m_sign_size;
+            result = ssl_private_key_success;
+        }
         free((void*)data->m_sign);
         data->m_sign = NULL;
         data->m_in = NULL;
-        ssl_apk_offload_release(data);
-        return ssl_private_key_failure;
+        SSL_set_private_key_method(ssl, NULL);
+        data->m_header.is_canceled = 1;
+        return result;
     }
 
     DEBUG_MESSAGE("[SSL: %p] AsyncPrivateKeySign retry\n", ssl);
@@ -229,13 +305,265 @@ struct Offloader *ssl_apk_get_offloader()
 }
 
 
+/**
+ * Called while loading the configuration, before the workers fork; the
+ * offloader itself is created by the first sign request of each worker.
+ */
+void ssl_apk_set_limits(int max_workers, int batch_size)
+{
+    if (max_workers < 1)
+        max_workers = 1;
+    if (batch_size < 1)
+        batch_size = 1;
+    else if (batch_size > SSL_APK_BATCH_MAX)
+        batch_size = SSL_APK_BATCH_MAX;
+    s_apk.m_iMaxWorkers = max_workers;
+    s_apk.m_iBatchSize = batch_size;
+}
+
+
 int ssl_apk_start_offloader(int worker)
+{
+    return ssl_apk_start_offloader2(1, worker, s_apk.m_iBatchSize);
+}
+
+
+int ssl_apk_start_offloader2(int min_workers, int max_workers,
+                             int batch_size)
 {
     if (s_offloader != NULL)
         return 0;
-    s_offloader = offloader_new("SSL_APK", worker);
+    if (max_workers < 1)
+        max_workers = 1;
+    if (min_workers < 1)
+        min_workers = 1;
+    else if (min_workers > max_workers)
+        min_workers = max_workers;
+    if (batch_size < 1)
+        batch_size = 1;
+    else if (batch_size > SSL_APK_BATCH_MAX)
+        batch_size = SSL_APK_BATCH_MAX;
+    s_offloader = offloader_new("SSL_APK", min_workers);
     if (s_offloader == NULL)
         return -1;
+    s_apk.m_iMinWorkers = min_workers;
+    s_apk.m_iMaxWorkers = max_workers;
+    s_apk.m_iWorkers = min_workers;
+    s_apk.m_iBatchSize = batch_size;
+    return 0;
+}
+
+
+/**
+ * Grow the signing crew as soon as the number of in-flight batches exceeds
+ * it; shrinking is left to ssl_apk_on_timer() so short bursts do not make
+ * threads come and go.
+ */
+static void ssl_apk_scale_up()
+{
+    int batches = (s_apk.m_iInflight + s_apk.m_iBatchSize - 1)
+                  / s_apk.m_iBatchSize;
+    if (batches <= s_apk.m_iWorkers
+        || s_apk.m_iWorkers >= s_apk.m_iMaxWorkers)
+        return;
+    if (batches > s_apk.m_iMaxWorkers)
+        batches = s_apk.m_iMaxWorkers;
+    DEBUG_MESSAGE("[SSL] [APK] in-flight: %d, grow workers %d -> %d\n",
+                  s_apk.m_iInflight, s_apk.m_iWorkers, batches);
+    s_apk.m_iWorkers = offloader_set_max_workers(s_offloader, batches);
+}
+
+
+void ssl_apk_on_timer()
+{
+    if (!s_offloader)
+        return;
+    int batches = (s_apk.m_iPeakInflight + s_apk.m_iBatchSize - 1)
+                  / s_apk.m_iBatchSize;
+    s_apk.m_iPeakInflight = s_apk.m_iInflight;
+    if (batches >= s_apk.m_iWorkers
+        || s_apk.m_iWorkers <= s_apk.m_iMinWorkers)
+        return;
+    DEBUG_MESSAGE("[SSL] [APK] peak in-flight batches: %d, shrink workers"
+                  " %d -> %d\n", batches, s_apk.m_iWorkers,
+                  s_apk.m_iWorkers - 1);
+    s_apk.m_iWorkers = offloader_set_max_workers(s_offloader,
+                                                 s_apk.m_iWorkers - 1);
+}
+
+
+int ssl_apk_generate_rt_report(int fd)
+{
+    char achBuf[512];
+    if (!s_offloader)
+        return 0;
+    int n = ls_snprintf(achBuf, sizeof(achBuf),
+                        "SSL_APK: WORKERS: %d, MAX_WORKERS: %d, "
+                        "QUEUE_DEPTH: %d, SIGN_PER_SEC: %ld, "
+                        "BATCH_PER_SEC: %ld, AVG_QUEUE_US: %ld, "
+                        "AVG_SIGN_US: %ld, TOT_SIGNS: %lld\n",
+                        offloader_get_workers(s_offloader), s_apk.m_iWorkers,
+                        s_apk.m_iInflight, s_apk.m_lSigns, s_apk.m_lBatches,
+                        s_apk.m_lSigns ? s_apk.m_lQueueUs / s_apk.m_lSigns : 0,
+                        s_apk.m_lSigns ? s_apk.m_lSignUs / s_apk.m_lSigns : 0,
+                        s_apk.m_llTotalSigns);
+    write(fd, achBuf, n);
+    return 0;
+}
+
+
+void ssl_apk_reset_stats()
+{
+    s_apk.m_lSigns = 0;
+    s_apk.m_lBatches = 0;
+    s_apk.m_lQueueUs = 0;
+    s_apk.m_lSignUs = 0;
+}
+
+
+static int ssl_apk_batch_perform(ls_offload *item)
+{
+    ssl_apk_batch_t *batch = (ssl_apk_batch_t *)item;
+    EVP_MD_CTX ctx;
+    int i;
+    DEBUG_MESSAGE("[SSL] [APK] batch %p, sign %d jobs\n", batch,
+                  batch->m_count);
+    for (i = 0; i < batch->m_count; ++i)
+    {
+        ssl_apk_offload_t *data = batch->m_tasks[i];
+        data->m_start_us = ssl_apk_now_us();
+        if (ls_atomic_value(&data->m_header.is_canceled))
+        {
+            ls_atomic_set(&data->m_header.state, LS_OFFLOAD_BYPASS);
+            data->m_done_us = data->m_start_us;
+            continue;
+        }
+        ls_atomic_set(&data->m_header.state, LS_OFFLOAD_PROCESSING);
+        EVP_MD_CTX_init(&ctx);
+        if (ssl_apk_sign_ex(&ctx, data) == -1)
+            data->m_sign_size = 0;
+        EVP_MD_CTX_cleanup(&ctx);
+        data->m_done_us = ssl_apk_now_us();
+        ls_atomic_set(&data->m_header.state, LS_OFFLOAD_IN_FINISH_QUEUE);
+    }
+    return 0;
+}
+
+
+static void ssl_apk_batch_release(ls_offload *item)
+{
+    if (--item->ref_cnt > 0)
+        return;
+    free(item);
+}
+
+
+static void ssl_apk_batch_done(void *param)
+{
+    ssl_apk_batch_t *batch = (ssl_apk_batch_t *)param;
+    int i;
+    ++s_apk.m_lBatches;
+    for (i = 0; i < batch->m_count; ++i)
+    {
+        ssl_apk_offload_t *data = batch->m_tasks[i];
+        --s_apk.m_iInflight;
+        ++s_apk.m_lSigns;
+        ++s_apk.m_llTotalSigns;
+        s_apk.m_lQueueUs += data->m_start_us - data->m_enqueue_us;
+        s_apk.m_lSignUs += data->m_done_us - data->m_start_us;
+        if (!data->m_header.is_canceled)
+        {
+            ls_atomic_set(&data->m_header.state, LS_OFFLOAD_FINISH_CB);
+            data->m_header.api->on_task_done(data->m_header.param_task_done);
+        }
+        else
+            ls_atomic_set(&data->m_header.state, LS_OFFLOAD_FINISH_CB_BYPASS);
+        data->m_header.api->release(&data->m_header);
+    }
+    batch->m_count = 0;
+}
+
+
+static ls_offload_api s_apk_batch_api =
+{
+    ssl_apk_batch_perform,
+    ssl_apk_batch_release,
+    ssl_apk_batch_done
+};
+
+
+static int ssl_apk_batch_flush()
+{
+    ssl_apk_batch_t *batch = s_apk.m_pPending;
+    if (!batch)
+        return 0;
+    s_apk.m_pPending = NULL;
+    DEBUG_MESSAGE("[SSL] [APK] flush batch %p with %d jobs\n", batch,
+                  batch->m_count);
+    s_apk.m_iInflight += batch->m_count;
+    if (s_apk.m_iInflight > s_apk.m_iPeakInflight)
+        s_apk.m_iPeakInflight = s_apk.m_iInflight;
+    ssl_apk_scale_up();
+    if (offloader_enqueue(s_offloader, &batch->m_header, NULL) == LS_FAIL)
+    {
+        ERROR_MESSAGE("[SSL] [APK] batch %p enqueue failed, sign %d jobs in "
+                      "place\n", batch, batch->m_count);
+        ssl_apk_batch_perform(&batch->m_header);
+        ssl_apk_batch_done(batch);
+        ssl_apk_batch_release(&batch->m_header);
+        return LS_FAIL;
+    }
+    ssl_apk_batch_release(&batch->m_header);
+    return 0;
+}
+
+
+static int ssl_apk_batch_flush_cb(evtcbhead_t *, const long, void *)
+{
+    ssl_apk_batch_flush();
+    return 0;
+}
+
+
+static int ssl_apk_batch_add(ssl_apk_offload_t *data)
+{
+    ssl_apk_batch_t *batch = s_apk.m_pPending;
+    if (!s_offloader)
+    {
+        if (s_apk_start_failed)
+            return LS_FAIL;
+        if (ssl_apk_start_offloader2(s_apk.m_iMinWorkers, s_apk.m_iMaxWorkers,
+                                     s_apk.m_iBatchSize) != 0)
+        {
+            ERROR_MESSAGE("[SSL] [APK] Failed to start offloader, sign in "
+                          "place\n");
+            s_apk_start_failed = 1;
+            return LS_FAIL;
+        }
+    }
+    if (!batch)
+    {
+        batch = (ssl_apk_batch_t *)malloc(sizeof(ssl_apk_batch_t));
+        if (!batch)
+            return LS_FAIL;
+        memset(batch, 0, sizeof(ssl_apk_batch_t));
+        batch->m_header.ref_cnt = 1;
+        batch->m_header.api = &s_apk_batch_api;
+        batch->m_header.param_task_done = batch;
+        if (!EvtcbQue::getInstance().schedule(ssl_apk_batch_flush_cb,
+                                              NULL, 0, NULL))
+        {
+            free(batch);
+            return LS_FAIL;
+        }
+        s_apk.m_pPending = batch;
+    }
+    ++data->m_header.ref_cnt;
+    ls_atomic_set(&data->m_header.state, LS_OFFLOAD_ENQUEUE);
+    data->m_enqueue_us = ssl_apk_now_us();
+    batch->m_tasks[batch->m_count++] = data;
+    if (batch->m_count >= s_apk.m_iBatchSize)
+        ssl_apk_batch_flush();
     return 0;
 }
 
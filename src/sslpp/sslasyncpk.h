@@ -35,11 +35,34 @@ typedef struct ssl_apk_offload
     char         *m_sign;
     size_t        m_sign_size;
     EVP_PKEY     *m_pkey;
+    int64_t       m_enqueue_us;
+    int64_t       m_start_us;
+    int64_t       m_done_us;
 }ssl_apk_offload_t;
 
+#define SSL_APK_BATCH_MAX       32
+
+/**
+ * Pending sign operations from all handshakes seen in one event loop pass
+ * are handed to the offloader as a single job.
+ */
+typedef struct ssl_apk_batch
+{
+    ls_offload_t        m_header;
+    int                 m_count;
+    ssl_apk_offload_t  *m_tasks[SSL_APK_BATCH_MAX];
+}ssl_apk_batch_t;
+
+void ssl_apk_set_limits(int max_workers, int batch_size);
 int ssl_apk_start_offloader(int worker);
+int ssl_apk_start_offloader2(int min_workers, int max_workers,
+                             int batch_size);
 struct Offloader *ssl_apk_get_offloader();
 
+void ssl_apk_on_timer();
+int  ssl_apk_generate_rt_report(int fd);
+void ssl_apk_reset_stats();
+
 void ssl_apk_set_api(ls_offload_api *api, void (*done_cb)(void *param));
 ssl_apk_offload_t *ssl_apk_prepare(SSL *ssl, ls_offload_api *api, void *param);
 
@@ -26,9 +26,14 @@
 #endif
 
 #include <lsr/ls_pool.h>
+#include <lsr/xxhash.h>
 
-#include <util/brotlibuf.h>
-#include <util/vmembuf.h>
+#include <brotli/decode.h>
+#include <brotli/encode.h>
+#include <zlib.h>
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
 
 #include <errno.h>
 #include <string.h>
@@ -68,6 +73,38 @@ static bool s_activate_decomp = false;
 static int  s_iBrCompressLevel = 6;
 static int  s_iSSL_CTX_index = -1;
 
+#ifndef TLSEXT_cert_compression_zstd
+#define TLSEXT_cert_compression_zstd 3
+#endif
+
+// Levels used when the certificate is loaded, the result is reused for
+// every handshake so it pays to compress as hard as possible.
+#define CC_PRECOMP_BR_LEVEL     BROTLI_MAX_QUALITY
+#define CC_PRECOMP_ZLIB_LEVEL   Z_BEST_COMPRESSION
+#define CC_PRECOMP_ZSTD_LEVEL   19
+#define CC_ZLIB_LEVEL           6
+#define CC_ZSTD_LEVEL           3
+
+static const char *s_alg_name[SslCertComp::CC_ALG_COUNT] =
+{
+    "brotli",
+    "zlib",
+#ifdef USE_ZSTD
+    "zstd",
+#endif
+};
+
+
+static void freeCacheSet(SslCertComp::comp_cache_set_t *set)
+{
+    for (int alg = 0; alg < SslCertComp::CC_ALG_COUNT; ++alg)
+        for (int i = 0; i < SslCertComp::CC_SLOTS; ++i)
+            if (set->m_entries[alg][i])
+                ls_pfree(set->m_entries[alg][i]);
+    ls_pfree(set);
+}
+
+
 static void freeCtxData(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx, 
                         long argl, void *argp)
 {
@@ -75,147 +112,162 @@ static void freeCtxData(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx,
     if (ptr)
     {
         DEBUG_MESSAGE("[SSLCertComp] freeing data\n");
-        ls_pfree(ptr);
+        freeCacheSet((SslCertComp::comp_cache_set_t *)ptr);
     }
 }
 
 
-static SslCertComp::comp_cache_t *cache_data(SSL_CTX *ctx, 
-                                             SslCertComp::comp_cache_t *cache, 
-                                             int in_size,
-                                             char *readBuffer, size_t len)
+static SslCertComp::comp_cache_set_t *getCacheSet(SSL_CTX *ctx, bool create)
 {
-    if (!cache)
-    {
-        cache = (SslCertComp::comp_cache_t *)ls_palloc(len + sizeof(int) * 2);
-        if (!cache)
-            return NULL;
-        cache->m_input_len = in_size;
-        cache->m_len = len;
-        memcpy(cache->m_comp, readBuffer, len);    
-    }
-    else
+    SslCertComp::comp_cache_set_t *set;
+    set = (SslCertComp::comp_cache_set_t *)SSL_CTX_get_ex_data(ctx,
+                                                        s_iSSL_CTX_index);
+    if (set || !create)
+        return set;
+    set = (SslCertComp::comp_cache_set_t *)ls_palloc(
+                                    sizeof(SslCertComp::comp_cache_set_t));
+    if (!set)
+        return NULL;
+    memset(set, 0, sizeof(SslCertComp::comp_cache_set_t));
+    SSL_CTX_set_ex_data(ctx, s_iSSL_CTX_index, (void *)set);
+    return set;
+}
+
+
+static SslCertComp::comp_cache_t *lookupCache(
+    SslCertComp::comp_cache_set_t *set, int alg, uint64_t hash, size_t in_size)
+{
+    for (int i = 0; i < SslCertComp::CC_SLOTS; ++i)
     {
-        SslCertComp::comp_cache_t *recache;
-        recache = (SslCertComp::comp_cache_t *)ls_prealloc(cache, cache->m_len + 
-                                                           sizeof(int) * 2 + len);
-        if (recache)
-        {
-            memcpy(&recache->m_comp[recache->m_len], readBuffer, len);
-            recache->m_len += len;    
-            cache = recache;
-        }
-        else 
-        {
-            return NULL;
-        }    
+        SslCertComp::comp_cache_t *cache = set->m_entries[alg][i];
+        if (cache && cache->m_hash == hash
+            && cache->m_input_len == (int)in_size)
+            return cache;
     }
-    SSL_CTX_set_ex_data(ctx, s_iSSL_CTX_index, (void *)cache);
-    return cache;
+    return NULL;
 }
 
 
-static int certCompressFunc(SSL *ssl, CBB *out, const uint8_t *in_data, 
-                            size_t in_size, 
-#ifdef ZBUF_H                            
-                            Zbuf *zbuf, 
-#else
-                            Compressor *zbuf,
-#endif                            
-                            int level)
+/**
+ * Slot CC_PINNED_SLOT holds the precomputed message and is only replaced by
+ * precompute(); variants compressed during handshakes rotate through the
+ * remaining slots.
+ */
+static void storeCache(SslCertComp::comp_cache_set_t *set, int alg,
+                       SslCertComp::comp_cache_t *cache, bool pinned)
 {
-    DEBUG_MESSAGE("[SSLCertComp] Compressing %ld bytes\n", in_size);
-    SSL_CTX *ctx = SSL_get_SSL_CTX(ssl);
-    
-    SslCertComp::comp_cache_t *cache;
-    cache = (SslCertComp::comp_cache_t *)SSL_CTX_get_ex_data(ctx, s_iSSL_CTX_index);
-    if (cache)
+    int slot = SslCertComp::CC_PINNED_SLOT;
+    if (!pinned)
     {
-        if (cache->m_input_len == (int)in_size)
-        {
-            DEBUG_MESSAGE("[SSLCertComp] Using cached %d bytes\n", cache->m_len);
-            if (CBB_add_bytes(out, (const uint8_t *)cache->m_comp, cache->m_len) == 0)
-            {
-                ERROR_MESSAGE("[SSLCertComp] Error adding cached data to compressed buffer\n");
-                return false;
-            }
-            return true;
-        }
-        else
-        {
-            SSL_CTX_set_ex_data(ctx, s_iSSL_CTX_index, NULL);\
-            DEBUG_MESSAGE("[SSLCertComp] input size changed, release old cache\n");
-            ls_pfree(cache);
-            cache = NULL;
-        }
+        slot = SslCertComp::CC_PINNED_SLOT + 1 + set->m_next[alg];
+        set->m_next[alg] = (set->m_next[alg] + 1)
+                           % (SslCertComp::CC_SLOTS - 1);
     }
-    
-    VMemBuf   vmembuf;
-    
-    if (vmembuf.set(VMBUF_MALLOC, 
-#ifdef ZBUF_H                            
-                    in_size
-#else
-                    (int)in_size
-#endif                    
-                   ) == LS_FAIL)
+    if (set->m_entries[alg][slot])
+        ls_pfree(set->m_entries[alg][slot]);
+    set->m_entries[alg][slot] = cache;
+}
+
+
+static SslCertComp::comp_cache_t *compressCertMsg(int alg,
+                                                  const uint8_t *in,
+                                                  size_t in_size, int level)
+{
+    size_t bound;
+    switch (alg)
     {
-        ERROR_MESSAGE("[SSLCertComp] Unable to set memory buffer\n");
-        return false;
+    case SslCertComp::CC_BROTLI:
+        bound = BrotliEncoderMaxCompressedSize(in_size);
+        break;
+    case SslCertComp::CC_ZLIB:
+        bound = compressBound(in_size);
+        break;
+#ifdef USE_ZSTD
+    case SslCertComp::CC_ZSTD:
+        bound = ZSTD_compressBound(in_size);
+        break;
+#endif
+    default:
+        return NULL;
     }
-    zbuf->setCompressCache(&vmembuf);
-    if (zbuf->init(
-#ifdef ZBUF_H                            
-                   Zbuf::MODE_COMPRESS, 
-#else
-                   Compressor::COMPRESSOR_COMPRESS,
-#endif                   
-                   level
-#ifdef ZBUF_H                            
-                   , 0
-#endif                   
-                  ) == LS_FAIL)
+    if (!bound)
+        return NULL;
+
+    SslCertComp::comp_cache_t *cache = (SslCertComp::comp_cache_t *)
+        ls_palloc(sizeof(SslCertComp::comp_cache_t) + bound);
+    if (!cache)
     {
-        ERROR_MESSAGE("[SSLCertComp] Unable to initialize compression\n");
-        return false;
+        ERROR_MESSAGE("[SSLCertComp] Insufficient memory to compress %zd "
+                      "bytes\n", in_size);
+        return NULL;
     }
-    if (zbuf->beginStream() == LS_FAIL)
+
+    size_t len = bound;
+    bool ok = false;
+    switch (alg)
     {
-        ERROR_MESSAGE("[SSLCertComp] Unable to begin stream\n");
-        return false;
+    case SslCertComp::CC_BROTLI:
+        ok = BrotliEncoderCompress(level, BROTLI_DEFAULT_WINDOW,
+                                   BROTLI_MODE_GENERIC, in_size, in, &len,
+                                   cache->m_comp) == BROTLI_TRUE;
+        break;
+    case SslCertComp::CC_ZLIB:
+        {
+            uLongf zlen = bound;
+            ok = compress2(cache->m_comp, &zlen, in, in_size, level) == Z_OK;
+            len = zlen;
+        }
+        break;
+#ifdef USE_ZSTD
+    case SslCertComp::CC_ZSTD:
+        len = ZSTD_compress(cache->m_comp, bound, in, in_size, level);
+        ok = !ZSTD_isError(len);
+        break;
+#endif
     }
-    if (zbuf->write((char *)in_data, in_size) == LS_FAIL)
+    if (!ok)
     {
-        ERROR_MESSAGE("[SSLCertComp] Unable to write data\n");
-        return false;
+        ERROR_MESSAGE("[SSLCertComp] Unable to %s compress %zd bytes\n",
+                      s_alg_name[alg], in_size);
+        ls_pfree(cache);
+        return NULL;
     }
-    char *readBuffer;
-    size_t len;
-    if (zbuf->endStream() == LS_FAIL)
-    {
-        ERROR_MESSAGE("[SSLCertComp] Unable to complete the compression\n");
+    cache->m_hash = XXH64(in, in_size, 0);
+    cache->m_input_len = in_size;
+    cache->m_len = len;
+    DEBUG_MESSAGE("[SSLCertComp] %s compressed %zd bytes to %zd bytes at "
+                  "level %d\n", s_alg_name[alg], in_size, len, level);
+    return cache;
+}
+
+
+static int certCompressFunc(SSL *ssl, CBB *out, const uint8_t *in_data, 
+                            size_t in_size, int alg, int level)
+{
+    DEBUG_MESSAGE("[SSLCertComp] Compressing %ld bytes with %s\n", in_size,
+                  s_alg_name[alg]);
+    SSL_CTX *ctx = SSL_get_SSL_CTX(ssl);
+    SslCertComp::comp_cache_set_t *set = getCacheSet(ctx, true);
+    if (!set)
         return false;
-    }
-    while ((readBuffer = vmembuf.getReadBuffer(len)) && (len))
+
+    uint64_t hash = XXH64(in_data, in_size, 0);
+    SslCertComp::comp_cache_t *cache = lookupCache(set, alg, hash, in_size);
+    if (cache)
+        DEBUG_MESSAGE("[SSLCertComp] Using cached %d bytes\n", cache->m_len);
+    else
     {
-        DEBUG_MESSAGE("[SSLCertComp] Got compressed buffer of %ld bytes\n", len);
-        if (CBB_add_bytes(out, (const uint8_t *)readBuffer, len) == 0)
-        {
-            ERROR_MESSAGE("[SSLCertComp] Error adding data to compressed buffer\n");
-            return false;
-        }
-        if (!(cache = cache_data(ctx, cache, in_size, readBuffer, len)))
+        cache = compressCertMsg(alg, in_data, in_size, level);
+        if (!cache)
             return false;
-        vmembuf.readUsed(len);
+        storeCache(set, alg, cache, false);
     }
-    if (CBB_flush(out) == 0)
+    if (CBB_add_bytes(out, (const uint8_t *)cache->m_comp, cache->m_len) == 0
+        || CBB_flush(out) == 0)
     {
-        ERROR_MESSAGE("[SSLCertComp] Error completing adding to compressed buffer\n");
-        SslCertComp::disableCertCompDecomp(ctx);
+        ERROR_MESSAGE("[SSLCertComp] Error adding cached data to compressed buffer\n");
         return false;
     }
-    DEBUG_MESSAGE("[SSLCertComp] Final compression resulted in %ld bytes\n",
-                  CBB_len(out));
     return true;
 }
 
@@ -223,70 +275,35 @@ static int certCompressFunc(SSL *ssl, CBB *out, const uint8_t *in_data,
 static int certCompressFuncBrotli(SSL *ssl, CBB *out, const uint8_t *in, 
                                   size_t in_len)
 {
-    BrotliBuf brotBuf;
-    return certCompressFunc(ssl, out, in, in_len, &brotBuf, s_iBrCompressLevel);
+    return certCompressFunc(ssl, out, in, in_len, SslCertComp::CC_BROTLI,
+                            s_iBrCompressLevel);
+}
+
+
+static int certCompressFuncZlib(SSL *ssl, CBB *out, const uint8_t *in,
+                                size_t in_len)
+{
+    return certCompressFunc(ssl, out, in, in_len, SslCertComp::CC_ZLIB,
+                            CC_ZLIB_LEVEL);
 }
 
 
+#ifdef USE_ZSTD
+static int certCompressFuncZstd(SSL *ssl, CBB *out, const uint8_t *in,
+                                size_t in_len)
+{
+    return certCompressFunc(ssl, out, in, in_len, SslCertComp::CC_ZSTD,
+                            CC_ZSTD_LEVEL);
+}
+#endif
+
+
 static int certDecompressFunc(SSL *ssl, CRYPTO_BUFFER **out,
                               size_t uncompressed_len, const uint8_t *in, 
-                              size_t in_len,
-#ifdef ZBUF_H                            
-                              Zbuf *zbuf, 
-#else
-                              Compressor *zbuf,
-#endif                            
-                              int level)
+                              size_t in_len, int alg)
 {
-    DEBUG_MESSAGE("[SSLCertComp] Decompressing %ld bytes to %ld bytes\n", in_len,
-                  uncompressed_len);
-
-    VMemBuf   vmembuf;
-    
-    if (vmembuf.set(VMBUF_MALLOC, 
-#ifdef ZBUF_H                            
-                    in_len
-#else
-                    (int)in_len
-#endif                    
-                   ) == LS_FAIL)
-    {
-        ERROR_MESSAGE("[SSLCertComp] Decompress Unable to set memory buffer\n");
-        return false;
-    }
-    zbuf->setCompressCache(&vmembuf);
-    if (zbuf->init(
-#ifdef ZBUF_H                            
-                   Zbuf::MODE_DECOMPRESS, 
-#else
-                   Compressor::COMPRESSOR_DECOMPRESS,
-#endif                   
-                   level
-#ifdef ZBUF_H                            
-                   , 0
-#endif                   
-                  ) == LS_FAIL)
-    {
-        ERROR_MESSAGE("[SSLCertComp] Unable to initialize decompression\n");
-        return false;
-    }
-    if (zbuf->beginStream() == LS_FAIL)
-    {
-        ERROR_MESSAGE("[SSLCertComp] Decompress; Unable to begin stream\n");
-        return false;
-    }
-    if (zbuf->write((char *)in, in_len) == LS_FAIL)
-    {
-        ERROR_MESSAGE("[SSLCertComp] Decompress; Unable to write data\n");
-        return false;
-    }
-    char *readBuffer;
-    size_t len;
-    if (zbuf->endStream() == LS_FAIL)
-    {
-        ERROR_MESSAGE("[SSLCertComp] Unable to complete the decompression\n");
-        return false;
-    }
+    DEBUG_MESSAGE("[SSLCertComp] Decompressing %ld bytes to %ld bytes with %s\n",
+                  in_len, uncompressed_len, s_alg_name[alg]);
 
     uint8_t *out_data;
     if (!((*out) = CRYPTO_BUFFER_alloc(&out_data, uncompressed_len)))
@@ -295,26 +312,34 @@ static int certDecompressFunc(SSL *ssl, CRYPTO_BUFFER **out,
                       "decompression buffer\n");
         return false;
     }
-    size_t pos = 0;
-    while ((readBuffer = vmembuf.getReadBuffer(len)) && (len))
+    size_t len = uncompressed_len;
+    bool ok = false;
+    switch (alg)
     {
-        DEBUG_MESSAGE("[SSLCertComp] Got decompressed buffer of %ld bytes\n", len);
-        if (len + pos > uncompressed_len)
+    case SslCertComp::CC_BROTLI:
+        ok = BrotliDecoderDecompress(in_len, in, &len, out_data)
+                == BROTLI_DECODER_RESULT_SUCCESS;
+        break;
+    case SslCertComp::CC_ZLIB:
         {
-            ERROR_MESSAGE("[SSLCertComp] Decompression exceeded expected len "
-                          "of %ld bytes (%ld bytes)\n", uncompressed_len, len + pos);
-            CRYPTO_BUFFER_free(*out);
-            return false;
+            uLongf zlen = uncompressed_len;
+            ok = uncompress(out_data, &zlen, in, in_len) == Z_OK;
+            len = zlen;
         }
-        memcpy(&out_data[pos], readBuffer, len);
-        pos += len;
-        vmembuf.readUsed(len);
+        break;
+#ifdef USE_ZSTD
+    case SslCertComp::CC_ZSTD:
+        len = ZSTD_decompress(out_data, uncompressed_len, in, in_len);
+        ok = !ZSTD_isError(len);
+        break;
+#endif
     }
-    if (len + pos != uncompressed_len)
+    if (!ok || len != uncompressed_len)
     {
-        ERROR_MESSAGE("[SSLCertComp] Decompression len error %ld != %ld\n",
-                      pos, uncompressed_len);
+        ERROR_MESSAGE("[SSLCertComp] Decompression failed or len error "
+                      "%ld != %ld\n", len, uncompressed_len);
         CRYPTO_BUFFER_free(*out);
+        *out = NULL;
         return false;
     }
     DEBUG_MESSAGE("[SSLCertComp] Decompression successful\n");
@@ -326,11 +351,67 @@ static int certDecompressFuncBrotli(SSL *ssl, CRYPTO_BUFFER **out,
                                     size_t uncompressed_len, const uint8_t *in, 
                                     size_t in_len)
 {
-    BrotliBuf brotBuf;
-    return certDecompressFunc(ssl, out, uncompressed_len, in, in_len, &brotBuf,
-                              s_iBrCompressLevel);
+    return certDecompressFunc(ssl, out, uncompressed_len, in, in_len,
+                              SslCertComp::CC_BROTLI);
 }
 
+
+static int certDecompressFuncZlib(SSL *ssl, CRYPTO_BUFFER **out,
+                                  size_t uncompressed_len, const uint8_t *in,
+                                  size_t in_len)
+{
+    return certDecompressFunc(ssl, out, uncompressed_len, in, in_len,
+                              SslCertComp::CC_ZLIB);
+}
+
+
+#ifdef USE_ZSTD
+static int certDecompressFuncZstd(SSL *ssl, CRYPTO_BUFFER **out,
+                                  size_t uncompressed_len, const uint8_t *in,
+                                  size_t in_len)
+{
+    return certDecompressFunc(ssl, out, uncompressed_len, in, in_len,
+                              SslCertComp::CC_ZSTD);
+}
+#endif
+
+
+static const struct
+{
+    uint16_t                    m_id;
+    ssl_cert_compression_func_t m_compress;
+    ssl_cert_decompression_func_t m_decompress;
+} s_algs[SslCertComp::CC_ALG_COUNT] =
+{
+    {   TLSEXT_cert_compression_brotli, certCompressFuncBrotli,
+        certDecompressFuncBrotli    },
+    {   TLSEXT_cert_compression_zlib, certCompressFuncZlib,
+        certDecompressFuncZlib      },
+#ifdef USE_ZSTD
+    {   TLSEXT_cert_compression_zstd, certCompressFuncZstd,
+        certDecompressFuncZstd      },
+#endif
+};
+
+
+static int addCertDer(CBB *list, X509 *x509)
+{
+    CBB entry;
+    uint8_t *p;
+    int len = i2d_X509(x509, NULL);
+    if (len <= 0
+        || !CBB_add_u24_length_prefixed(list, &entry)
+        || !CBB_add_space(&entry, &p, len)
+        || i2d_X509(x509, &p) != len
+        // No per-certificate extensions, OCSP/SCT variants are cached on
+        // first use.
+        || !CBB_add_u16(list, 0)
+        || !CBB_flush(list))
+        return LS_FAIL;
+    return LS_OK;
+}
+
+
 SslCertComp::SslCertComp()
 {
 }
@@ -370,18 +451,97 @@ void SslCertComp::disableCertCompDecomp(SSL_CTX *ctx)
 }
 
 
+/**
+ * Build the TLS 1.3 Certificate message body the way it is sent to a
+ * client that did not ask for OCSP or SCT, and compress it with every
+ * algorithm up front so the handshake only copies the cached bytes.
+ */
+int SslCertComp::precompute(SSL_CTX *ctx)
+{
+    X509 *leaf = SSL_CTX_get0_certificate(ctx);
+    if (!leaf)
+        return LS_FAIL;
+    SslCertComp::comp_cache_set_t *set = getCacheSet(ctx, false);
+    if (set)
+    {
+        SSL_CTX_set_ex_data(ctx, s_iSSL_CTX_index, NULL);
+        freeCacheSet(set);
+    }
+    if ((set = getCacheSet(ctx, true)) == NULL)
+        return LS_FAIL;
+
+    STACK_OF(X509) *chain = NULL;
+    SSL_CTX_get0_chain_certs(ctx, &chain);
+
+    CBB msg, list;
+    uint8_t *data;
+    size_t len;
+    int ret = LS_FAIL;
+    if (!CBB_init(&msg, 4096))
+        return LS_FAIL;
+    if (CBB_add_u8(&msg, 0)     // certificate_request_context
+        && CBB_add_u24_length_prefixed(&msg, &list)
+        && addCertDer(&list, leaf) == LS_OK)
+    {
+        size_t i;
+        for (i = 0; chain && i < sk_X509_num(chain); ++i)
+            if (addCertDer(&list, sk_X509_value(chain, i)) != LS_OK)
+                break;
+        if ((!chain || i == sk_X509_num(chain))
+            && CBB_finish(&msg, &data, &len))
+            ret = LS_OK;
+    }
+    if (ret != LS_OK)
+    {
+        CBB_cleanup(&msg);
+        ERROR_MESSAGE("[SSL_CTX:%p] Unable to build Certificate message for "
+                      "compression\n", ctx);
+        return LS_FAIL;
+    }
+
+    static const int s_levels[CC_ALG_COUNT] =
+    {
+        CC_PRECOMP_BR_LEVEL,
+        CC_PRECOMP_ZLIB_LEVEL,
+#ifdef USE_ZSTD
+        CC_PRECOMP_ZSTD_LEVEL,
+#endif
+    };
+    for (int alg = 0; alg < CC_ALG_COUNT; ++alg)
+    {
+        comp_cache_t *cache = compressCertMsg(alg, data, len, s_levels[alg]);
+        if (cache)
+            storeCache(set, alg, cache, true);
+    }
+    OPENSSL_free(data);
+    DEBUG_MESSAGE("[SSL_CTX:%p] Precompressed %zd bytes Certificate message\n",
+                  ctx, len);
+    return LS_OK;
+}
+
+
 void SslCertComp::enableCertComp(SSL_CTX *ctx)
 {
     if (s_activate_comp)
     {
         if (s_iSSL_CTX_index < 0)
             s_iSSL_CTX_index = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL, freeCtxData);
-        
-        if (!(SSL_CTX_add_cert_compression_alg(ctx, TLSEXT_cert_compression_brotli,
-                                               certCompressFuncBrotli, NULL)))
-            INFO_MESSAGE("[SSL_CTX:%p] Requested cert compression but unable to "
-                         "register Brotli\n", ctx);
-        else
+
+        // A context reconfigured in place keeps its algorithms, only the
+        // cached chain needs to follow the certificate.
+        if (!getCacheSet(ctx, false))
+        {
+            for (int alg = 0; alg < CC_ALG_COUNT; ++alg)
+            {
+                if (!(SSL_CTX_add_cert_compression_alg(ctx, s_algs[alg].m_id,
+                                                       s_algs[alg].m_compress,
+                                                       NULL)))
+                    INFO_MESSAGE("[SSL_CTX:%p] Requested cert compression but "
+                                 "unable to register %s\n", ctx,
+                                 s_alg_name[alg]);
+            }
+        }
+        if (precompute(ctx) == LS_OK)
             DEBUG_MESSAGE("[SSL_CTX:%p] Enabled Cert Compession\n", ctx);
     }
     else
@@ -397,10 +557,14 @@ void SslCertComp::enableCertDecomp(SSL_CTX *ctx)
         if (s_iSSL_CTX_index < 0)
             s_iSSL_CTX_index = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL, freeCtxData);
         
-        if (!(SSL_CTX_add_cert_compression_alg(ctx, TLSEXT_cert_compression_brotli,
-                                               NULL, certDecompressFuncBrotli)))
-            INFO_MESSAGE("[SSLCertComp] Requested cert decompression but unable to "
-                         "register Brotli\n");
+        for (int alg = 0; alg < CC_ALG_COUNT; ++alg)
+        {
+            if (!(SSL_CTX_add_cert_compression_alg(ctx, s_algs[alg].m_id,
+                                                   NULL,
+                                                   s_algs[alg].m_decompress)))
+                INFO_MESSAGE("[SSLCertComp] Requested cert decompression but "
+                             "unable to register %s\n", s_alg_name[alg]);
+        }
     }
     else
         DEBUG_MESSAGE("[SSLCertComp] Cert decompression not enabled\n");
@@ -36,12 +36,34 @@ class SslCertComp
     ~SslCertComp();
     
 public:
+    enum
+    {
+        CC_BROTLI,
+        CC_ZLIB,
+#ifdef USE_ZSTD
+        CC_ZSTD,
+#endif
+        CC_ALG_COUNT
+    };
+
+    // Certificate message variants kept per algorithm, the leaf may or may
+    // not carry OCSP/SCT extensions depending on what the client asked for.
+    // The precomputed message stays in CC_PINNED_SLOT.
+    enum { CC_PINNED_SLOT = 0, CC_SLOTS = 4 };
+
     typedef struct 
     {
+        uint64_t m_hash;
         int     m_input_len;
         int     m_len;
         uint8_t m_comp[1];
     } comp_cache_t;
+
+    typedef struct
+    {
+        comp_cache_t *m_entries[CC_ALG_COUNT][CC_SLOTS];
+        int           m_next[CC_ALG_COUNT];
+    } comp_cache_set_t;
     
     static void activateComp(bool activate);      
     static void activateDecomp(bool activate);
@@ -49,6 +71,7 @@ public:
     static void enableCertDecomp(SSL_CTX *ctx);
     static void disableCertCompDecomp(SSL_CTX *ctx);
     static void setBrCompressLevel(int level);
+    static int  precompute(SSL_CTX *ctx);
 
     LS_NO_COPY_ASSIGN(SslCertComp);
 };
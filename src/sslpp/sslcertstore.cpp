@@ -0,0 +1,409 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2022  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+
+#include <sslpp/sslcertstore.h>
+#include <sslpp/sslcontext.h>
+#include <sslpp/sslcontextconfig.h>
+#include <sslpp/sslutil.h>
+
+#include <log4cxx/logger.h>
+#include <shm/lsshm.h>
+#include <shm/lsshmhash.h>
+#include <shm/lsshmpool.h>
+#include <util/autobuf.h>
+#include <util/autostr.h>
+#include <util/datetime.h>
+
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define shmSsl          "SSL"
+#define shmSslCertDer   "SSLCertDer"
+
+// Do not retry a vhost with a broken certificate on every handshake.
+#define SSLCERTSTORE_RETRY_SECS     60
+
+#define SSLCERTSTORE_MAX_DER        (256 * 1024)
+
+
+typedef struct SslCertDer_s
+{
+    int64_t     x_iMtime;
+    int64_t     x_iSize;
+    int64_t     x_iIno;
+    int32_t     x_iCount;
+    uint32_t    x_iDataLen;
+    uint8_t     x_data[0];  // x_iCount times [uint32_t len][DER]
+} SslCertDer_t;
+
+
+/**
+ * An evicted SslContext may still be in use by established TLS and H2
+ * connections through the SSL_CTX references held by their SSL objects.
+ * The SslContext is handed over to its SSL_CTX (and the one of its ECC
+ * context) and deleted by the ex_data free callback once the last of them
+ * is released.
+ */
+typedef struct
+{
+    SslContext *m_pCtx;
+    int         m_iPending;
+} RetiredSslCtx_t;
+
+
+static int s_iRetiredIdx = -1;
+
+
+static void freeRetiredCtx(void *parent, void *ptr, CRYPTO_EX_DATA *ad,
+                           int idx, long argl, void *argp)
+{
+    RetiredSslCtx_t *pRetired = (RetiredSslCtx_t *)ptr;
+    if (!pRetired || --pRetired->m_iPending > 0)
+        return;
+    LS_DBG_L("[SSL] Release retired SslContext %p.", pRetired->m_pCtx);
+    delete pRetired->m_pCtx;
+    delete pRetired;
+}
+
+
+static void retireContext(SslContext *pCtx)
+{
+    SslContext *ctxs[2] = { pCtx, pCtx->getEccCtx() };
+    RetiredSslCtx_t *pRetired = NULL;
+    int i;
+
+    if (s_iRetiredIdx != -1)
+        pRetired = new RetiredSslCtx_t;
+    if (!pRetired)
+    {
+        delete pCtx;
+        return;
+    }
+    pRetired->m_pCtx = pCtx;
+    pRetired->m_iPending = 0;
+    for (i = 0; i < 2; ++i)
+    {
+        if (ctxs[i] && ctxs[i]->get() && ctxs[i]->get() != SSL_CTX_PENDING)
+        {
+            SSL_CTX_set_ex_data(ctxs[i]->get(), s_iRetiredIdx, pRetired);
+            ++pRetired->m_iPending;
+        }
+    }
+    if (pRetired->m_iPending == 0)
+    {
+        delete pRetired;
+        delete pCtx;
+        return;
+    }
+    // Drop the references of the SslContext itself, the last SSL_CTX_free()
+    // from a connection deletes it through freeRetiredCtx().
+    for (i = 0; i < 2; ++i)
+    {
+        if (ctxs[i] && ctxs[i]->get() && ctxs[i]->get() != SSL_CTX_PENDING)
+        {
+            SSL_CTX *pSslCtx = ctxs[i]->get();
+            ctxs[i]->retireStapling();
+            ctxs[i]->set(NULL);
+            SSL_CTX_free(pSslCtx);
+        }
+    }
+}
+
+
+class SslCertStoreEntry : public DLinkedObj
+{
+public:
+    SslCertStoreEntry(const char *pName, SslContext *pCtx)
+        : m_sName(pName)
+        , m_pCtx(pCtx)
+        , m_tmLastUse(DateTime::s_curTime)
+    {}
+    ~SslCertStoreEntry()
+    {
+        if (m_pCtx)
+            retireContext(m_pCtx);
+    }
+
+    AutoStr         m_sName;
+    SslContext     *m_pCtx;
+    time_t          m_tmLastUse;
+
+    LS_NO_COPY_ASSIGN(SslCertStoreEntry);
+};
+
+
+LS_SINGLETON(SslCertStore);
+
+
+SslCertStore::SslCertStore()
+    : m_iMaxContexts(0)
+    , m_iIdleSecs(LS_SSLCERTSTORE_IDLE_SECS)
+    , m_pDerStore(NULL)
+{
+}
+
+
+SslCertStore::~SslCertStore()
+{
+    m_entries.clear();
+    DLinkedObj *pObj;
+    while ((pObj = m_lru.pop_front()) != NULL)
+        delete (SslCertStoreEntry *)pObj;
+}
+
+
+int SslCertStore::init(int iMaxContexts, int iIdleSecs, int uid, int gid)
+{
+    LsShm *pShm;
+    LsShmPool *pPool;
+
+    m_iMaxContexts = iMaxContexts;
+    m_iIdleSecs = iIdleSecs;
+    if (s_iRetiredIdx == -1)
+        s_iRetiredIdx = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL,
+                                                 freeRetiredCtx);
+    if (m_pDerStore)
+        return LS_OK;
+    if ((pShm = LsShm::open(shmSsl, 0)) == NULL)
+        return LS_FAIL;
+    pShm->chperm(uid, gid, 0600);
+    if ((pPool = pShm->getGlobalPool()) == NULL)
+        return LS_FAIL;
+    m_pDerStore = pPool->getNamedHash(shmSslCertDer, 1000,
+                                      LsShmHash::hashXXH32, memcmp, 0);
+    if (!m_pDerStore)
+        return LS_FAIL;
+    m_pDerStore->disableAutoLock();
+    LS_INFO("[SSL] Lazy certificate loading enabled, keep up to %d contexts, "
+            "idle timeout %d seconds.", iMaxContexts, iIdleSecs);
+    return LS_OK;
+}
+
+
+SslContext *SslCertStore::get(const char *pName, SslContextConfig *pConfig)
+{
+    SslCertStoreEntry *pEntry = NULL;
+    HashStringMap<SslCertStoreEntry *>::iterator iter = m_entries.find(pName);
+    if (iter != m_entries.end())
+    {
+        pEntry = iter.second();
+        m_lru.remove(pEntry);
+        m_lru.append(pEntry);
+        if (pEntry->m_pCtx)
+        {
+            pEntry->m_tmLastUse = DateTime::s_curTime;
+            return pEntry->m_pCtx;
+        }
+        if (DateTime::s_curTime - pEntry->m_tmLastUse < SSLCERTSTORE_RETRY_SECS)
+            return NULL;
+    }
+
+    SslContext *pCtx = SslContext::config(NULL, pConfig);
+    LS_DBG_L("[SSL] Lazy load SslContext for [%s]: %p.", pName, pCtx);
+    if (!pCtx)
+        LS_ERROR("[SSL] Failed to load certificate for [%s], retry in %d "
+                 "seconds.", pName, SSLCERTSTORE_RETRY_SECS);
+
+    if (pEntry)
+    {
+        pEntry->m_pCtx = pCtx;
+        pEntry->m_tmLastUse = DateTime::s_curTime;
+        return pCtx;
+    }
+    pEntry = new SslCertStoreEntry(pName, pCtx);
+    m_entries.insert(pEntry->m_sName.c_str(), pEntry);
+    m_lru.append(pEntry);
+
+    while (m_lru.size() > m_iMaxContexts)
+        evict((SslCertStoreEntry *)m_lru.begin());
+    return pCtx;
+}
+
+
+void SslCertStore::remove(const char *pName)
+{
+    HashStringMap<SslCertStoreEntry *>::iterator iter = m_entries.find(pName);
+    if (iter != m_entries.end())
+        evict(iter.second());
+}
+
+
+void SslCertStore::evict(SslCertStoreEntry *pEntry)
+{
+    LS_DBG_L("[SSL] Evict SslContext %p of [%s], idle %ld seconds.",
+             pEntry->m_pCtx, pEntry->m_sName.c_str(),
+             (long)(DateTime::s_curTime - pEntry->m_tmLastUse));
+    m_entries.remove(pEntry->m_sName.c_str());
+    m_lru.remove(pEntry);
+    delete pEntry;
+}
+
+
+void SslCertStore::onTimer()
+{
+    SslCertStoreEntry *pEntry;
+    while (!m_lru.empty())
+    {
+        pEntry = (SslCertStoreEntry *)m_lru.begin();
+        if (DateTime::s_curTime - pEntry->m_tmLastUse < m_iIdleSecs)
+            break;
+        evict(pEntry);
+    }
+}
+
+
+static int isDerStale(const SslCertDer_t *pDer, const struct stat &st)
+{
+    return (pDer->x_iMtime != (int64_t)st.st_mtime
+            || pDer->x_iSize != (int64_t)st.st_size
+            || pDer->x_iIno != (int64_t)st.st_ino);
+}
+
+
+static int useCertDer(SSL_CTX *pCtx, const SslCertDer_t *pDer)
+{
+    const uint8_t *p = pDer->x_data;
+    const uint8_t *pEnd = p + pDer->x_iDataLen;
+    X509 *x509;
+    uint32_t len;
+    unsigned int digestlen;
+    unsigned char digest[EVP_MAX_MD_SIZE];
+
+    SSL_CTX_clear_extra_chain_certs(pCtx);
+    for (int i = 0; i < pDer->x_iCount; ++i)
+    {
+        if (p + sizeof(len) > pEnd)
+            return 0;
+        memcpy(&len, p, sizeof(len));
+        p += sizeof(len);
+        if (p + len > pEnd)
+            return 0;
+        const uint8_t *pCert = p;
+        x509 = d2i_X509(NULL, &pCert, len);
+        p += len;
+        if (!x509)
+            return 0;
+        if (i == 0)
+        {
+            int ret = SSL_CTX_use_certificate(pCtx, x509);
+            if (ret == 1)
+            {
+                if (X509_digest(x509, EVP_sha1(), digest, &digestlen) == 0)
+                    LS_DBG_L("Creating cert digest failed");
+                else if (SslUtil::digestIdContext(pCtx, digest, digestlen)
+                         != LS_OK)
+                    LS_DBG_L("Digest id context failed");
+            }
+            X509_free(x509);
+            if (ret != 1)
+                return 0;
+        }
+        else if (!SSL_CTX_add_extra_chain_cert(pCtx, x509))
+        {
+            X509_free(x509);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+int SslCertStore::loadCertDer(SSL_CTX *pCtx, const char *pFile)
+{
+    struct stat st;
+    int valLen, ret = -1;
+    LsShmOffset_t offset;
+
+    if (!m_pDerStore || stat(pFile, &st) == -1)
+        return -1;
+    m_pDerStore->lock();
+    offset = m_pDerStore->find(pFile, strlen(pFile), &valLen);
+    if (offset != 0)
+    {
+        SslCertDer_t *pDer = (SslCertDer_t *)m_pDerStore->offset2ptr(offset);
+        if (!isDerStale(pDer, st)
+            && (int)(sizeof(*pDer) + pDer->x_iDataLen) <= valLen)
+        {
+            ret = useCertDer(pCtx, pDer);
+            LS_DBG_L("[SSL] Load certificate %s from SHM DER cache: %d.",
+                     pFile, ret);
+        }
+    }
+    m_pDerStore->unlock();
+    return ret;
+}
+
+
+static int appendDer(AutoBuf *pBuf, X509 *x509)
+{
+    int len = i2d_X509(x509, NULL);
+    if (len <= 0 || pBuf->size() + len + 4 > SSLCERTSTORE_MAX_DER)
+        return LS_FAIL;
+    uint32_t len32 = len;
+    pBuf->append((const char *)&len32, sizeof(len32));
+    if (pBuf->appendAllocOnly(len) == -1)
+        return LS_FAIL;
+    unsigned char *p = (unsigned char *)pBuf->end() - len;
+    i2d_X509(x509, &p);
+    return LS_OK;
+}
+
+
+int SslCertStore::saveCertDer(SSL_CTX *pCtx, const char *pFile)
+{
+    struct stat st;
+    X509 *pLeaf;
+    STACK_OF(X509) *pChain = NULL;
+    SslCertDer_t header;
+
+    if (!m_pDerStore || stat(pFile, &st) == -1)
+        return LS_FAIL;
+    if ((pLeaf = SSL_CTX_get0_certificate(pCtx)) == NULL)
+        return LS_FAIL;
+    SSL_CTX_get_extra_chain_certs(pCtx, &pChain);
+
+    AutoBuf buf(4096);
+    memset(&header, 0, sizeof(header));
+    buf.append((const char *)&header, sizeof(header));
+    if (appendDer(&buf, pLeaf) != LS_OK)
+        return LS_FAIL;
+    header.x_iCount = 1;
+    for (int i = 0; pChain && i < (int)sk_X509_num(pChain); ++i)
+    {
+        if (appendDer(&buf, sk_X509_value(pChain, i)) != LS_OK)
+            return LS_FAIL;
+        ++header.x_iCount;
+    }
+    header.x_iMtime = st.st_mtime;
+    header.x_iSize = st.st_size;
+    header.x_iIno = st.st_ino;
+    header.x_iDataLen = buf.size() - sizeof(header);
+    memcpy(buf.begin(), &header, sizeof(header));
+
+    m_pDerStore->lock();
+    LsShmOffset_t offset = m_pDerStore->set(pFile, strlen(pFile),
+                                            buf.begin(), buf.size());
+    m_pDerStore->unlock();
+    LS_DBG_L("[SSL] Save certificate %s to SHM DER cache, %d certs, %d bytes.",
+             pFile, header.x_iCount, buf.size());
+    return offset ? LS_OK : LS_FAIL;
+}
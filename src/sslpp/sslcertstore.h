@@ -0,0 +1,85 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2022  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+
+#ifndef SSLCERTSTORE_H
+#define SSLCERTSTORE_H
+
+#include <lsdef.h>
+#include <util/dlinkqueue.h>
+#include <util/hashstringmap.h>
+#include <util/tsingleton.h>
+
+#define LS_SSLCERTSTORE_DEFAULTSIZE   1000
+#define LS_SSLCERTSTORE_IDLE_SECS     300
+
+class LsShmHash;
+class SslContext;
+class SslContextConfig;
+class SslCertStoreEntry;
+typedef struct ssl_ctx_st SSL_CTX;
+
+/**
+ * SslCertStore keeps the SslContext of virtual hosts configured for lazy
+ * loading. A context is built on the first handshake for one of the names
+ * of the virtual host and kept in a bounded LRU list, cold contexts are
+ * evicted and rebuilt when needed again.
+ *
+ * The parsed certificate chain is also shared between workers in SHM as
+ * DER, so only the first worker pays for the PEM decoding of a file.
+ * Private keys are never put in SHM.
+ */
+class SslCertStore : public TSingleton<SslCertStore>
+{
+    friend class TSingleton<SslCertStore>;
+
+public:
+    int  init(int iMaxContexts, int iIdleSecs, int uid, int gid);
+    int  isEnabled() const              {   return m_iMaxContexts > 0;  }
+
+    SslContext *get(const char *pName, SslContextConfig *pConfig);
+    void remove(const char *pName);
+    void onTimer();
+
+    /**
+     * Load the certificate and chain of pFile from the SHM DER cache.
+     * return: -1 if not cached or stale, 0 on fail, 1 on success.
+     */
+    int  loadCertDer(SSL_CTX *pCtx, const char *pFile);
+    int  saveCertDer(SSL_CTX *pCtx, const char *pFile);
+
+    int  getCount() const               {   return m_lru.size();        }
+    int  getMaxContexts() const         {   return m_iMaxContexts;      }
+
+private:
+    SslCertStore();
+    ~SslCertStore();
+
+    void evict(SslCertStoreEntry *pEntry);
+
+    int                              m_iMaxContexts;
+    int                              m_iIdleSecs;
+    LsShmHash                       *m_pDerStore;
+    HashStringMap<SslCertStoreEntry *> m_entries;
+    DLinkQueue                       m_lru;
+
+    LS_NO_COPY_ASSIGN(SslCertStore);
+};
+
+LS_SINGLETON_DECL(SslCertStore);
+
+#endif // SSLCERTSTORE_H
@@ -693,6 +693,20 @@ bool SslConnection::verifyContext(SslContext *ctx)
 }
 
 
+/**
+ * A request read before the client Finished message was sent as TLS 1.3
+ * early data, and may be a replay.
+ */
+int SslConnection::isEarlyData() const
+{
+#ifdef OPENSSL_IS_BORINGSSL
+    return m_ssl && SSL_in_early_data(m_ssl);
+#else
+    return 0;
+#endif
+}
+
+
 char* SslConnection::getRawBuffer(int *len)
 {
     DEBUG_MESSAGE("[SSL: %p] getRawBuffer: len: %d\n", this,
@@ -108,6 +108,7 @@ public:
 
     virtual int getEnv(HioCrypto::ENV id, char *&val,int maxValLen);
     virtual bool verifyContext(SslContext *ctx);
+    virtual int  isEarlyData() const;
 
     const char *getCipherName() const;
 
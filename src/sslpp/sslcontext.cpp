@@ -24,6 +24,7 @@
 #include <sslpp/sslcontextconfig.h>
 #include <sslpp/sslasyncpk.h>
 #include <sslpp/sslcertcomp.h>
+#include <sslpp/sslearlydata.h>
 
 #include <log4cxx/logger.h>
 #include <util/stringtool.h>
@@ -485,6 +486,14 @@ int SslContext::configOptions(SslContextConfig *pConfig)
 }
 
 
+// Called before the SSL_CTX is freed, the stapling goes with the SslContext.
+void SslContext::retireStapling()
+{
+    if (m_pStapling)
+        m_pStapling->retire();
+}
+
+
 int SslContext::configStapling(const char *name, int max_age,
                                const char *responder)
 {
@@ -1187,6 +1196,16 @@ static enum ssl_select_cert_result_t select_cert_cb(const SSL_CLIENT_HELLO *cli_
 
     if (!ssl)
         return ssl_select_cert_success;
+    if (SslEarlyData::isEnabled())
+    {
+        const uint8_t *pExt;
+        size_t extLen;
+        if (SSL_early_callback_ctx_extension_get(cli_hello,
+                TLSEXT_TYPE_early_data, &pExt, &extLen)
+            && !SslEarlyData::checkReplay(cli_hello->random,
+                                          cli_hello->random_len))
+            SSL_set_early_data_enabled(ssl, 0);
+    }
     int ecdsa = SslUtil::isEcdsaSupported(cli_hello->cipher_suites,
                                           cli_hello->cipher_suites_len);
     if (ecdsa)
@@ -1276,6 +1295,11 @@ int SslContext::initSNI(void *param)
 {
     assert(s_sniLookup != NULL);
     SSL_CTX_set_cert_cb(m_pCtx, servername_cb, param);
+    if (SslEarlyData::isEnabled())
+    {
+        SslEarlyData::enable(m_pCtx);
+        SSL_CTX_set_select_certificate_cb(m_pCtx, select_cert_cb);
+    }
     return 0;
 }
 
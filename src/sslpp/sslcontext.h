@@ -134,6 +134,7 @@ public:
     void setOcspStapling(int v)     {   m_iEnableOcsp = v;      }
     char getOcspStapling() const    {   return m_iEnableOcsp;   }
     int  configStapling(const char *name, int max_age, const char *responder);
+    void retireStapling();
 
     int selectCert(SSL *pSSL, const char *name, const void *cli_hello);
     SslContext *getEccCtx() const   {   return m_pEccCtx;       }
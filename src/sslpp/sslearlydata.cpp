@@ -0,0 +1,110 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2022  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+
+#include <sslpp/sslearlydata.h>
+
+#include <log4cxx/logger.h>
+#include <shm/lsshm.h>
+#include <shm/lsshmhash.h>
+#include <shm/lsshmpool.h>
+#include <util/datetime.h>
+
+#include <openssl/ssl.h>
+
+#include <string.h>
+
+#define shmSsl              "SSL"
+#define shmSslEarlyData     "SSLEarlyData"
+
+
+LsShmHash *SslEarlyData::s_pReplayStore = NULL;
+int        SslEarlyData::s_iNumNew = 0;
+
+
+int SslEarlyData::init(int uid, int gid)
+{
+    LsShm *pShm;
+    LsShmPool *pPool;
+
+    if (s_pReplayStore)
+        return LS_OK;
+    if ((pShm = LsShm::open(shmSsl, 0)) == NULL)
+        return LS_FAIL;
+    pShm->chperm(uid, gid, 0600);
+    if ((pPool = pShm->getGlobalPool()) == NULL)
+        return LS_FAIL;
+    s_pReplayStore = pPool->getNamedHash(shmSslEarlyData, 10000,
+                                         LsShmHash::hashXXH32, memcmp,
+                                         LSSHM_FLAG_LRU);
+    if (!s_pReplayStore)
+        return LS_FAIL;
+    s_pReplayStore->disableAutoLock();
+    LS_INFO("[SSL] TLS 1.3 early data enabled, anti-replay window %d seconds.",
+            LS_SSLEARLYDATA_WINDOW);
+    return LS_OK;
+}
+
+
+void SslEarlyData::enable(SSL_CTX *pCtx)
+{
+#ifdef OPENSSL_IS_BORINGSSL
+    if (isEnabled())
+        SSL_CTX_set_early_data_enabled(pCtx, 1);
+#endif
+}
+
+
+int SslEarlyData::checkReplay(const unsigned char *pRandom, int len)
+{
+    int valLen, ret = 0;
+    int32_t tmSeen = DateTime::s_curTime;
+    LsShmHash::iteroffset iterOff;
+    ls_strpair_t parms;
+
+    if (!s_pReplayStore)
+        return 0;
+    if (!(++s_iNumNew % 0x400))
+        flush();
+
+    s_pReplayStore->lock();
+    if (s_pReplayStore->find(pRandom, len, &valLen) == 0)
+    {
+        iterOff = s_pReplayStore->insertIterator(
+            s_pReplayStore->setParms(&parms, pRandom, len, &tmSeen,
+                                     sizeof(tmSeen)));
+        if (iterOff.m_iOffset != 0)
+        {
+            s_pReplayStore->linkMvTopTime(iterOff, tmSeen);
+            ret = 1;
+        }
+    }
+    s_pReplayStore->unlock();
+    if (!ret)
+        LS_DBG_L("[SSL] Reject early data of a replayed or unrecorded "
+                 "ClientHello.");
+    return ret;
+}
+
+
+void SslEarlyData::flush()
+{
+    s_pReplayStore->lock();
+    s_pReplayStore->trim(DateTime::s_curTime - LS_SSLEARLYDATA_WINDOW,
+                         NULL, NULL);
+    s_pReplayStore->unlock();
+}
@@ -0,0 +1,65 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2022  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+
+#ifndef SSLEARLYDATA_H
+#define SSLEARLYDATA_H
+
+#include <lsdef.h>
+
+class LsShmHash;
+typedef struct ssl_st SSL;
+typedef struct ssl_ctx_st SSL_CTX;
+
+// BoringSSL rejects 0-RTT data with a ticket age skew larger than 60
+// seconds, a replayed ClientHello cannot be accepted after that.
+#define LS_SSLEARLYDATA_WINDOW      120
+
+/**
+ * SslEarlyData accepts TLS 1.3 0-RTT data on server side listeners.
+ *
+ * Early data can be replayed by an attacker, every ClientHello offering
+ * early data is recorded in SHM keyed by its client random, a ClientHello
+ * seen before by any worker gets a full handshake instead. Only requests
+ * with a safe method and no body are served before the handshake has
+ * completed, others are answered with "425 Too Early".
+ */
+class SslEarlyData
+{
+    static LsShmHash  *s_pReplayStore;
+    static int         s_iNumNew;
+
+    SslEarlyData();
+    ~SslEarlyData();
+    SslEarlyData(const SslEarlyData &rhs);
+    void *operator=(const SslEarlyData &rhs);
+
+public:
+    static int  init(int uid, int gid);
+    static inline int isEnabled()       {   return s_pReplayStore != NULL;  }
+
+    static void enable(SSL_CTX *pCtx);
+
+    /**
+     * Record the client random of a ClientHello offering early data.
+     * return: 1 if first seen, 0 if it is a replay or cannot be recorded.
+     */
+    static int  checkReplay(const unsigned char *pRandom, int len);
+    static void flush();
+};
+
+#endif // SSLEARLYDATA_H
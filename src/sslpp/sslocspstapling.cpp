@@ -20,7 +20,12 @@
 #include <log4cxx/logger.h>
 #include <sslpp/sslerror.h>
 #include <sslpp/sslcontext.h>
+#include <shm/lsshm.h>
+#include <shm/lsshmhash.h>
+#include <shm/lsshmpool.h>
+#include <util/autobuf.h>
 #include <util/datetime.h>
+#include <util/dlinkqueue.h>
 #include <util/httpfetch.h>
 #include <util/stringtool.h>
 #include <util/vmembuf.h>
@@ -51,12 +56,36 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 
+#define shmSsl          "SSL"
+#define shmSslOcspResp  "SSLOcspResp"
+
+// A worker holding the fetch lease longer than this is considered gone.
+#define OCSP_FETCH_LEASE_SECS   60
+// Back off after a failed fetch before another worker tries again.
+#define OCSP_FETCH_RETRY_SECS   60
+
+
+typedef struct OcspShmResp_s
+{
+    int64_t     x_tmResp;
+    int64_t     x_tmNextUpdate;
+    int64_t     x_tmRefresh;
+    int64_t     x_tmFetchStart;
+    int32_t     x_iFetchPid;
+    uint32_t    x_iDataLen;
+    uint8_t     x_data[0];
+} OcspShmResp_t;
+
+
 static char * s_pOcspCachePath = NULL;
+LsShmHash *SslOcspStapling::s_pRespStore = NULL;
+static DLinkQueue s_staplings;
 
 void SslOcspStapling::setCachePath(const char *pPath)
 {
@@ -149,6 +178,13 @@ int SslOcspStapling::processResponse(HttpFetch *pHttpFetch)
     struct stat        st;
     const char          *pRespContentType;
     //assert( pHttpFetch == m_pHttpFetch );
+    if (!m_pCtx->get())
+    {
+        //retired while the request was out
+        releaseShmLease(0);
+        pHttpFetch->releaseResult();
+        return 0;
+    }
     int istatusCode = m_pHttpFetch->getStatusCode() ;
     pRespContentType = m_pHttpFetch->getRespContentType();
     if (istatusCode == 200 && pRespContentType != NULL
@@ -156,9 +192,12 @@ int SslOcspStapling::processResponse(HttpFetch *pHttpFetch)
     {
         if (verifyRespFile(1) != 0)
         {
+            releaseShmLease(OCSP_FETCH_RETRY_SECS);
             m_pCtx->disableOscp();
             m_RespTime = UINT_MAX;
         }
+        else
+            publishShmResp();
     }
     else
     {
@@ -169,6 +208,7 @@ int SslOcspStapling::processResponse(HttpFetch *pHttpFetch)
                       ((pRespContentType) ? (pRespContentType) : ("")));
         //printf("%s\n", s_ErrMsg.c_str());
         m_pHttpFetch->writeLog(s_ErrMsg.c_str());
+        releaseShmLease(OCSP_FETCH_RETRY_SECS);
         m_pCtx->disableOscp();
         m_RespTime = UINT_MAX;
     }
@@ -192,10 +232,12 @@ SslOcspStapling::SslOcspStapling()
     , m_nextUpdate(0)
     , m_pCertId(NULL)
 {
+    memset(m_certIdMd5, 0, sizeof(m_certIdMd5));
 }
 
 SslOcspStapling::~SslOcspStapling()
 {
+    s_staplings.remove(this);
     releaseRespData();
     if (m_pHttpFetch != NULL)
         delete m_pHttpFetch;
@@ -219,6 +261,8 @@ int SslOcspStapling::init(SslContext *pSslCtx)
     {
         iResult = 0;
         certIdToOcspRespFileName();
+        if (s_pRespStore)
+            s_staplings.append(this);
         //update();
         const ASN1_TIME *not_before;
 #if OPENSSL_VERSION_NUMBER >= 0x10100000L || defined(OPENSSL_IS_BORINGSSL)
@@ -237,6 +281,8 @@ int SslOcspStapling::update()
     struct stat st;
     if (m_RespTime == UINT_MAX)
         return 0;
+    if (s_pRespStore)
+        return updateFromShm();
     //NOTE: test code , to test clearing out expired OCSP response
     //if (m_pRespData && m_statTime + 10 <= DateTime::s_curTime)
     //    m_nextUpdate = DateTime::s_curTime;
@@ -293,6 +339,232 @@ TRY_CREATE_REQ:
 }
 
 
+int SslOcspStapling::initShm(int uid, int gid)
+{
+    LsShm *pShm;
+    LsShmPool *pPool;
+
+    if (s_pRespStore)
+        return LS_OK;
+    if ((pShm = LsShm::open(shmSsl, 0)) == NULL)
+        return LS_FAIL;
+    pShm->chperm(uid, gid, 0600);
+    if ((pPool = pShm->getGlobalPool()) == NULL)
+        return LS_FAIL;
+    s_pRespStore = pPool->getNamedHash(shmSslOcspResp, 100,
+                                       LsShmHash::hashXXH32, memcmp, 0);
+    if (!s_pRespStore)
+        return LS_FAIL;
+    s_pRespStore->disableAutoLock();
+    return LS_OK;
+}
+
+
+/**
+ * The SSL_CTX is freed when its SslContext is retired, the response is not
+ * refreshed any more.
+ */
+void SslOcspStapling::retire()
+{
+    s_staplings.remove(this);
+    m_RespTime = UINT_MAX;
+}
+
+
+void SslOcspStapling::onTimer()
+{
+    DLinkedObj *pObj = s_staplings.begin();
+    while (pObj != s_staplings.end())
+    {
+        ((SslOcspStapling *)pObj)->update();
+        pObj = pObj->next();
+    }
+}
+
+
+int SslOcspStapling::useRespData(const unsigned char *pData, int len)
+{
+    if (len <= 0)
+        return -1;
+    releaseRespData();
+    m_pRespData = new unsigned char[len];
+    memcpy(m_pRespData, pData, len);
+    m_iDataLen = len;
+#ifdef OPENSSL_IS_BORINGSSL
+    if (m_pCtx)
+        SSL_CTX_set_ocsp_response(m_pCtx->get(), m_pRespData, m_iDataLen);
+#endif
+    return 0;
+}
+
+
+/**
+ * Copy a newer response published by another worker, the response has
+ * been verified by the worker fetched it.
+ * return: 1 if this process has taken the fetch lease, 0 otherwise.
+ */
+int SslOcspStapling::loadShmResp()
+{
+    int valLen, fetch = 0;
+    LsShmOffset_t offset;
+    OcspShmResp_t *pResp;
+    time_t now = DateTime::s_curTime;
+
+    s_pRespStore->lock();
+    offset = s_pRespStore->find(m_certIdMd5, sizeof(m_certIdMd5), &valLen);
+    if (offset == 0)
+    {
+        OcspShmResp_t resp;
+        memset(&resp, 0, sizeof(resp));
+        offset = s_pRespStore->insert(m_certIdMd5, sizeof(m_certIdMd5),
+                                      &resp, sizeof(resp));
+        if (offset == 0)
+        {
+            s_pRespStore->unlock();
+            return 1;
+        }
+        valLen = sizeof(resp);
+    }
+    pResp = (OcspShmResp_t *)s_pRespStore->offset2ptr(offset);
+    if (pResp->x_iDataLen > 0 && pResp->x_tmResp != m_RespTime
+        && pResp->x_tmNextUpdate > now
+        && (int)(sizeof(*pResp) + pResp->x_iDataLen) <= valLen
+        && useRespData(pResp->x_data, pResp->x_iDataLen) == 0)
+    {
+        m_RespTime = pResp->x_tmResp;
+        m_nextUpdate = pResp->x_tmNextUpdate;
+        LS_DBG("[OCSP] %s: Use OCSP response from SHM, expire: %ld, "
+               "refresh: %ld.\n", m_sRespfile.c_str(), (long)m_nextUpdate,
+               (long)pResp->x_tmRefresh);
+    }
+    if (now >= pResp->x_tmRefresh
+        && (pResp->x_iFetchPid == 0
+            || now - pResp->x_tmFetchStart >= OCSP_FETCH_LEASE_SECS))
+    {
+        pResp->x_iFetchPid = getpid();
+        pResp->x_tmFetchStart = now;
+        fetch = 1;
+    }
+    s_pRespStore->unlock();
+    return fetch;
+}
+
+
+void SslOcspStapling::publishShmResp()
+{
+    OcspShmResp_t header;
+    time_t now = DateTime::s_curTime;
+    time_t life;
+
+    if (!s_pRespStore || !m_pRespData || m_iDataLen <= 0)
+        return;
+    if (m_nextUpdate <= now)
+        m_nextUpdate = now + m_iocspRespMaxAge;
+    life = m_nextUpdate - now;
+    if (life > m_iocspRespMaxAge)
+        life = m_iocspRespMaxAge;
+
+    // Refresh at 50% to 75% of the remaining lifetime, spread the fetches
+    // of certificates loaded at the same time.
+    memset(&header, 0, sizeof(header));
+    header.x_tmResp = m_RespTime;
+    header.x_tmNextUpdate = m_nextUpdate;
+    header.x_tmRefresh = now + life / 2;
+    if (life >= 4)
+        header.x_tmRefresh += random() % (life / 4);
+    header.x_iDataLen = m_iDataLen;
+
+    AutoBuf buf(sizeof(header) + m_iDataLen);
+    buf.append((const char *)&header, sizeof(header));
+    buf.append((const char *)m_pRespData, m_iDataLen);
+    s_pRespStore->lock();
+    LsShmOffset_t offset = s_pRespStore->set(m_certIdMd5, sizeof(m_certIdMd5),
+                                             buf.begin(), buf.size());
+    s_pRespStore->unlock();
+    LS_DBG("[OCSP] %s: Publish OCSP response to SHM: %s, expire: %ld, "
+           "refresh: %ld.\n", m_sRespfile.c_str(), offset ? "succeed" : "fail",
+           (long)header.x_tmNextUpdate, (long)header.x_tmRefresh);
+}
+
+
+void SslOcspStapling::releaseShmLease(int iRetrySecs)
+{
+    int valLen;
+    LsShmOffset_t offset;
+    OcspShmResp_t *pResp;
+
+    if (!s_pRespStore)
+        return;
+    s_pRespStore->lock();
+    offset = s_pRespStore->find(m_certIdMd5, sizeof(m_certIdMd5), &valLen);
+    if (offset != 0)
+    {
+        pResp = (OcspShmResp_t *)s_pRespStore->offset2ptr(offset);
+        if (pResp->x_iFetchPid == getpid())
+        {
+            pResp->x_iFetchPid = 0;
+            pResp->x_tmRefresh = DateTime::s_curTime + iRetrySecs;
+        }
+    }
+    s_pRespStore->unlock();
+}
+
+
+/**
+ * Take over the response file cached by a previous server instance.
+ * return: 0 if a valid response has been loaded.
+ */
+int SslOcspStapling::loadRespFile()
+{
+    struct stat st;
+    if (::stat(m_sRespfile.c_str(), &st) != 0)
+        return -1;
+    if (st.st_mtime + m_iocspRespMaxAge < DateTime::s_curTime)
+    {
+        unlink(m_sRespfile.c_str());
+        return -1;
+    }
+    if (verifyRespFile(0) != LS_OK)
+        return -1;
+    m_RespTime = st.st_mtime;
+    return 0;
+}
+
+
+int SslOcspStapling::updateFromShm()
+{
+    int ret;
+    struct stat st;
+
+    if (m_statTime == DateTime::s_curTime)
+        return 0;
+    m_statTime = DateTime::s_curTime;
+
+    int fetch = loadShmResp();
+    if (m_pRespData && m_nextUpdate <= DateTime::s_curTime)
+    {
+        LS_DBG("[OCSP] %s: OCSP response expired, cur: %ld, expire: %ld.\n",
+               m_sRespfile.c_str(), DateTime::s_curTime, m_nextUpdate);
+        releaseRespData();
+    }
+    if (!fetch)
+        return 0;
+
+    if (m_RespTime == 0 && loadRespFile() == 0)
+    {
+        publishShmResp();
+        return 0;
+    }
+
+    ret = ::stat(m_sRespfileTmp.c_str(), &st);
+    if (ret == 0)
+        unlink(m_sRespfileTmp.c_str());
+    if (createRequest() != 0)
+        releaseShmLease(OCSP_FETCH_RETRY_SECS);
+    return 0;
+}
+
+
 int SslOcspStapling::getResponder(X509 *pCert)
 {
     char                    *pUrl;
@@ -740,6 +1012,7 @@ void SslOcspStapling::certIdToOcspRespFileName()
         MD5_Update(&ctx, m_pCertId->serialNumber->data,
                   m_pCertId->serialNumber->length);
     MD5_Final(md5, &ctx);
+    memcpy(m_certIdMd5, md5, sizeof(m_certIdMd5));
     StringTool::hexEncode((const char *)md5, 16, md5Str);
     md5Str[32] = 0;
 
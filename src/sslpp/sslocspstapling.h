@@ -21,10 +21,12 @@
 #define SSLOCSPSTAPLING_H
 #include <socket/gsockaddr.h>
 #include <util/autostr.h>
+#include <util/linkedobj.h>
 #include <time.h>
 
 class SslContext;
 class HttpFetch;
+class LsShmHash;
 
 typedef struct asn1_string_st ASN1_TIME;
 typedef struct ocsp_basic_response_st OCSP_BASICRESP;
@@ -35,7 +37,14 @@ typedef struct ssl_ctx_st SSL_CTX;
 typedef struct x509_st X509;
 typedef struct x509_store_st X509_STORE;
 
-class SslOcspStapling
+/**
+ * When the SHM response store is available, verified OCSP responses are
+ * shared between workers in SHM keyed by the MD5 of the cert ID. Only the
+ * worker holding the fetch lease of a cert ID talks to the responder, it
+ * refreshes the response well before nextUpdate at a jittered time, all
+ * other workers only copy the published DER.
+ */
+class SslOcspStapling : public DLinkedObj
 {
 public:
     SslOcspStapling();
@@ -47,6 +56,7 @@ public:
     int getResponder(X509 *pCert);
     int callback(SSL *ssl);
     int processResponse(HttpFetch *pHttpFetch);
+    void retire();
     int verifyRespFile(int is_new_resp);
     int certVerify(OCSP_RESPONSE *pResponse, OCSP_BASICRESP *pBasicResp,
                    X509_STORE *pXstore);
@@ -63,8 +73,17 @@ public:
     static void setCachePath(const char *pPath);
     static const char *getCachePath();
     static int setProxy(const char *pProxyAddrStr);
+    static int initShm(int uid, int gid);
+    static void onTimer();
 
 private:
+    int  updateFromShm();
+    int  loadShmResp();
+    void publishShmResp();
+    void releaseShmLease(int iRetrySecs);
+    int  useRespData(const unsigned char *pData, int len);
+    int  loadRespFile();
+
     HttpFetch      *m_pHttpFetch;
 
     unsigned char  *m_pReqData;
@@ -83,7 +102,9 @@ private:
     time_t          m_statTime;
     time_t          m_nextUpdate;
     OCSP_CERTID    *m_pCertId;
+    unsigned char   m_certIdMd5[16];
     static const struct sockaddr *s_proxy_addr;
+    static LsShmHash *s_pRespStore;
 
 };
 
@@ -20,6 +20,7 @@
 #include <openssl/err.h>
 #endif
 #include "sslutil.h"
+#include <sslpp/sslcertstore.h>
 #include <sslpp/sslcontext.h>
 #include <sslpp/sslconnection.h>
 #include <sslpp/sslsesscache.h>
@@ -544,11 +545,19 @@ int SslUtil::loadCertFile(SSL_CTX *pCtx, const char *pFile, int type)
     if (translateType(type) == SSL_FILETYPE_ASN1)
         return -1;
 
+    SslCertStore &store = SslCertStore::getInstance();
+    int ret = store.loadCertDer(pCtx, pFile);
+    if (ret != -1)
+        return ret;
+
     len = loadPemWithMissingDash(pFile, buf, SSLUTIL_MAX_CERT_LENGTH, &pBegin);
     if (len == -1)
         return -1;
 
-    return loadCert(pCtx, pBegin, len, 1);
+    ret = loadCert(pCtx, pBegin, len, 1);
+    if (ret == 1)
+        store.saveCertDer(pCtx, pFile);
+    return ret;
 }
 
 int SslUtil::loadPrivateKeyFile(SSL_CTX *pCtx, const char *pFile, int type)
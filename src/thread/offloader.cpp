@@ -52,6 +52,8 @@ public:
 
     int startProcessor(int workers = 1);
 
+    int setMaxWorkers(int workers);
+
     int addJob(ls_offload *task, LogSession *log_sess);
 
     int onNotified(int count);
@@ -132,6 +134,21 @@ int Offloader::startProcessor(int workers)
 }
 
 
+int Offloader::setMaxWorkers(int workers)
+{
+    if (workers < m_crew->minIdle())
+        workers = m_crew->minIdle();
+    if (workers == m_crew->maxWorkers())
+        return workers;
+    LS_DBG_L("[%s] Offloader::setMaxWorkers: %d -> %d.\n", get_log_id(),
+             m_crew->maxWorkers(), workers);
+    if (m_crew->maxIdle() > workers)
+        m_crew->adjustIdle(m_crew->minIdle(), workers);
+    m_crew->maxWorkers(workers);
+    return workers;
+}
+
+
 int Offloader::start(Multiplexer *pMplx, int workers)
 {
     if (initNotifier(pMplx) == -1)
@@ -194,3 +211,15 @@ int offloader_enqueue(struct Offloader * offload, ls_offload *task, void *log_se
     return offload->addJob(task, (LogSession *)log_sess);
 }
 
+
+int offloader_set_max_workers(struct Offloader *offload, int workers)
+{
+    return offload->setMaxWorkers(workers);
+}
+
+
+int offloader_get_workers(struct Offloader *offload)
+{
+    return offload->m_crew->size();
+}
+
@@ -18,20 +18,25 @@
 #include <util/compressor.h>
 #include <util/vmembuf.h>
 
+#include <lsr/ls_atomic.h>
 #include <lsr/ls_fileio.h>
 
 #include <fcntl.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 
 #define DEFAULT_FLUSH_WINDOW    2048
 
+CompressStats Compressor::s_stats[Compressor::STATS_COUNT];
+
 Compressor::Compressor()
     : m_iLastFlush(0)
     , m_iFlushWindowSize(DEFAULT_FLUSH_WINDOW)
     , m_iType(0)
     , m_iStreamStarted(0)
+    , m_iNoStats(0)
     , m_pCompressCache(0)
 {
 }
@@ -85,4 +90,26 @@ int Compressor::processFile(int type, const char *pFileName,
 }
 
 
+void Compressor::addStats(int slot, int64_t in, int64_t out, int64_t usec)
+{
+    CompressStats *pStats = &s_stats[slot];
+    ls_atomic_add(&pStats->m_lBytesIn, in);
+    ls_atomic_add(&pStats->m_lBytesOut, out);
+    ls_atomic_add(&pStats->m_lUsec, usec);
+}
+
+
+void Compressor::getStats(int slot, CompressStats *pStats)
+{
+    pStats->m_lBytesIn = ls_atomic_value(&s_stats[slot].m_lBytesIn);
+    pStats->m_lBytesOut = ls_atomic_value(&s_stats[slot].m_lBytesOut);
+    pStats->m_lUsec = ls_atomic_value(&s_stats[slot].m_lUsec);
+}
+
 
+int64_t Compressor::getUsecNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
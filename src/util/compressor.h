@@ -23,6 +23,15 @@
 
 class VMemBuf;
 
+// Compression work done by a process, the offloader threads add to it too.
+struct CompressStats
+{
+    int64_t     m_lBytesIn;
+    int64_t     m_lBytesOut;
+    int64_t     m_lUsec;
+};
+
+
 class Compressor
 {
 protected:
@@ -30,6 +39,7 @@ protected:
     uint32_t        m_iFlushWindowSize;
     short           m_iType;
     short           m_iStreamStarted;
+    short           m_iNoStats;
     VMemBuf        *m_pCompressCache;
 
 public:
@@ -39,6 +49,12 @@ public:
         COMPRESSOR_COMPRESS,
         COMPRESSOR_DECOMPRESS
     };
+    enum
+    {
+        STATS_GZIP,
+        STATS_ZSTD,
+        STATS_COUNT
+    };
     Compressor();
     virtual ~Compressor();
 
@@ -70,6 +86,17 @@ public:
     {   return processFile(COMPRESSOR_DECOMPRESS, pFileName, pDecompressFileName);       }
     int isStreamStarted() const {   return m_iStreamStarted;     }
 
+    // Work off the request path, like precompressing static files, is left
+    // out of the stats the compression levels are tuned by.
+    void disableStats()         {   m_iNoStats = 1;     }
+
+    static void addStats(int slot, int64_t in, int64_t out, int64_t usec);
+    static void getStats(int slot, CompressStats *pStats);
+    static int64_t getUsecNow();
+
+
+private:
+    static CompressStats s_stats[STATS_COUNT];
 
     LS_NO_COPY_ASSIGN(Compressor);
 };
@@ -31,6 +31,7 @@
 #include <unistd.h>
 
 GzipBuf::GzipBuf()
+    : m_iLevel(0)
 {
     memset(&m_zstr, 0, sizeof(z_stream));
 }
@@ -64,7 +65,14 @@ int GzipBuf::init(int type, int level)
             ret = deflateInit2(&m_zstr, level, Z_DEFLATED, 15 + 16, 8,
                                Z_DEFAULT_STRATEGY);
         else
+        {
             ret = deflateReset(&m_zstr);
+            //A pooled buffer is reused after the level has been tuned
+            if (ret == Z_OK && level != m_iLevel)
+                ret = deflateParams(&m_zstr, level, Z_DEFAULT_STRATEGY);
+        }
+        if (ret == Z_OK)
+            m_iLevel = level;
     }
     else
     {
@@ -112,6 +120,20 @@ int GzipBuf::compress(const char *pBuf, int len)
 }
 
 int GzipBuf::process(int finish)
+{
+    if (m_iType != COMPRESSOR_COMPRESS || m_iNoStats)
+        return processLoop(finish);
+    uLong in = m_zstr.total_in;
+    uLong out = m_zstr.total_out;
+    int64_t start = getUsecNow();
+    int ret = processLoop(finish);
+    addStats(STATS_GZIP, m_zstr.total_in - in, m_zstr.total_out - out,
+             getUsecNow() - start);
+    return ret;
+}
+
+
+int GzipBuf::processLoop(int finish)
 {
 //     LS_ERROR("GZIPBUF in process");
     do
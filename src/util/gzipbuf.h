@@ -29,9 +29,11 @@ class VMemBuf;
 class GzipBuf : public Compressor
 {
     z_stream        m_zstr;
+    int             m_iLevel;
     //uint32_t        m_crc;
 
     int process(int finish);
+    int processLoop(int finish);
     int compress(const char *pBuf, int len);
     int decompress(const char *pBuf, int len);
 public:
@@ -0,0 +1,254 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2022  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+#include <util/zstdbuf.h>
+
+#ifdef USE_ZSTD
+
+#include <util/vmembuf.h>
+
+#include <string.h>
+
+
+ZstdBuf::ZstdBuf()
+    : m_pCCtx(NULL)
+    , m_iAvailIn(0)
+    , m_iAvailOut(0)
+    , m_pNextIn(NULL)
+    , m_pNextOut(NULL)
+    , m_pDict(NULL)
+    , m_iDictLen(0)
+    , m_iLevel(ZSTD_CLEVEL_DEFAULT)
+    , m_iTotalIn(0)
+    , m_iLastError(0)
+{
+}
+
+ZstdBuf::ZstdBuf(int type, int level)
+    : m_pCCtx(NULL)
+    , m_iAvailIn(0)
+    , m_iAvailOut(0)
+    , m_pNextIn(NULL)
+    , m_pNextOut(NULL)
+    , m_pDict(NULL)
+    , m_iDictLen(0)
+    , m_iLevel(level)
+    , m_iTotalIn(0)
+    , m_iLastError(0)
+{
+    init(type, level);
+}
+
+ZstdBuf::~ZstdBuf()
+{
+    release();
+}
+
+int ZstdBuf::release()
+{
+    if (m_iType == COMPRESSOR_DECOMPRESS)
+        ZSTD_freeDCtx(m_pDCtx);
+    else
+        ZSTD_freeCCtx(m_pCCtx);
+    m_pCCtx = NULL;
+    return 0;
+}
+
+
+int ZstdBuf::init(int type, int level)
+{
+    if (type != COMPRESSOR_DECOMPRESS)
+        type = COMPRESSOR_COMPRESS;
+    //A pooled buffer keeps its context, only the parameters are reset
+    if (m_pCCtx && type != m_iType)
+        release();
+    m_iType = type;
+    m_iLevel = level;
+    if (m_iType == COMPRESSOR_COMPRESS)
+    {
+        if (m_pCCtx)
+            ZSTD_CCtx_reset(m_pCCtx, ZSTD_reset_session_and_parameters);
+        else if ((m_pCCtx = ZSTD_createCCtx()) == NULL)
+            return LS_FAIL;
+        m_iLastError = ZSTD_CCtx_setParameter(m_pCCtx, ZSTD_c_compressionLevel,
+                                              level);
+        if (ZSTD_isError(m_iLastError))
+            return LS_FAIL;
+    }
+    else
+    {
+        if (m_pDCtx)
+            ZSTD_DCtx_reset(m_pDCtx, ZSTD_reset_session_and_parameters);
+        else if ((m_pDCtx = ZSTD_createDCtx()) == NULL)
+            return LS_FAIL;
+    }
+    return loadDict();
+}
+
+
+int ZstdBuf::loadDict()
+{
+    if (!m_pDict)
+        return LS_OK;
+    if (m_iType == COMPRESSOR_COMPRESS)
+        m_iLastError = ZSTD_CCtx_loadDictionary(m_pCCtx, m_pDict, m_iDictLen);
+    else
+        m_iLastError = ZSTD_DCtx_loadDictionary(m_pDCtx, m_pDict, m_iDictLen);
+    return ZSTD_isError(m_iLastError) ? LS_FAIL : LS_OK;
+}
+
+
+int ZstdBuf::reinit()
+{
+    m_iStreamStarted = 1;
+    return reset();
+}
+
+
+int ZstdBuf::beginStream()
+{
+    if (!m_pCompressCache)
+        return LS_FAIL;
+    size_t size;
+
+    m_pNextIn = NULL;
+    m_iAvailIn = 0;
+    m_iTotalIn = 0;
+    m_iLastFlush = 0;
+
+    m_pNextOut = (uint8_t *) m_pCompressCache->getWriteBuffer(size);
+    m_iAvailOut = size;
+    if (!m_pNextOut)
+        return LS_FAIL;
+    m_iStreamStarted = 1;
+    return 0;
+}
+
+
+int ZstdBuf::compress(const char *pBuf, int len)
+{
+    if (!m_iStreamStarted)
+        return LS_FAIL;
+    m_pNextIn = (uint8_t *)pBuf;
+    m_iAvailIn = len;
+    m_iTotalIn += len;
+    return process(ZSTD_e_continue);
+}
+
+
+/**
+ * For compression, ZSTD_e_continue is done when all input is consumed,
+ * flush and end are done when nothing is left in the context. The
+ * decompressor is done when the input is consumed and the output buffer
+ * was not filled up, a full buffer may leave decoded data in the context.
+ */
+int ZstdBuf::process(ZSTD_EndDirective op)
+{
+    ZSTD_inBuffer in = { m_pNextIn, m_iAvailIn, 0 };
+    ZSTD_outBuffer out;
+    size_t size;
+    int64_t produced = 0;
+    int64_t start = 0;
+    int done;
+    int track = (m_iType == COMPRESSOR_COMPRESS && !m_iNoStats);
+    if (track)
+        start = getUsecNow();
+    do
+    {
+        if (!m_iAvailOut)
+        {
+            m_pNextOut = (uint8_t *)m_pCompressCache->getWriteBuffer(size);
+            m_iAvailOut = size;
+            if (!m_pNextOut)
+                return LS_FAIL;
+        }
+        out.dst = m_pNextOut;
+        out.size = m_iAvailOut;
+        out.pos = 0;
+        if (m_iType == COMPRESSOR_COMPRESS)
+            m_iLastError = ZSTD_compressStream2(m_pCCtx, &out, &in, op);
+        else
+            m_iLastError = ZSTD_decompressStream(m_pDCtx, &out, &in);
+        if (ZSTD_isError(m_iLastError))
+            return LS_FAIL;
+        m_pNextOut += out.pos;
+        m_iAvailOut -= out.pos;
+        m_pCompressCache->writeUsed(out.pos);
+        produced += out.pos;
+
+        if (m_iType == COMPRESSOR_DECOMPRESS)
+            done = (in.pos == in.size && out.pos < out.size);
+        else if (op == ZSTD_e_continue)
+            done = (in.pos == in.size);
+        else
+            done = (m_iLastError == 0);
+    }
+    while (!done);
+    m_pNextIn += in.pos;
+    m_iAvailIn = 0;
+    if (track)
+        addStats(STATS_ZSTD, in.pos, produced, getUsecNow() - start);
+    return 0;
+}
+
+
+int ZstdBuf::endStream()
+{
+    int ret = 0;
+    if (m_iType == COMPRESSOR_COMPRESS)
+        ret = process(ZSTD_e_end);
+    else if (m_iLastError != 0)
+        //the last frame is incomplete
+        ret = LS_FAIL;
+    m_iStreamStarted = 0;
+    return ret;
+}
+
+
+int ZstdBuf::reset()
+{
+    if (!m_pCCtx)
+        return init(m_iType, m_iLevel);
+    if (m_iType == COMPRESSOR_COMPRESS)
+        m_iLastError = ZSTD_CCtx_reset(m_pCCtx, ZSTD_reset_session_only);
+    else
+        m_iLastError = ZSTD_DCtx_reset(m_pDCtx, ZSTD_reset_session_only);
+    //Level and dictionary stay with the context
+    return ZSTD_isError(m_iLastError) ? LS_FAIL : LS_OK;
+}
+
+
+int ZstdBuf::resetCompressCache()
+{
+    m_pCompressCache->rewindReadBuf();
+    m_pCompressCache->rewindWriteBuf();
+    size_t size;
+    m_pNextOut = (uint8_t *)m_pCompressCache->getWriteBuffer(size);
+    m_iAvailOut = size;
+    return 0;
+}
+
+
+const char *ZstdBuf::getLastError() const
+{
+    if (!ZSTD_isError(m_iLastError))
+        return NULL;
+    return ZSTD_getErrorName(m_iLastError);
+}
+
+
+#endif // USE_ZSTD
@@ -0,0 +1,310 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2022  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+
+#include <extensions/fcgi/fcgiapp.h>
+#include <extensions/fcgi/fcgiconnection.h>
+#include <extensions/fcgi/fcgimplxconn.h>
+#include <extensions/fcgi/fcginamevaluepair.h>
+#include <extensions/fcgi/fcgirecord.h>
+#include <extensions/fcgi/fcgirequest.h>
+#include <edio/poller.h>
+#include <util/autobuf.h>
+#include <util/misc/profiletime.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+char *argv0 = NULL;
+
+#define BENCH_CONCURRENCY   32
+#define BENCH_MAX_CONNS     BENCH_CONCURRENCY
+#define BENCH_RESP_SIZE     2048
+
+
+/**
+ * A FastCGI responder that multiplexes, it answers FCGI_GET_VALUES and
+ * every request as soon as its FCGI_STDIN ends, on as many connections
+ * as it is given.
+ */
+class MplxResponder
+{
+public:
+    explicit MplxResponder(int n)
+        : m_iConns(n)
+    {
+        memset(m_resp, 'x', sizeof(m_resp));
+    }
+
+    static void *run(void *pArg)
+    {
+        ((MplxResponder *)pArg)->loop();
+        return NULL;
+    }
+
+    void loop()
+    {
+        struct pollfd pfds[BENCH_MAX_CONNS];
+        int open = m_iConns;
+        for (int i = 0; i < m_iConns; ++i)
+        {
+            pfds[i].fd = m_fds[i];
+            pfds[i].events = POLLIN;
+        }
+        while (open > 0 && ::poll(pfds, m_iConns, -1) > 0)
+        {
+            for (int i = 0; i < m_iConns; ++i)
+            {
+                if (!(pfds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                    continue;
+                if (onRead(i) <= 0)
+                {
+                    pfds[i].fd = -1;
+                    --open;
+                }
+            }
+        }
+    }
+
+    int  m_fds[BENCH_MAX_CONNS];
+
+private:
+    void appendRecord(AutoBuf *pOut, int type, int id, const char *pContent,
+                      int len)
+    {
+        FCGI_Header header;
+        FcgiRecord::setRecordHeader(header, type, id, len);
+        pOut->append((const char *)&header, sizeof(header));
+        if (len > 0)
+            pOut->append(pContent, len);
+        pOut->append(FcgiConnection::s_padding, header.paddingLength);
+    }
+
+    void respond(AutoBuf *pOut, const FCGI_Header &header)
+    {
+        int id = FcgiRecord::getId((FCGI_Header &)header);
+        if (header.type == FCGI_GET_VALUES)
+        {
+            char achBuf[128];
+            int size = sizeof(achBuf);
+            int len = FcgiNameValuePair::append(achBuf, size,
+                                                FCGI_MPXS_CONNS, "1");
+            len += FcgiNameValuePair::append(achBuf + len, size,
+                                             FCGI_MAX_REQS, "128");
+            appendRecord(pOut, FCGI_GET_VALUES_RESULT, 0, achBuf, len);
+        }
+        else if (header.type == FCGI_STDIN
+                 && FcgiRecord::getContentLength((FCGI_Header &)header) == 0)
+        {
+            static const char s_achHeader[] =
+                "Status: 200\r\nContent-Type: text/html\r\n\r\n";
+            FCGI_EndRequestBody end;
+            memset(&end, 0, sizeof(end));
+            appendRecord(pOut, FCGI_STDOUT, id, s_achHeader,
+                         sizeof(s_achHeader) - 1);
+            appendRecord(pOut, FCGI_STDOUT, id, m_resp, sizeof(m_resp));
+            appendRecord(pOut, FCGI_STDOUT, id, NULL, 0);
+            appendRecord(pOut, FCGI_END_REQUEST, id, (const char *)&end,
+                         sizeof(end));
+        }
+    }
+
+    int onRead(int i)
+    {
+        char achBuf[16384];
+        int len = ::read(m_fds[i], achBuf, sizeof(achBuf));
+        if (len <= 0)
+            return len;
+        AutoBuf &in = m_in[i];
+        AutoBuf out(4096);
+        in.append(achBuf, len);
+        const char *p = in.begin();
+        while (in.end() - p >= (int)sizeof(FCGI_Header))
+        {
+            FCGI_Header header;
+            memcpy(&header, p, sizeof(header));
+            int recLen = sizeof(header) + header.paddingLength
+                         + FcgiRecord::getContentLength(header);
+            if (in.end() - p < recLen)
+                break;
+            respond(&out, header);
+            p += recLen;
+        }
+        in.pop_front(p - in.begin());
+        const char *pOut = out.begin();
+        int left = out.size();
+        while (left > 0)
+        {
+            int ret = ::write(m_fds[i], pOut, left);
+            if (ret <= 0)
+                return ret;
+            pOut += ret;
+            left -= ret;
+        }
+        return 1;
+    }
+
+    int     m_iConns;
+    AutoBuf m_in[BENCH_MAX_CONNS];
+    char    m_resp[BENCH_RESP_SIZE];
+};
+
+
+static const char *s_aEnv[][2] =
+{
+    { "SCRIPT_FILENAME",    "/home/user/public_html/index.php" },
+    { "QUERY_STRING",       "p=12345&s=search+term" },
+    { "REQUEST_METHOD",     "GET" },
+    { "REQUEST_URI",        "/index.php?p=12345&s=search+term" },
+    { "DOCUMENT_ROOT",      "/home/user/public_html" },
+    { "REMOTE_ADDR",        "192.168.100.100" },
+    { "SERVER_NAME",        "www.example.com" },
+    { "SERVER_PROTOCOL",    "HTTP/1.1" },
+    { "HTTP_HOST",          "www.example.com" },
+    { "HTTP_ACCEPT",        "text/html,application/xhtml+xml" },
+};
+
+
+static int buildEnv(char *pBuf, int size)
+{
+    int len = 0;
+    for (int i = 0; i < (int)(sizeof(s_aEnv) / sizeof(s_aEnv[0])); ++i)
+        len += FcgiNameValuePair::append(pBuf + len, size, s_aEnv[i][0],
+                                         s_aEnv[i][1]);
+    return len;
+}
+
+
+static void sendRequest(FcgiMplxConn *pConn, FcgiRequest *pReq,
+                        const char *pEnv, int envLen)
+{
+    FCGI_BeginRequestRecord begin;
+    int id = pConn->startRequest(pReq);
+    memset(&begin, 0, sizeof(begin));
+    FcgiRecord::setRecordHeader(begin.header, FCGI_BEGIN_REQUEST, id,
+                                sizeof(FCGI_BeginRequestBody));
+    begin.body.roleB0 = FCGI_RESPONDER;
+    begin.body.flags = FCGI_KEEP_CONN;
+    pConn->sendRecord((const char *)&begin, sizeof(begin));
+    pConn->writeStream(FCGI_PARAMS, id, pEnv, envLen);
+    pConn->endOfStream(FCGI_PARAMS, id);
+    pConn->endOfStream(FCGI_STDIN, id);
+}
+
+
+/**
+ * Runs BENCH_CONCURRENCY requests at a time, spread over conns
+ * connections, until loops requests are done.
+ */
+static void benchConns(int conns, int loops)
+{
+    Poller poller;
+    FcgiApp app("mplxbench");
+    FcgiMplxConn *aConns[BENCH_MAX_CONNS];
+    FcgiRequest aReqs[BENCH_CONCURRENCY];
+    MplxResponder responder(conns);
+    struct pollfd pfds[BENCH_MAX_CONNS];
+    pthread_t tid;
+    char achEnv[2048];
+    int envLen = buildEnv(achEnv, sizeof(achEnv));
+    int perConn = BENCH_CONCURRENCY / conns;
+    int i, j;
+
+    poller.init(BENCH_MAX_CONNS * 2);
+    for (i = 0; i < conns; ++i)
+    {
+        int fds[2];
+        socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+        fcntl(fds[0], F_SETFL, O_NONBLOCK);
+        responder.m_fds[i] = fds[1];
+        aConns[i] = new FcgiMplxConn(&app);
+        aConns[i]->EdStream::init(fds[0], &poller,
+                                  POLLIN | POLLOUT | POLLHUP | POLLERR);
+        pfds[i].fd = fds[0];
+        pfds[i].events = POLLIN;
+    }
+    pthread_create(&tid, NULL, MplxResponder::run, &responder);
+
+    //The first connection asks FCGI_GET_VALUES, the others are ready.
+    for (i = 0; i < conns; ++i)
+        aConns[i]->onWrite();
+    while (!aConns[0]->canStartRequest() && !aConns[0]->isClosed()
+           && ::poll(pfds, 1, 1000) > 0)
+        aConns[0]->onRead();
+
+    ProfileTime timer;
+    int done = 0;
+    while (done < loops)
+    {
+        for (i = 0; i < conns; ++i)
+        {
+            for (j = 0; j < perConn; ++j)
+                sendRequest(aConns[i], &aReqs[i * perConn + j], achEnv,
+                            envLen);
+            aConns[i]->onWrite();
+        }
+        int pending = conns * perConn;
+        while (pending > 0 && ::poll(pfds, conns, 1000) > 0)
+        {
+            pending = 0;
+            for (i = 0; i < conns; ++i)
+            {
+                if (pfds[i].revents && aConns[i]->onRead() == -1)
+                    break;
+                pending += aConns[i]->getLoad();
+            }
+            if (i < conns)
+                break;
+        }
+        if (pending > 0)
+            break;
+        done += conns * perConn;
+    }
+    timer.stop();
+
+    char achDesc[128];
+    snprintf(achDesc, sizeof(achDesc), "%d requests over %d connection(s)",
+             BENCH_CONCURRENCY, conns);
+    timer.printTime(achDesc, done);
+
+    for (i = 0; i < conns; ++i)
+    {
+        if (!aConns[i]->isClosed())
+            delete aConns[i];
+    }
+    pthread_join(tid, NULL);
+    for (i = 0; i < conns; ++i)
+        ::close(responder.m_fds[i]);
+}
+
+
+int main(int ac, char *av[])
+{
+    int loops = 200000;
+    int conns[] = { 1, 4, BENCH_MAX_CONNS };
+
+    signal(SIGPIPE, SIG_IGN);
+    for (int i = 0; i < (int)(sizeof(conns) / sizeof(conns[0])); ++i)
+        benchConns(conns[i], loops);
+    return 0;
+}
@@ -0,0 +1,330 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2022  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+#ifdef RUN_TEST
+
+#include <extensions/fcgi/fcgiapp.h>
+#include <extensions/fcgi/fcgiconnection.h>
+#include <extensions/fcgi/fcgimplxconn.h>
+#include <extensions/fcgi/fcginamevaluepair.h>
+#include <extensions/fcgi/fcgirecord.h>
+#include <extensions/fcgi/fcgireqlist.h>
+#include <extensions/fcgi/fcgirequest.h>
+#include <edio/poller.h>
+#include <util/autobuf.h>
+#include "unittest-cpp/UnitTest++.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+TEST(FcgiReqListTest_idReuse)
+{
+    FcgiRequest req[4];
+    FcgiReqList list;
+    CHECK(list.regist(&req[0]) == 1);
+    CHECK(list.regist(&req[1]) == 2);
+    CHECK(list.regist(&req[2]) == 3);
+    CHECK(list.size() == 3);
+
+    list.unregist(&req[1]);
+    CHECK(list.size() == 2);
+    CHECK(list.get(2) == NULL);
+    CHECK(list.first() == &req[0]);
+    CHECK(list.next(1) == &req[2]);
+
+    //The lowest free id is taken first.
+    CHECK(list.regist(&req[3]) == 2);
+    CHECK(req[3].getId() == 2);
+    CHECK(list.get(2) == &req[3]);
+    CHECK(list.size() == 3);
+
+    CHECK(list.get(0) == NULL);
+    CHECK(list.get(4) == NULL);
+}
+
+
+TEST(FcgiReqListTest_retire)
+{
+    FcgiRequest req[4];
+    FcgiReqList list;
+    list.regist(&req[0]);
+    list.regist(&req[1]);
+
+    list.retire(&req[0]);
+    CHECK(list.isRetired(1));
+    CHECK(list.get(1) == NULL);
+    CHECK(list.first() == &req[1]);
+    //Still counted until the application ends it.
+    CHECK(list.size() == 2);
+
+    //A retired id is not handed out again.
+    CHECK(list.regist(&req[2]) == 3);
+
+    CHECK(list.release(1) == LS_OK);
+    CHECK(!list.isRetired(1));
+    CHECK(list.release(1) == LS_FAIL);
+    CHECK(list.release(2) == LS_FAIL);
+    CHECK(list.size() == 2);
+    CHECK(list.regist(&req[3]) == 1);
+}
+
+
+/**
+ * A connection to a FastCGI application whose other end is half of a
+ * socketpair, records from the "application" are written to m_fd and
+ * processed with FcgiMplxConn::onRead().
+ */
+class FcgiMplxPeer
+{
+public:
+    FcgiMplxPeer()
+        : m_pApp(new FcgiApp("mplxtest"))
+        , m_pConn(new FcgiMplxConn(m_pApp))
+        , m_fd(-1)
+    {
+        int fds[2];
+        m_poller.init(16);
+        socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+        fcntl(fds[0], F_SETFL, O_NONBLOCK);
+        fcntl(fds[1], F_SETFL, O_NONBLOCK);
+        m_fd = fds[1];
+        m_pConn->EdStream::init(fds[0], &m_poller,
+                                POLLIN | POLLOUT | POLLHUP | POLLERR);
+        //Connected socket, sends FCGI_GET_VALUES.
+        m_pConn->onWrite();
+    }
+
+    ~FcgiMplxPeer()
+    {
+        //A closed connection is owned by the application.
+        if (!m_pConn->isClosed())
+            delete m_pConn;
+        delete m_pApp;
+        ::close(m_fd);
+    }
+
+    /**
+     * Flushes what the connection has buffered and reads it, until
+     * nothing more comes.
+     */
+    int recv(AutoBuf *pBuf)
+    {
+        char achBuf[4096];
+        int ret, len, total = 0;
+        while (!m_pConn->isClosed() && m_pConn->onWrite() != -1)
+        {
+            len = 0;
+            while ((ret = ::read(m_fd, achBuf, sizeof(achBuf))) > 0)
+            {
+                pBuf->append(achBuf, ret);
+                len += ret;
+            }
+            if (len == 0)
+                break;
+            total += len;
+        }
+        return total;
+    }
+
+    void sendRecord(int type, int id, const char *pContent, int len)
+    {
+        FCGI_Header header;
+        FcgiRecord::setRecordHeader(header, type, id, len);
+        m_out.append((const char *)&header, sizeof(header));
+        if (len > 0)
+            m_out.append(pContent, len);
+        m_out.append(FcgiConnection::s_padding, header.paddingLength);
+    }
+
+    void sendEndRequest(int id, int status)
+    {
+        FCGI_EndRequestBody body;
+        memset(&body, 0, sizeof(body));
+        body.protocolStatus = status;
+        sendRecord(FCGI_END_REQUEST, id, (const char *)&body, sizeof(body));
+    }
+
+    void sendValues(int mpxs, int maxReqs)
+    {
+        char achBuf[256], achVal[16];
+        int size = sizeof(achBuf);
+        int len;
+        snprintf(achVal, sizeof(achVal), "%d", mpxs);
+        len = FcgiNameValuePair::append(achBuf, size, FCGI_MPXS_CONNS, achVal);
+        snprintf(achVal, sizeof(achVal), "%d", maxReqs);
+        len += FcgiNameValuePair::append(achBuf + len, size, FCGI_MAX_REQS,
+                                         achVal);
+        sendRecord(FCGI_GET_VALUES_RESULT, 0, achBuf, len);
+    }
+
+    int process(int split = 0)
+    {
+        int ret = 0;
+        if (split > 0 && split < m_out.size())
+        {
+            ::write(m_fd, m_out.begin(), split);
+            ret = m_pConn->onRead();
+            ::write(m_fd, m_out.begin() + split, m_out.size() - split);
+        }
+        else
+            ::write(m_fd, m_out.begin(), m_out.size());
+        m_out.clear();
+        if (ret == -1)
+            return ret;
+        return m_pConn->onRead();
+    }
+
+    void negotiate(int mpxs, int maxReqs)
+    {
+        AutoBuf buf;
+        recv(&buf);
+        sendValues(mpxs, maxReqs);
+        process();
+    }
+
+    Poller          m_poller;
+    FcgiApp        *m_pApp;
+    FcgiMplxConn   *m_pConn;
+    int             m_fd;
+    AutoBuf         m_out;
+};
+
+
+/**
+ * Walks the records in pBuf, checks every header and the padding.
+ *
+ * @return the number of records, -1 if a record is malformed.
+ */
+static int parseRecords(const AutoBuf &buf, int type, int id,
+                        AutoBuf *pContent)
+{
+    const char *p = buf.begin();
+    const char *pEnd = buf.end();
+    int count = 0;
+    while (p < pEnd)
+    {
+        FCGI_Header header;
+        if (pEnd - p < (int)sizeof(header))
+            return -1;
+        memcpy(&header, p, sizeof(header));
+        p += sizeof(header);
+        int len = FcgiRecord::getContentLength(header);
+        if (!FcgiRecord::testRecord(header) || header.type != type
+            || FcgiRecord::getId(header) != id
+            || ((len + header.paddingLength) & 7) != 0
+            || pEnd - p < len + header.paddingLength)
+            return -1;
+        pContent->append(p, len);
+        p += len + header.paddingLength;
+        ++count;
+    }
+    return count;
+}
+
+
+TEST(FcgiMplxConnTest_negotiate)
+{
+    FcgiMplxPeer peer;
+    AutoBuf buf;
+    CHECK(peer.recv(&buf) > 0);
+    FCGI_Header header;
+    memcpy(&header, buf.begin(), sizeof(header));
+    CHECK(FcgiRecord::testRecord(header));
+    CHECK(header.type == FCGI_GET_VALUES);
+    CHECK(FcgiRecord::getId(header) == 0);
+    CHECK(buf.size() == (int)sizeof(header)
+          + FcgiRecord::getContentLength(header) + header.paddingLength);
+    CHECK(!peer.m_pConn->canStartRequest());
+
+    //Header split across two reads.
+    peer.sendValues(1, 20);
+    CHECK(peer.process(5) == 0);
+    CHECK(peer.m_pApp->isMultiplexConns());
+    CHECK(peer.m_pApp->getFcgiMaxReqs() == 20);
+    CHECK(!peer.m_pApp->wantManagementInfo());
+    CHECK(peer.m_pConn->canStartRequest());
+}
+
+
+TEST(FcgiMplxConnTest_writeStream)
+{
+    FcgiMplxPeer peer;
+    peer.negotiate(1, 10);
+
+    AutoBuf data(70000);
+    for (int i = 0; i < 70000; ++i)
+        data.append((char)('a' + i % 26));
+    CHECK(peer.m_pConn->writeStream(FCGI_STDIN, 3, data.begin(), data.size())
+          == data.size());
+    CHECK(peer.m_pConn->endOfStream(FCGI_STDIN, 3) != -1);
+
+    AutoBuf buf, content;
+    peer.recv(&buf);
+    //Two data records of at most FCGI_MAX_PACKET_SIZE, then the empty one.
+    CHECK(parseRecords(buf, FCGI_STDIN, 3, &content) == 3);
+    CHECK(content.size() == data.size());
+    CHECK(memcmp(content.begin(), data.begin(), data.size()) == 0);
+    FCGI_Header header;
+    memcpy(&header, buf.begin(), sizeof(header));
+    CHECK(FcgiRecord::getContentLength(header) == FCGI_MAX_PACKET_SIZE);
+    memcpy(&header, buf.end() - sizeof(header), sizeof(header));
+    CHECK(FcgiRecord::getContentLength(header) == 0);
+}
+
+
+TEST(FcgiMplxConnTest_idReuse)
+{
+    FcgiRequest req[5];
+    FcgiMplxPeer peer;
+    peer.negotiate(1, 10);
+
+    CHECK(peer.m_pConn->startRequest(&req[0]) == 1);
+    CHECK(peer.m_pConn->startRequest(&req[1]) == 2);
+    CHECK(peer.m_pConn->getLoad() == 2);
+
+    //Records of other requests in between, and of an unknown id.
+    const char achOut[] = "Content-type: text/plain\r\n\r\n";
+    peer.sendRecord(FCGI_STDOUT, 2, achOut, sizeof(achOut) - 1);
+    peer.sendRecord(FCGI_STDOUT, 7, achOut, sizeof(achOut) - 1);
+    peer.sendRecord(FCGI_STDOUT, 1, NULL, 0);
+    peer.sendEndRequest(1, FCGI_REQUEST_COMPLETE);
+    CHECK(peer.process(11) == 0);
+    CHECK(req[0].getId() == 0);
+    CHECK(req[1].getId() == 2);
+    CHECK(peer.m_pConn->getLoad() == 1);
+
+    //The id of an ended request is used again.
+    CHECK(peer.m_pConn->startRequest(&req[2]) == 1);
+
+    //An aborted id is reserved until the application ends it.
+    AutoBuf buf, content;
+    peer.m_pConn->releaseRequest(&req[1], 1);
+    peer.recv(&buf);
+    CHECK(parseRecords(buf, FCGI_ABORT_REQUEST, 2, &content) == 1);
+    CHECK(peer.m_pConn->startRequest(&req[3]) == 3);
+
+    peer.sendEndRequest(2, FCGI_REQUEST_COMPLETE);
+    CHECK(peer.process() == 0);
+    CHECK(peer.m_pConn->startRequest(&req[4]) == 2);
+    CHECK(peer.m_pConn->getLoad() == 3);
+}
+
+#endif
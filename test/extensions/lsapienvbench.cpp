@@ -0,0 +1,188 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2022  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+
+#include <extensions/lsapi/lsapidef.h>
+#include <extensions/lsapi/lsapireq.h>
+#include <http/clientinfo.h>
+#include <http/hiochainstream.h>
+#include <http/httpcontext.h>
+#include <http/httpsession.h>
+#include <http/httpvhost.h>
+#include <http/phpconfig.h>
+#include <http/vhostmap.h>
+#include <util/autobuf.h>
+#include <util/iovec.h>
+#include <util/misc/profiletime.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+
+char *argv0 = NULL;
+
+//A typical PHP request.
+static const char s_achReq[] =
+    "GET /index.php?p=12345&s=search+term HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) "
+    "Gecko/20100101 Firefox/115.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Cookie: wordpress_test_cookie=WP%20Cookie%20check; "
+    "wp-settings-time-1=1700000000\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "\r\n";
+
+
+/**
+ * The session, vhost and context an LSAPI request is built from, the
+ * context carries count php_value settings, prebuilt by PHPConfig.
+ */
+class LsapiEnvBench
+{
+public:
+    explicit LsapiEnvBench(int count)
+        : m_vhost("www.example.com")
+    {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = inet_addr("192.168.100.100");
+        m_clientInfo.setAddr((struct sockaddr *)&addr);
+
+        m_vhost.setDocRoot("/home/user/public_html/");
+        m_vhostMap.setPort(443);
+
+        PHPConfig *pConfig = new PHPConfig();
+        char achArgs[128], achErr[128];
+        for (int i = 0; i < count; ++i)
+        {
+            snprintf(achArgs, sizeof(achArgs),
+                     "setting_%d /home/user/php/value/of/setting/%d", i, i);
+            pConfig->parse(PHP_VALUE, achArgs, achErr, sizeof(achErr));
+        }
+        pConfig->buildLsapiEnv();
+        m_context.setPHPConfig(pConfig);
+
+        m_session.attachStream(&m_stream);
+        m_session.setClientInfo(&m_clientInfo);
+        m_session.setVHostMap(&m_vhostMap);
+
+        HttpReq *pReq = m_session.getReq();
+        pReq->getHeaderBuf().append(s_achReq, sizeof(s_achReq) - 1);
+        while (pReq->getStatus() != HttpReq::HEADER_OK)
+        {
+            if (pReq->processHeader() != 0
+                && pReq->getStatus() != HttpReq::HEADER_OK)
+                break;
+        }
+        pReq->setVHost(&m_vhost);
+        pReq->setContext(&m_context);
+        pReq->setRealPath("/home/user/public_html/index.php", 32);
+        pReq->setScriptNameLen(pReq->getURILen());
+    }
+
+    ~LsapiEnvBench()
+    {
+        m_session.detachStream();
+        m_session.setClientInfo(NULL);
+    }
+
+    int specialEnvSize()
+    {
+        return m_context.getPHPConfig()->getLsapiEnv().size();
+    }
+
+    HttpSession *getSession()   {   return &m_session;  }
+
+private:
+    HttpVHost       m_vhost;
+    VHostMap        m_vhostMap;
+    HttpContext     m_context;
+    ClientInfo      m_clientInfo;
+    HioChainStream  m_stream;
+    HttpSession     m_session;
+};
+
+
+static void benchBuildReq(LsapiEnvBench *pBench, int loops)
+{
+    IOVec iov;
+    LsapiReq req(&iov);
+    int total;
+    ProfileTime timer;
+    for (int i = 0; i < loops; ++i)
+    {
+        iov.clear();
+        req.buildReq(pBench->getSession(), &total);
+    }
+    timer.stop();
+
+    char achDesc[128];
+    snprintf(achDesc, sizeof(achDesc),
+             "buildReq, %d bytes special env, %d bytes packet",
+             pBench->specialEnvSize(), total);
+    timer.printTime(achDesc, loops);
+}
+
+
+/**
+ * buildReq plus copying the special env into the packet, what it cost
+ * before the block got its own iovec segment.
+ */
+static void benchBuildReqCopy(LsapiEnvBench *pBench, int loops)
+{
+    IOVec iov;
+    LsapiReq req(&iov);
+    AutoBuf buf(4096);
+    int total;
+    const AutoBuf &special =
+        pBench->getSession()->getReq()->getContext()->getPHPConfig()
+        ->getLsapiEnv();
+    ProfileTime timer;
+    for (int i = 0; i < loops; ++i)
+    {
+        iov.clear();
+        req.buildReq(pBench->getSession(), &total);
+        buf.clear();
+        buf.append(special.begin(), special.size());
+    }
+    timer.stop();
+
+    char achDesc[128];
+    snprintf(achDesc, sizeof(achDesc), "buildReq + copy, %d bytes special env",
+             pBench->specialEnvSize());
+    timer.printTime(achDesc, loops);
+}
+
+
+int main(int ac, char *av[])
+{
+    int loops = 1000000;
+    int counts[] = { 0, 10, 50 };
+
+    for (int i = 0; i < (int)(sizeof(counts) / sizeof(counts[0])); ++i)
+    {
+        LsapiEnvBench bench(counts[i]);
+        benchBuildReq(&bench, loops);
+        benchBuildReqCopy(&bench, loops);
+    }
+    return 0;
+}
@@ -0,0 +1,99 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2022  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+#ifdef RUN_TEST
+
+#include <extensions/poolscaler.h>
+#include "unittest-cpp/UnitTest++.h"
+
+
+TEST(PoolScalerTest_scaleDown)
+{
+    PoolScaler scaler;
+    scaler.setLimits(2, 20);
+    scaler.setTargetWaitMs(100);
+    CHECK(scaler.getTarget() == 2);
+
+    //A long queue grows it right away, up to the max.
+    CHECK(scaler.update(1, 5, 30, 500, -1) == 20);
+    CHECK(scaler.getAction() == PoolScaler::PS_UP_WAIT);
+
+    //Idle pool holds during the cool down, then shrinks by one a second.
+    for (int i = 1; i < POOLSCALER_COOLDOWN; ++i)
+        CHECK(scaler.update(0, 0, 0, 0, -1) == 20);
+    CHECK(scaler.update(0, 0, 0, 0, -1) == 19);
+    CHECK(scaler.getAction() == PoolScaler::PS_DOWN);
+    CHECK(scaler.update(0, 0, 0, 0, -1) == 18);
+    for (int i = 0; i < 100; ++i)
+        scaler.update(0, 0, 0, 0, -1);
+    CHECK(scaler.getTarget() == 2);
+}
+
+
+TEST(PoolScalerTest_scaleUp)
+{
+    PoolScaler scaler;
+    scaler.setLimits(1, 50);
+    scaler.setTargetWaitMs(100);
+    CHECK(scaler.getTarget() == 1);
+    for (int i = 0; i < 100; ++i)
+        scaler.update(0, 0, 0, 0, -1);
+    CHECK(scaler.getTarget() == 1);
+
+    //Raising the limits does not move the target.
+    scaler.setLimits(1, 60);
+    CHECK(scaler.getTarget() == 1);
+    scaler.setLimits(1, 50);
+
+    //Queue wait over target, grow to at least busy + queued.
+    CHECK(scaler.update(1, 5, 9, 500, -1) == 10);
+    CHECK(scaler.getAction() == PoolScaler::PS_UP_WAIT);
+
+    //100 req/s at 100ms each needs 10 connections, plus headroom and
+    //trend, pre-forks ahead of the queue.
+    int target = scaler.update(10, 100, 0, 0, -1);
+    CHECK(scaler.getAction() == PoolScaler::PS_UP_LOAD);
+    CHECK(target > 10);
+    CHECK(target <= 50);
+
+    //Never beyond the max.
+    for (int i = 0; i < 10; ++i)
+        scaler.update(50, 100, 100, 5000, -1);
+    CHECK(scaler.getTarget() == 50);
+}
+
+
+TEST(PoolScalerTest_memory)
+{
+    PoolScaler scaler;
+    scaler.setLimits(1, 10);
+    scaler.setMinFreeMemMB(1000);
+    for (int i = 0; i < 100; ++i)
+        scaler.update(0, 0, 0, 0, 4000);
+    CHECK(scaler.getTarget() == 1);
+
+    //No growth under the floor even with a long queue.
+    CHECK(scaler.update(1, 1, 10, 5000, 800) == 1);
+    CHECK(scaler.getAction() == PoolScaler::PS_MEM_HOLD);
+
+    CHECK(scaler.update(1, 1, 10, 5000, 4000) > 1);
+    int target = scaler.getTarget();
+    CHECK(scaler.update(1, 1, 0, 0, 400) == target - 1);
+    CHECK(scaler.getAction() == PoolScaler::PS_MEM_DOWN);
+}
+
+#endif
@@ -0,0 +1,234 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2022  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+#ifdef RUN_TEST
+
+#include <extensions/proxy/proxyh2conn.h>
+#include <extensions/proxy/proxyworker.h>
+#include <edio/poller.h>
+#include <h2/h2protocol.h>
+#include <util/autobuf.h>
+#include "unittest-cpp/UnitTest++.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+/**
+ * A clear text (h2c) session whose backend end is the other half of a
+ * socketpair, frames from the "backend" are written to m_fd and
+ * processed with ProxyH2Conn::onRead().
+ */
+class ProxyH2Peer
+{
+public:
+    ProxyH2Peer()
+        : m_pWorker(new ProxyWorker("h2test"))
+        , m_pConn(new ProxyH2Conn(m_pWorker))
+        , m_fd(-1)
+    {
+        int fds[2];
+        m_poller.init(16);
+        socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+        fcntl(fds[0], F_SETFL, O_NONBLOCK);
+        fcntl(fds[1], F_SETFL, O_NONBLOCK);
+        m_fd = fds[1];
+        m_pConn->EdStream::init(fds[0], &m_poller,
+                                POLLIN | POLLOUT | POLLHUP | POLLERR);
+        //Connected socket, sends the preface and SETTINGS.
+        m_pConn->onWrite();
+    }
+
+    ~ProxyH2Peer()
+    {
+        //A closed session is owned by the worker.
+        if (!m_pConn->isClosed())
+            delete m_pConn;
+        delete m_pWorker;
+        ::close(m_fd);
+    }
+
+    int recv(char *pBuf, int size)
+    {
+        int ret, total = 0;
+        while ((ret = ::read(m_fd, pBuf + total, size - total)) > 0)
+            total += ret;
+        return total;
+    }
+
+    void sendFrame(int type, int flags, uint32_t id, const void *pPayload,
+                   int len)
+    {
+        unsigned char header[H2_FRAME_HEADER_SIZE];
+        header[0] = len >> 16;
+        header[1] = len >> 8;
+        header[2] = len;
+        header[3] = type;
+        header[4] = flags;
+        header[5] = id >> 24;
+        header[6] = id >> 16;
+        header[7] = id >> 8;
+        header[8] = id;
+        m_out.append((const char *)header, H2_FRAME_HEADER_SIZE);
+        if (len > 0)
+            m_out.append((const char *)pPayload, len);
+    }
+
+    int process()
+    {
+        ::write(m_fd, m_out.begin(), m_out.size());
+        m_out.clear();
+        return m_pConn->onRead();
+    }
+
+    void sendSettings(int maxStreams)
+    {
+        unsigned char settings[6] = { 0, H2_SETTINGS_MAX_CONCURRENT_STREAMS,
+                                      0, 0, 0, 0 };
+        settings[5] = maxStreams;
+        sendFrame(H2_FRAME_SETTINGS, 0, 0, settings, sizeof(settings));
+    }
+
+    Poller          m_poller;
+    ProxyWorker    *m_pWorker;
+    ProxyH2Conn    *m_pConn;
+    int             m_fd;
+    AutoBuf         m_out;
+};
+
+
+// :status 200, content-type: text/plain, connection: close
+static const unsigned char s_resp200[] =
+{
+    0x88,
+    0x0f, 0x10, 0x0a, 't', 'e', 'x', 't', '/', 'p', 'l', 'a', 'i', 'n',
+    0x00, 0x0a, 'c', 'o', 'n', 'n', 'e', 'c', 't', 'i', 'o', 'n',
+    0x05, 'c', 'l', 'o', 's', 'e',
+};
+static const char s_resp200Text[] =
+    "HTTP/1.1 200\r\ncontent-type: text/plain\r\n\r\n";
+
+
+TEST(ProxyH2ConnTest_preface)
+{
+    ProxyH2Peer peer;
+    char buf[4096];
+    int len = peer.recv(buf, sizeof(buf));
+    CHECK(len >= H2_CLIENT_PREFACE_LEN + H2_FRAME_HEADER_SIZE);
+    CHECK(memcmp(buf, H2_CLIENT_PREFACE, H2_CLIENT_PREFACE_LEN) == 0);
+    CHECK(buf[H2_CLIENT_PREFACE_LEN + 3] == H2_FRAME_SETTINGS);
+    CHECK(peer.m_pConn->isUsable());
+
+    peer.sendSettings(100);
+    CHECK(peer.process() >= 0);
+    len = peer.recv(buf, sizeof(buf));
+    //SETTINGS ACK is sent back.
+    bool ack = false;
+    for (int i = 0; i + H2_FRAME_HEADER_SIZE <= len; )
+    {
+        int frameLen = ((unsigned char)buf[i] << 16)
+                       | ((unsigned char)buf[i + 1] << 8)
+                       | (unsigned char)buf[i + 2];
+        if (buf[i + 3] == H2_FRAME_SETTINGS && (buf[i + 4] & H2_FLAG_ACK))
+            ack = true;
+        i += H2_FRAME_HEADER_SIZE + frameLen;
+    }
+    CHECK(ack);
+}
+
+
+TEST(ProxyH2ConnTest_maxConcurrentStreams)
+{
+    ProxyH2Peer peer;
+    peer.sendSettings(1);
+    CHECK(peer.process() >= 0);
+    CHECK(peer.m_pConn->canStartStream());
+    ProxyH2Stream *pStream = peer.m_pConn->newStream(NULL);
+    CHECK(pStream != NULL);
+    CHECK(pStream->getStreamID() == 1);
+    CHECK(!peer.m_pConn->canStartStream());
+    CHECK(peer.m_pConn->newStream(NULL) == NULL);
+    CHECK(peer.m_pConn->getLoad() == 1);
+}
+
+
+TEST(ProxyH2ConnTest_respHeaders)
+{
+    ProxyH2Peer peer;
+    peer.sendSettings(100);
+    CHECK(peer.process() >= 0);
+    ProxyH2Stream *pStream = peer.m_pConn->newStream(NULL);
+    CHECK(pStream != NULL);
+
+    // :status 100, interim responses are not forwarded.
+    static const unsigned char s_resp100[] = { 0x08, 0x03, '1', '0', '0' };
+    peer.sendFrame(H2_FRAME_HEADERS, H2_FLAG_END_HEADERS, 1, s_resp100,
+                   sizeof(s_resp100));
+    CHECK(peer.process() >= 0);
+    CHECK(!pStream->isRespHeaderReady());
+
+    //END_STREAM on HEADERS applies after the CONTINUATION frame.
+    peer.sendFrame(H2_FRAME_HEADERS, H2_FLAG_END_STREAM, 1, s_resp200, 14);
+    peer.sendFrame(H2_FRAME_CONTINUATION, H2_FLAG_END_HEADERS, 1,
+                   s_resp200 + 14, sizeof(s_resp200) - 14);
+    CHECK(peer.process() >= 0);
+    CHECK(pStream->isRespHeaderReady());
+    CHECK(pStream->getRespHeaders().size() == sizeof(s_resp200Text) - 1);
+    CHECK(memcmp(pStream->getRespHeaders().begin(), s_resp200Text,
+                 sizeof(s_resp200Text) - 1) == 0);
+    CHECK(pStream->getFlag(HIO_FLAG_PEER_SHUTDOWN));
+}
+
+
+TEST(ProxyH2ConnTest_goaway)
+{
+    ProxyH2Peer peer;
+    peer.sendSettings(100);
+    CHECK(peer.process() >= 0);
+    CHECK(peer.m_pConn->newStream(NULL) != NULL);
+    CHECK(peer.m_pConn->newStream(NULL) != NULL);
+    CHECK(peer.m_pConn->getLoad() == 2);
+
+    //Last stream 1, stream 3 was not processed and is closed for a retry.
+    static const unsigned char s_goaway[8] = { 0, 0, 0, 1, 0, 0, 0, 0 };
+    peer.sendFrame(H2_FRAME_GOAWAY, 0, 0, s_goaway, sizeof(s_goaway));
+    CHECK(peer.process() >= 0);
+    CHECK(!peer.m_pConn->isUsable());
+    CHECK(!peer.m_pConn->isClosed());
+    CHECK(!peer.m_pConn->canStartStream());
+    CHECK(peer.m_pConn->getLoad() == 1);
+}
+
+
+TEST(ProxyH2ConnTest_unexpectedStream)
+{
+    ProxyH2Peer peer;
+    peer.sendSettings(100);
+    CHECK(peer.process() >= 0);
+    CHECK(peer.m_pConn->newStream(NULL) != NULL);
+
+    //A backend can not open streams, nor answer one never opened.
+    peer.sendFrame(H2_FRAME_HEADERS, H2_FLAG_END_HEADERS, 3, s_resp200,
+                   sizeof(s_resp200));
+    peer.process();
+    CHECK(peer.m_pConn->isClosed());
+}
+
+#endif
@@ -0,0 +1,141 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2022  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+#ifdef RUN_TEST
+
+#include <http/compresstuner.h>
+#include "unittest-cpp/UnitTest++.h"
+
+
+static void setupTuner(CompressTuner &tuner)
+{
+    tuner.setEnabled(1);
+    tuner.setBusyLimits(50, 85);
+    tuner.setLevel(Compressor::STATS_GZIP, 6);
+    tuner.setLevelLimits(Compressor::STATS_GZIP, 2, 7);
+    tuner.setLevel(Compressor::STATS_ZSTD, 3);
+    tuner.setLevelLimits(Compressor::STATS_ZSTD, 1, 5);
+}
+
+
+TEST(CompressTunerTest_levelDown)
+{
+    CompressTuner tuner;
+    int secs;
+    setupTuner(tuner);
+
+    //The smoothed utilization crosses the high mark first, then holds for
+    //the down period.
+    for (secs = 1; secs < 20; ++secs)
+    {
+        tuner.account(Compressor::STATS_GZIP, 1000000, 300000, 200000);
+        if (tuner.update(100, 1000000) == CompressTuner::CT_DOWN)
+            break;
+    }
+    CHECK(secs > COMPRESSTUNER_DOWN_SECS);
+    CHECK(secs < 20);
+    CHECK(tuner.getLevel(Compressor::STATS_GZIP) == 5);
+    CHECK(tuner.getLevel(Compressor::STATS_ZSTD) == 2);
+    CHECK(tuner.getCompressPct() == 20);
+    CHECK(tuner.getSavedPerCpuSec(Compressor::STATS_GZIP) == 3500000);
+
+    for (secs = 1; secs < COMPRESSTUNER_DOWN_SECS; ++secs)
+    {
+        tuner.account(Compressor::STATS_GZIP, 1000000, 300000, 200000);
+        CHECK(tuner.update(100, 1000000) == CompressTuner::CT_HOLD);
+    }
+    tuner.account(Compressor::STATS_GZIP, 1000000, 300000, 200000);
+    CHECK(tuner.update(100, 1000000) == CompressTuner::CT_DOWN);
+    CHECK(tuner.getLevel(Compressor::STATS_ZSTD) == 1);
+
+    //Stop at the lower limits.
+    for (secs = 0; secs < 100; ++secs)
+    {
+        tuner.account(Compressor::STATS_GZIP, 1000000, 300000, 200000);
+        tuner.update(100, 1000000);
+    }
+    CHECK(tuner.getLevel(Compressor::STATS_GZIP) == 2);
+    CHECK(tuner.getLevel(Compressor::STATS_ZSTD) == 1);
+}
+
+
+TEST(CompressTunerTest_noCompression)
+{
+    CompressTuner tuner;
+    setupTuner(tuner);
+
+    //Busy without compressing, a lower level would not help.
+    for (int i = 0; i < 100; ++i)
+        CHECK(tuner.update(100, 1000000) == CompressTuner::CT_HOLD);
+    CHECK(tuner.getLevel(Compressor::STATS_GZIP) == 6);
+    CHECK(tuner.getCompressPct() == 0);
+}
+
+
+TEST(CompressTunerTest_levelUp)
+{
+    CompressTuner tuner;
+    int secs;
+    setupTuner(tuner);
+
+    for (secs = 1; secs < COMPRESSTUNER_UP_SECS; ++secs)
+    {
+        tuner.account(Compressor::STATS_ZSTD, 1000000, 200000, 100000);
+        CHECK(tuner.update(20, 1000000) == CompressTuner::CT_HOLD);
+    }
+    tuner.account(Compressor::STATS_ZSTD, 1000000, 200000, 100000);
+    CHECK(tuner.update(20, 1000000) == CompressTuner::CT_UP);
+    CHECK(tuner.getLevel(Compressor::STATS_GZIP) == 7);
+    CHECK(tuner.getLevel(Compressor::STATS_ZSTD) == 4);
+
+    //Stop at the upper limits.
+    for (secs = 0; secs < 100; ++secs)
+        tuner.update(20, 1000000);
+    CHECK(tuner.getLevel(Compressor::STATS_GZIP) == 7);
+    CHECK(tuner.getLevel(Compressor::STATS_ZSTD) == 5);
+
+    //Between the marks, hold.
+    for (secs = 0; secs < 100; ++secs)
+        CHECK(tuner.update(70, 1000000) == CompressTuner::CT_HOLD);
+}
+
+
+TEST(CompressTunerTest_disabled)
+{
+    CompressTuner tuner;
+    setupTuner(tuner);
+    tuner.setLevel(Compressor::STATS_ZSTD, 0);
+    tuner.setEnabled(0);
+    for (int i = 0; i < 100; ++i)
+    {
+        tuner.account(Compressor::STATS_GZIP, 1000000, 300000, 200000);
+        CHECK(tuner.update(100, 1000000) == CompressTuner::CT_OFF);
+    }
+    CHECK(tuner.getLevel(Compressor::STATS_GZIP) == 6);
+
+    //A disabled method is left alone.
+    tuner.setEnabled(1);
+    for (int i = 0; i < 100; ++i)
+    {
+        tuner.account(Compressor::STATS_GZIP, 1000000, 300000, 200000);
+        tuner.update(100, 1000000);
+    }
+    CHECK(tuner.getLevel(Compressor::STATS_GZIP) == 2);
+    CHECK(tuner.getLevel(Compressor::STATS_ZSTD) == 0);
+}
+
+#endif
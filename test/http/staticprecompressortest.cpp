@@ -0,0 +1,134 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2022  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+#ifdef RUN_TEST
+
+#include <http/staticprecompressor.h>
+
+#if defined(linux) || defined(__linux) || defined(__linux__) || defined(__gnu_linux__)
+
+#include <http/staticfilecachedata.h>
+#include <util/compressor.h>
+#include "unittest-cpp/UnitTest++.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// 2 MB of text, its gzip variant takes well under 1 MB.
+static int writeTestFile(const char *pPath)
+{
+    char achLine[64];
+    int fd = open(pPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+        return -1;
+    for (int i = 0; i < 2 * 1024 * 1024 / 32; ++i)
+    {
+        snprintf(achLine, sizeof(achLine), "var v%08d = %08d * 2;\n",
+                 i, i);
+        if (write(fd, achLine, 32) != 32)
+            break;
+    }
+    close(fd);
+    return open(pPath, O_RDONLY);
+}
+
+
+TEST(StaticPrecompressorTest_precompressFile)
+{
+    StaticPrecompressor &precompressor = StaticPrecompressor::getInstance();
+    char achDir[] = "/tmp/precompresstest.XXXXXX";
+    char achFile[256];
+    char achVariant[4096];
+    struct stat st, stVariant;
+    CompressStats before, after;
+    int64_t used;
+    int fd, len, n;
+
+    CHECK(mkdtemp(achDir) != NULL);
+    StaticFileCacheData::setCompressCachePath(achDir);
+    len = snprintf(achFile, sizeof(achFile), "%s/test.js", achDir);
+    fd = writeTestFile(achFile);
+    CHECK(fd != -1);
+    CHECK(fstat(fd, &st) == 0);
+    n = StaticFileCacheData::buildCompressedBasePath(achFile, len, achVariant,
+                                                     sizeof(achVariant) - 4);
+    CHECK(n > 0);
+    memcpy(achVariant + n, ".lsz", 5);
+
+    precompressor.setOptions(0, 1, 0);
+    //Nothing watches the roots, the request path compresses the files
+    CHECK(!precompressor.isCovering());
+    used = precompressor.getDiskUsed();
+    Compressor::getStats(Compressor::STATS_GZIP, &before);
+    CHECK(precompressor.precompressFile(achFile, len, fd, st,
+                                        SFCD_MODE_GZIP) == 1);
+    CHECK(stat(achVariant, &stVariant) == 0);
+    CHECK(stVariant.st_mtime == st.st_mtime);
+    CHECK(stVariant.st_size < st.st_size);
+    CHECK(precompressor.getDiskUsed() - used == stVariant.st_size);
+    //Not counted as the work of the request path
+    Compressor::getStats(Compressor::STATS_GZIP, &after);
+    CHECK(after.m_lBytesIn == before.m_lBytesIn);
+    CHECK(after.m_lUsec == before.m_lUsec);
+
+    //Up to date
+    CHECK(precompressor.precompressFile(achFile, len, fd, st,
+                                        SFCD_MODE_GZIP) == 0);
+    CHECK(precompressor.getDiskUsed() - used == stVariant.st_size);
+
+    //A new version replaces the variant, which is not counted twice
+    st.st_mtime -= 10;
+    CHECK(precompressor.precompressFile(achFile, len, fd, st,
+                                        SFCD_MODE_GZIP) == 1);
+    CHECK(stat(achVariant, &stVariant) == 0);
+    CHECK(stVariant.st_mtime == st.st_mtime);
+    CHECK(precompressor.getDiskUsed() - used == stVariant.st_size);
+
+    //Over the disk limit the stale variant is removed
+    precompressor.setOptions(0, 1, 1);
+    st.st_mtime -= 10;
+    CHECK(precompressor.precompressFile(achFile, len, fd, st,
+                                        SFCD_MODE_GZIP) == 0);
+    CHECK(stat(achVariant, &stVariant) == -1);
+    CHECK(precompressor.getDiskUsed() == used);
+
+    //The variant of a removed file goes with it
+    precompressor.setOptions(0, 1, 0);
+    CHECK(precompressor.precompressFile(achFile, len, fd, st,
+                                        SFCD_MODE_GZIP) == 1);
+    close(fd);
+    unlink(achFile);
+    CHECK(precompressor.precompress(achFile, len) == 0);
+    CHECK(stat(achVariant, &stVariant) == -1);
+    CHECK(precompressor.getDiskUsed() == used);
+
+    //"<dir>/<x>/<y>/<hash>"
+    *strrchr(achVariant, '/') = 0;
+    rmdir(achVariant);
+    *strrchr(achVariant, '/') = 0;
+    rmdir(achVariant);
+    rmdir(achDir);
+}
+
+#endif
+
+#endif
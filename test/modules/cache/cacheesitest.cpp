@@ -0,0 +1,110 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2022  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+#ifdef RUN_TEST
+
+#include <modules/cache/cacheesi.h>
+#include <util/autobuf.h>
+#include "unittest-cpp/UnitTest++.h"
+
+#include <string.h>
+
+
+static const char s_achShell[] =
+    "<p><esi:include src=\"/frag1\"/><b>"
+    "<esi:include data-src='/no' src='http://example.com/a?x=1&amp;y=2'>"
+    "</esi:include></b>"
+    "<esi:include src=/u/v/>"
+    "<esi:include src=//cdn.example.com/c/d ></p>";
+
+
+static int checkFragment(const CacheEsiMap &map, int i, int offset, int len,
+                         const char *pSrc)
+{
+    const CacheEsiFragment *pFragment = map.getFragment(i);
+    return pFragment->m_offset == offset && pFragment->m_len == len
+           && pFragment->m_src.len() == (int)strlen(pSrc)
+           && memcmp(pFragment->m_src.c_str(), pSrc, strlen(pSrc)) == 0;
+}
+
+
+TEST(CacheEsiMapTest_parse)
+{
+    CacheEsiMap map;
+    CHECK(map.parse(s_achShell, sizeof(s_achShell) - 1) == 4);
+    CHECK(checkFragment(map, 0, 3, 27, "/frag1"));
+    //The closing tag is part of it, an absolute URL keeps its path only
+    CHECK(checkFragment(map, 1, 33, 81, "/a?x=1&y=2"));
+    CHECK(checkFragment(map, 2, 118, 23, "/u/v"));
+    CHECK(checkFragment(map, 3, 141, 40, "/c/d"));
+
+    //Parsed again from scratch
+    CHECK(map.parse("<esi:include src=\"/x\"/>", 23) == 1);
+    CHECK(checkFragment(map, 0, 0, 23, "/x"));
+}
+
+
+TEST(CacheEsiMapTest_parseEmptySrc)
+{
+    const char *pBody = "<esi:include src=\"frag\"/><esi:include/>"
+                        "<esi:include src=\"/x\"";
+    CacheEsiMap map;
+    //A relative or missing src renders nothing, an unterminated tag is not
+    //an include
+    CHECK(map.parse(pBody, strlen(pBody)) == 2);
+    CHECK(checkFragment(map, 0, 0, 25, ""));
+    CHECK(checkFragment(map, 1, 25, 14, ""));
+
+    CHECK(map.parse("<p>no include</p>", 17) == 0);
+}
+
+
+TEST(CacheEsiMapTest_parseLimit)
+{
+    AutoBuf body;
+    CacheEsiMap map;
+    for (int i = 0; i < CACHE_ESI_MAX_FRAGMENTS + 6; ++i)
+        body.append("<esi:include src=\"/f\"/>", 23);
+    CHECK(map.parse(body.begin(), body.size()) == CACHE_ESI_MAX_FRAGMENTS);
+    CHECK(checkFragment(map, CACHE_ESI_MAX_FRAGMENTS - 1,
+                        (CACHE_ESI_MAX_FRAGMENTS - 1) * 23, 23, "/f"));
+}
+
+
+TEST(CacheEsiMapTest_saveLoad)
+{
+    AutoBuf buf;
+    CacheEsiMap map, loaded;
+    int bodyLen = sizeof(s_achShell) - 1;
+
+    map.parse(s_achShell, bodyLen);
+    int len = map.save(&buf);
+    CHECK(len == buf.size());
+    CHECK(CacheEsiMap::getSavedLen(buf.begin(), buf.size()) == len);
+    CHECK(loaded.load(buf.begin(), buf.size(), bodyLen) == LS_OK);
+    CHECK(loaded.getCount() == 4);
+    CHECK(checkFragment(loaded, 1, 33, 81, "/a?x=1&y=2"));
+    CHECK(checkFragment(loaded, 3, 141, 40, "/c/d"));
+
+    //A map that does not fit the body is dropped
+    CHECK(loaded.load(buf.begin(), buf.size(), 100) == LS_FAIL);
+    CHECK(loaded.getCount() == 0);
+    CHECK(loaded.load(buf.begin(), len - 1, bodyLen) == LS_FAIL);
+    CHECK(CacheEsiMap::getSavedLen("<p>", 3) == LS_FAIL);
+}
+
+#endif
@@ -0,0 +1,179 @@
+/*****************************************************************************
+*    Open LiteSpeed is an open source HTTP server.                           *
+*    Copyright (C) 2013 - 2022  LiteSpeed Technologies, Inc.                 *
+*                                                                            *
+*    This program is free software: you can redistribute it and/or modify    *
+*    it under the terms of the GNU General Public License as published by    *
+*    the Free Software Foundation, either version 3 of the License, or       *
+*    (at your option) any later version.                                     *
+*                                                                            *
+*    This program is distributed in the hope that it will be useful,         *
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the            *
+*    GNU General Public License for more details.                            *
+*                                                                            *
+*    You should have received a copy of the GNU General Public License       *
+*    along with this program. If not, see http://www.gnu.org/licenses/.      *
+*****************************************************************************/
+#ifdef RUN_TEST
+
+#ifdef USE_ZSTD
+
+#include <util/zstdbuf.h>
+#include <util/vmembuf.h>
+#include "unittest-cpp/UnitTest++.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+static int zstdRoundTrip(ZstdBuf &comp, ZstdBuf &decomp, const char *pBuf,
+                         int len, int *compressedLen)
+{
+    VMemBuf zstFile;
+    VMemBuf outFile;
+    char *p;
+    size_t size;
+    int total = 0;
+
+    zstFile.set(VMBUF_ANON_MAP, 4096);
+    outFile.set(VMBUF_ANON_MAP, 4096);
+    comp.setCompressCache(&zstFile);
+    if (comp.beginStream() != 0 || comp.write(pBuf, len) != len
+        || comp.endStream() != 0)
+        return -1;
+    *compressedLen = zstFile.getCurWOffset();
+
+    decomp.setCompressCache(&outFile);
+    if (decomp.beginStream() != 0)
+        return -1;
+    while ((p = zstFile.getReadBuffer(size)) != NULL && size > 0)
+    {
+        if (decomp.write(p, size) != (int)size)
+            return -1;
+        zstFile.readUsed(size);
+    }
+    if (decomp.endStream() != 0)
+        return -1;
+    while ((p = outFile.getReadBuffer(size)) != NULL && size > 0)
+    {
+        if (total + (int)size > len || memcmp(pBuf + total, p, size) != 0)
+            return -1;
+        total += size;
+        outFile.readUsed(size);
+    }
+    return total;
+}
+
+
+TEST(ZstdBufTest_testZstdFile)
+{
+    VMemBuf zstFile;
+    zstFile.set("zstdbuftest.zst" , -1);
+    ZstdBuf zstBuf;
+    CHECK(0 == zstBuf.init(ZstdBuf::COMPRESSOR_COMPRESS, 3));
+
+    char achBuf[8192];
+    memset(achBuf, 'A', 4096);
+    memset(achBuf + 4096, 'b', 4096);
+
+    zstBuf.setCompressCache(&zstFile);
+    CHECK(0 == zstBuf.beginStream());
+    CHECK(8192 == zstBuf.write(achBuf, 8192));
+    CHECK(0 == zstBuf.endStream());
+    zstFile.exactSize();
+    zstFile.close();
+
+    zstBuf.reset();
+    zstFile.deallocate();
+    zstFile.set("zstdbuftest2.zst", -1);
+
+    CHECK(0 == zstBuf.beginStream());
+    for (int i = 1; i < 1024; ++i)
+    {
+        CHECK(i == zstBuf.write(achBuf + 4096 - i / 2, i));
+        if (zstBuf.shouldFlush())
+            CHECK(0 == zstBuf.flush());
+    }
+    CHECK(0 == zstBuf.endStream());
+    zstFile.exactSize();
+    zstFile.close();
+}
+
+
+TEST(ZstdBufTest_testRoundTrip)
+{
+    ZstdBuf comp(ZstdBuf::COMPRESSOR_COMPRESS, 3);
+    ZstdBuf decomp(ZstdBuf::COMPRESSOR_DECOMPRESS, 0);
+    int len = 20000 * 4;
+    char *pBuf = (char *)malloc(len);
+    int compressedLen;
+    int num;
+    for (int i = 0; i < len; i += 4)
+    {
+        num = rand() % 64;
+        memcpy(pBuf + i, &num, 4);
+    }
+    CHECK(len == zstdRoundTrip(comp, decomp, pBuf, len, &compressedLen));
+    CHECK(compressedLen < len);
+
+    //Reused for the next stream
+    comp.reset();
+    decomp.reset();
+    CHECK(len == zstdRoundTrip(comp, decomp, pBuf, len, &compressedLen));
+    free(pBuf);
+}
+
+
+TEST(ZstdBufTest_testDictionary)
+{
+    static const char s_achDict[] =
+        "<!DOCTYPE html><html><head><meta charset=\"utf-8\"><title>"
+        "</title><link rel=\"stylesheet\" href=\"/css/site.css\"></head>"
+        "<body><div class=\"container\"><div class=\"row\"></div></div>"
+        "</body></html>";
+    static const char s_achPage[] =
+        "<!DOCTYPE html><html><head><meta charset=\"utf-8\"><title>Home"
+        "</title><link rel=\"stylesheet\" href=\"/css/site.css\"></head>"
+        "<body><div class=\"container\"><div class=\"row\">Hello</div></div>"
+        "</body></html>";
+    int plainLen;
+    int dictLen;
+
+    ZstdBuf comp(ZstdBuf::COMPRESSOR_COMPRESS, 3);
+    ZstdBuf decomp(ZstdBuf::COMPRESSOR_DECOMPRESS, 0);
+    CHECK((int)sizeof(s_achPage) - 1 == zstdRoundTrip(comp, decomp,
+          s_achPage, sizeof(s_achPage) - 1, &plainLen));
+
+    ZstdBuf dictComp;
+    ZstdBuf dictDecomp;
+    dictComp.setDictionary(s_achDict, sizeof(s_achDict) - 1);
+    dictDecomp.setDictionary(s_achDict, sizeof(s_achDict) - 1);
+    CHECK(0 == dictComp.init(ZstdBuf::COMPRESSOR_COMPRESS, 3));
+    CHECK(0 == dictDecomp.init(ZstdBuf::COMPRESSOR_DECOMPRESS, 0));
+    CHECK((int)sizeof(s_achPage) - 1 == zstdRoundTrip(dictComp, dictDecomp,
+          s_achPage, sizeof(s_achPage) - 1, &dictLen));
+    CHECK(dictLen < plainLen);
+
+    //Without the dictionary the stream does not decode
+    VMemBuf zstFile;
+    VMemBuf outFile;
+    char *p;
+    size_t size;
+    zstFile.set(VMBUF_ANON_MAP, 4096);
+    outFile.set(VMBUF_ANON_MAP, 4096);
+    dictComp.reset();
+    dictComp.setCompressCache(&zstFile);
+    CHECK(0 == dictComp.beginStream());
+    dictComp.write(s_achPage, sizeof(s_achPage) - 1);
+    CHECK(0 == dictComp.endStream());
+    decomp.reset();
+    decomp.setCompressCache(&outFile);
+    CHECK(0 == decomp.beginStream());
+    p = zstFile.getReadBuffer(size);
+    CHECK(-1 == decomp.write(p, size));
+    CHECK(decomp.getLastError() != NULL);
+}
+
+#endif
+#endif